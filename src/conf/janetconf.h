@@ -26,17 +26,24 @@
 /* #define JANET_NO_PROCESSES */
 /* #define JANET_NO_ASSEMBLER */
 /* #define JANET_NO_PEG */
+/* #define JANET_NO_JSON */
 /* #define JANET_NO_NET */
 /* #define JANET_NO_INT_TYPES */
+/* #define JANET_NO_TYPED_ARRAY */
 /* #define JANET_NO_EV */
 /* #define JANET_NO_REALPATH */
 /* #define JANET_NO_SYMLINKS */
 /* #define JANET_NO_UMASK */
 /* #define JANET_NO_THREADS */
+/* #define JANET_NO_GC_POOL */
+/* #define JANET_NO_JIT */
 
 /* Other settings */
 /* #define JANET_DEBUG */
 /* #define JANET_PRF */
+/* #define JANET_PRF_HALFSIPHASH */
+/* #define JANET_OPCODE_STATS */
+/* #define JANET_USDT */
 /* #define JANET_NO_UTC_MKTIME */
 /* #define JANET_OUT_OF_MEMORY do { printf("janet out of memory\n"); exit(1); } while (0) */
 /* #define JANET_EXIT(msg) do { printf("C assert failed executing janet: %s\n", msg); exit(1); } while (0) */
@@ -45,10 +52,12 @@
 /* #define JANET_MAX_PROTO_DEPTH 200 */
 /* #define JANET_MAX_MACRO_EXPAND 200 */
 /* #define JANET_STACK_MAX 16384 */
+/* #define JANET_THREAD_POOL_SIZE 32 */
 /* #define JANET_OS_NAME my-custom-os */
 /* #define JANET_ARCH_NAME pdp-8 */
 /* #define JANET_EV_NO_EPOLL */
 /* #define JANET_EV_NO_KQUEUE */
+/* #define JANET_EV_URING */
 /* #define JANET_NO_INTERPRETER_INTERRUPT */
 
 /* Custom vm allocator support */
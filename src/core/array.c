@@ -26,8 +26,10 @@
 #include "gc.h"
 #include "util.h"
 #include "state.h"
+#include "compile.h"
 #endif
 
+#include <math.h>
 #include <string.h>
 
 /* Creates a new array */
@@ -98,6 +100,7 @@ void janet_array_push(JanetArray *array, Janet x) {
     }
     int32_t newcount = array->count + 1;
     janet_array_ensure(array, newcount, 2);
+    janet_gc_barrier_value(array, x);
     array->data[array->count] = x;
     array->count = newcount;
 }
@@ -122,6 +125,15 @@ Janet janet_array_peek(JanetArray *array) {
 
 /* C Functions */
 
+/* Unwrap an array argument without the whole array write barrier of janet_getarray.
+ * The functions below use janet_gc_barrier_value for every new reference they store. */
+static JanetArray *getarray(const Janet *argv, int32_t n) {
+    if (!janet_checktype(argv[n], JANET_ARRAY)) {
+        janet_panic_type(argv[n], n, JANET_TFLAG_ARRAY);
+    }
+    return janet_unwrap_array(argv[n]);
+}
+
 JANET_CORE_FN(cfun_array_new,
               "(array/new capacity)",
               "Creates a new empty array with a pre-allocated capacity. The same as "
@@ -151,8 +163,9 @@ JANET_CORE_FN(cfun_array_fill,
               "Replace all elements of an array with `value` (defaulting to nil) without changing the length of the array. "
               "Returns the modified array.") {
     janet_arity(argc, 1, 2);
-    JanetArray *array = janet_getarray(argv, 0);
+    JanetArray *array = getarray(argv, 0);
     Janet x = (argc == 2) ? argv[1] : janet_wrap_nil();
+    janet_gc_barrier_value(array, x);
     for (int32_t i = 0; i < array->count; i++) {
         array->data[i] = x;
     }
@@ -164,7 +177,7 @@ JANET_CORE_FN(cfun_array_pop,
               "Remove the last element of the array and return it. If the array is empty, will return nil. Modifies "
               "the input array.") {
     janet_fixarity(argc, 1);
-    JanetArray *array = janet_getarray(argv, 0);
+    JanetArray *array = getarray(argv, 0);
     return janet_array_pop(array);
 }
 
@@ -172,7 +185,7 @@ JANET_CORE_FN(cfun_array_peek,
               "(array/peek arr)",
               "Returns the last element of the array. Does not modify the array.") {
     janet_fixarity(argc, 1);
-    JanetArray *array = janet_getarray(argv, 0);
+    JanetArray *array = getarray(argv, 0);
     return janet_array_peek(array);
 }
 
@@ -180,12 +193,15 @@ JANET_CORE_FN(cfun_array_push,
               "(array/push arr x)",
               "Insert an element in the end of an array. Modifies the input array and returns it.") {
     janet_arity(argc, 1, -1);
-    JanetArray *array = janet_getarray(argv, 0);
+    JanetArray *array = getarray(argv, 0);
     if (INT32_MAX - argc + 1 <= array->count) {
         janet_panic("array overflow");
     }
     int32_t newcount = array->count - 1 + argc;
     janet_array_ensure(array, newcount, 2);
+    for (int32_t i = 1; i < argc; i++) {
+        janet_gc_barrier_value(array, argv[i]);
+    }
     if (argc > 1) memcpy(array->data + array->count, argv + 1, (size_t)(argc - 1) * sizeof(Janet));
     array->count = newcount;
     return argv[0];
@@ -198,7 +214,7 @@ JANET_CORE_FN(cfun_array_ensure,
               "If the backing capacity is already enough, then this function does nothing. "
               "Otherwise, the backing memory will be reallocated so that there is enough space.") {
     janet_fixarity(argc, 3);
-    JanetArray *array = janet_getarray(argv, 0);
+    JanetArray *array = getarray(argv, 0);
     int32_t newcount = janet_getinteger(argv, 1);
     int32_t growth = janet_getinteger(argv, 2);
     if (newcount < 1) janet_panic("expected positive integer");
@@ -230,7 +246,7 @@ JANET_CORE_FN(cfun_array_concat,
               "Return the modified array `arr`.") {
     int32_t i;
     janet_arity(argc, 1, -1);
-    JanetArray *array = janet_getarray(argv, 0);
+    JanetArray *array = getarray(argv, 0);
     for (i = 1; i < argc; i++) {
         switch (janet_type(argv[i])) {
             default:
@@ -263,7 +279,7 @@ JANET_CORE_FN(cfun_array_insert,
               "Returns the array.") {
     size_t chunksize, restsize;
     janet_arity(argc, 2, -1);
-    JanetArray *array = janet_getarray(argv, 0);
+    JanetArray *array = getarray(argv, 0);
     int32_t at = janet_getinteger(argv, 1);
     if (at < 0) {
         at = array->count + at + 1;
@@ -281,6 +297,9 @@ JANET_CORE_FN(cfun_array_insert,
                 array->data + at,
                 restsize);
     }
+    for (int32_t i = 2; i < argc; i++) {
+        janet_gc_barrier_value(array, argv[i]);
+    }
     safe_memcpy(array->data + at, argv + 2, chunksize);
     array->count += (argc - 2);
     return argv[0];
@@ -293,7 +312,7 @@ JANET_CORE_FN(cfun_array_remove,
               "By default, `n` is 1. "
               "Returns the array.") {
     janet_arity(argc, 2, 3);
-    JanetArray *array = janet_getarray(argv, 0);
+    JanetArray *array = getarray(argv, 0);
     int32_t at = janet_getinteger(argv, 1);
     int32_t n = 1;
     if (at < 0) {
@@ -320,7 +339,7 @@ JANET_CORE_FN(cfun_array_trim,
               "(array/trim arr)",
               "Set the backing capacity of an array to its current length. Returns the modified array.") {
     janet_fixarity(argc, 1);
-    JanetArray *array = janet_getarray(argv, 0);
+    JanetArray *array = getarray(argv, 0);
     if (array->count) {
         if (array->count < array->capacity) {
             Janet *newData = janet_realloc(array->data, array->count * sizeof(Janet));
@@ -343,12 +362,521 @@ JANET_CORE_FN(cfun_array_clear,
               "Empties an array, setting it's count to 0 but does not free the backing capacity. "
               "Returns the modified array.") {
     janet_fixarity(argc, 1);
-    JanetArray *array = janet_getarray(argv, 0);
+    JanetArray *array = getarray(argv, 0);
     array->count = 0;
     return argv[0];
 }
 
 /* Load the array module */
+/* Sorting. Unstable sorts use pattern-defeating quicksort, which falls back
+ * to heapsort on bad pivots, and stable sorts use a bottom up merge sort
+ * over insertion sorted runs that skips merging runs already in order. The
+ * comparison goes through a function pointer so native orders on numbers
+ * and janet_compare avoid calling into the VM. Loops check their bounds
+ * themselves, so an inconsistent comparator gives an unspecified order but
+ * never reads outside the array. */
+
+#define JANET_SORT_INSERTION 24
+#define JANET_SORT_NINTHER 128
+#define JANET_SORT_RUN 32
+
+typedef struct JanetSorter JanetSorter;
+struct JanetSorter {
+    int (*before)(JanetSorter *s, Janet a, Janet b);
+    Janet fn;
+    const Janet *keys;
+};
+
+#define sort_before(s, a, b) ((s)->before((s), (a), (b)))
+
+/* NaN sorts after every other number in both orders, so the native
+ * comparisons stay a total order on arrays that contain it */
+static int sort_before_double(double x, double y) {
+    return x < y || (isnan(y) && !isnan(x));
+}
+
+static int sort_before_number(JanetSorter *s, Janet a, Janet b) {
+    (void) s;
+    return sort_before_double(janet_unwrap_number(a), janet_unwrap_number(b));
+}
+
+static int sort_after_number(JanetSorter *s, Janet a, Janet b) {
+    (void) s;
+    double x = janet_unwrap_number(a);
+    double y = janet_unwrap_number(b);
+    return y < x || (isnan(y) && !isnan(x));
+}
+
+static int sort_before_compare(JanetSorter *s, Janet a, Janet b) {
+    (void) s;
+    return janet_compare(a, b) < 0;
+}
+
+static int sort_after_compare(JanetSorter *s, Janet a, Janet b) {
+    (void) s;
+    return janet_compare(b, a) < 0;
+}
+
+static Janet sort_call(Janet fn, int32_t argc, Janet *argv) {
+    if (janet_checktype(fn, JANET_CFUNCTION)) {
+        return janet_unwrap_cfunction(fn)(argc, argv);
+    }
+    return janet_call(janet_unwrap_function(fn), argc, argv);
+}
+
+static int sort_before_call(JanetSorter *s, Janet a, Janet b) {
+    Janet args[2] = {a, b};
+    return janet_truthy(sort_call(s->fn, 2, args));
+}
+
+/* For sort-by, elements are indices into the precomputed keys */
+static int sort_before_key_number(JanetSorter *s, Janet a, Janet b) {
+    return sort_before_double(janet_unwrap_number(s->keys[(int32_t) janet_unwrap_number(a)]),
+                              janet_unwrap_number(s->keys[(int32_t) janet_unwrap_number(b)]));
+}
+
+static int sort_before_key_compare(JanetSorter *s, Janet a, Janet b) {
+    return janet_compare(s->keys[(int32_t) janet_unwrap_number(a)],
+                         s->keys[(int32_t) janet_unwrap_number(b)]) < 0;
+}
+
+static void sort_swap(Janet *a, int32_t i, int32_t j) {
+    Janet tmp = a[i];
+    a[i] = a[j];
+    a[j] = tmp;
+}
+
+/* A comparator that calls back into Janet may collect garbage, so every
+ * comparison is made while both values are still in the array. */
+static void sort_insertion(JanetSorter *s, Janet *a, int32_t lo, int32_t hi) {
+    for (int32_t i = lo + 1; i < hi; i++) {
+        Janet x = a[i];
+        int32_t j = i;
+        while (j > lo && sort_before(s, x, a[j - 1])) j--;
+        if (j < i) {
+            memmove(a + j + 1, a + j, (size_t)(i - j) * sizeof(Janet));
+            a[j] = x;
+        }
+    }
+}
+
+/* Insertion sort that gives up after moving more than a few elements */
+static int sort_partial_insertion(JanetSorter *s, Janet *a, int32_t lo, int32_t hi) {
+    int32_t moved = 0;
+    for (int32_t i = lo + 1; i < hi; i++) {
+        if (moved > 8) return 0;
+        Janet x = a[i];
+        int32_t j = i;
+        while (j > lo && sort_before(s, x, a[j - 1])) j--;
+        if (j < i) {
+            memmove(a + j + 1, a + j, (size_t)(i - j) * sizeof(Janet));
+            a[j] = x;
+            moved += i - j;
+        }
+    }
+    return 1;
+}
+
+static void sort3(JanetSorter *s, Janet *a, int32_t i, int32_t j, int32_t k) {
+    if (sort_before(s, a[j], a[i])) sort_swap(a, i, j);
+    if (sort_before(s, a[k], a[j])) {
+        sort_swap(a, j, k);
+        if (sort_before(s, a[j], a[i])) sort_swap(a, i, j);
+    }
+}
+
+static void sort_siftdown(JanetSorter *s, Janet *a, int32_t root, int32_t n) {
+    for (;;) {
+        int32_t child = 2 * root + 1;
+        if (child >= n) break;
+        if (child + 1 < n && sort_before(s, a[child], a[child + 1])) child++;
+        if (!sort_before(s, a[root], a[child])) break;
+        sort_swap(a, root, child);
+        root = child;
+    }
+}
+
+static void sort_heap(JanetSorter *s, Janet *a, int32_t lo, int32_t hi) {
+    Janet *base = a + lo;
+    int32_t n = hi - lo;
+    for (int32_t i = n / 2 - 1; i >= 0; i--) sort_siftdown(s, base, i, n);
+    for (int32_t i = n - 1; i > 0; i--) {
+        sort_swap(base, 0, i);
+        sort_siftdown(s, base, 0, i);
+    }
+}
+
+/* Partition around the pivot a[lo]. Elements equal to the pivot go right.
+ * Sets *already if no elements had to be swapped. */
+static int32_t sort_partition_right(JanetSorter *s, Janet *a, int32_t lo, int32_t hi, int *already) {
+    Janet pivot = a[lo];
+    int32_t first = lo;
+    int32_t last = hi;
+    while (++first < hi && sort_before(s, a[first], pivot));
+    if (first - 1 == lo) {
+        while (first < last && !sort_before(s, a[--last], pivot));
+    } else {
+        while (--last > lo && !sort_before(s, a[last], pivot));
+    }
+    *already = first >= last;
+    while (first < last) {
+        sort_swap(a, first, last);
+        while (++first < hi && sort_before(s, a[first], pivot));
+        while (--last > lo && !sort_before(s, a[last], pivot));
+    }
+    int32_t pos = first - 1;
+    a[lo] = a[pos];
+    a[pos] = pivot;
+    return pos;
+}
+
+/* Partition around the pivot a[lo], putting elements equal to it on the
+ * left. Used when the pivot equals the element before the range, so the
+ * whole left side can be skipped. */
+static int32_t sort_partition_left(JanetSorter *s, Janet *a, int32_t lo, int32_t hi) {
+    Janet pivot = a[lo];
+    int32_t first = lo;
+    int32_t last = hi;
+    while (--last > lo && sort_before(s, pivot, a[last]));
+    while (++first < last && !sort_before(s, pivot, a[first]));
+    while (first < last) {
+        sort_swap(a, first, last);
+        while (--last > lo && sort_before(s, pivot, a[last]));
+        while (++first < hi && !sort_before(s, pivot, a[first]));
+    }
+    a[lo] = a[last];
+    a[last] = pivot;
+    return last;
+}
+
+static void sort_pdq_loop(JanetSorter *s, Janet *a, int32_t lo, int32_t hi, int bad_allowed, int leftmost) {
+    for (;;) {
+        int32_t size = hi - lo;
+        if (size < JANET_SORT_INSERTION) {
+            sort_insertion(s, a, lo, hi);
+            return;
+        }
+
+        /* Move the median of 3, or the pseudomedian of 9, to a[lo] */
+        int32_t half = size / 2;
+        if (size > JANET_SORT_NINTHER) {
+            sort3(s, a, lo, lo + half, hi - 1);
+            sort3(s, a, lo + 1, lo + (half - 1), hi - 2);
+            sort3(s, a, lo + 2, lo + (half + 1), hi - 3);
+            sort3(s, a, lo + (half - 1), lo + half, lo + (half + 1));
+            sort_swap(a, lo, lo + half);
+        } else {
+            sort3(s, a, lo + half, lo, hi - 1);
+        }
+
+        /* If the pivot equals the element before this range, which is no
+         * greater than anything in it, everything equal to the pivot is
+         * already in place. */
+        if (!leftmost && !sort_before(s, a[lo - 1], a[lo])) {
+            lo = sort_partition_left(s, a, lo, hi) + 1;
+            continue;
+        }
+
+        int already;
+        int32_t pos = sort_partition_right(s, a, lo, hi, &already);
+        int32_t lsize = pos - lo;
+        int32_t rsize = hi - (pos + 1);
+        if (lsize < size / 8 || rsize < size / 8) {
+            /* Unbalanced, so shuffle some elements to break up patterns,
+             * or give up on quicksort after too many bad pivots. */
+            if (--bad_allowed == 0) {
+                sort_heap(s, a, lo, hi);
+                return;
+            }
+            if (lsize >= JANET_SORT_INSERTION) {
+                sort_swap(a, lo, lo + lsize / 4);
+                sort_swap(a, pos - 1, pos - lsize / 4);
+                if (lsize > JANET_SORT_NINTHER) {
+                    sort_swap(a, lo + 1, lo + (lsize / 4 + 1));
+                    sort_swap(a, lo + 2, lo + (lsize / 4 + 2));
+                    sort_swap(a, pos - 2, pos - (lsize / 4 + 1));
+                    sort_swap(a, pos - 3, pos - (lsize / 4 + 2));
+                }
+            }
+            if (rsize >= JANET_SORT_INSERTION) {
+                sort_swap(a, pos + 1, pos + (1 + rsize / 4));
+                sort_swap(a, hi - 1, hi - rsize / 4);
+                if (rsize > JANET_SORT_NINTHER) {
+                    sort_swap(a, pos + 2, pos + (2 + rsize / 4));
+                    sort_swap(a, pos + 3, pos + (3 + rsize / 4));
+                    sort_swap(a, hi - 2, hi - (1 + rsize / 4));
+                    sort_swap(a, hi - 3, hi - (2 + rsize / 4));
+                }
+            }
+        } else if (already &&
+                   sort_partial_insertion(s, a, lo, pos) &&
+                   sort_partial_insertion(s, a, pos + 1, hi)) {
+            /* Probably sorted already */
+            return;
+        }
+
+        sort_pdq_loop(s, a, lo, pos, bad_allowed, leftmost);
+        lo = pos + 1;
+        leftmost = 0;
+    }
+}
+
+static void sort_unstable(JanetSorter *s, Janet *a, int32_t n) {
+    int bad_allowed = 1;
+    for (int32_t m = n; m > 1; m >>= 1) bad_allowed++;
+    sort_pdq_loop(s, a, 0, n, bad_allowed, 1);
+}
+
+/* Stable sort using buf, which has room for n values */
+static void sort_stable(JanetSorter *s, Janet *a, int32_t n, Janet *buf) {
+    for (int32_t lo = 0; lo < n; lo += JANET_SORT_RUN) {
+        sort_insertion(s, a, lo, lo + JANET_SORT_RUN < n ? lo + JANET_SORT_RUN : n);
+    }
+    for (int32_t width = JANET_SORT_RUN; width < n; width *= 2) {
+        for (int32_t lo = 0; lo < n - width; lo += 2 * width) {
+            int32_t mid = lo + width;
+            int32_t hi = width < n - mid ? mid + width : n;
+            if (!sort_before(s, a[mid], a[mid - 1])) continue;
+            memcpy(buf, a + lo, (size_t) width * sizeof(Janet));
+            int32_t i = 0, j = mid, k = lo;
+            while (i < width && j < hi) {
+                if (sort_before(s, a[j], buf[i])) {
+                    a[k++] = a[j++];
+                } else {
+                    a[k++] = buf[i++];
+                }
+            }
+            while (i < width) a[k++] = buf[i++];
+        }
+        if (width > INT32_MAX / 2) break;
+    }
+}
+
+static int sort_all_numbers(const Janet *a, int32_t n) {
+    for (int32_t i = 0; i < n; i++) {
+        if (!janet_checktype(a[i], JANET_NUMBER)) return 0;
+    }
+    return 1;
+}
+
+/* Returns 0 for nil and <, 1 for >, or -1 if before? has to be called */
+static int sort_native_order(Janet before) {
+    if (janet_checktype(before, JANET_NIL)) return 0;
+    if (!janet_checktype(before, JANET_FUNCTION)) return -1;
+    uint32_t tag = janet_unwrap_function(before)->def->flags & JANET_FUNCDEF_FLAG_TAG;
+    if (tag == JANET_FUN_LT) return 0;
+    if (tag == JANET_FUN_GT) return 1;
+    return -1;
+}
+
+/* Pick a native comparison for nil, < and >, or NULL if before? has to be called */
+static int (*sort_native(Janet before, const Janet *a, int32_t n))(JanetSorter *, Janet, Janet) {
+    int reverse = sort_native_order(before);
+    if (reverse < 0) return NULL;
+    if (sort_all_numbers(a, n)) {
+        return reverse ? sort_after_number : sort_before_number;
+    }
+    return reverse ? sort_after_compare : sort_before_compare;
+}
+
+/* Sort an array with a comparator that calls into Janet. The values are
+ * sorted in a copy that is a gc root, together with the merge buffer, so
+ * the comparator can neither collect them nor resize them away, and the
+ * root is released if the comparator raises an error. */
+static void sort_with_callback(JanetArray *array, Janet before, int stable) {
+    int32_t n = array->count;
+    if (n > INT32_MAX / 2) janet_panic("array too large to sort");
+    int32_t size = stable ? 2 * n : n;
+    JanetArray *work = janet_array(size);
+    safe_memcpy(work->data, array->data, (size_t) n * sizeof(Janet));
+    for (int32_t i = n; i < size; i++) work->data[i] = janet_wrap_nil();
+    work->count = size;
+    janet_gc_barrier(work);
+    Janet root = janet_wrap_array(work);
+    janet_gcroot(root);
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    if (!signal) {
+        JanetSorter s = {sort_before_call, before, NULL};
+        if (stable) {
+            sort_stable(&s, work->data, n, work->data + n);
+        } else {
+            sort_unstable(&s, work->data, n);
+        }
+        janet_restore(&tstate);
+    } else {
+        janet_restore(&tstate);
+        janet_gcunroot(root);
+        janet_signalv(signal, tstate.payload);
+    }
+    janet_gcunroot(root);
+    if (array->count != n) janet_panic("array length changed during sort");
+    safe_memcpy(array->data, work->data, (size_t) n * sizeof(Janet));
+    janet_gc_barrier(array);
+}
+
+static void sort_array(JanetArray *array, Janet before, int stable) {
+    int (*native)(JanetSorter *, Janet, Janet) = sort_native(before, array->data, array->count);
+    if (native) {
+        JanetSorter s = {native, janet_wrap_nil(), NULL};
+        if (stable) {
+            Janet *buf = janet_smalloc((size_t) array->count * sizeof(Janet));
+            sort_stable(&s, array->data, array->count, buf);
+            janet_sfree(buf);
+        } else {
+            sort_unstable(&s, array->data, array->count);
+        }
+    } else {
+        if (!janet_checktypes(before, JANET_TFLAG_FUNCTION | JANET_TFLAG_CFUNCTION))
+            janet_panic_type(before, 1, JANET_TFLAG_FUNCTION | JANET_TFLAG_CFUNCTION);
+        sort_with_callback(array, before, stable);
+    }
+}
+
+static void sort_by_array(Janet f, JanetArray *array) {
+    int32_t n = array->count;
+
+    /* Compute the keys into a gc root, since f may collect garbage */
+    JanetArray *keys = janet_array(n);
+    for (int32_t i = 0; i < n; i++) keys->data[i] = janet_wrap_nil();
+    keys->count = n;
+    Janet root = janet_wrap_array(keys);
+    janet_gcroot(root);
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    if (!signal) {
+        for (int32_t i = 0; i < n; i++) {
+            if (array->count != n) janet_panic("array length changed during sort");
+            Janet x = array->data[i];
+            Janet key = sort_call(f, 1, &x);
+            janet_gc_barrier_value(keys, key);
+            keys->data[i] = key;
+        }
+        janet_restore(&tstate);
+    } else {
+        janet_restore(&tstate);
+        janet_gcunroot(root);
+        janet_signalv(signal, tstate.payload);
+    }
+    janet_gcunroot(root);
+    if (array->count != n) janet_panic("array length changed during sort");
+
+    /* Sort indices by key, then permute. Nothing here allocates gc memory. */
+    Janet *order = janet_smalloc((size_t) n * 3 * sizeof(Janet) + 1);
+    Janet *buf = order + n;
+    Janet *values = buf + n;
+    for (int32_t i = 0; i < n; i++) order[i] = janet_wrap_integer(i);
+    JanetSorter s = {
+        sort_all_numbers(keys->data, n) ? sort_before_key_number : sort_before_key_compare,
+        janet_wrap_nil(),
+        keys->data
+    };
+    sort_stable(&s, order, n, buf);
+    safe_memcpy(values, array->data, (size_t) n * sizeof(Janet));
+    for (int32_t i = 0; i < n; i++) {
+        array->data[i] = values[(int32_t) janet_unwrap_number(order[i])];
+    }
+    janet_sfree(order);
+}
+
+/* Buffers sort their bytes. The native orders count the bytes, and
+ * comparators or key functions see each byte as a number, sorted in a
+ * temporary array that is a gc root while they run. */
+static void sort_bytes(uint8_t *bytes, int32_t n, int reverse) {
+    int32_t counts[256] = {0};
+    for (int32_t i = 0; i < n; i++) counts[bytes[i]]++;
+    int32_t k = 0;
+    for (int i = 0; i < 256; i++) {
+        int byte = reverse ? 255 - i : i;
+        memset(bytes + k, byte, (size_t) counts[byte]);
+        k += counts[byte];
+    }
+}
+
+static void sort_buffer_values(JanetBuffer *buffer, Janet fn, int stable, int by) {
+    int32_t n = buffer->count;
+    JanetArray *values = janet_array(n);
+    for (int32_t i = 0; i < n; i++) values->data[i] = janet_wrap_integer(buffer->data[i]);
+    values->count = n;
+    Janet root = janet_wrap_array(values);
+    janet_gcroot(root);
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    if (!signal) {
+        if (by) {
+            sort_by_array(fn, values);
+        } else {
+            sort_array(values, fn, stable);
+        }
+        janet_restore(&tstate);
+    } else {
+        janet_restore(&tstate);
+        janet_gcunroot(root);
+        janet_signalv(signal, tstate.payload);
+    }
+    janet_gcunroot(root);
+    if (buffer->count != n) janet_panic("buffer length changed during sort");
+    for (int32_t i = 0; i < n; i++) {
+        buffer->data[i] = (uint8_t) janet_unwrap_integer(values->data[i]);
+    }
+}
+
+static Janet sort_impl(int32_t argc, Janet *argv, int stable) {
+    janet_arity(argc, 1, 2);
+    Janet before = argc > 1 ? argv[1] : janet_wrap_nil();
+    if (janet_checktype(argv[0], JANET_BUFFER)) {
+        JanetBuffer *buffer = janet_unwrap_buffer(argv[0]);
+        int reverse = sort_native_order(before);
+        if (reverse >= 0) {
+            sort_bytes(buffer->data, buffer->count, reverse);
+        } else {
+            sort_buffer_values(buffer, before, stable, 0);
+        }
+        return argv[0];
+    }
+    if (!janet_checktype(argv[0], JANET_ARRAY))
+        janet_panic_type(argv[0], 0, JANET_TFLAG_ARRAY | JANET_TFLAG_BUFFER);
+    sort_array(janet_unwrap_array(argv[0]), before, stable);
+    return argv[0];
+}
+
+JANET_CORE_FN(cfun_array_sort,
+              "(sort ind &opt before?)",
+              "Sort the array or buffer `ind` in-place, and return it. Uses pattern-defeating "
+              "quicksort and is not a stable sort. If a `before?` comparator function is provided, "
+              "sorts elements using that, otherwise uses `<`. Sorting with `<` or `>` compares "
+              "elements natively without calling the comparator, and NaN sorts after every "
+              "other number.") {
+    return sort_impl(argc, argv, 0);
+}
+
+JANET_CORE_FN(cfun_array_sort_stable,
+              "(sort-stable ind &opt before?)",
+              "Sort the array or buffer `ind` in-place like `sort`, and return it. The sort is "
+              "stable, so elements that compare equal keep their order. Uses merge sort, which is "
+              "faster than `sort` on input that is already partly in order.") {
+    return sort_impl(argc, argv, 1);
+}
+
+JANET_CORE_FN(cfun_array_sort_by,
+              "(sort-by f ind)",
+              "Sort the array or buffer `ind` in-place by calling a function `f` on each element "
+              "and comparing the results with `<`, and return it. `f` is called once per element, "
+              "and the sort is stable.") {
+    janet_fixarity(argc, 2);
+    Janet f = argv[0];
+    if (!janet_checktypes(f, JANET_TFLAG_FUNCTION | JANET_TFLAG_CFUNCTION))
+        janet_panic_type(f, 0, JANET_TFLAG_FUNCTION | JANET_TFLAG_CFUNCTION);
+    if (janet_checktype(argv[1], JANET_BUFFER)) {
+        sort_buffer_values(janet_unwrap_buffer(argv[1]), f, 0, 1);
+        return argv[1];
+    }
+    if (!janet_checktype(argv[1], JANET_ARRAY))
+        janet_panic_type(argv[1], 1, JANET_TFLAG_ARRAY | JANET_TFLAG_BUFFER);
+    sort_by_array(f, janet_unwrap_array(argv[1]));
+    return argv[1];
+}
+
 void janet_lib_array(JanetTable *env) {
     JanetRegExt array_cfuns[] = {
         JANET_CORE_REG("array/new", cfun_array_new),
@@ -364,6 +892,9 @@ void janet_lib_array(JanetTable *env) {
         JANET_CORE_REG("array/remove", cfun_array_remove),
         JANET_CORE_REG("array/trim", cfun_array_trim),
         JANET_CORE_REG("array/clear", cfun_array_clear),
+        JANET_CORE_REG("sort", cfun_array_sort),
+        JANET_CORE_REG("sort-stable", cfun_array_sort_stable),
+        JANET_CORE_REG("sort-by", cfun_array_sort_by),
         JANET_REG_END
     };
     janet_core_cfuns_ext(env, NULL, array_cfuns);
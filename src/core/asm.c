@@ -28,8 +28,8 @@
 
 #include <setjmp.h>
 
-/* Conditionally compile this file */
-#ifdef JANET_ASSEMBLER
+/* The instruction names are also used to report opcode statistics */
+#if defined(JANET_ASSEMBLER) || defined(JANET_OPCODE_STATS)
 
 /* Definition for an instruction in the assembler */
 typedef struct JanetInstructionDef JanetInstructionDef;
@@ -38,26 +38,6 @@ struct JanetInstructionDef {
     enum JanetOpCode opcode;
 };
 
-/* Hold all state needed during assembly */
-typedef struct JanetAssembler JanetAssembler;
-struct JanetAssembler {
-    JanetAssembler *parent;
-    JanetFuncDef *def;
-    jmp_buf on_error;
-    const uint8_t *errmessage;
-    int32_t errindex;
-
-    int32_t environments_capacity;
-    int32_t defs_capacity;
-    int32_t bytecode_count; /* Used for calculating labels */
-
-    Janet name;
-    JanetTable labels; /* keyword -> bytecode index */
-    JanetTable slots; /* symbol -> slot index */
-    JanetTable envs; /* symbol -> environment index */
-    JanetTable defs; /* symbol -> funcdefs index */
-};
-
 /* Janet opcode descriptions in lexicographic order. This
  * allows a binary search over the elements to find the
  * correct opcode given a name. This works in reasonable
@@ -66,6 +46,9 @@ struct JanetAssembler {
 static const JanetInstructionDef janet_ops[] = {
     {"add", JOP_ADD},
     {"addim", JOP_ADD_IMMEDIATE},
+    {"addimjmp", JOP_ADD_IMMEDIATE_JUMP},
+    {"addimn", JOP_ADD_IMMEDIATE_NUMBER},
+    {"addn", JOP_ADD_NUMBER},
     {"band", JOP_BAND},
     {"bnot", JOP_BNOT},
     {"bor", JOP_BOR},
@@ -76,20 +59,30 @@ static const JanetInstructionDef janet_ops[] = {
     {"cncl", JOP_CANCEL},
     {"div", JOP_DIVIDE},
     {"divim", JOP_DIVIDE_IMMEDIATE},
+    {"divimn", JOP_DIVIDE_IMMEDIATE_NUMBER},
+    {"divn", JOP_DIVIDE_NUMBER},
     {"eq", JOP_EQUALS},
     {"eqim", JOP_EQUALS_IMMEDIATE},
+    {"eqimjno", JOP_EQUALS_IMMEDIATE_JUMP_IF_NOT},
+    {"eqjno", JOP_EQUALS_JUMP_IF_NOT},
     {"err", JOP_ERROR},
     {"get", JOP_GET},
     {"geti", JOP_GET_INDEX},
     {"gt", JOP_GREATER_THAN},
     {"gte", JOP_GREATER_THAN_EQUAL},
+    {"gtejno", JOP_GREATER_THAN_EQUAL_JUMP_IF_NOT},
+    {"gten", JOP_GREATER_THAN_EQUAL_NUMBER},
     {"gtim", JOP_GREATER_THAN_IMMEDIATE},
+    {"gtimjno", JOP_GREATER_THAN_IMMEDIATE_JUMP_IF_NOT},
+    {"gtjno", JOP_GREATER_THAN_JUMP_IF_NOT},
+    {"gtn", JOP_GREATER_THAN_NUMBER},
     {"in", JOP_IN},
     {"jmp", JOP_JUMP},
     {"jmpif", JOP_JUMP_IF},
     {"jmpni", JOP_JUMP_IF_NIL},
     {"jmpnn", JOP_JUMP_IF_NOT_NIL},
     {"jmpno", JOP_JUMP_IF_NOT},
+    {"jmptab", JOP_JUMP_TABLE},
     {"ldc", JOP_LOAD_CONSTANT},
     {"ldf", JOP_LOAD_FALSE},
     {"ldi", JOP_LOAD_INTEGER},
@@ -100,7 +93,12 @@ static const JanetInstructionDef janet_ops[] = {
     {"len", JOP_LENGTH},
     {"lt", JOP_LESS_THAN},
     {"lte", JOP_LESS_THAN_EQUAL},
+    {"ltejno", JOP_LESS_THAN_EQUAL_JUMP_IF_NOT},
+    {"lten", JOP_LESS_THAN_EQUAL_NUMBER},
     {"ltim", JOP_LESS_THAN_IMMEDIATE},
+    {"ltimjno", JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT},
+    {"ltjno", JOP_LESS_THAN_JUMP_IF_NOT},
+    {"ltn", JOP_LESS_THAN_NUMBER},
     {"mkarr", JOP_MAKE_ARRAY},
     {"mkbtp", JOP_MAKE_BRACKET_TUPLE},
     {"mkbuf", JOP_MAKE_BUFFER},
@@ -113,8 +111,12 @@ static const JanetInstructionDef janet_ops[] = {
     {"movn", JOP_MOVE_NEAR},
     {"mul", JOP_MULTIPLY},
     {"mulim", JOP_MULTIPLY_IMMEDIATE},
+    {"mulimn", JOP_MULTIPLY_IMMEDIATE_NUMBER},
+    {"muln", JOP_MULTIPLY_NUMBER},
     {"neq", JOP_NOT_EQUALS},
     {"neqim", JOP_NOT_EQUALS_IMMEDIATE},
+    {"neqimjno", JOP_NOT_EQUALS_IMMEDIATE_JUMP_IF_NOT},
+    {"neqjno", JOP_NOT_EQUALS_JUMP_IF_NOT},
     {"next", JOP_NEXT},
     {"noop", JOP_NOOP},
     {"prop", JOP_PROPAGATE},
@@ -137,10 +139,44 @@ static const JanetInstructionDef janet_ops[] = {
     {"sru", JOP_SHIFT_RIGHT_UNSIGNED},
     {"sruim", JOP_SHIFT_RIGHT_UNSIGNED_IMMEDIATE},
     {"sub", JOP_SUBTRACT},
+    {"subn", JOP_SUBTRACT_NUMBER},
     {"tcall", JOP_TAILCALL},
     {"tchck", JOP_TYPECHECK}
 };
 
+/* Get the assembler name of an opcode, or NULL if there is no such opcode */
+const char *janet_opcode_name(uint32_t opcode) {
+    for (size_t i = 0; i < sizeof(janet_ops) / sizeof(JanetInstructionDef); i++) {
+        if (janet_ops[i].opcode == opcode) return janet_ops[i].name;
+    }
+    return NULL;
+}
+
+#endif
+
+/* Conditionally compile this file */
+#ifdef JANET_ASSEMBLER
+
+/* Hold all state needed during assembly */
+typedef struct JanetAssembler JanetAssembler;
+struct JanetAssembler {
+    JanetAssembler *parent;
+    JanetFuncDef *def;
+    jmp_buf on_error;
+    const uint8_t *errmessage;
+    int32_t errindex;
+
+    int32_t environments_capacity;
+    int32_t defs_capacity;
+    int32_t bytecode_count; /* Used for calculating labels */
+
+    Janet name;
+    JanetTable labels; /* keyword -> bytecode index */
+    JanetTable slots; /* symbol -> slot index */
+    JanetTable envs; /* symbol -> environment index */
+    JanetTable defs; /* symbol -> funcdefs index */
+};
+
 /* Typename aliases for tchck instruction */
 typedef struct TypeAlias {
     const char *name;
@@ -722,6 +758,7 @@ static JanetAssembleResult janet_asm1(JanetAssembler *parent, Janet source, int
     }
 
     /* Add final flags */
+    def->flags |= janet_bytecode_specializations(def);
     janet_def_addflags(def);
 
     /* Finish everything and return funcdef */
@@ -884,6 +921,15 @@ static Janet janet_disasm_vararg(JanetFuncDef *def) {
     return janet_wrap_boolean(def->flags & JANET_FUNCDEF_FLAG_VARARG);
 }
 
+static Janet janet_disasm_specializations(JanetFuncDef *def) {
+    JanetArray *specs = janet_array(2);
+    if (def->flags & JANET_FUNCDEF_FLAG_NUMBER_MATH)
+        janet_array_push(specs, janet_ckeywordv("number-math"));
+    if (def->flags & JANET_FUNCDEF_FLAG_NUMBER_COMPARE)
+        janet_array_push(specs, janet_ckeywordv("number-compare"));
+    return janet_wrap_array(specs);
+}
+
 static Janet janet_disasm_constants(JanetFuncDef *def) {
     JanetArray *constants = janet_array(def->constants_length);
     for (int32_t i = 0; i < def->constants_length; i++) {
@@ -916,6 +962,15 @@ static Janet janet_disasm_environments(JanetFuncDef *def) {
     return janet_wrap_array(envs);
 }
 
+static Janet janet_disasm_captures(JanetFuncDef *def) {
+    JanetArray *captures = janet_array(def->captures_length);
+    for (int32_t i = 0; i < def->captures_length; i++) {
+        captures->data[i] = janet_wrap_integer(def->captures[i]);
+    }
+    captures->count = def->captures_length;
+    return janet_wrap_array(captures);
+}
+
 static Janet janet_disasm_defs(JanetFuncDef *def) {
     JanetArray *defs = janet_array(def->defs_length);
     for (int32_t i = 0; i < def->defs_length; i++) {
@@ -926,6 +981,7 @@ static Janet janet_disasm_defs(JanetFuncDef *def) {
 }
 
 Janet janet_disasm(JanetFuncDef *def) {
+    if (def->lazy) janet_funcdef_force(def);
     JanetTable *ret = janet_table(10);
     janet_table_put(ret, janet_ckeywordv("arity"), janet_disasm_arity(def));
     janet_table_put(ret, janet_ckeywordv("min-arity"), janet_disasm_min_arity(def));
@@ -938,7 +994,9 @@ Janet janet_disasm(JanetFuncDef *def) {
     janet_table_put(ret, janet_ckeywordv("constants"), janet_disasm_constants(def));
     janet_table_put(ret, janet_ckeywordv("sourcemap"), janet_disasm_sourcemap(def));
     janet_table_put(ret, janet_ckeywordv("environments"), janet_disasm_environments(def));
+    janet_table_put(ret, janet_ckeywordv("captures"), janet_disasm_captures(def));
     janet_table_put(ret, janet_ckeywordv("defs"), janet_disasm_defs(def));
+    janet_table_put(ret, janet_ckeywordv("specializations"), janet_disasm_specializations(def));
     return janet_wrap_struct(janet_table_to_struct(ret));
 }
 
@@ -974,9 +1032,14 @@ JANET_CORE_FN(cfun_disasm,
               "* :constants - an array of constants referenced by this function.\n"
               "* :sourcemap - a mapping of each bytecode instruction to a line and column in the source file.\n"
               "* :environments - an internal mapping of which enclosing functions are referenced for bindings.\n"
-              "* :defs - other function definitions that this function may instantiate.\n") {
+              "* :captures - slots of the enclosing function that are copied when the closure is created. "
+              "The copies are referenced by the environment -2 in :environments.\n"
+              "* :defs - other function definitions that this function may instantiate.\n"
+              "* :specializations - kinds of type specialized instructions the compiler emitted, "
+              "such as :number-math and :number-compare.\n") {
     janet_arity(argc, 1, 2);
     JanetFunction *f = janet_getfunction(argv, 0);
+    if (f->def->lazy) janet_funcdef_force(f->def);
     if (argc == 2) {
         JanetKeyword kw = janet_getkeyword(argv, 1);
         if (!janet_cstrcmp(kw, "arity")) return janet_disasm_arity(f->def);
@@ -990,7 +1053,9 @@ JANET_CORE_FN(cfun_disasm,
         if (!janet_cstrcmp(kw, "constants")) return janet_disasm_constants(f->def);
         if (!janet_cstrcmp(kw, "sourcemap")) return janet_disasm_sourcemap(f->def);
         if (!janet_cstrcmp(kw, "environments")) return janet_disasm_environments(f->def);
+        if (!janet_cstrcmp(kw, "captures")) return janet_disasm_captures(f->def);
         if (!janet_cstrcmp(kw, "defs")) return janet_disasm_defs(f->def);
+        if (!janet_cstrcmp(kw, "specializations")) return janet_disasm_specializations(f->def);
         janet_panicf("unknown disasm key %v", argv[1]);
     } else {
         return janet_disasm(f->def);
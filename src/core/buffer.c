@@ -444,8 +444,7 @@ JANET_CORE_FN(cfun_buffer_format,
               " the modified buffer.") {
     janet_arity(argc, 2, -1);
     JanetBuffer *buffer = janet_getbuffer(argv, 0);
-    const char *strfrmt = (const char *) janet_getstring(argv, 1);
-    janet_buffer_format(buffer, strfrmt, 1, argc, argv);
+    janet_buffer_format_value(buffer, 1, argc, argv);
     return argv[0];
 }
 
@@ -103,9 +103,986 @@ enum JanetInstructionType janet_instructions[JOP_INSTRUCTION_COUNT] = {
     JINT_SSS, /* JOP_NEXT */
     JINT_SSS, /* JOP_NOT_EQUALS, */
     JINT_SSI, /* JOP_NOT_EQUALS_IMMEDIATE, */
-    JINT_SSS /* JOP_CANCEL, */
+    JINT_SSS, /* JOP_CANCEL, */
+    JINT_SSS, /* JOP_LESS_THAN_JUMP_IF_NOT, */
+    JINT_SSS, /* JOP_LESS_THAN_EQUAL_JUMP_IF_NOT, */
+    JINT_SSI, /* JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT, */
+    JINT_SSS, /* JOP_GREATER_THAN_JUMP_IF_NOT, */
+    JINT_SSS, /* JOP_GREATER_THAN_EQUAL_JUMP_IF_NOT, */
+    JINT_SSI, /* JOP_GREATER_THAN_IMMEDIATE_JUMP_IF_NOT, */
+    JINT_SSS, /* JOP_EQUALS_JUMP_IF_NOT, */
+    JINT_SSI, /* JOP_EQUALS_IMMEDIATE_JUMP_IF_NOT, */
+    JINT_SSS, /* JOP_NOT_EQUALS_JUMP_IF_NOT, */
+    JINT_SSI, /* JOP_NOT_EQUALS_IMMEDIATE_JUMP_IF_NOT, */
+    JINT_SSI, /* JOP_ADD_IMMEDIATE_JUMP, */
+    JINT_SSS, /* JOP_ADD_NUMBER, */
+    JINT_SSS, /* JOP_SUBTRACT_NUMBER, */
+    JINT_SSS, /* JOP_MULTIPLY_NUMBER, */
+    JINT_SSS, /* JOP_DIVIDE_NUMBER, */
+    JINT_SSI, /* JOP_ADD_IMMEDIATE_NUMBER, */
+    JINT_SSI, /* JOP_MULTIPLY_IMMEDIATE_NUMBER, */
+    JINT_SSI, /* JOP_DIVIDE_IMMEDIATE_NUMBER, */
+    JINT_SSS, /* JOP_LESS_THAN_NUMBER, */
+    JINT_SSS, /* JOP_LESS_THAN_EQUAL_NUMBER, */
+    JINT_SSS, /* JOP_GREATER_THAN_NUMBER, */
+    JINT_SSS, /* JOP_GREATER_THAN_EQUAL_NUMBER, */
+    JINT_SC /* JOP_JUMP_TABLE, */
 };
 
+/* Superinstructions, and the pair of instructions each one replaces. The first
+ * instruction of the pair is rewritten in place, and the second is left as is. */
+static const struct {
+    uint8_t first;
+    uint8_t second;
+    uint8_t fused;
+} janet_superinstructions[] = {
+    {JOP_LESS_THAN, JOP_JUMP_IF_NOT, JOP_LESS_THAN_JUMP_IF_NOT},
+    {JOP_LESS_THAN_EQUAL, JOP_JUMP_IF_NOT, JOP_LESS_THAN_EQUAL_JUMP_IF_NOT},
+    {JOP_LESS_THAN_IMMEDIATE, JOP_JUMP_IF_NOT, JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT},
+    {JOP_GREATER_THAN, JOP_JUMP_IF_NOT, JOP_GREATER_THAN_JUMP_IF_NOT},
+    {JOP_GREATER_THAN_EQUAL, JOP_JUMP_IF_NOT, JOP_GREATER_THAN_EQUAL_JUMP_IF_NOT},
+    {JOP_GREATER_THAN_IMMEDIATE, JOP_JUMP_IF_NOT, JOP_GREATER_THAN_IMMEDIATE_JUMP_IF_NOT},
+    {JOP_EQUALS, JOP_JUMP_IF_NOT, JOP_EQUALS_JUMP_IF_NOT},
+    {JOP_EQUALS_IMMEDIATE, JOP_JUMP_IF_NOT, JOP_EQUALS_IMMEDIATE_JUMP_IF_NOT},
+    {JOP_NOT_EQUALS, JOP_JUMP_IF_NOT, JOP_NOT_EQUALS_JUMP_IF_NOT},
+    {JOP_NOT_EQUALS_IMMEDIATE, JOP_JUMP_IF_NOT, JOP_NOT_EQUALS_IMMEDIATE_JUMP_IF_NOT},
+    {JOP_ADD_IMMEDIATE, JOP_JUMP, JOP_ADD_IMMEDIATE_JUMP}
+};
+
+#define JANET_SUPERINSTRUCTION_COUNT (sizeof(janet_superinstructions) / sizeof(janet_superinstructions[0]))
+
+/* Find the superinstruction for a pair of instructions, looking up the first instruction
+ * by its plain or fused opcode. Conditional jumps must test the slot written by the first
+ * instruction. Returns the index of the superinstruction, -1 if the first instruction is
+ * not part of any superinstruction, or -2 if the second instruction does not match. */
+static int janet_superinstruction(uint32_t first, uint32_t second, int by_fused) {
+    for (size_t i = 0; i < JANET_SUPERINSTRUCTION_COUNT; i++) {
+        uint8_t op = by_fused ? janet_superinstructions[i].fused : janet_superinstructions[i].first;
+        if ((first & 0x7F) != op) continue;
+        if ((second & 0x7F) != janet_superinstructions[i].second) return -2;
+        if ((second & 0x7F) == JOP_JUMP_IF_NOT && ((first >> 8) & 0xFF) != ((second >> 8) & 0xFF)) return -2;
+        return (int) i;
+    }
+    return -1;
+}
+
+/* Replace instruction pairs with superinstructions. Instructions with
+ * breakpoints are left alone. */
+void janet_bytecode_fuse(JanetFuncDef *def) {
+    for (int32_t i = 0; i + 1 < def->bytecode_length; i++) {
+        uint32_t instr = def->bytecode[i];
+        if (instr & 0x80) continue;
+        int index = janet_superinstruction(instr, def->bytecode[i + 1], 0);
+        if (index >= 0) {
+            def->bytecode[i] = (instr & ~0xFFu) | janet_superinstructions[index].fused;
+        }
+    }
+}
+
+/* Get the instruction a superinstruction or number specialized instruction
+ * was made from. Other instructions are returned unchanged. */
+uint32_t janet_bytecode_generic(uint32_t instr) {
+    for (size_t i = 0; i < JANET_SUPERINSTRUCTION_COUNT; i++) {
+        if ((instr & 0x7F) == janet_superinstructions[i].fused) {
+            return (instr & ~0x7Fu) | janet_superinstructions[i].first;
+        }
+    }
+    uint8_t op;
+    switch (instr & 0x7F) {
+        default:
+            return instr;
+        case JOP_ADD_NUMBER:
+            op = JOP_ADD;
+            break;
+        case JOP_SUBTRACT_NUMBER:
+            op = JOP_SUBTRACT;
+            break;
+        case JOP_MULTIPLY_NUMBER:
+            op = JOP_MULTIPLY;
+            break;
+        case JOP_DIVIDE_NUMBER:
+            op = JOP_DIVIDE;
+            break;
+        case JOP_ADD_IMMEDIATE_NUMBER:
+            op = JOP_ADD_IMMEDIATE;
+            break;
+        case JOP_MULTIPLY_IMMEDIATE_NUMBER:
+            op = JOP_MULTIPLY_IMMEDIATE;
+            break;
+        case JOP_DIVIDE_IMMEDIATE_NUMBER:
+            op = JOP_DIVIDE_IMMEDIATE;
+            break;
+        case JOP_LESS_THAN_NUMBER:
+            op = JOP_LESS_THAN;
+            break;
+        case JOP_LESS_THAN_EQUAL_NUMBER:
+            op = JOP_LESS_THAN_EQUAL;
+            break;
+        case JOP_GREATER_THAN_NUMBER:
+            op = JOP_GREATER_THAN;
+            break;
+        case JOP_GREATER_THAN_EQUAL_NUMBER:
+            op = JOP_GREATER_THAN_EQUAL;
+            break;
+    }
+    return (instr & ~0x7Fu) | op;
+}
+
+/* Number of jumps after a jump table instruction, not counting the default */
+static int32_t janet_bytecode_table_length(const JanetFuncDef *def, uint32_t instr) {
+    int32_t index = (int32_t)(instr >> 16);
+    if (index >= def->constants_length || !janet_checktype(def->constants[index], JANET_STRUCT)) return 0;
+    int32_t n = janet_struct_length(janet_unwrap_struct(def->constants[index]));
+    return n > JANET_JUMP_TABLE_MAX ? 0 : n;
+}
+
+/* Number of successors of an instruction, written to targets. targets needs
+ * space for JANET_JUMP_TABLE_MAX + 1 entries. */
+static int janet_bytecode_successors(const JanetFuncDef *def, int32_t i, int32_t *targets) {
+    uint32_t instr = def->bytecode[i];
+    switch (instr & 0x7F) {
+        case JOP_RETURN:
+        case JOP_RETURN_NIL:
+        case JOP_TAILCALL:
+        case JOP_ERROR:
+            return 0;
+        case JOP_JUMP:
+            targets[0] = i + (((int32_t) instr) >> 8);
+            return 1;
+        case JOP_JUMP_IF:
+        case JOP_JUMP_IF_NOT:
+        case JOP_JUMP_IF_NIL:
+        case JOP_JUMP_IF_NOT_NIL:
+            targets[0] = i + 1;
+            targets[1] = i + (((int32_t) instr) >> 16);
+            return 2;
+        case JOP_JUMP_TABLE: {
+            int32_t n = janet_bytecode_table_length(def, instr);
+            for (int32_t j = 0; j <= n; j++) targets[j] = i + 1 + j;
+            return n + 1;
+        }
+        default:
+            /* Superinstructions continue to the jump they were fused with */
+            targets[0] = i + 1;
+            return 1;
+    }
+}
+
+/* Mark the instructions that can be reached from the start of a funcdef.
+ * stack needs space for bytecode_length entries. Returns 0 if a jump leaves
+ * the funcdef. */
+static int janet_bytecode_reachable(const JanetFuncDef *def, int32_t *reached, int32_t *stack) {
+    int32_t len = def->bytecode_length;
+    int32_t targets[JANET_JUMP_TABLE_MAX + 1];
+    int32_t top = 0;
+    for (int32_t i = 0; i < len; i++) reached[i] = 0;
+    reached[0] = 1;
+    stack[top++] = 0;
+    while (top) {
+        int32_t i = stack[--top];
+        int n = janet_bytecode_successors(def, i, targets);
+        for (int j = 0; j < n; j++) {
+            if (targets[j] < 0 || targets[j] >= len) return 0;
+            if (!reached[targets[j]]) {
+                reached[targets[j]] = 1;
+                stack[top++] = targets[j];
+            }
+        }
+    }
+    return 1;
+}
+
+/* Peephole optimizations. Jumps to jumps are threaded, and redundant
+ * moves and loads are replaced with noops, which janet_bytecode_compact then
+ * removes. Moves and loads are found with a backward liveness pass. Slots
+ * captured by closures are always live. */
+
+/* Skip liveness for very large functions */
+#define JANET_PEEPHOLE_MAX_STATE 0x100000
+
+/* Maximum number of jumps followed when threading */
+#define JANET_PEEPHOLE_MAX_HOPS 8
+
+/* Get the slots read by an instruction, and the slot it writes or -1.
+ * Returns the number of slots read. */
+int janet_bytecode_slots(uint32_t instr, int32_t *uses, int32_t *def) {
+    int32_t a = (int32_t)((instr >> 8) & 0xFF);
+    int32_t b = (int32_t)((instr >> 16) & 0xFF);
+    int32_t c = (int32_t)(instr >> 24);
+    int32_t d = (int32_t)(instr >> 8);
+    int32_t e = (int32_t)(instr >> 16);
+    *def = -1;
+    switch (instr & 0x7F) {
+        case JOP_NOOP:
+        case JOP_RETURN_NIL:
+        case JOP_JUMP:
+            return 0;
+        case JOP_LOAD_NIL:
+        case JOP_LOAD_TRUE:
+        case JOP_LOAD_FALSE:
+        case JOP_LOAD_SELF:
+        case JOP_MAKE_ARRAY:
+        case JOP_MAKE_BUFFER:
+        case JOP_MAKE_STRING:
+        case JOP_MAKE_STRUCT:
+        case JOP_MAKE_TABLE:
+        case JOP_MAKE_TUPLE:
+        case JOP_MAKE_BRACKET_TUPLE:
+            *def = d;
+            return 0;
+        case JOP_LOAD_INTEGER:
+        case JOP_LOAD_CONSTANT:
+        case JOP_LOAD_UPVALUE:
+        case JOP_CLOSURE:
+            *def = a;
+            return 0;
+        case JOP_ERROR:
+        case JOP_RETURN:
+        case JOP_PUSH:
+        case JOP_PUSH_ARRAY:
+        case JOP_TAILCALL:
+            uses[0] = d;
+            return 1;
+        case JOP_TYPECHECK:
+        case JOP_JUMP_IF:
+        case JOP_JUMP_IF_NOT:
+        case JOP_JUMP_IF_NIL:
+        case JOP_JUMP_IF_NOT_NIL:
+        case JOP_JUMP_TABLE:
+        case JOP_SET_UPVALUE:
+            uses[0] = a;
+            return 1;
+        case JOP_MOVE_NEAR:
+        case JOP_BNOT:
+        case JOP_LENGTH:
+        case JOP_CALL:
+            *def = a;
+            uses[0] = e;
+            return 1;
+        case JOP_MOVE_FAR:
+            *def = e;
+            uses[0] = a;
+            return 1;
+        case JOP_PUSH_2:
+            uses[0] = a;
+            uses[1] = e;
+            return 2;
+        case JOP_PUSH_3:
+        case JOP_PUT:
+            uses[0] = a;
+            uses[1] = b;
+            uses[2] = c;
+            return 3;
+        case JOP_PUT_INDEX:
+            uses[0] = a;
+            uses[1] = b;
+            return 2;
+        default:
+            break;
+    }
+    switch (janet_instructions[instr & 0x7F]) {
+        case JINT_SSS:
+            *def = a;
+            uses[0] = b;
+            uses[1] = c;
+            return 2;
+        case JINT_SSI:
+        case JINT_SSU:
+            *def = a;
+            uses[0] = b;
+            return 1;
+        default:
+            /* Unknown instructions read all of their operands */
+            uses[0] = a;
+            uses[1] = b;
+            uses[2] = c;
+            return 3;
+    }
+}
+
+/* Instructions that only write their destination, and can be removed if
+ * it is never read */
+static int janet_peephole_pure(uint32_t instr) {
+    switch (instr & 0x7F) {
+        default:
+            return 0;
+        case JOP_MOVE_NEAR:
+        case JOP_MOVE_FAR:
+        case JOP_LOAD_NIL:
+        case JOP_LOAD_TRUE:
+        case JOP_LOAD_FALSE:
+        case JOP_LOAD_INTEGER:
+        case JOP_LOAD_CONSTANT:
+        case JOP_LOAD_SELF:
+        case JOP_LOAD_UPVALUE:
+            return 1;
+    }
+}
+
+/* Instructions whose destination is written after all operands are read,
+ * so the destination can be changed to another slot */
+static int janet_peephole_retarget(uint32_t instr) {
+    switch (instr & 0x7F) {
+        default:
+            return janet_instructions[instr & 0x7F] == JINT_SSS ||
+                   janet_instructions[instr & 0x7F] == JINT_SSI;
+        case JOP_PUSH_3:
+        case JOP_PUT:
+        case JOP_RESUME:
+        case JOP_PROPAGATE:
+        case JOP_CANCEL:
+        case JOP_LESS_THAN_JUMP_IF_NOT:
+        case JOP_LESS_THAN_EQUAL_JUMP_IF_NOT:
+        case JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT:
+        case JOP_GREATER_THAN_JUMP_IF_NOT:
+        case JOP_GREATER_THAN_EQUAL_JUMP_IF_NOT:
+        case JOP_GREATER_THAN_IMMEDIATE_JUMP_IF_NOT:
+        case JOP_EQUALS_JUMP_IF_NOT:
+        case JOP_EQUALS_IMMEDIATE_JUMP_IF_NOT:
+        case JOP_NOT_EQUALS_JUMP_IF_NOT:
+        case JOP_NOT_EQUALS_IMMEDIATE_JUMP_IF_NOT:
+        case JOP_ADD_IMMEDIATE_JUMP:
+            return 0;
+        case JOP_MOVE_NEAR:
+        case JOP_BNOT:
+        case JOP_LENGTH:
+        case JOP_CALL:
+        case JOP_LOAD_INTEGER:
+        case JOP_LOAD_CONSTANT:
+        case JOP_LOAD_UPVALUE:
+        case JOP_CLOSURE:
+        case JOP_GET_INDEX:
+        case JOP_SHIFT_RIGHT_UNSIGNED_IMMEDIATE:
+        /* Destination in D */
+        case JOP_LOAD_NIL:
+        case JOP_LOAD_TRUE:
+        case JOP_LOAD_FALSE:
+        case JOP_LOAD_SELF:
+        case JOP_MAKE_ARRAY:
+        case JOP_MAKE_BUFFER:
+        case JOP_MAKE_STRING:
+        case JOP_MAKE_STRUCT:
+        case JOP_MAKE_TABLE:
+        case JOP_MAKE_TUPLE:
+        case JOP_MAKE_BRACKET_TUPLE:
+            return 1;
+    }
+}
+
+/* Check if a slot is live after an instruction */
+static int janet_peephole_live(const uint32_t *live, int32_t words, int32_t i, int32_t slot) {
+    return (live[(size_t) i * (size_t) words + (slot >> 5)] >> (slot & 31)) & 1;
+}
+
+/* Skip noops starting at an instruction */
+static int32_t janet_peephole_skip(const JanetFuncDef *def, int32_t i) {
+    while (i + 1 < def->bytecode_length && def->bytecode[i] == JOP_NOOP) i++;
+    return i;
+}
+
+/* Follow a jump through noops and unconditional jumps */
+static int32_t janet_peephole_thread(const JanetFuncDef *def, int32_t from, int32_t target) {
+    for (int hops = 0; hops < JANET_PEEPHOLE_MAX_HOPS; hops++) {
+        if (target < 0 || target >= def->bytecode_length) break;
+        target = janet_peephole_skip(def, target);
+        uint32_t instr = def->bytecode[target];
+        if ((instr & 0xFF) != JOP_JUMP) break;
+        int32_t next = target + (((int32_t) instr) >> 8);
+        if (next == from || next == target) break;
+        target = next;
+    }
+    return target;
+}
+
+/* Thread jumps through other jumps. The jumps after a jump table are
+ * indexed by position, so they are never removed. */
+static void janet_peephole_jumps(JanetFuncDef *def) {
+    int32_t table_end = -1;
+    for (int32_t i = 0; i < def->bytecode_length; i++) {
+        uint32_t instr = def->bytecode[i];
+        switch (instr & 0xFF) {
+            default:
+                break;
+            case JOP_JUMP_TABLE:
+                table_end = i + 1 + janet_bytecode_table_length(def, instr);
+                break;
+            case JOP_JUMP: {
+                int32_t target = janet_peephole_thread(def, i, i + (((int32_t) instr) >> 8));
+                if (i > table_end && i + 1 < def->bytecode_length && target == janet_peephole_skip(def, i + 1)) {
+                    def->bytecode[i] = JOP_NOOP;
+                    break;
+                }
+                uint32_t final = def->bytecode[target];
+                if (final == JOP_RETURN_NIL || (final & 0xFF) == JOP_RETURN) {
+                    /* A jump to a return is the return */
+                    def->bytecode[i] = final;
+                } else {
+                    def->bytecode[i] = JOP_JUMP | ((uint32_t)(target - i) << 8);
+                }
+                break;
+            }
+            case JOP_JUMP_IF:
+            case JOP_JUMP_IF_NOT:
+            case JOP_JUMP_IF_NIL:
+            case JOP_JUMP_IF_NOT_NIL: {
+                int32_t target = janet_peephole_thread(def, i, i + (((int32_t) instr) >> 16));
+                int32_t offset = target - i;
+                if (offset >= INT16_MIN && offset <= INT16_MAX) {
+                    def->bytecode[i] = (instr & 0xFFFF) | ((uint32_t) offset << 16);
+                }
+                break;
+            }
+        }
+    }
+}
+
+/* Remove moves and loads whose results are never read, and compute values
+ * directly into the slot they are moved to */
+/* A closure reads the slots it captures by value */
+static void janet_peephole_captures(const JanetFuncDef *def, uint32_t instr, uint32_t *in) {
+    if ((instr & 0x7F) != JOP_CLOSURE) return;
+    int32_t index = (int32_t)(instr >> 16);
+    if (index >= def->defs_length) return;
+    const JanetFuncDef *sub = def->defs[index];
+    for (int32_t k = 0; k < sub->captures_length; k++) {
+        int32_t slot = sub->captures[k];
+        if (slot >= 0 && slot < def->slotcount) in[slot >> 5] |= 1u << (slot & 31);
+    }
+}
+
+static void janet_peephole_moves(JanetFuncDef *def) {
+    int32_t len = def->bytecode_length;
+    int32_t slots = def->slotcount;
+    int32_t words = (slots + 31) >> 5;
+    int32_t targets[JANET_JUMP_TABLE_MAX + 1], uses[3], dest;
+    if (len == 0 || slots == 0) return;
+    if ((size_t) len * (size_t) words > JANET_PEEPHOLE_MAX_STATE) return;
+
+    /* Check operands, and find jump targets */
+    uint8_t *target = janet_calloc((size_t) len, 1);
+    if (NULL == target) {
+        JANET_OUT_OF_MEMORY;
+    }
+    for (int32_t i = 0; i < len; i++) {
+        int n = janet_bytecode_slots(def->bytecode[i], uses, &dest);
+        for (int j = 0; j < n; j++) {
+            if (uses[j] >= slots) goto done;
+        }
+        if (dest >= slots) goto done;
+        n = janet_bytecode_successors(def, i, targets);
+        for (int j = 0; j < n; j++) {
+            if (targets[j] < 0 || targets[j] >= len) goto done;
+            if (targets[j] != i + 1) target[targets[j]] = 1;
+        }
+    }
+
+    /* Live slots after each instruction */
+    uint32_t *live = janet_calloc((size_t) len * (size_t) words + (size_t) words, sizeof(uint32_t));
+    if (NULL == live) {
+        JANET_OUT_OF_MEMORY;
+    }
+    uint32_t *in = live + (size_t) len * (size_t) words;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int32_t i = len - 1; i >= 0; i--) {
+            uint32_t *out = live + (size_t) i * (size_t) words;
+            int n = janet_bytecode_successors(def, i, targets);
+            for (int j = 0; j < n; j++) {
+                if (targets[j] == len) continue;
+                /* Live in of the successor */
+                uint32_t *succ = live + (size_t) targets[j] * (size_t) words;
+                int32_t sdest;
+                int sn = janet_bytecode_slots(def->bytecode[targets[j]], uses, &sdest);
+                memcpy(in, succ, sizeof(uint32_t) * (size_t) words);
+                if (sdest >= 0) in[sdest >> 5] &= ~(1u << (sdest & 31));
+                for (int k = 0; k < sn; k++) in[uses[k] >> 5] |= 1u << (uses[k] & 31);
+                janet_peephole_captures(def, def->bytecode[targets[j]], in);
+                for (int32_t w = 0; w < words; w++) {
+                    if (in[w] & ~out[w]) {
+                        out[w] |= in[w];
+                        changed = 1;
+                    }
+                }
+            }
+        }
+    }
+    if (NULL != def->closure_bitset) {
+        for (int32_t i = 0; i < len; i++) {
+            uint32_t *out = live + (size_t) i * (size_t) words;
+            for (int32_t w = 0; w < words; w++) out[w] |= def->closure_bitset[w];
+        }
+    }
+    /* Remove dead moves and loads, including moves of a slot to itself */
+    for (int32_t i = 0; i < len; i++) {
+        uint32_t instr = def->bytecode[i];
+        if (!janet_peephole_pure(instr)) continue;
+        int n = janet_bytecode_slots(instr, uses, &dest);
+        if (!janet_peephole_live(live, words, i, dest) || (n == 1 && uses[0] == dest)) {
+            def->bytecode[i] = JOP_NOOP;
+        }
+    }
+
+    /* A move back to the slot that was just moved from */
+    for (int32_t i = 0; i + 1 < len; i++) {
+        uint32_t instr = def->bytecode[i];
+        uint32_t next = def->bytecode[i + 1];
+        if ((instr & 0xFF) != JOP_MOVE_NEAR || (next & 0xFF) != JOP_MOVE_NEAR || target[i + 1]) continue;
+        if ((instr >> 16) == ((next >> 8) & 0xFF) && (next >> 16) == ((instr >> 8) & 0xFF)) {
+            /* The slot moved from now keeps its value past the first move */
+            uint32_t from = instr >> 16;
+            live[(size_t) i * (size_t) words + (from >> 5)] |= 1u << (from & 31);
+            def->bytecode[i + 1] = JOP_NOOP;
+        }
+    }
+
+    /* Compute values directly into the slot they are moved to next */
+    for (int32_t i = 0; i + 1 < len; i++) {
+        uint32_t instr = def->bytecode[i];
+        uint32_t next = def->bytecode[i + 1];
+        if ((next & 0xFF) != JOP_MOVE_NEAR || target[i + 1]) continue;
+        if (!janet_peephole_retarget(instr)) continue;
+        janet_bytecode_slots(instr, uses, &dest);
+        int32_t from = (int32_t)(next >> 16);
+        int32_t to = (int32_t)((next >> 8) & 0xFF);
+        if (dest < 0 || dest != from || janet_peephole_live(live, words, i + 1, from)) continue;
+        if (janet_instructions[instr & 0x7F] == JINT_S) {
+            def->bytecode[i] = (instr & 0xFF) | ((uint32_t) to << 8);
+        } else {
+            def->bytecode[i] = (instr & ~0xFF00u) | ((uint32_t) to << 8);
+        }
+        def->bytecode[i + 1] = JOP_NOOP;
+        i++;
+    }
+
+    janet_free(live);
+done:
+    janet_free(target);
+}
+
+/* Replace unreachable instructions with noops, so they do not get in the way
+ * of other optimizations. Returns 0 for malformed bytecode. */
+static int janet_peephole_unreachable(JanetFuncDef *def) {
+    int32_t len = def->bytecode_length;
+    int32_t *reached = janet_malloc(sizeof(int32_t) * (size_t) len * 2);
+    if (NULL == reached) {
+        JANET_OUT_OF_MEMORY;
+    }
+    int ok = janet_bytecode_reachable(def, reached, reached + len);
+    if (ok) {
+        for (int32_t i = 0; i + 1 < len; i++) {
+            if (!reached[i]) def->bytecode[i] = JOP_NOOP;
+        }
+    }
+    janet_free(reached);
+    return ok;
+}
+
+void janet_bytecode_peephole(JanetFuncDef *def) {
+    if (def->bytecode_length == 0) return;
+    if (!janet_peephole_unreachable(def)) return;
+    janet_peephole_jumps(def);
+    /* Threading can leave jumps that are no longer used */
+    janet_peephole_unreachable(def);
+    janet_peephole_moves(def);
+    janet_peephole_jumps(def);
+}
+
+/* Remove noops and instructions that can not be reached from the start of
+ * the funcdef, such as the other branch of an if with a constant condition or
+ * code after a return. Jumps and the sourcemap are updated to match. */
+void janet_bytecode_compact(JanetFuncDef *def) {
+    int32_t len = def->bytecode_length;
+    int32_t targets[JANET_JUMP_TABLE_MAX + 1];
+    if (len == 0) return;
+    int32_t *keep = janet_malloc(sizeof(int32_t) * (size_t) len * 2);
+    if (NULL == keep) {
+        JANET_OUT_OF_MEMORY;
+    }
+    int32_t *index = keep + len;
+    if (!janet_bytecode_reachable(def, keep, index)) {
+        /* Leave malformed bytecode to the verifier */
+        janet_free(keep);
+        return;
+    }
+
+    /* Drop noops. Jumps to a noop go to the instruction after it, so the
+     * last instruction is always kept. So are the jumps after a jump table. */
+    for (int32_t i = 0, table_end = -1; i + 1 < len; i++) {
+        if ((def->bytecode[i] & 0x7F) == JOP_JUMP_TABLE) {
+            table_end = i + 1 + janet_bytecode_table_length(def, def->bytecode[i]);
+        }
+        if (def->bytecode[i] == JOP_NOOP && i > table_end) keep[i] = 0;
+    }
+
+    /* Number the instructions that are kept */
+    int32_t count = 0;
+    for (int32_t i = 0; i < len; i++) {
+        index[i] = count;
+        if (keep[i]) count++;
+    }
+    if (count == len) {
+        janet_free(keep);
+        return;
+    }
+
+    /* Compact, rewriting jump offsets */
+    for (int32_t i = 0; i < len; i++) {
+        if (!keep[i]) continue;
+        uint32_t instr = def->bytecode[i];
+        int n = janet_bytecode_successors(def, i, targets);
+        switch (instr & 0x7F) {
+            default:
+                break;
+            case JOP_JUMP:
+                instr = (instr & 0xFF) | ((uint32_t)(index[targets[0]] - index[i]) << 8);
+                break;
+            case JOP_JUMP_IF:
+            case JOP_JUMP_IF_NOT:
+            case JOP_JUMP_IF_NIL:
+            case JOP_JUMP_IF_NOT_NIL:
+                instr = (instr & 0xFFFF) | ((uint32_t)(index[targets[n - 1]] - index[i]) << 16);
+                break;
+        }
+        def->bytecode[index[i]] = instr;
+        if (NULL != def->sourcemap) def->sourcemap[index[i]] = def->sourcemap[i];
+    }
+    def->bytecode_length = count;
+    janet_free(keep);
+}
+
+/* Type specialization. A forward data flow pass over the basic blocks of a
+ * funcdef computes a mask of the possible types (JANET_TFLAG_*) of every slot
+ * before each instruction. Arithmetic and comparisons whose operands can only
+ * be numbers are then replaced by opcodes that skip the type checks. */
+
+/* Skip specialization for very large functions */
+#define JANET_SPECIALIZE_MAX_STATE 0x100000
+
+#define JANET_TFLAG_ANY 0xFFFF
+
+static int janet_specialize_captured(const JanetFuncDef *def, int32_t slot) {
+    return NULL != def->closure_bitset && (def->closure_bitset[slot >> 5] & (1u << (slot & 31)));
+}
+
+/* Update slot types for one instruction. consts holds the constant loaded
+ * into each slot in the current block, or -1. Returns 0 if the instruction
+ * writes outside of the frame. */
+static int janet_specialize_step(const JanetFuncDef *def, uint32_t instr,
+                                 uint32_t *types, int32_t *consts) {
+    uint32_t a = (instr >> 8) & 0xFF;
+    uint32_t b = (instr >> 16) & 0xFF;
+    uint32_t c = instr >> 24;
+    int bnum = b < (uint32_t) def->slotcount && types[b] == JANET_TFLAG_NUMBER;
+    int cnum = c < (uint32_t) def->slotcount && types[c] == JANET_TFLAG_NUMBER;
+    uint32_t result = JANET_TFLAG_ANY;
+    int32_t constant = -1;
+    uint8_t op = instr & 0x7F;
+    switch (op) {
+        /* Instructions that do not write a slot */
+        case JOP_NOOP:
+        case JOP_ERROR:
+        case JOP_RETURN:
+        case JOP_RETURN_NIL:
+        case JOP_SET_UPVALUE:
+        case JOP_PUSH:
+        case JOP_PUSH_2:
+        case JOP_PUSH_3:
+        case JOP_PUSH_ARRAY:
+        case JOP_TAILCALL:
+        case JOP_PUT:
+        case JOP_PUT_INDEX:
+        case JOP_JUMP:
+        case JOP_JUMP_IF:
+        case JOP_JUMP_IF_NOT:
+        case JOP_JUMP_IF_NIL:
+        case JOP_JUMP_IF_NOT_NIL:
+        case JOP_JUMP_TABLE:
+            return 1;
+        case JOP_TYPECHECK:
+            if (a >= (uint32_t) def->slotcount) return 0;
+            if (types[a] & (instr >> 16)) types[a] &= (instr >> 16);
+            return 1;
+        case JOP_MOVE_FAR: {
+            uint32_t dest = instr >> 16;
+            if (dest >= (uint32_t) def->slotcount || a >= (uint32_t) def->slotcount) return 0;
+            types[dest] = janet_specialize_captured(def, dest) ? JANET_TFLAG_ANY : types[a];
+            consts[dest] = consts[a];
+            return 1;
+        }
+        case JOP_MOVE_NEAR: {
+            uint32_t src = instr >> 16;
+            if (src >= (uint32_t) def->slotcount) return 0;
+            result = types[src];
+            constant = consts[src];
+            break;
+        }
+        case JOP_ADD:
+        case JOP_SUBTRACT:
+        case JOP_MULTIPLY:
+        case JOP_DIVIDE:
+        case JOP_MODULO:
+        case JOP_REMAINDER:
+        case JOP_BAND:
+        case JOP_BOR:
+        case JOP_BXOR:
+        case JOP_SHIFT_LEFT:
+        case JOP_SHIFT_RIGHT:
+        case JOP_SHIFT_RIGHT_UNSIGNED:
+        case JOP_ADD_NUMBER:
+        case JOP_SUBTRACT_NUMBER:
+        case JOP_MULTIPLY_NUMBER:
+        case JOP_DIVIDE_NUMBER:
+            if (bnum && cnum) result = JANET_TFLAG_NUMBER;
+            break;
+        case JOP_ADD_IMMEDIATE:
+        case JOP_MULTIPLY_IMMEDIATE:
+        case JOP_DIVIDE_IMMEDIATE:
+        case JOP_SHIFT_LEFT_IMMEDIATE:
+        case JOP_SHIFT_RIGHT_IMMEDIATE:
+        case JOP_SHIFT_RIGHT_UNSIGNED_IMMEDIATE:
+        case JOP_ADD_IMMEDIATE_JUMP:
+        case JOP_ADD_IMMEDIATE_NUMBER:
+        case JOP_MULTIPLY_IMMEDIATE_NUMBER:
+        case JOP_DIVIDE_IMMEDIATE_NUMBER:
+        case JOP_BNOT:
+            if (bnum) result = JANET_TFLAG_NUMBER;
+            break;
+        case JOP_GREATER_THAN:
+        case JOP_GREATER_THAN_IMMEDIATE:
+        case JOP_GREATER_THAN_EQUAL:
+        case JOP_LESS_THAN:
+        case JOP_LESS_THAN_IMMEDIATE:
+        case JOP_LESS_THAN_EQUAL:
+        case JOP_EQUALS:
+        case JOP_EQUALS_IMMEDIATE:
+        case JOP_NOT_EQUALS:
+        case JOP_NOT_EQUALS_IMMEDIATE:
+        case JOP_LESS_THAN_JUMP_IF_NOT:
+        case JOP_LESS_THAN_EQUAL_JUMP_IF_NOT:
+        case JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT:
+        case JOP_GREATER_THAN_JUMP_IF_NOT:
+        case JOP_GREATER_THAN_EQUAL_JUMP_IF_NOT:
+        case JOP_GREATER_THAN_IMMEDIATE_JUMP_IF_NOT:
+        case JOP_EQUALS_JUMP_IF_NOT:
+        case JOP_EQUALS_IMMEDIATE_JUMP_IF_NOT:
+        case JOP_NOT_EQUALS_JUMP_IF_NOT:
+        case JOP_NOT_EQUALS_IMMEDIATE_JUMP_IF_NOT:
+        case JOP_LESS_THAN_NUMBER:
+        case JOP_LESS_THAN_EQUAL_NUMBER:
+        case JOP_GREATER_THAN_NUMBER:
+        case JOP_GREATER_THAN_EQUAL_NUMBER:
+            result = JANET_TFLAG_BOOLEAN;
+            break;
+        case JOP_COMPARE:
+        case JOP_LOAD_INTEGER:
+            result = JANET_TFLAG_NUMBER;
+            break;
+        case JOP_LOAD_NIL:
+            result = JANET_TFLAG_NIL;
+            break;
+        case JOP_LOAD_TRUE:
+        case JOP_LOAD_FALSE:
+            result = JANET_TFLAG_BOOLEAN;
+            break;
+        case JOP_LOAD_CONSTANT: {
+            int32_t index = (int32_t)(instr >> 16);
+            if (index < def->constants_length) {
+                result = 1u << janet_type(def->constants[index]);
+                constant = index;
+            }
+            break;
+        }
+        case JOP_LOAD_SELF:
+        case JOP_CLOSURE:
+            result = JANET_TFLAG_FUNCTION;
+            break;
+        case JOP_CALL: {
+            uint32_t callee = instr >> 16;
+            if (callee >= (uint32_t) def->slotcount) return 0;
+            if (consts[callee] >= 0) {
+                Janet f = def->constants[consts[callee]];
+                if (janet_checktype(f, JANET_CFUNCTION) &&
+                        janet_math_returns_number(janet_unwrap_cfunction(f))) {
+                    result = JANET_TFLAG_NUMBER;
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    /* Instructions with a single slot operand may address all 24 bits */
+    if (janet_instructions[op] == JINT_S) a = instr >> 8;
+    if (a >= (uint32_t) def->slotcount) return 0;
+    /* Slots captured by closures can be changed by other functions */
+    types[a] = janet_specialize_captured(def, a) ? JANET_TFLAG_ANY : result;
+    consts[a] = constant;
+    return 1;
+}
+
+/* Get the number specialization of an instruction, or 0 if there is none */
+static uint8_t janet_specialize_instruction(uint32_t instr, const uint32_t *types, int32_t slotcount) {
+    uint32_t b = (instr >> 16) & 0xFF;
+    uint32_t c = instr >> 24;
+    int bnum = b < (uint32_t) slotcount && types[b] == JANET_TFLAG_NUMBER;
+    int cnum = bnum && c < (uint32_t) slotcount && types[c] == JANET_TFLAG_NUMBER;
+    switch (instr & 0xFF) {
+        case JOP_ADD:
+            return cnum ? JOP_ADD_NUMBER : 0;
+        case JOP_SUBTRACT:
+            return cnum ? JOP_SUBTRACT_NUMBER : 0;
+        case JOP_MULTIPLY:
+            return cnum ? JOP_MULTIPLY_NUMBER : 0;
+        case JOP_DIVIDE:
+            return cnum ? JOP_DIVIDE_NUMBER : 0;
+        case JOP_LESS_THAN:
+            return cnum ? JOP_LESS_THAN_NUMBER : 0;
+        case JOP_LESS_THAN_EQUAL:
+            return cnum ? JOP_LESS_THAN_EQUAL_NUMBER : 0;
+        case JOP_GREATER_THAN:
+            return cnum ? JOP_GREATER_THAN_NUMBER : 0;
+        case JOP_GREATER_THAN_EQUAL:
+            return cnum ? JOP_GREATER_THAN_EQUAL_NUMBER : 0;
+        case JOP_ADD_IMMEDIATE:
+            return bnum ? JOP_ADD_IMMEDIATE_NUMBER : 0;
+        case JOP_MULTIPLY_IMMEDIATE:
+            return bnum ? JOP_MULTIPLY_IMMEDIATE_NUMBER : 0;
+        case JOP_DIVIDE_IMMEDIATE:
+            return bnum ? JOP_DIVIDE_IMMEDIATE_NUMBER : 0;
+        default:
+            return 0;
+    }
+}
+
+/* Get the funcdef flags for the specialized instructions in some bytecode */
+int32_t janet_bytecode_specializations(const JanetFuncDef *def) {
+    int32_t flags = 0;
+    for (int32_t i = 0; i < def->bytecode_length; i++) {
+        switch (def->bytecode[i] & 0x7F) {
+            case JOP_ADD_NUMBER:
+            case JOP_SUBTRACT_NUMBER:
+            case JOP_MULTIPLY_NUMBER:
+            case JOP_DIVIDE_NUMBER:
+            case JOP_ADD_IMMEDIATE_NUMBER:
+            case JOP_MULTIPLY_IMMEDIATE_NUMBER:
+            case JOP_DIVIDE_IMMEDIATE_NUMBER:
+                flags |= JANET_FUNCDEF_FLAG_NUMBER_MATH;
+                break;
+            case JOP_LESS_THAN_NUMBER:
+            case JOP_LESS_THAN_EQUAL_NUMBER:
+            case JOP_GREATER_THAN_NUMBER:
+            case JOP_GREATER_THAN_EQUAL_NUMBER:
+                flags |= JANET_FUNCDEF_FLAG_NUMBER_COMPARE;
+                break;
+        }
+    }
+    return flags;
+}
+
+/* Replace generic arithmetic and comparisons with number only instructions
+ * where the operand types are known, and record the specializations used in
+ * the funcdef flags. Run after the closure bitset is known. */
+void janet_bytecode_specialize(JanetFuncDef *def) {
+    int32_t len = def->bytecode_length;
+    int32_t slots = def->slotcount;
+    int32_t nblocks = 0;
+    int32_t targets[JANET_JUMP_TABLE_MAX + 1];
+    if (len == 0 || slots == 0) return;
+
+    /* Find the basic blocks. block[i] is the index of the block starting at i, or -1 */
+    int32_t *block = janet_malloc(sizeof(int32_t) * (size_t) len);
+    if (NULL == block) {
+        JANET_OUT_OF_MEMORY;
+    }
+    for (int32_t i = 0; i < len; i++) block[i] = -1;
+    block[0] = 0;
+    for (int32_t i = 0; i < len; i++) {
+        int n = janet_bytecode_successors(def, i, targets);
+        if (n == 1 && targets[0] == i + 1) continue;
+        for (int j = 0; j < n; j++) {
+            if (targets[j] < 0 || targets[j] >= len) {
+                janet_free(block);
+                return;
+            }
+            block[targets[j]] = 0;
+        }
+        if (i + 1 < len) block[i + 1] = 0;
+    }
+    for (int32_t i = 0; i < len; i++) {
+        if (block[i] >= 0) block[i] = nblocks++;
+    }
+    if ((size_t) nblocks * (size_t) slots > JANET_SPECIALIZE_MAX_STATE) {
+        janet_free(block);
+        return;
+    }
+
+    /* Slot types on entry to each block, and scratch space for one block */
+    uint32_t *entry = janet_calloc((size_t) nblocks * (size_t) slots + (size_t) slots, sizeof(uint32_t));
+    int32_t *consts = janet_malloc(sizeof(int32_t) * (size_t) slots);
+    uint8_t *reached = janet_calloc((size_t) nblocks, 1);
+    if (NULL == entry || NULL == consts || NULL == reached) {
+        JANET_OUT_OF_MEMORY;
+    }
+    uint32_t *types = entry + (size_t) nblocks * (size_t) slots;
+    for (int32_t s = 0; s < slots; s++) entry[s] = JANET_TFLAG_ANY;
+    reached[0] = 1;
+
+    /* Iterate until the slot types stop growing. The second to last pass
+     * makes no changes, and the last pass rewrites instructions. */
+    int changed = 1, rewrite = 0, ok = 1;
+    while (ok && (changed || !rewrite)) {
+        if (!changed) rewrite = 1;
+        changed = 0;
+        for (int32_t start = 0; ok && start < len; start++) {
+            int32_t b = block[start];
+            if (b < 0 || !reached[b]) continue;
+            memcpy(types, entry + (size_t) b * slots, sizeof(uint32_t) * (size_t) slots);
+            for (int32_t s = 0; s < slots; s++) consts[s] = -1;
+            for (int32_t i = start; i < len; i++) {
+                uint32_t instr = def->bytecode[i];
+                if (rewrite && !(instr & 0x80)) {
+                    uint8_t op = janet_specialize_instruction(instr, types, slots);
+                    if (op) def->bytecode[i] = (instr & ~0xFFu) | op;
+                }
+                if (!janet_specialize_step(def, instr, types, consts)) {
+                    ok = 0;
+                    break;
+                }
+                int n = janet_bytecode_successors(def, i, targets);
+                int falls_through = 0;
+                for (int j = 0; j < n; j++) {
+                    if (targets[j] == i + 1 && (i + 1 >= len || block[i + 1] < 0)) {
+                        falls_through = 1;
+                        continue;
+                    }
+                    uint32_t *dest = entry + (size_t) block[targets[j]] * slots;
+                    if (!reached[block[targets[j]]]) {
+                        reached[block[targets[j]]] = 1;
+                        memcpy(dest, types, sizeof(uint32_t) * (size_t) slots);
+                        changed = 1;
+                        continue;
+                    }
+                    for (int32_t s = 0; s < slots; s++) {
+                        if ((dest[s] | types[s]) != dest[s]) {
+                            dest[s] |= types[s];
+                            changed = 1;
+                        }
+                    }
+                }
+                if (!falls_through || i + 1 >= len) break;
+            }
+        }
+        if (rewrite) break;
+    }
+
+    def->flags |= janet_bytecode_specializations(def);
+    janet_free(block);
+    janet_free(entry);
+    janet_free(consts);
+    janet_free(reached);
+}
+
 /* Verify some bytecode */
 int janet_verify(JanetFuncDef *def) {
     int vargs = !!(def->flags & JANET_FUNCDEF_FLAG_VARARG);
@@ -124,6 +1101,29 @@ int janet_verify(JanetFuncDef *def) {
         if ((instr & 0x7F) >= JOP_INSTRUCTION_COUNT) {
             return 3;
         }
+        /* Superinstructions must be followed by the instruction they replace. The
+         * last instruction is checked below, and cannot be a superinstruction. */
+        if (i + 1 < def->bytecode_length &&
+                janet_superinstruction(instr, def->bytecode[i + 1], 1) == -2) {
+            return 10;
+        }
+        /* Jump tables map values to the index of one of the jumps after them */
+        if ((instr & 0x7F) == JOP_JUMP_TABLE) {
+            int32_t index = (int32_t)(instr >> 16);
+            if ((int32_t)((instr >> 8) & 0xFF) >= sc) return 4;
+            if (index >= def->constants_length) return 7;
+            if (!janet_checktype(def->constants[index], JANET_STRUCT)) return 11;
+            const JanetKV *st = janet_unwrap_struct(def->constants[index]);
+            int32_t n = janet_struct_length(st);
+            if (n > JANET_JUMP_TABLE_MAX || i + 1 + n >= def->bytecode_length) return 11;
+            for (int32_t j = 0; j < janet_struct_capacity(st); j++) {
+                if (janet_checktype(st[j].key, JANET_NIL)) continue;
+                if (!janet_checkint(st[j].value)) return 11;
+                int32_t to = janet_unwrap_integer(st[j].value);
+                if (to < 1 || to > n) return 11;
+            }
+            continue;
+        }
         enum JanetInstructionType type = janet_instructions[instr & 0x7F];
         switch (type) {
             case JINT_0:
@@ -169,6 +1169,11 @@ int janet_verify(JanetFuncDef *def) {
             case JINT_SD: {
                 if ((int32_t)((instr >> 8) & 0xFF) >= sc) return 4;
                 if ((int32_t)(instr >> 16) >= def->defs_length) return 6;
+                /* Captured slots are read from this frame */
+                JanetFuncDef *fd = def->defs[instr >> 16];
+                for (int32_t j = 0; j < fd->captures_length; j++) {
+                    if (fd->captures[j] < 0 || fd->captures[j] >= sc) return 4;
+                }
                 continue;
             }
             case JINT_SC: {
@@ -216,6 +1221,7 @@ JanetFuncDef *janet_funcdef_alloc(void) {
     def->constants = NULL;
     def->bytecode = NULL;
     def->closure_bitset = NULL;
+    def->captures = NULL;
     def->flags = 0;
     def->slotcount = 0;
     def->arity = 0;
@@ -229,6 +1235,10 @@ JanetFuncDef *janet_funcdef_alloc(void) {
     def->constants_length = 0;
     def->bytecode_length = 0;
     def->environments_length = 0;
+    def->captures_length = 0;
+    def->jit = NULL;
+    def->lazy = NULL;
+    def->hotness = 0;
     return def;
 }
 
@@ -24,6 +24,7 @@
 #include "features.h"
 #include <janet.h>
 #include "state.h"
+#include "gc.h"
 #include "fiber.h"
 #endif
 
@@ -123,6 +124,19 @@ type janet_get##name(const Janet *argv, int32_t n) { \
     return janet_unwrap_##name(x); \
 }
 
+/* Mutable values returned to native code go through the write barrier, as
+ * callers are free to write references into them. */
+#define DEFINE_MUTABLE_GETTER(name, NAME, type) \
+type janet_get##name(const Janet *argv, int32_t n) { \
+    Janet x = argv[n]; \
+    if (!janet_checktype(x, JANET_##NAME)) { \
+        janet_panic_type(x, n, JANET_TFLAG_##NAME); \
+    } \
+    type ret = janet_unwrap_##name(x); \
+    janet_gc_barrier(ret); \
+    return ret; \
+}
+
 #define DEFINE_OPT(name, NAME, type) \
 type janet_opt##name(const Janet *argv, int32_t argc, int32_t n, type dflt) { \
     if (n >= argc) return dflt; \
@@ -167,9 +181,9 @@ Janet janet_nextmethod(const JanetMethod *methods, Janet key) {
 }
 
 DEFINE_GETTER(number, NUMBER, double)
-DEFINE_GETTER(array, ARRAY, JanetArray *)
+DEFINE_MUTABLE_GETTER(array, ARRAY, JanetArray *)
 DEFINE_GETTER(tuple, TUPLE, const Janet *)
-DEFINE_GETTER(table, TABLE, JanetTable *)
+DEFINE_MUTABLE_GETTER(table, TABLE, JanetTable *)
 DEFINE_GETTER(struct, STRUCT, const JanetKV *)
 DEFINE_GETTER(string, STRING, const uint8_t *)
 DEFINE_GETTER(keyword, KEYWORD, const uint8_t *)
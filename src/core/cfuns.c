@@ -28,6 +28,8 @@
 #include "vector.h"
 #endif
 
+#include <math.h>
+
 static int arity1or2(JanetFopts opts, JanetSlot *args) {
     (void) opts;
     int32_t arity = janet_v_count(args);
@@ -110,6 +112,112 @@ static int can_slot_be_imm(JanetSlot s, int8_t *out) {
     return can_be_imm(s.constant, out);
 }
 
+/* Check if all slots are constants */
+static int all_constant(JanetSlot *args) {
+    for (int32_t i = 0; i < janet_v_count(args); i++) {
+        if (!(args[i].flags & JANET_SLOT_CONSTANT)) return 0;
+    }
+    return 1;
+}
+
+/* Evaluate a binary instruction at compile time, the same way the vm would.
+ * Returns 0 if the instruction cannot be folded, in which case it is emitted
+ * normally and any error happens at runtime. */
+static int fold_binop(int op, Janet lhs, Janet rhs, Janet *out) {
+    if (op == JOP_EQUALS || op == JOP_NOT_EQUALS) {
+        int eq = janet_equals(lhs, rhs);
+        *out = janet_wrap_boolean(op == JOP_EQUALS ? eq : !eq);
+        return 1;
+    }
+    if (!janet_checktype(lhs, JANET_NUMBER) || !janet_checktype(rhs, JANET_NUMBER)) return 0;
+    double x1 = janet_unwrap_number(lhs);
+    double x2 = janet_unwrap_number(rhs);
+    switch (op) {
+        default:
+            break;
+        case JOP_ADD:
+            *out = janet_wrap_number(x1 + x2);
+            return 1;
+        case JOP_SUBTRACT:
+            *out = janet_wrap_number(x1 - x2);
+            return 1;
+        case JOP_MULTIPLY:
+            *out = janet_wrap_number(x1 * x2);
+            return 1;
+        case JOP_DIVIDE:
+            *out = janet_wrap_number(x1 / x2);
+            return 1;
+        case JOP_MODULO:
+            *out = janet_wrap_number(x1 - x2 * floor(x1 / x2));
+            return 1;
+        case JOP_REMAINDER:
+            *out = janet_wrap_number(fmod(x1, x2));
+            return 1;
+        case JOP_LESS_THAN:
+            *out = janet_wrap_boolean(x1 < x2);
+            return 1;
+        case JOP_LESS_THAN_EQUAL:
+            *out = janet_wrap_boolean(x1 <= x2);
+            return 1;
+        case JOP_GREATER_THAN:
+            *out = janet_wrap_boolean(x1 > x2);
+            return 1;
+        case JOP_GREATER_THAN_EQUAL:
+            *out = janet_wrap_boolean(x1 >= x2);
+            return 1;
+    }
+
+    /* Bitwise operators only fold for integers and in range shifts */
+    if (!janet_checkint(lhs) || !janet_checkint(rhs)) return 0;
+    int32_t i1 = janet_unwrap_integer(lhs);
+    int32_t i2 = janet_unwrap_integer(rhs);
+    switch (op) {
+        default:
+            return 0;
+        case JOP_BAND:
+            *out = janet_wrap_integer(i1 & i2);
+            return 1;
+        case JOP_BOR:
+            *out = janet_wrap_integer(i1 | i2);
+            return 1;
+        case JOP_BXOR:
+            *out = janet_wrap_integer(i1 ^ i2);
+            return 1;
+        case JOP_SHIFT_LEFT:
+        case JOP_SHIFT_RIGHT:
+        case JOP_SHIFT_RIGHT_UNSIGNED:
+            break;
+    }
+    if (i2 < 0 || i2 > 31) return 0;
+    if (op == JOP_SHIFT_LEFT) {
+        *out = janet_wrap_integer((int32_t)((uint32_t) i1 << i2));
+    } else if (op == JOP_SHIFT_RIGHT) {
+        *out = janet_wrap_integer(i1 >> i2);
+    } else {
+        *out = janet_wrap_integer((int32_t)((uint32_t) i1 >> i2));
+    }
+    return 1;
+}
+
+/* Fold a reduction over constant arguments. Mirrors the instructions that
+ * opreduce emits. */
+static int fold_reduce(JanetSlot *args, int op, Janet nullary, Janet *out) {
+    int32_t len = janet_v_count(args);
+    if (!all_constant(args)) return 0;
+    if (len == 1) {
+        if (op == JOP_SUBTRACT) {
+            return fold_binop(JOP_MULTIPLY, args[0].constant, janet_wrap_integer(-1), out);
+        }
+        return fold_binop(op, nullary, args[0].constant, out);
+    }
+    Janet acc = args[0].constant;
+    for (int32_t i = 1; i < len; i++) {
+        if (!fold_binop(op, acc, args[i].constant, &acc)) return 0;
+    }
+    *out = acc;
+    return 1;
+}
+
 /* Emit a series of instructions instead of a function call to a math op */
 static JanetSlot opreduce(
     JanetFopts opts,
@@ -121,11 +229,14 @@ static JanetSlot opreduce(
     int32_t i, len;
     int8_t imm = 0;
     int neg = opim < 0;
+    Janet folded;
     if (opim < 0) opim = -opim;
     len = janet_v_count(args);
     JanetSlot t;
     if (len == 0) {
         return janetc_cslot(nullary);
+    } else if (fold_reduce(args, op, nullary, &folded)) {
+        return janetc_cslot(folded);
     } else if (len == 1) {
         t = janetc_gettarget(opts);
         /* Special case subtract to be times -1 */
@@ -219,6 +330,22 @@ static JanetSlot do_put(JanetFopts opts, JanetSlot *args) {
     }
 }
 static JanetSlot do_length(JanetFopts opts, JanetSlot *args) {
+    /* Only immutable values have a length known at compile time */
+    if (args[0].flags & JANET_SLOT_CONSTANT) {
+        Janet x = args[0].constant;
+        switch (janet_type(x)) {
+            default:
+                break;
+            case JANET_STRING:
+            case JANET_SYMBOL:
+            case JANET_KEYWORD:
+                return janetc_cslot(janet_wrap_integer(janet_string_length(janet_unwrap_string(x))));
+            case JANET_TUPLE:
+                return janetc_cslot(janet_wrap_integer(janet_tuple_length(janet_unwrap_tuple(x))));
+            case JANET_STRUCT:
+                return janetc_cslot(janet_wrap_integer(janet_struct_length(janet_unwrap_struct(x))));
+        }
+    }
     return genericSS(opts, JOP_LENGTH, args[0]);
 }
 static JanetSlot do_yield(JanetFopts opts, JanetSlot *args) {
@@ -292,6 +419,9 @@ static JanetSlot do_rshiftu(JanetFopts opts, JanetSlot *args) {
     return opreduce(opts, args, JOP_SHIFT_RIGHT_UNSIGNED, JOP_SHIFT_RIGHT_UNSIGNED_IMMEDIATE, janet_wrap_integer(1));
 }
 static JanetSlot do_bnot(JanetFopts opts, JanetSlot *args) {
+    if ((args[0].flags & JANET_SLOT_CONSTANT) && janet_checkint(args[0].constant)) {
+        return janetc_cslot(janet_wrap_integer(~janet_unwrap_integer(args[0].constant)));
+    }
     return genericSS(opts, JOP_BNOT, args[0]);
 }
 
@@ -313,6 +443,15 @@ static JanetSlot compreduce(
                ? janetc_cslot(janet_wrap_false())
                : janetc_cslot(janet_wrap_true());
     }
+    if (all_constant(args)) {
+        /* Stop at the first result that would jump to the end */
+        Janet result = janet_wrap_nil();
+        for (i = 1; i < len; i++) {
+            if (!fold_binop(op, args[i - 1].constant, args[i].constant, &result)) break;
+            if (janet_truthy(result) == invert) return janetc_cslot(result);
+        }
+        if (i == len) return janetc_cslot(result);
+    }
     t = janetc_gettarget(opts);
     for (i = 1; i < len; i++) {
         if (opim && can_slot_be_imm(args[i], &imm)) {
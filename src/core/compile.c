@@ -128,6 +128,7 @@ void janetc_scope(JanetScope *s, JanetCompiler *c, int flags, const char *name)
     scope.consts = NULL;
     scope.syms = NULL;
     scope.envs = NULL;
+    scope.captures = NULL;
     scope.defs = NULL;
     scope.bytecode_start = janet_v_count(c->buffer);
     scope.flags = flags;
@@ -178,6 +179,7 @@ void janetc_popscope(JanetCompiler *c) {
     janet_v_free(oldscope->consts);
     janet_v_free(oldscope->syms);
     janet_v_free(oldscope->envs);
+    janet_v_free(oldscope->captures);
     janet_v_free(oldscope->defs);
     janetc_regalloc_deinit(&oldscope->ra);
     janetc_regalloc_deinit(&oldscope->ua);
@@ -286,6 +288,13 @@ JanetSlot janetc_resolve(
             case JANET_BINDING_DEF:
             case JANET_BINDING_MACRO: /* Macro should function like defs when not in calling pos */
                 ret = janetc_cslot(binding.value);
+                if (binding.type == JANET_BINDING_DEF) {
+                    Janet entry = janet_table_get(c->env, janet_wrap_symbol(sym));
+                    if (janet_checktype(entry, JANET_TABLE) &&
+                            janet_truthy(janet_table_get(janet_unwrap_table(entry), janet_ckeywordv("inline")))) {
+                        ret.flags |= JANET_SLOT_INLINE;
+                    }
+                }
                 break;
             case JANET_BINDING_DYNAMIC_DEF:
             case JANET_BINDING_DYNAMIC_MACRO:
@@ -333,21 +342,51 @@ found:
         return ret;
     }
 
-    /* non-local scope needs to expose its environment */
-    pair->keep = 1;
-    while (scope && !(scope->flags & JANET_SCOPE_FUNCTION))
-        scope = scope->parent;
-    janet_assert(scope, "invalid scopes");
-    scope->flags |= JANET_SCOPE_ENV;
+    int32_t envindex;
+    if (ret.flags & JANET_SLOT_MUTABLE) {
+        /* non-local scope needs to expose its environment */
+        pair->keep = 1;
+        while (scope && !(scope->flags & JANET_SCOPE_FUNCTION)) {
+            /* A loop that defines a captured variable gets a new stack
+             * frame for each iteration, see janetc_while */
+            if (scope->flags & JANET_SCOPE_WHILE)
+                scope->flags |= JANET_SCOPE_CLOSURE;
+            scope = scope->parent;
+        }
+        janet_assert(scope, "invalid scopes");
+        scope->flags |= JANET_SCOPE_ENV;
 
-    /* In the function scope, allocate the slot as an upvalue */
-    janetc_regalloc_touch(&scope->ua, ret.index);
+        /* In the function scope, allocate the slot as an upvalue */
+        janetc_regalloc_touch(&scope->ua, ret.index);
 
-    /* Iterate through child scopes and make sure environment is propagated */
-    scope = scope->child;
+        /* Iterate through child scopes and make sure environment is propagated */
+        scope = scope->child;
+        envindex = -1;
+    } else {
+        /* An immutable binding already has its final value when a closure is
+         * created, so the closure captures a copy instead of the stack frame.
+         * The copies are kept in an environment with envindex -2. */
+        while (scope && !(scope->flags & JANET_SCOPE_FUNCTION))
+            scope = scope->parent;
+        janet_assert(scope, "invalid scopes");
+        scope = scope->child;
+        while (scope && !(scope->flags & JANET_SCOPE_FUNCTION))
+            scope = scope->child;
+        janet_assert(scope, "invalid scopes");
+        int32_t len = janet_v_count(scope->captures);
+        int32_t capture = len;
+        for (int32_t j = 0; j < len; j++) {
+            if (scope->captures[j] == ret.index) {
+                capture = j;
+                break;
+            }
+        }
+        if (capture == len) janet_v_push(scope->captures, ret.index);
+        ret.index = capture;
+        envindex = -2;
+    }
 
     /* Propagate env up to current scope */
-    int32_t envindex = -1;
     while (scope) {
         if (scope->flags & JANET_SCOPE_FUNCTION) {
             int32_t j, len;
@@ -509,6 +548,200 @@ void janetc_throwaway(JanetFopts opts, Janet x) {
     }
 }
 
+/* Limits on the size of functions that can be inlined */
+#define JANET_INLINE_MAX_LENGTH 24
+#define JANET_INLINE_MAX_SLOTS 16
+
+/* Get a near register slot for inlined code */
+static JanetSlot janetc_inline_slot(int32_t reg) {
+    JanetSlot ret;
+    ret.flags = JANET_SLOTTYPE_ANY;
+    ret.index = reg;
+    ret.constant = janet_wrap_nil();
+    ret.envindex = -1;
+    return ret;
+}
+
+/* Check if the bytecode of a function can be copied into its caller */
+static int janetc_can_inline(JanetFuncDef *def, int32_t argc) {
+    if (def->bytecode_length > JANET_INLINE_MAX_LENGTH) return 0;
+    if (def->slotcount > JANET_INLINE_MAX_SLOTS) return 0;
+    if (def->environments_length || def->defs_length) return 0;
+    if (def->flags & (JANET_FUNCDEF_FLAG_VARARG | JANET_FUNCDEF_FLAG_NEEDSENV)) return 0;
+    if (def->arity != argc || def->min_arity != argc || def->max_arity != argc) return 0;
+    for (int32_t i = 0; i < def->bytecode_length; i++) {
+        uint32_t instr = def->bytecode[i];
+        if (instr & 0x80) return 0;
+        switch (janet_instructions[instr & 0x7F]) {
+            case JINT_SD:
+            case JINT_SES:
+                return 0;
+            default:
+                break;
+        }
+        if ((instr & 0x7F) == JOP_LOAD_SELF || (instr & 0x7F) == JOP_JUMP_TABLE) return 0;
+    }
+    return 1;
+}
+
+/* Copy the bytecode of a small function into the caller in place of a call.
+ * Each slot of the callee gets a new register, returns become moves to the
+ * target, and tail calls become calls. Returns 0 if the function cannot be
+ * inlined, in which case nothing is emitted. */
+static int janetc_inline(JanetFopts opts, JanetSlot *slots, JanetFuncDef *def, JanetSlot *out) {
+    JanetCompiler *c = opts.compiler;
+    int32_t argc = janet_v_count(slots);
+    if (def->lazy) janet_funcdef_force(def);
+    int32_t len = def->bytecode_length;
+    int32_t regs[JANET_INLINE_MAX_SLOTS];
+    int32_t newpc[JANET_INLINE_MAX_LENGTH + 1];
+    int32_t jumps[JANET_INLINE_MAX_LENGTH];
+    int32_t targets[JANET_INLINE_MAX_LENGTH];
+    int32_t jumpcount = 0;
+    int tail = (opts.flags & JANET_FOPTS_TAIL) && !(c->scope->flags & JANET_SCOPE_TOP);
+
+    if (!janetc_can_inline(def, argc)) return 0;
+
+    /* Arguments in registers are used in place if the callee never writes them */
+    uint32_t written = 0;
+    for (int32_t i = 0; i < len; i++) {
+        int32_t uses[3], dest;
+        janet_bytecode_slots(janet_bytecode_generic(def->bytecode[i]), uses, &dest);
+        if (dest >= 0 && dest < argc) written |= 1u << dest;
+    }
+
+    /* Allocate registers for the callee's slots */
+    uint32_t allocated = 0;
+    for (int32_t i = 0; i < def->slotcount; i++) {
+        JanetSlot arg = i < argc ? slots[i] : janetc_cslot(janet_wrap_nil());
+        if (i < argc && !(written & (1u << i)) && arg.envindex < 0 && arg.index >= 0 && arg.index < 0xF0 &&
+                !(arg.flags & (JANET_SLOT_CONSTANT | JANET_SLOT_REF | JANET_SLOT_MUTABLE))) {
+            regs[i] = arg.index;
+            continue;
+        }
+        regs[i] = janetc_regalloc_1(&c->scope->ra);
+        allocated |= 1u << i;
+        if (regs[i] >= 0xF0) {
+            for (int32_t j = 0; j <= i; j++) {
+                if (allocated & (1u << j)) janetc_regalloc_free(&c->scope->ra, regs[j]);
+            }
+            return 0;
+        }
+    }
+
+    for (int32_t i = 0; i < argc; i++) {
+        if (allocated & (1u << i)) janetc_copy(c, janetc_inline_slot(regs[i]), slots[i]);
+    }
+
+    JanetSlot retslot;
+    if (tail) {
+        retslot = janetc_cslot(janet_wrap_nil());
+        retslot.flags = JANET_SLOT_RETURNED;
+    } else {
+        retslot = janetc_gettarget(opts);
+    }
+
+#define REG(x) ((uint32_t) regs[(x)])
+    for (int32_t i = 0; i < len; i++) {
+        uint32_t instr = janet_bytecode_generic(def->bytecode[i]);
+        uint32_t op = instr & 0x7F;
+        uint32_t a = (instr >> 8) & 0xFF;
+        uint32_t b = (instr >> 16) & 0xFF;
+        newpc[i] = janet_v_count(c->buffer);
+        switch (op) {
+            case JOP_RETURN:
+            case JOP_RETURN_NIL: {
+                JanetSlot value = op == JOP_RETURN
+                                  ? janetc_inline_slot(regs[instr >> 8])
+                                  : janetc_cslot(janet_wrap_nil());
+                if (tail) {
+                    janetc_return(c, value);
+                    continue;
+                }
+                janetc_copy(c, retslot, value);
+                if (i + 1 < len) {
+                    jumps[jumpcount] = janet_v_count(c->buffer);
+                    targets[jumpcount++] = len;
+                    janetc_emit(c, JOP_JUMP);
+                }
+                continue;
+            }
+            case JOP_TAILCALL:
+                if (tail) {
+                    janetc_emit(c, JOP_TAILCALL | (REG(instr >> 8) << 8));
+                    continue;
+                }
+                janetc_emit_ss(c, JOP_CALL, retslot, janetc_inline_slot(regs[instr >> 8]), 1);
+                if (i + 1 < len) {
+                    jumps[jumpcount] = janet_v_count(c->buffer);
+                    targets[jumpcount++] = len;
+                    janetc_emit(c, JOP_JUMP);
+                }
+                continue;
+            default:
+                break;
+        }
+        switch (janet_instructions[op]) {
+            case JINT_0:
+                janetc_emit(c, instr);
+                break;
+            case JINT_S:
+                janetc_emit(c, op | (REG(instr >> 8) << 8));
+                break;
+            case JINT_L:
+                jumps[jumpcount] = janet_v_count(c->buffer);
+                targets[jumpcount++] = i + ((int32_t) instr >> 8);
+                janetc_emit(c, op);
+                break;
+            case JINT_SS:
+                janetc_emit(c, op | (REG(a) << 8) | (REG(instr >> 16) << 16));
+                break;
+            case JINT_SL:
+                jumps[jumpcount] = janet_v_count(c->buffer);
+                targets[jumpcount++] = i + ((int32_t) instr >> 16);
+                janetc_emit(c, op | (REG(a) << 8));
+                break;
+            case JINT_ST:
+            case JINT_SI:
+            case JINT_SU:
+                janetc_emit(c, (instr & 0xFFFF00FFu) | (REG(a) << 8));
+                break;
+            case JINT_SSS:
+                janetc_emit(c, op | (REG(a) << 8) | (REG(b) << 16) | (REG(instr >> 24) << 24));
+                break;
+            case JINT_SSI:
+            case JINT_SSU:
+                janetc_emit(c, (instr & 0xFF0000FFu) | (REG(a) << 8) | (REG(b) << 16));
+                break;
+            case JINT_SC:
+                janetc_copy(c, janetc_inline_slot(regs[a]),
+                            janetc_cslot(def->constants[instr >> 16]));
+                break;
+            default:
+                break;
+        }
+    }
+#undef REG
+    newpc[len] = janet_v_count(c->buffer);
+
+    /* Patch jumps now that the position of every instruction is known */
+    for (int32_t i = 0; i < jumpcount; i++) {
+        int32_t offset = newpc[targets[i]] - jumps[i];
+        uint32_t instr = c->buffer[jumps[i]];
+        if ((instr & 0x7F) == JOP_JUMP) {
+            c->buffer[jumps[i]] = instr | ((uint32_t) offset << 8);
+        } else {
+            c->buffer[jumps[i]] = instr | ((uint32_t) offset << 16);
+        }
+    }
+
+    for (int32_t i = 0; i < def->slotcount; i++) {
+        if (allocated & (1u << i)) janetc_regalloc_free(&c->scope->ra, regs[i]);
+    }
+    *out = retslot;
+    return 1;
+}
+
 /* Compile a call or tailcall instruction */
 static JanetSlot janetc_call(JanetFopts opts, JanetSlot *slots, JanetSlot fun) {
     JanetSlot retslot;
@@ -523,7 +756,11 @@ static JanetSlot janetc_call(JanetFopts opts, JanetSlot *slots, JanetSlot fun) {
                 retslot = o->optimize(opts, slots);
             }
         }
-        /* TODO janet function inlining (no c functions)*/
+        if (!specialized && (fun.flags & JANET_SLOT_INLINE) &&
+                janet_checktype(fun.constant, JANET_FUNCTION)) {
+            JanetFunction *f = janet_unwrap_function(fun.constant);
+            specialized = janetc_inline(opts, slots, f->def, &retslot);
+        }
     }
     if (!specialized) {
         int32_t min_arity = janetc_pushslots(c, slots);
@@ -844,6 +1081,7 @@ void janet_def_addflags(JanetFuncDef *def) {
     if (def->environments)    set_flags |= JANET_FUNCDEF_FLAG_HASENVS;
     if (def->sourcemap)       set_flags |= JANET_FUNCDEF_FLAG_HASSOURCEMAP;
     if (def->closure_bitset)  set_flags |= JANET_FUNCDEF_FLAG_HASCLOBITSET;
+    if (def->captures)        set_flags |= JANET_FUNCDEF_FLAG_HASCAPTURES;
     /* negative checks */
     if (!def->name)           unset_flags |= JANET_FUNCDEF_FLAG_HASNAME;
     if (!def->source)         unset_flags |= JANET_FUNCDEF_FLAG_HASSOURCE;
@@ -851,6 +1089,7 @@ void janet_def_addflags(JanetFuncDef *def) {
     if (!def->environments)   unset_flags |= JANET_FUNCDEF_FLAG_HASENVS;
     if (!def->sourcemap)      unset_flags |= JANET_FUNCDEF_FLAG_HASSOURCEMAP;
     if (!def->closure_bitset) unset_flags |= JANET_FUNCDEF_FLAG_HASCLOBITSET;
+    if (!def->captures)       unset_flags |= JANET_FUNCDEF_FLAG_HASCAPTURES;
     /* Update flags */
     def->flags |= set_flags;
     def->flags &= ~unset_flags;
@@ -870,6 +1109,9 @@ JanetFuncDef *janetc_pop_funcdef(JanetCompiler *c) {
     def->environments_length = janet_v_count(scope->envs);
     def->environments = janet_v_flatten(scope->envs);
 
+    def->captures_length = janet_v_count(scope->captures);
+    def->captures = janet_v_flatten(scope->captures);
+
     def->constants_length = janet_v_count(scope->consts);
     def->constants = janet_v_flatten(scope->consts);
 
@@ -923,6 +1165,11 @@ JanetFuncDef *janetc_pop_funcdef(JanetCompiler *c) {
         def->closure_bitset = chunks;
     }
 
+    janet_bytecode_peephole(def);
+    janet_bytecode_compact(def);
+    janet_bytecode_fuse(def);
+    janet_bytecode_specialize(def);
+
     /* Pop the scope */
     janetc_popscope(c);
 
@@ -89,6 +89,7 @@ typedef struct JanetSpecial JanetSpecial;
 #define JANET_SLOT_DEP_WARN 0x400000
 #define JANET_SLOT_DEP_ERROR 0x800000
 #define JANET_SLOT_SPLICED 0x1000000
+#define JANET_SLOT_INLINE 0x2000000
 
 #define JANET_SLOTTYPE_ANY 0xFFFF
 
@@ -144,6 +145,10 @@ struct JanetScope {
      * that corresponds to the direct parent's stack will always have value 0. */
     int32_t *envs;
 
+    /* Slots of the parent function copied into a new environment when a
+     * closure is created. Only immutable bindings are captured this way. */
+    int32_t *captures;
+
     int32_t bytecode_start;
     int flags;
 };
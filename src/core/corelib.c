@@ -26,6 +26,7 @@
 #include <math.h>
 #include "compile.h"
 #include "state.h"
+#include "gc.h"
 #include "util.h"
 #endif
 
@@ -549,6 +550,132 @@ JANET_CORE_FN(janet_core_gcinterval,
     return janet_wrap_number((double) janet_vm.gc_interval);
 }
 
+JANET_CORE_FN(janet_core_gcsetbudget,
+              "(gcsetbudget budget)",
+              "Set the number of objects the garbage collector may visit in one step of an "
+              "incremental collection. Full collections of the heap are then split into many "
+              "small steps, interleaved with the program, instead of pausing for the whole "
+              "collection at once. A budget of 0 disables incremental collection.") {
+    janet_fixarity(argc, 1);
+    janet_vm.gc_step_budget = janet_getsize(argv, 0);
+    return janet_wrap_nil();
+}
+
+JANET_CORE_FN(janet_core_gcbudget,
+              "(gcbudget)",
+              "Returns the number of objects the garbage collector may visit in one step of an "
+              "incremental collection, or 0 if incremental collection is disabled.") {
+    (void) argv;
+    janet_fixarity(argc, 0);
+    return janet_wrap_number((double) janet_vm.gc_step_budget);
+}
+
+JANET_CORE_FN(janet_core_gcstats,
+              "(gc/stats)",
+              "Returns a table of garbage collection statistics. Times are in seconds, and each step "
+              "of an incremental collection counts as a separate pause for the maximum times. "
+              "The :types entry maps each type of heap object to its live :count and approximate :bytes.") {
+    (void) argv;
+    janet_fixarity(argc, 0);
+    JanetGCStats stats;
+    JanetGCTypeStats types[JANET_GC_TYPE_COUNT];
+    janet_gcstats(&stats);
+    janet_gcstats_types(types);
+    JanetTable *typetab = janet_table(JANET_GC_TYPE_COUNT);
+    for (int i = 0; i < JANET_GC_TYPE_COUNT; i++) {
+        if (!types[i].count) continue;
+        JanetTable *entry = janet_table(2);
+        janet_table_put(entry, janet_ckeywordv("count"), janet_wrap_number((double) types[i].count));
+        janet_table_put(entry, janet_ckeywordv("bytes"), janet_wrap_number((double) types[i].bytes));
+        janet_table_put(typetab, janet_ckeywordv(types[i].name), janet_wrap_table(entry));
+    }
+    JanetTable *t = janet_table(12);
+    janet_table_put(t, janet_ckeywordv("collections"), janet_wrap_number((double) stats.collections));
+    janet_table_put(t, janet_ckeywordv("major-collections"), janet_wrap_number((double) stats.major_collections));
+    janet_table_put(t, janet_ckeywordv("mark-time"), janet_wrap_number(stats.mark_time));
+    janet_table_put(t, janet_ckeywordv("mark-time-max"), janet_wrap_number(stats.mark_time_max));
+    janet_table_put(t, janet_ckeywordv("sweep-time"), janet_wrap_number(stats.sweep_time));
+    janet_table_put(t, janet_ckeywordv("sweep-time-max"), janet_wrap_number(stats.sweep_time_max));
+    janet_table_put(t, janet_ckeywordv("blocks"), janet_wrap_number((double) stats.block_count));
+    janet_table_put(t, janet_ckeywordv("next-collection"), janet_wrap_number((double) stats.next_collection));
+    janet_table_put(t, janet_ckeywordv("last-freed-blocks"), janet_wrap_number((double) stats.last_freed_blocks));
+    janet_table_put(t, janet_ckeywordv("last-freed-bytes"), janet_wrap_number((double) stats.last_freed_bytes));
+    janet_table_put(t, janet_ckeywordv("types"), janet_wrap_table(typetab));
+    return janet_wrap_table(t);
+}
+
+JANET_CORE_FN(janet_core_gcheapsnapshot,
+              "(gc/heap-snapshot &opt buffer)",
+              "Write a snapshot of every object on the heap to a buffer. The first line lists the ids "
+              "of the gc roots, as `root <id>...`. Each following line describes one object as "
+              "`<id> <type> <bytes> <referenced id>...`, where ids are addresses in hexadecimal and "
+              "bytes is the approximate memory used by the object. Returns the buffer.") {
+    janet_arity(argc, 0, 1);
+    JanetBuffer *buffer = janet_optbuffer(argv, argc, 0, 4096);
+    janet_heap_snapshot(buffer);
+    return janet_wrap_buffer(buffer);
+}
+
+JANET_CORE_FN(janet_core_gcsampleallocations,
+              "(gc/sample-allocations rate)",
+              "Record the function and bytecode offset of one in every `rate` allocations. Use "
+              "`gc/allocation-samples` to get the results. A rate of 0 stops sampling.") {
+    janet_fixarity(argc, 1);
+    janet_gcsample(janet_getsize(argv, 0));
+    return janet_wrap_nil();
+}
+
+JANET_CORE_FN(janet_core_gcallocationsamples,
+              "(gc/allocation-samples &opt clear)",
+              "Get the allocations recorded since sampling started, grouped by allocation site and "
+              "type. Returns an array of tables with the keys :function, :source, :line, :column, "
+              ":pc, :type, :count, and :bytes, where :count and :bytes are for the sampled "
+              "allocations only. If `clear` is truthy, the samples are discarded.") {
+    janet_arity(argc, 0, 1);
+    const JanetGCSample *samples;
+    size_t count = janet_gcsamples(&samples);
+    JanetTable *sites = janet_table(0);
+    JanetArray *result = janet_array(0);
+    for (size_t i = 0; i < count; i++) {
+        const JanetGCSample *sample = samples + i;
+        Janet key[3];
+        key[0] = janet_wrap_pointer(sample->def);
+        key[1] = janet_wrap_integer(sample->pc);
+        key[2] = janet_wrap_integer(sample->type);
+        Janet keyv = janet_wrap_tuple(janet_tuple_n(key, 3));
+        Janet site = janet_table_get(sites, keyv);
+        if (janet_checktype(site, JANET_NIL)) {
+            JanetTable *t = janet_table(8);
+            JanetFuncDef *def = sample->def;
+            if (NULL != def) {
+                if (def->name) janet_table_put(t, janet_ckeywordv("function"), janet_wrap_string(def->name));
+                if (def->source) janet_table_put(t, janet_ckeywordv("source"), janet_wrap_string(def->source));
+                if (def->sourcemap && sample->pc < def->bytecode_length) {
+                    JanetSourceMapping mapping = def->sourcemap[sample->pc];
+                    janet_table_put(t, janet_ckeywordv("line"), janet_wrap_integer(mapping.line));
+                    janet_table_put(t, janet_ckeywordv("column"), janet_wrap_integer(mapping.column));
+                }
+                janet_table_put(t, janet_ckeywordv("pc"), janet_wrap_integer(sample->pc));
+            }
+            janet_table_put(t, janet_ckeywordv("type"), janet_ckeywordv(janet_gc_type_names[sample->type]));
+            janet_table_put(t, janet_ckeywordv("count"), janet_wrap_number(0));
+            janet_table_put(t, janet_ckeywordv("bytes"), janet_wrap_number(0));
+            site = janet_wrap_table(t);
+            janet_table_put(sites, keyv, site);
+            janet_array_push(result, site);
+        }
+        JanetTable *t = janet_unwrap_table(site);
+        Janet kcount = janet_ckeywordv("count");
+        Janet kbytes = janet_ckeywordv("bytes");
+        janet_table_put(t, kcount, janet_wrap_number(janet_unwrap_number(janet_table_get(t, kcount)) + 1));
+        janet_table_put(t, kbytes, janet_wrap_number(janet_unwrap_number(janet_table_get(t, kbytes)) + (double) sample->size));
+    }
+    if (argc > 0 && janet_truthy(argv[0])) {
+        janet_gcsamples_clear();
+    }
+    return janet_wrap_array(result);
+}
+
 JANET_CORE_FN(janet_core_type,
               "(type x)",
               "Returns the type of `x` as a keyword. `x` is one of:\n\n"
@@ -971,6 +1098,12 @@ static void janet_load_libs(JanetTable *env) {
         JANET_CORE_REG("gccollect", janet_core_gccollect),
         JANET_CORE_REG("gcsetinterval", janet_core_gcsetinterval),
         JANET_CORE_REG("gcinterval", janet_core_gcinterval),
+        JANET_CORE_REG("gcsetbudget", janet_core_gcsetbudget),
+        JANET_CORE_REG("gcbudget", janet_core_gcbudget),
+        JANET_CORE_REG("gc/stats", janet_core_gcstats),
+        JANET_CORE_REG("gc/heap-snapshot", janet_core_gcheapsnapshot),
+        JANET_CORE_REG("gc/sample-allocations", janet_core_gcsampleallocations),
+        JANET_CORE_REG("gc/allocation-samples", janet_core_gcallocationsamples),
         JANET_CORE_REG("type", janet_core_type),
         JANET_CORE_REG("hash", janet_core_hash),
         JANET_CORE_REG("getline", janet_core_getline),
@@ -994,6 +1127,7 @@ static void janet_load_libs(JanetTable *env) {
     janet_lib_buffer(env);
     janet_lib_table(env);
     janet_lib_struct(env);
+    janet_lib_hmap(env);
     janet_lib_fiber(env);
     janet_lib_os(env);
     janet_lib_parse(env);
@@ -1004,12 +1138,18 @@ static void janet_load_libs(JanetTable *env) {
 #ifdef JANET_PEG
     janet_lib_peg(env);
 #endif
+#ifdef JANET_JSON
+    janet_lib_json(env);
+#endif
 #ifdef JANET_ASSEMBLER
     janet_lib_asm(env);
 #endif
 #ifdef JANET_INT_TYPES
     janet_lib_inttypes(env);
 #endif
+#ifdef JANET_TYPED_ARRAY
+    janet_lib_typed_array(env);
+#endif
 #ifdef JANET_EV
     janet_lib_ev(env);
 #endif
@@ -1203,7 +1343,7 @@ JanetTable *janet_core_env(JanetTable *replacements) {
     Janet marsh_out = janet_unmarshal(
                           janet_core_image,
                           janet_core_image_size,
-                          0,
+                          JANET_MARSHAL_LAZY,
                           dict,
                           NULL);
 
@@ -29,22 +29,39 @@
 #include "vector.h"
 #endif
 
+#if !defined(JANET_SINGLE_THREADED) && !defined(JANET_NO_INTERPRETER_INTERRUPT)
+#ifdef JANET_WINDOWS
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+#endif
+
 /* Implements functionality to build a debugger from within janet.
  * The repl should also be able to serve as pretty featured debugger
  * out of the box. */
 
 /* Add a break point to a function */
 void janet_debug_break(JanetFuncDef *def, int32_t pc) {
+    if (def->lazy) janet_funcdef_force(def);
     if (pc >= def->bytecode_length || pc < 0)
         janet_panic("invalid bytecode offset");
     def->bytecode[pc] |= 0x80;
+#ifdef JANET_JIT
+    janet_jit_invalidate(def);
+#endif
 }
 
 /* Remove a break point from a function */
 void janet_debug_unbreak(JanetFuncDef *def, int32_t pc) {
+    if (def->lazy) janet_funcdef_force(def);
     if (pc >= def->bytecode_length || pc < 0)
         janet_panic("invalid bytecode offset");
     def->bytecode[pc] &= ~((uint32_t)0x80);
+#ifdef JANET_JIT
+    janet_jit_invalidate(def);
+#endif
 }
 
 /*
@@ -61,6 +78,22 @@ void janet_debug_find(
     int32_t best_line = -1;
     int32_t best_column = -1;
     JanetFuncDef *best_def = NULL;
+    /* Decode lazily loaded funcdefs from the source first. Each body can
+     * contain more of them, so repeat until there are none left. */
+    int forced = 1;
+    while (forced) {
+        forced = 0;
+        for (current = janet_vm.blocks; NULL != current; current = current->data.next) {
+            if ((current->flags & JANET_MEM_TYPEBITS) == JANET_MEMORY_FUNCDEF) {
+                JanetFuncDef *def = (JanetFuncDef *)(current);
+                if (def->lazy && def->source && !janet_string_compare(source, def->source)) {
+                    janet_funcdef_force(def);
+                    forced = 1;
+                }
+            }
+        }
+    }
+    current = janet_vm.blocks;
     while (NULL != current) {
         if ((current->flags & JANET_MEM_TYPEBITS) == JANET_MEMORY_FUNCDEF) {
             JanetFuncDef *def = (JanetFuncDef *)(current);
@@ -188,6 +221,306 @@ void janet_stacktrace_ext(JanetFiber *fiber, Janet err, const char *prefix) {
     janet_v_free(fibers);
 }
 
+/*
+ * Sampling profiler
+ */
+
+/* Record the stack of the running fiber, and the fibers that resumed it. Called by the vm
+ * at the points where it checks for interrupts when the profiler thread has requested a sample. */
+void janet_profile_sample(JanetFiber *fiber) {
+    janet_vm.profile_request = 0;
+    if (0 == janet_vm.profile_capacity) return;
+    JanetProfileSample *sample = janet_vm.profile_samples + janet_vm.profile_next;
+    if (++janet_vm.profile_next == janet_vm.profile_capacity) janet_vm.profile_next = 0;
+    if (janet_vm.profile_count < janet_vm.profile_capacity) janet_vm.profile_count++;
+    sample->depth = 0;
+    sample->truncated = 0;
+
+    /* Count the fibers between the root fiber and the sampled fiber. If the sampled
+     * fiber was not resumed through the root fiber, only its own stack is recorded. */
+    int32_t nfibers = 0;
+    JanetFiber *f = janet_vm.root_fiber;
+    while (NULL != f && f != fiber) {
+        f = f->child;
+        nfibers++;
+    }
+    if (f != fiber) nfibers = 0;
+
+    for (int32_t k = nfibers; k >= 0; k--) {
+        f = fiber;
+        if (k < nfibers) {
+            f = janet_vm.root_fiber;
+            for (int32_t m = 0; m < k; m++) f = f->child;
+        }
+        int32_t i = f->frame;
+        while (i > 0) {
+            JanetStackFrame *frame = (JanetStackFrame *)(f->data + i - JANET_FRAME_SIZE);
+            i = frame->prevframe;
+            if (sample->depth == JANET_PROFILE_MAX_DEPTH) {
+                sample->truncated = 1;
+                return;
+            }
+            JanetProfileFrame *pf = sample->frames + sample->depth++;
+            if (frame->func) {
+                JanetFuncDef *def = frame->func->def;
+                pf->def = def;
+                pf->cfun = NULL;
+                pf->pc = frame->pc ? (int32_t)(frame->pc - def->bytecode) : 0;
+                /* The frame may be popped before an incremental mark finishes */
+                if (janet_vm.gc_phase == JANET_GC_MARK)
+                    janet_gc_remember_value(janet_wrap_function(frame->func));
+            } else {
+                pf->def = NULL;
+                pf->cfun = (JanetCFunction)(frame->pc);
+                pf->pc = 0;
+            }
+        }
+    }
+}
+
+/* Discard all samples */
+void janet_profile_clear(void) {
+    janet_vm.profile_count = 0;
+    janet_vm.profile_next = 0;
+}
+
+/* Write one stack frame of a sample in folded stack format */
+static void janet_profile_frame(JanetBuffer *buffer, JanetProfileFrame *pf) {
+    if (NULL != pf->def) {
+        JanetFuncDef *def = pf->def;
+        const char *name = def->name ? (const char *)def->name : "<anonymous>";
+        if (NULL != def->source && NULL != def->sourcemap && pf->pc < def->bytecode_length) {
+            janet_formatb(buffer, "%s (%S:%d)", name, def->source, def->sourcemap[pf->pc].line);
+        } else if (NULL != def->source) {
+            janet_formatb(buffer, "%s (%S)", name, def->source);
+        } else {
+            janet_buffer_push_cstring(buffer, name);
+        }
+    } else {
+        JanetCFunRegistry *reg = pf->cfun ? janet_registry_get(pf->cfun) : NULL;
+        if (NULL != reg && NULL != reg->name) {
+            if (NULL != reg->name_prefix) {
+                janet_formatb(buffer, "%s/%s", reg->name_prefix, reg->name);
+            } else {
+                janet_buffer_push_cstring(buffer, reg->name);
+            }
+        } else {
+            janet_buffer_push_cstring(buffer, "<cfunction>");
+        }
+    }
+}
+
+/* Write all samples as folded stacks, one line per distinct stack with the outermost
+ * frame first, followed by the number of times the stack was sampled. This is the
+ * input format of most flame graph tools. */
+void janet_profile_folded(JanetBuffer *buffer) {
+    JanetTable *counts = janet_table(0);
+    JanetBuffer *line = janet_buffer(64);
+    for (size_t i = 0; i < janet_vm.profile_count; i++) {
+        JanetProfileSample *sample = janet_vm.profile_samples + i;
+        if (0 == sample->depth) continue;
+        line->count = 0;
+        if (sample->truncated) janet_buffer_push_cstring(line, "...;");
+        for (int32_t j = sample->depth - 1; j >= 0; j--) {
+            janet_profile_frame(line, sample->frames + j);
+            if (j) janet_buffer_push_u8(line, ';');
+        }
+        Janet key = janet_stringv(line->data, line->count);
+        Janet count = janet_table_get(counts, key);
+        janet_table_put(counts, key, janet_wrap_number(janet_checktype(count, JANET_NUMBER)
+                        ? janet_unwrap_number(count) + 1 : 1));
+    }
+    int32_t *index = janet_smalloc(sizeof(int32_t) * (counts->count + 1));
+    int32_t n = janet_sorted_keys(counts->data, counts->capacity, index);
+    for (int32_t i = 0; i < n; i++) {
+        const JanetKV *kv = counts->data + index[i];
+        janet_formatb(buffer, "%S %d\n", janet_unwrap_string(kv->key), (int32_t) janet_unwrap_number(kv->value));
+    }
+    janet_sfree(index);
+}
+
+#if !defined(JANET_SINGLE_THREADED) && !defined(JANET_NO_INTERPRETER_INTERRUPT)
+
+typedef struct {
+    JanetVM *vm;
+    volatile int running;
+    int32_t interval_us;
+#ifdef JANET_WINDOWS
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+} JanetProfiler;
+
+/* Body of the profiler thread. Requests a sample from the vm at a fixed interval. */
+#ifdef JANET_WINDOWS
+static DWORD WINAPI janet_profiler_body(LPVOID ptr) {
+    JanetProfiler *profiler = (JanetProfiler *) ptr;
+    DWORD ms = profiler->interval_us / 1000;
+    while (profiler->running) {
+        Sleep(ms ? ms : 1);
+        profiler->vm->profile_request = 1;
+    }
+    return 0;
+}
+#else
+static void *janet_profiler_body(void *ptr) {
+    JanetProfiler *profiler = (JanetProfiler *) ptr;
+    struct timespec ts;
+    ts.tv_sec = profiler->interval_us / 1000000;
+    ts.tv_nsec = (profiler->interval_us % 1000000) * 1000;
+    while (profiler->running) {
+        nanosleep(&ts, NULL);
+        profiler->vm->profile_request = 1;
+    }
+    return NULL;
+}
+#endif
+
+/* Start sampling the current vm hz times per second, keeping at most capacity samples.
+ * Restarting the profiler keeps existing samples unless the capacity changes. */
+void janet_profile_start(int32_t hz, size_t capacity) {
+    if (hz <= 0 || hz > 1000000) janet_panicf("expected sample rate in range (0, 1000000], got %d", hz);
+    if (capacity == 0) janet_panic("expected positive sample capacity");
+    janet_profile_stop();
+    if (capacity != janet_vm.profile_capacity) {
+        JanetProfileSample *samples = janet_realloc(janet_vm.profile_samples, capacity * sizeof(JanetProfileSample));
+        if (NULL == samples) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_vm.profile_samples = samples;
+        janet_vm.profile_capacity = capacity;
+        janet_profile_clear();
+    }
+    JanetProfiler *profiler = janet_malloc(sizeof(JanetProfiler));
+    if (NULL == profiler) {
+        JANET_OUT_OF_MEMORY;
+    }
+    profiler->vm = &janet_vm;
+    profiler->running = 1;
+    profiler->interval_us = 1000000 / hz;
+#ifdef JANET_WINDOWS
+    profiler->thread = CreateThread(NULL, 0, janet_profiler_body, profiler, 0, NULL);
+    if (NULL == profiler->thread) {
+        janet_free(profiler);
+        janet_panic("failed to create thread");
+    }
+#else
+    int err = pthread_create(&profiler->thread, NULL, janet_profiler_body, profiler);
+    if (err) {
+        janet_free(profiler);
+        janet_panicf("%s", strerror(err));
+    }
+#endif
+    janet_vm.profiler = profiler;
+}
+
+/* Stop the profiler thread of the current vm, if running. Samples are kept. */
+void janet_profile_stop(void) {
+    JanetProfiler *profiler = janet_vm.profiler;
+    if (NULL == profiler) return;
+    profiler->running = 0;
+#ifdef JANET_WINDOWS
+    WaitForSingleObject(profiler->thread, INFINITE);
+    CloseHandle(profiler->thread);
+#else
+    pthread_join(profiler->thread, NULL);
+#endif
+    janet_free(profiler);
+    janet_vm.profiler = NULL;
+    janet_vm.profile_request = 0;
+}
+
+#endif
+
+/*
+ * Structured tracing
+ */
+
+#ifdef JANET_WINDOWS
+static int64_t janet_trace_load(volatile int64_t *p) {
+    return InterlockedCompareExchange64((volatile LONG64 *) p, 0, 0);
+}
+static void janet_trace_store(volatile int64_t *p, int64_t x) {
+    InterlockedExchange64((volatile LONG64 *) p, x);
+}
+static uint64_t janet_trace_clock(void) {
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t)((double) count.QuadPart * (1e9 / (double) freq.QuadPart));
+}
+#else
+static int64_t janet_trace_load(volatile int64_t *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static void janet_trace_store(volatile int64_t *p, int64_t x) {
+    __atomic_store_n(p, x, __ATOMIC_RELEASE);
+}
+static uint64_t janet_trace_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+#endif
+
+/* Write an event to the ring of the current vm. Called through janet_trace. */
+void janet_trace_emit(uint32_t type, uint32_t arg, const void *subject) {
+    int64_t head = janet_vm.trace_head;
+    if ((size_t)(head - janet_trace_load(&janet_vm.trace_tail)) >= janet_vm.trace_capacity) {
+        janet_vm.trace_dropped++;
+        return;
+    }
+    JanetTraceEvent *event = janet_vm.trace_events + ((size_t) head & (janet_vm.trace_capacity - 1));
+    event->time = janet_trace_clock();
+    event->type = type;
+    event->arg = arg;
+    event->subject = subject;
+    janet_trace_store(&janet_vm.trace_head, head + 1);
+}
+
+/* Start recording the events in mask on the current vm, in a ring of at least capacity
+ * events. Restarting keeps unread events unless the capacity changes. Changing the
+ * capacity is not safe while another thread is draining the ring. */
+void janet_trace_start(uint32_t mask, size_t capacity) {
+    if (capacity == 0) janet_panic("expected positive trace capacity");
+    if (mask & ~JANET_TRACE_ALL) janet_panicf("invalid trace mask %d", (int32_t) mask);
+    size_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+    if (cap != janet_vm.trace_capacity) {
+        janet_vm.trace_mask = 0;
+        JanetTraceEvent *events = janet_realloc(janet_vm.trace_events, cap * sizeof(JanetTraceEvent));
+        if (NULL == events) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_vm.trace_events = events;
+        janet_vm.trace_capacity = cap;
+        janet_vm.trace_head = 0;
+        janet_vm.trace_tail = 0;
+    }
+    janet_vm.trace_dropped = 0;
+    janet_vm.trace_mask = mask;
+}
+
+/* Stop recording events on the current vm. Unread events are kept. */
+void janet_trace_stop(void) {
+    janet_vm.trace_mask = 0;
+}
+
+/* Move at most max of the oldest unread events of a vm into out, and return how many
+ * were moved. Only one thread may drain a vm at a time, but it does not have to be
+ * the thread running the vm. */
+size_t janet_trace_drain(JanetVM *vm, JanetTraceEvent *out, size_t max) {
+    int64_t tail = vm->trace_tail;
+    size_t count = (size_t)(janet_trace_load(&vm->trace_head) - tail);
+    if (count > max) count = max;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = vm->trace_events[((size_t) tail + i) & (vm->trace_capacity - 1)];
+    }
+    janet_trace_store(&vm->trace_tail, tail + (int64_t) count);
+    return count;
+}
+
 /*
  * CFuns
  */
@@ -401,6 +734,221 @@ JANET_CORE_FN(cfun_debug_step,
     return out;
 }
 
+#if !defined(JANET_SINGLE_THREADED) && !defined(JANET_NO_INTERPRETER_INTERRUPT)
+JANET_CORE_FN(cfun_debug_profile_start,
+              "(debug/profile-start &opt rate capacity)",
+              "Start the sampling profiler. A background thread asks the current thread's vm to record "
+              "the stack of the running fiber `rate` times per second, 100 by default. Samples are only taken "
+              "where the interpreter checks for interrupts, on function calls and backwards jumps, so time spent "
+              "inside a single C function is counted towards its Janet caller, and time spent waiting in the "
+              "event loop is not counted. At most `capacity` samples are kept, 4096 by default, after which the "
+              "oldest samples are replaced. Returns nil.") {
+    janet_arity(argc, 0, 2);
+    int32_t rate = janet_optinteger(argv, argc, 0, 100);
+    int32_t capacity = janet_optnat(argv, argc, 1, 4096);
+    janet_profile_start(rate, (size_t) capacity);
+    return janet_wrap_nil();
+}
+
+JANET_CORE_FN(cfun_debug_profile_stop,
+              "(debug/profile-stop)",
+              "Stop the sampling profiler. Samples are kept until they are cleared "
+              "with `debug/profile-folded`. Returns the number of samples.") {
+    janet_fixarity(argc, 0);
+    (void) argv;
+    janet_profile_stop();
+    return janet_wrap_number((double) janet_vm.profile_count);
+}
+#endif
+
+JANET_CORE_FN(cfun_debug_profile_folded,
+              "(debug/profile-folded &opt clear)",
+              "Get the samples taken by the sampling profiler as folded stacks, the input "
+              "format of flame graph tools. Each distinct stack is one line, with frames separated "
+              "by semicolons, outermost first, followed by a space and the number of times it was "
+              "sampled. Frames are written as `name (source:line)`. Stacks deeper than 32 frames "
+              "are truncated, with `...` as the outermost frame. If `clear` is truthy, discards "
+              "the samples afterwards. Returns a string.") {
+    janet_arity(argc, 0, 1);
+    int clear = janet_optboolean(argv, argc, 0, 0);
+    JanetBuffer *buffer = janet_buffer(0);
+    janet_profile_folded(buffer);
+    if (clear) janet_profile_clear();
+    return janet_stringv(buffer->data, buffer->count);
+}
+
+JANET_CORE_FN(cfun_debug_trace_start,
+              "(debug/trace-start &opt kinds capacity)",
+              "Start recording structured trace events on the current thread. `kinds` is an indexed "
+              "collection of the keywords `:calls`, `:fibers`, `:gc`, and `:ev`, and defaults to all of them. "
+              "Events are kept in a ring buffer of at least `capacity` events, 65536 by default, until they are "
+              "read with `debug/trace-drain`. Once the ring is full, new events are dropped. Returns nil.") {
+    janet_arity(argc, 0, 2);
+    uint32_t mask = JANET_TRACE_ALL;
+    if (argc > 0 && !janet_checktype(argv[0], JANET_NIL)) {
+        JanetView kinds = janet_getindexed(argv, 0);
+        mask = 0;
+        for (int32_t i = 0; i < kinds.len; i++) {
+            if (janet_keyeq(kinds.items[i], "calls")) {
+                mask |= JANET_TRACE_CALLS;
+            } else if (janet_keyeq(kinds.items[i], "fibers")) {
+                mask |= JANET_TRACE_FIBERS;
+            } else if (janet_keyeq(kinds.items[i], "gc")) {
+                mask |= JANET_TRACE_GC;
+            } else if (janet_keyeq(kinds.items[i], "ev")) {
+                mask |= JANET_TRACE_EV;
+            } else {
+                janet_panicf("unknown trace kind %v", kinds.items[i]);
+            }
+        }
+    }
+    int32_t capacity = janet_optnat(argv, argc, 1, 65536);
+    janet_trace_start(mask, (size_t) capacity);
+    return janet_wrap_nil();
+}
+
+JANET_CORE_FN(cfun_debug_trace_stop,
+              "(debug/trace-stop)",
+              "Stop recording structured trace events. Unread events are kept. Returns the "
+              "number of events dropped because the ring buffer was full.") {
+    janet_fixarity(argc, 0);
+    (void) argv;
+    janet_trace_stop();
+    return janet_wrap_number((double) janet_vm.trace_dropped);
+}
+
+static const char *const janet_trace_type_names[] = {
+    "enter", "exit", "resume", "stop", "gc-begin", "gc-end", "event"
+};
+
+static const char *const janet_trace_gc_names[] = {
+    "major", "minor", "step", "arena"
+};
+
+#ifdef JANET_EV
+static const char *const janet_trace_event_names[] = {
+    "init", "mark", "deinit", "close", "err", "hup", "read", "write", "cancel", "complete", "user"
+};
+#endif
+
+JANET_CORE_FN(cfun_debug_trace_drain,
+              "(debug/trace-drain &opt into)",
+              "Remove all unread structured trace events and append them to the array `into`, in the "
+              "order they happened. Each event is a tuple that starts with its kind and a time in "
+              "nanoseconds from a monotonic clock:\n\n"
+              "* `[:enter time name]` and `[:exit time name]` - a function was called or returned. The name "
+              "is written as in `debug/profile-folded`. Frames unwound by a signal have no `:exit` event.\n\n"
+              "* `[:resume time fiber]` and `[:stop time fiber signal]` - a fiber started or stopped running.\n\n"
+              "* `[:gc-begin time kind]` and `[:gc-end time kind]` - a `:major`, `:minor`, `:arena` "
+              "collection, or a `:step` of an incremental collection.\n\n"
+              "* `[:event time stream event]` - the event loop delivered an event such as `:read` or "
+              "`:write` to a listener on a stream.\n\n"
+              "Returns `into`, or a new array.") {
+    janet_arity(argc, 0, 1);
+    JanetArray *into = janet_optarray(argv, argc, 0, 0);
+    JanetTable *names = janet_table(0);
+    JanetBuffer *buffer = janet_buffer(64);
+    int64_t tail = janet_vm.trace_tail;
+    int64_t head = janet_trace_load(&janet_vm.trace_head);
+    /* Events stay in the ring until all of them are converted, so the gc keeps their subjects alive */
+    for (int64_t i = tail; i < head; i++) {
+        JanetTraceEvent *event = janet_vm.trace_events + ((size_t) i & (janet_vm.trace_capacity - 1));
+        Janet tup[4];
+        int32_t n = 3;
+        tup[0] = janet_ckeywordv(janet_trace_type_names[event->type]);
+        tup[1] = janet_wrap_number((double) event->time);
+        switch (event->type) {
+            default:
+                tup[2] = janet_wrap_nil();
+                break;
+            case JANET_TRACE_ENTER:
+            case JANET_TRACE_EXIT: {
+                Janet key = janet_wrap_pointer((void *) event->subject);
+                tup[2] = janet_table_get(names, key);
+                if (janet_checktype(tup[2], JANET_NIL)) {
+                    JanetProfileFrame pf;
+                    pf.def = event->arg ? NULL : (JanetFuncDef *) event->subject;
+                    pf.cfun = event->arg ? (JanetCFunction) event->subject : NULL;
+                    pf.pc = 0;
+                    buffer->count = 0;
+                    janet_profile_frame(buffer, &pf);
+                    tup[2] = janet_stringv(buffer->data, buffer->count);
+                    janet_table_put(names, key, tup[2]);
+                }
+                break;
+            }
+            case JANET_TRACE_RESUME:
+                tup[2] = janet_wrap_fiber((JanetFiber *) event->subject);
+                break;
+            case JANET_TRACE_STOP:
+                tup[2] = janet_wrap_fiber((JanetFiber *) event->subject);
+                tup[3] = janet_ckeywordv(janet_signal_names[event->arg]);
+                n = 4;
+                break;
+            case JANET_TRACE_GC_BEGIN:
+            case JANET_TRACE_GC_END:
+                tup[2] = janet_ckeywordv(janet_trace_gc_names[event->arg]);
+                break;
+#ifdef JANET_EV
+            case JANET_TRACE_LISTENER:
+                tup[2] = janet_wrap_abstract((void *) event->subject);
+                tup[3] = janet_ckeywordv(janet_trace_event_names[event->arg]);
+                n = 4;
+                break;
+#endif
+        }
+        janet_array_push(into, janet_wrap_tuple(janet_tuple_n(tup, n)));
+    }
+    janet_trace_store(&janet_vm.trace_tail, head);
+    return janet_wrap_array(into);
+}
+
+#ifdef JANET_OPCODE_STATS
+JANET_CORE_FN(cfun_debug_opcode_stats,
+              "(debug/opcode-stats)",
+              "Get the number of times each instruction was executed by the interpreter on the current "
+              "thread. Returns a table with two keys: `:opcodes`, a table mapping instruction names to counts, "
+              "and `:pairs`, a table mapping tuples of two instruction names to the number of times the second "
+              "was executed right after the first. Instructions that were never executed are left out. "
+              "Only available when Janet is built with JANET_OPCODE_STATS.") {
+    janet_fixarity(argc, 0);
+    (void) argv;
+    Janet names[JOP_INSTRUCTION_COUNT];
+    for (int32_t i = 0; i < JOP_INSTRUCTION_COUNT; i++) {
+        names[i] = janet_ckeywordv(janet_opcode_name((uint32_t) i));
+    }
+    JanetTable *opcodes = janet_table(0);
+    JanetTable *pairs = janet_table(0);
+    for (int32_t i = 0; i < JOP_INSTRUCTION_COUNT; i++) {
+        uint64_t count = janet_vm.opcode_counts[i];
+        if (count) {
+            janet_table_put(opcodes, names[i], janet_wrap_number((double) count));
+        }
+        for (int32_t j = 0; j < JOP_INSTRUCTION_COUNT; j++) {
+            count = janet_vm.opcode_pairs[i * JOP_INSTRUCTION_COUNT + j];
+            if (count) {
+                Janet pair[2] = {names[i], names[j]};
+                janet_table_put(pairs, janet_wrap_tuple(janet_tuple_n(pair, 2)), janet_wrap_number((double) count));
+            }
+        }
+    }
+    JanetTable *t = janet_table(2);
+    janet_table_put(t, janet_ckeywordv("opcodes"), janet_wrap_table(opcodes));
+    janet_table_put(t, janet_ckeywordv("pairs"), janet_wrap_table(pairs));
+    return janet_wrap_table(t);
+}
+
+JANET_CORE_FN(cfun_debug_opcode_stats_reset,
+              "(debug/opcode-stats-reset)",
+              "Reset the instruction counts returned by `debug/opcode-stats` to zero. Returns nil.") {
+    janet_fixarity(argc, 0);
+    (void) argv;
+    memset(janet_vm.opcode_counts, 0, JOP_INSTRUCTION_COUNT * (JOP_INSTRUCTION_COUNT + 1) * sizeof(uint64_t));
+    janet_vm.opcode_last = JOP_INSTRUCTION_COUNT;
+    return janet_wrap_nil();
+}
+#endif
+
 /* Module entry point */
 void janet_lib_debug(JanetTable *env) {
     JanetRegExt debug_cfuns[] = {
@@ -413,6 +961,18 @@ void janet_lib_debug(JanetTable *env) {
         JANET_CORE_REG("debug/stacktrace", cfun_debug_stacktrace),
         JANET_CORE_REG("debug/lineage", cfun_debug_lineage),
         JANET_CORE_REG("debug/step", cfun_debug_step),
+#if !defined(JANET_SINGLE_THREADED) && !defined(JANET_NO_INTERPRETER_INTERRUPT)
+        JANET_CORE_REG("debug/profile-start", cfun_debug_profile_start),
+        JANET_CORE_REG("debug/profile-stop", cfun_debug_profile_stop),
+#endif
+        JANET_CORE_REG("debug/profile-folded", cfun_debug_profile_folded),
+        JANET_CORE_REG("debug/trace-start", cfun_debug_trace_start),
+        JANET_CORE_REG("debug/trace-stop", cfun_debug_trace_stop),
+        JANET_CORE_REG("debug/trace-drain", cfun_debug_trace_drain),
+#ifdef JANET_OPCODE_STATS
+        JANET_CORE_REG("debug/opcode-stats", cfun_debug_opcode_stats),
+        JANET_CORE_REG("debug/opcode-stats-reset", cfun_debug_opcode_stats_reset),
+#endif
         JANET_REG_END
     };
     janet_core_cfuns_ext(env, NULL, debug_cfuns);
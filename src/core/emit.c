@@ -290,6 +290,10 @@ int32_t janetc_emit_su(JanetCompiler *c, uint8_t op, JanetSlot s, uint16_t immed
     return emit1s(c, op, s, (int32_t) immediate, wr);
 }
 
+int32_t janetc_emit_sc(JanetCompiler *c, uint8_t op, JanetSlot s, Janet constant) {
+    return emit1s(c, op, s, janetc_const(c, constant), 0);
+}
+
 static int32_t emit2s(JanetCompiler *c, uint8_t op, JanetSlot s1, JanetSlot s2, int32_t rest, int wr) {
     int32_t reg1 = janetc_regnear(c, s1, JANETC_REGTEMP_0);
     int32_t reg2 = janetc_regnear(c, s2, JANETC_REGTEMP_1);
@@ -49,6 +49,7 @@
 #include <netinet/tcp.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #ifdef JANET_EV_EPOLL
 #include <sys/epoll.h>
@@ -57,6 +58,12 @@
 #ifdef JANET_EV_KQUEUE
 #include <sys/event.h>
 #endif
+#ifdef JANET_EV_URING
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 #endif
 
 typedef struct {
@@ -72,6 +79,13 @@ typedef struct {
     } mode;
 } JanetChannelPending;
 
+/* Slot in the ring of a lock-free channel. seq tells producers and
+ * consumers whose turn it is to use the slot. */
+typedef struct {
+    volatile int64_t seq;
+    Janet value;
+} JanetChannelCell;
+
 typedef struct {
     JanetQueue items;
     JanetQueue read_pending;
@@ -79,7 +93,19 @@ typedef struct {
     int32_t limit;
     int closed;
     int is_threaded;
+    int is_move; /* Move buffers to the receiver instead of copying them */
     JanetOSMutex lock;
+    /* Lock-free channels keep up to limit items in a bounded MPMC ring. Items
+     * only go through the mutex and the items queue when the ring is full, or
+     * when a reader or writer has to wait (slow is set). */
+    JanetChannelCell *ring;
+    int32_t ring_size;
+    volatile int32_t slow;
+    char pad0[64];
+    volatile int64_t ring_head;
+    char pad1[64];
+    volatile int64_t ring_tail;
+    char pad2[64];
 } JanetChannel;
 
 typedef struct {
@@ -103,6 +129,7 @@ typedef struct {
     JanetThreadedCallback cb;
     JanetThreadedSubroutine subr;
     JanetHandle write_pipe;
+    void *next;
 } JanetEVThreadInit;
 
 #define JANET_MAX_Q_CAPACITY 0x7FFFFFF
@@ -172,66 +199,229 @@ static JanetTimestamp ts_delta(JanetTimestamp ts, double delta) {
     return ts;
 }
 
-/* Look at the next timeout value without
- * removing it. */
-static int peek_timeout(JanetTimeout *out) {
-    if (janet_vm.tq_count == 0) return 0;
-    *out = janet_vm.tq[0];
+/* Timeouts live in a hierarchical timing wheel. Level l has JANET_TW_SLOTS slots that
+ * each cover 64^l milliseconds. A timeout is filed in the coarsest level it fits in,
+ * relative to the wheel clock, and cascades to finer levels as its slot comes due,
+ * so insert and cancel are O(1) and long timeouts are only touched a few times.
+ * Timeouts beyond the top level are parked in its furthest slot and refiled. */
+
+#ifdef __GNUC__
+#define tw_ctz(x) ((int) __builtin_ctzll(x))
+#else
+static int tw_ctz(uint64_t x) {
+    int n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+}
+#endif
+
+static JanetTimestamp tw_span(int level) {
+    return ((JanetTimestamp) 1) << (JANET_TW_BITS * level);
+}
+
+static void tw_link(JanetTimeout *node, int32_t slot) {
+    JanetTimeout **head = janet_vm.tw.slots + slot;
+    node->slot = slot;
+    node->next = *head;
+    node->pprev = head;
+    if (*head) (*head)->pprev = &node->next;
+    *head = node;
+    janet_vm.tw.occupied[slot >> JANET_TW_BITS] |= ((uint64_t) 1) << (slot & (JANET_TW_SLOTS - 1));
+}
+
+static void tw_unlink(JanetTimeout *node) {
+    int32_t slot = node->slot;
+    *node->pprev = node->next;
+    if (node->next) node->next->pprev = node->pprev;
+    if (NULL == janet_vm.tw.slots[slot]) {
+        janet_vm.tw.occupied[slot >> JANET_TW_BITS] &= ~(((uint64_t) 1) << (slot & (JANET_TW_SLOTS - 1)));
+    }
+    node->slot = -1;
+}
+
+/* File a timeout relative to the wheel clock */
+static void tw_insert(JanetTimeout *node) {
+    JanetTimestamp now = janet_vm.tw.now;
+    JanetTimestamp when = node->when < now ? now : node->when;
+    JanetTimestamp delta = when - now;
+    int level = 0;
+    while (level < JANET_TW_LEVELS - 1 && delta >= tw_span(level + 1)) level++;
+    if (delta >= tw_span(JANET_TW_LEVELS)) {
+        /* Too far out - park in the slot that comes due last and refile from there */
+        when = now + tw_span(JANET_TW_LEVELS) - 1;
+    }
+    int32_t index = (int32_t)((when >> (JANET_TW_BITS * level)) & (JANET_TW_SLOTS - 1));
+    tw_link(node, level * JANET_TW_SLOTS + index);
+}
+
+/* Earliest time at which the wheel has work to do. For coarse levels this is the
+ * time the next occupied slot cascades, which is never later than its timeouts. */
+static int tw_next(JanetTimestamp *out) {
+    JanetTimestamp now = janet_vm.tw.now;
+    int found = 0;
+    JanetTimestamp best = 0;
+    for (int level = 0; level < JANET_TW_LEVELS; level++) {
+        uint64_t bits = janet_vm.tw.occupied[level];
+        if (!bits) continue;
+        int shift = JANET_TW_BITS * level;
+        int current = (int)((now >> shift) & (JANET_TW_SLOTS - 1));
+        /* Rotate so the current slot is bit 0 */
+        uint64_t rotated = current ? ((bits >> current) | (bits << (JANET_TW_SLOTS - current))) : bits;
+        JanetTimestamp t;
+        if (level == 0) {
+            t = now + tw_ctz(rotated);
+        } else if (!(now & (tw_span(level) - 1))) {
+            /* On a slot boundary the current slot is due right away */
+            t = ((now >> shift) + tw_ctz(rotated)) << shift;
+        } else {
+            /* Otherwise the current slot was already cascaded, so it next comes
+             * due a full rotation from now */
+            rotated = (rotated >> 1) | ((rotated & 1) << (JANET_TW_SLOTS - 1));
+            t = ((now >> shift) + tw_ctz(rotated) + 1) << shift;
+        }
+        if (!found || t < best) {
+            best = t;
+            found = 1;
+        }
+    }
+    *out = best;
+    return found;
+}
+
+static void tw_expire(JanetTimeout *node) {
+    node->next = NULL;
+    if (janet_vm.tw.expired_tail) {
+        janet_vm.tw.expired_tail->next = node;
+    } else {
+        janet_vm.tw.expired = node;
+    }
+    janet_vm.tw.expired_tail = node;
+}
+
+/* Process every tick up to and including now, moving due timeouts to the expired list */
+static void tw_advance(JanetTimestamp now) {
+    JanetTimestamp t;
+    while (tw_next(&t) && t <= now) {
+        janet_vm.tw.now = t;
+        /* Cascade coarse slots that start at this tick, coarsest first */
+        for (int level = JANET_TW_LEVELS - 1; level > 0; level--) {
+            if (t & (tw_span(level) - 1)) continue;
+            int32_t slot = level * JANET_TW_SLOTS + (int32_t)((t >> (JANET_TW_BITS * level)) & (JANET_TW_SLOTS - 1));
+            JanetTimeout *node = janet_vm.tw.slots[slot];
+            janet_vm.tw.slots[slot] = NULL;
+            janet_vm.tw.occupied[level] &= ~(((uint64_t) 1) << (slot & (JANET_TW_SLOTS - 1)));
+            while (node) {
+                JanetTimeout *next = node->next;
+                tw_insert(node);
+                node = next;
+            }
+        }
+        int32_t slot = (int32_t)(t & (JANET_TW_SLOTS - 1));
+        JanetTimeout *node = janet_vm.tw.slots[slot];
+        janet_vm.tw.slots[slot] = NULL;
+        janet_vm.tw.occupied[0] &= ~(((uint64_t) 1) << slot);
+        while (node) {
+            JanetTimeout *next = node->next;
+            node->slot = -1;
+            tw_expire(node);
+            node = next;
+        }
+        janet_vm.tw.now = t + 1;
+    }
+    if (janet_vm.tw.now <= now) janet_vm.tw.now = now + 1;
+}
+
+static void free_timeout(JanetTimeout *node) {
+    if (node->curr_fiber == NULL && node->fiber->timeout == node) {
+        node->fiber->timeout = NULL;
+    }
+    if (node->curr_fiber != NULL) janet_vm.tw.deadlines--;
+    janet_vm.tq_count--;
+    node->next = janet_vm.tw.free_list;
+    janet_vm.tw.free_list = node;
+}
+
+/* Take the next expired timeout, if any */
+static int pop_expired(JanetTimeout *out) {
+    JanetTimeout *node = janet_vm.tw.expired;
+    if (NULL == node) return 0;
+    janet_vm.tw.expired = node->next;
+    if (NULL == janet_vm.tw.expired) janet_vm.tw.expired_tail = NULL;
+    *out = *node;
+    free_timeout(node);
     return 1;
 }
 
-/* Remove the next timeout from the priority queue */
-static void pop_timeout(size_t index) {
-    if (janet_vm.tq_count <= index) return;
-    janet_vm.tq[index] = janet_vm.tq[--janet_vm.tq_count];
-    for (;;) {
-        size_t left = (index << 1) + 1;
-        size_t right = left + 1;
-        size_t smallest = index;
-        if (left < janet_vm.tq_count &&
-                (janet_vm.tq[left].when < janet_vm.tq[smallest].when))
-            smallest = left;
-        if (right < janet_vm.tq_count &&
-                (janet_vm.tq[right].when < janet_vm.tq[smallest].when))
-            smallest = right;
-        if (smallest == index) return;
-        JanetTimeout temp = janet_vm.tq[index];
-        janet_vm.tq[index] = janet_vm.tq[smallest];
-        janet_vm.tq[smallest] = temp;
-        index = smallest;
-    }
-}
-
-/* Add a timeout to the timeout min heap */
+/* Cancel a pending timeout in O(1) */
+static void cancel_timeout(JanetTimeout *node) {
+    if (node->slot >= 0) {
+        tw_unlink(node);
+        free_timeout(node);
+    }
+    /* Timeouts already on the expired list are discarded by the sched_id check */
+}
+
+/* Add a timeout to the timing wheel */
 static void add_timeout(JanetTimeout to) {
-    size_t oldcount = janet_vm.tq_count;
-    size_t newcount = oldcount + 1;
-    if (newcount > janet_vm.tq_capacity) {
-        size_t newcap = 2 * newcount;
-        JanetTimeout *tq = janet_realloc(janet_vm.tq, newcap * sizeof(JanetTimeout));
-        if (NULL == tq) {
+    JanetTimeout *node = janet_vm.tw.free_list;
+    if (NULL != node) {
+        janet_vm.tw.free_list = node->next;
+    } else {
+        node = janet_malloc(sizeof(JanetTimeout));
+        if (NULL == node) {
             JANET_OUT_OF_MEMORY;
         }
-        janet_vm.tq = tq;
-        janet_vm.tq_capacity = newcap;
     }
-    /* Append */
-    janet_vm.tq_count = (int32_t) newcount;
-    janet_vm.tq[oldcount] = to;
-    /* Heapify */
-    size_t index = oldcount;
-    while (index > 0) {
-        size_t parent = (index - 1) >> 1;
-        if (janet_vm.tq[parent].when <= janet_vm.tq[index].when) break;
-        /* Swap */
-        JanetTimeout tmp = janet_vm.tq[index];
-        janet_vm.tq[index] = janet_vm.tq[parent];
-        janet_vm.tq[parent] = tmp;
-        /* Next */
-        index = parent;
+    *node = to;
+    janet_vm.tq_count++;
+    if (to.curr_fiber == NULL) {
+        /* Remember the timeout so rescheduling the fiber can cancel it eagerly */
+        to.fiber->timeout = node;
+    } else {
+        janet_vm.tw.deadlines++;
+    }
+    tw_insert(node);
+}
+
+/* Drop deadlines whose fiber has already finished. Only needed when such deadlines
+ * are all that keeps the event loop alive. */
+static int fiber_is_finished(JanetFiber *fiber) {
+    JanetFiberStatus s = janet_fiber_status(fiber);
+    return (s == JANET_STATUS_DEAD ||
+            s == JANET_STATUS_ERROR ||
+            s == JANET_STATUS_USER0 ||
+            s == JANET_STATUS_USER1 ||
+            s == JANET_STATUS_USER2 ||
+            s == JANET_STATUS_USER3 ||
+            s == JANET_STATUS_USER4);
+}
+
+static void prune_deadlines(void) {
+    for (int32_t slot = 0; slot < JANET_TW_LEVELS * JANET_TW_SLOTS; slot++) {
+        JanetTimeout *node = janet_vm.tw.slots[slot];
+        while (node) {
+            JanetTimeout *next = node->next;
+            if (node->curr_fiber != NULL && fiber_is_finished(node->curr_fiber)) {
+                tw_unlink(node);
+                free_timeout(node);
+            }
+            node = next;
+        }
     }
 }
 
+/* Visit every pending timeout, whether filed or expired */
+#define JANET_TW_EACH(node, body) do { \
+    for (int32_t tw_i_ = 0; tw_i_ <= JANET_TW_LEVELS * JANET_TW_SLOTS; tw_i_++) { \
+        JanetTimeout *node = tw_i_ < JANET_TW_LEVELS * JANET_TW_SLOTS \
+            ? janet_vm.tw.slots[tw_i_] : janet_vm.tw.expired; \
+        for (; NULL != node; node = node->next) { body; } \
+    } \
+} while (0)
+
 /* Create a new event listener */
 static JanetListenerState *janet_listen_impl(JanetStream *stream, JanetListener behavior, int mask, size_t size, void *user) {
     if (stream->flags & JANET_STREAM_CLOSED) {
@@ -278,6 +468,13 @@ static JanetListenerState *janet_listen_impl(JanetStream *stream, JanetListener
     return state;
 }
 
+/* Run the state machine of a listener on an event from the poller */
+static JanetAsyncStatus janet_listener_fire(JanetListenerState *state, JanetAsyncEvent event) {
+    janet_probe2(ev__event, state->stream, event);
+    janet_trace(JANET_TRACE_EV, JANET_TRACE_LISTENER, event, state->stream);
+    return state->machine(state, event);
+}
+
 /* Indicate we are no longer listening for an event. This
  * frees the memory of the state machine as well. */
 static void janet_unlisten_impl(JanetListenerState *state, int is_gc) {
@@ -309,6 +506,8 @@ static const JanetMethod ev_default_stream_methods[] = {
     {"read", janet_cfun_stream_read},
     {"chunk", janet_cfun_stream_chunk},
     {"write", janet_cfun_stream_write},
+    {"pread", janet_cfun_stream_pread},
+    {"pwrite", janet_cfun_stream_pwrite},
     {NULL, NULL}
 };
 
@@ -319,6 +518,9 @@ JanetStream *janet_stream(JanetHandle handle, uint32_t flags, const JanetMethod
     stream->flags = flags;
     stream->state = NULL;
     stream->_mask = 0;
+#ifdef JANET_EV_URING
+    stream->_uring = NULL;
+#endif
     if (methods == NULL) methods = ev_default_stream_methods;
     stream->methods = methods;
     return stream;
@@ -432,6 +634,9 @@ static void *janet_stream_unmarshal(JanetMarshalContext *ctx) {
     /* Can't share listening state and such across threads */
     p->_mask = 0;
     p->state = NULL;
+#ifdef JANET_EV_URING
+    p->_uring = NULL;
+#endif
     p->flags = (uint32_t) janet_unmarshal_int(ctx);
     p->methods = (void *) janet_unmarshal_int64(ctx);
 #ifdef JANET_WINDOWS
@@ -462,13 +667,68 @@ const JanetAbstractType janet_stream_type = {
     JANET_ATEND_NEXT
 };
 
+/* Fiber priorities are kept in the gc flags of a fiber, with 0 for normal priority so
+ * that new fibers need no setup. janet_fiber_priority maps them to a run queue. */
+#define JANET_EV_PRIORITY_RATIO 8
+static const int janet_priority_queues[4] = {1, 0, 2, 1};
+static const char *const janet_priority_names[JANET_EV_PRIORITIES] = {"high", "normal", "low"};
+
+static int janet_fiber_priority(JanetFiber *fiber) {
+    return janet_priority_queues[(fiber->gc.flags & JANET_FIBER_EV_PRIORITY_MASK) >> JANET_FIBER_EV_PRIORITY_SHIFT];
+}
+
+static void janet_fiber_set_priority(JanetFiber *fiber, int queue) {
+    static const int32_t bits[JANET_EV_PRIORITIES] = {1, 0, 2};
+    fiber->gc.flags &= ~JANET_FIBER_EV_PRIORITY_MASK;
+    fiber->gc.flags |= bits[queue] << JANET_FIBER_EV_PRIORITY_SHIFT;
+}
+
+static void janet_ev_slice_stop(void);
+
 /* Register a fiber to resume with value */
 void janet_schedule_signal(JanetFiber *fiber, Janet value, JanetSignal sig) {
     if (fiber->gc.flags & JANET_FIBER_EV_FLAG_CANCELED) return;
     fiber->gc.flags |= JANET_FIBER_FLAG_ROOT;
+    /* Rescheduling makes any pending timeout stale, so drop it now */
+    if (NULL != fiber->timeout) cancel_timeout(fiber->timeout);
     JanetTask t = { fiber, value, sig, ++fiber->sched_id };
     if (sig == JANET_SIGNAL_ERROR) fiber->gc.flags |= JANET_FIBER_EV_FLAG_CANCELED;
-    janet_q_push(&janet_vm.spawn, &t, sizeof(t));
+    janet_q_push(&janet_vm.spawn[janet_fiber_priority(fiber)], &t, sizeof(t));
+}
+
+/* Take the next task to run. Queues are served highest priority first, but after
+ * JANET_EV_PRIORITY_RATIO tasks from one queue, a waiting task from the queues
+ * below it goes first, so lower priorities are slowed down rather than starved. */
+static int janet_ev_next_task(JanetTask *task) {
+    for (int i = 0; i < JANET_EV_PRIORITIES; i++) {
+        JanetQueue *q = janet_vm.spawn + i;
+        if (q->head == q->tail) continue;
+        int lower_waiting = 0;
+        for (int j = i + 1; j < JANET_EV_PRIORITIES; j++) {
+            if (janet_vm.spawn[j].head != janet_vm.spawn[j].tail) lower_waiting = 1;
+        }
+        if (!lower_waiting) {
+            /* Only count a streak while something below is kept waiting */
+            janet_vm.spawn_streak[i] = 0;
+        } else if (janet_vm.spawn_streak[i] >= JANET_EV_PRIORITY_RATIO) {
+            janet_vm.spawn_streak[i] = 0;
+            continue;
+        } else {
+            janet_vm.spawn_streak[i]++;
+        }
+        janet_q_pop(q, task, sizeof(JanetTask));
+        return 1;
+    }
+    return 0;
+}
+
+/* Number of tasks waiting to run */
+static int32_t janet_ev_spawn_count(void) {
+    int32_t count = 0;
+    for (int i = 0; i < JANET_EV_PRIORITIES; i++) {
+        count += janet_q_count(janet_vm.spawn + i);
+    }
+    return count;
 }
 
 void janet_cancel(JanetFiber *fiber, Janet value) {
@@ -491,30 +751,33 @@ void janet_fiber_did_resume(JanetFiber *fiber) {
 void janet_ev_mark(void) {
 
     /* Pending tasks */
-    JanetTask *tasks = janet_vm.spawn.data;
-    if (janet_vm.spawn.head <= janet_vm.spawn.tail) {
-        for (int32_t i = janet_vm.spawn.head; i < janet_vm.spawn.tail; i++) {
-            janet_mark(janet_wrap_fiber(tasks[i].fiber));
-            janet_mark(tasks[i].value);
-        }
-    } else {
-        for (int32_t i = janet_vm.spawn.head; i < janet_vm.spawn.capacity; i++) {
-            janet_mark(janet_wrap_fiber(tasks[i].fiber));
-            janet_mark(tasks[i].value);
-        }
-        for (int32_t i = 0; i < janet_vm.spawn.tail; i++) {
-            janet_mark(janet_wrap_fiber(tasks[i].fiber));
-            janet_mark(tasks[i].value);
+    for (int p = 0; p < JANET_EV_PRIORITIES; p++) {
+        JanetQueue *spawn = janet_vm.spawn + p;
+        JanetTask *tasks = spawn->data;
+        if (spawn->head <= spawn->tail) {
+            for (int32_t i = spawn->head; i < spawn->tail; i++) {
+                janet_mark(janet_wrap_fiber(tasks[i].fiber));
+                janet_mark(tasks[i].value);
+            }
+        } else {
+            for (int32_t i = spawn->head; i < spawn->capacity; i++) {
+                janet_mark(janet_wrap_fiber(tasks[i].fiber));
+                janet_mark(tasks[i].value);
+            }
+            for (int32_t i = 0; i < spawn->tail; i++) {
+                janet_mark(janet_wrap_fiber(tasks[i].fiber));
+                janet_mark(tasks[i].value);
+            }
         }
     }
 
     /* Pending timeouts */
-    for (size_t i = 0; i < janet_vm.tq_count; i++) {
-        janet_mark(janet_wrap_fiber(janet_vm.tq[i].fiber));
-        if (janet_vm.tq[i].curr_fiber != NULL) {
-            janet_mark(janet_wrap_fiber(janet_vm.tq[i].curr_fiber));
+    JANET_TW_EACH(node, {
+        janet_mark(janet_wrap_fiber(node->fiber));
+        if (node->curr_fiber != NULL) {
+            janet_mark(janet_wrap_fiber(node->curr_fiber));
         }
-    }
+    });
 
     /* Pending listeners */
     for (size_t i = 0; i < janet_vm.listener_count; i++) {
@@ -539,21 +802,47 @@ static Janet make_supervisor_event(const char *name, JanetFiber *fiber, int thre
 
 /* Common init code */
 void janet_ev_init_common(void) {
-    janet_q_init(&janet_vm.spawn);
+    for (int i = 0; i < JANET_EV_PRIORITIES; i++) {
+        janet_q_init(janet_vm.spawn + i);
+        janet_vm.spawn_streak[i] = 0;
+    }
+    janet_vm.slice_epoch = 0;
+    janet_vm.slicer = NULL;
     janet_vm.listener_count = 0;
     janet_vm.listener_cap = 0;
     janet_vm.listeners = NULL;
-    janet_vm.tq = NULL;
+    memset(&janet_vm.tw, 0, sizeof(janet_vm.tw));
+    janet_vm.tw.now = ts_now();
     janet_vm.tq_count = 0;
-    janet_vm.tq_capacity = 0;
     janet_table_init_raw(&janet_vm.threaded_abstracts, 0);
     janet_rng_seed(&janet_vm.ev_rng, 0);
+    memset(&janet_vm.ev_stats, 0, sizeof(janet_vm.ev_stats));
+    janet_vm.threaded_pending = 0;
+    janet_vm.ev_slow_threshold = 0;
+    janet_vm.ev_slow_hook = janet_wrap_nil();
 }
 
 /* Common deinit code */
 void janet_ev_deinit_common(void) {
-    janet_q_deinit(&janet_vm.spawn);
-    janet_free(janet_vm.tq);
+    janet_ev_slice_stop();
+    for (int i = 0; i < JANET_EV_PRIORITIES; i++) {
+        janet_q_deinit(janet_vm.spawn + i);
+    }
+    JanetTimeout *pending = NULL;
+    JANET_TW_EACH(node, {
+        node->pprev = (JanetTimeout **) pending;
+        pending = node;
+    });
+    while (pending) {
+        JanetTimeout *next = (JanetTimeout *) pending->pprev;
+        janet_free(pending);
+        pending = next;
+    }
+    while (janet_vm.tw.free_list) {
+        JanetTimeout *next = janet_vm.tw.free_list->next;
+        janet_free(janet_vm.tw.free_list);
+        janet_vm.tw.free_list = next;
+    }
     janet_free(janet_vm.listeners);
     janet_vm.listeners = NULL;
     janet_table_deinit(&janet_vm.threaded_abstracts);
@@ -587,6 +876,93 @@ void janet_ev_dec_refcount(void) {
 /* Channels */
 
 #define JANET_MAX_CHANNEL_CAPACITY 0xFFFFFF
+#define JANET_CHANNEL_RING_MAX 4096
+
+/* Atomics for lock-free channels and cross thread event posting */
+#ifdef JANET_WINDOWS
+static int64_t janet_atomic_load64(volatile int64_t *p) {
+    return InterlockedCompareExchange64((volatile LONG64 *) p, 0, 0);
+}
+static void janet_atomic_store64(volatile int64_t *p, int64_t x) {
+    InterlockedExchange64((volatile LONG64 *) p, x);
+}
+static int janet_atomic_cas64(volatile int64_t *p, int64_t expected, int64_t x) {
+    return InterlockedCompareExchange64((volatile LONG64 *) p, x, expected) == expected;
+}
+static int32_t janet_atomic_load32(volatile int32_t *p) {
+    return InterlockedCompareExchange((volatile LONG *) p, 0, 0);
+}
+static void janet_atomic_store32(volatile int32_t *p, int32_t x) {
+    InterlockedExchange((volatile LONG *) p, x);
+}
+#define janet_atomic_fence() MemoryBarrier()
+#else
+static int64_t janet_atomic_load64(volatile int64_t *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static void janet_atomic_store64(volatile int64_t *p, int64_t x) {
+    __atomic_store_n(p, x, __ATOMIC_RELEASE);
+}
+static int janet_atomic_cas64(volatile int64_t *p, int64_t expected, int64_t x) {
+    return __atomic_compare_exchange_n(p, &expected, x, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+static int32_t janet_atomic_load32(volatile int32_t *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static void janet_atomic_store32(volatile int32_t *p, int32_t x) {
+    __atomic_store_n(p, x, __ATOMIC_RELEASE);
+}
+#define janet_atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+/* Bounded MPMC ring (D. Vyukov). Returns 1 on success, 0 if the ring is full. */
+static int janet_chan_ring_push(JanetChannel *chan, Janet x) {
+    int64_t pos = janet_atomic_load64(&chan->ring_tail);
+    JanetChannelCell *cell;
+    for (;;) {
+        cell = chan->ring + (pos % chan->ring_size);
+        int64_t diff = janet_atomic_load64(&cell->seq) - pos;
+        if (diff == 0) {
+            if (janet_atomic_cas64(&chan->ring_tail, pos, pos + 1)) break;
+        } else if (diff < 0) {
+            return 0;
+        }
+        pos = janet_atomic_load64(&chan->ring_tail);
+    }
+    cell->value = x;
+    janet_atomic_store64(&cell->seq, pos + 1);
+    return 1;
+}
+
+/* Returns 1 if an item was taken from the ring, 0 if the ring is empty. */
+static int janet_chan_ring_pop(JanetChannel *chan, Janet *x) {
+    int64_t pos = janet_atomic_load64(&chan->ring_head);
+    JanetChannelCell *cell;
+    for (;;) {
+        cell = chan->ring + (pos % chan->ring_size);
+        int64_t diff = janet_atomic_load64(&cell->seq) - (pos + 1);
+        if (diff == 0) {
+            if (janet_atomic_cas64(&chan->ring_head, pos, pos + 1)) break;
+        } else if (diff < 0) {
+            return 0;
+        }
+        pos = janet_atomic_load64(&chan->ring_head);
+    }
+    *x = cell->value;
+    janet_atomic_store64(&cell->seq, pos + chan->ring_size);
+    return 1;
+}
+
+/* Number of queued items, including those in the ring. */
+static int32_t janet_chan_count(JanetChannel *chan) {
+    int32_t count = janet_q_count(&chan->items);
+    if (NULL != chan->ring) {
+        int64_t head = janet_atomic_load64(&chan->ring_head);
+        int64_t tail = janet_atomic_load64(&chan->ring_tail);
+        if (tail > head) count += (int32_t)(tail - head);
+    }
+    return count;
+}
 
 static inline int janet_chan_is_threaded(JanetChannel *chan) {
     return chan->is_threaded;
@@ -601,7 +977,19 @@ static int janet_chan_pack(JanetChannel *chan, Janet *x) {
                 JANET_OUT_OF_MEMORY;
             }
             janet_buffer_init(buf, 10);
-            janet_marshal(buf, *x, NULL, JANET_MARSHAL_UNSAFE);
+            int flags = chan->is_move ? (JANET_MARSHAL_UNSAFE | JANET_MARSHAL_MOVE) : JANET_MARSHAL_UNSAFE;
+            JanetTryState tstate;
+            JanetSignal signal = janet_try(&tstate);
+            if (!signal) {
+                janet_marshal(buf, *x, NULL, flags);
+                janet_restore(&tstate);
+            } else {
+                /* Do not leak the buffer if a value can not be marshalled or moved */
+                janet_restore(&tstate);
+                janet_buffer_deinit(buf);
+                janet_free(buf);
+                janet_signalv(signal, tstate.payload);
+            }
             *x = janet_wrap_buffer(buf);
             return 0;
         }
@@ -622,6 +1010,7 @@ static int janet_chan_unpack(JanetChannel *chan, Janet *x, int is_cleanup) {
         case JANET_BUFFER: {
             JanetBuffer *buf = janet_unwrap_buffer(*x);
             int flags = is_cleanup ? (JANET_MARSHAL_UNSAFE | JANET_MARSHAL_DECREF) : JANET_MARSHAL_UNSAFE;
+            if (chan->is_move) flags |= JANET_MARSHAL_MOVE;
             *x = janet_unmarshal(buf->data, buf->count, flags, NULL, NULL);
             janet_buffer_deinit(buf);
             janet_free(buf);
@@ -640,32 +1029,109 @@ static void janet_chan_init(JanetChannel *chan, int32_t limit, int threaded) {
     chan->limit = limit;
     chan->closed = 0;
     chan->is_threaded = threaded;
+    chan->is_move = 0;
+    chan->ring = NULL;
+    chan->ring_size = 0;
+    chan->slow = 0;
+    chan->ring_head = 0;
+    chan->ring_tail = 0;
     janet_q_init(&chan->items);
     janet_q_init(&chan->read_pending);
     janet_q_init(&chan->write_pending);
     janet_os_mutex_init(&chan->lock);
 }
 
+/* Give a threaded channel a lock-free ring for its first limit items. */
+static void janet_chan_init_ring(JanetChannel *chan) {
+    int32_t size = chan->limit < JANET_CHANNEL_RING_MAX ? chan->limit : JANET_CHANNEL_RING_MAX;
+    /* A ring of one slot can not tell a full slot from an empty one */
+    if (size < 2) return;
+    chan->ring = janet_malloc(sizeof(JanetChannelCell) * (size_t) size);
+    if (NULL == chan->ring) {
+        JANET_OUT_OF_MEMORY;
+    }
+    for (int32_t i = 0; i < size; i++) {
+        chan->ring[i].seq = i;
+    }
+    chan->ring_size = size;
+}
+
 static void janet_chan_deinit(JanetChannel *chan) {
     janet_q_deinit(&chan->read_pending);
     janet_q_deinit(&chan->write_pending);
     if (janet_chan_is_threaded(chan)) {
         Janet item;
+        if (NULL != chan->ring) {
+            while (janet_chan_ring_pop(chan, &item)) {
+                janet_chan_unpack(chan, &item, 1);
+            }
+        }
         while (!janet_q_pop(&chan->items, &item, sizeof(item))) {
             janet_chan_unpack(chan, &item, 1);
         }
     }
+    janet_free(chan->ring);
     janet_q_deinit(&chan->items);
     janet_os_mutex_deinit(&chan->lock);
 }
 
+static void janet_thread_chan_cb(JanetEVGenericMessage msg);
+
+/* Wake a fiber waiting on a threaded channel */
+static void janet_chan_post(JanetChannel *chan, JanetChannelPending *pending, Janet x) {
+    JanetEVGenericMessage msg;
+    msg.tag = pending->mode;
+    msg.fiber = pending->fiber;
+    msg.argi = (int32_t) pending->sched_id;
+    msg.argp = chan;
+    msg.argj = x;
+    janet_ev_post_event(pending->thread, janet_thread_chan_cb, msg);
+}
+
+/* With the lock held, hand ring items to waiting readers, move overflow
+ * items into the ring, and release writers whose items are now within the
+ * channel limit. Blocked writers own the last items in the channel. */
+static void janet_chan_settle(JanetChannel *chan) {
+    JanetChannelPending pending;
+    Janet x;
+    while (janet_q_count(&chan->read_pending) > 0) {
+        if (!janet_chan_ring_pop(chan, &x) && janet_q_pop(&chan->items, &x, sizeof(x))) break;
+        janet_q_pop(&chan->read_pending, &pending, sizeof(pending));
+        janet_chan_post(chan, &pending, x);
+    }
+    while (janet_q_count(&chan->items) > 0) {
+        x = ((Janet *) chan->items.data)[chan->items.head];
+        if (!janet_chan_ring_push(chan, x)) break;
+        janet_q_pop(&chan->items, &x, sizeof(x));
+    }
+    while (janet_q_count(&chan->write_pending) > 0 &&
+            janet_chan_count(chan) - janet_q_count(&chan->write_pending) < chan->limit) {
+        janet_q_pop(&chan->write_pending, &pending, sizeof(pending));
+        janet_chan_post(chan, &pending, janet_wrap_nil());
+    }
+}
+
+/* For lock-free channels, slow stays set while the lock is held so that the
+ * fast paths fall back to the mutex, and after that as long as anything is
+ * waiting in the channel. */
 static void janet_chan_lock(JanetChannel *chan) {
     if (!janet_chan_is_threaded(chan)) return;
     janet_os_mutex_lock(&chan->lock);
+    if (NULL != chan->ring) {
+        janet_atomic_store32(&chan->slow, 1);
+        janet_atomic_fence();
+    }
 }
 
 static void janet_chan_unlock(JanetChannel *chan) {
     if (!janet_chan_is_threaded(chan)) return;
+    if (NULL != chan->ring) {
+        janet_chan_settle(chan);
+        janet_atomic_store32(&chan->slow, chan->closed ||
+                             janet_q_count(&chan->items) > 0 ||
+                             janet_q_count(&chan->read_pending) > 0 ||
+                             janet_q_count(&chan->write_pending) > 0);
+    }
     janet_os_mutex_unlock(&chan->lock);
 }
 
@@ -767,14 +1233,12 @@ static void janet_thread_chan_cb(JanetEVGenericMessage msg) {
             JanetChannelPending reader;
             janet_chan_lock(channel);
             if (!janet_q_pop(&channel->read_pending, &reader, sizeof(reader))) {
-                JanetVM *vm = reader.thread;
-                JanetEVGenericMessage msg;
-                msg.tag = reader.mode;
-                msg.fiber = reader.fiber;
-                msg.argi = (int32_t) reader.sched_id;
-                msg.argp = channel;
-                msg.argj = x;
-                janet_ev_post_event(vm, janet_thread_chan_cb, msg);
+                janet_chan_post(channel, &reader, x);
+            } else if (!channel->closed) {
+                /* Nobody left to take it, so put the item back in the channel */
+                janet_q_push(&channel->items, &x, sizeof(x));
+            } else {
+                janet_chan_unpack(channel, &x, 1);
             }
             janet_chan_unlock(channel);
         } else {
@@ -804,9 +1268,19 @@ static int janet_channel_push(JanetChannel *channel, Janet x, int mode) {
     if (janet_chan_pack(channel, &x)) {
         janet_panicf("failed to pack value for channel: %v", x);
     }
+    if (NULL != channel->ring && !janet_atomic_load32(&channel->slow) && janet_chan_ring_push(channel, x)) {
+        /* A reader may have started waiting since slow was checked. */
+        janet_atomic_fence();
+        if (janet_atomic_load32(&channel->slow)) {
+            janet_chan_lock(channel);
+            janet_chan_unlock(channel);
+        }
+        return 0;
+    }
     janet_chan_lock(channel);
     if (channel->closed) {
         janet_chan_unlock(channel);
+        janet_chan_unpack(channel, &x, 1);
         janet_panic("cannot write to closed channel");
     }
     int is_threaded = janet_chan_is_threaded(channel);
@@ -820,10 +1294,15 @@ static int janet_channel_push(JanetChannel *channel, Janet x, int mode) {
     }
     if (is_empty) {
         /* No pending reader */
+        if (NULL != channel->ring && janet_q_count(&channel->items) == 0 && janet_chan_ring_push(channel, x)) {
+            janet_chan_unlock(channel);
+            return 0;
+        }
         if (janet_q_push(&channel->items, &x, sizeof(Janet))) {
             janet_chan_unlock(channel);
+            janet_chan_unpack(channel, &x, 1);
             janet_panicf("channel overflow: %v", x);
-        } else if (janet_q_count(&channel->items) > channel->limit) {
+        } else if (janet_chan_count(channel) > channel->limit) {
             /* No root fiber, we are in completion on a root fiber. Don't block. */
             if (mode == 2) {
                 janet_chan_unlock(channel);
@@ -870,6 +1349,16 @@ static int janet_channel_push(JanetChannel *channel, Janet x, int mode) {
  * queue in the channel. */
 static int janet_channel_pop(JanetChannel *channel, Janet *item, int is_choice) {
     JanetChannelPending writer;
+    if (NULL != channel->ring && !janet_atomic_load32(&channel->slow) && janet_chan_ring_pop(channel, item)) {
+        /* A writer may be waiting for the slot that was just freed. */
+        janet_atomic_fence();
+        if (janet_atomic_load32(&channel->slow)) {
+            janet_chan_lock(channel);
+            janet_chan_unlock(channel);
+        }
+        janet_assert(!janet_chan_unpack(channel, item, 0), "bad channel packing");
+        return 1;
+    }
     janet_chan_lock(channel);
     if (channel->closed) {
         janet_chan_unlock(channel);
@@ -877,6 +1366,13 @@ static int janet_channel_pop(JanetChannel *channel, Janet *item, int is_choice)
         return 1;
     }
     int is_threaded = janet_chan_is_threaded(channel);
+    if (NULL != channel->ring && (janet_chan_ring_pop(channel, item) ||
+                                  !janet_q_pop(&channel->items, item, sizeof(Janet)))) {
+        /* Overflow items and their writers are moved up on unlock */
+        janet_chan_unlock(channel);
+        janet_assert(!janet_chan_unpack(channel, item, 0), "bad channel packing");
+        return 1;
+    }
     if (janet_q_pop(&channel->items, item, sizeof(Janet))) {
         /* Queue empty */
         JanetChannelPending pending;
@@ -895,14 +1391,7 @@ static int janet_channel_pop(JanetChannel *channel, Janet *item, int is_choice)
     if (!janet_q_pop(&channel->write_pending, &writer, sizeof(writer))) {
         /* Pending writer */
         if (is_threaded) {
-            JanetVM *vm = writer.thread;
-            JanetEVGenericMessage msg;
-            msg.tag = writer.mode;
-            msg.fiber = writer.fiber;
-            msg.argi = (int32_t) writer.sched_id;
-            msg.argp = channel;
-            msg.argj = janet_wrap_nil();
-            janet_ev_post_event(vm, janet_thread_chan_cb, msg);
+            janet_chan_post(channel, &writer, janet_wrap_nil());
         } else {
             if (writer.mode == JANET_CP_MODE_CHOICE_WRITE) {
                 janet_schedule(writer.fiber, make_write_result(channel));
@@ -978,7 +1467,7 @@ JANET_CORE_FN(cfun_channel_choice,
                 janet_chan_unlock(chan);
                 return make_close_result(chan);
             }
-            if (janet_q_count(&chan->items) < chan->limit) {
+            if (janet_chan_count(chan) < chan->limit) {
                 janet_chan_unlock(chan);
                 janet_channel_push(chan, data[1], 1);
                 return make_write_result(chan);
@@ -992,27 +1481,38 @@ JANET_CORE_FN(cfun_channel_choice,
                 janet_chan_unlock(chan);
                 return make_close_result(chan);
             }
-            if (chan->items.head != chan->items.tail) {
+            if (janet_chan_count(chan) > 0) {
                 Janet item;
                 janet_chan_unlock(chan);
-                janet_channel_pop(chan, &item, 1);
-                return make_read_result(chan, item);
+                if (janet_channel_pop(chan, &item, 1)) {
+                    return make_read_result(chan, item);
+                }
+                /* Another thread took the item first, so wait on every clause */
+                break;
             }
             janet_chan_unlock(chan);
         }
     }
 
-    /* Wait for all readers or writers */
+    /* Wait for all readers or writers. Threaded channels can become ready
+     * in the mean time, in which case the fiber is scheduled right away and
+     * any registered clauses are discarded by their sched_id. */
     for (int32_t i = 0; i < argc; i++) {
         if (janet_indexed_view(argv[i], &data, &len) && len == 2) {
             /* Write */
             JanetChannel *chan = janet_getchannel(data, 0);
-            janet_channel_push(chan, data[1], 1);
+            if (!janet_channel_push(chan, data[1], 1)) {
+                janet_schedule(janet_vm.root_fiber, make_write_result(chan));
+                break;
+            }
         } else {
             /* Read */
             Janet item;
             JanetChannel *chan = janet_getchannel(argv, i);
-            janet_channel_pop(chan, &item, 1);
+            if (janet_channel_pop(chan, &item, 1)) {
+                janet_schedule(janet_vm.root_fiber, make_read_result(chan, item));
+                break;
+            }
         }
     }
 
@@ -1025,7 +1525,7 @@ JANET_CORE_FN(cfun_channel_full,
     janet_fixarity(argc, 1);
     JanetChannel *channel = janet_getchannel(argv, 0);
     janet_chan_lock(channel);
-    Janet ret = janet_wrap_boolean(janet_q_count(&channel->items) >= channel->limit);
+    Janet ret = janet_wrap_boolean(janet_chan_count(channel) >= channel->limit);
     janet_chan_unlock(channel);
     return ret;
 }
@@ -1047,7 +1547,7 @@ JANET_CORE_FN(cfun_channel_count,
     janet_fixarity(argc, 1);
     JanetChannel *channel = janet_getchannel(argv, 0);
     janet_chan_lock(channel);
-    Janet ret = janet_wrap_integer(janet_q_count(&channel->items));
+    Janet ret = janet_wrap_integer(janet_chan_count(channel));
     janet_chan_unlock(channel);
     return ret;
 }
@@ -1081,13 +1581,29 @@ JANET_CORE_FN(cfun_channel_new,
 }
 
 JANET_CORE_FN(cfun_channel_new_threaded,
-              "(ev/thread-chan &opt limit)",
+              "(ev/thread-chan &opt limit flags)",
               "Create a threaded channel. A threaded channel is a channel that can be shared between threads and "
-              "used to communicate between any number of operating system threads.") {
-    janet_arity(argc, 0, 1);
+              "used to communicate between any number of operating system threads. `flags` is a keyword of the "
+              "following flags:\n\n"
+              "* :m - buffers given to the channel, including buffers inside other values, are moved instead of "
+              "copied: the receiving thread takes over their memory, and they are left empty in the sending thread. "
+              "Giving a buffer that is still in use, for example by a pending read or write or by the text of a "
+              "running peg match, raises an error.\n"
+              "* :l - keep the first `limit` items in a lock-free ring, so that readers and writers only take the "
+              "channel lock when one of them has to wait. Useful for channels shared by many busy threads. Has no "
+              "effect on channels with a limit below 2.") {
+    janet_arity(argc, 0, 2);
     int32_t limit = janet_optnat(argv, argc, 0, 0);
+    uint64_t flags = 0;
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
+        flags = janet_getflags(argv, 1, "ml");
+    }
     JanetChannel *tchan = janet_abstract_threaded(&janet_channel_type, sizeof(JanetChannel));
     janet_chan_init(tchan, limit, 1);
+    tchan->is_move = !!(flags & 1);
+    if (flags & 2) {
+        janet_chan_init_ring(tchan);
+    }
     return janet_wrap_abstract(tchan);
 }
 
@@ -1187,28 +1703,191 @@ void janet_loop1_impl(int has_timeout, JanetTimestamp timeout);
 
 int janet_loop_done(void) {
     return !(janet_vm.listener_count ||
-             (janet_vm.spawn.head != janet_vm.spawn.tail) ||
+             janet_ev_spawn_count() ||
              janet_vm.tq_count ||
              janet_vm.extra_listeners);
 }
 
+/* Wall clock time in seconds, for event loop statistics */
+static double janet_ev_clock(void) {
+#ifdef JANET_GETTIME
+    struct timespec spec;
+    janet_gettime(&spec);
+    return (double) spec.tv_sec + (double) spec.tv_nsec * 1e-9;
+#else
+    return 0.0;
+#endif
+}
+
+/* Add the time spent running fibers in one loop iteration to the statistics */
+static void janet_ev_record_run(double start) {
+    JanetEVStats *stats = &janet_vm.ev_stats;
+    double elapsed = janet_ev_clock() - start;
+    if (elapsed < 0) elapsed = 0;
+    if (elapsed > stats->run_time_max) stats->run_time_max = elapsed;
+    double micros = elapsed * 1e6;
+    int bucket = 0;
+    while (micros >= 1.0 && bucket < JANET_EV_RUN_BUCKETS - 1) {
+        micros *= 0.5;
+        bucket++;
+    }
+    stats->run_hist[bucket]++;
+}
+
+/* Report a resume that blocked the loop for too long to the slow resume hook */
+static void janet_ev_slow_resume(JanetFiber *fiber, double elapsed) {
+    janet_vm.ev_stats.slow_resumes++;
+    Janet argv[2] = {janet_wrap_fiber(fiber), janet_wrap_number(elapsed)};
+    Janet out;
+    JanetFiber *hook_fiber = NULL;
+    JanetFunction *hook = janet_unwrap_function(janet_vm.ev_slow_hook);
+    if (janet_pcall(hook, 2, argv, &out, &hook_fiber) != JANET_SIGNAL_OK) {
+        janet_stacktrace_ext(hook_fiber, out, "");
+    }
+}
+
+/* Time slicing. A thread per vm watches the resume counter of the event loop, and
+ * asks the vm to suspend when the same resume has been running for a whole quantum. */
+
+#ifdef JANET_NO_INTERPRETER_INTERRUPT
+
+static void janet_ev_slice_stop(void) {
+}
+
+static void janet_ev_slice_clear(void) {
+}
+
+#else
+
+typedef struct {
+    JanetVM *vm;
+    volatile int running;
+    int32_t quantum_us;
+#ifdef JANET_WINDOWS
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+} JanetSlicer;
+
+/* Request a suspension unless one is already pending */
+static void janet_ev_slice_request(JanetVM *vm) {
+#ifdef JANET_WINDOWS
+    InterlockedCompareExchange((volatile LONG *) &vm->auto_suspend, JANET_SUSPEND_SLICE, 0);
+#else
+    int expected = 0;
+    __atomic_compare_exchange_n(&vm->auto_suspend, &expected, JANET_SUSPEND_SLICE, 0,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/* Withdraw a time slice request, keeping any other interrupt */
+static void janet_ev_slice_clear(void) {
+    if (janet_vm.auto_suspend != JANET_SUSPEND_SLICE) return;
+#ifdef JANET_WINDOWS
+    InterlockedCompareExchange((volatile LONG *) &janet_vm.auto_suspend, 0, JANET_SUSPEND_SLICE);
+#else
+    int expected = JANET_SUSPEND_SLICE;
+    __atomic_compare_exchange_n(&janet_vm.auto_suspend, &expected, 0, 0,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/* Checks twice per quantum, so a fiber is preempted after one to one and a half quanta */
+static void janet_slicer_tick(JanetSlicer *slicer, int32_t *last_epoch, int *ticks) {
+    JanetVM *vm = slicer->vm;
+    int32_t epoch = vm->slice_epoch;
+    if (vm->slice_depth < 0 || epoch != *last_epoch) {
+        *last_epoch = epoch;
+        *ticks = 0;
+    } else if (++*ticks >= 2) {
+        *ticks = 0;
+        janet_ev_slice_request(vm);
+    }
+}
+
+#ifdef JANET_WINDOWS
+static DWORD WINAPI janet_slicer_body(LPVOID ptr) {
+    JanetSlicer *slicer = (JanetSlicer *) ptr;
+    DWORD ms = slicer->quantum_us / 2000;
+    int32_t last_epoch = -1;
+    int ticks = 0;
+    while (slicer->running) {
+        Sleep(ms ? ms : 1);
+        janet_slicer_tick(slicer, &last_epoch, &ticks);
+    }
+    return 0;
+}
+#else
+static void *janet_slicer_body(void *ptr) {
+    JanetSlicer *slicer = (JanetSlicer *) ptr;
+    int32_t half = slicer->quantum_us / 2;
+    struct timespec ts;
+    ts.tv_sec = half / 1000000;
+    ts.tv_nsec = (half % 1000000) * 1000;
+    int32_t last_epoch = -1;
+    int ticks = 0;
+    while (slicer->running) {
+        nanosleep(&ts, NULL);
+        janet_slicer_tick(slicer, &last_epoch, &ticks);
+    }
+    return NULL;
+}
+#endif
+
+static void janet_ev_slice_start(double quantum) {
+    JanetSlicer *slicer = janet_malloc(sizeof(JanetSlicer));
+    if (NULL == slicer) {
+        JANET_OUT_OF_MEMORY;
+    }
+    slicer->vm = &janet_vm;
+    slicer->running = 1;
+    slicer->quantum_us = (int32_t)(quantum * 1e6);
+    if (slicer->quantum_us < 2) slicer->quantum_us = 2;
+#ifdef JANET_WINDOWS
+    slicer->thread = CreateThread(NULL, 0, janet_slicer_body, slicer, 0, NULL);
+    if (NULL == slicer->thread) {
+        janet_free(slicer);
+        janet_panic("failed to create thread");
+    }
+#else
+    int err = pthread_create(&slicer->thread, NULL, janet_slicer_body, slicer);
+    if (err) {
+        janet_free(slicer);
+        janet_panicf("%s", strerror(err));
+    }
+#endif
+    janet_vm.slicer = slicer;
+}
+
+static void janet_ev_slice_stop(void) {
+    JanetSlicer *slicer = janet_vm.slicer;
+    if (NULL == slicer) return;
+    slicer->running = 0;
+#ifdef JANET_WINDOWS
+    WaitForSingleObject(slicer->thread, INFINITE);
+    CloseHandle(slicer->thread);
+#else
+    pthread_join(slicer->thread, NULL);
+#endif
+    janet_free(slicer);
+    janet_vm.slicer = NULL;
+    janet_ev_slice_clear();
+}
+
+#endif
+
 JanetFiber *janet_loop1(void) {
+    janet_vm.ev_stats.iterations++;
+    double run_start = janet_ev_clock();
+
     /* Schedule expired timers */
     JanetTimeout to;
-    JanetTimestamp now = ts_now();
-    while (peek_timeout(&to) && to.when <= now) {
-        pop_timeout(0);
+    tw_advance(ts_now());
+    while (pop_expired(&to)) {
         if (to.curr_fiber != NULL) {
             /* This is a deadline (for a fiber, not a function call) */
-            JanetFiberStatus s = janet_fiber_status(to.curr_fiber);
-            int isFinished = (s == JANET_STATUS_DEAD ||
-                              s == JANET_STATUS_ERROR ||
-                              s == JANET_STATUS_USER0 ||
-                              s == JANET_STATUS_USER1 ||
-                              s == JANET_STATUS_USER2 ||
-                              s == JANET_STATUS_USER3 ||
-                              s == JANET_STATUS_USER4);
-            if (!isFinished) {
+            if (!fiber_is_finished(to.curr_fiber)) {
                 janet_cancel(to.fiber, janet_cstringv("deadline expired"));
             }
         } else {
@@ -1224,14 +1903,27 @@ JanetFiber *janet_loop1(void) {
     }
 
     /* Run scheduled fibers */
-    while (janet_vm.spawn.head != janet_vm.spawn.tail) {
-        JanetTask task = {NULL, janet_wrap_nil(), JANET_SIGNAL_OK, 0};
-        janet_q_pop(&janet_vm.spawn, &task, sizeof(task));
+    JanetTask task = {NULL, janet_wrap_nil(), JANET_SIGNAL_OK, 0};
+    while (janet_ev_next_task(&task)) {
         if (task.fiber->gc.flags & JANET_FIBER_EV_FLAG_SUSPENDED) janet_ev_dec_refcount();
         task.fiber->gc.flags &= ~(JANET_FIBER_EV_FLAG_CANCELED | JANET_FIBER_EV_FLAG_SUSPENDED);
         if (task.expected_sched_id != task.fiber->sched_id) continue;
         Janet res;
+        int timed = janet_checktype(janet_vm.ev_slow_hook, JANET_FUNCTION);
+        double resume_start = timed ? janet_ev_clock() : 0.0;
+        janet_vm.slice_epoch++;
+        janet_vm.slice_preempted = 0;
+        janet_vm.slice_depth = janet_vm.resume_depth + 1;
         JanetSignal sig = janet_continue_signal(task.fiber, task.value, &res, task.sig);
+        janet_vm.slice_depth = -1;
+        /* Drop a time slice request that came too late to preempt this fiber */
+        janet_ev_slice_clear();
+        janet_vm.ev_stats.resumes++;
+        /* The fiber may have changed the hook */
+        if (timed && janet_checktype(janet_vm.ev_slow_hook, JANET_FUNCTION)) {
+            double elapsed = janet_ev_clock() - resume_start;
+            if (elapsed >= janet_vm.ev_slow_threshold) janet_ev_slow_resume(task.fiber, elapsed);
+        }
         void *sv = task.fiber->supervisor_channel;
         int is_suspended = sig == JANET_SIGNAL_EVENT || sig == JANET_SIGNAL_YIELD || sig == JANET_SIGNAL_INTERRUPT;
         if (is_suspended) {
@@ -1250,40 +1942,42 @@ JanetFiber *janet_loop1(void) {
             janet_stacktrace_ext(task.fiber, res, "");
         }
         if (sig == JANET_SIGNAL_INTERRUPT) {
+            if (janet_vm.slice_preempted) {
+                /* The fiber used up its time slice, so send it to the back of its queue
+                 * and poll before running anything else so timers and events are not starved */
+                janet_vm.slice_preempted = 0;
+                janet_vm.ev_stats.preemptions++;
+                janet_schedule(task.fiber, janet_wrap_nil());
+                break;
+            }
             /* On interrupts, return the interrupted fiber immediately */
+            janet_ev_record_run(run_start);
             return task.fiber;
         }
     }
+    janet_ev_record_run(run_start);
 
     /* Poll for events */
     if (janet_vm.listener_count || janet_vm.tq_count || janet_vm.extra_listeners) {
-        JanetTimeout to;
-        memset(&to, 0, sizeof(to));
-        int has_timeout;
-        /* Drop timeouts that are no longer needed */
-        while ((has_timeout = peek_timeout(&to))) {
-            if (to.curr_fiber != NULL) {
-                JanetFiberStatus s = janet_fiber_status(to.curr_fiber);
-                int is_finished = (s == JANET_STATUS_DEAD ||
-                                   s == JANET_STATUS_ERROR ||
-                                   s == JANET_STATUS_USER0 ||
-                                   s == JANET_STATUS_USER1 ||
-                                   s == JANET_STATUS_USER2 ||
-                                   s == JANET_STATUS_USER3 ||
-                                   s == JANET_STATUS_USER4);
-                if (is_finished) {
-                    pop_timeout(0);
-                    continue;
-                }
-            } else if (to.fiber->sched_id != to.sched_id) {
-                pop_timeout(0);
-                continue;
-            }
-            break;
+        /* Drop finished deadlines if they are all that would keep the loop waiting */
+        if (janet_vm.tq_count && janet_vm.tq_count == janet_vm.tw.deadlines &&
+                !janet_vm.listener_count && !janet_vm.extra_listeners &&
+                !janet_ev_spawn_count()) {
+            prune_deadlines();
         }
         /* Run polling implementation only if pending timeouts or pending events */
         if (janet_vm.tq_count || janet_vm.listener_count || janet_vm.extra_listeners) {
-            janet_loop1_impl(has_timeout, to.when);
+            JanetTimestamp when = 0;
+            int has_timeout = tw_next(&when);
+            /* Don't block if fibers are still waiting to run */
+            if (janet_ev_spawn_count()) {
+                JanetTimestamp now = ts_now();
+                if (!has_timeout || when > now) when = now;
+                has_timeout = 1;
+            }
+            /* Use idle time to advance an incremental collection */
+            janet_gc_idle_step();
+            janet_loop1_impl(has_timeout, when);
         }
     }
 
@@ -1322,23 +2016,66 @@ void janet_loop(void) {
 
 #else
 
+/* Events posted with janet_ev_post_event are pushed on a lock-free stack,
+ * and only the first event posted since the last drain writes to the self
+ * pipe. A burst of events costs a single wakeup. */
+typedef struct JanetInboxEvent {
+    JanetEVGenericMessage msg;
+    JanetCallback cb;
+    struct JanetInboxEvent *next;
+} JanetInboxEvent;
+
 static void janet_ev_setup_selfpipe(void) {
     if (janet_make_pipe(janet_vm.selfpipe, 0)) {
         JANET_EXIT("failed to initialize self pipe in event loop");
     }
+    janet_vm.inbox = NULL;
+    janet_vm.inbox_signaled = 0;
+}
+
+static JanetInboxEvent *janet_ev_take_inbox(void) {
+    JanetInboxEvent *stack = __atomic_exchange_n((JanetInboxEvent **) &janet_vm.inbox, NULL, __ATOMIC_ACQ_REL);
+    /* Reverse to get the events in the order they were posted */
+    JanetInboxEvent *events = NULL;
+    while (stack) {
+        JanetInboxEvent *next = stack->next;
+        stack->next = events;
+        events = stack;
+        stack = next;
+    }
+    return events;
 }
 
 /* Handle events from the self pipe inside the event loop */
 static void janet_ev_handle_selfpipe(void) {
     JanetSelfPipeEvent response;
     while (read(janet_vm.selfpipe[0], &response, sizeof(response)) > 0) {
+        /* Only results of threaded calls carry a callback, plain wakeups are empty */
         if (NULL != response.cb) {
+            janet_vm.threaded_pending--;
             response.cb(response.msg);
         }
     }
+    /* Clear the flag before taking the inbox so later posts signal again */
+    __atomic_store_n(&janet_vm.inbox_signaled, 0, __ATOMIC_SEQ_CST);
+    JanetInboxEvent *events = janet_ev_take_inbox();
+    while (events) {
+        JanetInboxEvent *next = events->next;
+        JanetEVGenericMessage msg = events->msg;
+        JanetCallback cb = events->cb;
+        janet_free(events);
+        cb(msg);
+        events = next;
+    }
 }
 
 static void janet_ev_cleanup_selfpipe(void) {
+    JanetInboxEvent *events = janet_ev_take_inbox();
+    while (events) {
+        JanetInboxEvent *next = events->next;
+        janet_free(events);
+        events = next;
+    }
     close(janet_vm.selfpipe[0]);
     close(janet_vm.selfpipe[1]);
 }
@@ -1351,6 +2088,10 @@ static JanetTimestamp ts_now(void) {
     return (JanetTimestamp) GetTickCount64();
 }
 
+/* Completion keys are stream pointers, except for events posted by janet_ev_post_event
+ * (key 0) and results of threaded calls (key 1) */
+#define JANET_IOCP_KEY_THREADED 1
+
 void janet_ev_init(void) {
     janet_ev_init_common();
     janet_vm.iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
@@ -1399,9 +2140,10 @@ void janet_loop1_impl(int has_timeout, JanetTimestamp to) {
     BOOL result = GetQueuedCompletionStatus(janet_vm.iocp, &num_bytes_transfered, &completionKey, &overlapped, (DWORD) waittime);
 
     if (result || overlapped) {
-        if (0 == completionKey) {
-            /* Custom event */
+        if (JANET_IOCP_KEY_THREADED >= completionKey) {
+            /* Custom event, or the result of a threaded call */
             JanetSelfPipeEvent *response = (JanetSelfPipeEvent *)(overlapped);
+            if (JANET_IOCP_KEY_THREADED == completionKey) janet_vm.threaded_pending--;
             if (NULL != response->cb) {
                 response->cb(response->msg);
             }
@@ -1414,7 +2156,7 @@ void janet_loop1_impl(int has_timeout, JanetTimestamp to) {
                 if (state->tag == overlapped) {
                     state->event = overlapped;
                     state->bytes = num_bytes_transfered;
-                    JanetAsyncStatus status = state->machine(state, JANET_ASYNC_EVENT_COMPLETE);
+                    JanetAsyncStatus status = janet_listener_fire(state, JANET_ASYNC_EVENT_COMPLETE);
                     if (status == JANET_ASYNC_STATUS_DONE) {
                         janet_unlisten(state, 0);
                     }
@@ -1451,9 +2193,9 @@ static void janet_epoll_sync_callback(JanetEVGenericMessage msg) {
     JanetAsyncStatus status1 = JANET_ASYNC_STATUS_NOT_DONE;
     JanetAsyncStatus status2 = JANET_ASYNC_STATUS_NOT_DONE;
     if (state->stream->_mask & JANET_ASYNC_LISTEN_WRITE)
-        status1 = state->machine(state, JANET_ASYNC_EVENT_WRITE);
+        status1 = janet_listener_fire(state, JANET_ASYNC_EVENT_WRITE);
     if (state->stream->_mask & JANET_ASYNC_LISTEN_READ)
-        status2 = state->machine(state, JANET_ASYNC_EVENT_READ);
+        status2 = janet_listener_fire(state, JANET_ASYNC_EVENT_READ);
     if (status1 == JANET_ASYNC_STATUS_DONE ||
             status2 == JANET_ASYNC_STATUS_DONE) {
         janet_unlisten(state, 0);
@@ -1563,13 +2305,13 @@ void janet_loop1_impl(int has_timeout, JanetTimestamp timeout) {
                 JanetAsyncStatus status3 = JANET_ASYNC_STATUS_NOT_DONE;
                 JanetAsyncStatus status4 = JANET_ASYNC_STATUS_NOT_DONE;
                 if (mask & EPOLLOUT)
-                    status1 = state->machine(state, JANET_ASYNC_EVENT_WRITE);
+                    status1 = janet_listener_fire(state, JANET_ASYNC_EVENT_WRITE);
                 if (mask & EPOLLIN)
-                    status2 = state->machine(state, JANET_ASYNC_EVENT_READ);
+                    status2 = janet_listener_fire(state, JANET_ASYNC_EVENT_READ);
                 if (mask & EPOLLERR)
-                    status3 = state->machine(state, JANET_ASYNC_EVENT_ERR);
+                    status3 = janet_listener_fire(state, JANET_ASYNC_EVENT_ERR);
                 if ((mask & EPOLLHUP) && !(mask & (EPOLLOUT | EPOLLIN)))
-                    status4 = state->machine(state, JANET_ASYNC_EVENT_HUP);
+                    status4 = janet_listener_fire(state, JANET_ASYNC_EVENT_HUP);
                 if (status1 == JANET_ASYNC_STATUS_DONE ||
                         status2 == JANET_ASYNC_STATUS_DONE ||
                         status3 == JANET_ASYNC_STATUS_DONE ||
@@ -1612,29 +2354,370 @@ void janet_ev_deinit(void) {
  * End epoll implementation
  */
 
-#elif defined(JANET_EV_KQUEUE)
-/* Definition from:
- *   https://github.com/wahern/cqueues/blob/master/src/lib/kpoll.c
- * NetBSD uses intptr_t while others use void * for .udata */
-#define EV_SETx(ev, a, b, c, d, e, f) EV_SET((ev), (a), (b), (c), (d), (e), ((__typeof__((ev)->udata))(f)))
-#define JANET_KQUEUE_TF (EV_ADD | EV_ENABLE | EV_CLEAR | EV_ONESHOT)
-#define JANET_KQUEUE_MIN_INTERVAL 0
+#elif defined(JANET_EV_URING)
 
-/* NOTE:
- * NetBSD and OpenBSD expect things are always intervals, and FreeBSD doesn't
- * like an ABSTIME in the past so just use intervals always. Introduces a
- * calculation to determine the minimum timeout per timeout requested of
- * kqueue. Also note that NetBSD doesn't accept timeout intervals less than 1
- * millisecond, so correct all intervals on that platform to be at least 1
- * millisecond.*/
-JanetTimestamp to_interval(const JanetTimestamp ts) {
-    return ts >= JANET_KQUEUE_MIN_INTERVAL ? ts : JANET_KQUEUE_MIN_INTERVAL;
-}
-#define JANET_KQUEUE_INTERVAL(timestamp) (to_interval((timestamp - ts_now())))
+/*
+ * io_uring implementation. Readiness polls, poll removals and the loop timer are
+ * queued as submission entries and flushed in the same io_uring_enter call that
+ * waits for completions, so arming or disarming a listener costs no extra syscall.
+ * Each stream owns at most one outstanding oneshot poll, which is re-armed after
+ * every completion while the stream still has listeners (level triggered, like epoll).
+ */
 
-static JanetTimestamp ts_now(void) {
-    struct timespec now;
-    janet_assert(-1 != clock_gettime(CLOCK_MONOTONIC, &now), "failed to get time");
+#define JANET_URING_ENTRIES 256
+#define JANET_URING_IGNORE 0
+#define JANET_URING_TIMER 1
+#define JANET_URING_SELFPIPE 2
+
+/* One per stream with listeners. The stream pointer is cleared when the stream
+ * stops listening, and the token is freed once its last completion arrives. */
+typedef struct {
+    JanetStream *stream;
+    uint32_t armed;
+    int pending;
+    int cancelling;
+} JanetUringPoll;
+
+struct JanetUring {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned sq_local_tail;
+    int timer_pending;
+    JanetTimestamp timer_deadline;
+};
+
+static JanetTimestamp ts_now(void) {
+    struct timespec now;
+    janet_assert(-1 != clock_gettime(CLOCK_MONOTONIC, &now), "failed to get time");
+    uint64_t res = 1000 * now.tv_sec;
+    res += now.tv_nsec / 1000000;
+    return res;
+}
+
+static int janet_uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, janet_vm.uring->fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* Push all queued submissions to the kernel without waiting */
+static void janet_uring_flush(void) {
+    struct JanetUring *ring = janet_vm.uring;
+    unsigned to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    while (to_submit) {
+        int status = janet_uring_enter(to_submit, 0, 0);
+        if (status == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            JANET_EXIT("failed to submit io_uring events");
+        }
+        to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    }
+}
+
+static struct io_uring_sqe *janet_uring_sqe(void) {
+    struct JanetUring *ring = janet_vm.uring;
+    unsigned entries = *ring->sq_mask + 1;
+    if (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= entries) {
+        janet_uring_flush();
+    }
+    unsigned index = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = ring->sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+static uint32_t make_uring_events(int mask) {
+    uint32_t events = 0;
+    if (mask & JANET_ASYNC_LISTEN_READ)
+        events |= POLLIN;
+    if (mask & JANET_ASYNC_LISTEN_WRITE)
+        events |= POLLOUT;
+    return events;
+}
+
+static void janet_uring_poll_add(int fd, uint32_t events, uint64_t user_data) {
+    struct io_uring_sqe *sqe = janet_uring_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = user_data;
+}
+
+static void janet_uring_poll_remove(uint64_t target) {
+    struct io_uring_sqe *sqe = janet_uring_sqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = JANET_URING_IGNORE;
+}
+
+/* Make sure the stream's outstanding poll covers everything its listeners want */
+static void janet_uring_arm(JanetStream *stream) {
+    JanetUringPoll *poll = stream->_uring;
+    uint32_t events = make_uring_events(stream->_mask);
+    if (NULL == poll) {
+        poll = janet_malloc(sizeof(JanetUringPoll));
+        if (NULL == poll) {
+            JANET_OUT_OF_MEMORY;
+        }
+        poll->stream = stream;
+        poll->armed = 0;
+        poll->pending = 0;
+        poll->cancelling = 0;
+        stream->_uring = poll;
+    }
+    if (poll->pending) {
+        /* Cancel and re-arm from the completion if the interest grew */
+        if ((poll->armed & events) != events && !poll->cancelling) {
+            poll->cancelling = 1;
+            janet_uring_poll_remove((uint64_t)(uintptr_t) poll);
+        }
+        return;
+    }
+    poll->armed = events;
+    poll->pending = 1;
+    poll->cancelling = 0;
+    janet_uring_poll_add(stream->handle, events, (uint64_t)(uintptr_t) poll);
+}
+
+/* Wait for the next event */
+JanetListenerState *janet_listen(JanetStream *stream, JanetListener behavior, int mask, size_t size, void *user) {
+    JanetListenerState *state = janet_listen_impl(stream, behavior, mask, size, user);
+    janet_uring_arm(stream);
+    return state;
+}
+
+/* Tell system we are done listening for a certain event */
+static void janet_unlisten(JanetListenerState *state, int is_gc) {
+    JanetStream *stream = state->stream;
+    /* Destroy state machine and free memory */
+    janet_unlisten_impl(state, is_gc);
+    JanetUringPoll *poll = stream->_uring;
+    if (NULL != stream->state || NULL == poll) return;
+    /* Detach the poll from the stream, since the stream may be collected or closed
+     * before the kernel acknowledges the removal. */
+    stream->_uring = NULL;
+    poll->stream = NULL;
+    if (!poll->pending) {
+        janet_free(poll);
+    } else {
+        if (!poll->cancelling) {
+            poll->cancelling = 1;
+            janet_uring_poll_remove((uint64_t)(uintptr_t) poll);
+        }
+        /* A pending poll holds a reference to the file, so submit the removal now
+         * rather than keeping the descriptor alive after it is closed. */
+        janet_uring_flush();
+    }
+}
+
+static void janet_uring_dispatch(JanetUringPoll *poll, int32_t res) {
+    JanetStream *stream = poll->stream;
+    poll->pending = 0;
+    if (NULL == stream) {
+        janet_free(poll);
+        return;
+    }
+    /* A cancelled poll is simply re-armed below, other failures are reported as errors */
+    int mask = res > 0 ? res : (res == -ECANCELED ? 0 : POLLERR);
+    if (mask) {
+        JanetListenerState *state = stream->state;
+        while (NULL != state) {
+            state->event = &res;
+            JanetListenerState *next_state = state->_next;
+            JanetAsyncStatus status1 = JANET_ASYNC_STATUS_NOT_DONE;
+            JanetAsyncStatus status2 = JANET_ASYNC_STATUS_NOT_DONE;
+            JanetAsyncStatus status3 = JANET_ASYNC_STATUS_NOT_DONE;
+            JanetAsyncStatus status4 = JANET_ASYNC_STATUS_NOT_DONE;
+            if (mask & POLLOUT)
+                status1 = janet_listener_fire(state, JANET_ASYNC_EVENT_WRITE);
+            if (mask & POLLIN)
+                status2 = janet_listener_fire(state, JANET_ASYNC_EVENT_READ);
+            if (mask & POLLERR)
+                status3 = janet_listener_fire(state, JANET_ASYNC_EVENT_ERR);
+            if ((mask & POLLHUP) && !(mask & (POLLOUT | POLLIN)))
+                status4 = janet_listener_fire(state, JANET_ASYNC_EVENT_HUP);
+            if (status1 == JANET_ASYNC_STATUS_DONE ||
+                    status2 == JANET_ASYNC_STATUS_DONE ||
+                    status3 == JANET_ASYNC_STATUS_DONE ||
+                    status4 == JANET_ASYNC_STATUS_DONE)
+                janet_unlisten(state, 0);
+            state = next_state;
+        }
+    }
+    /* The machines above may have closed the stream and released the poll */
+    if (stream->_uring != poll) return;
+    if (stream->flags & JANET_STREAM_CLOSED) {
+        stream->_uring = NULL;
+        janet_free(poll);
+    } else if (NULL != stream->state) {
+        janet_uring_arm(stream);
+    }
+}
+
+void janet_loop1_impl(int has_timeout, JanetTimestamp timeout) {
+    struct JanetUring *ring = janet_vm.uring;
+    if (ring->timer_pending && (!has_timeout || timeout != ring->timer_deadline)) {
+        struct io_uring_sqe *sqe = janet_uring_sqe();
+        sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = JANET_URING_TIMER;
+        sqe->user_data = JANET_URING_IGNORE;
+        ring->timer_pending = 0;
+    }
+    struct __kernel_timespec ts;
+    if (has_timeout && !ring->timer_pending) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000;
+        struct io_uring_sqe *sqe = janet_uring_sqe();
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)(uintptr_t) &ts;
+        sqe->len = 1;
+        sqe->timeout_flags = IORING_TIMEOUT_ABS;
+        sqe->user_data = JANET_URING_TIMER;
+        ring->timer_pending = 1;
+        ring->timer_deadline = timeout;
+    }
+
+    /* Submit everything queued since the last iteration and wait for one completion */
+    int status;
+    do {
+        unsigned to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        status = janet_uring_enter(to_submit, 1, IORING_ENTER_GETEVENTS);
+    } while (status == -1 && (errno == EINTR || errno == EAGAIN || errno == EBUSY));
+    if (status == -1) {
+        JANET_EXIT("failed to poll events");
+    }
+
+    /* Step state machines */
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = ring->cqes + (head & *ring->cq_mask);
+        uint64_t user_data = cqe->user_data;
+        int32_t res = cqe->res;
+        head++;
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        if (user_data == JANET_URING_IGNORE) {
+            continue;
+        } else if (user_data == JANET_URING_TIMER) {
+            /* Timer expired, ignore */
+            if (res == -ETIME) ring->timer_pending = 0;
+        } else if (user_data == JANET_URING_SELFPIPE) {
+            /* Self-pipe handling */
+            janet_uring_poll_add(janet_vm.selfpipe[0], POLLIN, JANET_URING_SELFPIPE);
+            janet_ev_handle_selfpipe();
+        } else {
+            janet_uring_dispatch((JanetUringPoll *)(uintptr_t) user_data, res);
+        }
+        tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    }
+}
+
+void janet_ev_init(void) {
+    janet_ev_init_common();
+    janet_ev_setup_selfpipe();
+    struct JanetUring *ring = janet_malloc(sizeof(struct JanetUring));
+    if (NULL == ring) {
+        JANET_OUT_OF_MEMORY;
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->sq_ring = MAP_FAILED;
+    ring->cq_ring = MAP_FAILED;
+    ring->sqes = MAP_FAILED;
+    janet_vm.uring = ring;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int) syscall(__NR_io_uring_setup, JANET_URING_ENTRIES, &params);
+    if (ring->fd == -1) goto error;
+    fcntl(ring->fd, F_SETFD, FD_CLOEXEC);
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = 0;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) goto error;
+    if (ring->cq_ring_size) {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) goto error;
+    }
+    void *cq_ring = ring->cq_ring_size ? ring->cq_ring : ring->sq_ring;
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) goto error;
+    ring->sq_head = (unsigned *)((char *) ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned *)((char *) ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *) ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *) ring->sq_ring + params.sq_off.array);
+    ring->cq_head = (unsigned *)((char *) cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *) cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *) cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *) cq_ring + params.cq_off.cqes);
+    ring->sq_local_tail = *ring->sq_tail;
+    janet_uring_poll_add(janet_vm.selfpipe[0], POLLIN, JANET_URING_SELFPIPE);
+    return;
+error:
+    JANET_EXIT("failed to initialize event loop");
+}
+
+void janet_ev_deinit(void) {
+    struct JanetUring *ring = janet_vm.uring;
+    janet_ev_deinit_common();
+    if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != MAP_FAILED) munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    janet_ev_cleanup_selfpipe();
+    janet_free(ring);
+    janet_vm.uring = NULL;
+}
+
+/*
+ * End io_uring implementation
+ */
+
+#elif defined(JANET_EV_KQUEUE)
+/* Definition from:
+ *   https://github.com/wahern/cqueues/blob/master/src/lib/kpoll.c
+ * NetBSD uses intptr_t while others use void * for .udata */
+#define EV_SETx(ev, a, b, c, d, e, f) EV_SET((ev), (a), (b), (c), (d), (e), ((__typeof__((ev)->udata))(f)))
+#define JANET_KQUEUE_TF (EV_ADD | EV_ENABLE | EV_CLEAR | EV_ONESHOT)
+#define JANET_KQUEUE_MIN_INTERVAL 0
+
+/* NOTE:
+ * NetBSD and OpenBSD expect things are always intervals, and FreeBSD doesn't
+ * like an ABSTIME in the past so just use intervals always. Introduces a
+ * calculation to determine the minimum timeout per timeout requested of
+ * kqueue. Also note that NetBSD doesn't accept timeout intervals less than 1
+ * millisecond, so correct all intervals on that platform to be at least 1
+ * millisecond.*/
+JanetTimestamp to_interval(const JanetTimestamp ts) {
+    return ts >= JANET_KQUEUE_MIN_INTERVAL ? ts : JANET_KQUEUE_MIN_INTERVAL;
+}
+#define JANET_KQUEUE_INTERVAL(timestamp) (to_interval((timestamp - ts_now())))
+
+static JanetTimestamp ts_now(void) {
+    struct timespec now;
+    janet_assert(-1 != clock_gettime(CLOCK_MONOTONIC, &now), "failed to get time");
     uint64_t res = 1000 * now.tv_sec;
     res += now.tv_nsec / 1000000;
     return res;
@@ -1759,13 +2842,13 @@ void janet_loop1_impl(int has_timeout, JanetTimestamp timeout) {
 
                 if (!(events[i].flags & EV_ERROR)) {
                     if (events[i].filter == EVFILT_WRITE)
-                        statuses[0] = state->machine(state, JANET_ASYNC_EVENT_WRITE);
+                        statuses[0] = janet_listener_fire(state, JANET_ASYNC_EVENT_WRITE);
                     if (events[i].filter == EVFILT_READ)
-                        statuses[1] = state->machine(state, JANET_ASYNC_EVENT_READ);
+                        statuses[1] = janet_listener_fire(state, JANET_ASYNC_EVENT_READ);
                     if ((events[i].flags & EV_EOF) && !(events[i].data > 0))
-                        statuses[3] = state->machine(state, JANET_ASYNC_EVENT_HUP);
+                        statuses[3] = janet_listener_fire(state, JANET_ASYNC_EVENT_HUP);
                 } else {
-                    statuses[2] = state->machine(state, JANET_ASYNC_EVENT_ERR);
+                    statuses[2] = janet_listener_fire(state, JANET_ASYNC_EVENT_ERR);
                 }
                 if (statuses[0] == JANET_ASYNC_STATUS_DONE ||
                         statuses[1] == JANET_ASYNC_STATUS_DONE ||
@@ -1879,13 +2962,13 @@ void janet_loop1_impl(int has_timeout, JanetTimestamp timeout) {
         JanetAsyncStatus status4 = JANET_ASYNC_STATUS_NOT_DONE;
         state->event = pfd;
         if (mask & POLLOUT)
-            status1 = state->machine(state, JANET_ASYNC_EVENT_WRITE);
+            status1 = janet_listener_fire(state, JANET_ASYNC_EVENT_WRITE);
         if (mask & POLLIN)
-            status2 = state->machine(state, JANET_ASYNC_EVENT_READ);
+            status2 = janet_listener_fire(state, JANET_ASYNC_EVENT_READ);
         if (mask & POLLERR)
-            status3 = state->machine(state, JANET_ASYNC_EVENT_ERR);
+            status3 = janet_listener_fire(state, JANET_ASYNC_EVENT_ERR);
         if ((mask & POLLHUP) && !(mask & (POLLIN | POLLOUT)))
-            status4 = state->machine(state, JANET_ASYNC_EVENT_HUP);
+            status4 = janet_listener_fire(state, JANET_ASYNC_EVENT_HUP);
         if (status1 == JANET_ASYNC_STATUS_DONE ||
                 status2 == JANET_ASYNC_STATUS_DONE ||
                 status3 == JANET_ASYNC_STATUS_DONE ||
@@ -1941,10 +3024,19 @@ void janet_ev_post_event(JanetVM *vm, JanetCallback cb, JanetEVGenericMessage ms
                                             (LPOVERLAPPED) event),
                  "failed to post completion event");
 #else
+    JanetInboxEvent *posted = janet_malloc(sizeof(JanetInboxEvent));
+    if (NULL == posted) {
+        JANET_OUT_OF_MEMORY;
+    }
+    posted->msg = msg;
+    posted->cb = cb;
+    JanetInboxEvent **inbox = (JanetInboxEvent **) &vm->inbox;
+    posted->next = __atomic_load_n(inbox, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(inbox, &posted->next, posted, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    /* Only wake the loop if no wakeup is pending already */
+    if (__atomic_exchange_n(&vm->inbox_signaled, 1, __ATOMIC_SEQ_CST)) return;
     JanetSelfPipeEvent event;
     memset(&event, 0, sizeof(event));
-    event.msg = msg;
-    event.cb = cb;
     int fd = vm->selfpipe[1];
     /* handle a bit of back pressure before giving up. */
     int tries = 4;
@@ -1965,9 +3057,17 @@ void janet_ev_post_event(JanetVM *vm, JanetCallback cb, JanetEVGenericMessage ms
  * Threaded calls
  */
 
+#ifndef JANET_THREAD_POOL_SIZE
+#define JANET_THREAD_POOL_SIZE 32
+#endif
+
+static void janet_thread_pool_completed(void);
+
+/* Run a threaded subroutine and post its result back to the owning event loop.
+ * Jobs from the worker pool are counted as completed before the result is posted,
+ * so the event loop never sees a result that ev/thread-pool does not count yet. */
+static void janet_ev_run_threaded(JanetEVThreadInit *init, int pooled) {
 #ifdef JANET_WINDOWS
-static DWORD WINAPI janet_thread_body(LPVOID ptr) {
-    JanetEVThreadInit *init = (JanetEVThreadInit *)ptr;
     JanetEVGenericMessage msg = init->msg;
     JanetThreadedSubroutine subr = init->subr;
     JanetThreadedCallback cb = init->cb;
@@ -1975,16 +3075,13 @@ static DWORD WINAPI janet_thread_body(LPVOID ptr) {
     /* Reuse memory from thread init for returning data */
     init->msg = subr(msg);
     init->cb = cb;
+    if (pooled) janet_thread_pool_completed();
     janet_assert(PostQueuedCompletionStatus(iocp,
                                             sizeof(JanetSelfPipeEvent),
-                                            0,
+                                            JANET_IOCP_KEY_THREADED,
                                             (LPOVERLAPPED) init),
                  "failed to post completion event");
-    return 0;
-}
 #else
-static void *janet_thread_body(void *ptr) {
-    JanetEVThreadInit *init = (JanetEVThreadInit *)ptr;
     JanetEVGenericMessage msg = init->msg;
     JanetThreadedSubroutine subr = init->subr;
     JanetThreadedCallback cb = init->cb;
@@ -1994,6 +3091,7 @@ static void *janet_thread_body(void *ptr) {
     memset(&response, 0, sizeof(response));
     response.msg = subr(msg);
     response.cb = cb;
+    if (pooled) janet_thread_pool_completed();
     /* handle a bit of back pressure before giving up. */
     int tries = 4;
     while (tries > 0) {
@@ -2005,11 +3103,132 @@ static void *janet_thread_body(void *ptr) {
         sleep(1);
         tries--;
     }
+#endif
+}
+
+/* Process wide pool of worker threads shared by every event loop. Workers are
+ * started on demand up to max_workers and park on a condition variable when
+ * there is no work. Jobs are queued in FIFO order through JanetEVThreadInit.next. */
+typedef struct {
+#ifdef JANET_WINDOWS
+    SRWLOCK lock;
+    CONDITION_VARIABLE cond;
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+    JanetEVThreadInit *head;
+    JanetEVThreadInit *tail;
+    int32_t workers;
+    int32_t idle;
+    int32_t queued;
+    int32_t max_queued;
+    int32_t max_workers;
+    uint64_t submitted;
+    uint64_t completed;
+} JanetThreadPool;
+
+#ifdef JANET_WINDOWS
+static JanetThreadPool janet_thread_pool = {
+    SRWLOCK_INIT, CONDITION_VARIABLE_INIT, NULL, NULL, 0, 0, 0, 0, JANET_THREAD_POOL_SIZE, 0, 0
+};
+#define janet_pool_lock() AcquireSRWLockExclusive(&janet_thread_pool.lock)
+#define janet_pool_unlock() ReleaseSRWLockExclusive(&janet_thread_pool.lock)
+#define janet_pool_wait() SleepConditionVariableSRW(&janet_thread_pool.cond, &janet_thread_pool.lock, INFINITE, 0)
+#define janet_pool_signal() WakeConditionVariable(&janet_thread_pool.cond)
+#define janet_pool_broadcast() WakeAllConditionVariable(&janet_thread_pool.cond)
+#else
+static JanetThreadPool janet_thread_pool = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, 0, 0, JANET_THREAD_POOL_SIZE, 0, 0
+};
+#define janet_pool_lock() pthread_mutex_lock(&janet_thread_pool.lock)
+#define janet_pool_unlock() pthread_mutex_unlock(&janet_thread_pool.lock)
+#define janet_pool_wait() pthread_cond_wait(&janet_thread_pool.cond, &janet_thread_pool.lock)
+#define janet_pool_signal() pthread_cond_signal(&janet_thread_pool.cond)
+#define janet_pool_broadcast() pthread_cond_broadcast(&janet_thread_pool.cond)
+#endif
+
+static void janet_thread_pool_completed(void) {
+    janet_pool_lock();
+    janet_thread_pool.completed++;
+    janet_pool_unlock();
+}
+
+static void janet_thread_pool_worker(void) {
+    janet_pool_lock();
+    for (;;) {
+        while (NULL == janet_thread_pool.head) {
+            /* Retire surplus workers if the pool was shrunk */
+            if (janet_thread_pool.workers > janet_thread_pool.max_workers) goto done;
+            janet_thread_pool.idle++;
+            janet_pool_wait();
+            janet_thread_pool.idle--;
+        }
+        JanetEVThreadInit *init = janet_thread_pool.head;
+        janet_thread_pool.head = init->next;
+        if (NULL == janet_thread_pool.head) janet_thread_pool.tail = NULL;
+        janet_thread_pool.queued--;
+        janet_pool_unlock();
+        janet_ev_run_threaded(init, 1);
+        janet_pool_lock();
+    }
+done:
+    janet_thread_pool.workers--;
+    janet_pool_unlock();
+}
+
+#ifdef JANET_WINDOWS
+static DWORD WINAPI janet_thread_body(LPVOID ptr) {
+    janet_ev_run_threaded((JanetEVThreadInit *) ptr, 0);
+    return 0;
+}
+static DWORD WINAPI janet_thread_pool_body(LPVOID ptr) {
+    (void) ptr;
+    janet_thread_pool_worker();
+    return 0;
+}
+#else
+static void *janet_thread_body(void *ptr) {
+    janet_ev_run_threaded((JanetEVThreadInit *) ptr, 0);
+    return NULL;
+}
+static void *janet_thread_pool_body(void *ptr) {
+    (void) ptr;
+    janet_thread_pool_worker();
     return NULL;
 }
 #endif
 
-void janet_ev_threaded_call(JanetThreadedSubroutine fp, JanetEVGenericMessage arguments, JanetThreadedCallback cb) {
+/* Start a detached thread. Returns 0 on success, or an error code. */
+static int janet_ev_start_thread(int pool, JanetEVThreadInit *init) {
+#ifdef JANET_WINDOWS
+    HANDLE thread_handle = pool
+                           ? CreateThread(NULL, 0, janet_thread_pool_body, NULL, 0, NULL)
+                           : CreateThread(NULL, 0, janet_thread_body, init, 0, NULL);
+    if (NULL == thread_handle) return 1;
+    CloseHandle(thread_handle); /* detach from thread */
+    return 0;
+#else
+    pthread_t thread;
+    int err = pool
+              ? pthread_create(&thread, NULL, janet_thread_pool_body, NULL)
+              : pthread_create(&thread, NULL, janet_thread_body, init);
+    if (err) return err;
+    pthread_detach(thread);
+    return 0;
+#endif
+}
+
+static JANET_NO_RETURN void janet_ev_thread_error(int err) {
+#ifdef JANET_WINDOWS
+    (void) err;
+    janet_panic("failed to create thread");
+#else
+    janet_panicf("%s", strerror(err));
+#endif
+}
+
+static JanetEVThreadInit *janet_ev_thread_init(JanetThreadedSubroutine fp, JanetEVGenericMessage arguments, JanetThreadedCallback cb) {
     JanetEVThreadInit *init = janet_malloc(sizeof(JanetEVThreadInit));
     if (NULL == init) {
         JANET_OUT_OF_MEMORY;
@@ -2017,30 +3236,70 @@ void janet_ev_threaded_call(JanetThreadedSubroutine fp, JanetEVGenericMessage ar
     init->msg = arguments;
     init->subr = fp;
     init->cb = cb;
-
+    init->next = NULL;
 #ifdef JANET_WINDOWS
     init->write_pipe = janet_vm.iocp;
-    HANDLE thread_handle = CreateThread(NULL, 0, janet_thread_body, init, 0, NULL);
-    if (NULL == thread_handle) {
-        janet_free(init);
-        janet_panic("failed to create thread");
-    }
-    CloseHandle(thread_handle); /* detach from thread */
 #else
     init->write_pipe = janet_vm.selfpipe[1];
-    pthread_t waiter_thread;
-    int err = pthread_create(&waiter_thread, NULL, janet_thread_body, init);
-    if (err) {
-        janet_free(init);
-        janet_panicf("%s", strerror(err));
-    }
-    pthread_detach(waiter_thread);
 #endif
+    return init;
+}
+
+void janet_ev_threaded_call(JanetThreadedSubroutine fp, JanetEVGenericMessage arguments, JanetThreadedCallback cb) {
+    JanetEVThreadInit *init = janet_ev_thread_init(fp, arguments, cb);
+
+    janet_pool_lock();
+    /* Only start a new worker when the idle ones can not absorb the queue */
+    if (janet_thread_pool.queued >= janet_thread_pool.idle &&
+            janet_thread_pool.workers < janet_thread_pool.max_workers) {
+        int err = janet_ev_start_thread(1, NULL);
+        if (err) {
+            if (janet_thread_pool.workers == 0) {
+                janet_pool_unlock();
+                janet_free(init);
+                janet_ev_thread_error(err);
+            }
+        } else {
+            janet_thread_pool.workers++;
+        }
+    }
+    if (NULL == janet_thread_pool.tail) {
+        janet_thread_pool.head = init;
+    } else {
+        janet_thread_pool.tail->next = init;
+    }
+    janet_thread_pool.tail = init;
+    janet_thread_pool.queued++;
+    janet_thread_pool.submitted++;
+    if (janet_thread_pool.queued > janet_thread_pool.max_queued) {
+        janet_thread_pool.max_queued = janet_thread_pool.queued;
+    }
+    janet_pool_signal();
+    janet_pool_unlock();
+    janet_vm.threaded_pending++;
 
     /* Increment ev refcount so we don't quit while waiting for a subprocess */
     janet_ev_inc_refcount();
 }
 
+/* Like janet_ev_threaded_call, but always runs on a fresh thread. Used for long lived
+ * work such as ev/thread that would otherwise pin a pool worker indefinitely. */
+static void janet_ev_threaded_call_dedicated(JanetThreadedSubroutine fp, JanetEVGenericMessage arguments, JanetThreadedCallback cb) {
+    JanetEVThreadInit *init = janet_ev_thread_init(fp, arguments, cb);
+    int err = janet_ev_start_thread(0, init);
+    if (err) {
+        janet_free(init);
+        janet_ev_thread_error(err);
+    }
+    janet_vm.threaded_pending++;
+    janet_ev_inc_refcount();
+}
+
+/* Callback for threads that do not keep the event loop running. */
+static void janet_ev_detached_threaded_callback(JanetEVGenericMessage return_value) {
+    (void) return_value;
+}
+
 /* Default callback for janet_ev_threaded_await. */
 void janet_ev_default_threaded_callback(JanetEVGenericMessage return_value) {
     janet_ev_dec_refcount();
@@ -2183,6 +3442,9 @@ JanetAsyncStatus ev_machine_read(JanetListenerState *s, JanetAsyncEvent event) {
         case JANET_ASYNC_EVENT_MARK:
             janet_mark(janet_wrap_buffer(state->buf));
             break;
+        case JANET_ASYNC_EVENT_DEINIT:
+            janet_buffer_unborrow(state->buf);
+            break;
         case JANET_ASYNC_EVENT_CLOSE:
             janet_schedule(s->fiber, janet_wrap_nil());
             return JANET_ASYNC_STATUS_DONE;
@@ -2337,11 +3599,21 @@ JanetAsyncStatus ev_machine_read(JanetListenerState *s, JanetAsyncEvent event) {
     return JANET_ASYNC_STATUS_NOT_DONE;
 }
 
+#define JANET_FILEOP_READ 0
+#define JANET_FILEOP_WRITE 1
+static void janet_ev_fileop(JanetStream *stream, int op, int positional, int64_t offset,
+                            JanetBuffer *buf, const uint8_t *data, size_t len, int chunk);
+
 static void janet_ev_read_generic(JanetStream *stream, JanetBuffer *buf, int32_t nbytes, int is_chunked, JanetReadMode mode, int flags) {
+    if ((stream->flags & JANET_STREAM_FILE) && mode == JANET_ASYNC_READMODE_READ) {
+        janet_ev_fileop(stream, JANET_FILEOP_READ, 0, 0, buf, NULL, (size_t) nbytes, is_chunked);
+        return;
+    }
     StateRead *state = (StateRead *) janet_listen(stream, ev_machine_read,
                        JANET_ASYNC_LISTEN_READ, sizeof(StateRead), NULL);
     state->is_chunk = is_chunked;
     state->buf = buf;
+    janet_buffer_borrow(buf);
     state->bytes_left = nbytes;
     state->bytes_read = 0;
     state->mode = mode;
@@ -2381,59 +3653,375 @@ typedef enum {
     JANET_ASYNC_WRITEMODE_SENDTO
 } JanetWriteMode;
 
+typedef enum {
+    JANET_WRITE_SRC_STRING,
+    JANET_WRITE_SRC_BUFFER,
+    JANET_WRITE_SRC_PARTS
+} JanetWriteSource;
+
+/*
+ * Regular files. Epoll, kqueue and poll always report a regular file as ready,
+ * so reading or writing one on the event loop thread blocks every other fiber
+ * on a slow disk. These operations run on the worker pool instead, on a
+ * duplicate of the handle so that closing the stream while one is in flight
+ * is safe.
+ */
+
+/* Largest buffer allocated up front for one read, chunked reads grow past it */
+#define JANET_FILEOP_ALLOC_MAX (1 << 22)
+/* How many read sizes past a sequential read to ask the kernel to read ahead */
+#define JANET_FILEOP_READAHEAD 4
+
 typedef struct {
-    JanetListenerState head;
-    union {
-        JanetBuffer *buf;
-        const uint8_t *str;
-    } src;
-    int is_buffer;
-    JanetWriteMode mode;
-    void *dest_abst;
+    int op;
+    int positional; /* Use offset instead of the file position */
+    int chunk; /* Keep reading until want bytes or end of file */
+    int err;
+    JanetHandle handle;
+    int64_t offset;
+    size_t want;
+    size_t done;
+    size_t cap;
+    uint8_t *data;
+    JanetBuffer *buf;
+    uint32_t sched_id;
+} JanetFileOp;
+
+/* Runs on a worker thread */
+static JanetEVGenericMessage janet_fileop_subr(JanetEVGenericMessage args) {
+    JanetFileOp *fop = (JanetFileOp *) args.argp;
+    while (fop->done < fop->want) {
+        if (fop->done == fop->cap) {
+            size_t cap = fop->cap * 2;
+            if (cap < 4096) cap = 4096;
+            if (cap > fop->want) cap = fop->want;
+            uint8_t *data = janet_realloc(fop->data, cap);
+            if (NULL == data) {
 #ifdef JANET_WINDOWS
-    OVERLAPPED overlapped;
-#ifdef JANET_NET
-    WSABUF wbuf;
-    DWORD flags;
-#endif
+                fop->err = ERROR_NOT_ENOUGH_MEMORY;
 #else
-    int flags;
-    int32_t start;
+                fop->err = ENOMEM;
 #endif
-} StateWrite;
-
-JanetAsyncStatus ev_machine_write(JanetListenerState *s, JanetAsyncEvent event) {
-    StateWrite *state = (StateWrite *) s;
-    switch (event) {
-        default:
-            break;
-        case JANET_ASYNC_EVENT_MARK:
-            janet_mark(state->is_buffer
-                       ? janet_wrap_buffer(state->src.buf)
-                       : janet_wrap_string(state->src.str));
-            if (state->mode == JANET_ASYNC_WRITEMODE_SENDTO) {
-                janet_mark(janet_wrap_abstract(state->dest_abst));
+                break;
             }
-            break;
-        case JANET_ASYNC_EVENT_CLOSE:
-            janet_cancel(s->fiber, janet_cstringv("stream closed"));
-            return JANET_ASYNC_STATUS_DONE;
+            fop->data = data;
+            fop->cap = cap;
+        }
+        uint8_t *p = fop->data + fop->done;
+        size_t left = fop->cap - fop->done;
 #ifdef JANET_WINDOWS
-        case JANET_ASYNC_EVENT_COMPLETE: {
-            /* Called when write finished */
-            if (s->bytes == 0 && (state->mode != JANET_ASYNC_WRITEMODE_SENDTO)) {
-                janet_cancel(s->fiber, janet_cstringv("disconnect"));
-                return JANET_ASYNC_STATUS_DONE;
-            }
-
-            janet_schedule(s->fiber, janet_wrap_nil());
-            return JANET_ASYNC_STATUS_DONE;
+        /* Setting the low bit of the event keeps the completion off the event loop's port */
+        HANDLE event = CreateEvent(NULL, TRUE, FALSE, NULL);
+        OVERLAPPED ov;
+        memset(&ov, 0, sizeof(ov));
+        uint64_t pos = (uint64_t)(fop->offset + fop->done);
+        ov.Offset = (DWORD)(pos & 0xFFFFFFFF);
+        ov.OffsetHigh = (DWORD)(pos >> 32);
+        ov.hEvent = (HANDLE)((uintptr_t) event | 1);
+        DWORD len = left > 0x40000000 ? 0x40000000 : (DWORD) left;
+        DWORD n = 0;
+        BOOL ok = fop->op == JANET_FILEOP_READ
+                  ? ReadFile(fop->handle, p, len, NULL, &ov)
+                  : WriteFile(fop->handle, p, len, NULL, &ov);
+        if (ok || GetLastError() == ERROR_IO_PENDING) {
+            ok = GetOverlappedResult(fop->handle, &ov, &n, TRUE);
         }
-        break;
+        DWORD code = ok ? 0 : GetLastError();
+        CloseHandle(event);
+        if (!ok) {
+            if (code != ERROR_HANDLE_EOF) fop->err = (int) code;
+            break;
+        }
+#else
+        ssize_t n;
+        if (fop->op == JANET_FILEOP_READ) {
+            n = fop->positional
+                ? pread(fop->handle, p, left, (off_t)(fop->offset + fop->done))
+                : read(fop->handle, p, left);
+        } else {
+            n = fop->positional
+                ? pwrite(fop->handle, p, left, (off_t)(fop->offset + fop->done))
+                : write(fop->handle, p, left);
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fop->err = errno;
+            break;
+        }
+#endif
+        if (n == 0) break; /* End of file */
+        fop->done += (size_t) n;
+        if (fop->op == JANET_FILEOP_READ && !fop->chunk) break;
+    }
+#ifdef POSIX_FADV_WILLNEED
+    /* A read that filled its buffer is likely to be followed by the next one */
+    if (fop->op == JANET_FILEOP_READ && !fop->err && fop->done && fop->done == fop->want) {
+        off_t next = fop->positional ? (off_t)(fop->offset + fop->done) : lseek(fop->handle, 0, SEEK_CUR);
+        if (next >= 0) {
+            posix_fadvise(fop->handle, next, (off_t)(fop->done * JANET_FILEOP_READAHEAD), POSIX_FADV_WILLNEED);
+        }
+    }
+#endif
+#ifdef JANET_WINDOWS
+    CloseHandle(fop->handle);
+#else
+    close(fop->handle);
+#endif
+    return args;
+}
+
+static void janet_fileop_callback(JanetEVGenericMessage msg) {
+    janet_ev_dec_refcount();
+    JanetFileOp *fop = (JanetFileOp *) msg.argp;
+    JanetFiber *fiber = msg.fiber;
+    janet_gcunroot(janet_wrap_fiber(fiber));
+    if (NULL != fop->buf) {
+        janet_gcunroot(janet_wrap_buffer(fop->buf));
+        janet_buffer_unborrow(fop->buf);
+    }
+    /* Skip the result if the fiber was canceled or timed out in the meantime */
+    if (fiber->sched_id == fop->sched_id) {
+        if (fop->err) {
+#ifdef JANET_WINDOWS
+            SetLastError((DWORD) fop->err);
+#else
+            errno = fop->err;
+#endif
+            janet_cancel(fiber, janet_ev_lasterr());
+        } else if (fop->op == JANET_FILEOP_WRITE) {
+            janet_schedule(fiber, janet_wrap_nil());
+        } else if (fop->done == 0 && fop->want > 0) {
+            janet_schedule(fiber, janet_wrap_nil());
+        } else {
+            janet_buffer_push_bytes(fop->buf, fop->data, (int32_t) fop->done);
+            janet_schedule(fiber, janet_wrap_buffer(fop->buf));
+        }
+    }
+    janet_free(fop->data);
+    janet_free(fop);
+}
+
+/* Start a read or write of a regular file on the worker pool. For writes, data is
+ * copied, for reads the result is appended to buf. The caller then awaits. */
+static void janet_ev_fileop(JanetStream *stream, int op, int positional, int64_t offset,
+                            JanetBuffer *buf, const uint8_t *data, size_t len, int chunk) {
+    if (stream->flags & JANET_STREAM_CLOSED) {
+        janet_panic("stream is closed");
+    }
+    if (janet_vm.root_fiber->waiting != NULL) {
+        janet_panic("current fiber is already waiting for event");
+    }
+    JanetFileOp *fop = janet_calloc(1, sizeof(JanetFileOp));
+    if (NULL == fop) {
+        JANET_OUT_OF_MEMORY;
+    }
+    fop->op = op;
+    fop->positional = positional;
+    fop->chunk = chunk;
+    fop->offset = offset;
+    fop->want = len;
+    if (op == JANET_FILEOP_WRITE) {
+        fop->cap = len;
+        fop->data = janet_malloc(len ? len : 1);
+        if (NULL == fop->data) {
+            janet_free(fop);
+            JANET_OUT_OF_MEMORY;
+        }
+        if (len) memcpy(fop->data, data, len);
+    } else {
+        fop->buf = buf;
+        if (len) {
+            fop->cap = len > JANET_FILEOP_ALLOC_MAX ? JANET_FILEOP_ALLOC_MAX : len;
+            fop->data = janet_malloc(fop->cap);
+            if (NULL == fop->data) {
+                janet_free(fop);
+                JANET_OUT_OF_MEMORY;
+            }
+        }
+    }
+#ifdef JANET_WINDOWS
+    HANDLE self = GetCurrentProcess();
+    if (!DuplicateHandle(self, stream->handle, self, &fop->handle, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+        janet_free(fop->data);
+        janet_free(fop);
+        janet_panicv(janet_ev_lasterr());
+    }
+#else
+#ifdef F_DUPFD_CLOEXEC
+    fop->handle = fcntl(stream->handle, F_DUPFD_CLOEXEC, 0);
+#else
+    fop->handle = dup(stream->handle);
+#endif
+    if (fop->handle < 0) {
+        Janet err = janet_ev_lasterr();
+        janet_free(fop->data);
+        janet_free(fop);
+        janet_panicv(err);
+    }
+#endif
+    JanetEVGenericMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.argp = fop;
+    msg.fiber = janet_vm.root_fiber;
+    fop->sched_id = msg.fiber->sched_id;
+    janet_gcroot(janet_wrap_fiber(msg.fiber));
+    if (NULL != buf) {
+        janet_gcroot(janet_wrap_buffer(buf));
+        janet_buffer_borrow(buf);
+    }
+    janet_ev_threaded_call(janet_fileop_subr, msg, janet_fileop_callback);
+}
+
+/* Flatten the data of a write into one contiguous copy for a file write */
+static void janet_ev_file_write(JanetStream *stream, void *buf, int is_buffer) {
+    if (is_buffer == JANET_WRITE_SRC_PARTS) {
+        JanetArray *parts = (JanetArray *) buf;
+        JanetBuffer *flat = janet_buffer(0);
+        for (int32_t i = 0; i < parts->count; i++) {
+            JanetByteView view = janet_getbytes(parts->data, i);
+            janet_buffer_push_bytes(flat, view.bytes, view.len);
+        }
+        janet_ev_fileop(stream, JANET_FILEOP_WRITE, 0, 0, NULL, flat->data, (size_t) flat->count, 0);
+    } else if (is_buffer) {
+        JanetBuffer *b = (JanetBuffer *) buf;
+        janet_ev_fileop(stream, JANET_FILEOP_WRITE, 0, 0, NULL, b->data, (size_t) b->count, 0);
+    } else {
+        JanetString str = (JanetString) buf;
+        janet_ev_fileop(stream, JANET_FILEOP_WRITE, 0, 0, NULL, str, (size_t) janet_string_length(str), 0);
+    }
+}
+
+/* Most parts passed to a single writev or sendmsg call */
+#define JANET_WRITEV_MAX 64
+
+typedef struct {
+    JanetListenerState head;
+    union {
+        JanetBuffer *buf;
+        const uint8_t *str;
+        JanetArray *parts;
+    } src;
+    int is_buffer; /* A JanetWriteSource */
+    JanetWriteMode mode;
+    void *dest_abst;
+    /* Fibers and sched_ids of writes that were coalesced into this one */
+    JanetArray *waiters;
+#ifdef JANET_WINDOWS
+    OVERLAPPED overlapped;
+#ifdef JANET_NET
+    WSABUF wbuf;
+    DWORD flags;
+#endif
+#else
+    int flags;
+    int32_t start;
+    int32_t part; /* Index of the first unwritten part */
+#endif
+} StateWrite;
+
+/* Copy the strings and buffers of an indexed value into a new array of parts. */
+static JanetArray *janet_write_parts(Janet x) {
+    const Janet *data;
+    int32_t len;
+    if (!janet_indexed_view(x, &data, &len)) {
+        janet_panicf("expected array or tuple of bytes, got %v", x);
+    }
+    JanetArray *parts = janet_array(len);
+    for (int32_t i = 0; i < len; i++) {
+        const uint8_t *bytes;
+        int32_t blen;
+        if (!janet_bytes_view(data[i], &bytes, &blen)) {
+            janet_panicf("expected bytes in write, got %v", data[i]);
+        }
+        if (blen > 0) janet_array_push(parts, data[i]);
+    }
+    return parts;
+}
+
+/* Borrow or give back the buffers a pending write reads from */
+static void janet_write_borrow(StateWrite *state, int borrow) {
+    if (state->is_buffer == JANET_WRITE_SRC_PARTS) {
+        janet_buffer_borrow_values(state->src.parts->data, state->src.parts->count, borrow);
+    } else if (state->is_buffer) {
+        Janet x = janet_wrap_buffer(state->src.buf);
+        janet_buffer_borrow_values(&x, 1, borrow);
+    }
+}
+
+static void janet_write_done(StateWrite *state, int is_error, Janet value) {
+    if (is_error) {
+        janet_cancel(state->head.fiber, value);
+    } else {
+        janet_schedule(state->head.fiber, value);
+    }
+    if (NULL == state->waiters) return;
+    for (int32_t i = 0; i + 1 < state->waiters->count; i += 2) {
+        JanetFiber *fiber = janet_unwrap_fiber(state->waiters->data[i]);
+        uint32_t sched_id = (uint32_t) janet_unwrap_number(state->waiters->data[i + 1]);
+        /* Skip writers that were already resumed by a timeout */
+        if (fiber->sched_id != sched_id) continue;
+        if (is_error) {
+            janet_cancel(fiber, value);
+        } else {
+            janet_schedule(fiber, value);
+        }
+    }
+}
+
+JanetAsyncStatus ev_machine_write(JanetListenerState *s, JanetAsyncEvent event) {
+    StateWrite *state = (StateWrite *) s;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            if (state->is_buffer == JANET_WRITE_SRC_PARTS) {
+                janet_mark(janet_wrap_array(state->src.parts));
+            } else {
+                janet_mark(state->is_buffer
+                           ? janet_wrap_buffer(state->src.buf)
+                           : janet_wrap_string(state->src.str));
+            }
+            if (NULL != state->waiters) {
+                janet_mark(janet_wrap_array(state->waiters));
+            }
+            if (state->mode == JANET_ASYNC_WRITEMODE_SENDTO) {
+                janet_mark(janet_wrap_abstract(state->dest_abst));
+            }
+            break;
+        case JANET_ASYNC_EVENT_DEINIT:
+            janet_write_borrow(state, 0);
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            janet_write_done(state, 1, janet_cstringv("stream closed"));
+            return JANET_ASYNC_STATUS_DONE;
+#ifdef JANET_WINDOWS
+        case JANET_ASYNC_EVENT_COMPLETE: {
+            /* Called when write finished */
+            if (s->bytes == 0 && (state->mode != JANET_ASYNC_WRITEMODE_SENDTO)) {
+                janet_write_done(state, 1, janet_cstringv("disconnect"));
+                return JANET_ASYNC_STATUS_DONE;
+            }
+
+            janet_write_done(state, 0, janet_wrap_nil());
+            return JANET_ASYNC_STATUS_DONE;
+        }
+        break;
         case JANET_ASYNC_EVENT_USER: {
             /* Begin write */
             int32_t len;
             const uint8_t *bytes;
+            if (state->is_buffer == JANET_WRITE_SRC_PARTS) {
+                /* Overlapped file writes can not be vectored, so join the parts. */
+                JanetBuffer *joined = janet_buffer(0);
+                for (int32_t i = 0; i < state->src.parts->count; i++) {
+                    JanetByteView view = janet_getbytes(state->src.parts->data, i);
+                    janet_buffer_push_bytes(joined, view.bytes, view.len);
+                }
+                janet_write_borrow(state, 0);
+                state->is_buffer = JANET_WRITE_SRC_BUFFER;
+                state->src.buf = joined;
+                janet_write_borrow(state, 1);
+            }
             if (state->is_buffer) {
                 /* If buffer, convert to string. */
                 /* TODO - be more efficient about this */
@@ -2441,6 +4029,7 @@ JanetAsyncStatus ev_machine_write(JanetListenerState *s, JanetAsyncEvent event)
                 JanetString str = janet_string(buffer->data, buffer->count);
                 bytes = str;
                 len = buffer->count;
+                janet_write_borrow(state, 0);
                 state->is_buffer = 0;
                 state->src.str = str;
             } else {
@@ -2497,6 +4086,67 @@ JanetAsyncStatus ev_machine_write(JanetListenerState *s, JanetAsyncEvent event)
             int32_t start, len;
             const uint8_t *bytes;
             start = state->start;
+            if (state->is_buffer == JANET_WRITE_SRC_PARTS) {
+                /* Gather the unwritten parts for one vectored write */
+                struct iovec iov[JANET_WRITEV_MAX];
+                JanetArray *parts = state->src.parts;
+                int iovcnt = 0;
+                int32_t offset = start;
+                for (int32_t i = state->part; i < parts->count && iovcnt < JANET_WRITEV_MAX; i++) {
+                    JanetByteView view = janet_getbytes(parts->data, i);
+                    if (view.len > offset) {
+                        iov[iovcnt].iov_base = (void *)(view.bytes + offset);
+                        iov[iovcnt].iov_len = (size_t)(view.len - offset);
+                        iovcnt++;
+                    }
+                    offset = 0;
+                }
+                if (iovcnt == 0) {
+                    janet_write_done(state, 0, janet_wrap_nil());
+                    return JANET_ASYNC_STATUS_DONE;
+                }
+                ssize_t nwrote;
+                do {
+#ifdef JANET_NET
+                    if (state->mode == JANET_ASYNC_WRITEMODE_SEND) {
+                        struct msghdr msg;
+                        memset(&msg, 0, sizeof(msg));
+                        msg.msg_iov = iov;
+                        msg.msg_iovlen = iovcnt;
+                        nwrote = sendmsg(s->stream->handle, &msg, state->flags);
+                    } else
+#endif
+                    {
+                        nwrote = writev(s->stream->handle, iov, iovcnt);
+                    }
+                } while (nwrote == -1 && errno == EINTR);
+                if (nwrote == -1) {
+                    if (errno == EAGAIN || errno  == EWOULDBLOCK) break;
+                    janet_write_done(state, 1, janet_ev_lasterr());
+                    return JANET_ASYNC_STATUS_DONE;
+                }
+                if (nwrote == 0) {
+                    janet_write_done(state, 1, janet_cstringv("disconnect"));
+                    return JANET_ASYNC_STATUS_DONE;
+                }
+                /* Advance past the written bytes */
+                while (nwrote > 0 && state->part < parts->count) {
+                    int32_t left = janet_getbytes(parts->data, state->part).len - start;
+                    if (nwrote < left) {
+                        start += (int32_t) nwrote;
+                        break;
+                    }
+                    nwrote -= left;
+                    start = 0;
+                    state->part++;
+                }
+                state->start = start;
+                if (state->part >= parts->count) {
+                    janet_write_done(state, 0, janet_wrap_nil());
+                    return JANET_ASYNC_STATUS_DONE;
+                }
+                break;
+            }
             if (state->is_buffer) {
                 JanetBuffer *buffer = state->src.buf;
                 bytes = buffer->data;
@@ -2526,13 +4176,13 @@ JanetAsyncStatus ev_machine_write(JanetListenerState *s, JanetAsyncEvent event)
                 /* Handle write errors */
                 if (nwrote == -1) {
                     if (errno == EAGAIN || errno  == EWOULDBLOCK) break;
-                    janet_cancel(s->fiber, janet_ev_lasterr());
+                    janet_write_done(state, 1, janet_ev_lasterr());
                     return JANET_ASYNC_STATUS_DONE;
                 }
 
                 /* Unless using datagrams, empty message is a disconnect */
                 if (nwrote == 0 && !dest_abst) {
-                    janet_cancel(s->fiber, janet_cstringv("disconnect"));
+                    janet_write_done(state, 1, janet_cstringv("disconnect"));
                     return JANET_ASYNC_STATUS_DONE;
                 }
 
@@ -2544,7 +4194,7 @@ JanetAsyncStatus ev_machine_write(JanetListenerState *s, JanetAsyncEvent event)
             }
             state->start = start;
             if (start >= len) {
-                janet_schedule(s->fiber, janet_wrap_nil());
+                janet_write_done(state, 0, janet_wrap_nil());
                 return JANET_ASYNC_STATUS_DONE;
             }
             break;
@@ -2555,18 +4205,75 @@ JanetAsyncStatus ev_machine_write(JanetListenerState *s, JanetAsyncEvent event)
     return JANET_ASYNC_STATUS_NOT_DONE;
 }
 
+#ifndef JANET_WINDOWS
+/* On a coalescing stream, find a write that has not sent anything yet and that the
+ * current write can be added to. */
+static StateWrite *janet_ev_pending_write(JanetStream *stream, JanetWriteMode mode, int flags) {
+    if (!(stream->flags & JANET_STREAM_COALESCE) || mode == JANET_ASYNC_WRITEMODE_SENDTO) return NULL;
+    for (JanetListenerState *s = stream->state; NULL != s; s = s->_next) {
+        if (s->machine != ev_machine_write) continue;
+        StateWrite *state = (StateWrite *) s;
+        if (state->mode == mode && state->flags == flags && state->start == 0 && state->part == 0) {
+            return state;
+        }
+    }
+    return NULL;
+}
+#endif
+
 static void janet_ev_write_generic(JanetStream *stream, void *buf, void *dest_abst, JanetWriteMode mode, int is_buffer, int flags) {
+    if ((stream->flags & JANET_STREAM_FILE) && mode == JANET_ASYNC_WRITEMODE_WRITE) {
+        janet_ev_file_write(stream, buf, is_buffer);
+        return;
+    }
+#ifndef JANET_WINDOWS
+    StateWrite *pending = janet_ev_pending_write(stream, mode, flags);
+    if (NULL != pending) {
+        /* Join the pending write, so both go out in a single syscall */
+        if (janet_vm.root_fiber->waiting != NULL) {
+            janet_panic("current fiber is already waiting for event");
+        }
+        if (pending->is_buffer != JANET_WRITE_SRC_PARTS) {
+            Janet first = pending->is_buffer
+                          ? janet_wrap_buffer(pending->src.buf)
+                          : janet_wrap_string(pending->src.str);
+            pending->src.parts = janet_array(4);
+            janet_array_push(pending->src.parts, first);
+            pending->is_buffer = JANET_WRITE_SRC_PARTS;
+        }
+        int32_t first_new = pending->src.parts->count;
+        if (is_buffer == JANET_WRITE_SRC_PARTS) {
+            JanetArray *parts = buf;
+            for (int32_t i = 0; i < parts->count; i++) {
+                janet_array_push(pending->src.parts, parts->data[i]);
+            }
+        } else {
+            janet_array_push(pending->src.parts, is_buffer
+                             ? janet_wrap_buffer((JanetBuffer *) buf)
+                             : janet_wrap_string((const uint8_t *) buf));
+        }
+        janet_buffer_borrow_values(pending->src.parts->data + first_new,
+                                   pending->src.parts->count - first_new, 1);
+        if (NULL == pending->waiters) pending->waiters = janet_array(2);
+        janet_array_push(pending->waiters, janet_wrap_fiber(janet_vm.root_fiber));
+        janet_array_push(pending->waiters, janet_wrap_number((double) janet_vm.root_fiber->sched_id));
+        return;
+    }
+#endif
     StateWrite *state = (StateWrite *) janet_listen(stream, ev_machine_write,
                         JANET_ASYNC_LISTEN_WRITE, sizeof(StateWrite), NULL);
     state->is_buffer = is_buffer;
     state->src.buf = buf;
+    janet_write_borrow(state, 1);
     state->dest_abst = dest_abst;
     state->mode = mode;
+    state->waiters = NULL;
 #ifdef JANET_WINDOWS
     state->flags = (DWORD) flags;
     ev_machine_write((JanetListenerState *) state, JANET_ASYNC_EVENT_USER);
 #else
     state->start = 0;
+    state->part = 0;
     state->flags = flags;
 #endif
 }
@@ -2580,6 +4287,10 @@ void janet_ev_write_string(JanetStream *stream, JanetString str) {
     janet_ev_write_generic(stream, (void *) str, NULL, JANET_ASYNC_WRITEMODE_WRITE, 0, 0);
 }
 
+void janet_ev_write_parts(JanetStream *stream, Janet parts) {
+    janet_ev_write_generic(stream, janet_write_parts(parts), NULL, JANET_ASYNC_WRITEMODE_WRITE, JANET_WRITE_SRC_PARTS, 0);
+}
+
 #ifdef JANET_NET
 void janet_ev_send_buffer(JanetStream *stream, JanetBuffer *buf, int flags) {
     janet_ev_write_generic(stream, buf, NULL, JANET_ASYNC_WRITEMODE_SEND, 1, flags);
@@ -2589,6 +4300,10 @@ void janet_ev_send_string(JanetStream *stream, JanetString str, int flags) {
     janet_ev_write_generic(stream, (void *) str, NULL, JANET_ASYNC_WRITEMODE_SEND, 0, flags);
 }
 
+void janet_ev_send_parts(JanetStream *stream, Janet parts, int flags) {
+    janet_ev_write_generic(stream, janet_write_parts(parts), NULL, JANET_ASYNC_WRITEMODE_SEND, JANET_WRITE_SRC_PARTS, flags);
+}
+
 void janet_ev_sendto_buffer(JanetStream *stream, JanetBuffer *buf, void *dest, int flags) {
     janet_ev_write_generic(stream, buf, dest, JANET_ASYNC_WRITEMODE_SENDTO, 1, flags);
 }
@@ -2598,6 +4313,265 @@ void janet_ev_sendto_string(JanetStream *stream, JanetString str, void *dest, in
 }
 #endif
 
+/* Buffered reader over a stream. Data that has been read but not yet consumed is
+ * kept in one buffer, so delimiter searches never rescan bytes and each result is
+ * a single copy out of that buffer. */
+
+typedef struct {
+    JanetStream *stream;
+    JanetBuffer *buf;
+    int32_t start; /* Offset of the first unconsumed byte in buf */
+    int32_t chunk; /* Preferred size of each read */
+    int eof;
+#ifdef JANET_WINDOWS
+    int64_t offset; /* Bytes read from the handle so far, for seekable files */
+#endif
+} JanetStreamReader;
+
+static int janet_reader_mark(void *p, size_t s) {
+    (void) s;
+    JanetStreamReader *reader = (JanetStreamReader *) p;
+    janet_mark(janet_wrap_abstract(reader->stream));
+    janet_mark(janet_wrap_buffer(reader->buf));
+    return 0;
+}
+
+static int janet_reader_get(void *p, Janet key, Janet *out);
+static Janet janet_reader_next(void *p, Janet key);
+
+static const JanetAbstractType janet_stream_reader_type = {
+    "core/stream-reader",
+    NULL,
+    janet_reader_mark,
+    janet_reader_get,
+    NULL, /* put */
+    NULL, /* marshal */
+    NULL, /* unmarshal */
+    NULL, /* tostring */
+    NULL, /* compare */
+    NULL, /* hash */
+    janet_reader_next,
+    JANET_ATEND_NEXT
+};
+
+/* Find how many buffered bytes satisfy a request. With a delimiter, that is
+ * everything up to and including the first match, otherwise it is want bytes.
+ * Returns -1 if more data is needed, and advances *scanned past the bytes that
+ * can not start a match. */
+static int32_t janet_reader_scan(JanetStreamReader *reader, const uint8_t *delim, int32_t dlen,
+                                 int32_t want, int32_t *scanned) {
+    int32_t avail = reader->buf->count - reader->start;
+    if (dlen == 0) return avail >= want ? want : -1;
+    const uint8_t *base = reader->buf->data + reader->start;
+    const uint8_t *p = base + *scanned;
+    const uint8_t *end = base + avail;
+    while (end - p >= dlen) {
+        p = memchr(p, delim[0], (size_t)(end - p - dlen + 1));
+        if (NULL == p) break;
+        if (!memcmp(p, delim, (size_t) dlen)) return (int32_t)(p - base) + dlen;
+        p++;
+    }
+    *scanned = avail - dlen + 1 > 0 ? avail - dlen + 1 : 0;
+    return -1;
+}
+
+/* Move n buffered bytes into out */
+static void janet_reader_take(JanetStreamReader *reader, JanetBuffer *out, int32_t n) {
+    janet_buffer_push_bytes(out, reader->buf->data + reader->start, n);
+    reader->start += n;
+    if (reader->start == reader->buf->count) {
+        reader->start = 0;
+        reader->buf->count = 0;
+    }
+}
+
+/* Make room for the next read, sliding unconsumed bytes to the front of the
+ * buffer when more than half of it has already been consumed. */
+static int32_t janet_reader_reserve(JanetStreamReader *reader, int32_t want) {
+    JanetBuffer *buf = reader->buf;
+    if (reader->start && reader->start >= buf->capacity / 2) {
+        buf->count -= reader->start;
+        memmove(buf->data, buf->data + reader->start, buf->count);
+        reader->start = 0;
+    }
+    int32_t n = reader->chunk;
+    int32_t missing = want - (buf->count - reader->start);
+    if (missing > n) n = missing;
+    janet_buffer_extra(buf, n);
+    return n;
+}
+
+typedef struct {
+    JanetListenerState head;
+    JanetStreamReader *reader;
+    JanetBuffer *out;
+    Janet delim;
+    int32_t want;
+    int32_t scanned;
+#ifdef JANET_WINDOWS
+    OVERLAPPED overlapped;
+#endif
+} StateReaderFill;
+
+/* A read is either for want bytes, or up to a delimiter. A nil delimiter is a newline. */
+static void janet_reader_delim(Janet delim, int32_t want, const uint8_t **bytes, int32_t *len) {
+    if (want > 0) {
+        *bytes = NULL;
+        *len = 0;
+    } else if (janet_checktype(delim, JANET_NIL)) {
+        *bytes = (const uint8_t *) "\n";
+        *len = 1;
+    } else {
+        janet_bytes_view(delim, bytes, len);
+    }
+}
+
+/* Finish a read once the request is satisfied or the stream has ended. */
+static int janet_reader_try_finish(StateReaderFill *state, JanetFiber *fiber) {
+    JanetStreamReader *reader = state->reader;
+    const uint8_t *delim;
+    int32_t dlen;
+    janet_reader_delim(state->delim, state->want, &delim, &dlen);
+    int32_t n = janet_reader_scan(reader, delim, dlen, state->want, &state->scanned);
+    if (n < 0 && reader->eof) {
+        /* Hand out whatever is left at end of stream */
+        n = reader->buf->count - reader->start;
+        if (n == 0) {
+            janet_schedule(fiber, janet_wrap_nil());
+            return 1;
+        }
+    }
+    if (n < 0) return 0;
+    janet_reader_take(reader, state->out, n);
+    janet_schedule(fiber, janet_wrap_buffer(state->out));
+    return 1;
+}
+
+#ifdef JANET_WINDOWS
+
+static int janet_reader_start_fill(StateReaderFill *state) {
+    JanetStreamReader *reader = state->reader;
+    int32_t n = janet_reader_reserve(reader, state->want);
+    state->head.tag = &state->overlapped;
+    memset(&state->overlapped, 0, sizeof(OVERLAPPED));
+    state->overlapped.Offset = (DWORD)(reader->offset & 0xFFFFFFFF);
+    state->overlapped.OffsetHigh = (DWORD)(reader->offset >> 32);
+    JanetBuffer *buf = reader->buf;
+    if (!ReadFile(reader->stream->handle, buf->data + buf->count, n, NULL, &state->overlapped)) {
+        int code = GetLastError();
+        if (code == ERROR_BROKEN_PIPE) {
+            reader->eof = 1;
+            return 1;
+        }
+        if (code != ERROR_IO_PENDING) return -1;
+    }
+    return 0;
+}
+
+#endif
+
+JanetAsyncStatus ev_machine_reader_fill(JanetListenerState *s, JanetAsyncEvent event) {
+    StateReaderFill *state = (StateReaderFill *) s;
+    JanetStreamReader *reader = state->reader;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            janet_mark(janet_wrap_abstract(reader));
+            janet_mark(janet_wrap_buffer(state->out));
+            janet_mark(state->delim);
+            break;
+        case JANET_ASYNC_EVENT_DEINIT:
+            janet_buffer_unborrow(state->out);
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            janet_schedule(s->fiber, janet_wrap_nil());
+            return JANET_ASYNC_STATUS_DONE;
+#ifdef JANET_WINDOWS
+        case JANET_ASYNC_EVENT_COMPLETE:
+            if (s->bytes == 0) {
+                reader->eof = 1;
+            } else {
+                reader->buf->count += (int32_t) s->bytes;
+                reader->offset += s->bytes;
+            }
+            if (janet_reader_try_finish(state, s->fiber)) return JANET_ASYNC_STATUS_DONE;
+        /* fallthrough */
+        case JANET_ASYNC_EVENT_USER: {
+            int status = janet_reader_start_fill(state);
+            if (status < 0) {
+                janet_cancel(s->fiber, janet_ev_lasterr());
+                return JANET_ASYNC_STATUS_DONE;
+            }
+            if (status > 0) {
+                janet_reader_try_finish(state, s->fiber);
+                return JANET_ASYNC_STATUS_DONE;
+            }
+            break;
+        }
+#else
+        case JANET_ASYNC_EVENT_ERR:
+        case JANET_ASYNC_EVENT_HUP:
+        case JANET_ASYNC_EVENT_READ: {
+            int32_t n = janet_reader_reserve(reader, state->want);
+            JanetBuffer *buf = reader->buf;
+            ssize_t nread;
+            do {
+                nread = read(s->stream->handle, buf->data + buf->count, n);
+            } while (nread == -1 && errno == EINTR);
+            if (nread == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                if (errno != EPIPE && errno != ECONNRESET) {
+                    janet_cancel(s->fiber, janet_ev_lasterr());
+                    return JANET_ASYNC_STATUS_DONE;
+                }
+                nread = 0;
+            }
+            if (nread == 0) {
+                reader->eof = 1;
+            } else {
+                buf->count += (int32_t) nread;
+            }
+            if (janet_reader_try_finish(state, s->fiber)) return JANET_ASYNC_STATUS_DONE;
+            break;
+        }
+#endif
+    }
+    return JANET_ASYNC_STATUS_NOT_DONE;
+}
+
+/* Satisfy a read from the buffer if possible, otherwise wait on the stream.
+ * Reads with a delimiter pass want as 0. */
+static Janet janet_reader_read(JanetStreamReader *reader, JanetBuffer *out, Janet delim, int32_t want, double to) {
+    const uint8_t *dbytes;
+    int32_t dlen;
+    int32_t scanned = 0;
+    janet_reader_delim(delim, want, &dbytes, &dlen);
+    int32_t n = janet_reader_scan(reader, dbytes, dlen, want, &scanned);
+    if (n < 0 && reader->eof) {
+        n = reader->buf->count - reader->start;
+        if (n == 0) return janet_wrap_nil();
+    }
+    if (n >= 0) {
+        janet_reader_take(reader, out, n);
+        return janet_wrap_buffer(out);
+    }
+    janet_stream_flags(reader->stream, JANET_STREAM_READABLE);
+    if (to != INFINITY) janet_addtimeout(to);
+    StateReaderFill *state = (StateReaderFill *) janet_listen(reader->stream, ev_machine_reader_fill,
+                             JANET_ASYNC_LISTEN_READ, sizeof(StateReaderFill), NULL);
+    state->reader = reader;
+    state->out = out;
+    janet_buffer_borrow(out);
+    state->delim = delim;
+    state->want = want;
+    state->scanned = scanned;
+#ifdef JANET_WINDOWS
+    ev_machine_reader_fill((JanetListenerState *) state, JANET_ASYNC_EVENT_USER);
+#endif
+    janet_await();
+}
+
 /* For a pipe ID */
 #ifdef JANET_WINDOWS
 static volatile long PipeSerialNumber;
@@ -2677,14 +4651,61 @@ error:
 
 /* C functions */
 
+/* Get a fiber priority from a keyword */
+static int janet_getpriority(const Janet *argv, int32_t n) {
+    for (int i = 0; i < JANET_EV_PRIORITIES; i++) {
+        if (janet_keyeq(argv[n], janet_priority_names[i])) return i;
+    }
+    janet_panicf("expected :high, :normal or :low, got %v", argv[n]);
+}
+
+JANET_CORE_FN(cfun_ev_priority,
+              "(ev/priority &opt fiber priority)",
+              "Get or set the scheduling priority of a fiber, which defaults to the current fiber. "
+              "`priority` is one of `:high`, `:normal` and `:low`. Fibers waiting to be resumed by "
+              "the event loop run in priority order, but lower priorities still get a turn after every "
+              "few higher priority resumes so they can not be starved. The new priority applies the "
+              "next time the fiber is scheduled. Returns the priority of the fiber.") {
+    janet_arity(argc, 0, 2);
+    JanetFiber *fiber = janet_optfiber(argv, argc, 0, janet_vm.root_fiber);
+    if (NULL == fiber) fiber = janet_vm.fiber;
+    if (argc > 1) janet_fiber_set_priority(fiber, janet_getpriority(argv, 1));
+    return janet_ckeywordv(janet_priority_names[janet_fiber_priority(fiber)]);
+}
+
+JANET_CORE_FN(cfun_ev_time_slice,
+              "(ev/time-slice &opt quantum)",
+              "Turn on preemptive time slicing for the event loop of the current thread. A fiber that "
+              "runs for more than about `quantum` seconds without yielding is suspended at its next "
+              "function call or loop iteration, and put at the back of its run queue so that other "
+              "fibers can run. Fibers are not suspended while running inside a C function that calls "
+              "back into Janet. A quantum of nil or 0 turns time slicing off. Returns the previous "
+              "quantum, or nil if time slicing was off.") {
+    janet_arity(argc, 0, 1);
+    double quantum = janet_optnumber(argv, argc, 0, 0);
+    if (!(quantum >= 0)) janet_panicf("expected non-negative quantum, got %v", argv[0]);
+#ifdef JANET_NO_INTERPRETER_INTERRUPT
+    if (quantum > 0) janet_panic("time slicing needs interpreter interrupts");
+    return janet_wrap_nil();
+#else
+    JanetSlicer *slicer = janet_vm.slicer;
+    Janet old = slicer ? janet_wrap_number(slicer->quantum_us * 1e-6) : janet_wrap_nil();
+    janet_ev_slice_stop();
+    if (quantum > 0) janet_ev_slice_start(quantum);
+    return old;
+#endif
+}
+
 JANET_CORE_FN(cfun_ev_go,
-              "(ev/go fiber &opt value supervisor)",
+              "(ev/go fiber &opt value supervisor priority)",
               "Put a fiber on the event loop to be resumed later. Optionally pass "
               "a value to resume with, otherwise resumes with nil. Returns the fiber. "
               "An optional `core/channel` can be provided as a supervisor. When various "
               "events occur in the newly scheduled fiber, an event will be pushed to the supervisor. "
-              "If not provided, the new fiber will inherit the current supervisor.") {
-    janet_arity(argc, 1, 3);
+              "If not provided, the new fiber will inherit the current supervisor. "
+              "An optional `priority` of `:high`, `:normal` or `:low` sets the priority of the fiber, "
+              "as with ev/priority.") {
+    janet_arity(argc, 1, 4);
     Janet value = argc >= 2 ? argv[1] : janet_wrap_nil();
     void *supervisor = janet_optabstract(argv, argc, 2, &janet_channel_type, janet_vm.root_fiber->supervisor_channel);
     JanetFiber *fiber;
@@ -2711,10 +4732,130 @@ JANET_CORE_FN(cfun_ev_go,
         fiber = janet_getfiber(argv, 0);
     }
     fiber->supervisor_channel = supervisor;
+    if (argc > 3 && !janet_checktype(argv[3], JANET_NIL)) {
+        janet_fiber_set_priority(fiber, janet_getpriority(argv, 3));
+    }
     janet_schedule(fiber, value);
     return janet_wrap_fiber(fiber);
 }
 
+/* VM templates. A template is an environment marshalled once, that new VMs load
+ * instead of building the core environment and loading modules again. The image
+ * is shared read only by every VM loaded from it, and funcdef bodies are decoded
+ * from it lazily, so the template is kept alive by a reference from each VM. */
+
+typedef struct {
+    uint8_t *image;
+    size_t image_len;
+    JanetCFunRegistry *registry;
+    size_t registry_count;
+} JanetVMTemplate;
+
+static int janet_vm_template_gc(void *p, size_t size) {
+    (void) size;
+    JanetVMTemplate *tpl = (JanetVMTemplate *) p;
+    janet_free(tpl->image);
+    janet_free(tpl->registry);
+    return 0;
+}
+
+static const JanetAbstractType janet_vm_template_type = {
+    "core/vm-template",
+    janet_vm_template_gc,
+    JANET_ATEND_GC
+};
+
+void *janet_vm_template(JanetTable *env) {
+    if (NULL == env) env = janet_core_env(NULL);
+    size_t registry_count = janet_vm.registry_count;
+    JanetCFunRegistry *registry = janet_malloc(registry_count * sizeof(JanetCFunRegistry) + 1);
+    if (NULL == registry) {
+        JANET_OUT_OF_MEMORY;
+    }
+    if (registry_count) {
+        memcpy(registry, janet_vm.registry, registry_count * sizeof(JanetCFunRegistry));
+    }
+    /* Values from C, such as cfunctions and the standard files, are looked up by
+     * name when loading, like in the core image */
+    JanetTable *dict = janet_core_lookup_table(NULL);
+    JanetTable *rreg = janet_table(dict->count);
+    for (int32_t i = 0; i < dict->capacity; i++) {
+        const JanetKV *kv = dict->data + i;
+        if (janet_checktype(kv->key, JANET_NIL)) continue;
+        if (janet_checktypes(kv->value, JANET_TFLAG_TABLE | JANET_TFLAG_ARRAY | JANET_TFLAG_BUFFER)) continue;
+        janet_table_put(rreg, kv->value, kv->key);
+    }
+    JanetBuffer buffer;
+    janet_buffer_init(&buffer, 0);
+    Janet parts[2] = {
+        janet_wrap_table(janet_vm.abstract_registry),
+        janet_wrap_table(env)
+    };
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    if (!signal) {
+        janet_marshal(&buffer, janet_wrap_tuple(janet_tuple_n(parts, 2)), rreg,
+                      JANET_MARSHAL_UNSAFE | JANET_MARSHAL_LAZY);
+        janet_restore(&tstate);
+    } else {
+        janet_restore(&tstate);
+        janet_buffer_deinit(&buffer);
+        janet_free(registry);
+        janet_signalv(signal, tstate.payload);
+    }
+    JanetVMTemplate *tpl = janet_abstract_threaded(&janet_vm_template_type, sizeof(JanetVMTemplate));
+    tpl->image = buffer.data;
+    tpl->image_len = (size_t) buffer.count;
+    tpl->registry = registry;
+    tpl->registry_count = registry_count;
+    return tpl;
+}
+
+JanetTable *janet_vm_template_load(void *p) {
+    JanetVMTemplate *tpl = (JanetVMTemplate *) p;
+
+    /* Hold a reference for the lifetime of this VM */
+    Janet tplv = janet_wrap_abstract(tpl);
+    if (janet_checktype(janet_table_get(&janet_vm.threaded_abstracts, tplv), JANET_NIL)) {
+        janet_abstract_incref(tpl);
+        janet_table_put(&janet_vm.threaded_abstracts, tplv, janet_wrap_false());
+    }
+    janet_gcroot(tplv);
+
+    /* Building the lookup table registers the core cfunctions, so replace the
+     * registry afterwards */
+    JanetTable *dict = janet_core_lookup_table(NULL);
+    janet_free(janet_vm.registry);
+    janet_vm.registry = janet_malloc(tpl->registry_count * sizeof(JanetCFunRegistry) + 1);
+    if (NULL == janet_vm.registry) {
+        JANET_OUT_OF_MEMORY;
+    }
+    if (tpl->registry_count) {
+        memcpy(janet_vm.registry, tpl->registry, tpl->registry_count * sizeof(JanetCFunRegistry));
+    }
+    janet_vm.registry_count = tpl->registry_count;
+    janet_vm.registry_cap = tpl->registry_count;
+    janet_vm.registry_dirty = 1;
+
+    Janet out = janet_unmarshal(tpl->image, tpl->image_len,
+                                JANET_MARSHAL_UNSAFE | JANET_MARSHAL_LAZY,
+                                dict, NULL);
+    const Janet *parts = janet_unwrap_tuple(out);
+    janet_vm.abstract_registry = janet_unwrap_table(parts[0]);
+    janet_gcroot(parts[0]);
+    JanetTable *env = janet_unwrap_table(parts[1]);
+    janet_gcroot(parts[1]);
+
+    /* The root of the prototype chain is the core environment */
+    JanetTable *core = env;
+    while (NULL != core->proto) core = core->proto;
+    if (NULL == janet_vm.core_env) {
+        janet_vm.core_env = core;
+        janet_gcroot(janet_wrap_table(core));
+    }
+    return env;
+}
+
 /* For ev/thread - Run an interpreter in the new thread. */
 static JanetEVGenericMessage janet_go_thread_subr(JanetEVGenericMessage args) {
     JanetBuffer *buffer = (JanetBuffer *) args.argp;
@@ -2727,6 +4868,14 @@ static JanetEVGenericMessage janet_go_thread_subr(JanetEVGenericMessage args) {
     JanetSignal signal = janet_try(&tstate);
     if (!signal) {
 
+        /* Load the environment and registries from a template */
+        JanetTable *env = NULL;
+        if (flags & 0x20) {
+            Janet tplv = janet_unmarshal(nextbytes, endbytes - nextbytes,
+                                         JANET_MARSHAL_UNSAFE, NULL, &nextbytes);
+            env = janet_vm_template_load(janet_unwrap_abstract(tplv));
+        }
+
         /* Set abstract registry */
         if (!(flags & 0x2)) {
             Janet aregv = janet_unmarshal(nextbytes, endbytes - nextbytes,
@@ -2737,7 +4886,7 @@ static JanetEVGenericMessage janet_go_thread_subr(JanetEVGenericMessage args) {
         }
 
         /* Get supervsior */
-        if (flags & 0x8) {
+        if (flags & 0x10) {
             Janet sup =
                 janet_unmarshal(nextbytes, endbytes - nextbytes,
                                 JANET_MARSHAL_UNSAFE, NULL, &nextbytes);
@@ -2786,6 +4935,10 @@ static JanetEVGenericMessage janet_go_thread_subr(JanetEVGenericMessage args) {
                 JANET_FIBER_MASK_USER2 |
                 JANET_FIBER_MASK_USER3 |
                 JANET_FIBER_MASK_USER4;
+            if (NULL != env) {
+                fiber->env = janet_table(0);
+                fiber->env->proto = env;
+            }
         } else {
             fiber = janet_unwrap_fiber(fiberv);
         }
@@ -2825,7 +4978,7 @@ static JanetEVGenericMessage janet_go_thread_subr(JanetEVGenericMessage args) {
 }
 
 JANET_CORE_FN(cfun_ev_thread,
-              "(ev/thread main &opt value flags supervisor)",
+              "(ev/thread main &opt value flags supervisor template)",
               "Run `main` in a new operating system thread, optionally passing `value` "
               "to resume with. The parameter `main` can either be a fiber, or a function that accepts "
               "0 or 1 arguments. "
@@ -2834,16 +4987,23 @@ JANET_CORE_FN(cfun_ev_thread,
               "Otherwise, returns nil. Available flags:\n\n"
               "* `:n` - return immediately\n"
               "* `:a` - don't copy abstract registry to new thread (performance optimization)\n"
-              "* `:c` - don't copy cfunction registry to new thread (performance optimization)") {
-    janet_arity(argc, 1, 4);
+              "* `:c` - don't copy cfunction registry to new thread (performance optimization)\n"
+              "* `:d` - return immediately, and don't keep the current event loop running until the thread "
+              "completes. Useful for long lived worker threads.\n\n"
+              "If `template` is given, the new thread starts from a copy of the environment in the template, "
+              "made with `ev/thread-template`, and a function `main` runs with that environment.") {
+    janet_arity(argc, 1, 5);
     Janet value = argc >= 2 ? argv[1] : janet_wrap_nil();
     if (!janet_checktype(argv[0], JANET_FUNCTION)) janet_getfiber(argv, 0);
     uint64_t flags = 0;
-    if (argc >= 3) {
-        flags = janet_getflags(argv, 2, "nac");
+    if (argc >= 3 && !janet_checktype(argv[2], JANET_NIL)) {
+        flags = janet_getflags(argv, 2, "nacd");
     }
+    if (flags & 0x8) flags |= 0x1;
     void *supervisor = janet_optabstract(argv, argc, 3, &janet_channel_type, janet_vm.root_fiber->supervisor_channel);
-    if (NULL != supervisor) flags |= 0x8;
+    if (NULL != supervisor) flags |= 0x10;
+    void *tpl = janet_optabstract(argv, argc, 4, &janet_vm_template_type, NULL);
+    if (NULL != tpl) flags |= 0x2 | 0x4 | 0x20;
 
     /* Marshal arguments for the new thread. */
     JanetBuffer *buffer = janet_malloc(sizeof(JanetBuffer));
@@ -2851,10 +5011,13 @@ JANET_CORE_FN(cfun_ev_thread,
         JANET_OUT_OF_MEMORY;
     }
     janet_buffer_init(buffer, 0);
+    if (flags & 0x20) {
+        janet_marshal(buffer, janet_wrap_abstract(tpl), NULL, JANET_MARSHAL_UNSAFE);
+    }
     if (!(flags & 0x2)) {
         janet_marshal(buffer, janet_wrap_table(janet_vm.abstract_registry), NULL, JANET_MARSHAL_UNSAFE);
     }
-    if (flags & 0x8) {
+    if (flags & 0x10) {
         janet_marshal(buffer, janet_wrap_abstract(supervisor), NULL, JANET_MARSHAL_UNSAFE);
     }
     if (!(flags & 0x4)) {
@@ -2873,11 +5036,154 @@ JANET_CORE_FN(cfun_ev_thread,
         arguments.argi = argc;
         arguments.argp = buffer;
         arguments.fiber = NULL;
-        janet_ev_threaded_call(janet_go_thread_subr, arguments, janet_ev_default_threaded_callback);
+        if (flags & 0x8) {
+            janet_ev_threaded_call_dedicated(janet_go_thread_subr, arguments, janet_ev_detached_threaded_callback);
+            janet_ev_dec_refcount();
+        } else {
+            janet_ev_threaded_call_dedicated(janet_go_thread_subr, arguments, janet_ev_default_threaded_callback);
+        }
         return janet_wrap_nil();
     } else {
-        janet_ev_threaded_await(janet_go_thread_subr, (uint32_t) flags, argc, buffer);
+        JanetEVGenericMessage arguments;
+        memset(&arguments, 0, sizeof(arguments));
+        arguments.tag = (uint32_t) flags;
+        arguments.argi = argc;
+        arguments.argp = buffer;
+        arguments.fiber = janet_root_fiber();
+        janet_gcroot(janet_wrap_fiber(arguments.fiber));
+        janet_ev_threaded_call_dedicated(janet_go_thread_subr, arguments, janet_ev_default_threaded_callback);
+        janet_await();
+    }
+}
+
+JANET_CORE_FN(cfun_ev_thread_template,
+              "(ev/thread-template &opt env)",
+              "Marshal `env`, by default the current environment, into a template that `ev/thread` can "
+              "start threads from. A thread started from a template gets a copy of the environment, its "
+              "prototypes and the core environment, without building the core environment or loading "
+              "modules again. Every thread shares the template's marshalled image, and decodes a function "
+              "body from it only when the function is first called.") {
+    janet_arity(argc, 0, 1);
+    JanetTable *env = (argc > 0) ? janet_gettable(argv, 0) : janet_vm.fiber->env;
+    return janet_wrap_abstract(janet_vm_template(env));
+}
+
+JANET_CORE_FN(cfun_ev_thread_pool,
+              "(ev/thread-pool &opt max-workers)",
+              "Get statistics for the shared worker pool that runs blocking operations such as "
+              "`os/shell` and process waits. If `max-workers` is given, first set the maximum "
+              "number of worker threads; surplus workers exit once they finish their current job. "
+              "Returns a struct with the keys `:workers`, `:idle`, `:queued`, `:max-queued`, "
+              "`:max-workers`, `:submitted` and `:completed`.") {
+    janet_arity(argc, 0, 1);
+    int32_t max_workers = argc > 0 ? janet_getinteger(argv, 0) : 0;
+    if (argc > 0 && max_workers < 1) {
+        janet_panicf("expected positive integer for max-workers, got %v", argv[0]);
+    }
+    janet_pool_lock();
+    if (argc > 0) {
+        if (max_workers < janet_thread_pool.max_workers) janet_pool_broadcast();
+        janet_thread_pool.max_workers = max_workers;
+        /* Start workers for jobs that were waiting on the old limit */
+        int32_t started = 0;
+        while (janet_thread_pool.queued > janet_thread_pool.idle + started &&
+                janet_thread_pool.workers < max_workers &&
+                !janet_ev_start_thread(1, NULL)) {
+            janet_thread_pool.workers++;
+            started++;
+        }
+    }
+    int32_t workers = janet_thread_pool.workers;
+    int32_t idle = janet_thread_pool.idle;
+    int32_t queued = janet_thread_pool.queued;
+    int32_t max_queued = janet_thread_pool.max_queued;
+    max_workers = janet_thread_pool.max_workers;
+    uint64_t submitted = janet_thread_pool.submitted;
+    uint64_t completed = janet_thread_pool.completed;
+    janet_pool_unlock();
+    JanetKV *st = janet_struct_begin(7);
+    janet_struct_put(st, janet_ckeywordv("workers"), janet_wrap_integer(workers));
+    janet_struct_put(st, janet_ckeywordv("idle"), janet_wrap_integer(idle));
+    janet_struct_put(st, janet_ckeywordv("queued"), janet_wrap_integer(queued));
+    janet_struct_put(st, janet_ckeywordv("max-queued"), janet_wrap_integer(max_queued));
+    janet_struct_put(st, janet_ckeywordv("max-workers"), janet_wrap_integer(max_workers));
+    janet_struct_put(st, janet_ckeywordv("submitted"), janet_wrap_number((double) submitted));
+    janet_struct_put(st, janet_ckeywordv("completed"), janet_wrap_number((double) completed));
+    return janet_wrap_struct(janet_struct_end(st));
+}
+
+JANET_CORE_FN(cfun_ev_stats,
+              "(ev/stats &opt channel)",
+              "Get statistics for the event loop of the current thread. Returns a struct with the keys "
+              "`:iterations` for the number of loop iterations, `:resumes` for the number of fiber "
+              "resumes, `:run-time-max` for the longest time in seconds spent running fibers between "
+              "two polls, `:run-histogram`, `:spawn-queue` for the number of fibers waiting to be "
+              "resumed, `:timeouts` for the number of pending timeouts and deadlines, `:listeners` "
+              "for the number of pending IO operations, `:threaded-pending` for the number of threaded "
+              "calls that have not returned, and `:slow-resumes` and `:slow-threshold` for the resumes "
+              "reported to the hook set with ev/slow-resume-hook, and `:preemptions` for the number of "
+              "fibers suspended by ev/time-slice. Entry i of the `:run-histogram` tuple counts the "
+              "iterations that ran fibers for less than 2^i microseconds (and at least 2^(i-1) "
+              "microseconds), and the last entry counts all longer iterations. "
+              "If a channel is given, instead returns a struct with the keys `:count`, `:capacity`, "
+              "`:pending-readers`, `:pending-writers` and `:closed` for that channel.") {
+    janet_arity(argc, 0, 1);
+    if (argc > 0) {
+        JanetChannel *channel = janet_getchannel(argv, 0);
+        janet_chan_lock(channel);
+        int32_t count = janet_chan_count(channel);
+        int32_t readers = janet_q_count(&channel->read_pending);
+        int32_t writers = janet_q_count(&channel->write_pending);
+        int closed = channel->closed;
+        janet_chan_unlock(channel);
+        JanetKV *st = janet_struct_begin(5);
+        janet_struct_put(st, janet_ckeywordv("count"), janet_wrap_integer(count));
+        janet_struct_put(st, janet_ckeywordv("capacity"), janet_wrap_integer(channel->limit));
+        janet_struct_put(st, janet_ckeywordv("pending-readers"), janet_wrap_integer(readers));
+        janet_struct_put(st, janet_ckeywordv("pending-writers"), janet_wrap_integer(writers));
+        janet_struct_put(st, janet_ckeywordv("closed"), janet_wrap_boolean(closed));
+        return janet_wrap_struct(janet_struct_end(st));
+    }
+    JanetEVStats *stats = &janet_vm.ev_stats;
+    Janet hist[JANET_EV_RUN_BUCKETS];
+    for (int i = 0; i < JANET_EV_RUN_BUCKETS; i++) {
+        hist[i] = janet_wrap_number((double) stats->run_hist[i]);
+    }
+    JanetKV *st = janet_struct_begin(11);
+    janet_struct_put(st, janet_ckeywordv("iterations"), janet_wrap_number((double) stats->iterations));
+    janet_struct_put(st, janet_ckeywordv("resumes"), janet_wrap_number((double) stats->resumes));
+    janet_struct_put(st, janet_ckeywordv("run-time-max"), janet_wrap_number(stats->run_time_max));
+    janet_struct_put(st, janet_ckeywordv("run-histogram"), janet_wrap_tuple(janet_tuple_n(hist, JANET_EV_RUN_BUCKETS)));
+    janet_struct_put(st, janet_ckeywordv("spawn-queue"), janet_wrap_integer(janet_ev_spawn_count()));
+    janet_struct_put(st, janet_ckeywordv("timeouts"), janet_wrap_number((double) janet_vm.tq_count));
+    janet_struct_put(st, janet_ckeywordv("listeners"), janet_wrap_number((double) janet_vm.listener_count));
+    janet_struct_put(st, janet_ckeywordv("threaded-pending"), janet_wrap_number((double) janet_vm.threaded_pending));
+    janet_struct_put(st, janet_ckeywordv("slow-resumes"), janet_wrap_number((double) stats->slow_resumes));
+    janet_struct_put(st, janet_ckeywordv("preemptions"), janet_wrap_number((double) stats->preemptions));
+    janet_struct_put(st, janet_ckeywordv("slow-threshold"), janet_wrap_number(janet_vm.ev_slow_threshold));
+    return janet_wrap_struct(janet_struct_end(st));
+}
+
+JANET_CORE_FN(cfun_ev_slow_resume_hook,
+              "(ev/slow-resume-hook threshold &opt hook)",
+              "Call `hook` as `(hook fiber seconds)` whenever a single resume of a fiber by the event "
+              "loop takes at least `threshold` seconds, which usually means the fiber is doing blocking "
+              "work on the event loop. Errors raised by the hook are printed and otherwise ignored. "
+              "If `hook` is nil, stops reporting slow resumes. Resumes are only timed while a hook is "
+              "set. Returns the previous hook.") {
+    janet_arity(argc, 1, 2);
+    double threshold = janet_getnumber(argv, 0);
+    if (!(threshold >= 0)) janet_panicf("expected non-negative threshold, got %v", argv[0]);
+    Janet hook = janet_wrap_nil();
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
+        hook = janet_wrap_function(janet_getfunction(argv, 1));
     }
+    Janet old = janet_vm.ev_slow_hook;
+    if (!janet_checktype(old, JANET_NIL)) janet_gcunroot(old);
+    if (!janet_checktype(hook, JANET_NIL)) janet_gcroot(hook);
+    janet_vm.ev_slow_hook = hook;
+    janet_vm.ev_slow_threshold = threshold;
+    return old;
 }
 
 JANET_CORE_FN(cfun_ev_give_supervisor,
@@ -2993,18 +5299,63 @@ JANET_CORE_FN(janet_cfun_stream_chunk,
     janet_await();
 }
 
+JANET_CORE_FN(janet_cfun_stream_pread,
+              "(ev/pread stream n offset &opt buffer timeout)",
+              "Read up to n bytes from a file stream starting at byte `offset`, without moving the file "
+              "position. The read runs on a worker thread, so a slow disk does not hold up the event loop. "
+              "Reads of regular files opened with os/open through ev/read, ev/chunk and ev/write also run "
+              "on worker threads. Returns the buffer, or nil if `offset` is at or past the end of the file.") {
+    janet_arity(argc, 3, 5);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    janet_stream_flags(stream, JANET_STREAM_READABLE);
+    int32_t n = janet_getnat(argv, 1);
+    int64_t offset = janet_getinteger64(argv, 2);
+    if (offset < 0) janet_panicf("expected non-negative offset, got %v", argv[2]);
+    JanetBuffer *buffer = janet_optbuffer(argv, argc, 3, 10);
+    double to = janet_optnumber(argv, argc, 4, INFINITY);
+    if (to != INFINITY) janet_addtimeout(to);
+    janet_ev_fileop(stream, JANET_FILEOP_READ, 1, offset, buffer, NULL, (size_t) n, 1);
+    janet_await();
+}
+
+JANET_CORE_FN(janet_cfun_stream_pwrite,
+              "(ev/pwrite stream data offset &opt timeout)",
+              "Write `data` to a file stream starting at byte `offset`, without moving the file position. "
+              "The write runs on a worker thread. Returns nil, or raises an error if the write failed.") {
+    janet_arity(argc, 3, 4);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    janet_stream_flags(stream, JANET_STREAM_WRITABLE);
+    JanetByteView bytes = janet_getbytes(argv, 1);
+    int64_t offset = janet_getinteger64(argv, 2);
+    if (offset < 0) janet_panicf("expected non-negative offset, got %v", argv[2]);
+    double to = janet_optnumber(argv, argc, 3, INFINITY);
+    if (to != INFINITY) janet_addtimeout(to);
+    janet_ev_fileop(stream, JANET_FILEOP_WRITE, 1, offset, NULL, bytes.bytes, (size_t) bytes.len, 0);
+    janet_await();
+}
+
 JANET_CORE_FN(janet_cfun_stream_write,
               "(ev/write stream data &opt timeout)",
               "Write data to a stream, suspending the current fiber until the write "
-              "completes. Takes an optional timeout in seconds, after which will return nil. "
+              "completes. `data` can also be an array or tuple of strings and buffers, which "
+              "are written in order with a single vectored write. "
+              "Takes an optional timeout in seconds, after which will return nil. "
               "Returns nil, or raises an error if the write failed.") {
     janet_arity(argc, 2, 3);
     JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
     janet_stream_flags(stream, JANET_STREAM_WRITABLE);
     double to = janet_optnumber(argv, argc, 2, INFINITY);
-    if (janet_checktype(argv[1], JANET_BUFFER)) {
+    if (janet_checktypes(argv[1], JANET_TFLAG_INDEXED)) {
+        if (to != INFINITY) janet_addtimeout(to);
+        janet_ev_write_parts(stream, argv[1]);
+    } else if (janet_checktype(argv[1], JANET_BUFFER)) {
         if (to != INFINITY) janet_addtimeout(to);
         janet_ev_write_buffer(stream, janet_getbuffer(argv, 1));
+    } else if (janet_checktype(argv[1], JANET_ABSTRACT)) {
+        /* Byte views such as file mappings are not strings, so write them as a single part */
+        janet_getbytes(argv, 1);
+        if (to != INFINITY) janet_addtimeout(to);
+        janet_ev_write_parts(stream, janet_wrap_tuple(janet_tuple_n(argv + 1, 1)));
     } else {
         JanetByteView bytes = janet_getbytes(argv, 1);
         if (to != INFINITY) janet_addtimeout(to);
@@ -3013,6 +5364,107 @@ JANET_CORE_FN(janet_cfun_stream_write,
     janet_await();
 }
 
+JANET_CORE_FN(janet_cfun_stream_coalesce,
+              "(ev/coalesce stream &opt enable)",
+              "Turn write coalescing for a stream on or off, defaulting to on. While it is on, "
+              "writes from several fibers that are waiting on the stream at the same time are "
+              "combined and sent with one vectored write in the next event loop iteration, "
+              "instead of raising an error. Each writer still resumes once its own data has been "
+              "written. Has no effect on Windows. Returns the stream.") {
+    janet_arity(argc, 1, 2);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    if (argc < 2 || janet_truthy(argv[1])) {
+        stream->flags |= JANET_STREAM_COALESCE;
+    } else {
+        stream->flags &= ~JANET_STREAM_COALESCE;
+    }
+    return argv[0];
+}
+
+JANET_CORE_FN(cfun_ev_reader,
+              "(ev/reader stream &opt chunk-size)",
+              "Create a buffered reader over a readable stream, for use with ev/read-until, "
+              "ev/read-line and ev/read-exactly. Bytes read from the stream but not yet consumed "
+              "are kept by the reader, so the stream should not be read directly while the reader "
+              "is in use. `chunk-size` is the number of bytes to ask for on each read from the "
+              "stream, defaulting to 4096.") {
+    janet_arity(argc, 1, 2);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    janet_stream_flags(stream, JANET_STREAM_READABLE);
+    int32_t chunk = janet_optnat(argv, argc, 1, 4096);
+    if (chunk < 1) chunk = 1;
+    JanetStreamReader *reader = janet_abstract(&janet_stream_reader_type, sizeof(JanetStreamReader));
+    reader->stream = stream;
+    reader->buf = janet_buffer(chunk);
+    reader->start = 0;
+    reader->chunk = chunk;
+    reader->eof = 0;
+#ifdef JANET_WINDOWS
+    reader->offset = 0;
+#endif
+    return janet_wrap_abstract(reader);
+}
+
+JANET_CORE_FN(cfun_ev_read_until,
+              "(ev/read-until reader delim &opt buffer timeout)",
+              "Read from a buffered reader up to and including the next occurrence of the bytes "
+              "`delim`, suspending the current fiber until they arrive. The bytes are pushed to "
+              "`buffer`, or to a new buffer. At end of stream, the remaining bytes are returned "
+              "without a delimiter. Takes an optional timeout in seconds, after which will return nil. "
+              "Returns the buffer, or nil if the stream has ended and nothing is left.") {
+    janet_arity(argc, 2, 4);
+    JanetStreamReader *reader = janet_getabstract(argv, 0, &janet_stream_reader_type);
+    JanetByteView delim = janet_getbytes(argv, 1);
+    if (delim.len == 0) janet_panic("expected non-empty delimiter");
+    JanetBuffer *buffer = janet_optbuffer(argv, argc, 2, 10);
+    double to = janet_optnumber(argv, argc, 3, INFINITY);
+    return janet_reader_read(reader, buffer, argv[1], 0, to);
+}
+
+JANET_CORE_FN(cfun_ev_read_line,
+              "(ev/read-line reader &opt buffer timeout)",
+              "Read a line from a buffered reader, including the trailing newline. Like "
+              "`(ev/read-until reader \"\\n\" buffer timeout)`.") {
+    janet_arity(argc, 1, 3);
+    JanetStreamReader *reader = janet_getabstract(argv, 0, &janet_stream_reader_type);
+    JanetBuffer *buffer = janet_optbuffer(argv, argc, 1, 10);
+    double to = janet_optnumber(argv, argc, 2, INFINITY);
+    return janet_reader_read(reader, buffer, janet_wrap_nil(), 0, to);
+}
+
+JANET_CORE_FN(cfun_ev_read_exactly,
+              "(ev/read-exactly reader n &opt buffer timeout)",
+              "Read exactly n bytes from a buffered reader, suspending the current fiber until they "
+              "arrive. If the stream ends first, returns the bytes that were left. Takes an optional "
+              "timeout in seconds, after which will return nil. Returns the buffer, or nil if the "
+              "stream has ended and nothing is left.") {
+    janet_arity(argc, 2, 4);
+    JanetStreamReader *reader = janet_getabstract(argv, 0, &janet_stream_reader_type);
+    int32_t n = janet_getnat(argv, 1);
+    JanetBuffer *buffer = janet_optbuffer(argv, argc, 2, n > 0 ? n : 10);
+    double to = janet_optnumber(argv, argc, 3, INFINITY);
+    if (n == 0) return janet_wrap_buffer(buffer);
+    return janet_reader_read(reader, buffer, janet_wrap_nil(), n, to);
+}
+
+static const JanetMethod ev_reader_methods[] = {
+    {"read-until", cfun_ev_read_until},
+    {"read-line", cfun_ev_read_line},
+    {"read-exactly", cfun_ev_read_exactly},
+    {NULL, NULL}
+};
+
+static int janet_reader_get(void *p, Janet key, Janet *out) {
+    (void) p;
+    if (!janet_checktype(key, JANET_KEYWORD)) return 0;
+    return janet_getmethod(janet_unwrap_keyword(key), ev_reader_methods, out);
+}
+
+static Janet janet_reader_next(void *p, Janet key) {
+    (void) p;
+    return janet_nextmethod(ev_reader_methods, key);
+}
+
 void janet_lib_ev(JanetTable *env) {
     JanetRegExt ev_cfuns_ext[] = {
         JANET_CORE_REG("ev/give", cfun_channel_push),
@@ -3027,6 +5479,12 @@ void janet_lib_ev(JanetTable *env) {
         JANET_CORE_REG("ev/chan-close", cfun_channel_close),
         JANET_CORE_REG("ev/go", cfun_ev_go),
         JANET_CORE_REG("ev/thread", cfun_ev_thread),
+        JANET_CORE_REG("ev/thread-template", cfun_ev_thread_template),
+        JANET_CORE_REG("ev/thread-pool", cfun_ev_thread_pool),
+        JANET_CORE_REG("ev/stats", cfun_ev_stats),
+        JANET_CORE_REG("ev/priority", cfun_ev_priority),
+        JANET_CORE_REG("ev/time-slice", cfun_ev_time_slice),
+        JANET_CORE_REG("ev/slow-resume-hook", cfun_ev_slow_resume_hook),
         JANET_CORE_REG("ev/give-supervisor", cfun_ev_give_supervisor),
         JANET_CORE_REG("ev/sleep", cfun_ev_sleep),
         JANET_CORE_REG("ev/deadline", cfun_ev_deadline),
@@ -3034,13 +5492,21 @@ void janet_lib_ev(JanetTable *env) {
         JANET_CORE_REG("ev/close", janet_cfun_stream_close),
         JANET_CORE_REG("ev/read", janet_cfun_stream_read),
         JANET_CORE_REG("ev/chunk", janet_cfun_stream_chunk),
+        JANET_CORE_REG("ev/pread", janet_cfun_stream_pread),
+        JANET_CORE_REG("ev/pwrite", janet_cfun_stream_pwrite),
         JANET_CORE_REG("ev/write", janet_cfun_stream_write),
+        JANET_CORE_REG("ev/coalesce", janet_cfun_stream_coalesce),
+        JANET_CORE_REG("ev/reader", cfun_ev_reader),
+        JANET_CORE_REG("ev/read-until", cfun_ev_read_until),
+        JANET_CORE_REG("ev/read-line", cfun_ev_read_line),
+        JANET_CORE_REG("ev/read-exactly", cfun_ev_read_exactly),
         JANET_REG_END
     };
 
     janet_core_cfuns_ext(env, NULL, ev_cfuns_ext);
     janet_register_abstract_type(&janet_stream_type);
     janet_register_abstract_type(&janet_channel_type);
+    janet_register_abstract_type(&janet_stream_reader_type);
 }
 
 #endif
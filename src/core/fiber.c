@@ -42,23 +42,102 @@ static void fiber_reset(JanetFiber *fiber) {
     fiber->waiting = NULL;
     fiber->sched_id = 0;
     fiber->supervisor_channel = NULL;
+    fiber->timeout = NULL;
 #endif
     janet_fiber_set_status(fiber, JANET_STATUS_NEW);
 }
 
-static JanetFiber *fiber_alloc(int32_t capacity) {
-    Janet *data;
-    JanetFiber *fiber = janet_gcalloc(JANET_MEMORY_FIBER, sizeof(JanetFiber));
-    if (capacity < 32) {
-        capacity = 32;
+/* A fiber stack in the pool. The fields are stored in the stack memory itself. */
+typedef struct JanetFiberStack JanetFiberStack;
+struct JanetFiberStack {
+    JanetFiberStack *next;
+    int32_t capacity;
+};
+
+/* Get a stack with room for at least *capacity values, and store its real
+ * capacity back into *capacity. Reuses a pooled stack if there is one. */
+static Janet *janet_fiber_stack_alloc(int32_t *capacity) {
+    int32_t cap = *capacity < 32 ? 32 : *capacity;
+#ifdef JANET_GC_POOL
+    int bucket = 0;
+    while (bucket < JANET_FIBER_POOL_BUCKETS && (32 << bucket) < cap) bucket++;
+    if (bucket < JANET_FIBER_POOL_BUCKETS) {
+        JanetFiberStack *stack = janet_vm.fiber_pool[bucket];
+        if (NULL != stack) {
+            janet_vm.fiber_pool[bucket] = stack->next;
+            janet_vm.fiber_pool_count[bucket]--;
+            *capacity = stack->capacity;
+            return (Janet *) stack;
+        }
+        /* Round up so the stack can go back in the same bucket */
+        cap = 32 << bucket;
     }
-    fiber->capacity = capacity;
-    data = janet_malloc(sizeof(Janet) * (size_t) capacity);
+#endif
+    Janet *data = janet_malloc(sizeof(Janet) * (size_t) cap);
     if (NULL == data) {
         JANET_OUT_OF_MEMORY;
     }
-    janet_vm.next_collection += sizeof(Janet) * capacity;
-    fiber->data = data;
+    janet_vm.next_collection += sizeof(Janet) * cap;
+    *capacity = cap;
+    return data;
+}
+
+/* Release a stack, keeping it in the pool if there is room. Stacks with a
+ * capacity of 0 are not owned by their fiber. */
+void janet_fiber_stack_free(Janet *data, int32_t capacity) {
+    if (NULL == data || 0 == capacity) return;
+#ifdef JANET_GC_POOL
+    if (capacity >= 32) {
+        int bucket = 0;
+        while (bucket + 1 < JANET_FIBER_POOL_BUCKETS && (32 << (bucket + 1)) <= capacity) bucket++;
+        if ((32 << bucket) << 1 > capacity &&
+                janet_vm.fiber_pool_count[bucket] < JANET_FIBER_POOL_MAX) {
+            JanetFiberStack *stack = (JanetFiberStack *) data;
+            stack->next = janet_vm.fiber_pool[bucket];
+            stack->capacity = capacity;
+            janet_vm.fiber_pool[bucket] = stack;
+            janet_vm.fiber_pool_count[bucket]++;
+            return;
+        }
+    }
+#else
+    (void) capacity;
+#endif
+    janet_free(data);
+}
+
+/* Free all pooled fiber stacks */
+void janet_fiber_pool_release(void) {
+    for (int i = 0; i < JANET_FIBER_POOL_BUCKETS; i++) {
+        JanetFiberStack *stack = janet_vm.fiber_pool[i];
+        while (NULL != stack) {
+            JanetFiberStack *next = stack->next;
+            janet_free(stack);
+            stack = next;
+        }
+        janet_vm.fiber_pool[i] = NULL;
+        janet_vm.fiber_pool_count[i] = 0;
+    }
+}
+
+/* Stack of fibers that finished, after their own stack was released */
+static Janet janet_fiber_empty_stack[JANET_FRAME_SIZE];
+
+/* Give back the stack of a fiber that finished normally, so the next fiber can
+ * reuse it. Fibers that finished with an error keep their stack for stack traces. */
+void janet_fiber_release_stack(JanetFiber *fiber) {
+    janet_fiber_stack_free(fiber->data, fiber->capacity);
+    fiber->data = janet_fiber_empty_stack;
+    fiber->capacity = 0;
+    fiber->frame = 0;
+    fiber->stackstart = JANET_FRAME_SIZE;
+    fiber->stacktop = JANET_FRAME_SIZE;
+}
+
+static JanetFiber *fiber_alloc(int32_t capacity) {
+    JanetFiber *fiber = janet_gcalloc(JANET_MEMORY_FIBER, sizeof(JanetFiber));
+    fiber->data = janet_fiber_stack_alloc(&capacity);
+    fiber->capacity = capacity;
     return fiber;
 }
 
@@ -66,11 +145,15 @@ static JanetFiber *fiber_alloc(int32_t capacity) {
 JanetFiber *janet_fiber_reset(JanetFiber *fiber, JanetFunction *callee, int32_t argc, const Janet *argv) {
     int32_t newstacktop;
     fiber_reset(fiber);
+    newstacktop = fiber->stacktop + argc;
+    if (newstacktop >= fiber->capacity) {
+        /* The old stack contents are not needed, so swap in a bigger stack */
+        int32_t capacity = 2 * newstacktop;
+        janet_fiber_stack_free(fiber->data, fiber->capacity);
+        fiber->data = janet_fiber_stack_alloc(&capacity);
+        fiber->capacity = capacity;
+    }
     if (argc) {
-        newstacktop = fiber->stacktop + argc;
-        if (newstacktop >= fiber->capacity) {
-            janet_fiber_setcapacity(fiber, 2 * newstacktop);
-        }
         if (argv) {
             memcpy(fiber->data + fiber->stacktop, argv, argc * sizeof(Janet));
         } else {
@@ -189,6 +272,9 @@ static Janet make_struct_n(const Janet *args, int32_t n) {
 int janet_fiber_funcframe(JanetFiber *fiber, JanetFunction *func) {
     JanetStackFrame *newframe;
 
+    /* Functions from the core image are decoded on their first call */
+    if (func->def->lazy) janet_funcdef_force(func->def);
+
     int32_t i;
     int32_t oldtop = fiber->stacktop;
     int32_t oldframe = fiber->frame;
@@ -275,6 +361,7 @@ static void janet_env_detach(JanetFuncEnv *env) {
         }
         env->offset = 0;
         env->as.values = vmem;
+        janet_gc_barrier(env);
     }
 }
 
@@ -326,6 +413,8 @@ void janet_env_maybe_detach(JanetFuncEnv *env) {
 
 /* Create a tail frame for a function */
 int janet_fiber_funcframe_tail(JanetFiber *fiber, JanetFunction *func) {
+    if (func->def->lazy) janet_funcdef_force(func->def);
+
     int32_t i;
     int32_t nextframetop = fiber->frame + func->def->slotcount;
     int32_t nextstacktop = nextframetop + JANET_FRAME_SIZE;
@@ -499,7 +588,10 @@ JANET_CORE_FN(cfun_fiber_new,
               "The sigmask argument also can take environment flags. If any mutually "
               "exclusive flags are present, the last flag takes precedence.\n\n"
               "* :i - inherit the environment from the current fiber\n"
-              "* :p - the environment table's prototype is the current environment table") {
+              "* :p - the environment table's prototype is the current environment table\n\n"
+              "The :r flag allocates objects created by the fiber (and any fibers it resumes) "
+              "from an arena. When the fiber finishes, the garbage in the arena is freed without "
+              "waiting for the next collection. Objects that are still reachable are kept.") {
     janet_arity(argc, 1, 2);
     JanetFunction *func = janet_getfunction(argv, 0);
     JanetFiber *fiber;
@@ -518,7 +610,7 @@ JANET_CORE_FN(cfun_fiber_new,
             } else {
                 switch (view.bytes[i]) {
                     default:
-                        janet_panicf("invalid flag %c, expected a, t, d, e, u, y, i, or p", view.bytes[i]);
+                        janet_panicf("invalid flag %c, expected a, t, d, e, u, y, i, p, or r", view.bytes[i]);
                         break;
                     case 'a':
                         fiber->flags |=
@@ -561,6 +653,9 @@ JANET_CORE_FN(cfun_fiber_new,
                         fiber->env = janet_table(0);
                         fiber->env->proto = janet_vm.fiber->env;
                         break;
+                    case 'r':
+                        fiber->flags |= JANET_FIBER_ARENA;
+                        break;
                 }
             }
         }
@@ -55,10 +55,13 @@
 #define JANET_FIBER_RESUME_NO_SKIP   0x4000000
 #define JANET_FIBER_DID_LONGJUMP     0x8000000
 #define JANET_FIBER_FLAG_MASK        0xF000000
+#define JANET_FIBER_ARENA            0x10000000
 
 #define JANET_FIBER_EV_FLAG_CANCELED 0x10000
 #define JANET_FIBER_EV_FLAG_SUSPENDED 0x20000
 #define JANET_FIBER_FLAG_ROOT 0x40000
+#define JANET_FIBER_EV_PRIORITY_MASK 0x180000
+#define JANET_FIBER_EV_PRIORITY_SHIFT 19
 
 #define janet_fiber_set_status(f, s) do {\
     (f)->flags &= ~JANET_FIBER_STATUS_MASK;\
@@ -68,6 +71,9 @@
 #define janet_stack_frame(s) ((JanetStackFrame *)((s) - JANET_FRAME_SIZE))
 #define janet_fiber_frame(f) janet_stack_frame((f)->data + (f)->frame)
 void janet_fiber_setcapacity(JanetFiber *fiber, int32_t n);
+void janet_fiber_stack_free(Janet *data, int32_t capacity);
+void janet_fiber_pool_release(void);
+void janet_fiber_release_stack(JanetFiber *fiber);
 void janet_fiber_push(JanetFiber *fiber, Janet x);
 void janet_fiber_push2(JanetFiber *fiber, Janet x, Janet y);
 void janet_fiber_push3(JanetFiber *fiber, Janet x, Janet y, Janet z);
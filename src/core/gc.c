@@ -31,243 +31,462 @@
 #include "vector.h"
 #endif
 
-/* Helpers for marking the various gc types */
-static void janet_mark_funcenv(JanetFuncEnv *env);
-static void janet_mark_funcdef(JanetFuncDef *def);
-static void janet_mark_function(JanetFunction *func);
-static void janet_mark_array(JanetArray *array);
-static void janet_mark_table(JanetTable *table);
-static void janet_mark_struct(const JanetKV *st);
-static void janet_mark_tuple(const Janet *tuple);
-static void janet_mark_buffer(JanetBuffer *buffer);
-static void janet_mark_string(const uint8_t *str);
-static void janet_mark_fiber(JanetFiber *fiber);
-static void janet_mark_abstract(void *adata);
-
-/* Local state that is only temporary for gc */
-static JANET_THREAD_LOCAL uint32_t depth = JANET_RECURSION_GUARD;
-static JANET_THREAD_LOCAL size_t orig_rootcount;
+/* Minimum number of old blocks allowed to accumulate before a full collection */
+#define JANET_GC_MIN_MAJOR_LIMIT 0x4000
+
+/* How many values ahead to prefetch when shading the values of an object */
+#define JANET_GC_PREFETCH_DISTANCE 8
+
+/* Types of values that reference objects on the gc heap */
+#define JANET_GC_TFLAGS (JANET_TFLAG_LENGTHABLE | JANET_TFLAG_FIBER | JANET_TFLAG_FUNCTION | JANET_TFLAG_ABSTRACT)
+
+#ifdef __GNUC__
+#define janet_gc_prefetch(p) __builtin_prefetch(p)
+#else
+#define janet_gc_prefetch(p) ((void) 0)
+#endif
+
+/* Set while the mark stack is being drained */
+static JANET_THREAD_LOCAL int draining = 0;
+
+/* Set while taking a heap snapshot. janet_mark then records references instead. */
+static JANET_THREAD_LOCAL JanetBuffer *snapshot = NULL;
+
+const char *const janet_gc_type_names[JANET_GC_TYPE_COUNT] = {
+    "none", "string", "symbol", "array", "tuple", "table", "struct",
+    "fiber", "buffer", "function", "abstract", "funcenv", "funcdef",
+    "threaded-abstract"
+};
 
 /* Hint to the GC that we may need to collect */
 void janet_gcpressure(size_t s) {
     janet_vm.next_collection += s;
 }
 
-/* Mark a value */
+static void janet_shade(Janet x);
+static void janet_shade_object(void *mem);
+static void janet_blacken(JanetGCObject *mem);
+static void janet_gc_drain_gray(void);
+static void janet_snapshot_ref(Janet x);
+
+/* Mark a value. Marking does not recurse - objects are shaded gray by pushing them
+ * onto the mark stack (the gray list), which is then drained. If marking is already
+ * in progress, for example when called from the gcmark function of an abstract type,
+ * or during an incremental collection, the value is only shaded. */
 void janet_mark(Janet x) {
-    if (depth) {
-        depth--;
-        switch (janet_type(x)) {
-            default:
-                break;
-            case JANET_STRING:
-            case JANET_KEYWORD:
-            case JANET_SYMBOL:
-                janet_mark_string(janet_unwrap_string(x));
-                break;
-            case JANET_FUNCTION:
-                janet_mark_function(janet_unwrap_function(x));
-                break;
-            case JANET_ARRAY:
-                janet_mark_array(janet_unwrap_array(x));
-                break;
-            case JANET_TABLE:
-                janet_mark_table(janet_unwrap_table(x));
-                break;
-            case JANET_STRUCT:
-                janet_mark_struct(janet_unwrap_struct(x));
-                break;
-            case JANET_TUPLE:
-                janet_mark_tuple(janet_unwrap_tuple(x));
-                break;
-            case JANET_BUFFER:
-                janet_mark_buffer(janet_unwrap_buffer(x));
-                break;
-            case JANET_FIBER:
-                janet_mark_fiber(janet_unwrap_fiber(x));
-                break;
-            case JANET_ABSTRACT:
-                janet_mark_abstract(janet_unwrap_abstract(x));
-                break;
-        }
-        depth++;
-    } else {
-        janet_gcroot(x);
+    if (NULL != snapshot) {
+        janet_snapshot_ref(x);
+        return;
+    }
+    janet_shade(x);
+    if (!draining && janet_vm.gc_phase != JANET_GC_MARK) {
+        janet_gc_drain_gray();
     }
 }
 
-static void janet_mark_string(const uint8_t *str) {
-    janet_gc_mark(janet_string_head(str));
+/* Mark an entry of the remembered set. It is either an old object written to
+ * through janet_gc_barrier, or a young value stored into an old object. */
+static void janet_mark_remembered(JanetGCObject *mem) {
+    if (mem->flags & JANET_MEM_REACHABLE) {
+        janet_blacken(mem);
+    } else {
+        janet_shade_object(mem);
+    }
 }
 
-static void janet_mark_buffer(JanetBuffer *buffer) {
-    janet_gc_mark(buffer);
+/* Check if an object is mutated without going through the write barrier. If so,
+ * it needs to be scanned in every minor collection while it is old. */
+static int janet_gc_needs_rescan(JanetGCObject *mem) {
+    switch (mem->flags & JANET_MEM_TYPEBITS) {
+        default:
+            return 0;
+        case JANET_MEMORY_FIBER:
+            return 1;
+        case JANET_MEMORY_ABSTRACT:
+            return ((JanetAbstractHead *) mem)->type->gcmark != NULL;
+    }
 }
 
-static void janet_mark_abstract(void *adata) {
-#ifdef JANET_EV
-    /* Check if abstract type is a threaded abstract type. If it is, marking means
-     * updating the threaded_abstract table. */
-    if ((janet_abstract_head(adata)->gc.flags & JANET_MEM_TYPEBITS) == JANET_MEMORY_THREADED_ABSTRACT) {
-        janet_table_put(&janet_vm.threaded_abstracts, janet_wrap_abstract(adata), janet_wrap_true());
-        return;
+static void janet_gclist_push(JanetGCList *list, JanetGCObject *mem) {
+    if (list->count == list->capacity) {
+        size_t newcap = 2 * list->capacity + 16;
+        JanetGCObject **newitems = janet_realloc(list->items, newcap * sizeof(JanetGCObject *));
+        if (NULL == newitems) {
+            JANET_OUT_OF_MEMORY;
+        }
+        list->items = newitems;
+        list->capacity = newcap;
     }
-#endif
-    if (janet_gc_reachable(janet_abstract_head(adata)))
-        return;
-    janet_gc_mark(janet_abstract_head(adata));
-    if (janet_abstract_head(adata)->type->gcmark) {
-        janet_abstract_head(adata)->type->gcmark(adata, janet_abstract_size(adata));
+    list->items[list->count++] = mem;
+}
+
+/* Add an old object to the remembered set */
+void janet_gc_remember(JanetGCObject *mem) {
+    mem->flags |= JANET_MEM_REMEMBERED;
+    janet_gclist_push(&janet_vm.gc_remembered, mem);
+}
+
+/* Get the gc header of a value, or NULL if the value is not a gc object
+ * on the heap of this thread. */
+static JanetGCObject *janet_gc_value_header(Janet x) {
+    switch (janet_type(x)) {
+        default:
+            return NULL;
+        case JANET_STRING:
+        case JANET_KEYWORD:
+        case JANET_SYMBOL:
+            return janet_gc_header(janet_string_head(janet_unwrap_string(x)));
+        case JANET_BUFFER:
+            return janet_gc_header(janet_unwrap_buffer(x));
+        case JANET_FUNCTION:
+            return janet_gc_header(janet_unwrap_function(x));
+        case JANET_ARRAY:
+            return janet_gc_header(janet_unwrap_array(x));
+        case JANET_TABLE:
+            return janet_gc_header(janet_unwrap_table(x));
+        case JANET_FIBER:
+            return janet_gc_header(janet_unwrap_fiber(x));
+        case JANET_STRUCT:
+            return janet_gc_header(janet_struct_head(janet_unwrap_struct(x)));
+        case JANET_TUPLE:
+            return janet_gc_header(janet_tuple_head(janet_unwrap_tuple(x)));
+        case JANET_ABSTRACT: {
+            JanetGCObject *mem = janet_gc_header(janet_abstract_head(janet_unwrap_abstract(x)));
+            if ((mem->flags & JANET_MEM_TYPEBITS) == JANET_MEMORY_THREADED_ABSTRACT) return NULL;
+            return mem;
+        }
     }
 }
 
-/* Mark a bunch of items in memory */
-static void janet_mark_many(const Janet *values, int32_t n) {
-    if (values == NULL)
-        return;
-    const Janet *end = values + n;
-    while (values < end) {
-        janet_mark(*values);
-        values += 1;
+/* Remember a young value stored into an old object. The next minor collection treats
+ * the value as a root. While incrementally marking, the value is shaded instead, and
+ * while clearing marks nothing needs to be done as marking has not started yet. */
+void janet_gc_remember_value(Janet x) {
+    JanetGCObject *mem = janet_gc_value_header(x);
+    if (NULL == mem || (mem->flags & (JANET_MEM_REACHABLE | JANET_MEM_REMEMBERED))) return;
+    switch (janet_vm.gc_phase) {
+        case JANET_GC_CLEAR:
+            break;
+        case JANET_GC_MARK:
+            janet_shade(x);
+            break;
+        default:
+            janet_gc_remember(mem);
+            break;
     }
 }
 
-/* Mark a bunch of key values items in memory */
-static void janet_mark_kvs(const JanetKV *kvs, int32_t n) {
-    const JanetKV *end = kvs + n;
-    while (kvs < end) {
-        janet_mark(kvs->key);
-        janet_mark(kvs->value);
-        kvs++;
+/* Public version of the write barrier for native code that writes
+ * to the memory of arrays, tables, or function environments directly. */
+void janet_gcbarrier(void *mem) {
+    janet_gc_barrier(mem);
+}
+
+/* Code that holds on to the memory of a buffer past the current call, such as a
+ * pending read or write, borrows the buffer. The count of borrowers is kept in the
+ * gc header. A borrowed buffer can still grow, but its memory can not be moved to
+ * another thread. A count that overflows sticks, and the buffer stays borrowed. */
+void janet_buffer_borrow(JanetBuffer *buffer) {
+    if ((buffer->gc.flags & JANET_MEM_BORROWBITS) == JANET_MEM_BORROWBITS) return;
+    buffer->gc.flags += JANET_MEM_BORROWONE;
+}
+
+void janet_buffer_unborrow(JanetBuffer *buffer) {
+    int32_t borrows = buffer->gc.flags & JANET_MEM_BORROWBITS;
+    janet_assert(borrows, "buffer is not borrowed");
+    if (borrows == JANET_MEM_BORROWBITS) return;
+    buffer->gc.flags -= JANET_MEM_BORROWONE;
+}
+
+int janet_buffer_borrowed(JanetBuffer *buffer) {
+    return !!(buffer->gc.flags & JANET_MEM_BORROWBITS);
+}
+
+/* Borrow or give back every buffer in a list of values */
+void janet_buffer_borrow_values(const Janet *values, int32_t n, int borrow) {
+    for (int32_t i = 0; i < n; i++) {
+        if (!janet_checktype(values[i], JANET_BUFFER)) continue;
+        if (borrow) {
+            janet_buffer_borrow(janet_unwrap_buffer(values[i]));
+        } else {
+            janet_buffer_unborrow(janet_unwrap_buffer(values[i]));
+        }
     }
 }
 
-static void janet_mark_array(JanetArray *array) {
-    if (janet_gc_reachable(array))
-        return;
-    janet_gc_mark(array);
-    janet_mark_many(array->data, array->count);
+/* Borrow x, if it is a buffer, for the rest of a native call that may call back
+ * into janet. Returns a mark to pass to janet_buffer_unborrow_scope. If the call
+ * panics, janet_restore gives the buffer back instead. */
+size_t janet_buffer_borrow_scope(Janet x) {
+    size_t mark = janet_vm.buffer_borrows.count;
+    if (janet_checktype(x, JANET_BUFFER)) {
+        JanetBuffer *buffer = janet_unwrap_buffer(x);
+        janet_buffer_borrow(buffer);
+        janet_gclist_push(&janet_vm.buffer_borrows, janet_gc_header(buffer));
+    }
+    return mark;
 }
 
-static void janet_mark_table(JanetTable *table) {
-recur: /* Manual tail recursion */
-    if (janet_gc_reachable(table))
-        return;
-    janet_gc_mark(table);
-    janet_mark_kvs(table->data, table->capacity);
-    if (table->proto) {
-        table = table->proto;
-        goto recur;
+void janet_buffer_unborrow_scope(size_t mark) {
+    while (janet_vm.buffer_borrows.count > mark) {
+        JanetGCObject *mem = janet_vm.buffer_borrows.items[--janet_vm.buffer_borrows.count];
+        janet_buffer_unborrow((JanetBuffer *) mem);
     }
 }
 
-static void janet_mark_struct(const JanetKV *st) {
-recur:
-    if (janet_gc_reachable(janet_struct_head(st)))
-        return;
-    janet_gc_mark(janet_struct_head(st));
-    janet_mark_kvs(st, janet_struct_capacity(st));
-    st = janet_struct_proto(st);
-    if (st) goto recur;
+/* Empty the remembered set */
+static void janet_gc_forget(void) {
+    for (size_t i = 0; i < janet_vm.gc_remembered.count; i++) {
+        janet_vm.gc_remembered.items[i]->flags &= ~JANET_MEM_REMEMBERED;
+    }
+    janet_vm.gc_remembered.count = 0;
 }
 
-static void janet_mark_tuple(const Janet *tuple) {
-    if (janet_gc_reachable(janet_tuple_head(tuple)))
-        return;
-    janet_gc_mark(janet_tuple_head(tuple));
-    janet_mark_many(tuple, janet_tuple_length(tuple));
+/* Marking. Instead of recursively marking children, objects are shaded gray by
+ * setting their mark and pushing them onto the gray list. Gray objects are then
+ * blackened by shading their children, either all at once, or a bounded number
+ * per step in an incremental collection. */
+
+static void janet_shade_object(void *mem) {
+    JanetGCObject *obj = janet_gc_header(mem);
+    if (obj->flags & JANET_MEM_REACHABLE) return;
+    obj->flags |= JANET_MEM_REACHABLE;
+    janet_gclist_push(&janet_vm.gc_gray, obj);
 }
 
-/* Helper to mark function environments */
-static void janet_mark_funcenv(JanetFuncEnv *env) {
-    if (janet_gc_reachable(env))
+static void janet_shade_abstract(void *adata) {
+    JanetAbstractHead *head = janet_abstract_head(adata);
+#ifdef JANET_EV
+    if ((head->gc.flags & JANET_MEM_TYPEBITS) == JANET_MEMORY_THREADED_ABSTRACT) {
+        janet_table_put(&janet_vm.threaded_abstracts, janet_wrap_abstract(adata), janet_wrap_true());
         return;
-    janet_gc_mark(env);
-    /* If closure env references a dead fiber, we can just copy out the stack frame we need so
-     * we don't need to keep around the whole dead fiber. */
-    janet_env_maybe_detach(env);
-    if (env->offset > 0) {
-        /* On stack */
-        janet_mark_fiber(env->as.fiber);
+    }
+#endif
+    if (head->type->gcmark) {
+        janet_shade_object(head);
     } else {
-        /* Not on stack */
-        janet_mark_many(env->as.values, env->length);
+        janet_gc_mark(head);
     }
 }
 
-/* GC helper to mark a FuncDef */
-static void janet_mark_funcdef(JanetFuncDef *def) {
-    int32_t i;
-    if (janet_gc_reachable(def))
-        return;
-    janet_gc_mark(def);
-    janet_mark_many(def->constants, def->constants_length);
-    for (i = 0; i < def->defs_length; ++i) {
-        janet_mark_funcdef(def->defs[i]);
+static void janet_shade(Janet x) {
+    switch (janet_type(x)) {
+        default:
+            break;
+        case JANET_STRING:
+        case JANET_KEYWORD:
+        case JANET_SYMBOL:
+            janet_gc_mark(janet_string_head(janet_unwrap_string(x)));
+            break;
+        case JANET_BUFFER:
+            janet_gc_mark(janet_unwrap_buffer(x));
+            break;
+        case JANET_FUNCTION:
+            janet_shade_object(janet_unwrap_function(x));
+            break;
+        case JANET_ARRAY:
+            janet_shade_object(janet_unwrap_array(x));
+            break;
+        case JANET_TABLE:
+            janet_shade_object(janet_unwrap_table(x));
+            break;
+        case JANET_STRUCT:
+            janet_shade_object(janet_struct_head(janet_unwrap_struct(x)));
+            break;
+        case JANET_TUPLE:
+            janet_shade_object(janet_tuple_head(janet_unwrap_tuple(x)));
+            break;
+        case JANET_FIBER:
+            janet_shade_object(janet_unwrap_fiber(x));
+            break;
+        case JANET_ABSTRACT:
+            janet_shade_abstract(janet_unwrap_abstract(x));
+            break;
     }
-    if (def->source)
-        janet_mark_string(def->source);
-    if (def->name)
-        janet_mark_string(def->name);
 }
 
-static void janet_mark_function(JanetFunction *func) {
-    int32_t i;
-    int32_t numenvs;
-    if (janet_gc_reachable(func))
-        return;
-    janet_gc_mark(func);
-    if (NULL != func->def) {
-        /* this should always be true, except if function is only partially constructed */
-        numenvs = func->def->environments_length;
-        for (i = 0; i < numenvs; ++i) {
-            janet_mark_funcenv(func->envs[i]);
-        }
-        janet_mark_funcdef(func->def);
+/* Prefetch the heap object referenced by a value before it is shaded */
+static void janet_gc_prefetch_value(Janet x) {
+    if (janet_checktypes(x, JANET_GC_TFLAGS)) {
+        janet_gc_prefetch(janet_unwrap_pointer(x));
     }
 }
 
-static void janet_mark_fiber(JanetFiber *fiber) {
-    int32_t i, j;
-    JanetStackFrame *frame;
-recur:
-    if (janet_gc_reachable(fiber))
+static void janet_shade_many(const Janet *values, int32_t n) {
+    if (values == NULL)
         return;
-    janet_gc_mark(fiber);
-
-    janet_mark(fiber->last_value);
+    for (int32_t i = 0; i < n; i++) {
+        if (i + JANET_GC_PREFETCH_DISTANCE < n)
+            janet_gc_prefetch_value(values[i + JANET_GC_PREFETCH_DISTANCE]);
+        janet_shade(values[i]);
+    }
+}
 
-    /* Mark values on the argument stack */
-    janet_mark_many(fiber->data + fiber->stackstart,
-                    fiber->stacktop - fiber->stackstart);
+static void janet_shade_kvs(const JanetKV *kvs, int32_t n) {
+    for (int32_t i = 0; i < n; i++) {
+        if (i + JANET_GC_PREFETCH_DISTANCE < n) {
+            janet_gc_prefetch_value(kvs[i + JANET_GC_PREFETCH_DISTANCE].key);
+            janet_gc_prefetch_value(kvs[i + JANET_GC_PREFETCH_DISTANCE].value);
+        }
+        janet_shade(kvs[i].key);
+        janet_shade(kvs[i].value);
+    }
+}
 
-    i = fiber->frame;
-    j = fiber->stackstart - JANET_FRAME_SIZE;
+static void janet_shade_fiber_children(JanetFiber *fiber) {
+    int32_t i = fiber->frame;
+    int32_t j = fiber->stackstart - JANET_FRAME_SIZE;
+    janet_shade(fiber->last_value);
+    janet_shade_many(fiber->data + fiber->stackstart, fiber->stacktop - fiber->stackstart);
     while (i > 0) {
-        frame = (JanetStackFrame *)(fiber->data + i - JANET_FRAME_SIZE);
+        JanetStackFrame *frame = (JanetStackFrame *)(fiber->data + i - JANET_FRAME_SIZE);
         if (NULL != frame->func)
-            janet_mark_function(frame->func);
+            janet_shade_object(frame->func);
         if (NULL != frame->env)
-            janet_mark_funcenv(frame->env);
-        /* Mark all values in the stack frame */
-        janet_mark_many(fiber->data + i, j - i);
+            janet_shade_object(frame->env);
+        janet_shade_many(fiber->data + i, j - i);
         j = i - JANET_FRAME_SIZE;
         i = frame->prevframe;
     }
-
     if (fiber->env)
-        janet_mark_table(fiber->env);
-
+        janet_shade_object(fiber->env);
+    if (fiber->child)
+        janet_shade_object(fiber->child);
 #ifdef JANET_EV
-    if (fiber->supervisor_channel) {
-        janet_mark_abstract(fiber->supervisor_channel);
-    }
+    if (fiber->supervisor_channel)
+        janet_shade_abstract(fiber->supervisor_channel);
 #endif
+}
+
+/* Shade the children of a gray object, making it black. Fibers and abstract types
+ * with gcmark are not protected by the write barrier, so during an incremental
+ * collection they are also added to the rescan set to be blackened again when
+ * marking finishes. */
+static void janet_blacken(JanetGCObject *mem) {
+    switch (mem->flags & JANET_MEM_TYPEBITS) {
+        default:
+            break;
+        case JANET_MEMORY_ARRAY: {
+            JanetArray *array = (JanetArray *) mem;
+            janet_shade_many(array->data, array->count);
+        }
+        break;
+        case JANET_MEMORY_TUPLE: {
+            const Janet *tuple = janet_tuple_from_head(mem);
+            janet_shade_many(tuple, janet_tuple_length(tuple));
+        }
+        break;
+        case JANET_MEMORY_TABLE: {
+            JanetTable *table = (JanetTable *) mem;
+            janet_shade_kvs(table->data, table->capacity);
+            if (table->proto)
+                janet_shade_object(table->proto);
+        }
+        break;
+        case JANET_MEMORY_STRUCT: {
+            const JanetKV *st = (const JanetKV *)(((JanetStructHead *) mem)->data);
+            janet_shade_kvs(st, janet_struct_capacity(st));
+            if (janet_struct_proto(st))
+                janet_shade_object(janet_struct_head(janet_struct_proto(st)));
+        }
+        break;
+        case JANET_MEMORY_FUNCTION: {
+            JanetFunction *func = (JanetFunction *) mem;
+            if (NULL != func->def) {
+                for (int32_t i = 0; i < func->def->environments_length; i++) {
+                    janet_shade_object(func->envs[i]);
+                }
+                janet_shade_object(func->def);
+            }
+        }
+        break;
+        case JANET_MEMORY_FUNCENV: {
+            JanetFuncEnv *env = (JanetFuncEnv *) mem;
+            janet_env_maybe_detach(env);
+            if (env->offset > 0) {
+                janet_shade_object(env->as.fiber);
+            } else {
+                janet_shade_many(env->as.values, env->length);
+            }
+        }
+        break;
+        case JANET_MEMORY_FUNCDEF: {
+            JanetFuncDef *def = (JanetFuncDef *) mem;
+            janet_shade_many(def->constants, def->constants_length);
+            for (int32_t i = 0; i < def->defs_length; i++) {
+                janet_shade_object(def->defs[i]);
+            }
+            if (def->source)
+                janet_gc_mark(janet_string_head(def->source));
+            if (def->name)
+                janet_gc_mark(janet_string_head(def->name));
+        }
+        break;
+        case JANET_MEMORY_FIBER:
+            janet_shade_fiber_children((JanetFiber *) mem);
+            if (janet_vm.gc_phase == JANET_GC_MARK)
+                janet_gclist_push(&janet_vm.gc_rescan, mem);
+            break;
+        case JANET_MEMORY_ABSTRACT: {
+            JanetAbstractHead *head = (JanetAbstractHead *) mem;
+            if (head->type->gcmark) {
+                head->type->gcmark(head->data, head->size);
+                if (janet_vm.gc_phase == JANET_GC_MARK)
+                    janet_gclist_push(&janet_vm.gc_rescan, mem);
+            }
+        }
+        break;
+    }
+}
 
-    /* Explicit tail recursion */
-    if (fiber->child) {
-        fiber = fiber->child;
-        goto recur;
+/* Approximate number of bytes used by a block, including memory it owns
+ * outside of the gc heap. While sweeping, other dead blocks may already have
+ * been freed, so only memory reachable from the block itself is counted. */
+static size_t janet_gc_block_size(JanetGCObject *mem, int sweeping) {
+    switch (mem->flags & JANET_MEM_TYPEBITS) {
+        default:
+            return sizeof(JanetGCObject);
+        case JANET_MEMORY_STRING:
+        case JANET_MEMORY_SYMBOL:
+            return sizeof(JanetStringHead) + (size_t)((JanetStringHead *) mem)->length + 1;
+        case JANET_MEMORY_ARRAY:
+            return sizeof(JanetArray) + (size_t)((JanetArray *) mem)->capacity * sizeof(Janet);
+        case JANET_MEMORY_TUPLE:
+            return sizeof(JanetTupleHead) + (size_t)((JanetTupleHead *) mem)->length * sizeof(Janet);
+        case JANET_MEMORY_TABLE:
+            return sizeof(JanetTable) + janet_table_datasize(((JanetTable *) mem)->capacity);
+        case JANET_MEMORY_STRUCT:
+            return sizeof(JanetStructHead) + (size_t)((JanetStructHead *) mem)->capacity * sizeof(JanetKV);
+        case JANET_MEMORY_FIBER:
+            return sizeof(JanetFiber) + (size_t)((JanetFiber *) mem)->capacity * sizeof(Janet);
+        case JANET_MEMORY_BUFFER:
+            return sizeof(JanetBuffer) + (size_t)((JanetBuffer *) mem)->capacity;
+        case JANET_MEMORY_FUNCTION: {
+            JanetFunction *func = (JanetFunction *) mem;
+            size_t envs = (sweeping || NULL == func->def) ? 0 : (size_t) func->def->environments_length;
+            return sizeof(JanetFunction) + envs * sizeof(JanetFuncEnv *);
+        }
+        case JANET_MEMORY_ABSTRACT:
+            return sizeof(JanetAbstractHead) + ((JanetAbstractHead *) mem)->size;
+        case JANET_MEMORY_FUNCENV: {
+            JanetFuncEnv *env = (JanetFuncEnv *) mem;
+            size_t values = (env->offset > 0) ? 0 : (size_t) env->length;
+            return sizeof(JanetFuncEnv) + values * sizeof(Janet);
+        }
+        case JANET_MEMORY_FUNCDEF: {
+            JanetFuncDef *def = (JanetFuncDef *) mem;
+            size_t size = sizeof(JanetFuncDef);
+            size += (size_t) def->bytecode_length * sizeof(uint32_t);
+            size += (size_t) def->constants_length * sizeof(Janet);
+            size += (size_t) def->defs_length * sizeof(JanetFuncDef *);
+            size += (size_t) def->environments_length * sizeof(int32_t);
+            size += (size_t) def->captures_length * sizeof(int32_t);
+            if (NULL != def->sourcemap)
+                size += (size_t) def->bytecode_length * sizeof(JanetSourceMapping);
+            if (NULL != def->closure_bitset)
+                size += (size_t)((def->slotcount + 31) >> 5) * sizeof(uint32_t);
+            return size;
+        }
     }
 }
 
@@ -287,7 +506,7 @@ static void janet_deinit_block(JanetGCObject *mem) {
             janet_free(((JanetTable *) mem)->data);
             break;
         case JANET_MEMORY_FIBER:
-            janet_free(((JanetFiber *)mem)->data);
+            janet_fiber_stack_free(((JanetFiber *)mem)->data, ((JanetFiber *)mem)->capacity);
             break;
         case JANET_MEMORY_BUFFER:
             janet_buffer_deinit((JanetBuffer *) mem);
@@ -310,40 +529,122 @@ static void janet_deinit_block(JanetGCObject *mem) {
             /* TODO - get this all with one alloc and one free */
             janet_free(def->defs);
             janet_free(def->environments);
+            janet_free(def->captures);
             janet_free(def->constants);
             janet_free(def->bytecode);
             janet_free(def->sourcemap);
             janet_free(def->closure_bitset);
+#ifdef JANET_JIT
+            janet_jit_free(def);
+#endif
         }
         break;
     }
 }
 
-/* Iterate over all allocated memory, and free memory that is not
- * marked as reachable. Flip the gc color flag for next sweep. */
-void janet_sweep() {
-    JanetGCObject *previous = NULL;
-    JanetGCObject *current = janet_vm.blocks;
-    JanetGCObject *next;
-    while (NULL != current) {
-        next = current->data.next;
-        if (current->flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
-            previous = current;
-            current->flags &= ~JANET_MEM_REACHABLE;
-        } else {
-            janet_vm.block_count--;
-            janet_deinit_block(current);
-            if (NULL != previous) {
-                previous->data.next = next;
-            } else {
-                janet_vm.blocks = next;
-            }
-            janet_free(current);
+#ifdef JANET_GC_POOL
+
+/* Small objects are carved out of fixed size cells in per-VM pools. Each pool hands out
+ * cells from its free list first, and otherwise bump allocates from the current chunk.
+ * The sweep pushes dead cells back onto the free list of their size class. */
+#define JANET_GC_POOL_MAX 256
+#define JANET_GC_POOL_CHUNK 0x10000
+#define JANET_GC_POOL_ALIGN 16
+
+static const uint16_t janet_gc_pool_sizes[JANET_GC_POOL_COUNT] = {
+    32, 48, 64, 96, 128, 192, 256
+};
+
+/* Map an allocation size, in units of 16 bytes, to a size class. Classes start at 1. */
+static const uint8_t janet_gc_pool_classes[(JANET_GC_POOL_MAX >> 4) + 1] = {
+    1, 1, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7
+};
+
+static void janet_gc_pool_refill(JanetGCPool *pool) {
+    char *chunk = janet_malloc(JANET_GC_POOL_CHUNK);
+    if (NULL == chunk) {
+        JANET_OUT_OF_MEMORY;
+    }
+    *((void **) chunk) = janet_vm.gc_pool_chunks;
+    janet_vm.gc_pool_chunks = chunk;
+    pool->cursor = chunk + JANET_GC_POOL_ALIGN;
+    pool->end = chunk + JANET_GC_POOL_CHUNK;
+}
+
+#endif
+
+/* Get memory for a new block, and the pool bits to store in its flags */
+static JanetGCObject *janet_gc_rawalloc(size_t size, int32_t *poolbits) {
+    JanetGCObject *mem;
+#ifdef JANET_GC_POOL
+    if (size <= JANET_GC_POOL_MAX) {
+        int cls = janet_gc_pool_classes[(size + 15) >> 4];
+        JanetGCPool *pool = janet_vm.gc_pools + (cls - 1);
+        size_t cellsize = janet_gc_pool_sizes[cls - 1];
+        *poolbits = cls << JANET_MEM_POOLSHIFT;
+        mem = pool->free;
+        if (NULL != mem) {
+            pool->free = mem->data.next;
+            return mem;
         }
-        current = next;
+        if ((size_t)(pool->end - pool->cursor) < cellsize) {
+            janet_gc_pool_refill(pool);
+        }
+        mem = (JanetGCObject *) pool->cursor;
+        pool->cursor += cellsize;
+        return mem;
     }
+#endif
+    *poolbits = 0;
+    mem = janet_malloc(size);
+    if (NULL == mem) {
+        JANET_OUT_OF_MEMORY;
+    }
+    return mem;
+}
+
+/* Return the memory of a dead block to its pool or to the system allocator */
+static void janet_gc_rawfree(JanetGCObject *mem) {
+#ifdef JANET_GC_POOL
+    int cls = (mem->flags & JANET_MEM_POOLBITS) >> JANET_MEM_POOLSHIFT;
+    if (cls) {
+        JanetGCPool *pool = janet_vm.gc_pools + (cls - 1);
+        mem->flags = 0;
+        mem->data.next = pool->free;
+        pool->free = mem;
+        return;
+    }
+#endif
+    janet_free(mem);
+}
+
+/* Release a block that was not marked during a sweep */
+static void janet_sweep_block(JanetGCObject *mem) {
+    janet_vm.block_count--;
+    janet_vm.gc_freed_blocks++;
+    janet_vm.gc_freed_bytes += janet_gc_block_size(mem, 1);
+    janet_deinit_block(mem);
+    janet_gc_rawfree(mem);
+}
+
+/* Free all pool chunks. Only valid once every block has been deinitialized. */
+static void janet_gc_pool_release(void) {
+#ifdef JANET_GC_POOL
+    void *chunk = janet_vm.gc_pool_chunks;
+    while (NULL != chunk) {
+        void *next = *((void **) chunk);
+        janet_free(chunk);
+        chunk = next;
+    }
+    janet_vm.gc_pool_chunks = NULL;
+    memset(janet_vm.gc_pools, 0, sizeof(janet_vm.gc_pools));
+#endif
+}
+
+/* Sweep threaded abstract types for references to decrement. References
+ * are only released after marking the whole heap. */
+static void janet_sweep_threaded_abstracts(int major) {
 #ifdef JANET_EV
-    /* Sweep threaded abstract types for references to decrement */
     JanetKV *items = janet_vm.threaded_abstracts.data;
     for (int32_t i = 0; i < janet_vm.threaded_abstracts.capacity; i++) {
         if (janet_checktype(items[i].key, JANET_ABSTRACT)) {
@@ -352,22 +653,21 @@ void janet_sweep() {
              * abstract type isn't present in the heap and needs its refcount
              * decremented, and shouuld be removed from table. If the refcount is
              * then 0, the item will be collected. This ensures that only one interpreter
-             * will clean up the threaded abstract. */
+             * will clean up the threaded abstract. A minor collection does not
+             * visit the old generation, so only a full collection can do this. */
 
             /* If not visited... */
-            if (!janet_truthy(items[i].value)) {
+            if (major && !janet_truthy(items[i].value)) {
                 void *abst = janet_unwrap_abstract(items[i].key);
+                /* Mark as tombstone in place. The reference is gone from this
+                 * heap even if other threads still hold the abstract. */
+                janet_table_remove(&janet_vm.threaded_abstracts, items[i].key);
                 if (0 == janet_abstract_decref(abst)) {
                     /* Run finalizer */
                     JanetAbstractHead *head = janet_abstract_head(abst);
                     if (head->type->gc) {
                         janet_assert(!head->type->gc(head->data, head->size), "finalizer failed");
                     }
-                    /* Mark as tombstone in place */
-                    items[i].key = janet_wrap_nil();
-                    items[i].value = janet_wrap_false();
-                    janet_vm.threaded_abstracts.deleted++;
-                    janet_vm.threaded_abstracts.count--;
                     /* Free memory */
                     janet_free(janet_abstract_head(abst));
                 }
@@ -377,29 +677,116 @@ void janet_sweep() {
             items[i].value = janet_wrap_false();
         }
     }
+#else
+    (void) major;
 #endif
 }
 
+/* Iterate over allocated memory up to the stop block, and free memory that is not
+ * marked as reachable. Surviving blocks keep their mark and become part of the old
+ * generation. A full sweep (stop is NULL) visits every block in the heap. */
+static void janet_sweep_blocks(JanetGCObject *stop) {
+    int major = (NULL == stop);
+    JanetGCObject *previous = NULL;
+    JanetGCObject *current = janet_vm.blocks;
+    JanetGCObject *next;
+    while (stop != current) {
+        next = current->data.next;
+        if (current->flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
+            previous = current;
+            current->flags |= JANET_MEM_REACHABLE;
+            if (janet_gc_needs_rescan(current)) {
+                janet_gclist_push(&janet_vm.gc_rescan, current);
+            }
+        } else {
+            if (NULL != previous) {
+                previous->data.next = next;
+            } else {
+                janet_vm.blocks = next;
+            }
+            janet_sweep_block(current);
+        }
+        current = next;
+    }
+    janet_vm.old_blocks = janet_vm.blocks;
+    janet_sweep_threaded_abstracts(major);
+}
+
+/* Iterate over all allocated memory, and free memory that is not
+ * marked as reachable. */
+void janet_sweep() {
+    janet_vm.gc_rescan.count = 0;
+    janet_sweep_blocks(NULL);
+}
+
 /* Allocate some memory that is tracked for garbage collection */
+/* Record the innermost janet function and bytecode offset allocating a block */
+static void janet_gc_sample(enum JanetMemoryType type, size_t size) {
+    JanetGCSample *sample;
+    JanetFiber *fiber = janet_vm.fiber;
+    JanetFuncDef *def = NULL;
+    int32_t pc = 0;
+    if (NULL != fiber) {
+        int32_t i = fiber->frame;
+        while (i > 0) {
+            JanetStackFrame *frame = janet_stack_frame(fiber->data + i);
+            if (NULL != frame->func && NULL != frame->pc) {
+                def = frame->func->def;
+                pc = (int32_t)(frame->pc - def->bytecode);
+                break;
+            }
+            i = frame->prevframe;
+        }
+    }
+    if (janet_vm.gc_sample_count < janet_vm.gc_sample_capacity) {
+        sample = janet_vm.gc_samples + janet_vm.gc_sample_count++;
+    } else if (janet_vm.gc_sample_capacity < JANET_GC_SAMPLE_MAX) {
+        size_t newcap = 2 * janet_vm.gc_sample_capacity + 64;
+        if (newcap > JANET_GC_SAMPLE_MAX) newcap = JANET_GC_SAMPLE_MAX;
+        JanetGCSample *newsamples = janet_realloc(janet_vm.gc_samples, newcap * sizeof(JanetGCSample));
+        if (NULL == newsamples) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_vm.gc_samples = newsamples;
+        janet_vm.gc_sample_capacity = newcap;
+        sample = janet_vm.gc_samples + janet_vm.gc_sample_count++;
+    } else {
+        sample = janet_vm.gc_samples + janet_vm.gc_sample_next;
+        janet_vm.gc_sample_next = (janet_vm.gc_sample_next + 1) % JANET_GC_SAMPLE_MAX;
+    }
+    sample->def = def;
+    sample->pc = pc;
+    sample->type = (int32_t) type;
+    sample->size = size;
+}
+
 void *janet_gcalloc(enum JanetMemoryType type, size_t size) {
     JanetGCObject *mem;
+    int32_t poolbits;
 
     /* Make sure everything is inited */
     janet_assert(NULL != janet_vm.cache, "please initialize janet before use");
-    mem = janet_malloc(size);
-
-    /* Check for bad malloc */
-    if (NULL == mem) {
-        JANET_OUT_OF_MEMORY;
-    }
+    mem = janet_gc_rawalloc(size, &poolbits);
 
     /* Configure block */
-    mem->flags = type;
+    mem->flags = type | poolbits;
+
+    if (janet_vm.gc_sample_rate && 0 == --janet_vm.gc_sample_countdown) {
+        janet_vm.gc_sample_countdown = janet_vm.gc_sample_rate;
+        janet_gc_sample(type, size);
+    }
 
-    /* Prepend block to heap list */
+    /* Prepend block to heap list, or to the arena of the running fiber */
     janet_vm.next_collection += size;
-    mem->data.next = janet_vm.blocks;
-    janet_vm.blocks = mem;
+    if (NULL != janet_vm.gc_arena_fiber && janet_vm.gc_phase == JANET_GC_IDLE) {
+        if (NULL == janet_vm.gc_arena) janet_vm.gc_arena_tail = mem;
+        mem->data.next = janet_vm.gc_arena;
+        janet_vm.gc_arena = mem;
+        janet_vm.gc_arena_count++;
+    } else {
+        mem->data.next = janet_vm.blocks;
+        janet_vm.blocks = mem;
+    }
     janet_vm.block_count++;
 
     return (void *)mem;
@@ -425,33 +812,391 @@ static JanetScratch *janet_mem2scratch(void *mem) {
     return s - 1;
 }
 
-/* Run garbage collection */
-void janet_collect(void) {
-    uint32_t i;
-    if (janet_vm.gc_suspend) return;
-    depth = JANET_RECURSION_GUARD;
-    /* Try and prevent many major collections back to back.
-     * A full collection will take O(janet_vm.block_count) time.
-     * If we have a large heap, make sure our interval is not too
-     * small so we won't make many collections over it. This is just a
-     * heuristic for automatically changing the gc interval */
-    if (janet_vm.block_count * 8 > janet_vm.gc_interval) {
-        janet_vm.gc_interval = janet_vm.block_count * sizeof(JanetGCObject);
-    }
-    orig_rootcount = janet_vm.root_count;
+/* Current time in seconds, used to time collections */
+static double janet_gc_clock(void) {
+#ifdef JANET_GETTIME
+    struct timespec spec;
+    janet_gettime(&spec);
+    return (double) spec.tv_sec + (double) spec.tv_nsec * 1e-9;
+#else
+    return 0.0;
+#endif
+}
+
+/* Add the time spent in one pause of the program to the statistics */
+static void janet_gc_record_pause(double mark_time, double sweep_time) {
+    JanetGCStats *stats = &janet_vm.gc_stats;
+    stats->mark_time += mark_time;
+    stats->sweep_time += sweep_time;
+    if (mark_time > stats->mark_time_max) stats->mark_time_max = mark_time;
+    if (sweep_time > stats->sweep_time_max) stats->sweep_time_max = sweep_time;
+}
+
+/* Count a finished collection and call the gc hook, if any */
+static void janet_gc_record_collection(int major) {
+    JanetGCStats *stats = &janet_vm.gc_stats;
+    stats->collections++;
+    if (major) stats->major_collections++;
+    stats->last_freed_blocks = janet_vm.gc_freed_blocks;
+    stats->last_freed_bytes = janet_vm.gc_freed_bytes;
+    janet_vm.gc_freed_blocks = 0;
+    janet_vm.gc_freed_bytes = 0;
+    if (NULL != janet_vm.gc_hook) {
+        JanetGCStats copy;
+        janet_gcstats(&copy);
+        janet_vm.gc_hook(&copy, major, janet_vm.gc_hook_data);
+    }
+}
+
+/* Stop an incremental collection in progress. The heap stays consistent between
+ * steps, so a full collection can then be run from scratch. */
+static void janet_gc_abort_incremental(void) {
+    janet_vm.gc_phase = JANET_GC_IDLE;
+    janet_vm.gc_gray.count = 0;
+    janet_vm.gc_cursor = NULL;
+    janet_vm.gc_freed_blocks = 0;
+    janet_vm.gc_freed_bytes = 0;
+}
+
+/* Start an incremental collection of the whole heap. The first phase
+ * clears the sticky marks of all blocks. */
+static void janet_gc_begin_incremental(void) {
+    janet_vm.gc_phase = JANET_GC_CLEAR;
+    janet_vm.gc_cursor = janet_vm.blocks;
+    janet_vm.gc_rescan.count = 0;
+}
+
+/* Shade all roots gray */
+static void janet_gc_shade_roots(void) {
 #ifdef JANET_EV
     janet_ev_mark();
 #endif
-    janet_mark_fiber(janet_vm.root_fiber);
-    for (i = 0; i < orig_rootcount; i++)
-        janet_mark(janet_vm.roots[i]);
-    while (orig_rootcount < janet_vm.root_count) {
-        Janet x = janet_vm.roots[--janet_vm.root_count];
-        janet_mark(x);
+    if (NULL != janet_vm.root_fiber)
+        janet_shade_object(janet_vm.root_fiber);
+    for (size_t i = 0; i < janet_vm.root_count; i++)
+        janet_shade(janet_vm.roots[i]);
+    /* Keep sampled allocation sites alive */
+    for (size_t i = 0; i < janet_vm.gc_sample_count; i++) {
+        if (NULL != janet_vm.gc_samples[i].def)
+            janet_shade_object(janet_vm.gc_samples[i].def);
+    }
+    /* Keep functions in profiler samples alive */
+    for (size_t i = 0; i < janet_vm.profile_count; i++) {
+        JanetProfileSample *sample = janet_vm.profile_samples + i;
+        for (int32_t j = 0; j < sample->depth; j++) {
+            if (NULL != sample->frames[j].def)
+                janet_shade_object(sample->frames[j].def);
+        }
+    }
+    /* Keep the subjects of unread trace events alive */
+    for (int64_t i = janet_vm.trace_tail; i < janet_vm.trace_head; i++) {
+        JanetTraceEvent *event = janet_vm.trace_events + ((size_t) i & (janet_vm.trace_capacity - 1));
+        void *subject = (void *) event->subject;
+        switch (event->type) {
+            default:
+                break;
+            case JANET_TRACE_ENTER:
+            case JANET_TRACE_EXIT:
+                if (!event->arg) janet_shade_object(subject);
+                break;
+            case JANET_TRACE_RESUME:
+            case JANET_TRACE_STOP:
+                janet_shade_object(subject);
+                break;
+#ifdef JANET_EV
+            case JANET_TRACE_LISTENER:
+                janet_shade_object(janet_abstract_head(subject));
+                break;
+#endif
+        }
     }
+}
+
+/* Blacken gray objects until the mark stack is empty. The next object on the
+ * stack is prefetched while the current one is blackened. */
+static void janet_gc_drain_gray(void) {
+    draining = 1;
+    while (janet_vm.gc_gray.count) {
+        size_t count = --janet_vm.gc_gray.count;
+        if (count) janet_gc_prefetch(janet_vm.gc_gray.items[count - 1]);
+        janet_blacken(janet_vm.gc_gray.items[count]);
+    }
+    draining = 0;
+}
+
+/* Mark all roots. In a minor collection, old objects are already marked,
+ * so also mark everything reachable from the remembered and rescan sets. */
+static void janet_mark_roots(int major) {
+    draining = 1;
+    janet_gc_shade_roots();
+    if (!major) {
+        for (size_t i = 0; i < janet_vm.gc_remembered.count; i++)
+            janet_mark_remembered(janet_vm.gc_remembered.items[i]);
+        for (size_t i = 0; i < janet_vm.gc_rescan.count; i++)
+            janet_blacken(janet_vm.gc_rescan.items[i]);
+    }
+    janet_gc_drain_gray();
+}
+
+/* Finish marking without interruption. Roots may have changed since they were
+ * shaded, objects that were written to after being marked are in the remembered set,
+ * and fibers or abstract types may have changed without a barrier. After this, every
+ * block that is not marked is garbage, and the sweep can begin. */
+static void janet_gc_remark(void) {
+    JanetGCObject *start;
+    size_t rescan_count = janet_vm.gc_rescan.count;
+    janet_gc_shade_roots();
+    for (size_t i = 0; i < janet_vm.gc_remembered.count; i++)
+        janet_mark_remembered(janet_vm.gc_remembered.items[i]);
+    for (size_t i = 0; i < rescan_count; i++)
+        janet_blacken(janet_vm.gc_rescan.items[i]);
+    janet_gc_drain_gray();
+    janet_gc_forget();
+    janet_sweep_threaded_abstracts(1);
+    janet_vm.gc_phase = JANET_GC_SWEEP;
+    janet_vm.gc_rescan.count = 0;
+    janet_vm.gc_freed_blocks = 0;
+    janet_vm.gc_freed_bytes = 0;
+    /* Sweeping starts after the current first block, since blocks allocated while
+     * sweeping are pushed onto the front of the list. The first block becomes the
+     * start of the old generation. If it is garbage, it is only freed by the next
+     * full collection. */
+    start = janet_vm.blocks;
+    janet_vm.gc_cursor = start;
+    if (NULL != start) {
+        start->flags |= JANET_MEM_REACHABLE;
+        if (janet_gc_needs_rescan(start)) {
+            janet_gclist_push(&janet_vm.gc_rescan, start);
+        }
+    }
+    janet_vm.old_blocks = start;
+}
+
+static void janet_gc_finish_incremental(void) {
+    janet_vm.gc_phase = JANET_GC_IDLE;
+    janet_vm.gc_cursor = NULL;
+    janet_vm.old_block_count = janet_vm.block_count;
+    janet_vm.major_block_limit = 2 * janet_vm.block_count + JANET_GC_MIN_MAJOR_LIMIT;
+}
+
+/* Do a bounded amount of work on the incremental collection in progress. The
+ * budget is the number of blocks that can be cleared, blackened, or swept. */
+static void janet_gc_step(size_t budget) {
+    size_t work = 0;
+    int sweeping = janet_vm.gc_phase == JANET_GC_SWEEP;
+    double start = janet_gc_clock();
+    double elapsed;
+    janet_probe1(gc__begin, JANET_TRACE_GC_STEP);
+    janet_trace(JANET_TRACE_GC, JANET_TRACE_GC_BEGIN, JANET_TRACE_GC_STEP, NULL);
+    while (work < budget && janet_vm.gc_phase != JANET_GC_IDLE) {
+        switch (janet_vm.gc_phase) {
+            case JANET_GC_CLEAR: {
+                JanetGCObject *current = janet_vm.gc_cursor;
+                while (NULL != current && work < budget) {
+                    current->flags &= ~JANET_MEM_REACHABLE;
+                    current = current->data.next;
+                    work++;
+                }
+                janet_vm.gc_cursor = current;
+                if (NULL == current) {
+                    janet_gc_forget();
+                    janet_vm.gc_phase = JANET_GC_MARK;
+                    janet_gc_shade_roots();
+                }
+            }
+            break;
+            case JANET_GC_MARK:
+                while (janet_vm.gc_gray.count && work < budget) {
+                    janet_blacken(janet_vm.gc_gray.items[--janet_vm.gc_gray.count]);
+                    work++;
+                }
+                if (0 == janet_vm.gc_gray.count) {
+                    janet_gc_remark();
+                }
+                break;
+            case JANET_GC_SWEEP: {
+                JanetGCObject *previous = janet_vm.gc_cursor;
+                JanetGCObject *current = (NULL == previous) ? NULL : previous->data.next;
+                while (NULL != current && work < budget) {
+                    JanetGCObject *next = current->data.next;
+                    if (current->flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
+                        current->flags |= JANET_MEM_REACHABLE;
+                        if (janet_gc_needs_rescan(current)) {
+                            janet_gclist_push(&janet_vm.gc_rescan, current);
+                        }
+                        previous = current;
+                    } else {
+                        previous->data.next = next;
+                        janet_sweep_block(current);
+                    }
+                    current = next;
+                    work++;
+                }
+                janet_vm.gc_cursor = previous;
+                if (NULL == current) {
+                    janet_gc_finish_incremental();
+                }
+            }
+            break;
+        }
+    }
+    elapsed = janet_gc_clock() - start;
+    janet_gc_record_pause(sweeping ? 0.0 : elapsed, sweeping ? elapsed : 0.0);
+    janet_trace(JANET_TRACE_GC, JANET_TRACE_GC_END, JANET_TRACE_GC_STEP, NULL);
+    janet_probe1(gc__end, JANET_TRACE_GC_STEP);
+    if (janet_vm.gc_phase == JANET_GC_IDLE) {
+        janet_gc_record_collection(1);
+    }
+}
+
+void janet_gc_idle_step(void) {
+    if (janet_vm.gc_suspend || janet_vm.gc_phase == JANET_GC_IDLE) return;
+    janet_gc_step(janet_vm.gc_step_budget ? janet_vm.gc_step_budget : SIZE_MAX);
+    janet_free_all_scratch();
+}
+
+/* Move the blocks in the arena to the front of the young generation */
+static void janet_gc_arena_merge(void) {
+    if (NULL == janet_vm.gc_arena) return;
+    janet_vm.gc_arena_tail->data.next = janet_vm.blocks;
+    janet_vm.blocks = janet_vm.gc_arena;
+    janet_vm.gc_arena = NULL;
+    janet_vm.gc_arena_tail = NULL;
+    janet_vm.gc_arena_count = 0;
+}
+
+/* Free the garbage in the arena of a fiber that has finished. Marking is the same
+ * as for a minor collection, but only the arena is swept. The marks are then
+ * cleared again, so the young generation and the surviving arena blocks stay
+ * young, and the remembered set is kept for the next minor collection. */
+static void janet_collect_arena(JanetFiber *fiber, Janet result) {
+    JanetGCObject *survivors = NULL;
+    JanetGCObject *survivors_tail = NULL;
+    JanetGCObject *current;
+    double start = janet_gc_clock();
+    double mark_end;
+    janet_probe1(gc__begin, JANET_TRACE_GC_ARENA);
+    janet_trace(JANET_TRACE_GC, JANET_TRACE_GC_BEGIN, JANET_TRACE_GC_ARENA, NULL);
+    janet_gcroot(janet_wrap_fiber(fiber));
+    janet_gcroot(result);
+    janet_mark_roots(0);
+    janet_vm.root_count -= 2;
+    mark_end = janet_gc_clock();
+    current = janet_vm.gc_arena;
+    while (NULL != current) {
+        JanetGCObject *next = current->data.next;
+        if (current->flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
+            current->flags &= ~JANET_MEM_REACHABLE;
+            if (NULL == survivors) survivors_tail = current;
+            current->data.next = survivors;
+            survivors = current;
+        } else {
+            janet_sweep_block(current);
+        }
+        current = next;
+    }
+    for (current = janet_vm.blocks; current != janet_vm.old_blocks; current = current->data.next) {
+        current->flags &= ~JANET_MEM_REACHABLE;
+    }
+    janet_sweep_threaded_abstracts(0);
+    janet_vm.gc_arena = survivors;
+    janet_vm.gc_arena_tail = survivors_tail;
+    janet_gc_arena_merge();
+    /* Garbage that never left the arena should not count towards the next collection */
+    if (janet_vm.next_collection > janet_vm.gc_freed_bytes) {
+        janet_vm.next_collection -= janet_vm.gc_freed_bytes;
+    } else {
+        janet_vm.next_collection = 0;
+    }
+    janet_gc_record_pause(mark_end - start, janet_gc_clock() - mark_end);
+    janet_gc_record_collection(0);
+    janet_trace(JANET_TRACE_GC, JANET_TRACE_GC_END, JANET_TRACE_GC_ARENA, NULL);
+    janet_probe1(gc__end, JANET_TRACE_GC_ARENA);
+}
+
+void janet_gc_arena_enter(JanetFiber *fiber) {
+    if (NULL == janet_vm.gc_arena_fiber && (fiber->flags & JANET_FIBER_ARENA)) {
+        janet_vm.gc_arena_fiber = fiber;
+    }
+}
+
+/* A fiber that yields keeps nothing in the arena, since the objects it allocated
+ * may be used when it is resumed. */
+void janet_gc_arena_exit(JanetFiber *fiber, JanetSignal sig, Janet result) {
+    if (janet_vm.gc_arena_fiber != fiber) return;
+    janet_vm.gc_arena_fiber = NULL;
+    if ((sig == JANET_SIGNAL_OK || sig == JANET_SIGNAL_ERROR) &&
+            janet_vm.gc_arena_count >= JANET_GC_ARENA_MIN_BLOCKS &&
+            !janet_vm.gc_suspend &&
+            janet_vm.gc_phase == JANET_GC_IDLE) {
+        janet_collect_arena(fiber, result);
+    } else {
+        janet_gc_arena_merge();
+    }
+}
+
+/* Run garbage collection over the whole heap */
+void janet_collect(void) {
+    double start, mark_end;
+    if (janet_vm.gc_suspend) return;
+    start = janet_gc_clock();
+    janet_probe1(gc__begin, JANET_TRACE_GC_MAJOR);
+    janet_trace(JANET_TRACE_GC, JANET_TRACE_GC_BEGIN, JANET_TRACE_GC_MAJOR, NULL);
+    janet_gc_arena_merge();
+    janet_gc_abort_incremental();
+    /* Clear sticky marks so the whole heap is traced */
+    for (JanetGCObject *current = janet_vm.blocks; NULL != current; current = current->data.next) {
+        current->flags &= ~JANET_MEM_REACHABLE;
+    }
+    janet_mark_roots(1);
+    janet_gc_forget();
+    mark_end = janet_gc_clock();
     janet_sweep();
+    janet_vm.old_block_count = janet_vm.block_count;
+    janet_vm.major_block_limit = 2 * janet_vm.block_count + JANET_GC_MIN_MAJOR_LIMIT;
     janet_vm.next_collection = 0;
     janet_free_all_scratch();
+    janet_gc_record_pause(mark_end - start, janet_gc_clock() - mark_end);
+    janet_gc_record_collection(1);
+    janet_trace(JANET_TRACE_GC, JANET_TRACE_GC_END, JANET_TRACE_GC_MAJOR, NULL);
+    janet_probe1(gc__end, JANET_TRACE_GC_MAJOR);
+}
+
+/* Run garbage collection over only the objects allocated since the last collection.
+ * Once the old generation has grown too much, do a full collection instead. */
+void janet_collect_minor(void) {
+    double start, mark_end;
+    if (janet_vm.gc_suspend) return;
+    janet_gc_arena_merge();
+    if (janet_vm.gc_phase != JANET_GC_IDLE) {
+        janet_gc_step(janet_vm.gc_step_budget ? janet_vm.gc_step_budget : SIZE_MAX);
+        janet_vm.next_collection = 0;
+        janet_free_all_scratch();
+        return;
+    }
+    if (janet_vm.old_block_count >= janet_vm.major_block_limit) {
+        if (janet_vm.gc_step_budget) {
+            janet_gc_begin_incremental();
+            janet_vm.next_collection = 0;
+        } else {
+            janet_collect();
+        }
+        return;
+    }
+    start = janet_gc_clock();
+    janet_probe1(gc__begin, JANET_TRACE_GC_MINOR);
+    janet_trace(JANET_TRACE_GC, JANET_TRACE_GC_BEGIN, JANET_TRACE_GC_MINOR, NULL);
+    janet_mark_roots(0);
+    janet_gc_forget();
+    mark_end = janet_gc_clock();
+    janet_sweep_blocks(janet_vm.old_blocks);
+    janet_vm.old_block_count = janet_vm.block_count;
+    janet_vm.next_collection = 0;
+    janet_free_all_scratch();
+    janet_gc_record_pause(mark_end - start, janet_gc_clock() - mark_end);
+    janet_gc_record_collection(0);
+    janet_trace(JANET_TRACE_GC, JANET_TRACE_GC_END, JANET_TRACE_GC_MINOR, NULL);
+    janet_probe1(gc__end, JANET_TRACE_GC_MINOR);
 }
 
 /* Add a root value to the GC. This prevents the GC from removing a value
@@ -532,14 +1277,25 @@ void janet_clear_memory(void) {
         }
     }
 #endif
+    janet_gc_arena_merge();
     JanetGCObject *current = janet_vm.blocks;
     while (NULL != current) {
         janet_deinit_block(current);
         JanetGCObject *next = current->data.next;
-        janet_free(current);
+        if (!(current->flags & JANET_MEM_POOLBITS)) {
+            janet_free(current);
+        }
         current = next;
     }
     janet_vm.blocks = NULL;
+    janet_gc_pool_release();
+    janet_fiber_pool_release();
+    janet_vm.old_blocks = NULL;
+    janet_free(janet_vm.gc_remembered.items);
+    janet_free(janet_vm.gc_rescan.items);
+    janet_free(janet_vm.buffer_borrows.items);
+    janet_free(janet_vm.gc_gray.items);
+    janet_free(janet_vm.gc_samples);
     janet_free_all_scratch();
     janet_free(janet_vm.scratch_mem);
 }
@@ -552,14 +1308,215 @@ void janet_gcunlock(int handle) {
     janet_vm.gc_suspend = handle;
 }
 
-/* Scratch memory API */
+/* Garbage collection statistics */
+void janet_gcstats(JanetGCStats *stats) {
+    *stats = janet_vm.gc_stats;
+    stats->block_count = janet_vm.block_count;
+    stats->next_collection = janet_vm.next_collection;
+}
 
-void *janet_smalloc(size_t size) {
-    JanetScratch *s = janet_malloc(sizeof(JanetScratch) + size);
-    if (NULL == s) {
-        JANET_OUT_OF_MEMORY;
+/* Count the objects of each type on the heap. types must have room
+ * for JANET_GC_TYPE_COUNT entries, and is indexed by memory type. */
+void janet_gcstats_types(JanetGCTypeStats *types) {
+    for (int i = 0; i < JANET_GC_TYPE_COUNT; i++) {
+        types[i].name = janet_gc_type_names[i];
+        types[i].count = 0;
+        types[i].bytes = 0;
     }
-    s->finalize = NULL;
+    for (int arena = 0; arena < 2; arena++) {
+        JanetGCObject *current = arena ? janet_vm.gc_arena : janet_vm.blocks;
+        for (; NULL != current; current = current->data.next) {
+            int type = current->flags & JANET_MEM_TYPEBITS;
+            if (type >= JANET_GC_TYPE_COUNT) continue;
+            types[type].count++;
+            types[type].bytes += janet_gc_block_size(current, 0);
+        }
+    }
+}
+
+/* Set a function to call after each collection. Pass NULL to remove it. */
+void janet_gcsethook(JanetGCHook hook, void *data) {
+    janet_vm.gc_hook = hook;
+    janet_vm.gc_hook_data = data;
+}
+
+/* Heap snapshots */
+
+static void janet_snapshot_hex(const void *mem) {
+    uintptr_t x = (uintptr_t) mem;
+    uint8_t digits[2 * sizeof(uintptr_t)];
+    int n = 0;
+    do {
+        digits[n++] = "0123456789abcdef"[x & 0xF];
+        x >>= 4;
+    } while (x);
+    while (n) janet_buffer_push_u8(snapshot, digits[--n]);
+}
+
+static void janet_snapshot_id(const void *mem) {
+    janet_buffer_push_u8(snapshot, ' ');
+    janet_snapshot_hex(janet_gc_header(mem));
+}
+
+static void janet_snapshot_ref(Janet x) {
+    JanetGCObject *mem = janet_gc_value_header(x);
+    if (NULL != mem) janet_snapshot_id(mem);
+}
+
+static void janet_snapshot_refs(const Janet *values, int32_t n) {
+    if (NULL == values) return;
+    for (int32_t i = 0; i < n; i++) janet_snapshot_ref(values[i]);
+}
+
+static void janet_snapshot_kvs(const JanetKV *kvs, int32_t n) {
+    for (int32_t i = 0; i < n; i++) {
+        janet_snapshot_ref(kvs[i].key);
+        janet_snapshot_ref(kvs[i].value);
+    }
+}
+
+/* Write the references held by a block. This mirrors janet_blacken, without
+ * changing the block. */
+static void janet_snapshot_children(JanetGCObject *mem) {
+    switch (mem->flags & JANET_MEM_TYPEBITS) {
+        default:
+            break;
+        case JANET_MEMORY_ARRAY: {
+            JanetArray *array = (JanetArray *) mem;
+            janet_snapshot_refs(array->data, array->count);
+        }
+        break;
+        case JANET_MEMORY_TUPLE: {
+            const Janet *tuple = janet_tuple_from_head(mem);
+            janet_snapshot_refs(tuple, janet_tuple_length(tuple));
+        }
+        break;
+        case JANET_MEMORY_TABLE: {
+            JanetTable *table = (JanetTable *) mem;
+            janet_snapshot_kvs(table->data, table->capacity);
+            if (table->proto) janet_snapshot_id(table->proto);
+        }
+        break;
+        case JANET_MEMORY_STRUCT: {
+            const JanetKV *st = (const JanetKV *)(((JanetStructHead *) mem)->data);
+            janet_snapshot_kvs(st, janet_struct_capacity(st));
+            if (janet_struct_proto(st)) janet_snapshot_id(janet_struct_head(janet_struct_proto(st)));
+        }
+        break;
+        case JANET_MEMORY_FUNCTION: {
+            JanetFunction *func = (JanetFunction *) mem;
+            if (NULL != func->def) {
+                for (int32_t i = 0; i < func->def->environments_length; i++) {
+                    janet_snapshot_id(func->envs[i]);
+                }
+                janet_snapshot_id(func->def);
+            }
+        }
+        break;
+        case JANET_MEMORY_FUNCENV: {
+            JanetFuncEnv *env = (JanetFuncEnv *) mem;
+            if (env->offset > 0) {
+                janet_snapshot_id(env->as.fiber);
+            } else {
+                janet_snapshot_refs(env->as.values, env->length);
+            }
+        }
+        break;
+        case JANET_MEMORY_FUNCDEF: {
+            JanetFuncDef *def = (JanetFuncDef *) mem;
+            janet_snapshot_refs(def->constants, def->constants_length);
+            for (int32_t i = 0; i < def->defs_length; i++) {
+                janet_snapshot_id(def->defs[i]);
+            }
+            if (def->source) janet_snapshot_id(janet_string_head(def->source));
+            if (def->name) janet_snapshot_id(janet_string_head(def->name));
+        }
+        break;
+        case JANET_MEMORY_FIBER: {
+            JanetFiber *fiber = (JanetFiber *) mem;
+            int32_t i = fiber->frame;
+            int32_t j = fiber->stackstart - JANET_FRAME_SIZE;
+            janet_snapshot_ref(fiber->last_value);
+            janet_snapshot_refs(fiber->data + fiber->stackstart, fiber->stacktop - fiber->stackstart);
+            while (i > 0) {
+                JanetStackFrame *frame = (JanetStackFrame *)(fiber->data + i - JANET_FRAME_SIZE);
+                if (NULL != frame->func) janet_snapshot_id(frame->func);
+                if (NULL != frame->env) janet_snapshot_id(frame->env);
+                janet_snapshot_refs(fiber->data + i, j - i);
+                j = i - JANET_FRAME_SIZE;
+                i = frame->prevframe;
+            }
+            if (fiber->env) janet_snapshot_id(fiber->env);
+            if (fiber->child) janet_snapshot_id(fiber->child);
+#ifdef JANET_EV
+            if (fiber->supervisor_channel) janet_snapshot_ref(janet_wrap_abstract(fiber->supervisor_channel));
+#endif
+        }
+        break;
+        case JANET_MEMORY_ABSTRACT: {
+            JanetAbstractHead *head = (JanetAbstractHead *) mem;
+            if (head->type->gcmark) {
+                head->type->gcmark(head->data, head->size);
+            }
+        }
+        break;
+    }
+}
+
+/* Write a snapshot of the heap to a buffer. The first line lists the roots, and each
+ * following line describes a block, as space separated fields:
+ *
+ *   root <id>...
+ *   <id> <type> <bytes> <referenced id>...
+ *
+ * Ids are block addresses in hexadecimal. Bytes is the approximate size of the block,
+ * including memory it owns outside of the gc heap. */
+void janet_heap_snapshot(JanetBuffer *buffer) {
+    janet_buffer_push_cstring(buffer, "root");
+    snapshot = buffer;
+#ifdef JANET_EV
+    janet_ev_mark();
+#endif
+    if (NULL != janet_vm.root_fiber) janet_snapshot_id(janet_vm.root_fiber);
+    janet_snapshot_refs(janet_vm.roots, (int32_t) janet_vm.root_count);
+    janet_buffer_push_u8(buffer, '\n');
+    for (int arena = 0; arena < 2; arena++) {
+        JanetGCObject *current = arena ? janet_vm.gc_arena : janet_vm.blocks;
+        for (; NULL != current; current = current->data.next) {
+            int type = current->flags & JANET_MEM_TYPEBITS;
+            char size[32];
+            if (type >= JANET_GC_TYPE_COUNT) continue;
+            janet_snapshot_hex(current);
+            janet_buffer_push_u8(buffer, ' ');
+            janet_buffer_push_cstring(buffer, janet_gc_type_names[type]);
+            snprintf(size, sizeof(size), " %lu", (unsigned long) janet_gc_block_size(current, 0));
+            janet_buffer_push_cstring(buffer, size);
+            janet_snapshot_children(current);
+            janet_buffer_push_u8(buffer, '\n');
+        }
+    }
+    snapshot = NULL;
+}
+
+/* Allocation sampling. A rate of 0 disables sampling. */
+void janet_gcsample(size_t rate) {
+    janet_vm.gc_sample_rate = rate;
+    janet_vm.gc_sample_countdown = rate;
+}
+
+size_t janet_gcsamples(const JanetGCSample **samples) {
+    *samples = janet_vm.gc_samples;
+    return janet_vm.gc_sample_count;
+}
+
+void janet_gcsamples_clear(void) {
+    janet_vm.gc_sample_count = 0;
+    janet_vm.gc_sample_next = 0;
+}
+
+/* Scratch memory API */
+
+static void janet_scratch_track(JanetScratch *s) {
     if (janet_vm.scratch_len == janet_vm.scratch_cap) {
         size_t newcap = 2 * janet_vm.scratch_cap + 2;
         JanetScratch **newmem = (JanetScratch **) janet_realloc(janet_vm.scratch_mem, newcap * sizeof(JanetScratch));
@@ -570,6 +1527,15 @@ void *janet_smalloc(size_t size) {
         janet_vm.scratch_mem = newmem;
     }
     janet_vm.scratch_mem[janet_vm.scratch_len++] = s;
+}
+
+void *janet_smalloc(size_t size) {
+    JanetScratch *s = janet_malloc(sizeof(JanetScratch) + size);
+    if (NULL == s) {
+        JANET_OUT_OF_MEMORY;
+    }
+    s->finalize = NULL;
+    janet_scratch_track(s);
     return (char *)(s->mem);
 }
 
@@ -607,6 +1573,26 @@ void janet_sfinalizer(void *mem, JanetScratchFinalizer finalizer) {
     s->finalize = finalizer;
 }
 
+void janet_sdetach(void *mem) {
+    if (NULL == mem) return;
+    JanetScratch *s = janet_mem2scratch(mem);
+    if (janet_vm.scratch_len) {
+        for (size_t i = janet_vm.scratch_len - 1; ; i--) {
+            if (janet_vm.scratch_mem[i] == s) {
+                janet_vm.scratch_mem[i] = janet_vm.scratch_mem[--janet_vm.scratch_len];
+                return;
+            }
+            if (i == 0) break;
+        }
+    }
+    JANET_EXIT("invalid janet_sdetach");
+}
+
+void janet_sattach(void *mem) {
+    if (NULL == mem) return;
+    janet_scratch_track(janet_mem2scratch(mem));
+}
+
 void janet_sfree(void *mem) {
     if (NULL == mem) return;
     JanetScratch *s = janet_mem2scratch(mem);
@@ -34,6 +34,15 @@
 #define JANET_MEM_TYPEBITS 0xFF
 #define JANET_MEM_REACHABLE 0x100
 #define JANET_MEM_DISABLED 0x200
+#define JANET_MEM_REMEMBERED 0x400
+
+/* Size class of a pooled block, or 0 if the block was allocated with janet_malloc */
+#define JANET_MEM_POOLBITS 0x3800
+#define JANET_MEM_POOLSHIFT 11
+
+/* Number of borrowers of a buffer's memory, see janet_buffer_borrow */
+#define JANET_MEM_BORROWBITS 0x7FFF0000
+#define JANET_MEM_BORROWONE 0x10000
 
 #define janet_gc_settype(m, t) ((janet_gc_header(m)->flags |= (0xFF & (t))))
 #define janet_gc_type(m) (janet_gc_header(m)->flags & 0xFF)
@@ -41,6 +50,39 @@
 #define janet_gc_mark(m) (janet_gc_header(m)->flags |= JANET_MEM_REACHABLE)
 #define janet_gc_reachable(m) (janet_gc_header(m)->flags & JANET_MEM_REACHABLE)
 
+/* The collector is generational and uses sticky mark bits - objects that survive
+ * a collection keep their reachable bit, which makes them part of the old generation.
+ * Outside of a collection, a set reachable bit therefore means an object is old.
+ * Storing a reference into a mutable object that may be old must go through a
+ * write barrier so minor collections can find references from old objects to young ones.
+ * janet_gc_barrier_value(m, x) should be used before storing the value x into m, and
+ * remembers only x. janet_gc_barrier(m) remembers the whole object m, and is for code
+ * that writes into m without knowing the values ahead of time. */
+#define janet_gc_barrier(m) do { \
+    if ((janet_gc_header(m)->flags & (JANET_MEM_REACHABLE | JANET_MEM_REMEMBERED)) == JANET_MEM_REACHABLE) \
+        janet_gc_remember(janet_gc_header(m)); \
+} while (0)
+#define janet_gc_barrier_value(m, x) do { \
+    if (janet_gc_reachable(m)) janet_gc_remember_value(x); \
+} while (0)
+
+/* Phases of an incremental collection. Outside of an incremental collection the
+ * phase is JANET_GC_IDLE. */
+#define JANET_GC_IDLE 0
+#define JANET_GC_CLEAR 1
+#define JANET_GC_MARK 2
+#define JANET_GC_SWEEP 3
+
+/* Bytes that can be allocated per unit of step budget before the next incremental step */
+#define JANET_GC_STEP_RATIO 8
+
+/* Arenas with fewer blocks than this are merged into the young generation
+ * when their fiber finishes instead of being collected */
+#define JANET_GC_ARENA_MIN_BLOCKS 256
+
+/* Maximum number of allocation samples kept */
+#define JANET_GC_SAMPLE_MAX 0x10000
+
 /* Memory types for the GC. Different from JanetType to include funcenv and funcdef. */
 enum JanetMemoryType {
     JANET_MEMORY_NONE,
@@ -59,8 +101,29 @@ enum JanetMemoryType {
     JANET_MEMORY_THREADED_ABSTRACT,
 };
 
+/* Names of the memory types, indexed by type */
+extern const char *const janet_gc_type_names[JANET_GC_TYPE_COUNT];
+
 /* To allocate collectable memory, one must call janet_alloc, initialize the memory,
  * and then call when janet_enablegc when it is initailize and reachable by the gc (on the JANET stack) */
 void *janet_gcalloc(enum JanetMemoryType type, size_t size);
 
+/* Slow path of the write barrier - add an old object to the remembered set */
+void janet_gc_remember(JanetGCObject *mem);
+
+/* Slow path of the value write barrier - remember a value stored into an old object */
+void janet_gc_remember_value(Janet x);
+
+/* Advance an incremental collection in progress while the event loop is idle */
+void janet_gc_idle_step(void);
+
+/* Detached scratch memory is not freed by collections, and must be attached
+ * again before it can be reallocated or freed. */
+void janet_sdetach(void *mem);
+void janet_sattach(void *mem);
+
+/* Start and stop allocating into the arena of a fiber with JANET_FIBER_ARENA */
+void janet_gc_arena_enter(JanetFiber *fiber);
+void janet_gc_arena_exit(JanetFiber *fiber, JanetSignal sig, Janet result);
+
 #endif
@@ -0,0 +1,737 @@
+/*
+* Copyright (c) 2021 Calvin Rose
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to
+* deal in the Software without restriction, including without limitation the
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+* sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#ifndef JANET_AMALG
+#include "features.h"
+#include <janet.h>
+#include "util.h"
+#include <math.h>
+#endif
+
+/* Persistent hash maps. An hmap is a hash array mapped trie: each node
+ * uses 5 bits of a key's hash to pick one of 32 positions, which hold
+ * either an entry or a child node. Adding or removing a key copies only
+ * the nodes on the path to that key, and the new map shares every other
+ * node with the old one. The trie is kept in a canonical form, where an
+ * entry lives in the shallowest node its hash prefix allows, so equal
+ * maps have the same shape and iterate in the same order. */
+
+#define HMAP_BITS 5
+#define HMAP_MAX_SHIFT 32
+
+/* A node holds the key value pairs of the positions in datamap, then the
+ * child nodes of the positions in nodemap. Below the last level of hash
+ * bits, a node holds keys with identical hashes, with the number of pairs
+ * in datamap and the keys sorted. */
+typedef struct {
+    uint32_t datamap;
+    uint32_t nodemap;
+    Janet slots[];
+} JanetHmapNode;
+
+typedef struct {
+    int32_t count;
+    uint32_t hash;
+    JanetHmapNode *root;
+} JanetHmap;
+
+/* Result of changing a subtrie */
+typedef struct {
+    int32_t added;
+    int32_t removed;
+    Janet old;
+} JanetHmapEdit;
+
+#ifdef __GNUC__
+#define hmap_popcount(x) __builtin_popcount(x)
+#else
+static int hmap_popcount(uint32_t x) {
+    int count = 0;
+    while (x) {
+        x &= x - 1;
+        count++;
+    }
+    return count;
+}
+#endif
+
+static int hmap_node_gcmark(void *p, size_t size) {
+    JanetHmapNode *node = (JanetHmapNode *) p;
+    size_t nslots = (size - sizeof(JanetHmapNode)) / sizeof(Janet);
+    for (size_t i = 0; i < nslots; i++) {
+        janet_mark(node->slots[i]);
+    }
+    return 0;
+}
+
+static const JanetAbstractType janet_hmap_node_type = {
+    "core/hmap-node",
+    NULL,
+    hmap_node_gcmark,
+    JANET_ATEND_GCMARK
+};
+
+static int hmap_collision(int shift) {
+    return shift >= HMAP_MAX_SHIFT;
+}
+
+static int32_t hmap_entries(const JanetHmapNode *node, int shift) {
+    return hmap_collision(shift) ? (int32_t) node->datamap : hmap_popcount(node->datamap);
+}
+
+static uint32_t hmap_bit(uint32_t hash, int shift) {
+    return (uint32_t) 1 << ((hash >> shift) & 31);
+}
+
+static int32_t hmap_index(uint32_t map, uint32_t bit) {
+    return hmap_popcount(map & (bit - 1));
+}
+
+static JanetHmapNode *hmap_child(const JanetHmapNode *node, int32_t entries, int32_t index) {
+    return (JanetHmapNode *) janet_unwrap_abstract(node->slots[2 * entries + index]);
+}
+
+static JanetHmapNode *hmap_node(uint32_t datamap, uint32_t nodemap, int32_t nslots) {
+    JanetHmapNode *node = janet_abstract(&janet_hmap_node_type,
+                                         sizeof(JanetHmapNode) + (size_t) nslots * sizeof(Janet));
+    node->datamap = datamap;
+    node->nodemap = nodemap;
+    return node;
+}
+
+/* Number of slots in a node */
+static int32_t hmap_nslots(const JanetHmapNode *node, int shift) {
+    return 2 * hmap_entries(node, shift) + hmap_popcount(node->nodemap);
+}
+
+static JanetHmapNode *hmap_copy(const JanetHmapNode *node, int shift) {
+    int32_t nslots = hmap_nslots(node, shift);
+    JanetHmapNode *copy = hmap_node(node->datamap, node->nodemap, nslots);
+    memcpy(copy->slots, node->slots, (size_t) nslots * sizeof(Janet));
+    return copy;
+}
+
+/* Find the value slot of a key */
+static const Janet *hmap_find(const JanetHmapNode *node, Janet key, uint32_t hash) {
+    for (int shift = 0; NULL != node; shift += HMAP_BITS) {
+        if (hmap_collision(shift)) {
+            for (uint32_t i = 0; i < node->datamap; i++) {
+                if (janet_equals(node->slots[2 * i], key)) return node->slots + 2 * i + 1;
+            }
+            return NULL;
+        }
+        uint32_t bit = hmap_bit(hash, shift);
+        if (node->datamap & bit) {
+            int32_t i = hmap_index(node->datamap, bit);
+            return janet_equals(node->slots[2 * i], key) ? node->slots + 2 * i + 1 : NULL;
+        }
+        if (!(node->nodemap & bit)) return NULL;
+        node = hmap_child(node, hmap_popcount(node->datamap), hmap_index(node->nodemap, bit));
+    }
+    return NULL;
+}
+
+/* Make a subtrie from two keys with different keys but the same hash prefix */
+static JanetHmapNode *hmap_pair(int shift,
+                                Janet k1, Janet v1, uint32_t h1,
+                                Janet k2, Janet v2, uint32_t h2) {
+    if (hmap_collision(shift)) {
+        JanetHmapNode *node = hmap_node(2, 0, 4);
+        int swap = janet_compare(k1, k2) > 0;
+        node->slots[swap ? 2 : 0] = k1;
+        node->slots[swap ? 3 : 1] = v1;
+        node->slots[swap ? 0 : 2] = k2;
+        node->slots[swap ? 1 : 3] = v2;
+        return node;
+    }
+    uint32_t b1 = hmap_bit(h1, shift);
+    uint32_t b2 = hmap_bit(h2, shift);
+    if (b1 == b2) {
+        JanetHmapNode *node = hmap_node(0, b1, 1);
+        node->slots[0] = janet_wrap_abstract(hmap_pair(shift + HMAP_BITS, k1, v1, h1, k2, v2, h2));
+        return node;
+    }
+    JanetHmapNode *node = hmap_node(b1 | b2, 0, 4);
+    int swap = b1 > b2;
+    node->slots[swap ? 2 : 0] = k1;
+    node->slots[swap ? 3 : 1] = v1;
+    node->slots[swap ? 0 : 2] = k2;
+    node->slots[swap ? 1 : 3] = v2;
+    return node;
+}
+
+/* Copy a node, inserting count slots at index */
+static JanetHmapNode *hmap_insert_slots(const JanetHmapNode *node, int shift,
+                                        uint32_t datamap, uint32_t nodemap,
+                                        int32_t index, int32_t count) {
+    int32_t nslots = hmap_nslots(node, shift);
+    JanetHmapNode *copy = hmap_node(datamap, nodemap, nslots + count);
+    memcpy(copy->slots, node->slots, (size_t) index * sizeof(Janet));
+    memcpy(copy->slots + index + count, node->slots + index, (size_t)(nslots - index) * sizeof(Janet));
+    return copy;
+}
+
+/* Copy a node, removing count slots at index */
+static JanetHmapNode *hmap_remove_slots(const JanetHmapNode *node, int shift,
+                                        uint32_t datamap, uint32_t nodemap,
+                                        int32_t index, int32_t count) {
+    int32_t nslots = hmap_nslots(node, shift);
+    JanetHmapNode *copy = hmap_node(datamap, nodemap, nslots - count);
+    memcpy(copy->slots, node->slots, (size_t) index * sizeof(Janet));
+    memcpy(copy->slots + index, node->slots + index + count, (size_t)(nslots - index - count) * sizeof(Janet));
+    return copy;
+}
+
+static JanetHmapNode *hmap_assoc(const JanetHmapNode *node, int shift, uint32_t hash,
+                                 Janet key, Janet value, JanetHmapEdit *edit) {
+    if (NULL == node) {
+        JanetHmapNode *leaf = hmap_node(hmap_collision(shift) ? 1 : hmap_bit(hash, shift), 0, 2);
+        leaf->slots[0] = key;
+        leaf->slots[1] = value;
+        edit->added = 1;
+        return leaf;
+    }
+    if (hmap_collision(shift)) {
+        int32_t n = (int32_t) node->datamap;
+        int32_t i = 0;
+        for (; i < n; i++) {
+            int cmp = janet_compare(node->slots[2 * i], key);
+            if (cmp == 0) break;
+            if (cmp > 0) break;
+        }
+        if (i < n && janet_equals(node->slots[2 * i], key)) {
+            edit->old = node->slots[2 * i + 1];
+            if (janet_equals(edit->old, value)) return (JanetHmapNode *) node;
+            JanetHmapNode *copy = hmap_copy(node, shift);
+            copy->slots[2 * i + 1] = value;
+            return copy;
+        }
+        JanetHmapNode *copy = hmap_insert_slots(node, shift, (uint32_t)(n + 1), 0, 2 * i, 2);
+        copy->slots[2 * i] = key;
+        copy->slots[2 * i + 1] = value;
+        edit->added = 1;
+        return copy;
+    }
+    uint32_t bit = hmap_bit(hash, shift);
+    int32_t entries = hmap_popcount(node->datamap);
+    if (node->datamap & bit) {
+        int32_t i = hmap_index(node->datamap, bit);
+        Janet oldkey = node->slots[2 * i];
+        Janet oldvalue = node->slots[2 * i + 1];
+        if (janet_equals(oldkey, key)) {
+            edit->old = oldvalue;
+            if (janet_equals(oldvalue, value)) return (JanetHmapNode *) node;
+            JanetHmapNode *copy = hmap_copy(node, shift);
+            copy->slots[2 * i + 1] = value;
+            return copy;
+        }
+        /* Move the existing entry and the new one into a child node */
+        JanetHmapNode *child = hmap_pair(shift + HMAP_BITS,
+                                         oldkey, oldvalue, (uint32_t) janet_hash(oldkey),
+                                         key, value, hash);
+        int32_t j = hmap_index(node->nodemap, bit);
+        int32_t nslots = hmap_nslots(node, shift);
+        JanetHmapNode *copy = hmap_node(node->datamap ^ bit, node->nodemap | bit, nslots - 1);
+        int32_t childslot = 2 * (entries - 1) + j;
+        memcpy(copy->slots, node->slots, (size_t)(2 * i) * sizeof(Janet));
+        memcpy(copy->slots + 2 * i, node->slots + 2 * i + 2, (size_t)(childslot - 2 * i) * sizeof(Janet));
+        copy->slots[childslot] = janet_wrap_abstract(child);
+        memcpy(copy->slots + childslot + 1, node->slots + childslot + 2,
+               (size_t)(nslots - childslot - 2) * sizeof(Janet));
+        edit->added = 1;
+        return copy;
+    }
+    if (node->nodemap & bit) {
+        int32_t j = hmap_index(node->nodemap, bit);
+        JanetHmapNode *child = hmap_child(node, entries, j);
+        JanetHmapNode *newchild = hmap_assoc(child, shift + HMAP_BITS, hash, key, value, edit);
+        if (newchild == child) return (JanetHmapNode *) node;
+        JanetHmapNode *copy = hmap_copy(node, shift);
+        copy->slots[2 * entries + j] = janet_wrap_abstract(newchild);
+        return copy;
+    }
+    int32_t i = hmap_index(node->datamap, bit);
+    JanetHmapNode *copy = hmap_insert_slots(node, shift, node->datamap | bit, node->nodemap, 2 * i, 2);
+    copy->slots[2 * i] = key;
+    copy->slots[2 * i + 1] = value;
+    edit->added = 1;
+    return copy;
+}
+
+/* Returns NULL if the node has no entries left */
+static JanetHmapNode *hmap_dissoc(const JanetHmapNode *node, int shift, uint32_t hash,
+                                  Janet key, JanetHmapEdit *edit) {
+    if (NULL == node) return NULL;
+    if (hmap_collision(shift)) {
+        int32_t n = (int32_t) node->datamap;
+        for (int32_t i = 0; i < n; i++) {
+            if (janet_equals(node->slots[2 * i], key)) {
+                edit->old = node->slots[2 * i + 1];
+                edit->removed = 1;
+                if (n == 1) return NULL;
+                return hmap_remove_slots(node, shift, (uint32_t)(n - 1), 0, 2 * i, 2);
+            }
+        }
+        return (JanetHmapNode *) node;
+    }
+    uint32_t bit = hmap_bit(hash, shift);
+    int32_t entries = hmap_popcount(node->datamap);
+    if (node->datamap & bit) {
+        int32_t i = hmap_index(node->datamap, bit);
+        if (!janet_equals(node->slots[2 * i], key)) return (JanetHmapNode *) node;
+        edit->old = node->slots[2 * i + 1];
+        edit->removed = 1;
+        if (entries == 1 && node->nodemap == 0) return NULL;
+        return hmap_remove_slots(node, shift, node->datamap ^ bit, node->nodemap, 2 * i, 2);
+    }
+    if (node->nodemap & bit) {
+        int32_t j = hmap_index(node->nodemap, bit);
+        JanetHmapNode *child = hmap_child(node, entries, j);
+        JanetHmapNode *newchild = hmap_dissoc(child, shift + HMAP_BITS, hash, key, edit);
+        if (newchild == child) return (JanetHmapNode *) node;
+        if (NULL != newchild && (newchild->nodemap != 0 || hmap_entries(newchild, shift + HMAP_BITS) != 1)) {
+            JanetHmapNode *copy = hmap_copy(node, shift);
+            copy->slots[2 * entries + j] = janet_wrap_abstract(newchild);
+            return copy;
+        }
+        /* A child with a single entry is replaced by the entry. Children
+         * always had at least two entries, so newchild is not NULL. */
+        int32_t i = hmap_index(node->datamap, bit);
+        int32_t nslots = hmap_nslots(node, shift);
+        int32_t childslot = 2 * entries + j;
+        JanetHmapNode *copy = hmap_node(node->datamap | bit, node->nodemap ^ bit, nslots + 1);
+        memcpy(copy->slots, node->slots, (size_t)(2 * i) * sizeof(Janet));
+        copy->slots[2 * i] = newchild->slots[0];
+        copy->slots[2 * i + 1] = newchild->slots[1];
+        memcpy(copy->slots + 2 * i + 2, node->slots + 2 * i, (size_t)(childslot - 2 * i) * sizeof(Janet));
+        memcpy(copy->slots + childslot + 2, node->slots + childslot + 1,
+               (size_t)(nslots - childslot - 1) * sizeof(Janet));
+        return copy;
+    }
+    return (JanetHmapNode *) node;
+}
+
+/* Iteration order is the entries of a node, then its children */
+static Janet hmap_first(const JanetHmapNode *node) {
+    while (node->datamap == 0) {
+        node = (JanetHmapNode *) janet_unwrap_abstract(node->slots[0]);
+    }
+    return node->slots[0];
+}
+
+#define HMAP_MISSING 0
+#define HMAP_END 1
+#define HMAP_NEXT 2
+
+static int hmap_next(const JanetHmapNode *node, int shift, uint32_t hash, Janet key, Janet *out) {
+    int32_t entries = hmap_entries(node, shift);
+    int32_t nodes = hmap_popcount(node->nodemap);
+    int32_t j;
+    if (hmap_collision(shift)) {
+        int32_t i = 0;
+        while (i < entries && !janet_equals(node->slots[2 * i], key)) i++;
+        if (i == entries) return HMAP_MISSING;
+        if (i + 1 == entries) return HMAP_END;
+        *out = node->slots[2 * i + 2];
+        return HMAP_NEXT;
+    }
+    uint32_t bit = hmap_bit(hash, shift);
+    if (node->datamap & bit) {
+        int32_t i = hmap_index(node->datamap, bit);
+        if (!janet_equals(node->slots[2 * i], key)) return HMAP_MISSING;
+        if (i + 1 < entries) {
+            *out = node->slots[2 * i + 2];
+            return HMAP_NEXT;
+        }
+        j = 0;
+    } else if (node->nodemap & bit) {
+        int32_t i = hmap_index(node->nodemap, bit);
+        int status = hmap_next(hmap_child(node, entries, i), shift + HMAP_BITS, hash, key, out);
+        if (status != HMAP_END) return status;
+        j = i + 1;
+    } else {
+        return HMAP_MISSING;
+    }
+    if (j >= nodes) return HMAP_END;
+    *out = hmap_first(hmap_child(node, entries, j));
+    return HMAP_NEXT;
+}
+
+/* Call fn on every entry, in iteration order */
+typedef void (*JanetHmapVisit)(void *data, Janet key, Janet value);
+
+static void hmap_visit(const JanetHmapNode *node, int shift, JanetHmapVisit fn, void *data) {
+    if (NULL == node) return;
+    int32_t entries = hmap_entries(node, shift);
+    int32_t nodes = hmap_popcount(node->nodemap);
+    for (int32_t i = 0; i < entries; i++) {
+        fn(data, node->slots[2 * i], node->slots[2 * i + 1]);
+    }
+    for (int32_t j = 0; j < nodes; j++) {
+        hmap_visit(hmap_child(node, entries, j), shift + HMAP_BITS, fn, data);
+    }
+}
+
+/* The hash of a map does not depend on the order of entries, so it is
+ * updated in constant time by each change */
+static uint32_t hmap_entry_hash(Janet key, Janet value) {
+    return janet_hash_mix((uint32_t) janet_hash(key), (uint32_t) janet_hash(value));
+}
+
+static JanetHmap *hmap_alloc(void);
+
+/* Change a map in place. Only used for maps no other code has seen yet. */
+static void hmap_put_mut(JanetHmap *m, Janet key, Janet value) {
+    if (janet_checktype(key, JANET_NIL)) return;
+    if (janet_checktype(key, JANET_NUMBER) && isnan(janet_unwrap_number(key))) return;
+    uint32_t hash = (uint32_t) janet_hash(key);
+    JanetHmapEdit edit = {0, 0, janet_wrap_nil()};
+    if (janet_checktype(value, JANET_NIL)) {
+        m->root = hmap_dissoc(m->root, 0, hash, key, &edit);
+        if (edit.removed) {
+            m->count--;
+            m->hash -= hmap_entry_hash(key, edit.old);
+        }
+    } else {
+        m->root = hmap_assoc(m->root, 0, hash, key, value, &edit);
+        if (edit.added) {
+            m->count++;
+        } else {
+            m->hash -= hmap_entry_hash(key, edit.old);
+        }
+        m->hash += hmap_entry_hash(key, value);
+    }
+}
+
+static JanetHmap *hmap_with(const JanetHmap *m, Janet key, Janet value) {
+    JanetHmap *ret = hmap_alloc();
+    *ret = *m;
+    hmap_put_mut(ret, key, value);
+    return ret;
+}
+
+static Janet hmap_get(const JanetHmap *m, Janet key) {
+    if (NULL == m->root) return janet_wrap_nil();
+    const Janet *v = hmap_find(m->root, key, (uint32_t) janet_hash(key));
+    return v ? *v : janet_wrap_nil();
+}
+
+/* Abstract type */
+
+static Janet hmap_length_method(int32_t argc, Janet *argv);
+
+static const JanetMethod hmap_methods[] = {
+    {"length", hmap_length_method},
+    {NULL, NULL}
+};
+
+static int hmap_gcmark(void *p, size_t size) {
+    (void) size;
+    JanetHmap *m = (JanetHmap *) p;
+    if (m->root) janet_mark(janet_wrap_abstract(m->root));
+    return 0;
+}
+
+/* Keys of the map come first, so the length method is only found when
+ * the map has no :length key. */
+static int hmap_getter(void *p, Janet key, Janet *out) {
+    JanetHmap *m = (JanetHmap *) p;
+    *out = hmap_get(m, key);
+    if (!janet_checktype(*out, JANET_NIL)) return 1;
+    if (!janet_checktype(key, JANET_KEYWORD)) return 0;
+    return janet_getmethod(janet_unwrap_keyword(key), hmap_methods, out);
+}
+
+static void hmap_marshal_entry(void *data, Janet key, Janet value) {
+    JanetMarshalContext *ctx = (JanetMarshalContext *) data;
+    janet_marshal_janet(ctx, key);
+    janet_marshal_janet(ctx, value);
+}
+
+static void hmap_marshal(void *p, JanetMarshalContext *ctx) {
+    JanetHmap *m = (JanetHmap *) p;
+    janet_marshal_abstract(ctx, p);
+    janet_marshal_int(ctx, m->count);
+    hmap_visit(m->root, 0, hmap_marshal_entry, ctx);
+}
+
+static void *hmap_unmarshal(JanetMarshalContext *ctx) {
+    JanetHmap *m = janet_unmarshal_abstract(ctx, sizeof(JanetHmap));
+    m->count = 0;
+    m->hash = 0;
+    m->root = NULL;
+    int32_t count = janet_unmarshal_int(ctx);
+    for (int32_t i = 0; i < count; i++) {
+        Janet key = janet_unmarshal_janet(ctx);
+        Janet value = janet_unmarshal_janet(ctx);
+        if (janet_checktype(value, JANET_NIL)) janet_panic("invalid hmap entry");
+        hmap_put_mut(m, key, value);
+    }
+    return m;
+}
+
+typedef struct {
+    JanetBuffer *buffer;
+    int first;
+} HmapPrint;
+
+static void hmap_tostring_entry(void *data, Janet key, Janet value) {
+    HmapPrint *print = (HmapPrint *) data;
+    if (!print->first) janet_buffer_push_u8(print->buffer, ' ');
+    print->first = 0;
+    janet_description_b(print->buffer, key);
+    janet_buffer_push_u8(print->buffer, ' ');
+    janet_description_b(print->buffer, value);
+}
+
+static void hmap_tostring(void *p, JanetBuffer *buffer) {
+    JanetHmap *m = (JanetHmap *) p;
+    HmapPrint print = {buffer, 1};
+    janet_buffer_push_u8(buffer, '{');
+    hmap_visit(m->root, 0, hmap_tostring_entry, &print);
+    janet_buffer_push_u8(buffer, '}');
+}
+
+/* Equal maps have the same trie, so entries can be compared in order */
+static int hmap_compare(void *lhs, void *rhs) {
+    JanetHmap *a = (JanetHmap *) lhs;
+    JanetHmap *b = (JanetHmap *) rhs;
+    if (a->count != b->count) return a->count < b->count ? -1 : 1;
+    if (a->hash != b->hash) return a->hash < b->hash ? -1 : 1;
+    if (a->root == b->root || NULL == a->root) return 0;
+    Janet ka = hmap_first(a->root);
+    Janet kb = hmap_first(b->root);
+    for (int32_t i = 0; i < a->count; i++) {
+        int cmp = janet_compare(ka, kb);
+        if (cmp) return cmp;
+        cmp = janet_compare(hmap_get(a, ka), hmap_get(b, kb));
+        if (cmp) return cmp;
+        if (i + 1 == a->count) break;
+        hmap_next(a->root, 0, (uint32_t) janet_hash(ka), ka, &ka);
+        hmap_next(b->root, 0, (uint32_t) janet_hash(kb), kb, &kb);
+    }
+    return 0;
+}
+
+static int32_t hmap_hash(void *p, size_t size) {
+    (void) size;
+    JanetHmap *m = (JanetHmap *) p;
+    return (int32_t) janet_hash_mix(m->hash, (uint32_t) m->count);
+}
+
+static Janet hmap_nextkey(void *p, Janet key) {
+    JanetHmap *m = (JanetHmap *) p;
+    if (NULL == m->root) return janet_wrap_nil();
+    if (janet_checktype(key, JANET_NIL)) return hmap_first(m->root);
+    Janet out;
+    if (hmap_next(m->root, 0, (uint32_t) janet_hash(key), key, &out) == HMAP_NEXT) return out;
+    return janet_wrap_nil();
+}
+
+static Janet hmap_call(void *p, int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 2);
+    Janet value = hmap_get((JanetHmap *) p, argv[0]);
+    if (argc == 2 && janet_checktype(value, JANET_NIL)) return argv[1];
+    return value;
+}
+
+const JanetAbstractType janet_hmap_type = {
+    "core/hmap",
+    NULL,
+    hmap_gcmark,
+    hmap_getter,
+    NULL,
+    hmap_marshal,
+    hmap_unmarshal,
+    hmap_tostring,
+    hmap_compare,
+    hmap_hash,
+    hmap_nextkey,
+    hmap_call,
+    JANET_ATEND_CALL
+};
+
+static JanetHmap *hmap_alloc(void) {
+    JanetHmap *m = janet_abstract(&janet_hmap_type, sizeof(JanetHmap));
+    m->count = 0;
+    m->hash = 0;
+    m->root = NULL;
+    return m;
+}
+
+/* Add every entry of a dictionary to a map that is being built */
+static void hmap_merge_mut(JanetHmap *m, Janet ds) {
+    if (janet_checkabstract(ds, &janet_hmap_type)) {
+        JanetHmap *other = (JanetHmap *) janet_unwrap_abstract(ds);
+        if (m->count == 0) {
+            *m = *other;
+            return;
+        }
+        for (Janet k = hmap_nextkey(other, janet_wrap_nil());
+                !janet_checktype(k, JANET_NIL);
+                k = hmap_nextkey(other, k)) {
+            hmap_put_mut(m, k, hmap_get(other, k));
+        }
+        return;
+    }
+    const JanetKV *kvs = NULL;
+    int32_t len, cap = 0;
+    if (!janet_dictionary_view(ds, &kvs, &len, &cap)) {
+        janet_panicf("expected dictionary, got %v", ds);
+    }
+    for (int32_t i = 0; i < cap; i++) {
+        if (!janet_checktype(kvs[i].key, JANET_NIL)) {
+            hmap_put_mut(m, kvs[i].key, kvs[i].value);
+        }
+    }
+}
+
+static JanetHmap *janet_gethmap(const Janet *argv, int32_t n) {
+    return (JanetHmap *) janet_getabstract(argv, n, &janet_hmap_type);
+}
+
+static Janet hmap_length_method(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    return janet_wrap_integer(janet_gethmap(argv, 0)->count);
+}
+
+/* C Functions */
+
+JANET_CORE_FN(cfun_hmap_new,
+              "(hmap/new & kvs)",
+              "Create a persistent hash map from alternating keys and values. "
+              "An hmap is immutable like a struct, but hmap/put and hmap/remove return a "
+              "new map that shares most of its memory with the old one, in time logarithmic "
+              "in the size of the map. Use get, length, keys, pairs and each on hmaps as on "
+              "structs. Two hmaps with the same entries are equal and have the same hash.") {
+    if (argc & 1) janet_panic("expected even number of arguments");
+    JanetHmap *m = hmap_alloc();
+    for (int32_t i = 0; i < argc; i += 2) {
+        hmap_put_mut(m, argv[i], argv[i + 1]);
+    }
+    return janet_wrap_abstract(m);
+}
+
+JANET_CORE_FN(cfun_hmap_from,
+              "(hmap/from & dictionaries)",
+              "Create an hmap with the entries of tables, structs or other hmaps. "
+              "Later dictionaries override keys of earlier ones. Prototypes are not included.") {
+    JanetHmap *m = hmap_alloc();
+    for (int32_t i = 0; i < argc; i++) {
+        hmap_merge_mut(m, argv[i]);
+    }
+    return janet_wrap_abstract(m);
+}
+
+JANET_CORE_FN(cfun_hmap_put,
+              "(hmap/put m key value & kvs)",
+              "Return a new hmap with key set to value, and any further keys and values. "
+              "A nil value removes the key. m is not changed.") {
+    janet_arity(argc, 3, -1);
+    if (!(argc & 1)) janet_panic("expected odd number of arguments");
+    JanetHmap *m = hmap_with(janet_gethmap(argv, 0), argv[1], argv[2]);
+    for (int32_t i = 3; i < argc; i += 2) {
+        hmap_put_mut(m, argv[i], argv[i + 1]);
+    }
+    return janet_wrap_abstract(m);
+}
+
+JANET_CORE_FN(cfun_hmap_remove,
+              "(hmap/remove m & keys)",
+              "Return a new hmap without the given keys. m is not changed.") {
+    janet_arity(argc, 1, -1);
+    JanetHmap *m = janet_gethmap(argv, 0);
+    if (argc == 1) return argv[0];
+    JanetHmap *ret = hmap_with(m, argv[1], janet_wrap_nil());
+    for (int32_t i = 2; i < argc; i++) {
+        hmap_put_mut(ret, argv[i], janet_wrap_nil());
+    }
+    return janet_wrap_abstract(ret);
+}
+
+JANET_CORE_FN(cfun_hmap_merge,
+              "(hmap/merge m & dictionaries)",
+              "Return a new hmap with the entries of m and of each dictionary, which can be a "
+              "table, struct or hmap. m is not changed.") {
+    janet_arity(argc, 1, -1);
+    JanetHmap *m = hmap_alloc();
+    *m = *janet_gethmap(argv, 0);
+    for (int32_t i = 1; i < argc; i++) {
+        hmap_merge_mut(m, argv[i]);
+    }
+    return janet_wrap_abstract(m);
+}
+
+JANET_CORE_FN(cfun_hmap_get,
+              "(hmap/get m key &opt dflt)",
+              "Get the value of key in m, or dflt if key is not in m. Unlike get, this never "
+              "returns a method of the hmap type.") {
+    janet_arity(argc, 2, 3);
+    Janet value = hmap_get(janet_gethmap(argv, 0), argv[1]);
+    if (argc == 3 && janet_checktype(value, JANET_NIL)) return argv[2];
+    return value;
+}
+
+static void hmap_struct_entry(void *data, Janet key, Janet value) {
+    janet_struct_put((JanetKV *) data, key, value);
+}
+
+JANET_CORE_FN(cfun_hmap_to_struct,
+              "(hmap/to-struct m)",
+              "Convert an hmap to a struct with the same entries.") {
+    janet_fixarity(argc, 1);
+    JanetHmap *m = janet_gethmap(argv, 0);
+    JanetKV *st = janet_struct_begin(m->count);
+    hmap_visit(m->root, 0, hmap_struct_entry, st);
+    return janet_wrap_struct(janet_struct_end(st));
+}
+
+static void hmap_table_entry(void *data, Janet key, Janet value) {
+    janet_table_put((JanetTable *) data, key, value);
+}
+
+JANET_CORE_FN(cfun_hmap_to_table,
+              "(hmap/to-table m)",
+              "Convert an hmap to a new table with the same entries.") {
+    janet_fixarity(argc, 1);
+    JanetHmap *m = janet_gethmap(argv, 0);
+    JanetTable *t = janet_table(m->count);
+    hmap_visit(m->root, 0, hmap_table_entry, t);
+    return janet_wrap_table(t);
+}
+
+/* Load the hmap module */
+void janet_lib_hmap(JanetTable *env) {
+    JanetRegExt hmap_cfuns[] = {
+        JANET_CORE_REG("hmap/new", cfun_hmap_new),
+        JANET_CORE_REG("hmap/from", cfun_hmap_from),
+        JANET_CORE_REG("hmap/put", cfun_hmap_put),
+        JANET_CORE_REG("hmap/remove", cfun_hmap_remove),
+        JANET_CORE_REG("hmap/merge", cfun_hmap_merge),
+        JANET_CORE_REG("hmap/get", cfun_hmap_get),
+        JANET_CORE_REG("hmap/to-struct", cfun_hmap_to_struct),
+        JANET_CORE_REG("hmap/to-table", cfun_hmap_to_table),
+        JANET_REG_END
+    };
+    janet_core_cfuns_ext(env, NULL, hmap_cfuns);
+    janet_register_abstract_type(&janet_hmap_type);
+}
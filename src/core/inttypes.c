@@ -481,6 +481,8 @@ static Janet cfun_it_s64_mod(int32_t argc, Janet *argv) {
     int64_t *box = janet_abstract(&janet_s64_type, sizeof(int64_t));
     int64_t op1 = janet_unwrap_s64(argv[0]);
     int64_t op2 = janet_unwrap_s64(argv[1]);
+    if (op2 == 0) janet_panic("division by zero");
+    if (op2 == -1 && op1 == INT64_MIN) janet_panic("INT64_MIN divided by -1");
     int64_t x = op1 % op2;
     *box = (op1 > 0)
            ? ((op2 > 0) ? x : (0 == x ? x : x + op2))
@@ -518,6 +520,120 @@ OPMETHOD(uint64_t, u64, rshift, >>)
 #undef DIVMETHOD_SIGNED
 #undef COMPMETHOD
 
+/* Apply a binary operator to two 64 bit integers of the given type. Operators
+ * are named by the first character of their method name, with 'm' for mod. */
+static uint64_t it_binop(JanetIntType t, char op, uint64_t x, uint64_t y) {
+    int is_signed = t == JANET_INT_S64;
+    switch (op) {
+        case '+':
+            return x + y;
+        case '-':
+            return x - y;
+        case '*':
+            return x * y;
+        case '&':
+            return x & y;
+        case '|':
+            return x | y;
+        case '^':
+            return x ^ y;
+        case '<':
+            return x << (y & 63);
+        case '>':
+            return is_signed
+                   ? (uint64_t)((int64_t) x >> (y & 63))
+                   : x >> (y & 63);
+        case '/':
+        case '%':
+        case 'm':
+            break;
+        default:
+            janet_panicf("unknown integer operator %c", op);
+    }
+    if (y == 0) janet_panic("division by zero");
+    if (!is_signed) return op == '/' ? x / y : x % y;
+    int64_t a = (int64_t) x, b = (int64_t) y;
+    if (b == -1 && a == INT64_MIN) janet_panic("INT64_MIN divided by -1");
+    if (op == '/') return (uint64_t)(a / b);
+    int64_t r = a % b;
+    if (op == 'm' && r != 0 && ((r < 0) != (b < 0))) r += b;
+    return (uint64_t) r;
+}
+
+/* Fast path for the arithmetic and bitwise opcodes, so that they don't need to
+ * look up and call a method for boxed integers. Returns 0 if the operation
+ * should go through the usual method call instead. */
+int janet_int64_binop(char op, Janet lhs, Janet rhs, Janet *out) {
+    JanetIntType t = janet_is_int(lhs);
+    if (t == JANET_INT_NONE) {
+        /* Only the methods with an exact right hand version are inlined */
+        if (!janet_checktype(lhs, JANET_NUMBER)) return 0;
+        if (op == '<' || op == '>' || op == '%' || op == 'm') return 0;
+        t = janet_is_int(rhs);
+        if (t == JANET_INT_NONE) return 0;
+    }
+    if (t == JANET_INT_S64) {
+        uint64_t x = (uint64_t) janet_unwrap_s64(lhs);
+        uint64_t y = (uint64_t) janet_unwrap_s64(rhs);
+        *out = janet_wrap_s64((int64_t) it_binop(t, op, x, y));
+    } else {
+        uint64_t x = janet_unwrap_u64(lhs);
+        uint64_t y = janet_unwrap_u64(rhs);
+        *out = janet_wrap_u64(it_binop(t, op, x, y));
+    }
+    return 1;
+}
+
+/* Update a boxed integer in place */
+static Janet it_update(int32_t argc, Janet *argv, char op) {
+    janet_arity(argc, 1, -1);
+    JanetIntType t = janet_is_int(argv[0]);
+    if (t == JANET_INT_NONE) janet_panic_type(argv[0], 0, JANET_TFLAG_ABSTRACT);
+    uint64_t *box = janet_unwrap_abstract(argv[0]);
+    for (int32_t i = 1; i < argc; i++) {
+        uint64_t y = (t == JANET_INT_S64)
+                     ? (uint64_t) janet_unwrap_s64(argv[i])
+                     : janet_unwrap_u64(argv[i]);
+        *box = it_binop(t, op, *box, y);
+    }
+    return argv[0];
+}
+
+JANET_CORE_FN(cfun_it_set,
+              "(int/set! x value)",
+              "Set the boxed integer `x` to `value` in place, and return `x`. "
+              "The in place operations let a loop update a 64 bit counter or hash without "
+              "allocating a new integer on each step. Avoid them on integers that other code "
+              "holds on to, such as table keys.") {
+    janet_fixarity(argc, 2);
+    JanetIntType t = janet_is_int(argv[0]);
+    if (t == JANET_INT_NONE) janet_panic_type(argv[0], 0, JANET_TFLAG_ABSTRACT);
+    uint64_t *box = janet_unwrap_abstract(argv[0]);
+    *box = (t == JANET_INT_S64)
+           ? (uint64_t) janet_unwrap_s64(argv[1])
+           : janet_unwrap_u64(argv[1]);
+    return argv[0];
+}
+
+#define INPLACE(name, op, desc) \
+JANET_CORE_FN(cfun_it_##name##_in_place, \
+              "(int/" #name "! x & args)", \
+              desc " the boxed integer `x` in place, and return `x`. See `int/set!`.") { \
+    return it_update(argc, argv, op); \
+}
+
+INPLACE(add, '+', "Add `args` to")
+INPLACE(sub, '-', "Subtract `args` from")
+INPLACE(mul, '*', "Multiply by `args`")
+INPLACE(div, '/', "Divide by `args`")
+INPLACE(band, '&', "Bitwise and `args` into")
+INPLACE(bor, '|', "Bitwise or `args` into")
+INPLACE(bxor, '^', "Bitwise xor `args` into")
+INPLACE(blshift, '<', "Shift left by `args`")
+INPLACE(brshift, '>', "Shift right by `args`")
+
+#undef INPLACE
+
 
 static JanetMethod it_s64_methods[] = {
     {"+", cfun_it_s64_add},
@@ -602,6 +718,16 @@ void janet_lib_inttypes(JanetTable *env) {
         JANET_CORE_REG("int/u64", cfun_it_u64_new),
         JANET_CORE_REG("int/to-number", cfun_to_number),
         JANET_CORE_REG("int/to-bytes", cfun_to_bytes),
+        JANET_CORE_REG("int/set!", cfun_it_set),
+        JANET_CORE_REG("int/add!", cfun_it_add_in_place),
+        JANET_CORE_REG("int/sub!", cfun_it_sub_in_place),
+        JANET_CORE_REG("int/mul!", cfun_it_mul_in_place),
+        JANET_CORE_REG("int/div!", cfun_it_div_in_place),
+        JANET_CORE_REG("int/band!", cfun_it_band_in_place),
+        JANET_CORE_REG("int/bor!", cfun_it_bor_in_place),
+        JANET_CORE_REG("int/bxor!", cfun_it_bxor_in_place),
+        JANET_CORE_REG("int/blshift!", cfun_it_blshift_in_place),
+        JANET_CORE_REG("int/brshift!", cfun_it_brshift_in_place),
         JANET_REG_END
     };
     janet_core_cfuns_ext(env, NULL, it_cfuns);
@@ -31,8 +31,13 @@
 
 #ifndef JANET_WINDOWS
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#else
+#include <windows.h>
+#include <io.h>
 #endif
 
 static int cfun_io_gc(void *p, size_t len);
@@ -458,6 +463,285 @@ static void *io_file_unmarshal(JanetMarshalContext *ctx) {
     }
 }
 
+/*
+ * Memory mapped files
+ */
+
+#define JANET_MMAP_WRITE 1
+#define JANET_MMAP_CLOSED 2
+
+typedef struct {
+    uint8_t *base; /* Start of the mapping, aligned as the OS requires */
+    size_t map_len;
+    uint8_t *data; /* Start of the requested range */
+    int32_t len;
+    int32_t flags;
+} JanetMapping;
+
+static int io_mmap_gc(void *p, size_t len);
+static int io_mmap_get(void *p, Janet key, Janet *out);
+static void io_mmap_put(void *p, Janet key, Janet value);
+static Janet io_mmap_next(void *p, Janet key);
+static JanetByteView io_mmap_bytes(void *p, size_t len);
+
+const JanetAbstractType janet_mmap_type = {
+    "core/mmap",
+    io_mmap_gc,
+    NULL,
+    io_mmap_get,
+    io_mmap_put,
+    NULL, /* marshal */
+    NULL, /* unmarshal */
+    NULL, /* tostring */
+    NULL, /* compare */
+    NULL, /* hash */
+    io_mmap_next,
+    NULL, /* call */
+    io_mmap_bytes,
+    JANET_ATEND_BYTES
+};
+
+#if !defined(JANET_WINDOWS) && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* Close a mapping. Byte views taken before, for example by a peg match that
+ * calls back into janet or by a pending write, can still be in use, so the
+ * address range is only released when the mapping is collected. Until then
+ * the file pages are replaced with zeroed memory, or stay mapped on Windows. */
+static void io_mmap_close(JanetMapping *map) {
+    if (map->flags & JANET_MMAP_CLOSED) return;
+#ifndef JANET_WINDOWS
+    if (map->map_len) {
+        /* If this fails the file stays mapped until collection */
+        mmap(map->base, map->map_len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    }
+#endif
+    map->flags |= JANET_MMAP_CLOSED;
+    map->data = NULL;
+    map->len = 0;
+}
+
+static int io_mmap_gc(void *p, size_t len) {
+    (void) len;
+    JanetMapping *map = (JanetMapping *) p;
+    if (map->map_len) {
+#ifdef JANET_WINDOWS
+        UnmapViewOfFile(map->base);
+#else
+        munmap(map->base, map->map_len);
+#endif
+    }
+    return 0;
+}
+
+static JanetByteView io_mmap_bytes(void *p, size_t len) {
+    (void) len;
+    JanetMapping *map = (JanetMapping *) p;
+    JanetByteView view;
+    view.bytes = (map->flags & JANET_MMAP_CLOSED) ? (const uint8_t *) "" : map->data;
+    view.len = map->len;
+    return view;
+}
+
+static JanetMapping *io_getmmap(Janet *argv, int32_t n) {
+    JanetMapping *map = janet_getabstract(argv, n, &janet_mmap_type);
+    if (map->flags & JANET_MMAP_CLOSED) janet_panic("mapping is closed");
+    return map;
+}
+
+JANET_CORE_FN(cfun_io_mmap,
+              "(file/mmap f &opt mode offset length)",
+              "Map part of the file `f` into memory. Returns a core/mmap that can be passed to "
+              "functions that take a string or buffer, such as peg/match, string/find, unmarshal or "
+              "net/write, without copying the file onto the heap. `mode` is :r for a read only "
+              "mapping, the default, or :w to write changes through to the file, which needs `f` "
+              "to be open for writing. `offset` and `length` select the range of the file to map, "
+              "and default to the whole file. A mapping is at most 2GB, larger files can be mapped "
+              "in windows. Index the mapping to read and write single bytes.") {
+    janet_arity(argc, 1, 4);
+    int32_t fflags;
+    FILE *f = janet_getfile(argv, 0, &fflags);
+    if (fflags & JANET_FILE_CLOSED) janet_panic("file is closed");
+    int writable = 0;
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
+        const uint8_t *mode = janet_getkeyword(argv, 1);
+        if (!janet_cstrcmp(mode, "w")) {
+            writable = 1;
+        } else if (janet_cstrcmp(mode, "r")) {
+            janet_panicf("expected :r or :w, got %v", argv[1]);
+        }
+    }
+    if (writable && !(fflags & (JANET_FILE_WRITE | JANET_FILE_APPEND | JANET_FILE_UPDATE)))
+        janet_panic("file is not writeable");
+    int64_t offset = argc > 2 && !janet_checktype(argv[2], JANET_NIL) ? janet_getinteger64(argv, 2) : 0;
+    if (offset < 0) janet_panicf("expected non-negative offset, got %v", argv[2]);
+    fflush(f);
+
+    /* Find the size of the region */
+    int64_t size;
+#ifdef JANET_WINDOWS
+    HANDLE handle = (HANDLE) _get_osfhandle(_fileno(f));
+    LARGE_INTEGER fsize;
+    if (!GetFileSizeEx(handle, &fsize)) janet_panic("could not get file size");
+    size = fsize.QuadPart;
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int64_t align = info.dwAllocationGranularity;
+#else
+    int fd = fileno(f);
+    struct stat st;
+    if (fstat(fd, &st)) janet_panicf("could not get file size: %s", strerror(errno));
+    size = st.st_size;
+    int64_t align = sysconf(_SC_PAGESIZE);
+#endif
+    if (offset > size) janet_panicf("offset %v is past the end of the file", argv[2]);
+    int64_t length = argc > 3 && !janet_checktype(argv[3], JANET_NIL) ? janet_getinteger64(argv, 3) : size - offset;
+    if (length < 0 || offset + length > size) janet_panicf("length %v is out of range", argv[3]);
+    if (length > INT32_MAX) janet_panic("mapping is larger than 2GB, map a smaller range");
+
+    JanetMapping *map = janet_abstract(&janet_mmap_type, sizeof(JanetMapping));
+    map->flags = JANET_MMAP_CLOSED;
+    map->base = NULL;
+    map->map_len = 0;
+    map->data = NULL;
+    map->len = 0;
+    int64_t start = offset - offset % align;
+    size_t map_len = (size_t)(offset + length - start);
+    uint8_t *base;
+    if (map_len == 0) {
+        /* An empty mapping, nothing to map */
+        return janet_wrap_abstract(map);
+    }
+#ifdef JANET_WINDOWS
+    HANDLE mapping = CreateFileMapping(handle, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+    if (NULL == mapping) janet_panicf("could not map file: error %d", (int) GetLastError());
+    base = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ,
+                         (DWORD)(start >> 32), (DWORD)(start & 0xFFFFFFFF), map_len);
+    CloseHandle(mapping);
+    if (NULL == base) janet_panicf("could not map file: error %d", (int) GetLastError());
+#else
+    base = mmap(NULL, map_len, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, (off_t) start);
+    if (MAP_FAILED == (void *) base) janet_panicf("could not map file: %s", strerror(errno));
+#endif
+    map->base = base;
+    map->map_len = map_len;
+    map->data = base + (offset - start);
+    map->len = (int32_t) length;
+    map->flags = writable ? JANET_MMAP_WRITE : 0;
+    return janet_wrap_abstract(map);
+}
+
+JANET_CORE_FN(cfun_io_munmap,
+              "(file/munmap m)",
+              "Unmap a memory mapped file before it is garbage collected. Afterwards the mapping "
+              "behaves as an empty string. Functions that were already reading the mapping, such as "
+              "a peg/match that unmaps it from a callback, see zeros instead of the file. Returns nil.") {
+    janet_fixarity(argc, 1);
+    JanetMapping *map = janet_getabstract(argv, 0, &janet_mmap_type);
+    io_mmap_close(map);
+    return janet_wrap_nil();
+}
+
+JANET_CORE_FN(cfun_io_madvise,
+              "(file/madvise m advice)",
+              "Tell the operating system how a mapping will be used so it can read ahead or drop pages. "
+              "`advice` is one of :normal, :random, :sequential, :willneed and :dontneed. This is only a "
+              "hint, and does nothing on platforms without madvise. Returns the mapping.") {
+    janet_fixarity(argc, 2);
+    JanetMapping *map = io_getmmap(argv, 0);
+    const uint8_t *advice = janet_getkeyword(argv, 1);
+#if defined(JANET_WINDOWS) || !defined(MADV_NORMAL)
+    if (janet_cstrcmp(advice, "normal") && janet_cstrcmp(advice, "random") &&
+            janet_cstrcmp(advice, "sequential") && janet_cstrcmp(advice, "willneed") &&
+            janet_cstrcmp(advice, "dontneed")) {
+        janet_panicf("unknown advice %v", argv[1]);
+    }
+    (void) map;
+#else
+    int how;
+    if (!janet_cstrcmp(advice, "normal")) {
+        how = MADV_NORMAL;
+    } else if (!janet_cstrcmp(advice, "random")) {
+        how = MADV_RANDOM;
+    } else if (!janet_cstrcmp(advice, "sequential")) {
+        how = MADV_SEQUENTIAL;
+    } else if (!janet_cstrcmp(advice, "willneed")) {
+        how = MADV_WILLNEED;
+    } else if (!janet_cstrcmp(advice, "dontneed")) {
+        how = MADV_DONTNEED;
+    } else {
+        janet_panicf("unknown advice %v", argv[1]);
+    }
+    if (map->map_len && madvise(map->base, map->map_len, how)) {
+        janet_panicf("madvise failed: %s", strerror(errno));
+    }
+#endif
+    return argv[0];
+}
+
+JANET_CORE_FN(cfun_io_msync,
+              "(file/msync m)",
+              "Write changes to a writable mapping back to the file, waiting until they are written. "
+              "Returns the mapping.") {
+    janet_fixarity(argc, 1);
+    JanetMapping *map = io_getmmap(argv, 0);
+    if (!(map->flags & JANET_MMAP_WRITE)) janet_panic("mapping is not writable");
+    if (map->map_len) {
+#ifdef JANET_WINDOWS
+        if (!FlushViewOfFile(map->base, map->map_len)) janet_panic("could not sync mapping");
+#else
+        if (msync(map->base, map->map_len, MS_SYNC)) janet_panicf("could not sync mapping: %s", strerror(errno));
+#endif
+    }
+    return argv[0];
+}
+
+JANET_CORE_FN(cfun_io_mmap_length,
+              "(file/mmap-length m)",
+              "Get the number of bytes in a mapping.") {
+    janet_fixarity(argc, 1);
+    JanetMapping *map = janet_getabstract(argv, 0, &janet_mmap_type);
+    return janet_wrap_integer(map->len);
+}
+
+static JanetMethod io_mmap_methods[] = {
+    {"advise", cfun_io_madvise},
+    {"length", cfun_io_mmap_length},
+    {"sync", cfun_io_msync},
+    {"unmap", cfun_io_munmap},
+    {NULL, NULL}
+};
+
+static int io_mmap_get(void *p, Janet key, Janet *out) {
+    JanetMapping *map = (JanetMapping *) p;
+    if (janet_checktype(key, JANET_KEYWORD)) {
+        return janet_getmethod(janet_unwrap_keyword(key), io_mmap_methods, out);
+    }
+    if (!janet_checkint(key)) return 0;
+    int32_t index = janet_unwrap_integer(key);
+    if (index < 0 || index >= map->len) return 0;
+    *out = janet_wrap_integer(map->data[index]);
+    return 1;
+}
+
+static void io_mmap_put(void *p, Janet key, Janet value) {
+    JanetMapping *map = (JanetMapping *) p;
+    if (map->flags & JANET_MMAP_CLOSED) janet_panic("mapping is closed");
+    if (!(map->flags & JANET_MMAP_WRITE)) janet_panic("mapping is not writable");
+    if (!janet_checkint(key)) janet_panicf("expected integer key, got %v", key);
+    int32_t index = janet_unwrap_integer(key);
+    if (index < 0 || index >= map->len) janet_panicf("index %d out of range [0, %d)", index, map->len);
+    if (!janet_checkint(value)) janet_panicf("expected integer byte, got %v", value);
+    map->data[index] = (uint8_t)(janet_unwrap_integer(value) & 0xFF);
+}
+
+static Janet io_mmap_next(void *p, Janet key) {
+    (void) p;
+    return janet_nextmethod(io_mmap_methods, key);
+}
+
 FILE *janet_dynfile(const char *name, FILE *def) {
     Janet x = janet_dyn(name);
     if (!janet_checktype(x, JANET_ABSTRACT)) return def;
@@ -590,14 +874,13 @@ JANET_CORE_FN(cfun_io_xprin,
 static Janet cfun_io_printf_impl_x(int32_t argc, Janet *argv, int newline,
                                    FILE *dflt_file, int32_t offset, Janet x) {
     FILE *f;
-    const char *fmt = janet_getcstring(argv, offset);
     switch (janet_type(x)) {
         default:
             janet_panicf("cannot print to %v", x);
         case JANET_BUFFER: {
             /* Special case buffer */
             JanetBuffer *buf = janet_unwrap_buffer(x);
-            janet_buffer_format(buf, fmt, offset, argc, argv);
+            janet_buffer_format_value(buf, offset, argc, argv);
             if (newline) janet_buffer_push_u8(buf, '\n');
             return janet_wrap_nil();
         }
@@ -615,7 +898,7 @@ static Janet cfun_io_printf_impl_x(int32_t argc, Janet *argv, int newline,
         }
     }
     JanetBuffer *buf = janet_buffer(10);
-    janet_buffer_format(buf, fmt, offset, argc, argv);
+    janet_buffer_format_value(buf, offset, argc, argv);
     if (newline) janet_buffer_push_u8(buf, '\n');
     if (buf->count) {
         if (1 != fwrite(buf->data, buf->count, 1, f)) {
@@ -802,6 +1085,11 @@ void janet_lib_io(JanetTable *env) {
         JANET_CORE_REG("file/write", cfun_io_fwrite),
         JANET_CORE_REG("file/flush", cfun_io_fflush),
         JANET_CORE_REG("file/seek", cfun_io_fseek),
+        JANET_CORE_REG("file/mmap", cfun_io_mmap),
+        JANET_CORE_REG("file/munmap", cfun_io_munmap),
+        JANET_CORE_REG("file/madvise", cfun_io_madvise),
+        JANET_CORE_REG("file/msync", cfun_io_msync),
+        JANET_CORE_REG("file/mmap-length", cfun_io_mmap_length),
 #ifndef JANET_NO_PROCESSES
         JANET_CORE_REG("file/popen", cfun_io_popen),
 #endif
@@ -809,6 +1097,7 @@ void janet_lib_io(JanetTable *env) {
     };
     janet_core_cfuns_ext(env, NULL, io_cfuns);
     janet_register_abstract_type(&janet_file_type);
+    janet_register_abstract_type(&janet_mmap_type);
     int default_flags = JANET_FILE_NOT_CLOSEABLE | JANET_FILE_SERIALIZABLE;
     /* stdout */
     JANET_CORE_DEF(env, "stdout",
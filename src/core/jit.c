@@ -0,0 +1,606 @@
+/*
+* Copyright (c) 2021 Calvin Rose
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to
+* deal in the Software without restriction, including without limitation the
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+* sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#ifndef JANET_AMALG
+#include "features.h"
+#include <janet.h>
+#include "state.h"
+#include "util.h"
+#include "vector.h"
+#endif
+
+#ifdef JANET_JIT
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* A baseline template JIT for x86-64. Each instruction the JIT understands is
+ * translated to a fixed sequence of machine code that works directly on the
+ * stack frame, which is kept in rbx. Any other instruction, and any type check
+ * that fails, leaves the machine code and hands the address of the instruction
+ * back to the interpreter, which runs it as usual. Translated instructions never
+ * call into C, so errors, signals, garbage collection, breakpoints and stack
+ * traces all happen in the interpreter. */
+
+/* uint32_t *code(Janet *stack, const uint8_t *entry, JanetVM *vm) */
+typedef uint32_t *(*JanetJitFunction)(Janet *stack, const uint8_t *entry, JanetVM *vm);
+
+/* Machine code for a funcdef, stored in def->jit */
+typedef struct {
+    uint8_t *code;
+    size_t size;
+    uint8_t *native; /* Whether each instruction has been translated */
+    int32_t offsets[]; /* Machine code offset of each instruction */
+} JanetJitCode;
+
+/* A rel32 operand to patch once all code is emitted */
+typedef struct {
+    int32_t at;
+    int32_t pc;
+} JanetJitFixup;
+
+typedef struct {
+    JanetFuncDef *def;
+    uint8_t *buf;
+    int32_t *offsets;
+    JanetJitFixup *jumps; /* Patched with the offset of an instruction */
+    JanetJitFixup *exits; /* Patched with the exit stub of an instruction */
+} JanetJitBuilder;
+
+/* Size of the prologue, which is followed by the shared epilogue */
+#define JIT_PROLOGUE_SIZE 11
+
+/* Registers as they are encoded in ModRM bytes */
+#define JIT_RAX 0
+#define JIT_RCX 1
+#define JIT_XMM0 0
+#define JIT_XMM1 1
+#define JIT_XMM2 2
+
+static void jit_u8(JanetJitBuilder *b, uint8_t x) {
+    janet_v_push(b->buf, x);
+}
+
+static void jit_bytes(JanetJitBuilder *b, const uint8_t *bytes, int32_t n) {
+    for (int32_t i = 0; i < n; i++) jit_u8(b, bytes[i]);
+}
+
+static void jit_u32(JanetJitBuilder *b, uint32_t x) {
+    for (int i = 0; i < 4; i++) jit_u8(b, (uint8_t)(x >> (8 * i)));
+}
+
+static void jit_u64(JanetJitBuilder *b, uint64_t x) {
+    for (int i = 0; i < 8; i++) jit_u8(b, (uint8_t)(x >> (8 * i)));
+}
+
+/* ModRM and displacement for [rbx + 8 * slot] */
+static void jit_slot(JanetJitBuilder *b, int reg, int32_t slot) {
+    jit_u8(b, (uint8_t)(0x80 | (reg << 3) | 3));
+    jit_u32(b, (uint32_t) slot * (uint32_t) sizeof(Janet));
+}
+
+/* mov rax, [slot] */
+static void jit_load(JanetJitBuilder *b, int32_t slot) {
+    jit_u8(b, 0x48);
+    jit_u8(b, 0x8B);
+    jit_slot(b, JIT_RAX, slot);
+}
+
+/* mov [slot], rax */
+static void jit_store(JanetJitBuilder *b, int32_t slot) {
+    jit_u8(b, 0x48);
+    jit_u8(b, 0x89);
+    jit_slot(b, JIT_RAX, slot);
+}
+
+/* mov rax/rcx, imm64 */
+static void jit_imm(JanetJitBuilder *b, int reg, uint64_t x) {
+    jit_u8(b, 0x48);
+    jit_u8(b, (uint8_t)(0xB8 + reg));
+    jit_u64(b, x);
+}
+
+/* movsd xmm, [slot] */
+static void jit_load_number(JanetJitBuilder *b, int xmm, int32_t slot) {
+    static const uint8_t op[] = {0xF2, 0x0F, 0x10};
+    jit_bytes(b, op, 3);
+    jit_slot(b, xmm, slot);
+}
+
+/* movsd [slot], xmm0 */
+static void jit_store_number(JanetJitBuilder *b, int32_t slot) {
+    static const uint8_t op[] = {0xF2, 0x0F, 0x11};
+    jit_bytes(b, op, 3);
+    jit_slot(b, JIT_XMM0, slot);
+}
+
+/* Load the number immediate into xmm1 */
+static void jit_load_immediate(JanetJitBuilder *b, int32_t x) {
+    static const uint8_t movq[] = {0x66, 0x48, 0x0F, 0x6E, 0xC8};
+    jit_imm(b, JIT_RAX, janet_wrap_number((double) x).u64);
+    jit_bytes(b, movq, 5);
+}
+
+/* Emit a jump instruction to the code for the instruction at pc */
+static void jit_jump(JanetJitBuilder *b, const uint8_t *op, int32_t n, int32_t pc) {
+    JanetJitFixup fixup;
+    jit_bytes(b, op, n);
+    fixup.at = janet_v_count(b->buf);
+    fixup.pc = pc;
+    janet_v_push(b->jumps, fixup);
+    jit_u32(b, 0);
+}
+
+/* Emit a jump instruction to the exit stub that resumes the interpreter at pc */
+static void jit_exit_if(JanetJitBuilder *b, const uint8_t *op, int32_t n, int32_t pc) {
+    JanetJitFixup fixup;
+    jit_bytes(b, op, n);
+    fixup.at = janet_v_count(b->buf);
+    fixup.pc = pc;
+    janet_v_push(b->exits, fixup);
+    jit_u32(b, 0);
+}
+
+/* Return the address of the instruction at pc to the interpreter */
+static void jit_exit(JanetJitBuilder *b, int32_t pc) {
+    jit_imm(b, JIT_RAX, (uint64_t)(uintptr_t)(b->def->bytecode + pc));
+    jit_u8(b, 0xE9);
+    jit_u32(b, (uint32_t)(JIT_PROLOGUE_SIZE - (janet_v_count(b->buf) + 4)));
+}
+
+/* Leave the machine code at pc unless the slot holds a number */
+static void jit_check_number(JanetJitBuilder *b, int32_t slot, int32_t pc) {
+    static const uint8_t ucomisd[] = {0x66, 0x0F, 0x2E, 0xD2, 0x7B, 19};
+    static const uint8_t shr_test[] = {0x48, 0xC1, 0xE8, 0x2F, 0xA8, 0x0F};
+    static const uint8_t jnz[] = {0x0F, 0x85};
+    /* Numbers are either not NaN, or NaN with the number type tag */
+    jit_load_number(b, JIT_XMM2, slot);
+    jit_bytes(b, ucomisd, 6);
+    jit_load(b, slot);
+    jit_bytes(b, shr_test, 6);
+    jit_exit_if(b, jnz, 2, pc);
+}
+
+/* Store a boolean from the low byte of eax */
+static void jit_store_boolean(JanetJitBuilder *b, int32_t slot) {
+    static const uint8_t movzx[] = {0x0F, 0xB6, 0xC0};
+    static const uint8_t or_rcx[] = {0x48, 0x09, 0xC8};
+    jit_bytes(b, movzx, 3);
+    jit_imm(b, JIT_RCX, janet_wrap_false().u64);
+    jit_bytes(b, or_rcx, 3);
+    jit_store(b, slot);
+}
+
+/* Shift the type tag of the value in rax into ecx */
+static void jit_tag(JanetJitBuilder *b) {
+    static const uint8_t op[] = {0x48, 0x89, 0xC1, 0x48, 0xC1, 0xE9, 0x2F};
+    jit_bytes(b, op, 7);
+}
+
+/* cmp ecx, imm32 */
+static void jit_cmp_tag(JanetJitBuilder *b, JanetType type) {
+    jit_u8(b, 0x81);
+    jit_u8(b, 0xF9);
+    jit_u32(b, (uint32_t) janet_nanbox_lowtag(type));
+}
+
+/* Check that the instruction only uses slots in the frame */
+static int jit_slots_ok(JanetFuncDef *def, uint32_t instr) {
+    enum JanetInstructionType type = janet_instructions[instr & 0x7F];
+    int32_t sc = def->slotcount;
+    int32_t a = (int32_t)((instr >> 8) & 0xFF);
+    int32_t b = (int32_t)((instr >> 16) & 0xFF);
+    int32_t c = (int32_t)(instr >> 24);
+    switch (type) {
+        case JINT_S:
+            return (int32_t)(instr >> 8) < sc;
+        case JINT_SS:
+            return a < sc && (int32_t)(instr >> 16) < sc;
+        case JINT_SSS:
+            return a < sc && b < sc && c < sc;
+        case JINT_SSI:
+        case JINT_SSU:
+            return a < sc && b < sc;
+        case JINT_SI:
+        case JINT_SL:
+            return a < sc;
+        case JINT_SC:
+            return a < sc && (int32_t)(instr >> 16) < def->constants_length;
+        default:
+            return 1;
+    }
+}
+
+/* Translate one instruction. Returns 0 without emitting anything if the
+ * instruction is not supported. */
+static int jit_instruction(JanetJitBuilder *b, int32_t pc) {
+    static const uint8_t jmp[] = {0xE9};
+    static const uint8_t je[] = {0x0F, 0x84};
+    static const uint8_t jne[] = {0x0F, 0x85};
+    JanetFuncDef *def = b->def;
+    uint32_t instr = def->bytecode[pc];
+    int32_t A = (int32_t)((instr >> 8) & 0xFF);
+    int32_t B = (int32_t)((instr >> 16) & 0xFF);
+    int32_t C = (int32_t)(instr >> 24);
+    int32_t CS = ((int32_t) instr) >> 24;
+    int32_t D = (int32_t)(instr >> 8);
+    int32_t E = (int32_t)(instr >> 16);
+    int32_t ES = ((int32_t) instr) >> 16;
+    int32_t DS = ((int32_t) instr) >> 8;
+    uint8_t arith = 0;
+    int compare = 0;
+    int checked = 1;
+    int immediate = 0;
+
+    /* Leave instructions with breakpoints to the interpreter */
+    if (instr & 0x80) return 0;
+    if (!jit_slots_ok(def, instr)) return 0;
+
+    switch (instr & 0x7F) {
+        default:
+            return 0;
+        case JOP_NOOP:
+            return 1;
+        case JOP_MOVE_NEAR:
+            jit_load(b, E);
+            jit_store(b, A);
+            return 1;
+        case JOP_MOVE_FAR:
+            jit_load(b, A);
+            jit_store(b, E);
+            return 1;
+        case JOP_LOAD_NIL:
+            jit_imm(b, JIT_RAX, janet_wrap_nil().u64);
+            jit_store(b, D);
+            return 1;
+        case JOP_LOAD_TRUE:
+            jit_imm(b, JIT_RAX, janet_wrap_true().u64);
+            jit_store(b, D);
+            return 1;
+        case JOP_LOAD_FALSE:
+            jit_imm(b, JIT_RAX, janet_wrap_false().u64);
+            jit_store(b, D);
+            return 1;
+        case JOP_LOAD_INTEGER:
+            jit_imm(b, JIT_RAX, janet_wrap_integer(ES).u64);
+            jit_store(b, A);
+            return 1;
+        case JOP_LOAD_CONSTANT:
+            jit_imm(b, JIT_RAX, def->constants[E].u64);
+            jit_store(b, A);
+            return 1;
+        case JOP_JUMP:
+            if (pc + DS < 0 || pc + DS >= def->bytecode_length) return 0;
+            if (DS < 0) {
+#ifndef JANET_NO_INTERPRETER_INTERRUPT
+                /* Let the interpreter handle interrupts and profiler samples */
+                static const uint8_t check[] = {0x41, 0x8B, 0x8C, 0x24};
+                static const uint8_t or_check[] = {0x41, 0x0B, 0x8C, 0x24};
+                jit_bytes(b, check, 4);
+                jit_u32(b, (uint32_t) offsetof(JanetVM, auto_suspend));
+                jit_bytes(b, or_check, 4);
+                jit_u32(b, (uint32_t) offsetof(JanetVM, profile_request));
+                jit_exit_if(b, jne, 2, pc);
+#endif
+            }
+            jit_jump(b, jmp, 1, pc + DS);
+            return 1;
+        case JOP_JUMP_IF:
+        case JOP_JUMP_IF_NOT: {
+            /* Backward conditional jumps check for interrupts in the interpreter */
+            static const uint8_t skip_if_not_boolean[] = {0x75, 8};
+            static const uint8_t test_true[] = {0xA8, 0x01};
+            if (ES < 0 || pc + ES >= def->bytecode_length) return 0;
+            jit_load(b, A);
+            jit_tag(b);
+            jit_cmp_tag(b, JANET_NIL);
+            if ((instr & 0x7F) == JOP_JUMP_IF) {
+                static const uint8_t skip_nil[] = {0x74, 6 + 6 + 2 + 6};
+                jit_bytes(b, skip_nil, 2);
+                jit_cmp_tag(b, JANET_BOOLEAN);
+                jit_jump(b, jne, 2, pc + ES);
+                jit_bytes(b, test_true, 2);
+                jit_jump(b, jne, 2, pc + ES);
+            } else {
+                jit_jump(b, je, 2, pc + ES);
+                jit_cmp_tag(b, JANET_BOOLEAN);
+                jit_bytes(b, skip_if_not_boolean, 2);
+                jit_bytes(b, test_true, 2);
+                jit_jump(b, je, 2, pc + ES);
+            }
+            return 1;
+        }
+        case JOP_JUMP_IF_NIL:
+        case JOP_JUMP_IF_NOT_NIL:
+            if (ES < 0 || pc + ES >= def->bytecode_length) return 0;
+            jit_load(b, A);
+            jit_tag(b);
+            jit_cmp_tag(b, JANET_NIL);
+            jit_jump(b, (instr & 0x7F) == JOP_JUMP_IF_NIL ? je : jne, 2, pc + ES);
+            return 1;
+
+        case JOP_ADD_NUMBER:
+            checked = 0;
+        /* fallthrough */
+        case JOP_ADD:
+            arith = 0x58;
+            break;
+        case JOP_SUBTRACT_NUMBER:
+            checked = 0;
+        /* fallthrough */
+        case JOP_SUBTRACT:
+            arith = 0x5C;
+            break;
+        case JOP_MULTIPLY_NUMBER:
+            checked = 0;
+        /* fallthrough */
+        case JOP_MULTIPLY:
+            arith = 0x59;
+            break;
+        case JOP_DIVIDE_NUMBER:
+            checked = 0;
+        /* fallthrough */
+        case JOP_DIVIDE:
+            arith = 0x5E;
+            break;
+        case JOP_ADD_IMMEDIATE_NUMBER:
+            checked = 0;
+        /* fallthrough */
+        case JOP_ADD_IMMEDIATE:
+        case JOP_ADD_IMMEDIATE_JUMP:
+            /* The fused jump is translated separately */
+            arith = 0x58;
+            immediate = 1;
+            break;
+        case JOP_MULTIPLY_IMMEDIATE_NUMBER:
+            checked = 0;
+        /* fallthrough */
+        case JOP_MULTIPLY_IMMEDIATE:
+            arith = 0x59;
+            immediate = 1;
+            break;
+        case JOP_DIVIDE_IMMEDIATE_NUMBER:
+            checked = 0;
+        /* fallthrough */
+        case JOP_DIVIDE_IMMEDIATE:
+            arith = 0x5E;
+            immediate = 1;
+            break;
+
+        /* Compare x1 with x2 using ucomisd and setcc. Fused compare and
+         * jump instructions only compute the comparison here, and the
+         * jump that follows them is translated on its own. */
+        case JOP_LESS_THAN_NUMBER:
+            checked = 0;
+        /* fallthrough */
+        case JOP_LESS_THAN:
+        case JOP_LESS_THAN_JUMP_IF_NOT:
+            compare = 0x97; /* x2 > x1 */
+            break;
+        case JOP_LESS_THAN_EQUAL_NUMBER:
+            checked = 0;
+        /* fallthrough */
+        case JOP_LESS_THAN_EQUAL:
+        case JOP_LESS_THAN_EQUAL_JUMP_IF_NOT:
+            compare = 0x93; /* x2 >= x1 */
+            break;
+        case JOP_GREATER_THAN_NUMBER:
+            checked = 0;
+        /* fallthrough */
+        case JOP_GREATER_THAN:
+        case JOP_GREATER_THAN_JUMP_IF_NOT:
+            compare = 0x97 | 0x100; /* x1 > x2 */
+            break;
+        case JOP_GREATER_THAN_EQUAL_NUMBER:
+            checked = 0;
+        /* fallthrough */
+        case JOP_GREATER_THAN_EQUAL:
+        case JOP_GREATER_THAN_EQUAL_JUMP_IF_NOT:
+            compare = 0x93 | 0x100; /* x1 >= x2 */
+            break;
+        case JOP_LESS_THAN_IMMEDIATE:
+        case JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT:
+            compare = 0x97;
+            immediate = 1;
+            break;
+        case JOP_GREATER_THAN_IMMEDIATE:
+        case JOP_GREATER_THAN_IMMEDIATE_JUMP_IF_NOT:
+            compare = 0x97 | 0x100;
+            immediate = 1;
+            break;
+        case JOP_EQUALS_IMMEDIATE:
+        case JOP_EQUALS_IMMEDIATE_JUMP_IF_NOT:
+        case JOP_NOT_EQUALS_IMMEDIATE:
+        case JOP_NOT_EQUALS_IMMEDIATE_JUMP_IF_NOT: {
+            /* The interpreter compares these as doubles without a type check */
+            static const uint8_t ucomisd[] = {0x66, 0x0F, 0x2E, 0xC1};
+            static const uint8_t eq[] = {0x0F, 0x94, 0xC0, 0x0F, 0x9B, 0xC1, 0x20, 0xC8};
+            static const uint8_t neq[] = {0x0F, 0x95, 0xC0, 0x0F, 0x9A, 0xC1, 0x08, 0xC8};
+            uint8_t op = instr & 0x7F;
+            jit_load_number(b, JIT_XMM0, B);
+            jit_load_immediate(b, CS);
+            jit_bytes(b, ucomisd, 4);
+            jit_bytes(b, (op == JOP_EQUALS_IMMEDIATE || op == JOP_EQUALS_IMMEDIATE_JUMP_IF_NOT) ? eq : neq, 8);
+            jit_store_boolean(b, A);
+            return 1;
+        }
+    }
+
+    /* Number operands */
+    if (checked) {
+        jit_check_number(b, B, pc);
+        if (!immediate) jit_check_number(b, C, pc);
+    }
+    jit_load_number(b, JIT_XMM0, B);
+    if (immediate) {
+        jit_load_immediate(b, CS);
+    } else {
+        jit_load_number(b, JIT_XMM1, C);
+    }
+
+    if (arith) {
+        /* addsd, subsd, mulsd or divsd xmm0, xmm1 */
+        jit_u8(b, 0xF2);
+        jit_u8(b, 0x0F);
+        jit_u8(b, arith);
+        jit_u8(b, 0xC1);
+        jit_store_number(b, A);
+    } else {
+        /* ucomisd xmm0, xmm1 or ucomisd xmm1, xmm0, then seta or setae al */
+        static const uint8_t swapped[] = {0x66, 0x0F, 0x2E, 0xC1};
+        static const uint8_t normal[] = {0x66, 0x0F, 0x2E, 0xC8};
+        jit_bytes(b, (compare & 0x100) ? swapped : normal, 4);
+        jit_u8(b, 0x0F);
+        jit_u8(b, (uint8_t)(compare & 0xFF));
+        jit_u8(b, 0xC0);
+        jit_store_boolean(b, A);
+    }
+    return 1;
+}
+
+static void jit_patch(JanetJitBuilder *b, int32_t at, int32_t target) {
+    uint32_t rel = (uint32_t)(target - (at + 4));
+    for (int i = 0; i < 4; i++) b->buf[at + i] = (uint8_t)(rel >> (8 * i));
+}
+
+/* Translate a funcdef. Returns NULL if there is nothing worth translating
+ * or executable memory is not available. */
+static JanetJitCode *janet_jit_compile(JanetFuncDef *def) {
+    static const uint8_t prologue[JIT_PROLOGUE_SIZE] = {
+        0x53, /* push rbx */
+        0x41, 0x54, /* push r12 */
+        0x48, 0x89, 0xFB, /* mov rbx, rdi */
+        0x49, 0x89, 0xD4, /* mov r12, rdx */
+        0xFF, 0xE6 /* jmp rsi */
+    };
+    static const uint8_t epilogue[] = {
+        0x41, 0x5C, /* pop r12 */
+        0x5B, /* pop rbx */
+        0xC3 /* ret */
+    };
+    int32_t len = def->bytecode_length;
+    int32_t translated = 0;
+    JanetJitCode *jit = NULL;
+    JanetJitBuilder b;
+    if (len == 0) return NULL;
+
+    jit = janet_malloc(sizeof(JanetJitCode) + (size_t) len * (sizeof(int32_t) + 1));
+    if (NULL == jit) {
+        JANET_OUT_OF_MEMORY;
+    }
+    jit->native = (uint8_t *)(jit->offsets + len);
+    b.def = def;
+    b.buf = NULL;
+    b.offsets = jit->offsets;
+    b.jumps = NULL;
+    b.exits = NULL;
+
+    jit_bytes(&b, prologue, JIT_PROLOGUE_SIZE);
+    jit_bytes(&b, epilogue, sizeof(epilogue));
+    for (int32_t pc = 0; pc < len; pc++) {
+        b.offsets[pc] = janet_v_count(b.buf);
+        jit->native[pc] = (uint8_t) jit_instruction(&b, pc);
+        if (jit->native[pc]) {
+            translated++;
+        } else {
+            jit_exit(&b, pc);
+        }
+    }
+
+    /* Exit stubs for failed type checks and interrupts */
+    for (int32_t i = 0; i < janet_v_count(b.exits); i++) {
+        int32_t stub = janet_v_count(b.buf);
+        jit_exit(&b, b.exits[i].pc);
+        jit_patch(&b, b.exits[i].at, stub);
+    }
+    for (int32_t i = 0; i < janet_v_count(b.jumps); i++) {
+        jit_patch(&b, b.jumps[i].at, b.offsets[b.jumps[i].pc]);
+    }
+
+    jit->code = NULL;
+    if (translated) {
+        long pagesize = sysconf(_SC_PAGESIZE);
+        size_t size = (size_t) janet_v_count(b.buf);
+        if (pagesize > 0) size = (size + (size_t) pagesize - 1) & ~((size_t) pagesize - 1);
+        void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem != MAP_FAILED) {
+            memcpy(mem, b.buf, (size_t) janet_v_count(b.buf));
+            if (mprotect(mem, size, PROT_READ | PROT_EXEC)) {
+                munmap(mem, size);
+            } else {
+                jit->code = mem;
+                jit->size = size;
+            }
+        }
+    }
+
+    janet_v_free(b.buf);
+    janet_v_free(b.jumps);
+    janet_v_free(b.exits);
+    if (NULL == jit->code) {
+        janet_free(jit);
+        return NULL;
+    }
+    return jit;
+}
+
+/* Run the machine code for def from pc, compiling it first if needed.
+ * Returns the instruction where the interpreter should continue. */
+uint32_t *janet_jit_run(JanetFuncDef *def, Janet *stack, uint32_t *pc) {
+    JanetJitCode *jit = def->jit;
+    if (NULL == jit) {
+        jit = janet_jit_compile(def);
+        if (NULL == jit) {
+            /* Do not try again for a long time */
+            def->hotness = INT32_MIN;
+            return pc;
+        }
+        def->jit = jit;
+    }
+    int32_t index = (int32_t)(pc - def->bytecode);
+    if (!jit->native[index]) return pc;
+    JanetJitFunction f;
+    void *code = jit->code;
+    memcpy(&f, &code, sizeof(f));
+    return f(stack, jit->code + jit->offsets[index], &janet_vm);
+}
+
+/* Free the machine code for a funcdef */
+void janet_jit_free(JanetFuncDef *def) {
+    JanetJitCode *jit = def->jit;
+    if (NULL != jit) {
+        munmap(jit->code, jit->size);
+        janet_free(jit);
+        def->jit = NULL;
+    }
+}
+
+/* Throw away machine code after the bytecode changes, such as when
+ * breakpoints are set. It is translated again once the funcdef is hot. */
+void janet_jit_invalidate(JanetFuncDef *def) {
+    janet_jit_free(def);
+    def->hotness = 0;
+}
+
+#endif
@@ -0,0 +1,595 @@
+/*
+* Copyright (c) 2021 Calvin Rose
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to
+* deal in the Software without restriction, including without limitation the
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+* sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#ifndef JANET_AMALG
+#include "features.h"
+#include <janet.h>
+#include "util.h"
+#include <math.h>
+#include <string.h>
+#endif
+
+#ifdef JANET_JSON
+
+/* JSON decoding and encoding. Objects decode to tables, arrays to arrays, and
+ * strings to strings. String bodies, which make up most of a typical document,
+ * are scanned 8 bytes at a time for quotes, backslashes and control characters. */
+
+/* Word at a time byte tests. json_has_zero is nonzero if any byte of v is zero,
+ * json_has_less if any byte is less than n (for n <= 128). */
+#define JSON_ONES 0x0101010101010101ULL
+#define JSON_HIGHS 0x8080808080808080ULL
+#define json_has_zero(v) (((v) - JSON_ONES) & ~(v) & JSON_HIGHS)
+#define json_has_less(v, n) (((v) - JSON_ONES * (n)) & ~(v) & JSON_HIGHS)
+
+typedef struct {
+    const uint8_t *start;
+    const uint8_t *p;
+    const uint8_t *end;
+    int keywords;
+    int nils;
+    int depth;
+    /* Scratch space for strings with escapes, shared by all strings in a document */
+    uint8_t *scratch;
+    size_t scratch_cap;
+} JsonDecoder;
+
+static JANET_NO_RETURN void json_fail(JsonDecoder *d, const char *msg) {
+    janet_panicf("json: %s at byte %d", msg, (int32_t)(d->p - d->start));
+}
+
+static void json_skip_ws(JsonDecoder *d) {
+    const uint8_t *p = d->p;
+    while (p < d->end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+    d->p = p;
+}
+
+static int json_hex4(JsonDecoder *d) {
+    if (d->end - d->p < 4) json_fail(d, "unexpected end of input in escape");
+    int value = 0;
+    for (int i = 0; i < 4; i++) {
+        uint8_t c = d->p[i];
+        int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else json_fail(d, "invalid unicode escape");
+        value = (value << 4) | digit;
+    }
+    d->p += 4;
+    return value;
+}
+
+/* Decode the string starting at the opening quote. The result is either a slice of
+ * the source, when the string has no escapes, or is written to the scratch space. */
+static void json_string(JsonDecoder *d, const uint8_t **out, int32_t *outlen) {
+    const uint8_t *p = ++d->p;
+    const uint8_t *end = d->end;
+    while (end - p >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        uint64_t special = json_has_zero(v ^ (JSON_ONES * '"')) |
+                           json_has_zero(v ^ (JSON_ONES * '\\')) |
+                           json_has_less(v, 0x20);
+        if (special) break;
+        p += 8;
+    }
+    while (p < end && *p != '"' && *p != '\\' && *p >= 0x20) p++;
+    if (p == end) {
+        d->p = p;
+        json_fail(d, "unterminated string");
+    }
+    if (*p == '"') {
+        *out = d->p;
+        *outlen = (int32_t)(p - d->p);
+        d->p = p + 1;
+        return;
+    }
+    if (*p < 0x20) {
+        d->p = p;
+        json_fail(d, "invalid control character in string");
+    }
+    /* Slow path - copy to scratch space, decoding escapes. Escapes never take up
+     * more room than their source, so the rest of the input bounds the length. */
+    size_t needed = (size_t)(end - d->p);
+    if (needed > d->scratch_cap) {
+        d->scratch = janet_srealloc(d->scratch, needed);
+        d->scratch_cap = needed;
+    }
+    size_t n = (size_t)(p - d->p);
+    memcpy(d->scratch, d->p, n);
+    d->p = p;
+    for (;;) {
+        if (d->p == end) json_fail(d, "unterminated string");
+        uint8_t c = *d->p;
+        if (c == '"') break;
+        if (c < 0x20) json_fail(d, "invalid control character in string");
+        if (c != '\\') {
+            d->scratch[n++] = c;
+            d->p++;
+            continue;
+        }
+        if (++d->p == end) json_fail(d, "unterminated string");
+        c = *d->p++;
+        switch (c) {
+            case '"':
+            case '\\':
+            case '/':
+                d->scratch[n++] = c;
+                break;
+            case 'b':
+                d->scratch[n++] = '\b';
+                break;
+            case 'f':
+                d->scratch[n++] = '\f';
+                break;
+            case 'n':
+                d->scratch[n++] = '\n';
+                break;
+            case 'r':
+                d->scratch[n++] = '\r';
+                break;
+            case 't':
+                d->scratch[n++] = '\t';
+                break;
+            case 'u': {
+                int32_t cp = json_hex4(d);
+                if (cp >= 0xDC00 && cp <= 0xDFFF) json_fail(d, "invalid surrogate pair");
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    if (end - d->p < 2 || d->p[0] != '\\' || d->p[1] != 'u') json_fail(d, "invalid surrogate pair");
+                    d->p += 2;
+                    int32_t lo = json_hex4(d);
+                    if (lo < 0xDC00 || lo > 0xDFFF) json_fail(d, "invalid surrogate pair");
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                }
+                if (cp < 0x80) {
+                    d->scratch[n++] = (uint8_t) cp;
+                } else if (cp < 0x800) {
+                    d->scratch[n++] = (uint8_t)(0xC0 | (cp >> 6));
+                    d->scratch[n++] = (uint8_t)(0x80 | (cp & 0x3F));
+                } else if (cp < 0x10000) {
+                    d->scratch[n++] = (uint8_t)(0xE0 | (cp >> 12));
+                    d->scratch[n++] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+                    d->scratch[n++] = (uint8_t)(0x80 | (cp & 0x3F));
+                } else {
+                    d->scratch[n++] = (uint8_t)(0xF0 | (cp >> 18));
+                    d->scratch[n++] = (uint8_t)(0x80 | ((cp >> 12) & 0x3F));
+                    d->scratch[n++] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+                    d->scratch[n++] = (uint8_t)(0x80 | (cp & 0x3F));
+                }
+                break;
+            }
+            default:
+                d->p -= 2;
+                json_fail(d, "invalid escape");
+        }
+    }
+    d->p++;
+    *out = d->scratch;
+    *outlen = (int32_t) n;
+}
+
+static Janet json_number(JsonDecoder *d) {
+    const uint8_t *start = d->p;
+    const uint8_t *p = d->p;
+    const uint8_t *end = d->end;
+    int simple = 1;
+    if (p < end && *p == '-') p++;
+    if (p < end && *p == '0') {
+        p++;
+    } else if (p < end && *p >= '1' && *p <= '9') {
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    } else {
+        d->p = p;
+        json_fail(d, "invalid number");
+    }
+    if (p < end && *p == '.') {
+        simple = 0;
+        p++;
+        if (p == end || *p < '0' || *p > '9') {
+            d->p = p;
+            json_fail(d, "invalid number");
+        }
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        simple = 0;
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        if (p == end || *p < '0' || *p > '9') {
+            d->p = p;
+            json_fail(d, "invalid number");
+        }
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    }
+    d->p = p;
+    /* Integers that fit in a double exactly don't need the full number scanner */
+    if (simple && (p - start) <= 15) {
+        const uint8_t *q = start;
+        int negative = *q == '-';
+        if (negative) q++;
+        int64_t value = 0;
+        while (q < p) value = value * 10 + (*q++ - '0');
+        double x = (double) value;
+        return janet_wrap_number(negative ? -x : x);
+    }
+    double x;
+    if (janet_scan_number(start, (int32_t)(p - start), &x)) {
+        d->p = start;
+        json_fail(d, "invalid number");
+    }
+    return janet_wrap_number(x);
+}
+
+static void json_literal(JsonDecoder *d, const char *lit, size_t len) {
+    if ((size_t)(d->end - d->p) < len || memcmp(d->p, lit, len)) json_fail(d, "unexpected character");
+    d->p += len;
+}
+
+static Janet json_value(JsonDecoder *d) {
+    json_skip_ws(d);
+    if (d->p == d->end) json_fail(d, "unexpected end of input");
+    switch (*d->p) {
+        default:
+            json_fail(d, "unexpected character");
+        case '"': {
+            const uint8_t *bytes;
+            int32_t len;
+            json_string(d, &bytes, &len);
+            return janet_stringv(bytes, len);
+        }
+        case '-':
+        case '0':
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+        case '6':
+        case '7':
+        case '8':
+        case '9':
+            return json_number(d);
+        case 't':
+            json_literal(d, "true", 4);
+            return janet_wrap_true();
+        case 'f':
+            json_literal(d, "false", 5);
+            return janet_wrap_false();
+        case 'n':
+            json_literal(d, "null", 4);
+            return d->nils ? janet_wrap_nil() : janet_ckeywordv("null");
+        case '[': {
+            if (++d->depth > JANET_RECURSION_GUARD) json_fail(d, "nested too deeply");
+            d->p++;
+            JanetArray *array = janet_array(0);
+            json_skip_ws(d);
+            if (d->p < d->end && *d->p == ']') {
+                d->p++;
+            } else {
+                for (;;) {
+                    janet_array_push(array, json_value(d));
+                    json_skip_ws(d);
+                    if (d->p == d->end) json_fail(d, "unexpected end of input");
+                    if (*d->p == ']') {
+                        d->p++;
+                        break;
+                    }
+                    if (*d->p != ',') json_fail(d, "expected , or ]");
+                    d->p++;
+                }
+            }
+            d->depth--;
+            return janet_wrap_array(array);
+        }
+        case '{': {
+            if (++d->depth > JANET_RECURSION_GUARD) json_fail(d, "nested too deeply");
+            d->p++;
+            JanetTable *table = janet_table(0);
+            json_skip_ws(d);
+            if (d->p < d->end && *d->p == '}') {
+                d->p++;
+            } else {
+                for (;;) {
+                    json_skip_ws(d);
+                    if (d->p == d->end) json_fail(d, "unexpected end of input");
+                    if (*d->p != '"') json_fail(d, "expected string key");
+                    const uint8_t *bytes;
+                    int32_t len;
+                    json_string(d, &bytes, &len);
+                    Janet key = d->keywords ? janet_keywordv(bytes, len) : janet_stringv(bytes, len);
+                    json_skip_ws(d);
+                    if (d->p == d->end || *d->p != ':') json_fail(d, "expected :");
+                    d->p++;
+                    janet_table_put(table, key, json_value(d));
+                    json_skip_ws(d);
+                    if (d->p == d->end) json_fail(d, "unexpected end of input");
+                    if (*d->p == '}') {
+                        d->p++;
+                        break;
+                    }
+                    if (*d->p != ',') json_fail(d, "expected , or }");
+                    d->p++;
+                }
+            }
+            d->depth--;
+            return janet_wrap_table(table);
+        }
+    }
+}
+
+static void json_decoder_init(JsonDecoder *d, JanetByteView view, int32_t argc, Janet *argv, int32_t flagarg) {
+    d->start = view.bytes;
+    d->p = view.bytes;
+    d->end = view.bytes + view.len;
+    d->keywords = argc > flagarg && janet_truthy(argv[flagarg]);
+    d->nils = argc > flagarg + 1 && janet_truthy(argv[flagarg + 1]);
+    d->depth = 0;
+    d->scratch = NULL;
+    d->scratch_cap = 0;
+}
+
+JANET_CORE_FN(cfun_json_decode,
+              "(json/decode src &opt keywords nils)",
+              "Decode a JSON document in a string or buffer. Objects become tables, arrays become arrays, "
+              "and strings become strings. If `keywords` is truthy, object keys become keywords. "
+              "JSON null becomes the keyword :null, or nil if `nils` is truthy. Raises an error "
+              "if `src` is not a single, valid JSON value.") {
+    janet_arity(argc, 1, 3);
+    JsonDecoder d;
+    json_decoder_init(&d, janet_getbytes(argv, 0), argc, argv, 1);
+    Janet ret = json_value(&d);
+    json_skip_ws(&d);
+    if (d.p != d.end) json_fail(&d, "unexpected trailing characters");
+    janet_sfree(d.scratch);
+    return ret;
+}
+
+JANET_CORE_FN(cfun_json_decode_next,
+              "(json/decode-next src &opt start keywords nils)",
+              "Decode the JSON value in `src` that begins at byte index `start`, which defaults to 0. "
+              "Returns a tuple of the value and the index just past it, or nil if only whitespace "
+              "remains. This reads sequences of values, such as newline delimited JSON, "
+              "without slicing the input. Options are as for json/decode.") {
+    janet_arity(argc, 1, 4);
+    JanetByteView view = janet_getbytes(argv, 0);
+    int32_t start = janet_optinteger(argv, argc, 1, 0);
+    if (start < 0 || start > view.len) janet_panicf("start index %d out of range [0,%d]", start, view.len);
+    JsonDecoder d;
+    json_decoder_init(&d, view, argc, argv, 2);
+    d.p += start;
+    json_skip_ws(&d);
+    if (d.p == d.end) return janet_wrap_nil();
+    Janet tup[2];
+    tup[0] = json_value(&d);
+    tup[1] = janet_wrap_integer((int32_t)(d.p - d.start));
+    janet_sfree(d.scratch);
+    return janet_wrap_tuple(janet_tuple_n(tup, 2));
+}
+
+/*
+ * Encoding
+ */
+
+typedef struct {
+    JanetBuffer *buffer;
+    const uint8_t *tab;
+    int32_t tablen;
+    const uint8_t *newline;
+    int32_t newlinelen;
+} JsonEncoder;
+
+static void json_encode_newline(JsonEncoder *e, int depth) {
+    if (!e->newlinelen && !e->tablen) return;
+    janet_buffer_push_bytes(e->buffer, e->newline, e->newlinelen);
+    for (int i = 0; i < depth; i++) janet_buffer_push_bytes(e->buffer, e->tab, e->tablen);
+}
+
+static void json_encode_string(JsonEncoder *e, const uint8_t *str, int32_t len) {
+    static const char hex[] = "0123456789abcdef";
+    JanetBuffer *b = e->buffer;
+    /* Reserve room for the common case of a string that needs no escapes */
+    janet_buffer_extra(b, len + 2);
+    b->data[b->count++] = '"';
+    int32_t i = 0;
+    while (i < len) {
+        int32_t run = i;
+        while (len - run >= 8) {
+            uint64_t v;
+            memcpy(&v, str + run, 8);
+            uint64_t special = json_has_zero(v ^ (JSON_ONES * '"')) |
+                               json_has_zero(v ^ (JSON_ONES * '\\')) |
+                               json_has_less(v, 0x20);
+            if (special) break;
+            run += 8;
+        }
+        while (run < len && str[run] != '"' && str[run] != '\\' && str[run] >= 0x20) run++;
+        janet_buffer_push_bytes(b, str + i, run - i);
+        if (run == len) break;
+        uint8_t c = str[run];
+        switch (c) {
+            case '"':
+                janet_buffer_push_bytes(b, (const uint8_t *) "\\\"", 2);
+                break;
+            case '\\':
+                janet_buffer_push_bytes(b, (const uint8_t *) "\\\\", 2);
+                break;
+            case '\n':
+                janet_buffer_push_bytes(b, (const uint8_t *) "\\n", 2);
+                break;
+            case '\r':
+                janet_buffer_push_bytes(b, (const uint8_t *) "\\r", 2);
+                break;
+            case '\t':
+                janet_buffer_push_bytes(b, (const uint8_t *) "\\t", 2);
+                break;
+            default: {
+                uint8_t esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+                janet_buffer_push_bytes(b, esc, 6);
+                break;
+            }
+        }
+        i = run + 1;
+    }
+    janet_buffer_push_u8(b, '"');
+}
+
+static void json_encode_key(JsonEncoder *e, Janet key) {
+    if (!janet_checktypes(key, JANET_TFLAG_BYTES)) {
+        janet_panicf("json: object key must be a string, symbol, keyword or buffer, got %v", key);
+    }
+    JanetByteView view;
+    janet_bytes_view(key, &view.bytes, &view.len);
+    json_encode_string(e, view.bytes, view.len);
+    janet_buffer_push_u8(e->buffer, ':');
+    if (e->tablen || e->newlinelen) janet_buffer_push_u8(e->buffer, ' ');
+}
+
+static void json_encode_value(JsonEncoder *e, Janet x, int depth) {
+    if (depth > JANET_RECURSION_GUARD) janet_panic("json: nested too deeply, possible cycle");
+    JanetBuffer *b = e->buffer;
+    switch (janet_type(x)) {
+        default:
+            janet_panicf("json: cannot encode %T %v", janet_type(x), x);
+        case JANET_NIL:
+            janet_buffer_push_bytes(b, (const uint8_t *) "null", 4);
+            break;
+        case JANET_BOOLEAN:
+            if (janet_unwrap_boolean(x)) {
+                janet_buffer_push_bytes(b, (const uint8_t *) "true", 4);
+            } else {
+                janet_buffer_push_bytes(b, (const uint8_t *) "false", 5);
+            }
+            break;
+        case JANET_NUMBER: {
+            double num = janet_unwrap_number(x);
+            if (!isfinite(num)) janet_panicf("json: cannot encode %v", x);
+            if (num == floor(num) && num <= JANET_INTMAX_DOUBLE && num >= JANET_INTMIN_DOUBLE) {
+                janet_buffer_extra(b, 32);
+                b->count += snprintf((char *) b->data + b->count, 32, "%.0f", num);
+            } else {
+                janet_buffer_push_shortest(b, num);
+            }
+            break;
+        }
+        case JANET_STRING:
+        case JANET_SYMBOL:
+        case JANET_BUFFER: {
+            JanetByteView view;
+            janet_bytes_view(x, &view.bytes, &view.len);
+            json_encode_string(e, view.bytes, view.len);
+            break;
+        }
+        case JANET_KEYWORD:
+            if (!janet_cstrcmp(janet_unwrap_keyword(x), "null")) {
+                janet_buffer_push_bytes(b, (const uint8_t *) "null", 4);
+            } else {
+                const uint8_t *kw = janet_unwrap_keyword(x);
+                json_encode_string(e, kw, janet_string_length(kw));
+            }
+            break;
+        case JANET_ARRAY:
+        case JANET_TUPLE: {
+            const Janet *items;
+            int32_t len;
+            janet_indexed_view(x, &items, &len);
+            janet_buffer_push_u8(b, '[');
+            for (int32_t i = 0; i < len; i++) {
+                if (i) janet_buffer_push_u8(b, ',');
+                json_encode_newline(e, depth + 1);
+                json_encode_value(e, items[i], depth + 1);
+            }
+            if (len) json_encode_newline(e, depth);
+            janet_buffer_push_u8(b, ']');
+            break;
+        }
+        case JANET_TABLE:
+        case JANET_STRUCT: {
+            const JanetKV *kvs;
+            int32_t count, cap;
+            janet_dictionary_view(x, &kvs, &count, &cap);
+            janet_buffer_push_u8(b, '{');
+            int first = 1;
+            for (int32_t i = 0; i < cap; i++) {
+                if (janet_checktype(kvs[i].key, JANET_NIL)) continue;
+                if (!first) janet_buffer_push_u8(b, ',');
+                first = 0;
+                json_encode_newline(e, depth + 1);
+                json_encode_key(e, kvs[i].key);
+                json_encode_value(e, kvs[i].value, depth + 1);
+            }
+            if (!first) json_encode_newline(e, depth);
+            janet_buffer_push_u8(b, '}');
+            break;
+        }
+    }
+}
+
+JANET_CORE_FN(cfun_json_encode,
+              "(json/encode x &opt tab newline buf)",
+              "Encode a value as JSON. Tables and structs become objects, and their keys must be "
+              "strings, symbols, keywords or buffers. Arrays and tuples become arrays, and nil and "
+              ":null become null. If `tab` or `newline` is given, the output is indented with them. "
+              "Appends to `buf` if provided, which lets a buffer be reused across calls, "
+              "and returns the buffer.") {
+    janet_arity(argc, 1, 4);
+    JsonEncoder e;
+    JanetByteView tab = {NULL, 0};
+    JanetByteView newline = {NULL, 0};
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) tab = janet_getbytes(argv, 1);
+    if (argc > 2 && !janet_checktype(argv[2], JANET_NIL)) newline = janet_getbytes(argv, 2);
+    e.tab = tab.bytes;
+    e.tablen = tab.len;
+    e.newline = newline.bytes;
+    e.newlinelen = newline.len;
+    if (e.tablen && !e.newlinelen) {
+        e.newline = (const uint8_t *) "\n";
+        e.newlinelen = 1;
+    }
+    e.buffer = janet_optbuffer(argv, argc, 3, 10);
+    int32_t count = e.buffer->count;
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    if (signal == JANET_SIGNAL_OK) {
+        json_encode_value(&e, argv[0], 0);
+        janet_restore(&tstate);
+    } else {
+        janet_restore(&tstate);
+        /* Don't leave half an encoding in a reused buffer */
+        e.buffer->count = count;
+        janet_signalv(signal, tstate.payload);
+    }
+    return janet_wrap_buffer(e.buffer);
+}
+
+/* Load the json module */
+void janet_lib_json(JanetTable *env) {
+    JanetRegExt json_cfuns[] = {
+        JANET_CORE_REG("json/decode", cfun_json_decode),
+        JANET_CORE_REG("json/decode-next", cfun_json_decode_next),
+        JANET_CORE_REG("json/encode", cfun_json_encode),
+        JANET_REG_END
+    };
+    janet_core_cfuns_ext(env, NULL, json_cfuns);
+}
+
+#endif
@@ -30,12 +30,25 @@
 #include "util.h"
 #endif
 
+#include <errno.h>
+#ifdef JANET_WINDOWS
+#include <stdio.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 typedef struct {
     JanetBuffer *buf;
     JanetTable seen;
     JanetTable *rreg;
     JanetFuncEnv **seen_envs;
     JanetFuncDef **seen_defs;
+    JanetFuncDef **lazy_defs;
+    int32_t *lazy_ids;
+    JanetBuffer **moved;
     int32_t nextid;
 } MarshalState;
 
@@ -66,10 +79,17 @@ enum {
     LB_UNSAFE_POINTER, /* 222 */
     LB_STRUCT_PROTO, /* 223 */
 #ifdef JANET_EV
-    LB_THREADED_ABSTRACT/* 224 */
+    LB_THREADED_ABSTRACT, /* 224 */
 #endif
+    LB_DEFERRED = 225, /* 225 */
+    LB_COMPACT = 226, /* 226 */
+    LB_BUFFER_MOVE = 227 /* 227 */
 } LeadBytes;
 
+/* Set in the flags of a marshalled funcdef whose body is written after the
+ * marshalled value, and of an unmarshalled funcdef until its body is read. */
+#define JANET_FUNCDEF_FLAG_DEFERRED 0x40000
+
 /* Helper to look inside an entry in an environment */
 static Janet entry_getval(Janet env_entry) {
     if (janet_checktype(env_entry, JANET_TABLE)) {
@@ -228,34 +248,17 @@ static void janet_marshal_u32s(MarshalState *st, const uint32_t *u32s, int32_t n
     }
 }
 
-/* Marshal a function def */
-static void marshal_one_def(MarshalState *st, JanetFuncDef *def, int flags) {
-    MARSH_STACKCHECK;
-    for (int32_t i = 0; i < janet_v_count(st->seen_defs); i++) {
-        if (st->seen_defs[i] == def) {
-            pushbyte(st, LB_FUNCDEF_REF);
-            pushint(st, i);
-            return;
-        }
+/* Marshal the constants, bytecode, sub funcdefs and debug info of a function def */
+/* Marshal the parent slots a funcdef copies when a closure is created */
+static void marshal_def_captures(MarshalState *st, JanetFuncDef *def) {
+    if (def->flags & JANET_FUNCDEF_FLAG_HASCAPTURES) {
+        pushint(st, def->captures_length);
+        for (int32_t i = 0; i < def->captures_length; i++)
+            pushint(st, def->captures[i]);
     }
-    /* Add to lookup */
-    janet_v_push(st->seen_defs, def);
-    pushint(st, def->flags);
-    pushint(st, def->slotcount);
-    pushint(st, def->arity);
-    pushint(st, def->min_arity);
-    pushint(st, def->max_arity);
-    pushint(st, def->constants_length);
-    pushint(st, def->bytecode_length);
-    if (def->flags & JANET_FUNCDEF_FLAG_HASENVS)
-        pushint(st, def->environments_length);
-    if (def->flags & JANET_FUNCDEF_FLAG_HASDEFS)
-        pushint(st, def->defs_length);
-    if (def->flags & JANET_FUNCDEF_FLAG_HASNAME)
-        marshal_one(st, janet_wrap_string(def->name), flags);
-    if (def->flags & JANET_FUNCDEF_FLAG_HASSOURCE)
-        marshal_one(st, janet_wrap_string(def->source), flags);
+}
 
+static void marshal_def_body(MarshalState *st, JanetFuncDef *def, int with_envs, int flags) {
     /* marshal constants */
     for (int32_t i = 0; i < def->constants_length; i++)
         marshal_one(st, def->constants[i], flags);
@@ -264,8 +267,11 @@ static void marshal_one_def(MarshalState *st, JanetFuncDef *def, int flags) {
     janet_marshal_u32s(st, def->bytecode, def->bytecode_length);
 
     /* marshal the environments if needed */
-    for (int32_t i = 0; i < def->environments_length; i++)
-        pushint(st, def->environments[i]);
+    if (with_envs) {
+        for (int32_t i = 0; i < def->environments_length; i++)
+            pushint(st, def->environments[i]);
+        marshal_def_captures(st, def);
+    }
 
     /* marshal the sub funcdefs if needed */
     for (int32_t i = 0; i < def->defs_length; i++)
@@ -288,6 +294,96 @@ static void marshal_one_def(MarshalState *st, JanetFuncDef *def, int flags) {
     }
 }
 
+/* Marshal a function def */
+static void marshal_one_def(MarshalState *st, JanetFuncDef *def, int flags) {
+    MARSH_STACKCHECK;
+    for (int32_t i = 0; i < janet_v_count(st->seen_defs); i++) {
+        if (st->seen_defs[i] == def) {
+            pushbyte(st, LB_FUNCDEF_REF);
+            pushint(st, i);
+            return;
+        }
+    }
+    if (def->lazy) janet_funcdef_force(def);
+    /* Add to lookup */
+    janet_v_push(st->seen_defs, def);
+    if (flags & JANET_MARSHAL_LAZY) {
+        /* Only write what is needed to create closures, the body is
+         * written after the rest of the value by marshal_deferred. */
+        pushint(st, def->flags | JANET_FUNCDEF_FLAG_DEFERRED);
+        pushint(st, def->slotcount);
+        pushint(st, def->arity);
+        pushint(st, def->min_arity);
+        pushint(st, def->max_arity);
+        if (def->flags & JANET_FUNCDEF_FLAG_HASENVS)
+            pushint(st, def->environments_length);
+        if (def->flags & JANET_FUNCDEF_FLAG_HASNAME)
+            marshal_one(st, janet_wrap_string(def->name), flags);
+        if (def->flags & JANET_FUNCDEF_FLAG_HASSOURCE)
+            marshal_one(st, janet_wrap_string(def->source), flags);
+        for (int32_t i = 0; i < def->environments_length; i++)
+            pushint(st, def->environments[i]);
+        marshal_def_captures(st, def);
+        janet_v_push(st->lazy_defs, def);
+        janet_v_push(st->lazy_ids, janet_v_count(st->seen_defs) - 1);
+        return;
+    }
+    pushint(st, def->flags);
+    pushint(st, def->slotcount);
+    pushint(st, def->arity);
+    pushint(st, def->min_arity);
+    pushint(st, def->max_arity);
+    pushint(st, def->constants_length);
+    pushint(st, def->bytecode_length);
+    if (def->flags & JANET_FUNCDEF_FLAG_HASENVS)
+        pushint(st, def->environments_length);
+    if (def->flags & JANET_FUNCDEF_FLAG_HASDEFS)
+        pushint(st, def->defs_length);
+    if (def->flags & JANET_FUNCDEF_FLAG_HASNAME)
+        marshal_one(st, janet_wrap_string(def->name), flags);
+    if (def->flags & JANET_FUNCDEF_FLAG_HASSOURCE)
+        marshal_one(st, janet_wrap_string(def->source), flags);
+    marshal_def_body(st, def, 1, flags);
+}
+
+/* Write the bodies of the funcdefs deferred by marshal_one_def. A directory
+ * with the size of each body and the number of objects it contains comes
+ * first, so an unmarshaller can skip bodies without decoding them. Bodies can
+ * defer more funcdefs, which are appended to the queue as we go. */
+static void marshal_deferred(MarshalState *st, int flags) {
+    JanetBuffer *out = st->buf;
+    JanetBuffer bodies;
+    int32_t *dir = NULL;
+    int32_t last_id = 0;
+    janet_buffer_init(&bodies, 0);
+    st->buf = &bodies;
+    for (int32_t i = 0; i < janet_v_count(st->lazy_defs); i++) {
+        JanetFuncDef *def = st->lazy_defs[i];
+        int32_t start = bodies.count;
+        int32_t nextid = st->nextid;
+        int32_t ndefs = janet_v_count(st->seen_defs);
+        int32_t nenvs = janet_v_count(st->seen_envs);
+        pushint(st, def->constants_length);
+        pushint(st, def->bytecode_length);
+        if (def->flags & JANET_FUNCDEF_FLAG_HASDEFS)
+            pushint(st, def->defs_length);
+        marshal_def_body(st, def, 0, flags);
+        janet_v_push(dir, st->lazy_ids[i] - last_id);
+        janet_v_push(dir, st->nextid - nextid);
+        janet_v_push(dir, janet_v_count(st->seen_defs) - ndefs);
+        janet_v_push(dir, janet_v_count(st->seen_envs) - nenvs);
+        janet_v_push(dir, bodies.count - start);
+        last_id = st->lazy_ids[i];
+    }
+    st->buf = out;
+    pushint(st, janet_v_count(st->lazy_defs));
+    for (int32_t i = 0; i < janet_v_count(dir); i++)
+        pushint(st, dir[i]);
+    pushbytes(st, bodies.data, bodies.count);
+    janet_buffer_deinit(&bodies);
+    janet_v_free(dir);
+}
+
 #define JANET_FIBER_FLAG_HASCHILD (1 << 29)
 #define JANET_FIBER_FLAG_HASENV   (1 << 30)
 #define JANET_STACKFRAME_HASENV   (INT32_MIN)
@@ -495,6 +591,19 @@ static void marshal_one(MarshalState *st, Janet x, int flags) {
             JanetBuffer *buffer = janet_unwrap_buffer(x);
             /* Record reference */
             MARK_SEEN();
+            if (flags & JANET_MARSHAL_MOVE) {
+                /* The memory is handed over once marshalling succeeds, so it must not
+                 * be in use by a pending read or write, or by a native call. */
+                if (janet_buffer_borrowed(buffer)) {
+                    janet_panic("cannot move buffer that is in use");
+                }
+                pushbyte(st, LB_BUFFER_MOVE);
+                pushint(st, buffer->count);
+                pushint(st, buffer->capacity);
+                pushbytes(st, (uint8_t *) &buffer->data, sizeof(uint8_t *));
+                janet_v_push(st->moved, buffer);
+                return;
+            }
             pushbyte(st, LB_BUFFER);
             pushint(st, buffer->count);
             pushbytes(st, buffer->data, buffer->count);
@@ -602,34 +711,221 @@ static void marshal_one(MarshalState *st, Janet x, int flags) {
 #undef MARK_SEEN
 }
 
+/*
+ * Compact format
+ */
+
+/* A value marshalled with JANET_MARSHAL_COMPACT is written as LB_COMPACT, a
+ * format version, and the length of the plain encoding as a LEB128 varint,
+ * followed by the plain encoding compressed with a small LZ77 scheme. The
+ * compressed data is a series of sequences, each a token byte holding a
+ * literal count and a match length less 4 in its high and low nibbles, which
+ * are followed by varints when they are 15. Then come the literals, and then
+ * a 2 byte little endian match offset. The last sequence has no match, and ends
+ * where the plain encoding does.
+ *
+ * Only the header length is a varint. The plain encoding inside is unchanged:
+ * lengths of strings, tuples and arrays keep their 1, 2 or 5 byte integers, and
+ * repeated strings, keywords and symbols are already written once and then
+ * referenced through the seen table, so there is no separate dictionary. */
+
+#define JANET_MARSHAL_COMPACT_VERSION 1
+#define COMPACT_HASH_BITS 14
+#define COMPACT_MIN_MATCH 4
+#define COMPACT_MAX_OFFSET 0xFFFF
+
+static void compact_push_varint(JanetBuffer *buf, uint64_t x) {
+    while (x >= 0x80) {
+        janet_buffer_push_u8(buf, (uint8_t)(x | 0x80));
+        x >>= 7;
+    }
+    janet_buffer_push_u8(buf, (uint8_t) x);
+}
+
+static uint64_t compact_read_varint(const uint8_t **atdata, const uint8_t *end) {
+    const uint8_t *data = *atdata;
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (data >= end) janet_panic("unexpected end of source");
+        uint8_t b = *data++;
+        x |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *atdata = data;
+            return x;
+        }
+    }
+    janet_panic("invalid varint in compact marshal data");
+    return 0;
+}
+
+static uint32_t compact_hash(const uint8_t *p) {
+    uint32_t v = (uint32_t) p[0] |
+                 ((uint32_t) p[1] << 8) |
+                 ((uint32_t) p[2] << 16) |
+                 ((uint32_t) p[3] << 24);
+    return (v * 2654435761u) >> (32 - COMPACT_HASH_BITS);
+}
+
+static void compact_sequence(JanetBuffer *buf, const uint8_t *literals, int32_t nlit,
+                             int32_t match, int32_t offset) {
+    int32_t extra = match ? match - COMPACT_MIN_MATCH : 0;
+    janet_buffer_push_u8(buf, (uint8_t)(((nlit < 15 ? nlit : 15) << 4) | (extra < 15 ? extra : 15)));
+    if (nlit >= 15) compact_push_varint(buf, (uint64_t)(nlit - 15));
+    janet_buffer_push_bytes(buf, literals, nlit);
+    if (match) {
+        janet_buffer_push_u8(buf, offset & 0xFF);
+        janet_buffer_push_u8(buf, (offset >> 8) & 0xFF);
+        if (extra >= 15) compact_push_varint(buf, (uint64_t)(extra - 15));
+    }
+}
+
+/* Write the compact header and the compressed form of a plain encoding */
+static void compact_compress(JanetBuffer *buf, const uint8_t *src, int32_t n) {
+    janet_buffer_push_u8(buf, LB_COMPACT);
+    janet_buffer_push_u8(buf, JANET_MARSHAL_COMPACT_VERSION);
+    compact_push_varint(buf, (uint64_t) n);
+    /* Positions are stored plus one, so zero is empty */
+    uint32_t *table = janet_scalloc((size_t) 1 << COMPACT_HASH_BITS, sizeof(uint32_t));
+    int32_t anchor = 0;
+    int32_t i = 0;
+    while (i + COMPACT_MIN_MATCH <= n) {
+        uint32_t h = compact_hash(src + i);
+        int32_t candidate = (int32_t) table[h] - 1;
+        table[h] = (uint32_t) i + 1;
+        if (candidate >= 0 && i - candidate <= COMPACT_MAX_OFFSET &&
+                !memcmp(src + candidate, src + i, COMPACT_MIN_MATCH)) {
+            int32_t len = COMPACT_MIN_MATCH;
+            while (i + len < n && src[candidate + len] == src[i + len]) len++;
+            compact_sequence(buf, src + anchor, i - anchor, len, i - candidate);
+            i += len;
+            anchor = i;
+            if (i + COMPACT_MIN_MATCH <= n + 2) {
+                table[compact_hash(src + i - 2)] = (uint32_t)(i - 2) + 1;
+            }
+        } else {
+            i++;
+        }
+    }
+    compact_sequence(buf, src + anchor, n - anchor, 0, 0);
+    janet_sfree(table);
+}
+
+/* Decompress into out, which has room for the len bytes of the plain
+ * encoding. Returns the end of the compressed data. */
+static const uint8_t *compact_decompress(const uint8_t *data, const uint8_t *end,
+        uint8_t *out, size_t len) {
+    size_t at = 0;
+    for (;;) {
+        if (data >= end) janet_panic("unexpected end of source");
+        uint8_t token = *data++;
+        uint64_t nlit = token >> 4;
+        if (nlit == 15) nlit += compact_read_varint(&data, end);
+        if (nlit > (uint64_t)(end - data) || nlit > len - at)
+            janet_panic("invalid compact marshal data");
+        memcpy(out + at, data, (size_t) nlit);
+        at += (size_t) nlit;
+        data += nlit;
+        if (at == len) return data;
+        if (end - data < 2) janet_panic("unexpected end of source");
+        size_t offset = (size_t) data[0] | ((size_t) data[1] << 8);
+        data += 2;
+        uint64_t match = token & 0xF;
+        if (match == 15) match += compact_read_varint(&data, end);
+        match += COMPACT_MIN_MATCH;
+        if (offset == 0 || offset > at || match > len - at)
+            janet_panic("invalid compact marshal data");
+        uint8_t *dest = out + at;
+        const uint8_t *from = dest - offset;
+        if (offset >= match) {
+            memcpy(dest, from, (size_t) match);
+        } else {
+            for (size_t j = 0; j < match; j++) dest[j] = from[j];
+        }
+        at += (size_t) match;
+    }
+}
+
 void janet_marshal(
     JanetBuffer *buf,
     Janet x,
     JanetTable *rreg,
     int flags) {
+    if (flags & JANET_MARSHAL_COMPACT) {
+        JanetBuffer *plain = janet_buffer(0);
+        janet_marshal(plain, x, rreg, flags & ~JANET_MARSHAL_COMPACT);
+        compact_compress(buf, plain->data, plain->count);
+        return;
+    }
     MarshalState st;
     st.buf = buf;
     st.nextid = 0;
     st.seen_defs = NULL;
     st.seen_envs = NULL;
+    st.lazy_defs = NULL;
+    st.lazy_ids = NULL;
+    st.moved = NULL;
     st.rreg = rreg;
     janet_table_init(&st.seen, 0);
-    marshal_one(&st, x, flags);
+    if (flags & JANET_MARSHAL_LAZY) {
+        pushbyte(&st, LB_DEFERRED);
+        marshal_one(&st, x, flags);
+        marshal_deferred(&st, flags);
+    } else {
+        marshal_one(&st, x, flags);
+    }
+    /* Moved buffers are left empty */
+    for (int32_t i = 0; i < janet_v_count(st.moved); i++) {
+        janet_buffer_init(st.moved[i], 0);
+    }
+    janet_v_free(st.moved);
     janet_table_deinit(&st.seen);
     janet_v_free(st.seen_envs);
     janet_v_free(st.seen_defs);
+    janet_v_free(st.lazy_defs);
+    janet_v_free(st.lazy_ids);
 }
 
+typedef struct JanetLazyBody JanetLazyBody;
+
 typedef struct {
-    jmp_buf err;
     Janet *lookup;
     JanetTable *reg;
     JanetFuncEnv **lookup_envs;
     JanetFuncDef **lookup_defs;
     const uint8_t *start;
     const uint8_t *end;
+    /* Where the next object of each kind is stored. These only differ from
+     * the lengths of the lookup vectors while decoding a deferred body. */
+    int32_t lookup_next;
+    int32_t defs_next;
+    int32_t envs_next;
+    JanetLazyBody *bodies;
+    int32_t body_count;
+    int flags;
 } UnmarshalState;
 
+/* A deferred funcdef body. The objects it contains have the index ranges
+ * [start, start + count) in the lookup, funcdef, and funcenv vectors, in order. */
+struct JanetLazyBody {
+    UnmarshalState *st;
+    const uint8_t *data;
+    int32_t size;
+    int32_t def;
+    int32_t start[3];
+    int32_t count[3];
+    int loaded;
+};
+
+/* Once the directory of deferred bodies is read, the lookup vectors have
+ * room for every object and never grow again. */
+#define UNMARSHAL_SEEN(st, v, next, x) do { \
+    if ((next) < janet_v_count(v)) (v)[(next)] = (x); \
+    else if (NULL != (st)->bodies) janet_panic("too many objects"); \
+    else janet_v_push((v), (x)); \
+    (next)++; \
+} while (0)
+#define unmarshal_seen(st, x) UNMARSHAL_SEEN((st), (st)->lookup, (st)->lookup_next, (x))
+
 #define MARSH_EOS(st, data) do { \
     if ((data) >= (st)->end) janet_panic("unexpected end of source");\
 } while (0)
@@ -726,6 +1022,8 @@ static const uint8_t *unmarshal_one_fiber(
     JanetFiber **out,
     int flags);
 
+static void lazy_resolve(UnmarshalState *st, int kind, int32_t index);
+
 /* Unmarshal a funcenv */
 static const uint8_t *unmarshal_one_env(
     UnmarshalState *st,
@@ -738,13 +1036,17 @@ static const uint8_t *unmarshal_one_env(
         int32_t index = readint(st, &data);
         if (index < 0 || index >= janet_v_count(st->lookup_envs))
             janet_panicf("invalid funcenv reference %d", index);
+        if (NULL == st->lookup_envs[index])
+            lazy_resolve(st, 2, index);
+        if (NULL == st->lookup_envs[index])
+            janet_panicf("invalid funcenv reference %d", index);
         *out = st->lookup_envs[index];
     } else {
         JanetFuncEnv *env = janet_gcalloc(JANET_MEMORY_FUNCENV, sizeof(JanetFuncEnv));
         env->length = 0;
         env->offset = 0;
         env->as.values = NULL;
-        janet_v_push(st->lookup_envs, env);
+        UNMARSHAL_SEEN(st, st->lookup_envs, st->envs_next, env);
         int32_t offset = readnat(st, &data);
         int32_t length = readnat(st, &data);
         if (offset > 0) {
@@ -788,6 +1090,139 @@ static const uint8_t *janet_unmarshal_u32s(UnmarshalState *st, const uint8_t *da
     return data;
 }
 
+/* Unmarshal the environments a funcdef captures from its parent */
+static const uint8_t *unmarshal_def_envs(
+    UnmarshalState *st,
+    const uint8_t *data,
+    JanetFuncDef *def,
+    int32_t environments_length) {
+    if (def->flags & JANET_FUNCDEF_FLAG_HASENVS) {
+        def->environments = janet_calloc(1, sizeof(int32_t) * (size_t) environments_length);
+        if (!def->environments) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (int32_t i = 0; i < environments_length; i++) {
+            def->environments[i] = readint(st, &data);
+        }
+    } else {
+        def->environments = NULL;
+    }
+    def->environments_length = environments_length;
+    if (def->flags & JANET_FUNCDEF_FLAG_HASCAPTURES) {
+        int32_t captures_length = readnat(st, &data);
+        def->captures = janet_calloc(1, sizeof(int32_t) * (size_t) captures_length + 1);
+        if (!def->captures) {
+            JANET_OUT_OF_MEMORY;
+        }
+        def->captures_length = captures_length;
+        for (int32_t i = 0; i < captures_length; i++) {
+            def->captures[i] = readnat(st, &data);
+        }
+    }
+    return data;
+}
+
+/* Unmarshal the constants, bytecode, sub funcdefs and debug info of a funcdef.
+ * A negative environments_length means the environments were read with the header. */
+static const uint8_t *unmarshal_def_body(
+    UnmarshalState *st,
+    const uint8_t *data,
+    JanetFuncDef *def,
+    int32_t constants_length,
+    int32_t bytecode_length,
+    int32_t environments_length,
+    int32_t defs_length,
+    int flags) {
+
+    /* Unmarshal constants */
+    if (constants_length) {
+        def->constants = janet_malloc(sizeof(Janet) * constants_length);
+        if (!def->constants) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (int32_t i = 0; i < constants_length; i++)
+            data = unmarshal_one(st, data, def->constants + i, flags + 1);
+    } else {
+        def->constants = NULL;
+    }
+    def->constants_length = constants_length;
+
+    /* Unmarshal bytecode */
+    def->bytecode = janet_malloc(sizeof(uint32_t) * bytecode_length);
+    if (!def->bytecode) {
+        JANET_OUT_OF_MEMORY;
+    }
+    data = janet_unmarshal_u32s(st, data, def->bytecode, bytecode_length);
+    def->bytecode_length = bytecode_length;
+
+    /* Unmarshal environments */
+    if (environments_length >= 0) {
+        data = unmarshal_def_envs(st, data, def, environments_length);
+    }
+
+    /* Unmarshal sub funcdefs */
+    if (def->flags & JANET_FUNCDEF_FLAG_HASDEFS) {
+        def->defs = janet_calloc(1, sizeof(JanetFuncDef *) * (size_t) defs_length);
+        if (!def->defs) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (int32_t i = 0; i < defs_length; i++) {
+            data = unmarshal_one_def(st, data, def->defs + i, flags + 1);
+        }
+    } else {
+        def->defs = NULL;
+    }
+    def->defs_length = defs_length;
+
+    /* Unmarshal source maps if needed */
+    if (def->flags & JANET_FUNCDEF_FLAG_HASSOURCEMAP) {
+        int32_t current = 0;
+        def->sourcemap = janet_malloc(sizeof(JanetSourceMapping) * (size_t) bytecode_length);
+        if (!def->sourcemap) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (int32_t i = 0; i < bytecode_length; i++) {
+            current += readint(st, &data);
+            def->sourcemap[i].line = current;
+            def->sourcemap[i].column = readint(st, &data);
+        }
+    } else {
+        def->sourcemap = NULL;
+    }
+
+    /* Unmarshal closure bitset if needed */
+    if (def->flags & JANET_FUNCDEF_FLAG_HASCLOBITSET) {
+        int32_t n = (def->slotcount + 31) >> 5;
+        def->closure_bitset = janet_malloc(sizeof(uint32_t) * (size_t) n);
+        if (NULL == def->closure_bitset) {
+            JANET_OUT_OF_MEMORY;
+        }
+        data = janet_unmarshal_u32s(st, data, def->closure_bitset, n);
+    }
+
+    /* Validate */
+    if (janet_verify(def))
+        janet_panic("funcdef has invalid bytecode");
+
+    return data;
+}
+
+/* Find the deferred body of the funcdef with a given index */
+static JanetLazyBody *lazy_find_def(UnmarshalState *st, int32_t index) {
+    int32_t lo = 0, hi = st->body_count;
+    while (lo < hi) {
+        int32_t mid = lo + ((hi - lo) >> 1);
+        if (st->bodies[mid].def < index) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < st->body_count && st->bodies[lo].def == index) return st->bodies + lo;
+    janet_panicf("missing body for funcdef %d", index);
+    return NULL;
+}
+
 /* Unmarshal a funcdef */
 static const uint8_t *unmarshal_one_def(
     UnmarshalState *st,
@@ -800,12 +1235,18 @@ static const uint8_t *unmarshal_one_def(
         int32_t index = readint(st, &data);
         if (index < 0 || index >= janet_v_count(st->lookup_defs))
             janet_panicf("invalid funcdef reference %d", index);
+        if (NULL == st->lookup_defs[index])
+            lazy_resolve(st, 1, index);
+        if (NULL == st->lookup_defs[index])
+            janet_panicf("invalid funcdef reference %d", index);
         *out = st->lookup_defs[index];
     } else {
         /* Initialize with values that will not break garbage collection
          * if unmarshalling fails. */
         JanetFuncDef *def = janet_gcalloc(JANET_MEMORY_FUNCDEF, sizeof(JanetFuncDef));
+        int32_t index = st->defs_next;
         def->environments_length = 0;
+        def->captures_length = 0;
         def->defs_length = 0;
         def->constants_length = 0;
         def->bytecode_length = 0;
@@ -813,11 +1254,15 @@ static const uint8_t *unmarshal_one_def(
         def->source = NULL;
         def->closure_bitset = NULL;
         def->defs = NULL;
+        def->jit = NULL;
+        def->lazy = NULL;
+        def->hotness = 0;
         def->environments = NULL;
+        def->captures = NULL;
         def->constants = NULL;
         def->bytecode = NULL;
         def->sourcemap = NULL;
-        janet_v_push(st->lookup_defs, def);
+        UNMARSHAL_SEEN(st, st->lookup_defs, st->defs_next, def);
 
         /* Set default lengths to zero */
         int32_t bytecode_length = 0;
@@ -831,13 +1276,16 @@ static const uint8_t *unmarshal_one_def(
         def->arity = readnat(st, &data);
         def->min_arity = readnat(st, &data);
         def->max_arity = readnat(st, &data);
+        int deferred = def->flags & JANET_FUNCDEF_FLAG_DEFERRED;
 
         /* Read some lengths */
-        constants_length = readnat(st, &data);
-        bytecode_length = readnat(st, &data);
+        if (!deferred) {
+            constants_length = readnat(st, &data);
+            bytecode_length = readnat(st, &data);
+        }
         if (def->flags & JANET_FUNCDEF_FLAG_HASENVS)
             environments_length = readnat(st, &data);
-        if (def->flags & JANET_FUNCDEF_FLAG_HASDEFS)
+        if (!deferred && (def->flags & JANET_FUNCDEF_FLAG_HASDEFS))
             defs_length = readnat(st, &data);
 
         /* Check name and source (optional) */
@@ -854,84 +1302,16 @@ static const uint8_t *unmarshal_one_def(
             def->source = janet_unwrap_string(x);
         }
 
-        /* Unmarshal constants */
-        if (constants_length) {
-            def->constants = janet_malloc(sizeof(Janet) * constants_length);
-            if (!def->constants) {
-                JANET_OUT_OF_MEMORY;
-            }
-            for (int32_t i = 0; i < constants_length; i++)
-                data = unmarshal_one(st, data, def->constants + i, flags + 1);
+        if (deferred) {
+            /* The body comes after the unmarshalled value. Until the directory
+             * of bodies has been read, janet_unmarshal attaches it. */
+            data = unmarshal_def_envs(st, data, def, environments_length);
+            if (NULL != st->bodies)
+                def->lazy = lazy_find_def(st, index);
         } else {
-            def->constants = NULL;
+            data = unmarshal_def_body(st, data, def, constants_length, bytecode_length,
+                                      environments_length, defs_length, flags);
         }
-        def->constants_length = constants_length;
-
-        /* Unmarshal bytecode */
-        def->bytecode = janet_malloc(sizeof(uint32_t) * bytecode_length);
-        if (!def->bytecode) {
-            JANET_OUT_OF_MEMORY;
-        }
-        data = janet_unmarshal_u32s(st, data, def->bytecode, bytecode_length);
-        def->bytecode_length = bytecode_length;
-
-        /* Unmarshal environments */
-        if (def->flags & JANET_FUNCDEF_FLAG_HASENVS) {
-            def->environments = janet_calloc(1, sizeof(int32_t) * (size_t) environments_length);
-            if (!def->environments) {
-                JANET_OUT_OF_MEMORY;
-            }
-            for (int32_t i = 0; i < environments_length; i++) {
-                def->environments[i] = readint(st, &data);
-            }
-        } else {
-            def->environments = NULL;
-        }
-        def->environments_length = environments_length;
-
-        /* Unmarshal sub funcdefs */
-        if (def->flags & JANET_FUNCDEF_FLAG_HASDEFS) {
-            def->defs = janet_calloc(1, sizeof(JanetFuncDef *) * (size_t) defs_length);
-            if (!def->defs) {
-                JANET_OUT_OF_MEMORY;
-            }
-            for (int32_t i = 0; i < defs_length; i++) {
-                data = unmarshal_one_def(st, data, def->defs + i, flags + 1);
-            }
-        } else {
-            def->defs = NULL;
-        }
-        def->defs_length = defs_length;
-
-        /* Unmarshal source maps if needed */
-        if (def->flags & JANET_FUNCDEF_FLAG_HASSOURCEMAP) {
-            int32_t current = 0;
-            def->sourcemap = janet_malloc(sizeof(JanetSourceMapping) * (size_t) bytecode_length);
-            if (!def->sourcemap) {
-                JANET_OUT_OF_MEMORY;
-            }
-            for (int32_t i = 0; i < bytecode_length; i++) {
-                current += readint(st, &data);
-                def->sourcemap[i].line = current;
-                def->sourcemap[i].column = readint(st, &data);
-            }
-        } else {
-            def->sourcemap = NULL;
-        }
-
-        /* Unmarshal closure bitset if needed */
-        if (def->flags & JANET_FUNCDEF_FLAG_HASCLOBITSET) {
-            int32_t n = (def->slotcount + 31) >> 5;
-            def->closure_bitset = janet_malloc(sizeof(uint32_t) * (size_t) n);
-            if (NULL == def->closure_bitset) {
-                JANET_OUT_OF_MEMORY;
-            }
-            data = janet_unmarshal_u32s(st, data, def->closure_bitset, n);
-        }
-
-        /* Validate */
-        if (janet_verify(def))
-            janet_panic("funcdef has invalid bytecode");
 
         /* Set def */
         *out = def;
@@ -962,10 +1342,11 @@ static const uint8_t *unmarshal_one_fiber(
     fiber->waiting = NULL;
     fiber->sched_id = 0;
     fiber->supervisor_channel = NULL;
+    fiber->timeout = NULL;
 #endif
 
     /* Push fiber to seen stack */
-    janet_v_push(st->lookup, janet_wrap_fiber(fiber));
+    unmarshal_seen(st, janet_wrap_fiber(fiber));
 
     /* Read ints */
     int32_t fiber_flags = readint(st, &data);
@@ -1134,7 +1515,7 @@ void janet_unmarshal_abstract_reuse(JanetMarshalContext *ctx, void *p) {
     if (ctx->at == NULL) {
         janet_panicf("janet_unmarshal_abstract called more than once");
     }
-    janet_v_push(st->lookup, janet_wrap_abstract(p));
+    unmarshal_seen(st, janet_wrap_abstract(p));
     ctx->at = NULL;
 }
 
@@ -1214,7 +1595,7 @@ static const uint8_t *unmarshal_one(
             memcpy(&u.bytes, data + 1, sizeof(double));
 #endif
             *out = janet_wrap_number_safe(u.d);
-            janet_v_push(st->lookup, *out);
+            unmarshal_seen(st, *out);
             return data + 9;
         }
         case LB_STRING:
@@ -1247,7 +1628,7 @@ static const uint8_t *unmarshal_one(
                 safe_memcpy(buffer->data, data, len);
                 *out = janet_wrap_buffer(buffer);
             }
-            janet_v_push(st->lookup, *out);
+            unmarshal_seen(st, *out);
             return data + len;
         }
         case LB_FIBER: {
@@ -1268,7 +1649,7 @@ static const uint8_t *unmarshal_one(
                                  len * sizeof(JanetFuncEnv));
             func->def = NULL;
             *out = janet_wrap_function(func);
-            janet_v_push(st->lookup, *out);
+            unmarshal_seen(st, *out);
             data = unmarshal_one_def(st, data, &def, flags + 1);
             func->def = def;
             for (int32_t i = 0; i < len; i++) {
@@ -1300,7 +1681,7 @@ static const uint8_t *unmarshal_one(
                 JanetArray *array = janet_array(len);
                 array->count = len;
                 *out = janet_wrap_array(array);
-                janet_v_push(st->lookup, *out);
+                unmarshal_seen(st, *out);
                 for (int32_t i = 0; i < len; i++) {
                     data = unmarshal_one(st, data, array->data + i, flags + 1);
                 }
@@ -1313,7 +1694,7 @@ static const uint8_t *unmarshal_one(
                     data = unmarshal_one(st, data, tup + i, flags + 1);
                 }
                 *out = janet_wrap_tuple(janet_tuple_end(tup));
-                janet_v_push(st->lookup, *out);
+                unmarshal_seen(st, *out);
             } else if (lead == LB_STRUCT || lead == LB_STRUCT_PROTO) {
                 /* Struct */
                 JanetKV *struct_ = janet_struct_begin(len);
@@ -1330,16 +1711,18 @@ static const uint8_t *unmarshal_one(
                     janet_struct_put(struct_, key, value);
                 }
                 *out = janet_wrap_struct(janet_struct_end(struct_));
-                janet_v_push(st->lookup, *out);
+                unmarshal_seen(st, *out);
             } else if (lead == LB_REFERENCE) {
                 if (len >= janet_v_count(st->lookup))
                     janet_panicf("invalid reference %d", len);
+                if (janet_checktype(st->lookup[len], JANET_NIL))
+                    lazy_resolve(st, 0, len);
                 *out = st->lookup[len];
             } else {
                 /* Table */
                 JanetTable *t = janet_table(len);
                 *out = janet_wrap_table(t);
-                janet_v_push(st->lookup, *out);
+                unmarshal_seen(st, *out);
                 if (lead == LB_TABLE_PROTO) {
                     Janet proto;
                     data = unmarshal_one(st, data, &proto, flags + 1);
@@ -1355,6 +1738,37 @@ static const uint8_t *unmarshal_one(
             }
             return data;
         }
+        case LB_BUFFER_MOVE: {
+            data++;
+            int32_t count = readnat(st, &data);
+            int32_t capacity = readnat(st, &data);
+            MARSH_EOS(st, data - 1 + sizeof(uint8_t *));
+            /* The payload holds a raw pointer that is trusted as is, so only accept it
+             * from a thread channel that moves buffers. */
+            if ((flags & (JANET_MARSHAL_UNSAFE | JANET_MARSHAL_MOVE)) !=
+                    (JANET_MARSHAL_UNSAFE | JANET_MARSHAL_MOVE)) {
+                janet_panicf("move flag not given, "
+                             "will not unmarshal moved buffer at index %d",
+                             (int)(data - st->start));
+            }
+            uint8_t *bytes;
+            memcpy(&bytes, data, sizeof(uint8_t *));
+            data += sizeof(uint8_t *);
+            if (flags & JANET_MARSHAL_DECREF) {
+                /* The value was never received */
+                janet_free(bytes);
+                *out = janet_wrap_nil();
+            } else {
+                JanetBuffer *buffer = janet_gcalloc(JANET_MEMORY_BUFFER, sizeof(JanetBuffer));
+                buffer->data = bytes;
+                buffer->count = count;
+                buffer->capacity = capacity;
+                janet_gcpressure(capacity);
+                *out = janet_wrap_buffer(buffer);
+            }
+            unmarshal_seen(st, *out);
+            return data;
+        }
         case LB_UNSAFE_POINTER: {
             MARSH_EOS(st, data + sizeof(void *));
             data++;
@@ -1370,7 +1784,7 @@ static const uint8_t *unmarshal_one(
             memcpy(u.bytes, data, sizeof(void *));
             data += sizeof(void *);
             *out = janet_wrap_pointer(u.ptr);
-            janet_v_push(st->lookup, *out);
+            unmarshal_seen(st, *out);
             return data;
         }
         case LB_UNSAFE_CFUNCTION: {
@@ -1388,7 +1802,7 @@ static const uint8_t *unmarshal_one(
             memcpy(u.bytes, data, sizeof(JanetCFunction));
             data += sizeof(JanetCFunction);
             *out = janet_wrap_cfunction(u.ptr);
-            janet_v_push(st->lookup, *out);
+            unmarshal_seen(st, *out);
             return data;
         }
 #ifdef JANET_EV
@@ -1423,7 +1837,7 @@ static const uint8_t *unmarshal_one(
                 }
             }
 
-            janet_v_push(st->lookup, *out);
+            unmarshal_seen(st, *out);
             return data;
         }
 #endif
@@ -1436,21 +1850,315 @@ static const uint8_t *unmarshal_one(
     }
 }
 
-Janet janet_unmarshal(
+/* Decode a deferred funcdef body into its funcdef */
+static void lazy_force(UnmarshalState *st, JanetLazyBody *body) {
+    if (body->loaded) return;
+    body->loaded = 1;
+    if (body->def >= janet_v_count(st->lookup_defs))
+        janet_panicf("invalid funcdef reference %d", body->def);
+    if (NULL == st->lookup_defs[body->def])
+        lazy_resolve(st, 1, body->def);
+    JanetFuncDef *def = st->lookup_defs[body->def];
+    if (NULL == def || def->lazy != body)
+        janet_panicf("invalid body for funcdef %d", body->def);
+    int32_t lookup_next = st->lookup_next;
+    int32_t defs_next = st->defs_next;
+    int32_t envs_next = st->envs_next;
+    st->lookup_next = body->start[0];
+    st->defs_next = body->start[1];
+    st->envs_next = body->start[2];
+    const uint8_t *data = body->data;
+    int32_t constants_length = readnat(st, &data);
+    int32_t bytecode_length = readnat(st, &data);
+    int32_t defs_length = 0;
+    if (def->flags & JANET_FUNCDEF_FLAG_HASDEFS)
+        defs_length = readnat(st, &data);
+    def->flags &= ~JANET_FUNCDEF_FLAG_DEFERRED;
+    def->lazy = NULL;
+    data = unmarshal_def_body(st, data, def, constants_length, bytecode_length,
+                              -1, defs_length, st->flags);
+    if (data != body->data + body->size ||
+            st->lookup_next != body->start[0] + body->count[0] ||
+            st->defs_next != body->start[1] + body->count[1] ||
+            st->envs_next != body->start[2] + body->count[2]) {
+        janet_panicf("invalid body for funcdef %d", body->def);
+    }
+    st->lookup_next = lookup_next;
+    st->defs_next = defs_next;
+    st->envs_next = envs_next;
+    janet_gc_barrier(def);
+}
+
+/* Decode the deferred body containing the object with the given index in
+ * the lookup (kind 0), funcdef (kind 1), or funcenv (kind 2) vector. The
+ * bodies are sorted by their ranges in each vector. */
+static void lazy_resolve(UnmarshalState *st, int kind, int32_t index) {
+    int32_t lo = 0, hi = st->body_count;
+    while (lo < hi) {
+        int32_t mid = lo + ((hi - lo) >> 1);
+        if (st->bodies[mid].start[kind] <= index) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) return;
+    JanetLazyBody *body = st->bodies + lo - 1;
+    if (index < body->start[kind] + body->count[kind]) {
+        lazy_force(st, body);
+    }
+}
+
+/* Read the directory of deferred funcdef bodies that follows a value
+ * marshalled with JANET_MARSHAL_LAZY, and reserve room for the objects
+ * in the bodies so they can be decoded in any order. */
+static const uint8_t *unmarshal_directory(UnmarshalState *st, const uint8_t *data) {
+    int32_t count = readnat(st, &data);
+    MARSH_EOS(st, data + count - 1);
+    st->bodies = janet_smalloc(sizeof(JanetLazyBody) * ((size_t) count + 1));
+    if (NULL == st->bodies) {
+        JANET_OUT_OF_MEMORY;
+    }
+    int32_t start[3] = {
+        janet_v_count(st->lookup),
+        janet_v_count(st->lookup_defs),
+        janet_v_count(st->lookup_envs)
+    };
+    int32_t def = 0;
+    for (int32_t i = 0; i < count; i++) {
+        JanetLazyBody *body = st->bodies + i;
+        body->st = st;
+        body->loaded = 0;
+        def += readnat(st, &data);
+        body->def = def;
+        for (int j = 0; j < 3; j++) {
+            body->count[j] = readnat(st, &data);
+            body->start[j] = start[j];
+            if (start[j] > INT32_MAX - body->count[j]) janet_panic("too many objects");
+            start[j] += body->count[j];
+        }
+        body->size = readnat(st, &data);
+        st->body_count = i + 1;
+    }
+    for (int32_t i = 0; i < count; i++) {
+        JanetLazyBody *body = st->bodies + i;
+        if (body->size > st->end - data) janet_panic("unexpected end of source");
+        body->data = data;
+        data += body->size;
+    }
+    while (janet_v_count(st->lookup) < start[0]) janet_v_push(st->lookup, janet_wrap_nil());
+    while (janet_v_count(st->lookup_defs) < start[1]) janet_v_push(st->lookup_defs, NULL);
+    while (janet_v_count(st->lookup_envs) < start[2]) janet_v_push(st->lookup_envs, NULL);
+    for (int32_t i = 0; i < count; i++) {
+        JanetLazyBody *body = st->bodies + i;
+        if (body->def < st->defs_next) {
+            JanetFuncDef *fd = st->lookup_defs[body->def];
+            if (fd->lazy || !(fd->flags & JANET_FUNCDEF_FLAG_DEFERRED))
+                janet_panicf("invalid body for funcdef %d", body->def);
+            fd->lazy = body;
+        }
+    }
+    return data;
+}
+
+/* Source bytes owned by an image, such as a mapped file */
+typedef struct {
+    uint8_t *bytes;
+    size_t len;
+    int mapped;
+} ImageSource;
+
+static void image_source_release(ImageSource *source) {
+    if (NULL == source->bytes) return;
+#ifndef JANET_WINDOWS
+    if (source->mapped) {
+        munmap(source->bytes, source->len);
+    } else
+#endif
+    {
+        janet_free(source->bytes);
+    }
+    source->bytes = NULL;
+}
+
+/* The state of an image unmarshalled with JANET_MARSHAL_LAZY, kept while
+ * funcdef bodies remain to be decoded. Bodies are decoded straight from the
+ * source bytes, so an image can own them. */
+typedef struct {
+    UnmarshalState st;
+    ImageSource source;
+} LazyImage;
+
+/* Move a vector out of scratch memory so it survives garbage collection */
+static void *lazy_image_keep(void *v, int32_t itemsize) {
+    int32_t count = janet_v_count(v);
+    int32_t *p = janet_malloc(sizeof(int32_t) * 2 + (size_t) itemsize * count);
+    if (NULL == p) {
+        JANET_OUT_OF_MEMORY;
+    }
+    p[0] = count;
+    p[1] = count;
+    if (count) safe_memcpy(p + 2, v, (size_t) itemsize * count);
+    janet_v_free(v);
+    return p + 2;
+}
+
+static int lazy_image_gc(void *p, size_t size) {
+    (void) size;
+    LazyImage *image = (LazyImage *) p;
+    janet_free(janet_v__raw(image->st.lookup));
+    janet_free(janet_v__raw(image->st.lookup_defs));
+    janet_free(janet_v__raw(image->st.lookup_envs));
+    janet_free(image->st.bodies);
+    image_source_release(&image->source);
+    return 0;
+}
+
+/* Funcdefs and funcenvs are reachable from the functions and fibers in the lookup */
+static int lazy_image_gcmark(void *p, size_t size) {
+    (void) size;
+    LazyImage *image = (LazyImage *) p;
+    for (int32_t i = 0; i < janet_v_count(image->st.lookup); i++)
+        janet_mark(image->st.lookup[i]);
+    if (NULL != image->st.reg)
+        janet_mark(janet_wrap_table(image->st.reg));
+    return 0;
+}
+
+static const JanetAbstractType janet_lazy_image_type = {
+    "core/lazy-image",
+    lazy_image_gc,
+    lazy_image_gcmark,
+    JANET_ATEND_GCMARK
+};
+
+void janet_funcdef_force(JanetFuncDef *def) {
+    JanetLazyBody *body = (JanetLazyBody *) def->lazy;
+    UnmarshalState *st = body->st;
+    lazy_force(st, body);
+    janet_gc_barrier(janet_abstract_head((LazyImage *) st));
+}
+
+static Janet unmarshal_image(const uint8_t *bytes, size_t len, int flags, JanetTable *reg,
+                             const uint8_t **next, ImageSource *source);
+
+/* Decompress the payload of an image in the compact format into plain,
+ * and unmarshal it. Lazy images take the decompressed bytes. */
+static Janet unmarshal_decompressed(
+    ImageSource *plain,
+    const uint8_t *payload,
+    const uint8_t *end,
+    int flags,
+    JanetTable *reg,
+    const uint8_t **next) {
+    Janet out;
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    if (!signal) {
+        const uint8_t *rest = compact_decompress(payload, end, plain->bytes, plain->len);
+        out = unmarshal_image(plain->bytes, plain->len, flags, reg, NULL, plain);
+        if (next) *next = rest;
+        janet_restore(&tstate);
+    } else {
+        janet_restore(&tstate);
+        image_source_release(plain);
+        janet_signalv(signal, tstate.payload);
+    }
+    image_source_release(plain);
+    return out;
+}
+
+static Janet unmarshal_compact(
     const uint8_t *bytes,
     size_t len,
     int flags,
     JanetTable *reg,
     const uint8_t **next) {
+    const uint8_t *end = bytes + len;
+    const uint8_t *data = bytes + 1;
+    if (data >= end) janet_panic("unexpected end of source");
+    if (*data != JANET_MARSHAL_COMPACT_VERSION)
+        janet_panicf("unsupported compact marshal version %d", *data);
+    data++;
+    uint64_t plain_len = compact_read_varint(&data, end);
+    if (plain_len == 0 || plain_len > INT32_MAX)
+        janet_panic("invalid compact marshal length");
+    ImageSource plain;
+    plain.bytes = janet_malloc((size_t) plain_len);
+    if (NULL == plain.bytes) {
+        JANET_OUT_OF_MEMORY;
+    }
+    plain.len = (size_t) plain_len;
+    plain.mapped = 0;
+    return unmarshal_decompressed(&plain, data, end, flags, reg, next);
+}
+
+/* Unmarshal an image. If source is given and funcdef bodies are left to be
+ * decoded lazily, the image takes ownership of it and clears source->bytes. */
+static Janet unmarshal_image(
+    const uint8_t *bytes,
+    size_t len,
+    int flags,
+    JanetTable *reg,
+    const uint8_t **next,
+    ImageSource *source) {
+    if (len > 0 && bytes[0] == LB_COMPACT) {
+        return unmarshal_compact(bytes, len, flags, reg, next);
+    }
     UnmarshalState st;
+    int lazy = flags & JANET_MARSHAL_LAZY;
+    flags &= ~JANET_MARSHAL_LAZY;
     st.start = bytes;
     st.end = bytes + len;
     st.lookup_defs = NULL;
     st.lookup_envs = NULL;
     st.lookup = NULL;
+    st.lookup_next = 0;
+    st.defs_next = 0;
+    st.envs_next = 0;
+    st.bodies = NULL;
+    st.body_count = 0;
+    st.flags = flags;
     st.reg = reg;
     Janet out;
-    const uint8_t *nextbytes = unmarshal_one(&st, bytes, &out, flags);
+    const uint8_t *nextbytes;
+    if (len > 0 && bytes[0] == LB_DEFERRED) {
+        nextbytes = unmarshal_one(&st, bytes + 1, &out, flags);
+        nextbytes = unmarshal_directory(&st, nextbytes);
+        if (lazy && st.body_count > 0) {
+            /* Keep the state to decode each body when it is first needed */
+            LazyImage *image = janet_abstract(&janet_lazy_image_type, sizeof(LazyImage));
+            image->st = st;
+            image->source.bytes = NULL;
+            if (NULL != source) {
+                image->source = *source;
+                source->bytes = NULL;
+            }
+            image->st.lookup = lazy_image_keep(st.lookup, sizeof(Janet));
+            image->st.lookup_defs = lazy_image_keep(st.lookup_defs, sizeof(JanetFuncDef *));
+            image->st.lookup_envs = lazy_image_keep(st.lookup_envs, sizeof(JanetFuncEnv *));
+            image->st.bodies = janet_malloc(sizeof(JanetLazyBody) * (size_t) st.body_count);
+            if (NULL == image->st.bodies) {
+                JANET_OUT_OF_MEMORY;
+            }
+            safe_memcpy(image->st.bodies, st.bodies, sizeof(JanetLazyBody) * (size_t) st.body_count);
+            janet_sfree(st.bodies);
+            for (int32_t i = 0; i < st.body_count; i++) {
+                image->st.bodies[i].st = &image->st;
+                if (image->st.bodies[i].def < image->st.defs_next) {
+                    image->st.lookup_defs[image->st.bodies[i].def]->lazy = image->st.bodies + i;
+                }
+            }
+            janet_gcroot(janet_wrap_abstract(image));
+            if (next) *next = nextbytes;
+            return out;
+        }
+        for (int32_t i = 0; i < st.body_count; i++)
+            lazy_force(&st, st.bodies + i);
+        janet_sfree(st.bodies);
+    } else {
+        nextbytes = unmarshal_one(&st, bytes, &out, flags);
+    }
     if (next) *next = nextbytes;
     janet_v_free(st.lookup_defs);
     janet_v_free(st.lookup_envs);
@@ -1458,6 +2166,232 @@ Janet janet_unmarshal(
     return out;
 }
 
+Janet janet_unmarshal(
+    const uint8_t *bytes,
+    size_t len,
+    int flags,
+    JanetTable *reg,
+    const uint8_t **next) {
+    return unmarshal_image(bytes, len, flags, reg, next, NULL);
+}
+
+/* Map a file read only. Where mapping is not available, or the file is empty,
+ * the file is read into memory instead. */
+static void image_source_open(ImageSource *source, const char *path) {
+    source->bytes = NULL;
+    source->len = 0;
+    source->mapped = 0;
+#ifdef JANET_WINDOWS
+    FILE *f = fopen(path, "rb");
+    if (NULL == f) janet_panicf("could not open file %s: %s", path, strerror(errno));
+    uint8_t *data = NULL;
+    size_t len = 0, cap = 0, n;
+    do {
+        if (len == cap) {
+            cap = cap ? 2 * cap : 4096;
+            uint8_t *next = janet_realloc(data, cap);
+            if (NULL == next) {
+                janet_free(data);
+                fclose(f);
+                JANET_OUT_OF_MEMORY;
+            }
+            data = next;
+        }
+        n = fread(data + len, 1, cap - len, f);
+        len += n;
+    } while (n > 0);
+    fclose(f);
+    source->bytes = data;
+    source->len = len;
+#else
+    int fd;
+    do {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) janet_panicf("could not open file %s: %s", path, strerror(errno));
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        int err = errno;
+        close(fd);
+        janet_panicf("could not stat file %s: %s", path, strerror(err));
+    }
+    if (sb.st_size > 0) {
+        void *mem = mmap(NULL, (size_t) sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mem == MAP_FAILED) {
+            int err = errno;
+            close(fd);
+            janet_panicf("could not map file %s: %s", path, strerror(err));
+        }
+        source->bytes = mem;
+        source->len = (size_t) sb.st_size;
+        source->mapped = 1;
+    }
+    close(fd);
+#endif
+}
+
+/*
+ * Marshal sessions
+ */
+
+/* A writer marshals a series of values into frames, each a 4 byte little
+ * endian length followed by one marshalled value. Values sent in earlier
+ * frames are written as references, so a reader must decode every frame of
+ * a writer, in order. The lookup vectors of both ends are kept between calls
+ * as detached scratch memory. A session that fails part way through a value
+ * cannot be used again. */
+
+typedef struct {
+    MarshalState st;
+    int broken;
+} MarshalWriter;
+
+typedef struct {
+    UnmarshalState st;
+    int broken;
+} MarshalReader;
+
+static void session_attach(void *v) {
+    if (NULL != v) janet_sattach(janet_v__raw(v));
+}
+
+static void session_detach(void *v) {
+    if (NULL != v) janet_sdetach(janet_v__raw(v));
+}
+
+static int marshal_writer_gc(void *p, size_t size) {
+    (void) size;
+    MarshalWriter *w = (MarshalWriter *) p;
+    janet_table_deinit(&w->st.seen);
+    session_attach(w->st.seen_envs);
+    session_attach(w->st.seen_defs);
+    janet_v_free(w->st.seen_envs);
+    janet_v_free(w->st.seen_defs);
+    return 0;
+}
+
+/* Funcdefs and funcenvs are reachable from the functions and fibers seen */
+static int marshal_writer_gcmark(void *p, size_t size) {
+    (void) size;
+    MarshalWriter *w = (MarshalWriter *) p;
+    const JanetKV *kv = NULL;
+    while ((kv = janet_dictionary_next(w->st.seen.data, w->st.seen.capacity, kv)))
+        janet_mark(kv->key);
+    if (NULL != w->st.rreg)
+        janet_mark(janet_wrap_table(w->st.rreg));
+    return 0;
+}
+
+static int marshal_reader_gc(void *p, size_t size) {
+    (void) size;
+    MarshalReader *r = (MarshalReader *) p;
+    session_attach(r->st.lookup);
+    session_attach(r->st.lookup_defs);
+    session_attach(r->st.lookup_envs);
+    janet_v_free(r->st.lookup);
+    janet_v_free(r->st.lookup_defs);
+    janet_v_free(r->st.lookup_envs);
+    return 0;
+}
+
+static int marshal_reader_gcmark(void *p, size_t size) {
+    (void) size;
+    MarshalReader *r = (MarshalReader *) p;
+    for (int32_t i = 0; i < janet_v_count(r->st.lookup); i++)
+        janet_mark(r->st.lookup[i]);
+    if (NULL != r->st.reg)
+        janet_mark(janet_wrap_table(r->st.reg));
+    return 0;
+}
+
+static const JanetAbstractType marshal_writer_type = {
+    "core/marshal-writer",
+    marshal_writer_gc,
+    marshal_writer_gcmark,
+    JANET_ATEND_GCMARK
+};
+
+static const JanetAbstractType marshal_reader_type = {
+    "core/marshal-reader",
+    marshal_reader_gc,
+    marshal_reader_gcmark,
+    JANET_ATEND_GCMARK
+};
+
+/* Append one frame holding x to buffer */
+static void marshal_writer_write(MarshalWriter *w, JanetBuffer *buffer, Janet x) {
+    if (w->broken) janet_panic("marshal writer failed on an earlier value");
+    int32_t start = buffer->count;
+    janet_buffer_push_u32(buffer, 0);
+    w->st.buf = buffer;
+    session_attach(w->st.seen_envs);
+    session_attach(w->st.seen_defs);
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    if (!signal) {
+        marshal_one(&w->st, x, 0);
+        janet_restore(&tstate);
+    } else {
+        janet_restore(&tstate);
+        w->broken = 1;
+        buffer->count = start;
+    }
+    session_detach(w->st.seen_envs);
+    session_detach(w->st.seen_defs);
+    w->st.buf = NULL;
+    janet_gc_barrier(janet_abstract_head(w));
+    if (signal) janet_signalv(signal, tstate.payload);
+    uint32_t len = (uint32_t)(buffer->count - start - 4);
+    uint8_t *frame = buffer->data + start;
+    frame[0] = len & 0xFF;
+    frame[1] = (len >> 8) & 0xFF;
+    frame[2] = (len >> 16) & 0xFF;
+    frame[3] = (len >> 24) & 0xFF;
+}
+
+/* Decode every complete frame at the start of buffer, and remove them */
+static JanetArray *marshal_reader_read(MarshalReader *r, JanetBuffer *buffer) {
+    if (r->broken) janet_panic("marshal reader failed on an earlier value");
+    JanetArray *out = janet_array(0);
+    int32_t pos = 0;
+    session_attach(r->st.lookup);
+    session_attach(r->st.lookup_defs);
+    session_attach(r->st.lookup_envs);
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    if (!signal) {
+        while (buffer->count - pos >= 4) {
+            const uint8_t *frame = buffer->data + pos;
+            uint32_t len = (uint32_t) frame[0] |
+                           ((uint32_t) frame[1] << 8) |
+                           ((uint32_t) frame[2] << 16) |
+                           ((uint32_t) frame[3] << 24);
+            if (len > (uint32_t)(buffer->count - pos - 4)) break;
+            r->st.start = frame + 4;
+            r->st.end = frame + 4 + len;
+            Janet x;
+            if (unmarshal_one(&r->st, r->st.start, &x, r->st.flags) != r->st.end)
+                janet_panic("extra bytes in marshal frame");
+            janet_array_push(out, x);
+            pos += 4 + (int32_t) len;
+        }
+        janet_restore(&tstate);
+    } else {
+        janet_restore(&tstate);
+        r->broken = 1;
+    }
+    session_detach(r->st.lookup);
+    session_detach(r->st.lookup_defs);
+    session_detach(r->st.lookup_envs);
+    janet_gc_barrier(janet_abstract_head(r));
+    if (signal) janet_signalv(signal, tstate.payload);
+    if (pos) {
+        memmove(buffer->data, buffer->data + pos, buffer->count - pos);
+        buffer->count -= pos;
+    }
+    return out;
+}
+
 /* C functions */
 
 JANET_CORE_FN(cfun_env_lookup,
@@ -1471,25 +2405,26 @@ JANET_CORE_FN(cfun_env_lookup,
 }
 
 JANET_CORE_FN(cfun_marshal,
-              "(marshal x &opt reverse-lookup buffer)",
+              "(marshal x &opt reverse-lookup buffer lazy compact)",
               "Marshal a value into a buffer and return the buffer. The buffer "
               "can then later be unmarshalled to reconstruct the initial value. "
               "Optionally, one can pass in a reverse lookup table to not marshal "
               "aliased values that are found in the table. Then a forward "
               "lookup table can be used to recover the original value when "
-              "unmarshalling.") {
-    janet_arity(argc, 1, 3);
+              "unmarshalling. If `lazy` is truthy, the bodies of functions are written "
+              "after the rest of the value, which lets the core image be loaded without "
+              "decoding a function until it is first called. If `compact` is truthy, the "
+              "output is compressed behind a versioned header, which `unmarshal` detects.") {
+    janet_arity(argc, 1, 5);
     JanetBuffer *buffer;
     JanetTable *rreg = NULL;
-    if (argc > 1) {
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
         rreg = janet_gettable(argv, 1);
     }
-    if (argc > 2) {
-        buffer = janet_getbuffer(argv, 2);
-    } else {
-        buffer = janet_buffer(10);
-    }
-    janet_marshal(buffer, argv[0], rreg, 0);
+    buffer = janet_optbuffer(argv, argc, 2, 10);
+    int flags = (argc > 3 && janet_truthy(argv[3])) ? JANET_MARSHAL_LAZY : 0;
+    if (argc > 4 && janet_truthy(argv[4])) flags |= JANET_MARSHAL_COMPACT;
+    janet_marshal(buffer, argv[0], rreg, flags);
     return janet_wrap_buffer(buffer);
 }
 
@@ -1507,12 +2442,118 @@ JANET_CORE_FN(cfun_unmarshal,
     return janet_unmarshal(view.bytes, (size_t) view.len, 0, reg, NULL);
 }
 
+JANET_CORE_FN(cfun_unmarshal_file,
+              "(unmarshal-file path &opt lookup)",
+              "Unmarshal a value from the file at `path`, like `unmarshal`. The file is mapped "
+              "into memory rather than read, and if it was written by `marshal` with `lazy` set, "
+              "the bodies of functions are decoded from the mapping the first time each function "
+              "is called, so unused functions cost only the clean pages they occupy. The file "
+              "should not be modified while the value is in use.") {
+    janet_arity(argc, 1, 2);
+    const char *path = janet_getcstring(argv, 0);
+    JanetTable *reg = NULL;
+    if (argc > 1) {
+        reg = janet_gettable(argv, 1);
+    }
+    ImageSource source;
+    image_source_open(&source, path);
+    Janet out;
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    if (!signal) {
+        out = unmarshal_image(source.bytes, source.len, JANET_MARSHAL_LAZY, reg, NULL, &source);
+        janet_restore(&tstate);
+    } else {
+        janet_restore(&tstate);
+        image_source_release(&source);
+        janet_signalv(signal, tstate.payload);
+    }
+    image_source_release(&source);
+    return out;
+}
+
+JANET_CORE_FN(cfun_marshal_writer,
+              "(marshal/writer &opt reverse-lookup)",
+              "Create a writer that marshals a series of values with `marshal/write`. Values "
+              "that were written before are sent as references, which keeps shared structure "
+              "intact across the whole series without holding it all in one buffer.") {
+    janet_arity(argc, 0, 1);
+    MarshalWriter *w = janet_abstract(&marshal_writer_type, sizeof(MarshalWriter));
+    w->st.buf = NULL;
+    w->st.nextid = 0;
+    w->st.seen_defs = NULL;
+    w->st.seen_envs = NULL;
+    w->st.lazy_defs = NULL;
+    w->st.lazy_ids = NULL;
+    w->st.moved = NULL;
+    w->st.rreg = NULL;
+    w->broken = 0;
+    janet_table_init_raw(&w->st.seen, 0);
+    if (argc > 0 && !janet_checktype(argv[0], JANET_NIL)) {
+        w->st.rreg = janet_gettable(argv, 0);
+    }
+    return janet_wrap_abstract(w);
+}
+
+JANET_CORE_FN(cfun_marshal_write,
+              "(marshal/write writer x &opt buffer)",
+              "Marshal x with a writer from `marshal/writer`, appending one frame to a buffer, "
+              "and return the buffer. Each frame is a 4 byte little endian length followed "
+              "by the marshalled value, and frames must be read in order by one reader.") {
+    janet_arity(argc, 2, 3);
+    MarshalWriter *w = janet_getabstract(argv, 0, &marshal_writer_type);
+    JanetBuffer *buffer = janet_optbuffer(argv, argc, 2, 10);
+    marshal_writer_write(w, buffer, argv[1]);
+    return janet_wrap_buffer(buffer);
+}
+
+JANET_CORE_FN(cfun_marshal_reader,
+              "(marshal/reader &opt lookup)",
+              "Create a reader that unmarshals the frames written by one `marshal/writer`.") {
+    janet_arity(argc, 0, 1);
+    MarshalReader *r = janet_abstract(&marshal_reader_type, sizeof(MarshalReader));
+    r->st.lookup = NULL;
+    r->st.lookup_defs = NULL;
+    r->st.lookup_envs = NULL;
+    r->st.lookup_next = 0;
+    r->st.defs_next = 0;
+    r->st.envs_next = 0;
+    r->st.bodies = NULL;
+    r->st.body_count = 0;
+    r->st.flags = 0;
+    r->st.reg = NULL;
+    r->st.start = NULL;
+    r->st.end = NULL;
+    r->broken = 0;
+    if (argc > 0 && !janet_checktype(argv[0], JANET_NIL)) {
+        r->st.reg = janet_gettable(argv, 0);
+    }
+    return janet_wrap_abstract(r);
+}
+
+JANET_CORE_FN(cfun_marshal_read,
+              "(marshal/read reader buffer)",
+              "Unmarshal every complete frame at the start of buffer with a reader from "
+              "`marshal/reader`, remove those frames from the buffer, and return an array "
+              "of the values. Incomplete frames are left in the buffer for the next call, "
+              "so chunks can be appended to the buffer as they arrive.") {
+    janet_fixarity(argc, 2);
+    MarshalReader *r = janet_getabstract(argv, 0, &marshal_reader_type);
+    JanetBuffer *buffer = janet_getbuffer(argv, 1);
+    return janet_wrap_array(marshal_reader_read(r, buffer));
+}
+
 /* Module entry point */
 void janet_lib_marsh(JanetTable *env) {
     JanetRegExt marsh_cfuns[] = {
         JANET_CORE_REG("marshal", cfun_marshal),
         JANET_CORE_REG("unmarshal", cfun_unmarshal),
+        JANET_CORE_REG("unmarshal-file", cfun_unmarshal_file),
         JANET_CORE_REG("env-lookup", cfun_env_lookup),
+        JANET_CORE_REG("marshal/writer", cfun_marshal_writer),
+        JANET_CORE_REG("marshal/write", cfun_marshal_write),
+        JANET_CORE_REG("marshal/reader", cfun_marshal_reader),
+        JANET_CORE_REG("marshal/read", cfun_marshal_read),
         JANET_REG_END
     };
     janet_core_cfuns_ext(env, NULL, marsh_cfuns);
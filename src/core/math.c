@@ -347,6 +347,24 @@ JANET_CORE_FN(janet_cfun_lcm, "(math/lcm x y)",
     return janet_wrap_number(janet_lcm(x, y));
 }
 
+/* Check if a C function from this module always returns a number. Used by the
+ * compiler to infer the types of slots. */
+int janet_math_returns_number(JanetCFunction cfun) {
+    static const JanetCFunction number_cfuns[] = {
+        janet_rand, janet_cos, janet_sin, janet_tan, janet_acos, janet_asin,
+        janet_atan, janet_exp, janet_log, janet_log10, janet_log2, janet_sqrt,
+        janet_cbrt, janet_floor, janet_ceil, janet_pow, janet_fabs, janet_sinh,
+        janet_cosh, janet_tanh, janet_atanh, janet_asinh, janet_acosh, janet_atan2,
+        cfun_rng_uniform, cfun_rng_int, janet_hypot, janet_exp2, janet_log1p,
+        janet_gamma, janet_lgamma, janet_erfc, janet_erf, janet_expm1, janet_trunc,
+        janet_round, janet_nextafter, janet_cfun_gcd, janet_cfun_lcm
+    };
+    for (size_t i = 0; i < sizeof(number_cfuns) / sizeof(number_cfuns[0]); i++) {
+        if (number_cfuns[i] == cfun) return 1;
+    }
+    return 0;
+}
+
 /* Module entry point */
 void janet_lib_math(JanetTable *env) {
     JanetRegExt math_cfuns[] = {
@@ -49,6 +49,15 @@
 #include <netinet/tcp.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <errno.h>
+#ifdef JANET_LINUX
+#include <sys/sendfile.h>
+#include <pthread.h>
+#include <time.h>
+#endif
+#if defined(JANET_BSD) || defined(JANET_APPLE)
+#include <sys/uio.h>
+#endif
 #endif
 
 const JanetAbstractType janet_address_type = {
@@ -266,6 +275,47 @@ static int janet_get_sockettype(Janet *argv, int32_t argc, int32_t n) {
     return socktype;
 }
 
+/* Get the host and port arguments starting at offset. Needs argc >= offset + 2 */
+static void janet_net_hostport(Janet *argv, int32_t offset, char **host, char **port) {
+    *host = (char *)janet_getcstring(argv, offset);
+    if (janet_checkint(argv[offset + 1])) {
+        *port = (char *)janet_to_string(argv[offset + 1]);
+    } else {
+        *port = (char *)janet_optcstring(argv, offset + 2, offset + 1, NULL);
+    }
+}
+
+#ifndef JANET_WINDOWS
+/* Make a socket address for a unix domain socket path */
+static struct sockaddr_un *janet_net_unix_sockaddr(const char *path, void *(*alloc)(size_t)) {
+    struct sockaddr_un *saddr = alloc(sizeof(struct sockaddr_un));
+    if (saddr == NULL) {
+        JANET_OUT_OF_MEMORY;
+    }
+    memset(saddr, 0, sizeof(struct sockaddr_un));
+    saddr->sun_family = AF_UNIX;
+    size_t path_size = sizeof(saddr->sun_path);
+#ifdef JANET_LINUX
+    if (path[0] == '@') {
+        saddr->sun_path[0] = '\0';
+        snprintf(saddr->sun_path + 1, path_size - 1, "%s", path + 1);
+    } else
+#endif
+    {
+        snprintf(saddr->sun_path, path_size, "%s", path);
+    }
+    return saddr;
+}
+
+static void *janet_net_address_alloc(size_t size) {
+    return janet_abstract(&janet_address_type, size);
+}
+
+static void *janet_net_malloc(size_t size) {
+    return janet_malloc(size);
+}
+#endif
+
 /* Needs argc >= offset + 2 */
 /* For unix paths, just rertuns a single sockaddr and sets *is_unix to 1,
  * otherwise 0. Also, ignores is_bind when is a unix socket. */
@@ -274,33 +324,13 @@ static struct addrinfo *janet_get_addrinfo(Janet *argv, int32_t offset, int sock
 #ifndef JANET_WINDOWS
     if (janet_keyeq(argv[offset], "unix")) {
         const char *path = janet_getcstring(argv, offset + 1);
-        struct sockaddr_un *saddr = janet_calloc(1, sizeof(struct sockaddr_un));
-        if (saddr == NULL) {
-            JANET_OUT_OF_MEMORY;
-        }
-        saddr->sun_family = AF_UNIX;
-        size_t path_size = sizeof(saddr->sun_path);
-#ifdef JANET_LINUX
-        if (path[0] == '@') {
-            saddr->sun_path[0] = '\0';
-            snprintf(saddr->sun_path + 1, path_size - 1, "%s", path + 1);
-        } else
-#endif
-        {
-            snprintf(saddr->sun_path, path_size, "%s", path);
-        }
         *is_unix = 1;
-        return (struct addrinfo *) saddr;
+        return (struct addrinfo *) janet_net_unix_sockaddr(path, janet_net_malloc);
     }
 #endif
     /* Get host and port */
-    char *host = (char *)janet_getcstring(argv, offset);
-    char *port = NULL;
-    if (janet_checkint(argv[offset + 1])) {
-        port = (char *)janet_to_string(argv[offset + 1]);
-    } else {
-        port = (char *)janet_optcstring(argv, offset + 2, offset + 1, NULL);
-    }
+    char *host, *port;
+    janet_net_hostport(argv, offset, &host, &port);
     /* getaddrinfo */
     struct addrinfo *ai = NULL;
     struct addrinfo hints;
@@ -317,176 +347,195 @@ static struct addrinfo *janet_get_addrinfo(Janet *argv, int32_t offset, int sock
 }
 
 /*
- * C Funs
+ * Name resolution for net/address and net/connect. Numeric addresses are parsed
+ * in place, anything else is looked up with getaddrinfo on a worker thread while
+ * the calling fiber waits. Results can be kept in a per thread cache.
  */
 
-JANET_CORE_FN(cfun_net_sockaddr,
-              "(net/address host port &opt type multi)",
-              "Look up the connection information for a given hostname, port, and connection type. Returns "
-              "a handle that can be used to send datagrams over network without establishing a connection. "
-              "On Posix platforms, you can use :unix for host to connect to a unix domain socket, where the name is "
-              "given in the port argument. On Linux, abstract "
-              "unix domain sockets are specified with a leading '@' character in port. If `multi` is truthy, will "
-              "return all address that match in an array instead of just the first.") {
-    janet_arity(argc, 2, 4);
-    int socktype = janet_get_sockettype(argv, argc, 2);
-    int is_unix = 0;
-    int make_arr = (argc >= 3 && janet_truthy(argv[3]));
-    struct addrinfo *ai = janet_get_addrinfo(argv, 0, socktype, 0, &is_unix);
-#ifndef JANET_WINDOWS
-    /* no unix domain socket support on windows yet */
-    if (is_unix) {
-        void *abst = janet_abstract(&janet_address_type, sizeof(struct sockaddr_un));
-        memcpy(abst, ai, sizeof(struct sockaddr_un));
-        Janet ret = janet_wrap_abstract(abst);
-        return make_arr ? janet_wrap_array(janet_array_n(&ret, 1)) : ret;
+#define JANET_RESOLVE_ADDRESS 0
+#define JANET_RESOLVE_CONNECT 1
+#define JANET_DNS_CACHE_MAX 1024
+
+typedef struct {
+    int op;
+    int socktype;
+    int multi;
+    uint32_t sched_id;
+    char *host;
+    char *port;
+    char *bindhost;
+    char *bindport;
+    int status;
+    int bind_status;
+    struct addrinfo *ai;
+    struct addrinfo *binding;
+} JanetResolveRequest;
+
+static char *net_strdup(const char *str) {
+    if (NULL == str) return NULL;
+    size_t len = strlen(str) + 1;
+    char *copy = janet_malloc(len);
+    if (NULL == copy) {
+        JANET_OUT_OF_MEMORY;
     }
-#endif
-    if (make_arr) {
-        /* Select all */
-        JanetArray *arr = janet_array(10);
-        struct addrinfo *iter = ai;
-        while (NULL != iter) {
-            void *abst = janet_abstract(&janet_address_type, iter->ai_addrlen);
-            memcpy(abst, iter->ai_addr, iter->ai_addrlen);
-            janet_array_push(arr, janet_wrap_abstract(abst));
-            iter = iter->ai_next;
-        }
-        freeaddrinfo(ai);
-        return janet_wrap_array(arr);
-    } else {
-        /* Select first */
-        if (NULL == ai) {
-            janet_panic("no data for given address");
-        }
+    memcpy(copy, str, len);
+    return copy;
+}
+
+static void net_resolve_free(JanetResolveRequest *req) {
+    janet_free(req->host);
+    janet_free(req->port);
+    janet_free(req->bindhost);
+    janet_free(req->bindport);
+    if (NULL != req->ai) freeaddrinfo(req->ai);
+    if (NULL != req->binding) freeaddrinfo(req->binding);
+    janet_free(req);
+}
+
+static int net_getaddrinfo(const char *host, const char *port, int socktype, int flags, struct addrinfo **out) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+    hints.ai_flags = flags;
+    *out = NULL;
+    return getaddrinfo(host, port, &hints, out);
+}
+
+/* Copy a list of address infos into an array of socket addresses */
+static JanetArray *net_addrs(struct addrinfo *ai) {
+    JanetArray *arr = janet_array(1);
+    for (; NULL != ai; ai = ai->ai_next) {
         void *abst = janet_abstract(&janet_address_type, ai->ai_addrlen);
         memcpy(abst, ai->ai_addr, ai->ai_addrlen);
-        freeaddrinfo(ai);
-        return janet_wrap_abstract(abst);
+        janet_array_push(arr, janet_wrap_abstract(abst));
     }
+    return arr;
 }
 
-JANET_CORE_FN(cfun_net_connect,
-              "(net/connect host port &opt type bindhost bindport)",
-              "Open a connection to communicate with a server. Returns a duplex stream "
-              "that can be used to communicate with the server. Type is an optional keyword "
-              "to specify a connection type, either :stream or :datagram. The default is :stream. "
-              "Bindhost is an optional string to select from what address to make the outgoing "
-              "connection, with the default being the same as using the OS's preferred address. ") {
-    janet_arity(argc, 2, 5);
+static double net_now(void) {
+    struct timespec spec;
+    janet_gettime(&spec);
+    return (double) spec.tv_sec + (double) spec.tv_nsec * 1e-9;
+}
 
-    /* Check arguments */
-    int socktype = janet_get_sockettype(argv, argc, 2);
-    int is_unix = 0;
-    char *bindhost = (char *) janet_optcstring(argv, argc, 3, NULL);
-    char *bindport = NULL;
-    if (argc >= 5 && janet_checkint(argv[4])) {
-        bindport = (char *)janet_to_string(argv[4]);
-    } else {
-        bindport = (char *)janet_optcstring(argv, argc, 4, NULL);
+static Janet net_cache_key(const char *host, const char *port, int socktype) {
+    return janet_wrap_string(janet_formatc("%s %s %d", host, port ? port : "", socktype));
+}
+
+static JanetArray *net_cache_get(const char *host, const char *port, int socktype) {
+    if (NULL == janet_vm.dns_cache) return NULL;
+    Janet key = net_cache_key(host, port, socktype);
+    Janet entry = janet_table_get(janet_vm.dns_cache, key);
+    if (!janet_checktype(entry, JANET_TUPLE)) return NULL;
+    const Janet *pair = janet_unwrap_tuple(entry);
+    if (janet_unwrap_number(pair[0]) < net_now()) {
+        janet_table_remove(janet_vm.dns_cache, key);
+        return NULL;
     }
+    return janet_unwrap_array(pair[1]);
+}
 
-    /* Where we're connecting to */
-    struct addrinfo *ai = janet_get_addrinfo(argv, 0, socktype, 0, &is_unix);
+static void net_cache_put(const char *host, const char *port, int socktype, JanetArray *addrs) {
+    if (janet_vm.dns_ttl <= 0) return;
+    if (NULL == janet_vm.dns_cache) {
+        janet_vm.dns_cache = janet_table(0);
+        janet_gcroot(janet_wrap_table(janet_vm.dns_cache));
+    }
+    /* Keep the cache bounded, hot names come back quickly after a flush */
+    if (janet_vm.dns_cache->count >= JANET_DNS_CACHE_MAX) {
+        janet_table_clear(janet_vm.dns_cache);
+    }
+    Janet pair[2];
+    pair[0] = janet_wrap_number(net_now() + janet_vm.dns_ttl);
+    pair[1] = janet_wrap_array(addrs);
+    janet_table_put(janet_vm.dns_cache, net_cache_key(host, port, socktype),
+                    janet_wrap_tuple(janet_tuple_n(pair, 2)));
+}
 
-    /* Check if we're binding address */
-    struct addrinfo *binding = NULL;
-    if (bindhost != NULL) {
-        if (is_unix) {
-            freeaddrinfo(ai);
-            janet_panic("bindhost not supported for unix domain sockets");
-        }
-        /* getaddrinfo */
-        struct addrinfo hints;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_UNSPEC;
-        hints.ai_socktype = socktype;
-        hints.ai_flags = 0;
-        int status = getaddrinfo(bindhost, bindport, &hints, &binding);
-        if (status) {
-            freeaddrinfo(ai);
-            janet_panicf("could not get address info for bindhost: %s", gai_strerror(status));
-        }
+/* Resolve a name without blocking, either from the cache or because it is a numeric
+ * address. Returns NULL if the name needs a real lookup. */
+static JanetArray *net_lookup_now(const char *host, const char *port, int socktype) {
+    JanetArray *cached = net_cache_get(host, port, socktype);
+    if (NULL != cached) return cached;
+    struct addrinfo *ai = NULL;
+    if (net_getaddrinfo(host, port, socktype, AI_NUMERICHOST, &ai)) {
+        /* Not numeric, or some other failure - the full lookup reports the error */
+        return NULL;
     }
+    JanetArray *addrs = net_addrs(ai);
+    freeaddrinfo(ai);
+    return addrs;
+}
 
+static int net_address_result(JanetArray *addrs, int multi, Janet *out) {
+    if (multi) {
+        *out = janet_wrap_array(janet_array_n(addrs->data, addrs->count));
+        return 0;
+    }
+    if (addrs->count == 0) {
+        *out = janet_cstringv("no data for given address");
+        return 1;
+    }
+    *out = addrs->data[0];
+    return 0;
+}
 
+/* Open a socket to the first usable address in addrs, optionally bound to one of binds.
+ * Returns 0 and the new stream in out, or non-zero and an error message in out. */
+static int net_connect_addrs(JanetArray *addrs, JanetArray *binds, int socktype, Janet *out) {
     /* Create socket */
     JSock sock = JSOCKDEFAULT;
-    void *addr = NULL;
+    struct sockaddr *addr = NULL;
     socklen_t addrlen = 0;
-#ifndef JANET_WINDOWS
-    if (is_unix) {
-        sock = socket(AF_UNIX, socktype | JSOCKFLAGS, 0);
-        if (!JSOCKVALID(sock)) {
-            Janet v = janet_ev_lasterr();
-            janet_free(ai);
-            janet_panicf("could not create socket: %V", v);
-        }
-        addr = (void *) ai;
-        addrlen = sizeof(struct sockaddr_un);
-    } else
-#endif
-    {
-        struct addrinfo *rp = NULL;
-        for (rp = ai; rp != NULL; rp = rp->ai_next) {
+    for (int32_t i = 0; i < addrs->count; i++) {
+        struct sockaddr *sa = janet_unwrap_abstract(addrs->data[i]);
 #ifdef JANET_WINDOWS
-            sock = WSASocketW(rp->ai_family, rp->ai_socktype, rp->ai_protocol, NULL, 0, WSA_FLAG_OVERLAPPED);
+        sock = WSASocketW(sa->sa_family, socktype, 0, NULL, 0, WSA_FLAG_OVERLAPPED);
 #else
-            sock = socket(rp->ai_family, rp->ai_socktype | JSOCKFLAGS, rp->ai_protocol);
+        sock = socket(sa->sa_family, socktype | JSOCKFLAGS, 0);
 #endif
-            if (JSOCKVALID(sock)) {
-                addr = rp->ai_addr;
-                addrlen = (socklen_t) rp->ai_addrlen;
-                break;
-            }
-        }
-        if (NULL == addr) {
-            Janet v = janet_ev_lasterr();
-            if (binding) freeaddrinfo(binding);
-            freeaddrinfo(ai);
-            janet_panicf("could not create socket: %V", v);
+        if (JSOCKVALID(sock)) {
+            addr = sa;
+            addrlen = (socklen_t) janet_abstract_size(sa);
+            break;
         }
     }
+    if (NULL == addr) {
+        Janet v = janet_ev_lasterr();
+        *out = janet_wrap_string(janet_formatc("could not create socket: %V", v));
+        return 1;
+    }
 
     /* Bind to bindhost and bindport if given */
-    if (binding) {
-        struct addrinfo *rp = NULL;
+    if (NULL != binds) {
         int did_bind = 0;
-        for (rp = ai; rp != NULL; rp = rp->ai_next) {
-            if (bind(sock, rp->ai_addr, (int) rp->ai_addrlen) == 0) {
+        for (int32_t i = 0; i < binds->count; i++) {
+            struct sockaddr *sa = janet_unwrap_abstract(binds->data[i]);
+            if (bind(sock, sa, (int) janet_abstract_size(sa)) == 0) {
                 did_bind = 1;
                 break;
             }
         }
         if (!did_bind) {
             Janet v = janet_ev_lasterr();
-            freeaddrinfo(binding);
-            freeaddrinfo(ai);
             JSOCKCLOSE(sock);
-            janet_panicf("could not bind outgoing address: %V", v);
-        } else {
-            freeaddrinfo(binding);
+            *out = janet_wrap_string(janet_formatc("could not bind outgoing address: %V", v));
+            return 1;
         }
     }
 
     /* Connect to socket */
 #ifdef JANET_WINDOWS
     int status = WSAConnect(sock, addr, addrlen, NULL, NULL, NULL, NULL);
-    Janet lasterr = janet_ev_lasterr();
-    freeaddrinfo(ai);
 #else
     int status = connect(sock, addr, addrlen);
-    Janet lasterr = janet_ev_lasterr();
-    if (is_unix) {
-        janet_free(ai);
-    } else {
-        freeaddrinfo(ai);
-    }
 #endif
-
     if (status == -1) {
+        Janet lasterr = janet_ev_lasterr();
         JSOCKCLOSE(sock);
-        janet_panicf("could not connect socket: %V", lasterr);
+        *out = janet_wrap_string(janet_formatc("could not connect socket: %V", lasterr));
+        return 1;
     }
 
     /* Set up the socket for non-blocking IO after connect - TODO - non-blocking connect? */
@@ -494,7 +543,196 @@ JANET_CORE_FN(cfun_net_connect,
 
     /* Wrap socket in abstract type JanetStream */
     JanetStream *stream = make_stream(sock, JANET_STREAM_READABLE | JANET_STREAM_WRITABLE);
-    return janet_wrap_abstract(stream);
+    *out = janet_wrap_abstract(stream);
+    return 0;
+}
+
+/* Runs on a worker thread */
+static JanetEVGenericMessage net_resolve_subr(JanetEVGenericMessage args) {
+    JanetResolveRequest *req = (JanetResolveRequest *) args.argp;
+    req->status = net_getaddrinfo(req->host, req->port, req->socktype, 0, &req->ai);
+    if (!req->status && NULL != req->bindhost) {
+        req->bind_status = net_getaddrinfo(req->bindhost, req->bindport, req->socktype, 0, &req->binding);
+    }
+    return args;
+}
+
+static int net_resolve_finish(JanetResolveRequest *req, Janet *out) {
+    if (req->status) {
+        *out = janet_wrap_string(janet_formatc("could not get address info: %s", gai_strerror(req->status)));
+        return 1;
+    }
+    JanetArray *addrs = net_addrs(req->ai);
+    net_cache_put(req->host, req->port, req->socktype, addrs);
+    if (req->op == JANET_RESOLVE_ADDRESS) {
+        return net_address_result(addrs, req->multi, out);
+    }
+    JanetArray *binds = NULL;
+    if (NULL != req->bindhost) {
+        if (req->bind_status) {
+            *out = janet_wrap_string(janet_formatc("could not get address info for bindhost: %s",
+                                                   gai_strerror(req->bind_status)));
+            return 1;
+        }
+        binds = net_addrs(req->binding);
+        net_cache_put(req->bindhost, req->bindport, req->socktype, binds);
+    }
+    return net_connect_addrs(addrs, binds, req->socktype, out);
+}
+
+static void net_resolve_callback(JanetEVGenericMessage msg) {
+    janet_ev_dec_refcount();
+    JanetResolveRequest *req = (JanetResolveRequest *) msg.argp;
+    JanetFiber *fiber = msg.fiber;
+    janet_gcunroot(janet_wrap_fiber(fiber));
+    /* The fiber was canceled or timed out while waiting for the lookup */
+    if (fiber->sched_id != req->sched_id) {
+        net_resolve_free(req);
+        return;
+    }
+    Janet out;
+    int err = net_resolve_finish(req, &out);
+    net_resolve_free(req);
+    if (err) {
+        janet_cancel(fiber, out);
+    } else {
+        janet_schedule(fiber, out);
+    }
+}
+
+JANET_NO_RETURN
+static void net_resolve_await(int op, const char *host, const char *port,
+                              const char *bindhost, const char *bindport,
+                              int socktype, int multi) {
+    JanetResolveRequest *req = janet_calloc(1, sizeof(JanetResolveRequest));
+    if (NULL == req) {
+        JANET_OUT_OF_MEMORY;
+    }
+    req->op = op;
+    req->socktype = socktype;
+    req->multi = multi;
+    req->host = net_strdup(host);
+    req->port = net_strdup(port);
+    req->bindhost = net_strdup(bindhost);
+    req->bindport = net_strdup(bindport);
+    JanetEVGenericMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.argp = req;
+    msg.fiber = janet_root_fiber();
+    req->sched_id = msg.fiber->sched_id;
+    janet_gcroot(janet_wrap_fiber(msg.fiber));
+    janet_ev_threaded_call(net_resolve_subr, msg, net_resolve_callback);
+    janet_await();
+}
+
+/*
+ * C Funs
+ */
+
+JANET_CORE_FN(cfun_net_sockaddr,
+              "(net/address host port &opt type multi)",
+              "Look up the connection information for a given hostname, port, and connection type. Returns "
+              "a handle that can be used to send datagrams over network without establishing a connection. "
+              "On Posix platforms, you can use :unix for host to connect to a unix domain socket, where the name is "
+              "given in the port argument. On Linux, abstract "
+              "unix domain sockets are specified with a leading '@' character in port. If `multi` is truthy, will "
+              "return all address that match in an array instead of just the first. Host names that are not "
+              "numeric addresses are looked up on a worker thread, so the event loop keeps running while "
+              "the current fiber waits for the result.") {
+    janet_arity(argc, 2, 4);
+    int socktype = janet_get_sockettype(argv, argc, 2);
+    int make_arr = (argc >= 4 && janet_truthy(argv[3]));
+#ifndef JANET_WINDOWS
+    /* no unix domain socket support on windows yet */
+    if (janet_keyeq(argv[0], "unix")) {
+        const char *path = janet_getcstring(argv, 1);
+        Janet ret = janet_wrap_abstract(janet_net_unix_sockaddr(path, janet_net_address_alloc));
+        return make_arr ? janet_wrap_array(janet_array_n(&ret, 1)) : ret;
+    }
+#endif
+    char *host, *port;
+    janet_net_hostport(argv, 0, &host, &port);
+    JanetArray *addrs = net_lookup_now(host, port, socktype);
+    if (NULL == addrs) {
+        net_resolve_await(JANET_RESOLVE_ADDRESS, host, port, NULL, NULL, socktype, make_arr);
+    }
+    Janet out;
+    if (net_address_result(addrs, make_arr, &out)) {
+        janet_panicv(out);
+    }
+    return out;
+}
+
+JANET_CORE_FN(cfun_net_connect,
+              "(net/connect host port &opt type bindhost bindport)",
+              "Open a connection to communicate with a server. Returns a duplex stream "
+              "that can be used to communicate with the server. Type is an optional keyword "
+              "to specify a connection type, either :stream or :datagram. The default is :stream. "
+              "Bindhost is an optional string to select from what address to make the outgoing "
+              "connection, with the default being the same as using the OS's preferred address. "
+              "Host names are looked up without blocking the event loop, as with net/address.") {
+    janet_arity(argc, 2, 5);
+
+    /* Check arguments */
+    int socktype = janet_get_sockettype(argv, argc, 2);
+    char *bindhost = (char *) janet_optcstring(argv, argc, 3, NULL);
+    char *bindport = NULL;
+    if (argc >= 5 && janet_checkint(argv[4])) {
+        bindport = (char *)janet_to_string(argv[4]);
+    } else {
+        bindport = (char *)janet_optcstring(argv, argc, 4, NULL);
+    }
+
+    /* Where we're connecting to */
+    JanetArray *addrs = NULL;
+    JanetArray *binds = NULL;
+#ifndef JANET_WINDOWS
+    if (janet_keyeq(argv[0], "unix")) {
+        if (bindhost != NULL) {
+            janet_panic("bindhost not supported for unix domain sockets");
+        }
+        const char *path = janet_getcstring(argv, 1);
+        Janet addr = janet_wrap_abstract(janet_net_unix_sockaddr(path, janet_net_address_alloc));
+        addrs = janet_array_n(&addr, 1);
+    } else
+#endif
+    {
+        char *host, *port;
+        janet_net_hostport(argv, 0, &host, &port);
+        addrs = net_lookup_now(host, port, socktype);
+        if (bindhost != NULL) binds = net_lookup_now(bindhost, bindport, socktype);
+        if (NULL == addrs || (bindhost != NULL && NULL == binds)) {
+            net_resolve_await(JANET_RESOLVE_CONNECT, host, port, bindhost, bindport, socktype, 0);
+        }
+    }
+
+    Janet out;
+    if (net_connect_addrs(addrs, binds, socktype, &out)) {
+        janet_panicv(out);
+    }
+    return out;
+}
+
+JANET_CORE_FN(cfun_net_dns_cache,
+              "(net/dns-cache &opt ttl)",
+              "Keep the results of host name lookups made by net/address and net/connect for `ttl` seconds, "
+              "so that connecting to the same hosts again does not wait on the resolver. The system resolver "
+              "does not report record lifetimes, so the same `ttl` applies to every name. A `ttl` of 0, the "
+              "default, turns the cache off and drops all cached lookups. Without arguments, returns the "
+              "current ttl. Otherwise returns the previous ttl.") {
+    janet_arity(argc, 0, 1);
+    double old = janet_vm.dns_ttl;
+    if (argc == 0) return janet_wrap_number(old);
+    double ttl = janet_getnumber(argv, 0);
+    if (!(ttl >= 0)) {
+        janet_panicf("expected non-negative ttl, got %v", argv[0]);
+    }
+    janet_vm.dns_ttl = ttl;
+    if (ttl == 0 && NULL != janet_vm.dns_cache) {
+        janet_gcunroot(janet_wrap_table(janet_vm.dns_cache));
+        janet_vm.dns_cache = NULL;
+    }
+    return janet_wrap_number(old);
 }
 
 static const char *serverify_socket(JSock sfd) {
@@ -810,15 +1048,25 @@ JANET_CORE_FN(cfun_stream_recv_from,
 JANET_CORE_FN(cfun_stream_write,
               "(net/write stream data &opt timeout)",
               "Write data to a stream, suspending the current fiber until the write "
-              "completes. Takes an optional timeout in seconds, after which will return nil. "
+              "completes. `data` can also be an array or tuple of strings and buffers, which "
+              "are sent in order with a single vectored send. "
+              "Takes an optional timeout in seconds, after which will return nil. "
               "Returns nil, or raises an error if the write failed.") {
     janet_arity(argc, 2, 3);
     JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
     janet_stream_flags(stream, JANET_STREAM_WRITABLE | JANET_STREAM_SOCKET);
     double to = janet_optnumber(argv, argc, 2, INFINITY);
-    if (janet_checktype(argv[1], JANET_BUFFER)) {
+    if (janet_checktypes(argv[1], JANET_TFLAG_INDEXED)) {
+        if (to != INFINITY) janet_addtimeout(to);
+        janet_ev_send_parts(stream, argv[1], MSG_NOSIGNAL);
+    } else if (janet_checktype(argv[1], JANET_BUFFER)) {
         if (to != INFINITY) janet_addtimeout(to);
         janet_ev_send_buffer(stream, janet_getbuffer(argv, 1), MSG_NOSIGNAL);
+    } else if (janet_checktype(argv[1], JANET_ABSTRACT)) {
+        /* Byte views such as file mappings are not strings, so send them as a single part */
+        janet_getbytes(argv, 1);
+        if (to != INFINITY) janet_addtimeout(to);
+        janet_ev_send_parts(stream, janet_wrap_tuple(janet_tuple_n(argv + 1, 1)), MSG_NOSIGNAL);
     } else {
         JanetByteView bytes = janet_getbytes(argv, 1);
         if (to != INFINITY) janet_addtimeout(to);
@@ -827,6 +1075,255 @@ JANET_CORE_FN(cfun_stream_write,
     janet_await();
 }
 
+/* State machine for sending a file to a socket without copying it through user
+ * space. Uses sendfile on Linux and BSD, TransmitFile on Windows, and otherwise
+ * falls back to reading and sending a chunk at a time. */
+
+typedef struct {
+    JanetListenerState head;
+    Janet file; /* Keeps the file open while the transfer runs */
+    JanetHandle fd;
+    int64_t offset;
+    int64_t remaining; /* -1 to send until end of file */
+    int64_t sent;
+#ifdef JANET_WINDOWS
+    WSAOVERLAPPED overlapped;
+    DWORD chunk;
+#else
+    int fallback;
+#endif
+} NetStateSendfile;
+
+#define JANET_SENDFILE_CHUNK 0x40000000
+#define JANET_SENDFILE_FALLBACK_CHUNK 0x10000
+
+#ifdef JANET_WINDOWS
+
+static int net_sendfile_start(NetStateSendfile *state) {
+    int64_t count = state->remaining;
+    if (count < 0 || count > JANET_SENDFILE_CHUNK) count = JANET_SENDFILE_CHUNK;
+    state->chunk = (DWORD) count;
+    memset(&state->overlapped, 0, sizeof(WSAOVERLAPPED));
+    state->overlapped.Offset = (DWORD)(state->offset & 0xFFFFFFFF);
+    state->overlapped.OffsetHigh = (DWORD)(state->offset >> 32);
+    state->head.tag = &state->overlapped;
+    if (!TransmitFile((SOCKET) state->head.stream->handle, state->fd, state->chunk, 0,
+                      &state->overlapped, NULL, 0)) {
+        int code = WSAGetLastError();
+        if (code != WSA_IO_PENDING && code != ERROR_IO_PENDING) return 1;
+    }
+    return 0;
+}
+
+JanetAsyncStatus net_machine_sendfile(JanetListenerState *s, JanetAsyncEvent event) {
+    NetStateSendfile *state = (NetStateSendfile *) s;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            janet_mark(state->file);
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            janet_cancel(s->fiber, janet_cstringv("stream closed"));
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_USER:
+            if (net_sendfile_start(state)) {
+                janet_cancel(s->fiber, janet_ev_lasterr());
+                return JANET_ASYNC_STATUS_DONE;
+            }
+            break;
+        case JANET_ASYNC_EVENT_COMPLETE: {
+            int64_t nsent = (int64_t) s->bytes;
+            state->sent += nsent;
+            state->offset += nsent;
+            if (state->remaining > 0) state->remaining -= nsent;
+            /* A short transfer means the end of the file was reached */
+            if (nsent < (int64_t) state->chunk || state->remaining == 0) {
+                janet_schedule(s->fiber, janet_wrap_number((double) state->sent));
+                return JANET_ASYNC_STATUS_DONE;
+            }
+            if (net_sendfile_start(state)) {
+                janet_cancel(s->fiber, janet_ev_lasterr());
+                return JANET_ASYNC_STATUS_DONE;
+            }
+            break;
+        }
+    }
+    return JANET_ASYNC_STATUS_NOT_DONE;
+}
+
+#else
+
+#ifdef JANET_LINUX
+/* sendfile has no MSG_NOSIGNAL, so keep a closed peer from raising SIGPIPE by
+ * blocking it for the call and discarding it if it was raised. */
+static ssize_t net_sendfile_nosignal(int sock, int fd, off_t *offset, size_t count) {
+    sigset_t pipe_set, old_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+    ssize_t n = sendfile(sock, fd, offset, count);
+    if (n == -1 && errno == EPIPE && !sigismember(&old_set, SIGPIPE)) {
+        int err = errno;
+        struct timespec zero = {0, 0};
+        sigtimedwait(&pipe_set, NULL, &zero);
+        errno = err;
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    return n;
+}
+#endif
+
+JanetAsyncStatus net_machine_sendfile(JanetListenerState *s, JanetAsyncEvent event) {
+    NetStateSendfile *state = (NetStateSendfile *) s;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            janet_mark(state->file);
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            janet_cancel(s->fiber, janet_cstringv("stream closed"));
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_ERR:
+            janet_cancel(s->fiber, janet_cstringv("stream err"));
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_HUP:
+            janet_cancel(s->fiber, janet_cstringv("stream hup"));
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_WRITE: {
+            int sock = s->stream->handle;
+            int64_t count = state->remaining;
+            if (count < 0 || count > JANET_SENDFILE_CHUNK) count = JANET_SENDFILE_CHUNK;
+            ssize_t nsent = -1;
+#if defined(JANET_LINUX)
+            if (!state->fallback) {
+                off_t off = (off_t) state->offset;
+                do {
+                    nsent = net_sendfile_nosignal(sock, state->fd, &off, (size_t) count);
+                } while (nsent == -1 && errno == EINTR);
+                /* Not every kind of file can be the source of sendfile */
+                if (nsent == -1 && (errno == EINVAL || errno == ENOSYS)) state->fallback = 1;
+            }
+#elif defined(JANET_BSD) || defined(JANET_APPLE)
+            if (!state->fallback) {
+                off_t len = 0;
+                int status;
+#ifdef JANET_APPLE
+                len = (off_t) count;
+                status = sendfile(state->fd, sock, (off_t) state->offset, &len, NULL, 0);
+#else
+                status = sendfile(state->fd, sock, (off_t) state->offset, (size_t) count, NULL, &len, 0);
+#endif
+                if (status == 0 || len > 0) {
+                    nsent = (ssize_t) len;
+                } else if (errno == EINVAL || errno == ENOTSOCK || errno == EOPNOTSUPP) {
+                    state->fallback = 1;
+                } else {
+                    nsent = -1;
+                }
+            }
+#else
+            state->fallback = 1;
+#endif
+            if (state->fallback) {
+                /* Read a chunk at the current offset and send what the socket takes. */
+                uint8_t chunk[JANET_SENDFILE_FALLBACK_CHUNK];
+                if (count > JANET_SENDFILE_FALLBACK_CHUNK) count = JANET_SENDFILE_FALLBACK_CHUNK;
+                ssize_t nread;
+                do {
+                    nread = pread(state->fd, chunk, (size_t) count, (off_t) state->offset);
+                } while (nread == -1 && errno == EINTR);
+                if (nread == -1) {
+                    janet_cancel(s->fiber, janet_ev_lasterr());
+                    return JANET_ASYNC_STATUS_DONE;
+                }
+                nsent = 0;
+                if (nread > 0) {
+                    do {
+                        nsent = send(sock, chunk, (size_t) nread, MSG_NOSIGNAL);
+                    } while (nsent == -1 && errno == EINTR);
+                }
+            }
+            if (nsent == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                janet_cancel(s->fiber, janet_ev_lasterr());
+                return JANET_ASYNC_STATUS_DONE;
+            }
+            state->sent += nsent;
+            state->offset += nsent;
+            if (state->remaining > 0) state->remaining -= nsent;
+            /* Nothing sent means the end of the file was reached */
+            if (nsent == 0 || state->remaining == 0) {
+                janet_schedule(s->fiber, janet_wrap_number((double) state->sent));
+                return JANET_ASYNC_STATUS_DONE;
+            }
+            break;
+        }
+    }
+    return JANET_ASYNC_STATUS_NOT_DONE;
+}
+
+#endif
+
+JANET_CORE_FN(cfun_stream_sendfile,
+              "(net/sendfile stream file &opt offset length timeout)",
+              "Send the contents of `file`, a core/file or a core/stream, to a socket stream, "
+              "suspending the current fiber until the transfer completes. The kernel copies the "
+              "data directly from the file to the socket where it can (sendfile on Linux and BSD, "
+              "TransmitFile on Windows); otherwise the file is read and sent a chunk at a time. "
+              "Starts at byte `offset` of the file, defaulting to 0, and sends `length` bytes, or "
+              "up to the end of the file if `length` is nil. The file's read position is not "
+              "changed. Takes an optional timeout in seconds, after which will return nil. "
+              "Returns the number of bytes sent.") {
+    janet_arity(argc, 2, 5);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    janet_stream_flags(stream, JANET_STREAM_WRITABLE | JANET_STREAM_SOCKET);
+    JanetHandle fd;
+    JanetStream *fstream = janet_checkabstract(argv[1], &janet_stream_type);
+    if (NULL != fstream) {
+        if (fstream->flags & JANET_STREAM_CLOSED) janet_panic("stream is closed");
+        fd = fstream->handle;
+    } else {
+        int32_t flags;
+        FILE *f = janet_getfile(argv, 1, &flags);
+        if (flags & JANET_FILE_CLOSED) janet_panic("file is closed");
+        /* Data written through the FILE must reach the file first */
+        fflush(f);
+#ifdef JANET_WINDOWS
+        fd = (HANDLE) _get_osfhandle(_fileno(f));
+#else
+        fd = fileno(f);
+#endif
+    }
+    int64_t offset = 0;
+    if (argc > 2 && !janet_checktype(argv[2], JANET_NIL)) {
+        offset = janet_getinteger64(argv, 2);
+        if (offset < 0) janet_panicf("expected non-negative offset, got %v", argv[2]);
+    }
+    int64_t length = -1;
+    if (argc > 3 && !janet_checktype(argv[3], JANET_NIL)) {
+        length = janet_getinteger64(argv, 3);
+        if (length < 0) janet_panicf("expected non-negative length, got %v", argv[3]);
+    }
+    double to = janet_optnumber(argv, argc, 4, INFINITY);
+    if (length == 0) return janet_wrap_number(0);
+    if (to != INFINITY) janet_addtimeout(to);
+    NetStateSendfile *state = (NetStateSendfile *) janet_listen(stream, net_machine_sendfile,
+                              JANET_ASYNC_LISTEN_WRITE, sizeof(NetStateSendfile), NULL);
+    state->file = argv[1];
+    state->fd = fd;
+    state->offset = offset;
+    state->remaining = length;
+    state->sent = 0;
+#ifdef JANET_WINDOWS
+    net_machine_sendfile((JanetListenerState *) state, JANET_ASYNC_EVENT_USER);
+#else
+    state->fallback = 0;
+#endif
+    janet_await();
+}
+
 JANET_CORE_FN(cfun_stream_send_to,
               "(net/send-to stream dest data &opt timeout)",
               "Writes a datagram to a server stream. dest is a the destination address of the packet. "
@@ -848,6 +1345,433 @@ JANET_CORE_FN(cfun_stream_send_to,
     janet_await();
 }
 
+/* State machines for batched datagram receive and send. On Linux, recvmmsg and
+ * sendmmsg move many datagrams per system call. Elsewhere each datagram takes
+ * its own call, but a whole batch is still handled in a single wakeup. */
+
+#define JANET_MMSG_MAX 64
+
+typedef struct {
+    JanetListenerState head;
+    JanetArray *bufs;
+    JanetArray *addrs;
+    int32_t nbytes;
+    int32_t count; /* Datagrams received so far */
+    int flags;
+#ifdef JANET_WINDOWS
+    OVERLAPPED overlapped;
+    WSABUF wbuf;
+    DWORD wflags;
+    struct sockaddr_storage from;
+    int fromlen;
+    uint8_t *scratch;
+#endif
+} NetStateRecvMany;
+
+static void net_recv_many_address(NetStateRecvMany *state, const void *sa, size_t len) {
+    void *abst = janet_abstract(&janet_address_type, len);
+    memcpy(abst, sa, len);
+    janet_array_push(state->addrs, janet_wrap_abstract(abst));
+}
+
+#ifdef JANET_WINDOWS
+
+/* Receive whatever else is already queued without blocking. FIONREAD reports
+ * zero when nothing is waiting, so the synchronous recvfrom can not block. */
+static void net_recv_many_drain(NetStateRecvMany *state) {
+    SOCKET sock = (SOCKET) state->head.stream->handle;
+    while (state->count < state->bufs->count) {
+        u_long avail = 0;
+        if (ioctlsocket(sock, FIONREAD, &avail) || avail == 0) break;
+        JanetBuffer *buf = janet_unwrap_buffer(state->bufs->data[state->count]);
+        janet_buffer_ensure(buf, state->nbytes, 1);
+        struct sockaddr_storage from;
+        int fromlen = sizeof(from);
+        int n = recvfrom(sock, (char *) buf->data, state->nbytes, 0, (struct sockaddr *) &from, &fromlen);
+        if (n == SOCKET_ERROR) break;
+        buf->count = n;
+        net_recv_many_address(state, &from, (size_t) fromlen);
+        state->count++;
+    }
+}
+
+JanetAsyncStatus net_machine_recv_many(JanetListenerState *s, JanetAsyncEvent event) {
+    NetStateRecvMany *state = (NetStateRecvMany *) s;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            janet_mark(janet_wrap_array(state->bufs));
+            janet_mark(janet_wrap_array(state->addrs));
+            break;
+        case JANET_ASYNC_EVENT_DEINIT:
+            janet_buffer_borrow_values(state->bufs->data, state->bufs->count, 0);
+            janet_free(state->scratch);
+            state->scratch = NULL;
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            janet_schedule(s->fiber, janet_wrap_nil());
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_USER: {
+            /* Wait for the first datagram with an overlapped receive */
+            s->tag = &state->overlapped;
+            memset(&state->overlapped, 0, sizeof(OVERLAPPED));
+            state->wbuf.len = (ULONG) state->nbytes;
+            state->wbuf.buf = (char *) state->scratch;
+            state->wflags = (DWORD) state->flags;
+            state->fromlen = sizeof(state->from);
+            int status = WSARecvFrom((SOCKET) s->stream->handle, &state->wbuf, 1, NULL, &state->wflags,
+                                     (struct sockaddr *) &state->from, &state->fromlen, &state->overlapped, NULL);
+            if (status && (WSA_IO_PENDING != WSAGetLastError())) {
+                janet_cancel(s->fiber, janet_ev_lasterr());
+                return JANET_ASYNC_STATUS_DONE;
+            }
+            break;
+        }
+        case JANET_ASYNC_EVENT_COMPLETE: {
+            JanetBuffer *buf = janet_unwrap_buffer(state->bufs->data[0]);
+            buf->count = 0;
+            janet_buffer_push_bytes(buf, state->scratch, (int32_t) s->bytes);
+            net_recv_many_address(state, &state->from, (size_t) state->fromlen);
+            state->count = 1;
+            net_recv_many_drain(state);
+            janet_schedule(s->fiber, janet_wrap_integer(state->count));
+            return JANET_ASYNC_STATUS_DONE;
+        }
+    }
+    return JANET_ASYNC_STATUS_NOT_DONE;
+}
+
+#else
+
+/* Receive up to batch datagrams into the next buffers. Returns how many were
+ * received, or -1 with errno set if the first receive failed. */
+static int32_t net_recv_batch(NetStateRecvMany *state, int sock, int32_t batch) {
+    JanetBuffer *bufs[JANET_MMSG_MAX];
+    struct sockaddr_storage saddrs[JANET_MMSG_MAX];
+    int32_t n = 0;
+    for (int32_t i = 0; i < batch; i++) {
+        bufs[i] = janet_unwrap_buffer(state->bufs->data[state->count + i]);
+        janet_buffer_ensure(bufs[i], state->nbytes, 1);
+    }
+#ifdef JANET_LINUX
+    struct mmsghdr msgs[JANET_MMSG_MAX];
+    struct iovec iovs[JANET_MMSG_MAX];
+    memset(msgs, 0, sizeof(struct mmsghdr) * (size_t) batch);
+    for (int32_t i = 0; i < batch; i++) {
+        iovs[i].iov_base = bufs[i]->data;
+        iovs[i].iov_len = (size_t) state->nbytes;
+        msgs[i].msg_hdr.msg_name = &saddrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(saddrs[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int status;
+    do {
+        status = recvmmsg(sock, msgs, (unsigned int) batch, state->flags, NULL);
+    } while (status == -1 && errno == EINTR);
+    if (status == -1) return -1;
+    for (n = 0; n < status; n++) {
+        bufs[n]->count = (int32_t) msgs[n].msg_len;
+        net_recv_many_address(state, &saddrs[n], msgs[n].msg_hdr.msg_namelen);
+    }
+#else
+    for (; n < batch; n++) {
+        socklen_t socklen = sizeof(saddrs[n]);
+        ssize_t nread;
+        do {
+            nread = recvfrom(sock, bufs[n]->data, (size_t) state->nbytes, state->flags,
+                             (struct sockaddr *) &saddrs[n], &socklen);
+        } while (nread == -1 && errno == EINTR);
+        if (nread == -1) {
+            if (n == 0) return -1;
+            break;
+        }
+        bufs[n]->count = (int32_t) nread;
+        net_recv_many_address(state, &saddrs[n], socklen);
+    }
+#endif
+    return n;
+}
+
+JanetAsyncStatus net_machine_recv_many(JanetListenerState *s, JanetAsyncEvent event) {
+    NetStateRecvMany *state = (NetStateRecvMany *) s;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            janet_mark(janet_wrap_array(state->bufs));
+            janet_mark(janet_wrap_array(state->addrs));
+            break;
+        case JANET_ASYNC_EVENT_DEINIT:
+            janet_buffer_borrow_values(state->bufs->data, state->bufs->count, 0);
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            janet_schedule(s->fiber, janet_wrap_nil());
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_ERR:
+            janet_cancel(s->fiber, janet_cstringv("stream err"));
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_HUP:
+        case JANET_ASYNC_EVENT_READ: {
+            int sock = s->stream->handle;
+            while (state->count < state->bufs->count) {
+                int32_t batch = state->bufs->count - state->count;
+                if (batch > JANET_MMSG_MAX) batch = JANET_MMSG_MAX;
+                int32_t n = net_recv_batch(state, sock, batch);
+                if (n == -1) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                    /* Report what was already received, the error will come up again */
+                    if (state->count) break;
+                    janet_cancel(s->fiber, janet_ev_lasterr());
+                    return JANET_ASYNC_STATUS_DONE;
+                }
+                state->count += n;
+                /* A short batch means the socket has been drained */
+                if (n < batch) break;
+            }
+            if (state->count) {
+                janet_schedule(s->fiber, janet_wrap_integer(state->count));
+                return JANET_ASYNC_STATUS_DONE;
+            }
+            break;
+        }
+    }
+    return JANET_ASYNC_STATUS_NOT_DONE;
+}
+
+#endif
+
+JANET_CORE_FN(cfun_stream_recv_many,
+              "(net/recv-many stream nbytes bufs addrs &opt timeout)",
+              "Receives a batch of datagrams from a server stream in one go. `bufs` is an array or tuple "
+              "of buffers, and each datagram received replaces the contents of the next buffer, up to "
+              "`nbytes` bytes per datagram. `addrs` is an array that is cleared and then filled with the "
+              "socket-address each datagram came from. Suspends the current fiber until at least one "
+              "datagram arrives, then takes as many as are already queued, up to the number of buffers. "
+              "Takes an optional timeout in seconds, after which will return nil. "
+              "Returns the number of datagrams received.") {
+    janet_arity(argc, 4, 5);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    janet_stream_flags(stream, JANET_STREAM_UDPSERVER | JANET_STREAM_SOCKET);
+    int32_t n = janet_getnat(argv, 1);
+    JanetView bufs = janet_getindexed(argv, 2);
+    JanetArray *addrs = janet_getarray(argv, 3);
+    double to = janet_optnumber(argv, argc, 4, INFINITY);
+    for (int32_t i = 0; i < bufs.len; i++) {
+        if (!janet_checktype(bufs.items[i], JANET_BUFFER)) {
+            janet_panicf("expected array of buffers, got %v at index %d", bufs.items[i], i);
+        }
+    }
+    addrs->count = 0;
+    if (bufs.len == 0) return janet_wrap_integer(0);
+    if (to != INFINITY) janet_addtimeout(to);
+    NetStateRecvMany *state = (NetStateRecvMany *) janet_listen(stream, net_machine_recv_many,
+                              JANET_ASYNC_LISTEN_READ, sizeof(NetStateRecvMany), NULL);
+    /* Copy the buffers so the batch can not change under the receive */
+    state->bufs = janet_array(bufs.len);
+    memcpy(state->bufs->data, bufs.items, sizeof(Janet) * (size_t) bufs.len);
+    state->bufs->count = bufs.len;
+    janet_buffer_borrow_values(state->bufs->data, state->bufs->count, 1);
+    state->addrs = addrs;
+    state->nbytes = n;
+    state->count = 0;
+    state->flags = MSG_NOSIGNAL;
+#ifdef JANET_WINDOWS
+    state->scratch = janet_malloc(n ? (size_t) n : 1);
+    if (NULL == state->scratch) {
+        JANET_OUT_OF_MEMORY;
+    }
+    net_machine_recv_many((JanetListenerState *) state, JANET_ASYNC_EVENT_USER);
+#endif
+    janet_await();
+}
+
+typedef struct {
+    JanetListenerState head;
+    JanetArray *packets; /* Destination and data, two slots per datagram */
+    int32_t next; /* Index of the next datagram to send */
+    int flags;
+#ifdef JANET_WINDOWS
+    WSAOVERLAPPED overlapped;
+    WSABUF wbuf;
+#endif
+} NetStateSendMany;
+
+#ifdef JANET_WINDOWS
+
+static int net_send_many_start(NetStateSendMany *state) {
+    const struct sockaddr *to = janet_unwrap_abstract(state->packets->data[2 * state->next]);
+    const uint8_t *bytes;
+    int32_t len;
+    janet_bytes_view(state->packets->data[2 * state->next + 1], &bytes, &len);
+    state->head.tag = &state->overlapped;
+    memset(&state->overlapped, 0, sizeof(WSAOVERLAPPED));
+    state->wbuf.buf = (char *) bytes;
+    state->wbuf.len = (ULONG) len;
+    int status = WSASendTo((SOCKET) state->head.stream->handle, &state->wbuf, 1, NULL, (DWORD) state->flags,
+                           to, (int) janet_abstract_size((void *) to), &state->overlapped, NULL);
+    return status && (WSA_IO_PENDING != WSAGetLastError());
+}
+
+JanetAsyncStatus net_machine_send_many(JanetListenerState *s, JanetAsyncEvent event) {
+    NetStateSendMany *state = (NetStateSendMany *) s;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            janet_mark(janet_wrap_array(state->packets));
+            break;
+        case JANET_ASYNC_EVENT_DEINIT:
+            janet_buffer_borrow_values(state->packets->data, state->packets->count, 0);
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            janet_cancel(s->fiber, janet_cstringv("stream closed"));
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_COMPLETE:
+            state->next++;
+            if (2 * state->next == state->packets->count) {
+                janet_schedule(s->fiber, janet_wrap_integer(state->next));
+                return JANET_ASYNC_STATUS_DONE;
+            }
+        /* fallthrough */
+        case JANET_ASYNC_EVENT_USER:
+            if (net_send_many_start(state)) {
+                janet_cancel(s->fiber, janet_ev_lasterr());
+                return JANET_ASYNC_STATUS_DONE;
+            }
+            break;
+    }
+    return JANET_ASYNC_STATUS_NOT_DONE;
+}
+
+#else
+
+/* Send up to batch datagrams starting at the next one. Returns how many were
+ * sent, or -1 with errno set if the first send failed. */
+static int32_t net_send_batch(NetStateSendMany *state, int sock, int32_t batch) {
+    const Janet *packets = state->packets->data + 2 * state->next;
+#ifdef JANET_LINUX
+    struct mmsghdr msgs[JANET_MMSG_MAX];
+    struct iovec iovs[JANET_MMSG_MAX];
+    memset(msgs, 0, sizeof(struct mmsghdr) * (size_t) batch);
+    for (int32_t i = 0; i < batch; i++) {
+        void *to = janet_unwrap_abstract(packets[2 * i]);
+        const uint8_t *bytes;
+        int32_t len;
+        janet_bytes_view(packets[2 * i + 1], &bytes, &len);
+        iovs[i].iov_base = (void *) bytes;
+        iovs[i].iov_len = (size_t) len;
+        msgs[i].msg_hdr.msg_name = to;
+        msgs[i].msg_hdr.msg_namelen = (socklen_t) janet_abstract_size(to);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int status;
+    do {
+        status = sendmmsg(sock, msgs, (unsigned int) batch, state->flags);
+    } while (status == -1 && errno == EINTR);
+    return status;
+#else
+    int32_t n = 0;
+    for (; n < batch; n++) {
+        void *to = janet_unwrap_abstract(packets[2 * n]);
+        const uint8_t *bytes;
+        int32_t len;
+        janet_bytes_view(packets[2 * n + 1], &bytes, &len);
+        ssize_t nsent;
+        do {
+            nsent = sendto(sock, bytes, (size_t) len, state->flags,
+                           (const struct sockaddr *) to, (socklen_t) janet_abstract_size(to));
+        } while (nsent == -1 && errno == EINTR);
+        if (nsent == -1) return n ? n : -1;
+    }
+    return n;
+#endif
+}
+
+JanetAsyncStatus net_machine_send_many(JanetListenerState *s, JanetAsyncEvent event) {
+    NetStateSendMany *state = (NetStateSendMany *) s;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            janet_mark(janet_wrap_array(state->packets));
+            break;
+        case JANET_ASYNC_EVENT_DEINIT:
+            janet_buffer_borrow_values(state->packets->data, state->packets->count, 0);
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            janet_cancel(s->fiber, janet_cstringv("stream closed"));
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_ERR:
+            janet_cancel(s->fiber, janet_cstringv("stream err"));
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_HUP:
+            janet_cancel(s->fiber, janet_cstringv("stream hup"));
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_WRITE: {
+            int sock = s->stream->handle;
+            int32_t total = state->packets->count / 2;
+            while (state->next < total) {
+                int32_t batch = total - state->next;
+                if (batch > JANET_MMSG_MAX) batch = JANET_MMSG_MAX;
+                int32_t n = net_send_batch(state, sock, batch);
+                if (n == -1) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) return JANET_ASYNC_STATUS_NOT_DONE;
+                    janet_cancel(s->fiber, janet_ev_lasterr());
+                    return JANET_ASYNC_STATUS_DONE;
+                }
+                state->next += n;
+            }
+            janet_schedule(s->fiber, janet_wrap_integer(total));
+            return JANET_ASYNC_STATUS_DONE;
+        }
+    }
+    return JANET_ASYNC_STATUS_NOT_DONE;
+}
+
+#endif
+
+JANET_CORE_FN(cfun_stream_send_many,
+              "(net/send-many stream packets &opt timeout)",
+              "Writes a batch of datagrams to a server stream. `packets` is an array or tuple of "
+              "`[dest data]` pairs, where dest is the destination address of the packet, as for "
+              "net/send-to. The datagrams are sent in order, many per system call where the platform "
+              "allows it. Takes an optional timeout in seconds, after which will return nil. "
+              "Returns the number of datagrams sent.") {
+    janet_arity(argc, 2, 3);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    janet_stream_flags(stream, JANET_STREAM_UDPSERVER | JANET_STREAM_SOCKET);
+    JanetView packets = janet_getindexed(argv, 1);
+    double to = janet_optnumber(argv, argc, 2, INFINITY);
+    JanetArray *flat = janet_array(2 * packets.len);
+    for (int32_t i = 0; i < packets.len; i++) {
+        const Janet *pair;
+        int32_t pair_len;
+        if (!janet_indexed_view(packets.items[i], &pair, &pair_len) || pair_len != 2 ||
+                NULL == janet_checkabstract(pair[0], &janet_address_type) ||
+                !janet_checktypes(pair[1], JANET_TFLAG_BYTES)) {
+            janet_panicf("expected [dest data] pair, got %v at index %d", packets.items[i], i);
+        }
+        flat->data[2 * i] = pair[0];
+        flat->data[2 * i + 1] = pair[1];
+    }
+    flat->count = 2 * packets.len;
+    if (packets.len == 0) return janet_wrap_integer(0);
+    if (to != INFINITY) janet_addtimeout(to);
+    NetStateSendMany *state = (NetStateSendMany *) janet_listen(stream, net_machine_send_many,
+                              JANET_ASYNC_LISTEN_WRITE, sizeof(NetStateSendMany), NULL);
+    state->packets = flat;
+    janet_buffer_borrow_values(flat->data, flat->count, 1);
+    state->next = 0;
+    state->flags = MSG_NOSIGNAL;
+#ifdef JANET_WINDOWS
+    net_machine_send_many((JanetListenerState *) state, JANET_ASYNC_EVENT_USER);
+#endif
+    janet_await();
+}
+
 JANET_CORE_FN(cfun_stream_flush,
               "(net/flush stream)",
               "Make sure that a stream is not buffering any data. This temporarily disables Nagle's algorithm. "
@@ -868,11 +1792,14 @@ static const JanetMethod net_stream_methods[] = {
     {"close", janet_cfun_stream_close},
     {"read", cfun_stream_read},
     {"write", cfun_stream_write},
+    {"sendfile", cfun_stream_sendfile},
     {"flush", cfun_stream_flush},
     {"accept", cfun_stream_accept},
     {"accept-loop", cfun_stream_accept_loop},
     {"send-to", cfun_stream_send_to},
     {"recv-from", cfun_stream_recv_from},
+    {"send-many", cfun_stream_send_many},
+    {"recv-many", cfun_stream_recv_many},
     {"evread", janet_cfun_stream_read},
     {"evchunk", janet_cfun_stream_chunk},
     {"evwrite", janet_cfun_stream_write},
@@ -894,10 +1821,14 @@ void janet_lib_net(JanetTable *env) {
         JANET_CORE_REG("net/read", cfun_stream_read),
         JANET_CORE_REG("net/chunk", cfun_stream_chunk),
         JANET_CORE_REG("net/write", cfun_stream_write),
+        JANET_CORE_REG("net/sendfile", cfun_stream_sendfile),
         JANET_CORE_REG("net/send-to", cfun_stream_send_to),
         JANET_CORE_REG("net/recv-from", cfun_stream_recv_from),
+        JANET_CORE_REG("net/send-many", cfun_stream_send_many),
+        JANET_CORE_REG("net/recv-many", cfun_stream_recv_many),
         JANET_CORE_REG("net/flush", cfun_stream_flush),
         JANET_CORE_REG("net/connect", cfun_net_connect),
+        JANET_CORE_REG("net/dns-cache", cfun_net_dns_cache),
         JANET_CORE_REG("net/shutdown", cfun_net_shutdown),
         JANET_CORE_REG("net/peername", cfun_net_getpeername),
         JANET_CORE_REG("net/localname", cfun_net_getsockname),
@@ -912,6 +1843,8 @@ void janet_net_init(void) {
     WSADATA wsaData;
     janet_assert(!WSAStartup(MAKEWORD(2, 2), &wsaData), "could not start winsock");
 #endif
+    janet_vm.dns_cache = NULL;
+    janet_vm.dns_ttl = 0;
 }
 
 void janet_net_deinit(void) {
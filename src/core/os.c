@@ -56,6 +56,9 @@
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#ifdef JANET_LINUX
+#include <sys/syscall.h>
+#endif
 #ifdef JANET_APPLE
 #include <crt_externs.h>
 #define environ (*_NSGetEnviron())
@@ -378,6 +381,10 @@ static const JanetAbstractType ProcAT;
 #define JANET_PROC_OWNS_STDOUT 32
 #define JANET_PROC_OWNS_STDERR 64
 #define JANET_PROC_ALLOW_ZOMBIE 128
+#define JANET_PROC_PIDFD 256
+#if defined(JANET_EV) && defined(JANET_LINUX) && defined(SYS_pidfd_open)
+#define JANET_EV_PIDFD
+#endif
 typedef struct {
     int flags;
 #ifdef JANET_WINDOWS
@@ -396,6 +403,9 @@ typedef struct {
     JanetFile *out;
     JanetFile *err;
 #endif
+#ifdef JANET_EV_PIDFD
+    JanetStream *pidfd;
+#endif
 } JanetProc;
 
 #ifdef JANET_EV
@@ -469,6 +479,83 @@ static void janet_proc_wait_cb(JanetEVGenericMessage args) {
     }
 }
 
+#ifdef JANET_EV_PIDFD
+
+/* Wait on a child through a pidfd, which becomes readable when the child exits. This
+ * is an ordinary listener on the event loop, so no thread is needed per child. */
+
+typedef struct {
+    JanetListenerState head;
+    JanetProc *proc;
+} JanetProcWaitState;
+
+static void janet_proc_pidfd_close(JanetEVGenericMessage msg) {
+    JanetStream *stream = (JanetStream *) msg.argp;
+    janet_stream_close(stream);
+    janet_gcunroot(janet_wrap_abstract(stream));
+}
+
+static JanetAsyncStatus janet_proc_wait_machine(JanetListenerState *s, JanetAsyncEvent event) {
+    JanetProcWaitState *state = (JanetProcWaitState *) s;
+    JanetProc *proc = state->proc;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            janet_mark(janet_wrap_abstract(proc));
+            break;
+        case JANET_ASYNC_EVENT_CANCEL:
+            /* The waiting fiber was resumed early, so the process can be waited on again */
+            proc->flags &= ~(JANET_PROC_WAITING | JANET_PROC_PIDFD);
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            proc->flags &= ~(JANET_PROC_WAITING | JANET_PROC_PIDFD);
+            janet_schedule(s->fiber, janet_wrap_nil());
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_HUP:
+        case JANET_ASYNC_EVENT_ERR:
+        case JANET_ASYNC_EVENT_READ: {
+            int status = proc_get_status(proc);
+            proc->return_code = (int32_t) status;
+            proc->flags |= JANET_PROC_WAITED;
+            proc->flags &= ~(JANET_PROC_WAITING | JANET_PROC_PIDFD);
+            /* The pidfd can't be closed while the event loop is dispatching it, so
+             * close it right after. Until then it is rooted. */
+            JanetEVGenericMessage msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.argp = proc->pidfd;
+            janet_gcroot(janet_wrap_abstract(proc->pidfd));
+            proc->pidfd = NULL;
+            janet_ev_post_event(NULL, janet_proc_pidfd_close, msg);
+            if ((status != 0) && (proc->flags & JANET_PROC_ERROR_NONZERO)) {
+                JanetString str = janet_formatc("command failed with non-zero exit code %d", status);
+                janet_cancel(s->fiber, janet_wrap_string(str));
+            } else {
+                janet_schedule(s->fiber, janet_wrap_integer(status));
+            }
+            return JANET_ASYNC_STATUS_DONE;
+        }
+    }
+    return JANET_ASYNC_STATUS_NOT_DONE;
+}
+
+/* Returns 0 if pidfds are not supported, in which case the caller falls back to a thread. */
+static int janet_proc_wait_pidfd(JanetProc *proc) {
+    if (NULL == proc->pidfd) {
+        int fd = (int) syscall(SYS_pidfd_open, proc->pid, 0);
+        if (fd < 0) return 0;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        proc->pidfd = janet_stream(fd, JANET_STREAM_READABLE, NULL);
+    }
+    proc->flags |= JANET_PROC_WAITING | JANET_PROC_PIDFD;
+    JanetProcWaitState *state = (JanetProcWaitState *) janet_listen(proc->pidfd,
+                                janet_proc_wait_machine, JANET_ASYNC_LISTEN_READ, sizeof(JanetProcWaitState), NULL);
+    state->proc = proc;
+    return 1;
+}
+
+#endif
+
 #endif /* End ev check */
 
 static int janet_proc_gc(void *p, size_t s) {
@@ -487,7 +574,7 @@ static int janet_proc_gc(void *p, size_t s) {
         /* Kill and wait to prevent zombies */
         kill(proc->pid, SIGKILL);
         int status;
-        if (!(proc->flags & JANET_PROC_WAITING)) {
+        if (!(proc->flags & JANET_PROC_WAITING) || (proc->flags & JANET_PROC_PIDFD)) {
             waitpid(proc->pid, &status, 0);
         }
     }
@@ -501,6 +588,9 @@ static int janet_proc_mark(void *p, size_t s) {
     if (NULL != proc->in) janet_mark(janet_wrap_abstract(proc->in));
     if (NULL != proc->out) janet_mark(janet_wrap_abstract(proc->out));
     if (NULL != proc->err) janet_mark(janet_wrap_abstract(proc->err));
+#ifdef JANET_EV_PIDFD
+    if (NULL != proc->pidfd) janet_mark(janet_wrap_abstract(proc->pidfd));
+#endif
     return 0;
 }
 
@@ -514,6 +604,11 @@ os_proc_wait_impl(JanetProc *proc) {
         janet_panicf("cannot wait twice on a process");
     }
 #ifdef JANET_EV
+#ifdef JANET_EV_PIDFD
+    if (janet_proc_wait_pidfd(proc)) {
+        janet_await();
+    }
+#endif
     /* Event loop implementation - threaded call */
     proc->flags |= JANET_PROC_WAITING;
     JanetEVGenericMessage targs;
@@ -1032,6 +1127,9 @@ static Janet os_execute_impl(int32_t argc, Janet *argv, int is_spawn) {
     proc->in = NULL;
     proc->out = NULL;
     proc->err = NULL;
+#ifdef JANET_EV_PIDFD
+    proc->pidfd = NULL;
+#endif
     proc->flags = pipe_owner_flags;
     if (janet_flag_at(flags, 2)) {
         proc->flags |= JANET_PROC_ERROR_NONZERO;
@@ -1238,6 +1336,61 @@ JANET_CORE_FN(os_sleep,
     return janet_wrap_nil();
 }
 
+JANET_CORE_FN(os_cpu_count,
+              "(os/cpu-count &opt dflt)",
+              "Get an approximate number of CPUs available for this program to use. If unable to get an "
+              "approximation, will return a default value dflt.") {
+    janet_arity(argc, 0, 1);
+    Janet dflt = argc > 0 ? argv[0] : janet_wrap_nil();
+#ifdef JANET_WINDOWS
+    (void) dflt;
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return janet_wrap_integer(info.dwNumberOfProcessors);
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long result = sysconf(_SC_NPROCESSORS_ONLN);
+    if (result < 1) return dflt;
+    return janet_wrap_integer((int32_t) result);
+#else
+    return dflt;
+#endif
+}
+
+JANET_CORE_FN(os_setaffinity,
+              "(os/setaffinity & cpus)",
+              "Restrict the calling thread to run only on the given CPU indices. "
+              "Returns true on success, or false if thread affinity is not supported on this platform.") {
+    janet_arity(argc, 1, -1);
+#if defined(JANET_LINUX) && defined(SYS_sched_setaffinity)
+    unsigned long mask[16];
+    memset(mask, 0, sizeof(mask));
+    const int32_t bits = (int32_t)(sizeof(unsigned long) * 8);
+    for (int32_t i = 0; i < argc; i++) {
+        int32_t cpu = janet_getinteger(argv, i);
+        if (cpu < 0 || cpu >= (int32_t)(sizeof(mask) * 8)) janet_panicf("cpu index %d out of range", cpu);
+        mask[cpu / bits] |= 1UL << (cpu % bits);
+    }
+    if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask)) {
+        janet_panicf("%s", strerror(errno));
+    }
+    return janet_wrap_true();
+#elif defined(JANET_WINDOWS)
+    DWORD_PTR mask = 0;
+    for (int32_t i = 0; i < argc; i++) {
+        int32_t cpu = janet_getinteger(argv, i);
+        if (cpu < 0 || cpu >= (int32_t)(sizeof(mask) * 8)) janet_panicf("cpu index %d out of range", cpu);
+        mask |= ((DWORD_PTR) 1) << cpu;
+    }
+    if (0 == SetThreadAffinityMask(GetCurrentThread(), mask)) {
+        janet_panic("failed to set thread affinity");
+    }
+    return janet_wrap_true();
+#else
+    for (int32_t i = 0; i < argc; i++) janet_getinteger(argv, i);
+    return janet_wrap_false();
+#endif
+}
+
 JANET_CORE_FN(os_cwd,
               "(os/cwd)",
               "Returns the current working directory.") {
@@ -1927,6 +2080,370 @@ JANET_CORE_FN(os_dir,
     return janet_wrap_array(paths);
 }
 
+/*
+ * Directory walking
+ */
+
+#define JANET_WALK_TYPES 1
+#define JANET_WALK_STAT 2
+#define JANET_WALK_FOLLOW 4
+
+typedef struct {
+#ifdef JANET_WINDOWS
+    intptr_t handle;
+    struct _finddata_t data;
+    int has_data; /* data holds an entry that has not been returned yet */
+#else
+    DIR *dir;
+    dev_t dev;
+    ino_t ino;
+#endif
+    size_t path_len; /* Length of this directory's path in the walker path */
+} JanetWalkFrame;
+
+typedef struct {
+    JanetWalkFrame *frames;
+    int32_t depth;
+    int32_t cap;
+    int32_t max_depth;
+    int32_t index;
+    int flags;
+    int pending_dir; /* The last entry is a directory to enter on the next step */
+    int done;
+    char *path;
+    size_t path_len;
+    size_t path_cap;
+    Janet current;
+} JanetWalker;
+
+static void walker_close(JanetWalker *w) {
+    for (int32_t i = 0; i < w->depth; i++) {
+#ifdef JANET_WINDOWS
+        _findclose(w->frames[i].handle);
+#else
+        closedir(w->frames[i].dir);
+#endif
+    }
+    w->depth = 0;
+    w->done = 1;
+    w->pending_dir = 0;
+    w->current = janet_wrap_nil();
+}
+
+static int walker_gc(void *p, size_t s) {
+    (void) s;
+    JanetWalker *w = (JanetWalker *) p;
+    walker_close(w);
+    janet_free(w->frames);
+    janet_free(w->path);
+    return 0;
+}
+
+static int walker_mark(void *p, size_t s) {
+    (void) s;
+    janet_mark(((JanetWalker *) p)->current);
+    return 0;
+}
+
+static void walker_path_push(JanetWalker *w, const char *name) {
+    size_t len = strlen(name);
+    size_t needed = w->path_len + len + 2;
+    if (needed > w->path_cap) {
+        size_t cap = needed * 2;
+        char *path = janet_realloc(w->path, cap);
+        if (NULL == path) {
+            JANET_OUT_OF_MEMORY;
+        }
+        w->path = path;
+        w->path_cap = cap;
+    }
+    if (w->path_len && w->path[w->path_len - 1] != '/') w->path[w->path_len++] = '/';
+    memcpy(w->path + w->path_len, name, len + 1);
+    w->path_len += len;
+}
+
+/* Open the directory at the current path and push it on the stack. Returns 0 if it
+ * can't be opened or is already being walked (a symlink cycle). */
+static int walker_enter(JanetWalker *w, JanetWalkFrame *parent, const char *name) {
+    JanetWalkFrame frame;
+    frame.path_len = w->path_len;
+#ifdef JANET_WINDOWS
+    (void) parent;
+    (void) name;
+    char pattern[MAX_PATH + 1];
+    if (w->path_len > sizeof(pattern) - 3) return 0;
+    sprintf(pattern, "%s/*", w->path);
+    frame.handle = _findfirst(pattern, &frame.data);
+    if (-1 == frame.handle) return 0;
+    frame.has_data = 1;
+#else
+    int fd;
+    if (NULL == parent) {
+        fd = open(w->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    } else {
+        /* Open relative to the parent so the kernel does not resolve the whole path again */
+        fd = openat(dirfd(parent->dir), name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return 0;
+    }
+    for (int32_t i = 0; i < w->depth; i++) {
+        if (w->frames[i].dev == st.st_dev && w->frames[i].ino == st.st_ino) {
+            close(fd);
+            return 0;
+        }
+    }
+    frame.dir = fdopendir(fd);
+    if (NULL == frame.dir) {
+        close(fd);
+        return 0;
+    }
+    frame.dev = st.st_dev;
+    frame.ino = st.st_ino;
+#endif
+    if (w->depth == w->cap) {
+        int32_t cap = w->cap ? 2 * w->cap : 8;
+        JanetWalkFrame *frames = janet_realloc(w->frames, cap * sizeof(JanetWalkFrame));
+        if (NULL == frames) {
+            JANET_OUT_OF_MEMORY;
+        }
+        w->frames = frames;
+        w->cap = cap;
+    }
+    w->frames[w->depth++] = frame;
+    return 1;
+}
+
+#ifndef JANET_WINDOWS
+static const char *walker_dtype_name(unsigned char type) {
+    switch (type) {
+        default:
+            return "other";
+#ifdef DT_UNKNOWN
+        case DT_REG:
+            return "file";
+        case DT_DIR:
+            return "directory";
+        case DT_LNK:
+            return "link";
+        case DT_FIFO:
+            return "fifo";
+        case DT_SOCK:
+            return "socket";
+        case DT_CHR:
+            return "character";
+        case DT_BLK:
+            return "block";
+#endif
+    }
+}
+#endif
+
+/* Step to the next entry. Returns 0 when the walk is over. */
+static int walker_step(JanetWalker *w) {
+    if (w->done) return 0;
+    if (w->pending_dir) {
+        w->pending_dir = 0;
+        const char *name = w->path + w->frames[w->depth - 1].path_len;
+        while (*name == '/') name++;
+        walker_enter(w, w->frames + w->depth - 1, name);
+    }
+    while (w->depth > 0) {
+        JanetWalkFrame *frame = w->frames + w->depth - 1;
+        w->path_len = frame->path_len;
+        w->path[w->path_len] = '\0';
+        const char *name;
+        int is_dir = 0;
+        const char *type_name = NULL;
+#ifdef JANET_WINDOWS
+        if (!frame->has_data && _findnext(frame->handle, &frame->data) == -1) {
+            _findclose(frame->handle);
+            w->depth--;
+            continue;
+        }
+        frame->has_data = 0;
+        name = frame->data.name;
+        if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+        is_dir = (frame->data.attrib & _A_SUBDIR) != 0;
+        type_name = is_dir ? "directory" : "file";
+        walker_path_push(w, name);
+#else
+        struct dirent *dp = readdir(frame->dir);
+        if (NULL == dp) {
+            closedir(frame->dir);
+            w->depth--;
+            continue;
+        }
+        name = dp->d_name;
+        if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+        walker_path_push(w, name);
+        struct stat st;
+        int have_stat = 0;
+#ifdef DT_UNKNOWN
+        unsigned char dtype = dp->d_type;
+#else
+        unsigned char dtype = 0;
+#endif
+        /* Only stat when asked to, or when the file system does not fill in d_type */
+        if ((w->flags & JANET_WALK_STAT) || dtype == 0) {
+            have_stat = !fstatat(dirfd(frame->dir), name, &st, AT_SYMLINK_NOFOLLOW);
+        }
+        if (have_stat) {
+            type_name = (const char *) janet_decode_mode(st.st_mode);
+            is_dir = S_ISDIR(st.st_mode);
+            if (S_ISLNK(st.st_mode) && (w->flags & JANET_WALK_FOLLOW)) {
+                struct stat target;
+                is_dir = !fstatat(dirfd(frame->dir), name, &target, 0) && S_ISDIR(target.st_mode);
+            }
+        } else {
+            type_name = walker_dtype_name(dtype);
+#ifdef DT_UNKNOWN
+            is_dir = dtype == DT_DIR;
+            if (dtype == DT_LNK && (w->flags & JANET_WALK_FOLLOW)) {
+                struct stat target;
+                is_dir = !fstatat(dirfd(frame->dir), name, &target, 0) && S_ISDIR(target.st_mode);
+            }
+#endif
+        }
+#endif
+        if (is_dir && (w->max_depth < 0 || w->depth < w->max_depth)) w->pending_dir = 1;
+        Janet path = janet_stringv((const uint8_t *) w->path, (int32_t) w->path_len);
+        if (w->flags & JANET_WALK_STAT) {
+            JanetTable *tab = janet_table(16);
+#ifdef JANET_WINDOWS
+            jstat_t st;
+            int have_stat = !_stat(w->path, &st);
+#endif
+            if (have_stat) {
+                for (const struct OsStatGetter *sg = os_stat_getters; sg->name != NULL; sg++) {
+                    janet_table_put(tab, janet_ckeywordv(sg->name), sg->fn(&st));
+                }
+            }
+            Janet tup[2] = {path, janet_wrap_table(tab)};
+            w->current = janet_wrap_tuple(janet_tuple_n(tup, 2));
+        } else if (w->flags & JANET_WALK_TYPES) {
+            Janet tup[2] = {path, janet_ckeywordv(type_name)};
+            w->current = janet_wrap_tuple(janet_tuple_n(tup, 2));
+        } else {
+            w->current = path;
+        }
+        w->index++;
+        return 1;
+    }
+    w->done = 1;
+    w->current = janet_wrap_nil();
+    return 0;
+}
+
+static Janet walker_method_skip(int32_t argc, Janet *argv);
+static Janet walker_method_close(int32_t argc, Janet *argv);
+
+static const JanetMethod walker_methods[] = {
+    {"close", walker_method_close},
+    {"skip", walker_method_skip},
+    {NULL, NULL}
+};
+
+static int walker_get(void *p, Janet key, Janet *out) {
+    JanetWalker *w = (JanetWalker *) p;
+    if (janet_checktype(key, JANET_KEYWORD)) {
+        return janet_getmethod(janet_unwrap_keyword(key), walker_methods, out);
+    }
+    if (!janet_checkint(key) || janet_unwrap_integer(key) != w->index || w->done) return 0;
+    *out = w->current;
+    return 1;
+}
+
+static Janet walker_next(void *p, Janet key) {
+    (void) key;
+    JanetWalker *w = (JanetWalker *) p;
+    if (!walker_step(w)) return janet_wrap_nil();
+    return janet_wrap_integer(w->index);
+}
+
+static const JanetAbstractType janet_walker_type = {
+    "core/dir-walker",
+    walker_gc,
+    walker_mark,
+    walker_get,
+    NULL, /* put */
+    NULL, /* marshal */
+    NULL, /* unmarshal */
+    NULL, /* tostring */
+    NULL, /* compare */
+    NULL, /* hash */
+    walker_next,
+    JANET_ATEND_NEXT
+};
+
+static Janet walker_method_skip(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetWalker *w = janet_getabstract(argv, 0, &janet_walker_type);
+    w->pending_dir = 0;
+    return argv[0];
+}
+
+static Janet walker_method_close(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetWalker *w = janet_getabstract(argv, 0, &janet_walker_type);
+    walker_close(w);
+    return janet_wrap_nil();
+}
+
+JANET_CORE_FN(os_walk,
+              "(os/walk dir &opt flags max-depth)",
+              "Walk the tree of files and directories under `dir`, depth first. Returns an iterator that "
+              "produces entries lazily, for use with `each`, `loop` and `next`, so even very large trees are "
+              "never held in memory at once. Each entry is the path of a file or directory, starting with "
+              "`dir`. `flags` is a keyword of the following characters:\n\n"
+              "* :t - produce `[path type]` tuples, where type is a keyword as in the :mode of os/stat. "
+              "The type usually comes from the directory listing, without a call to stat\n\n"
+              "* :s - produce `[path stat]` tuples, where stat is a table as returned by os/lstat\n\n"
+              "* :L - follow symbolic links to directories. Links that lead back to a directory being "
+              "walked are not followed again\n\n"
+              "Directories below `max-depth` levels are not entered. Call the :skip method right after "
+              "getting a directory to not enter it, and :close to stop early. Directories that can not "
+              "be opened are skipped.") {
+    janet_arity(argc, 1, 3);
+    const char *dir = janet_getcstring(argv, 0);
+    int flags = 0;
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
+        const uint8_t *kw = janet_getkeyword(argv, 1);
+        for (const uint8_t *c = kw; *c; c++) {
+            switch (*c) {
+                case 't':
+                    flags |= JANET_WALK_TYPES;
+                    break;
+                case 's':
+                    flags |= JANET_WALK_STAT;
+                    break;
+                case 'L':
+                    flags |= JANET_WALK_FOLLOW;
+                    break;
+                default:
+                    janet_panicf("invalid flag %c, expected t, s or L", *c);
+            }
+        }
+    }
+    int32_t max_depth = -1;
+    if (argc > 2 && !janet_checktype(argv[2], JANET_NIL)) max_depth = janet_getnat(argv, 2);
+    JanetWalker *w = janet_abstract(&janet_walker_type, sizeof(JanetWalker));
+    memset(w, 0, sizeof(JanetWalker));
+    w->flags = flags;
+    w->max_depth = max_depth;
+    w->current = janet_wrap_nil();
+    walker_path_push(w, dir);
+    if (max_depth == 0) {
+        w->done = 1;
+    } else if (!walker_enter(w, NULL, NULL)) {
+        janet_panicf("cannot open directory %s", dir);
+    }
+    return janet_wrap_abstract(w);
+}
+
 JANET_CORE_FN(os_rename,
               "(os/rename oldname newname)",
               "Rename a file on disk to a new path. Returns nil.") {
@@ -2115,15 +2632,9 @@ JANET_CORE_FN(os_open,
             default:
                 break;
             case 'r':
-                open_flags = (open_flags & O_WRONLY)
-                             ? ((open_flags & ~O_WRONLY) | O_RDWR)
-                             : (open_flags | O_RDONLY);
                 stream_flags |= JANET_STREAM_READABLE;
                 break;
             case 'w':
-                open_flags = (open_flags & O_RDONLY)
-                             ? ((open_flags & ~O_RDONLY) | O_RDWR)
-                             : (open_flags | O_WRONLY);
                 stream_flags |= JANET_STREAM_WRITABLE;
                 break;
             case 'c':
@@ -2147,10 +2658,21 @@ JANET_CORE_FN(os_open,
                 break;
         }
     }
+    /* O_RDONLY is 0 on most systems, so it can't be tested for in open_flags */
+    if ((stream_flags & JANET_STREAM_READABLE) && (stream_flags & JANET_STREAM_WRITABLE)) {
+        open_flags |= O_RDWR;
+    } else if (stream_flags & JANET_STREAM_WRITABLE) {
+        open_flags |= O_WRONLY;
+    } else {
+        open_flags |= O_RDONLY;
+    }
     do {
         fd = open(path, open_flags, mode);
     } while (fd == -1 && errno == EINTR);
     if (fd == -1) janet_panicv(janet_ev_lasterr());
+    /* Regular files never block in the poller, so their IO goes to the worker pool */
+    struct stat st;
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode)) stream_flags |= JANET_STREAM_FILE;
 #endif
     return janet_wrap_abstract(janet_stream(fd, stream_flags, NULL));
 }
@@ -2201,6 +2723,7 @@ void janet_lib_os(JanetTable *env) {
         JANET_CORE_REG("os/environ", os_environ),
         JANET_CORE_REG("os/getenv", os_getenv),
         JANET_CORE_REG("os/dir", os_dir),
+        JANET_CORE_REG("os/walk", os_walk),
         JANET_CORE_REG("os/stat", os_stat),
         JANET_CORE_REG("os/lstat", os_lstat),
         JANET_CORE_REG("os/chmod", os_chmod),
@@ -2230,6 +2753,8 @@ void janet_lib_os(JanetTable *env) {
         JANET_CORE_REG("os/mktime", os_mktime),
         JANET_CORE_REG("os/clock", os_clock),
         JANET_CORE_REG("os/sleep", os_sleep),
+        JANET_CORE_REG("os/cpu-count", os_cpu_count),
+        JANET_CORE_REG("os/setaffinity", os_setaffinity),
         JANET_CORE_REG("os/cwd", os_cwd),
         JANET_CORE_REG("os/cryptorand", os_cryptorand),
         JANET_CORE_REG("os/date", os_date),
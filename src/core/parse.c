@@ -138,6 +138,22 @@ DEF_PARSER_STACK(push_buf, uint8_t, buf, bufcount, bufcap)
 DEF_PARSER_STACK(push_arg, Janet, args, argcount, argcap)
 DEF_PARSER_STACK(_pushstate, JanetParseState, states, statecount, statecap)
 
+/* Push a run of bytes to the buffer at once */
+static void push_bytes(JanetParser *p, const uint8_t *bytes, size_t n) {
+    size_t newcount = p->bufcount + n;
+    if (newcount > p->bufcap) {
+        size_t newcap = 2 * newcount;
+        uint8_t *next = janet_realloc(p->buf, newcap);
+        if (NULL == next) {
+            JANET_OUT_OF_MEMORY;
+        }
+        p->buf = next;
+        p->bufcap = newcap;
+    }
+    memcpy(p->buf + p->bufcount, bytes, n);
+    p->bufcount = newcount;
+}
+
 #undef DEF_PARSER_STACK
 
 #define PFLAG_CONTAINER 0x100
@@ -656,11 +672,8 @@ static void janet_parser_checkdead(JanetParser *parser) {
     if (parser->error) janet_panic("parser has unchecked error, cannot consume");
 }
 
-/* Public API */
-
-void janet_parser_consume(JanetParser *parser, uint8_t c) {
-    int consumed = 0;
-    janet_parser_checkdead(parser);
+/* Update the source position for one byte */
+static void parser_advance(JanetParser *parser, uint8_t c) {
     if (c == '\r') {
         parser->line++;
         parser->column = 0;
@@ -671,11 +684,73 @@ void janet_parser_consume(JanetParser *parser, uint8_t c) {
     } else {
         parser->column++;
     }
+    parser->lookback = c;
+}
+
+/* Find the longest run of bytes at the start of bytes that the current state would
+ * consume without changing state, and consume it directly. Runs are whitespace
+ * between forms, symbol characters in tokens, and the insides of strings and comments.
+ * Returns the number of bytes consumed. */
+static size_t parser_consume_run(JanetParser *parser, const uint8_t *bytes, size_t len) {
+    JanetParseState *state = parser->states + parser->statecount - 1;
+    Consumer consumer = state->consumer;
+    size_t n = 0;
+    if (consumer == root) {
+        while (n < len && is_whitespace(bytes[n])) parser_advance(parser, bytes[n++]);
+        return n;
+    } else if (consumer == tokenchar) {
+        int nonascii = 0;
+        while (n < len && janet_is_symbol_char(bytes[n])) nonascii |= bytes[n++] & 0x80;
+        if (!n) return 0;
+        if (nonascii) state->argn = 1;
+        push_bytes(parser, bytes, n);
+    } else if (consumer == stringchar) {
+        while (n < len) {
+            uint8_t c = bytes[n];
+            if (c == '\\' || c == '"' || c == '\n' || c == '\r') break;
+            n++;
+        }
+        if (!n) return 0;
+        push_bytes(parser, bytes, n);
+    } else if (consumer == comment || (consumer == longstring && (state->flags & PFLAG_INSTRING))) {
+        const uint8_t *end = memchr(bytes, consumer == comment ? '\n' : '`', len);
+        n = end ? (size_t)(end - bytes) : len;
+        if (!n) return 0;
+        push_bytes(parser, bytes, n);
+        for (size_t i = 0; i < n; i++) parser_advance(parser, bytes[i]);
+        return n;
+    } else {
+        return 0;
+    }
+    /* Token and string runs contain no line breaks */
+    parser->column += n;
+    parser->lookback = bytes[n - 1];
+    return n;
+}
+
+/* Public API */
+
+void janet_parser_consume(JanetParser *parser, uint8_t c) {
+    int consumed = 0;
+    janet_parser_checkdead(parser);
+    parser_advance(parser, c);
     while (!consumed && !parser->error) {
         JanetParseState *state = parser->states + parser->statecount - 1;
         consumed = state->consumer(parser, state, c);
     }
-    parser->lookback = c;
+}
+
+size_t janet_parser_consume_bytes(JanetParser *parser, const uint8_t *bytes, size_t len) {
+    size_t i = 0;
+    if (!len) return 0;
+    janet_parser_checkdead(parser);
+    while (i < len) {
+        i += parser_consume_run(parser, bytes + i, len - i);
+        if (i == len) break;
+        janet_parser_consume(parser, bytes[i++]);
+        if (parser->error) break;
+    }
+    return i;
 }
 
 void janet_parser_eof(JanetParser *parser) {
@@ -906,18 +981,8 @@ JANET_CORE_FN(cfun_parse_consume,
         view.len -= offset;
         view.bytes += offset;
     }
-    int32_t i;
-    for (i = 0; i < view.len; i++) {
-        janet_parser_consume(p, view.bytes[i]);
-        switch (janet_parser_status(p)) {
-            case JANET_PARSE_ROOT:
-            case JANET_PARSE_PENDING:
-                break;
-            default:
-                return janet_wrap_integer(i + 1);
-        }
-    }
-    return janet_wrap_integer(i);
+    size_t n = janet_parser_consume_bytes(p, view.bytes, (size_t) view.len);
+    return janet_wrap_integer((int32_t) n);
 }
 
 JANET_CORE_FN(cfun_parse_eof,
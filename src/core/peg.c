@@ -51,6 +51,9 @@ typedef struct {
     int32_t depth;
     int32_t linemaplen;
     int32_t has_backref;
+    int32_t hit_end; /* Set when the result could change if the text were longer */
+    struct PegMemo *memo;
+    struct PegProfileEntry *profile;
     enum {
         PEG_MODE_NORMAL,
         PEG_MODE_ACCUMULATE
@@ -161,6 +164,179 @@ static int64_t peg_convert_u64_s64(uint64_t from, int width) {
     return ((int64_t)(from << shift)) >> shift;
 }
 
+/* Packrat memoization. The result of a (memo patt) rule is cached by rule,
+ * position and capture mode along with the captures it pushed, so each
+ * memoized rule runs at most once per position. Tagged captures are only
+ * kept for backreferences, which can make a rule's result depend on what
+ * matched before it, so pegs with backreferences are never memoized. */
+
+/* Default memory limit of the memo table, changed with (dyn :peg-memo-limit) */
+#define JANET_PEG_MEMO_LIMIT (16 * 1024 * 1024)
+
+typedef struct {
+    uint32_t rule;
+    int32_t position;
+    int32_t mode;
+    int32_t hit_end;
+    int32_t end; /* -1 on failure */
+    int32_t cap;
+    int32_t ncap;
+    int32_t scratch;
+    int32_t nscratch;
+} PegMemoEntry;
+
+typedef struct PegMemo {
+    PegMemoEntry *entries;
+    int32_t count;
+    int32_t capacity;
+    int32_t *slots; /* Open addressing table of entry indices, -1 if empty */
+    int32_t nslots;
+    size_t size;
+    size_t limit;
+    JanetArray *captures;
+    JanetBuffer *scratch;
+} PegMemo;
+
+static uint32_t peg_memo_hash(uint32_t rule, int32_t position, int32_t mode) {
+    uint32_t h = rule * 0x9E3779B1u ^ ((uint32_t) position * 0x85EBCA77u) ^ (uint32_t) mode;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    return h;
+}
+
+static PegMemo *peg_memo_init(PegState *s) {
+    PegMemo *m = janet_smalloc(sizeof(PegMemo));
+    m->count = 0;
+    m->capacity = 64;
+    m->entries = janet_smalloc(m->capacity * sizeof(PegMemoEntry));
+    m->nslots = 128;
+    m->slots = janet_smalloc(m->nslots * sizeof(int32_t));
+    for (int32_t i = 0; i < m->nslots; i++) m->slots[i] = -1;
+    m->size = 0;
+    m->limit = JANET_PEG_MEMO_LIMIT;
+    Janet limit = janet_dyn("peg-memo-limit");
+    if (janet_checkint(limit) && janet_unwrap_integer(limit) >= 0) {
+        m->limit = (size_t) janet_unwrap_integer(limit);
+    }
+    m->captures = janet_array(0);
+    m->scratch = janet_buffer(0);
+    s->memo = m;
+    return m;
+}
+
+static void peg_memo_deinit(PegState *s) {
+    PegMemo *m = s->memo;
+    if (NULL == m) return;
+    janet_sfree(m->entries);
+    janet_sfree(m->slots);
+    janet_sfree(m);
+    s->memo = NULL;
+}
+
+static PegMemoEntry *peg_memo_get(PegMemo *m, uint32_t rule, int32_t position, int32_t mode) {
+    uint32_t mask = (uint32_t) m->nslots - 1;
+    for (uint32_t i = peg_memo_hash(rule, position, mode) & mask;; i = (i + 1) & mask) {
+        int32_t index = m->slots[i];
+        if (index < 0) return NULL;
+        PegMemoEntry *e = m->entries + index;
+        if (e->rule == rule && e->position == position && e->mode == mode) return e;
+    }
+}
+
+static void peg_memo_insert_slot(PegMemo *m, int32_t index) {
+    PegMemoEntry *e = m->entries + index;
+    uint32_t mask = (uint32_t) m->nslots - 1;
+    uint32_t i = peg_memo_hash(e->rule, e->position, e->mode) & mask;
+    while (m->slots[i] >= 0) i = (i + 1) & mask;
+    m->slots[i] = index;
+}
+
+/* Record the result of a memoized rule, and the captures it pushed since cs.
+ * Once the memory limit is reached, nothing more is recorded. */
+static void peg_memo_put(PegState *s, uint32_t rule, int32_t position, CapState cs,
+                         const uint8_t *result, int hit_end) {
+    PegMemo *m = s->memo;
+    int32_t ncap = result ? s->captures->count - cs.cap : 0;
+    int32_t nscratch = result ? s->scratch->count - cs.scratch : 0;
+    size_t cost = sizeof(PegMemoEntry) + 2 * sizeof(int32_t) + ncap * sizeof(Janet) + nscratch;
+    if (m->size + cost > m->limit) return;
+    m->size += cost;
+    if (m->count == m->capacity) {
+        m->capacity *= 2;
+        m->entries = janet_srealloc(m->entries, m->capacity * sizeof(PegMemoEntry));
+    }
+    PegMemoEntry *e = m->entries + m->count;
+    e->rule = rule;
+    e->position = position;
+    e->mode = s->mode;
+    e->hit_end = hit_end;
+    e->end = result ? (int32_t)(result - s->text_start) : -1;
+    e->cap = m->captures->count;
+    e->ncap = ncap;
+    e->scratch = m->scratch->count;
+    e->nscratch = nscratch;
+    for (int32_t i = 0; i < ncap; i++) {
+        janet_array_push(m->captures, s->captures->data[cs.cap + i]);
+    }
+    janet_buffer_push_bytes(m->scratch, s->scratch->data + cs.scratch, nscratch);
+    m->count++;
+    if (2 * m->count > m->nslots) {
+        janet_sfree(m->slots);
+        m->nslots *= 2;
+        m->slots = janet_smalloc(m->nslots * sizeof(int32_t));
+        for (int32_t i = 0; i < m->nslots; i++) m->slots[i] = -1;
+        for (int32_t i = 0; i < m->count; i++) peg_memo_insert_slot(m, i);
+    } else {
+        peg_memo_insert_slot(m, m->count - 1);
+    }
+}
+
+/* Replay a memoized result */
+static const uint8_t *peg_memo_replay(PegState *s, PegMemoEntry *e) {
+    PegMemo *m = s->memo;
+    if (e->hit_end) s->hit_end = 1;
+    if (e->end < 0) return NULL;
+    for (int32_t i = 0; i < e->ncap; i++) {
+        janet_array_push(s->captures, m->captures->data[e->cap + i]);
+    }
+    janet_buffer_push_bytes(s->scratch, m->scratch->data + e->scratch, e->nscratch);
+    return s->text_start + e->end;
+}
+
+/* Profiling. Named rules are wrapped in profile rules when compiling with
+ * (dyn :peg-profile) or through peg/profile, and counters are kept per name
+ * for the duration of one match. Time is inclusive of the rules called, but
+ * recursive entries into a rule are not counted twice. */
+
+typedef struct PegProfileEntry {
+    int64_t entries;
+    int64_t successes;
+    int64_t failures;
+    int64_t bytes;
+    int32_t active;
+    double time;
+} PegProfileEntry;
+
+static double peg_profile_now(void) {
+    struct timespec spec;
+    janet_gettime(&spec);
+    return (double) spec.tv_sec + (double) spec.tv_nsec * 1e-9;
+}
+
+#ifdef __GNUC__
+#define peg_ctz(x) ((uint32_t) __builtin_ctz(x))
+#else
+static uint32_t peg_ctz(uint32_t x) {
+    uint32_t bit = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        bit++;
+    }
+    return bit;
+}
+#endif
+
 /* Prevent stack overflow */
 #define down1(s) do { \
     if (0 == --((s)->depth)) janet_panic("peg/match recursed too deeply"); \
@@ -179,47 +355,61 @@ static const uint8_t *peg_rule(
     const uint32_t *rule,
     const uint8_t *text) {
 tail:
-    switch (*rule & 0x1F) {
+    switch (*rule & 0x3F) {
         default:
             janet_panic("unexpected opcode");
             return NULL;
 
         case RULE_LITERAL: {
             uint32_t len = rule[1];
-            if (text + len > s->text_end) return NULL;
+            if (text + len > s->text_end) {
+                if (!memcmp(text, rule + 2, s->text_end - text)) s->hit_end = 1;
+                return NULL;
+            }
             return memcmp(text, rule + 2, len) ? NULL : text + len;
         }
 
         case RULE_NCHAR: {
             uint32_t n = rule[1];
-            return (text + n > s->text_end) ? NULL : text + n;
+            if (text + n > s->text_end) {
+                s->hit_end = 1;
+                return NULL;
+            }
+            return text + n;
         }
 
         case RULE_NOTNCHAR: {
             uint32_t n = rule[1];
-            return (text + n > s->text_end) ? text : NULL;
+            if (text + n > s->text_end) {
+                s->hit_end = 1;
+                return text;
+            }
+            return NULL;
         }
 
         case RULE_RANGE: {
             uint8_t lo = rule[1] & 0xFF;
             uint8_t hi = (rule[1] >> 16) & 0xFF;
-            return (text < s->text_end &&
-                    text[0] >= lo &&
-                    text[0] <= hi)
-                   ? text + 1
-                   : NULL;
+            if (text >= s->text_end) {
+                s->hit_end = 1;
+                return NULL;
+            }
+            return (text[0] >= lo && text[0] <= hi) ? text + 1 : NULL;
         }
 
         case RULE_SET: {
+            if (text >= s->text_end) {
+                s->hit_end = 1;
+                return NULL;
+            }
             uint32_t word = rule[1 + (text[0] >> 5)];
             uint32_t mask = (uint32_t)1 << (text[0] & 0x1F);
-            return (text < s->text_end && (word & mask))
-                   ? text + 1
-                   : NULL;
+            return (word & mask) ? text + 1 : NULL;
         }
 
         case RULE_LOOK: {
             text += ((int32_t *)rule)[1];
+            if (text > s->text_end) s->hit_end = 1;
             if (text < s->text_start || text > s->text_end) return NULL;
             down1(s);
             const uint8_t *result = peg_rule(s, s->bytecode + rule[2], text);
@@ -247,6 +437,36 @@ tail:
             goto tail;
         }
 
+        case RULE_DISPATCH: {
+            /* Choice that only tries the alternatives that can start with
+             * the next byte */
+            uint32_t len = rule[1];
+            uint32_t words = rule[2];
+            const uint32_t *args = rule + 3;
+            if (text >= s->text_end) s->hit_end = 1;
+            const uint32_t *row = args + len + words * (text < s->text_end ? text[0] : 256);
+            uint32_t pending = UINT32_MAX;
+            down1(s);
+            CapState cs = cap_save(s);
+            for (uint32_t w = 0; w < words; w++) {
+                for (uint32_t m = row[w]; m; m &= m - 1) {
+                    if (pending != UINT32_MAX) {
+                        const uint8_t *result = peg_rule(s, s->bytecode + args[pending], text);
+                        if (result) {
+                            up1(s);
+                            return result;
+                        }
+                        cap_load(s, cs);
+                    }
+                    pending = w * 32 + peg_ctz(m);
+                }
+            }
+            up1(s);
+            if (pending == UINT32_MAX) return NULL;
+            rule = s->bytecode + args[pending];
+            goto tail;
+        }
+
         case RULE_SEQUENCE: {
             uint32_t len = rule[1];
             const uint32_t *args = rule + 2;
@@ -329,6 +549,63 @@ tail:
             return text;
         }
 
+        case RULE_SPAN: {
+            /* Repetition of a character set */
+            uint32_t lo = rule[1];
+            uint32_t hi = rule[2];
+            const uint32_t *bitmap = rule + 3;
+            const uint8_t *end = s->text_end;
+            if ((size_t)(end - text) > hi) end = text + hi;
+            const uint8_t *p = text;
+            while (p < end && (bitmap[*p >> 5] & ((uint32_t)1 << (*p & 0x1F)))) p++;
+            if (p == s->text_end) s->hit_end = 1;
+            return ((uint32_t)(p - text) < lo) ? NULL : p;
+        }
+
+        case RULE_MEMO: {
+            const uint32_t *rule_a = s->bytecode + rule[1];
+            if (s->has_backref) {
+                rule = rule_a;
+                goto tail;
+            }
+            PegMemo *m = s->memo ? s->memo : peg_memo_init(s);
+            uint32_t index = (uint32_t)(rule - s->bytecode);
+            int32_t position = (int32_t)(text - s->text_start);
+            PegMemoEntry *e = peg_memo_get(m, index, position, s->mode);
+            if (e) return peg_memo_replay(s, e);
+            CapState cs = cap_save(s);
+            int32_t old_hit_end = s->hit_end;
+            s->hit_end = 0;
+            down1(s);
+            const uint8_t *result = peg_rule(s, rule_a, text);
+            up1(s);
+            peg_memo_put(s, index, position, cs, result, s->hit_end);
+            s->hit_end |= old_hit_end;
+            return result;
+        }
+
+        case RULE_PROFILE: {
+            const uint32_t *rule_a = s->bytecode + rule[1];
+            if (NULL == s->profile) {
+                rule = rule_a;
+                goto tail;
+            }
+            PegProfileEntry *p = s->profile + rule[2];
+            p->entries++;
+            double start = p->active++ ? 0.0 : peg_profile_now();
+            down1(s);
+            const uint8_t *result = peg_rule(s, rule_a, text);
+            up1(s);
+            if (!--p->active) p->time += peg_profile_now() - start;
+            if (result) {
+                p->successes++;
+                p->bytes += result - text;
+            } else {
+                p->failures++;
+            }
+            return result;
+        }
+
         /* Capturing rules */
 
         case RULE_GETTAG: {
@@ -534,8 +811,10 @@ tail:
                         return NULL;
                     const uint8_t *bytes = janet_unwrap_string(capture);
                     int32_t len = janet_string_length(bytes);
-                    if (text + len > s->text_end)
+                    if (text + len > s->text_end) {
+                        if (!memcmp(text, bytes, s->text_end - text)) s->hit_end = 1;
                         return NULL;
+                    }
                     return memcmp(text, bytes, len) ? NULL : text + len;
                 }
             }
@@ -579,7 +858,10 @@ tail:
             uint32_t signedness = rule[1] & 0x10;
             uint32_t endianess = rule[1] & 0x20;
             int width = (int)(rule[1] & 0xF);
-            if (text + width > s->text_end) return NULL;
+            if (text + width > s->text_end) {
+                s->hit_end = 1;
+                return NULL;
+            }
             uint64_t accum = 0;
             if (endianess) {
                 /* BE */
@@ -656,6 +938,10 @@ typedef struct {
     int depth;
     uint32_t nexttag;
     int has_backref;
+    int memoize; /* Memoize every named rule */
+    JanetTable *memos;
+    int profile; /* Count entries into every named rule */
+    JanetTable *profiles;
 } Builder;
 
 /* Forward declaration to allow recursion */
@@ -953,6 +1239,9 @@ static void spec_onerule(Builder *b, int32_t argc, const Janet *argv, uint32_t o
 static void spec_not(Builder *b, int32_t argc, const Janet *argv) {
     spec_onerule(b, argc, argv, RULE_NOT);
 }
+static void spec_memo(Builder *b, int32_t argc, const Janet *argv) {
+    spec_onerule(b, argc, argv, RULE_MEMO);
+}
 static void spec_error(Builder *b, int32_t argc, const Janet *argv) {
     if (argc == 0) {
         Reserve r = reserve(b, 2);
@@ -1155,6 +1444,7 @@ static const SpecialPair peg_specials[] = {
     {"lenprefix", spec_lenprefix},
     {"line", spec_line},
     {"look", spec_look},
+    {"memo", spec_memo},
     {"not", spec_not},
     {"number", spec_capture_number},
     {"opt", spec_opt},
@@ -1173,9 +1463,64 @@ static const SpecialPair peg_specials[] = {
     {"unref", spec_unref},
 };
 
+/* Wrap a rule in a memo rule, once per rule */
+static uint32_t peg_memo_wrap(Builder *b, uint32_t rule) {
+    Janet check = janet_table_get(b->memos, janet_wrap_number(rule));
+    if (!janet_checktype(check, JANET_NIL)) return (uint32_t) janet_unwrap_number(check);
+    Reserve r = reserve(b, 2);
+    emit_1(r, RULE_MEMO, rule);
+    janet_table_put(b->memos, janet_wrap_number(rule), janet_wrap_number(r.index));
+    return r.index;
+}
+
+/* Each profiled name gets one constant, which indexes the counters at match time */
+static uint32_t peg_profile_name(Builder *b, Janet name) {
+    Janet cindex = janet_table_get(b->profiles, name);
+    if (janet_checktype(cindex, JANET_NIL)) {
+        cindex = janet_wrap_number(emit_constant(b, name));
+        janet_table_put(b->profiles, name, cindex);
+    }
+    return (uint32_t) janet_unwrap_number(cindex);
+}
+
+/* Wrap a rule in a profile rule for name, once per rule and name */
+static uint32_t peg_profile_wrap(Builder *b, uint32_t rule, Janet name) {
+    Janet key = janet_wrap_tuple(janet_tuple_n((Janet[]) {
+        name, janet_wrap_number(rule)
+    }, 2));
+    Janet check = janet_table_get(b->profiles, key);
+    if (!janet_checktype(check, JANET_NIL)) return (uint32_t) janet_unwrap_number(check);
+    Reserve r = reserve(b, 3);
+    emit_2(r, RULE_PROFILE, rule, peg_profile_name(b, name));
+    janet_table_put(b->profiles, key, janet_wrap_number(r.index));
+    return r.index;
+}
+
+/* Compile the main rule of a grammar. When profiling, the profile rule is
+ * reserved first so that it is the entry point of a top level grammar. */
+static uint32_t peg_compile_main(Builder *b, Janet main_rule) {
+    if (!b->profile) return peg_compile1(b, main_rule);
+    Reserve r = reserve(b, 3);
+    uint32_t rule = peg_compile1(b, main_rule);
+    emit_2(r, RULE_PROFILE, rule, peg_profile_name(b, janet_ckeywordv("main")));
+    return r.index;
+}
+
+/* Wrap a named rule for memoization and profiling as requested */
+static uint32_t peg_named(Builder *b, uint32_t rule, Janet name) {
+    if (b->memoize) rule = peg_memo_wrap(b, rule);
+    if (b->profile) rule = peg_profile_wrap(b, rule, name);
+    return rule;
+}
+
 /* Compile a janet value into a rule and return the rule index. */
 static uint32_t peg_compile1(Builder *b, Janet peg) {
 
+    /* Named rules are memoized when compiling with (dyn :peg-memoize),
+     * and profiled when compiling with (dyn :peg-profile) */
+    Janet name = peg;
+    int named = janet_checktype(peg, JANET_KEYWORD);
+
     /* Keep track of the form being compiled for error purposes */
     Janet old_form = b->form;
     JanetTable *old_grammar = b->grammar;
@@ -1210,7 +1555,8 @@ static uint32_t peg_compile1(Builder *b, Janet peg) {
     if (!janet_checktype(check, JANET_NIL)) {
         b->form = old_form;
         b->grammar = old_grammar;
-        return (uint32_t) janet_unwrap_number(check);
+        uint32_t rule = (uint32_t) janet_unwrap_number(check);
+        return named ? peg_named(b, rule, name) : rule;
     }
 
     /* Check depth */
@@ -1262,7 +1608,7 @@ static uint32_t peg_compile1(Builder *b, Janet peg) {
             Janet main_rule = janet_table_rawget(grammar, janet_ckeywordv("main"));
             if (janet_checktype(main_rule, JANET_NIL))
                 peg_panic(b, "grammar requires :main rule");
-            rule = peg_compile1(b, main_rule);
+            rule = peg_compile_main(b, main_rule);
             break;
         }
         case JANET_STRUCT: {
@@ -1280,7 +1626,7 @@ static uint32_t peg_compile1(Builder *b, Janet peg) {
             Janet main_rule = janet_table_rawget(grammar, janet_ckeywordv("main"));
             if (janet_checktype(main_rule, JANET_NIL))
                 peg_panic(b, "grammar requires :main rule");
-            rule = peg_compile1(b, main_rule);
+            rule = peg_compile_main(b, main_rule);
             break;
         }
         case JANET_TUPLE: {
@@ -1316,7 +1662,362 @@ static uint32_t peg_compile1(Builder *b, Janet peg) {
     b->depth++;
     b->form = old_form;
     b->grammar = old_grammar;
-    return rule;
+    return named ? peg_named(b, rule, name) : rule;
+}
+
+/*
+ * Optimization
+ */
+
+/* Choices with at least this many alternatives dispatch on the next byte */
+#define JANET_PEG_DISPATCH_MIN 3
+#define JANET_PEG_DISPATCH_MAX 256
+
+/* How deeply to follow rules when computing first sets */
+#define JANET_PEG_FIRST_DEPTH 16
+
+/* Number of words in a rule */
+static uint32_t peg_rule_size(const uint32_t *rule) {
+    switch (rule[0]) {
+        default:
+            janet_panic("unexpected opcode");
+        case RULE_NCHAR:
+        case RULE_NOTNCHAR:
+        case RULE_RANGE:
+        case RULE_POSITION:
+        case RULE_LINE:
+        case RULE_COLUMN:
+        case RULE_BACKMATCH:
+        case RULE_ERROR:
+        case RULE_DROP:
+        case RULE_NOT:
+        case RULE_TO:
+        case RULE_THRU:
+        case RULE_MEMO:
+            return 2;
+        case RULE_LOOK:
+        case RULE_IF:
+        case RULE_IFNOT:
+        case RULE_LENPREFIX:
+        case RULE_ARGUMENT:
+        case RULE_GETTAG:
+        case RULE_CONSTANT:
+        case RULE_PROFILE:
+        case RULE_ACCUMULATE:
+        case RULE_GROUP:
+        case RULE_CAPTURE:
+        case RULE_UNREF:
+        case RULE_READINT:
+            return 3;
+        case RULE_BETWEEN:
+        case RULE_CAPTURE_NUM:
+        case RULE_REPLACE:
+        case RULE_MATCHTIME:
+            return 4;
+        case RULE_SET:
+            return 9;
+        case RULE_SPAN:
+            return 11;
+        case RULE_DISPATCH:
+            return 3 + rule[1] + 257 * rule[2];
+        case RULE_LITERAL:
+            return 2 + ((rule[1] + 3) >> 2);
+        case RULE_CHOICE:
+        case RULE_SEQUENCE:
+            return 2 + rule[1];
+    }
+}
+
+/* The operands of a rule that refer to other rules are always consecutive.
+ * Returns how many there are, and sets *first to the offset of the first. */
+static uint32_t peg_rule_refs(const uint32_t *rule, uint32_t *first) {
+    *first = 1;
+    switch (rule[0]) {
+        default:
+            return 0;
+        case RULE_LOOK:
+            *first = 2;
+            return 1;
+        case RULE_BETWEEN:
+            *first = 3;
+            return 1;
+        case RULE_CHOICE:
+        case RULE_SEQUENCE:
+            *first = 2;
+            return rule[1];
+        case RULE_IF:
+        case RULE_IFNOT:
+        case RULE_LENPREFIX:
+            return 2;
+        case RULE_ACCUMULATE:
+        case RULE_GROUP:
+        case RULE_CAPTURE:
+        case RULE_UNREF:
+        case RULE_CAPTURE_NUM:
+        case RULE_REPLACE:
+        case RULE_MATCHTIME:
+        case RULE_ERROR:
+        case RULE_DROP:
+        case RULE_NOT:
+        case RULE_TO:
+        case RULE_THRU:
+        case RULE_MEMO:
+        case RULE_PROFILE:
+            return 1;
+    }
+}
+
+/* Add the bytes matched by a rule that always matches exactly one byte to
+ * bitmap. Returns 0 if the rule is not of that kind. */
+static int peg_charset(const uint32_t *rule, uint32_t *bitmap) {
+    switch (rule[0]) {
+        default:
+            return 0;
+        case RULE_SET:
+            for (int i = 0; i < 8; i++) bitmap[i] |= rule[1 + i];
+            return 1;
+        case RULE_RANGE:
+            for (uint32_t c = rule[1] & 0xFF; c <= ((rule[1] >> 16) & 0xFF); c++)
+                bitmap_set(bitmap, (uint8_t) c);
+            return 1;
+        case RULE_LITERAL:
+            if (rule[1] != 1) return 0;
+            bitmap_set(bitmap, ((const uint8_t *)(rule + 2))[0]);
+            return 1;
+        case RULE_NCHAR:
+            if (rule[1] != 1) return 0;
+            memset(bitmap, 0xFF, 8 * sizeof(uint32_t));
+            return 1;
+    }
+}
+
+/* Add the bytes that can start a match of a rule to bitmap. Returns 0 if
+ * that is not known, which includes any rule that might match without
+ * consuming input, so a rule with a known first set cannot match at the
+ * end of the text. */
+static int peg_first(const uint32_t *bytecode, uint32_t index, uint32_t *bitmap, int depth) {
+    const uint32_t *rule = bytecode + index;
+    if (depth <= 0) return 0;
+    switch (rule[0]) {
+        default:
+            return 0;
+        case RULE_LITERAL:
+            if (rule[1] == 0) return 0;
+            bitmap_set(bitmap, ((const uint8_t *)(rule + 2))[0]);
+            return 1;
+        case RULE_NCHAR:
+            if (rule[1] == 0) return 0;
+            memset(bitmap, 0xFF, 8 * sizeof(uint32_t));
+            return 1;
+        case RULE_RANGE:
+        case RULE_SET:
+            return peg_charset(rule, bitmap);
+        case RULE_CHOICE:
+            for (uint32_t i = 0; i < rule[1]; i++) {
+                if (!peg_first(bytecode, rule[2 + i], bitmap, depth - 1)) return 0;
+            }
+            return 1;
+        case RULE_SEQUENCE:
+            /* Skip over leading rules that never consume input */
+            for (uint32_t i = 0; i < rule[1]; i++) {
+                switch (bytecode[rule[2 + i]]) {
+                    case RULE_POSITION:
+                    case RULE_LINE:
+                    case RULE_COLUMN:
+                    case RULE_ARGUMENT:
+                    case RULE_CONSTANT:
+                    case RULE_GETTAG:
+                        continue;
+                    default:
+                        return peg_first(bytecode, rule[2 + i], bitmap, depth - 1);
+                }
+            }
+            return 0;
+        case RULE_BETWEEN:
+            if (rule[1] == 0) return 0;
+            return peg_first(bytecode, rule[3], bitmap, depth - 1);
+        case RULE_IF:
+        case RULE_IFNOT:
+            return peg_first(bytecode, rule[2], bitmap, depth - 1);
+        case RULE_ACCUMULATE:
+        case RULE_GROUP:
+        case RULE_CAPTURE:
+        case RULE_UNREF:
+        case RULE_CAPTURE_NUM:
+        case RULE_REPLACE:
+        case RULE_MATCHTIME:
+        case RULE_ERROR:
+        case RULE_DROP:
+        case RULE_MEMO:
+        case RULE_PROFILE:
+            return peg_first(bytecode, rule[1], bitmap, depth - 1);
+    }
+}
+
+/* Push a literal made of the literals at the given rule indices */
+static void peg_push_literal(uint32_t **code, const uint32_t *old, const uint32_t *rules, uint32_t count) {
+    uint32_t len = 0;
+    for (uint32_t i = 0; i < count; i++) len += old[rules[i] + 1];
+    uint32_t at = janet_v_count(*code);
+    janet_v_push(*code, RULE_LITERAL);
+    janet_v_push(*code, len);
+    for (uint32_t i = 0; i < ((len + 3) >> 2); i++)
+        janet_v_push(*code, 0);
+    uint8_t *bytes = (uint8_t *)(*code + at + 2);
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t *lit = old + rules[i];
+        memcpy(bytes, lit + 2, lit[1]);
+        bytes += lit[1];
+    }
+}
+
+/* Copy a sequence, replacing each run of literals with a single literal.
+ * Merged literals are appended after the rest of the program, and are
+ * recorded in merges as (operand position, first rule, count). */
+static void peg_push_sequence(uint32_t **code, uint32_t **fixups, uint32_t **merges,
+                              const uint32_t *old, const uint32_t *rule) {
+    uint32_t len = rule[1];
+    const uint32_t *args = rule + 2;
+    uint32_t nlits = 0;
+    for (uint32_t i = 0; i < len; i++) nlits += old[args[i]] == RULE_LITERAL;
+    if (len > 1 && nlits == len) {
+        peg_push_literal(code, old, args, len);
+        return;
+    }
+    uint32_t at = janet_v_count(*code);
+    janet_v_push(*code, RULE_SEQUENCE);
+    janet_v_push(*code, 0);
+    uint32_t newlen = 0;
+    for (uint32_t i = 0; i < len;) {
+        uint32_t j = i;
+        while (j < len && old[args[j]] == RULE_LITERAL) j++;
+        newlen++;
+        if (j - i > 1) {
+            janet_v_push(*merges, janet_v_count(*code));
+            janet_v_push(*merges, (uint32_t)(rule - old) + 2 + i);
+            janet_v_push(*merges, j - i);
+            janet_v_push(*code, 0);
+            i = j;
+        } else {
+            janet_v_push(*fixups, janet_v_count(*code));
+            janet_v_push(*code, args[i]);
+            i++;
+        }
+    }
+    (*code)[at + 1] = newlen;
+}
+
+/* Emit a choice that only tries the alternatives whose first set contains
+ * the next byte. Row c of the table is a bitmask of candidate alternatives
+ * for the byte c, and row 256 is used at the end of the text. Returns 0 if
+ * no alternative has a known first set. */
+static int peg_push_dispatch(uint32_t **code, uint32_t **fixups, const uint32_t *old, const uint32_t *rule) {
+    uint32_t len = rule[1];
+    if (len < JANET_PEG_DISPATCH_MIN || len > JANET_PEG_DISPATCH_MAX) return 0;
+    uint32_t words = (len + 31) >> 5;
+    uint32_t *table = janet_calloc(257 * words, sizeof(uint32_t));
+    if (NULL == table) {
+        JANET_OUT_OF_MEMORY;
+    }
+    int useful = 0;
+    for (uint32_t a = 0; a < len; a++) {
+        uint32_t bitmap[8] = {0};
+        int known = peg_first(old, rule[2 + a], bitmap, JANET_PEG_FIRST_DEPTH);
+        uint32_t w = a >> 5;
+        uint32_t bit = (uint32_t) 1 << (a & 0x1F);
+        for (uint32_t c = 0; c < 256; c++) {
+            if (!known || (bitmap[c >> 5] & ((uint32_t) 1 << (c & 0x1F))))
+                table[c * words + w] |= bit;
+        }
+        if (known) {
+            useful = 1;
+        } else {
+            table[256 * words + w] |= bit;
+        }
+    }
+    if (useful) {
+        janet_v_push(*code, RULE_DISPATCH);
+        janet_v_push(*code, len);
+        janet_v_push(*code, words);
+        for (uint32_t a = 0; a < len; a++) {
+            janet_v_push(*fixups, janet_v_count(*code));
+            janet_v_push(*code, rule[2 + a]);
+        }
+        for (uint32_t i = 0; i < 257 * words; i++)
+            janet_v_push(*code, table[i]);
+    }
+    janet_free(table);
+    return useful;
+}
+
+/* Rewrite the compiled program. Rules keep their order, so the main rule
+ * stays at index 0, but can change size, so rule references are remapped
+ * once everything has been emitted. */
+static void peg_optimize(Builder *b) {
+    uint32_t *old = b->bytecode;
+    uint32_t blen = janet_v_count(old);
+    uint32_t *map = janet_malloc(sizeof(uint32_t) * (blen + 1));
+    if (NULL == map) {
+        JANET_OUT_OF_MEMORY;
+    }
+    uint32_t *code = NULL;
+    uint32_t *fixups = NULL;
+    uint32_t *merges = NULL;
+    for (uint32_t i = 0; i < blen; i += peg_rule_size(old + i)) {
+        const uint32_t *rule = old + i;
+        map[i] = janet_v_count(code);
+        if (rule[0] == RULE_SEQUENCE) {
+            peg_push_sequence(&code, &fixups, &merges, old, rule);
+            continue;
+        }
+        if (rule[0] == RULE_CHOICE && peg_push_dispatch(&code, &fixups, old, rule)) {
+            continue;
+        }
+        if (rule[0] == RULE_MEMO) {
+            /* Memoizing a primitive costs more than matching it */
+            const uint32_t *target = old + rule[1];
+            switch (target[0]) {
+                case RULE_LITERAL:
+                case RULE_NCHAR:
+                case RULE_NOTNCHAR:
+                case RULE_RANGE:
+                case RULE_SET:
+                    for (uint32_t j = 0; j < peg_rule_size(target); j++) janet_v_push(code, target[j]);
+                    continue;
+                default:
+                    break;
+            }
+        }
+        if (rule[0] == RULE_BETWEEN) {
+            uint32_t bitmap[8] = {0};
+            if (peg_charset(old + rule[3], bitmap)) {
+                janet_v_push(code, RULE_SPAN);
+                janet_v_push(code, rule[1]);
+                janet_v_push(code, rule[2]);
+                for (int j = 0; j < 8; j++) janet_v_push(code, bitmap[j]);
+                continue;
+            }
+        }
+        uint32_t size = peg_rule_size(rule);
+        uint32_t first;
+        uint32_t nrefs = peg_rule_refs(rule, &first);
+        uint32_t at = janet_v_count(code);
+        for (uint32_t j = 0; j < size; j++) janet_v_push(code, rule[j]);
+        for (uint32_t j = 0; j < nrefs; j++) janet_v_push(fixups, at + first + j);
+    }
+    for (int32_t i = 0; i < janet_v_count(fixups); i++) {
+        code[fixups[i]] = map[code[fixups[i]]];
+    }
+    for (int32_t i = 0; i < janet_v_count(merges); i += 3) {
+        uint32_t index = janet_v_count(code);
+        peg_push_literal(&code, old, old + merges[i + 1], merges[i + 2]);
+        code[merges[i]] = index;
+    }
+    janet_free(map);
+    janet_v_free(fixups);
+    janet_v_free(merges);
+    janet_v_free(old);
+    b->bytecode = code;
 }
 
 /*
@@ -1400,7 +2101,7 @@ static void *peg_unmarshal(JanetMarshalContext *ctx) {
         uint32_t instr = bytecode[i];
         uint32_t *rule = bytecode + i;
         op_flags[i] |= 0x02;
-        switch (instr & 0x1F) {
+        switch (instr & 0x3F) {
             case RULE_LITERAL:
                 i += 2 + ((rule[1] + 3) >> 2);
                 break;
@@ -1422,6 +2123,32 @@ static void *peg_unmarshal(JanetMarshalContext *ctx) {
                 /* [8 words] */
                 i += 9;
                 break;
+            case RULE_SPAN:
+                /* [lo, hi, 8 words] */
+                i += 11;
+                break;
+            case RULE_DISPATCH:
+                /* [len, words, rules..., candidates (257 * words)] */
+            {
+                if (i + 3 > blen) goto bad;
+                uint32_t len = rule[1];
+                uint32_t words = rule[2];
+                if (len == 0 || words != ((len + 31) >> 5)) goto bad;
+                if ((uint64_t) i + 3 + len + 257 * (uint64_t) words > blen) goto bad;
+                for (uint32_t j = 0; j < len; j++) {
+                    if (rule[3 + j] >= blen) goto bad;
+                    op_flags[rule[3 + j]] |= 0x1;
+                }
+                /* Candidates must be alternatives */
+                if (len & 0x1F) {
+                    uint32_t extra = ~(((uint32_t) 1 << (len & 0x1F)) - 1);
+                    for (uint32_t c = 0; c < 257; c++) {
+                        if (rule[3 + len + c * words + words - 1] & extra) goto bad;
+                    }
+                }
+                i += 3 + len + 257 * words;
+            }
+            break;
             case RULE_LOOK:
                 /* [offset, rule] */
                 if (rule[2] >= blen) goto bad;
@@ -1485,6 +2212,13 @@ static void *peg_unmarshal(JanetMarshalContext *ctx) {
                 op_flags[rule[1]] |= 0x01;
                 i += 3;
                 break;
+            case RULE_PROFILE:
+                /* [rule, constant] */
+                if (rule[1] >= blen) goto bad;
+                if (rule[2] >= clen) goto bad;
+                op_flags[rule[1]] |= 0x01;
+                i += 3;
+                break;
             case RULE_REPLACE:
             case RULE_MATCHTIME:
                 /* [rule, constant, tag] */
@@ -1498,6 +2232,7 @@ static void *peg_unmarshal(JanetMarshalContext *ctx) {
             case RULE_NOT:
             case RULE_TO:
             case RULE_THRU:
+            case RULE_MEMO:
                 /* [rule] */
                 if (rule[1] >= blen) goto bad;
                 op_flags[rule[1]] |= 0x01;
@@ -1571,7 +2306,7 @@ static JanetPeg *make_peg(Builder *b) {
 }
 
 /* Compiler entry point */
-static JanetPeg *compile_peg(Janet x) {
+static JanetPeg *compile_peg(Janet x, int profile) {
     Builder builder;
     builder.grammar = janet_table(0);
     builder.default_grammar = NULL;
@@ -1588,7 +2323,12 @@ static JanetPeg *compile_peg(Janet x) {
     builder.form = x;
     builder.depth = JANET_RECURSION_GUARD;
     builder.has_backref = 0;
+    builder.memoize = janet_truthy(janet_dyn("peg-memoize"));
+    builder.memos = janet_table(0);
+    builder.profile = profile || janet_truthy(janet_dyn("peg-profile"));
+    builder.profiles = janet_table(0);
     peg_compile1(&builder, x);
+    peg_optimize(&builder);
     JanetPeg *peg = make_peg(&builder);
     builder_cleanup(&builder);
     return peg;
@@ -1602,9 +2342,11 @@ JANET_CORE_FN(cfun_peg_compile,
               "(peg/compile peg)",
               "Compiles a peg source data structure into a <core/peg>. This will speed up matching "
               "if the same peg will be used multiple times. Will also use `(dyn :peg-grammar)` to suppliment "
-              "the grammar of the peg for otherwise undefined peg keywords.") {
+              "the grammar of the peg for otherwise undefined peg keywords. If `(dyn :peg-memoize)` is set, "
+              "every named rule is memoized, and if `(dyn :peg-profile)` is set, named rules are counted "
+              "by `peg/profile`.") {
     janet_fixarity(argc, 1);
-    JanetPeg *peg = compile_peg(argv[0]);
+    JanetPeg *peg = compile_peg(argv[0], 0);
     return janet_wrap_abstract(peg);
 }
 
@@ -1615,25 +2357,52 @@ typedef struct {
     JanetByteView bytes;
     JanetByteView repl;
     int32_t start;
+    size_t borrows;
 } PegCall;
 
+/* Get a compiled peg, compiling it if needed */
+static JanetPeg *peg_getpeg(Janet x) {
+    if (janet_checktype(x, JANET_ABSTRACT) &&
+            janet_abstract_type(janet_unwrap_abstract(x)) == &janet_peg_type) {
+        return janet_unwrap_abstract(x);
+    }
+    return compile_peg(x, 0);
+}
+
+/* Initialize the matching state for a peg over some text */
+static void peg_state_init(PegState *s, JanetPeg *peg, const uint8_t *text, int32_t len) {
+    s->mode = PEG_MODE_NORMAL;
+    s->text_start = text;
+    s->text_end = text + len;
+    s->depth = JANET_RECURSION_GUARD;
+    s->captures = janet_array(0);
+    s->tagged_captures = janet_array(0);
+    s->scratch = janet_buffer(10);
+    s->tags = janet_buffer(10);
+    s->constants = peg->constants;
+    s->bytecode = peg->bytecode;
+    s->linemap = NULL;
+    s->linemaplen = -1;
+    s->has_backref = peg->has_backref;
+    s->hit_end = 0;
+    s->memo = NULL;
+    s->profile = NULL;
+}
+
 /* Initialize state for peg cfunctions */
 static PegCall peg_cfun_init(int32_t argc, Janet *argv, int get_replace) {
     PegCall ret;
     int32_t min = get_replace ? 3 : 2;
     janet_arity(argc, get_replace, -1);
-    if (janet_checktype(argv[0], JANET_ABSTRACT) &&
-            janet_abstract_type(janet_unwrap_abstract(argv[0])) == &janet_peg_type) {
-        ret.peg = janet_unwrap_abstract(argv[0]);
-    } else {
-        ret.peg = compile_peg(argv[0]);
-    }
+    ret.peg = peg_getpeg(argv[0]);
     if (get_replace) {
         ret.repl = janet_getbytes(argv, 1);
         ret.bytes = janet_getbytes(argv, 2);
     } else {
         ret.bytes = janet_getbytes(argv, 1);
     }
+    /* Callbacks in the grammar must not move the text out from under the match */
+    ret.borrows = janet_buffer_borrow_scope(argv[get_replace ? 2 : 1]);
     if (argc > min) {
         ret.start = janet_gethalfrange(argv, min, ret.bytes.len, "offset");
         ret.s.extrac = argc - min - 1;
@@ -1643,22 +2412,15 @@ static PegCall peg_cfun_init(int32_t argc, Janet *argv, int get_replace) {
         ret.s.extrac = 0;
         ret.s.extrav = NULL;
     }
-    ret.s.mode = PEG_MODE_NORMAL;
-    ret.s.text_start = ret.bytes.bytes;
-    ret.s.text_end = ret.bytes.bytes + ret.bytes.len;
-    ret.s.depth = JANET_RECURSION_GUARD;
-    ret.s.captures = janet_array(0);
-    ret.s.tagged_captures = janet_array(0);
-    ret.s.scratch = janet_buffer(10);
-    ret.s.tags = janet_buffer(10);
-    ret.s.constants = ret.peg->constants;
-    ret.s.bytecode = ret.peg->bytecode;
-    ret.s.linemap = NULL;
-    ret.s.linemaplen = -1;
-    ret.s.has_backref = ret.peg->has_backref;
+    peg_state_init(&ret.s, ret.peg, ret.bytes.bytes, ret.bytes.len);
     return ret;
 }
 
+static void peg_call_deinit(PegCall *c) {
+    peg_memo_deinit(&c->s);
+    janet_buffer_unborrow_scope(c->borrows);
+}
+
 static void peg_call_reset(PegCall *c) {
     c->s.captures->count = 0;
     c->s.scratch->count = 0;
@@ -1671,19 +2433,65 @@ JANET_CORE_FN(cfun_peg_match,
               "Returns nil if text does not match the language defined by peg. The syntax of PEGs is documented on the Janet website.") {
     PegCall c = peg_cfun_init(argc, argv, 0);
     const uint8_t *result = peg_rule(&c.s, c.s.bytecode, c.bytes.bytes + c.start);
+    peg_call_deinit(&c);
     return result ? janet_wrap_array(c.s.captures) : janet_wrap_nil();
 }
 
+JANET_CORE_FN(cfun_peg_profile,
+              "(peg/profile peg text &opt start & args)",
+              "Match a peg like `peg/match`, and count how often each named rule of the grammar was tried. "
+              "Returns a table with the match result under `:result`, and a table under `:rules` that maps each "
+              "rule keyword (and `:main` for each grammar) to a table of `:entries`, `:successes`, `:failures`, "
+              "`:bytes` consumed by successful matches, and `:time` in seconds spent in the rule. "
+              "Source pegs are compiled with profiling enabled; compiled pegs only report rules if they were "
+              "compiled with `(dyn :peg-profile)` set.") {
+    janet_arity(argc, 2, -1);
+    if (!janet_checkabstract(argv[0], &janet_peg_type)) {
+        argv[0] = janet_wrap_abstract(compile_peg(argv[0], 1));
+    }
+    PegCall c = peg_cfun_init(argc, argv, 0);
+    int32_t count = c.peg->num_constants;
+    PegProfileEntry *profile = janet_smalloc(sizeof(PegProfileEntry) * (count ? count : 1));
+    memset(profile, 0, sizeof(PegProfileEntry) * (count ? count : 1));
+    c.s.profile = profile;
+    const uint8_t *result = peg_rule(&c.s, c.s.bytecode, c.bytes.bytes + c.start);
+    peg_call_deinit(&c);
+    JanetTable *rules = janet_table(0);
+    for (uint32_t i = 0; i < c.peg->bytecode_len; i += peg_rule_size(c.peg->bytecode + i)) {
+        const uint32_t *rule = c.peg->bytecode + i;
+        if (rule[0] != RULE_PROFILE) continue;
+        Janet name = c.peg->constants[rule[2]];
+        if (!janet_checktype(janet_table_get(rules, name), JANET_NIL)) continue;
+        PegProfileEntry *p = profile + rule[2];
+        JanetTable *stats = janet_table(5);
+        janet_table_put(stats, janet_ckeywordv("entries"), janet_wrap_number((double) p->entries));
+        janet_table_put(stats, janet_ckeywordv("successes"), janet_wrap_number((double) p->successes));
+        janet_table_put(stats, janet_ckeywordv("failures"), janet_wrap_number((double) p->failures));
+        janet_table_put(stats, janet_ckeywordv("bytes"), janet_wrap_number((double) p->bytes));
+        janet_table_put(stats, janet_ckeywordv("time"), janet_wrap_number(p->time));
+        janet_table_put(rules, name, janet_wrap_table(stats));
+    }
+    janet_sfree(profile);
+    JanetTable *ret = janet_table(2);
+    janet_table_put(ret, janet_ckeywordv("result"), result ? janet_wrap_array(c.s.captures) : janet_wrap_nil());
+    janet_table_put(ret, janet_ckeywordv("rules"), janet_wrap_table(rules));
+    return janet_wrap_table(ret);
+}
+
 JANET_CORE_FN(cfun_peg_find,
               "(peg/find peg text &opt start & args)",
               "Find first index where the peg matches in text. Returns an integer, or nil if not found.") {
     PegCall c = peg_cfun_init(argc, argv, 0);
+    Janet ret = janet_wrap_nil();
     for (int32_t i = c.start; i < c.bytes.len; i++) {
         peg_call_reset(&c);
-        if (peg_rule(&c.s, c.s.bytecode, c.bytes.bytes + i))
-            return janet_wrap_integer(i);
+        if (peg_rule(&c.s, c.s.bytecode, c.bytes.bytes + i)) {
+            ret = janet_wrap_integer(i);
+            break;
+        }
     }
-    return janet_wrap_nil();
+    peg_call_deinit(&c);
+    return ret;
 }
 
 JANET_CORE_FN(cfun_peg_find_all,
@@ -1696,6 +2504,7 @@ JANET_CORE_FN(cfun_peg_find_all,
         if (peg_rule(&c.s, c.s.bytecode, c.bytes.bytes + i))
             janet_array_push(ret, janet_wrap_integer(i));
     }
+    peg_call_deinit(&c);
     return janet_wrap_array(ret);
 }
 
@@ -1724,6 +2533,7 @@ static Janet cfun_peg_replace_generic(int32_t argc, Janet *argv, int only_one) {
     if (trail < c.bytes.len) {
         janet_buffer_push_bytes(ret, c.bytes.bytes + trail, (c.bytes.len - trail));
     }
+    peg_call_deinit(&c);
     return janet_wrap_buffer(ret);
 }
 
@@ -1761,19 +2571,181 @@ static Janet peg_next(void *p, Janet key) {
     return janet_nextmethod(peg_methods, key);
 }
 
+/*
+ * Streaming
+ */
+
+/* A peg stream matches a peg repeatedly against input that arrives in
+ * chunks. The matcher is recursive C code and cannot suspend in the middle
+ * of a rule, so each attempt runs from the start of the pending message.
+ * What is kept between chunks is the pending input and its position, and
+ * the matcher records whether it looked at the end of the text, so a match
+ * that cannot change with more input is reported right away, and so is a
+ * failure that no more input could fix. */
+typedef struct {
+    JanetPeg *peg;
+    JanetBuffer *buffer;
+    const Janet *extrav;
+    int32_t extrac;
+    int32_t start; /* Start of the pending message in buffer */
+    int32_t checked; /* Length of buffer at the last attempt that needed more */
+} JanetPegStream;
+
+static int peg_stream_mark(void *p, size_t size) {
+    (void) size;
+    JanetPegStream *ps = (JanetPegStream *)p;
+    janet_mark(janet_wrap_abstract(ps->peg));
+    janet_mark(janet_wrap_buffer(ps->buffer));
+    if (NULL != ps->extrav) janet_mark(janet_wrap_tuple(ps->extrav));
+    return 0;
+}
+
+static int peg_stream_get(void *p, Janet key, Janet *out);
+static Janet peg_stream_next(void *p, Janet key);
+
+static const JanetAbstractType peg_stream_type = {
+    "core/peg-stream",
+    NULL,
+    peg_stream_mark,
+    peg_stream_get,
+    NULL, /* put */
+    NULL, /* marshal */
+    NULL, /* unmarshal */
+    NULL, /* tostring */
+    NULL, /* compare */
+    NULL, /* hash */
+    peg_stream_next,
+    JANET_ATEND_NEXT
+};
+
+/* Try to match the pending message. Returns the captures on a match, or
+ * :more or :fail. With final set, the end of the buffer is the end of the
+ * input. */
+static Janet peg_stream_step(JanetPegStream *ps, int final) {
+    JanetBuffer *buffer = ps->buffer;
+    if (!final && ps->checked == buffer->count) return janet_ckeywordv("more");
+    PegState s;
+    peg_state_init(&s, ps->peg, buffer->data + ps->start, buffer->count - ps->start);
+    s.extrav = ps->extrav;
+    s.extrac = ps->extrac;
+    size_t borrows = janet_buffer_borrow_scope(janet_wrap_buffer(buffer));
+    const uint8_t *result = peg_rule(&s, s.bytecode, s.text_start);
+    peg_memo_deinit(&s);
+    janet_buffer_unborrow_scope(borrows);
+    if (s.hit_end && !final) {
+        ps->checked = buffer->count;
+        return janet_ckeywordv("more");
+    }
+    ps->checked = -1;
+    if (!result) return janet_ckeywordv("fail");
+    ps->start += (int32_t)(result - s.text_start);
+    /* Drop consumed input once it is most of the buffer */
+    if (ps->start == buffer->count) {
+        buffer->count = 0;
+        ps->start = 0;
+    } else if (ps->start > 4096 && ps->start > buffer->count / 2) {
+        memmove(buffer->data, buffer->data + ps->start, buffer->count - ps->start);
+        buffer->count -= ps->start;
+        ps->start = 0;
+    }
+    return janet_wrap_array(s.captures);
+}
+
+static JanetPegStream *peg_getstream(const Janet *argv, int32_t n) {
+    return (JanetPegStream *) janet_getabstract(argv, n, &peg_stream_type);
+}
+
+JANET_CORE_FN(cfun_peg_stream,
+              "(peg/stream peg & args)",
+              "Create a <core/peg-stream> for matching `peg` against input that arrives in chunks, "
+              "such as messages read from a network stream. Input is added with `peg/feed`. "
+              "Extra `args` are passed to the matcher as in `peg/match`.") {
+    janet_arity(argc, 1, -1);
+    JanetPeg *peg = peg_getpeg(argv[0]);
+    JanetPegStream *ps = janet_abstract(&peg_stream_type, sizeof(JanetPegStream));
+    ps->peg = peg;
+    ps->buffer = janet_buffer(0);
+    ps->extrac = argc - 1;
+    ps->extrav = argc > 1 ? janet_tuple_n(argv + 1, argc - 1) : NULL;
+    ps->start = 0;
+    ps->checked = -1;
+    return janet_wrap_abstract(ps);
+}
+
+JANET_CORE_FN(cfun_peg_feed,
+              "(peg/feed stream &opt bytes)",
+              "Append `bytes` to the input of a peg stream and try to match the peg against the "
+              "pending input. Returns the array of captures if the peg matched, in which case the "
+              "matched input is consumed and the next call matches against what follows it. "
+              "Returns :more if the result depends on input that has not arrived yet, and :fail "
+              "if the pending input cannot match no matter what follows. The peg is not run again "
+              "until more input arrives after returning :more.") {
+    janet_arity(argc, 1, 2);
+    JanetPegStream *ps = peg_getstream(argv, 0);
+    if (argc > 1) {
+        JanetByteView bytes = janet_getbytes(argv, 1);
+        janet_buffer_push_bytes(ps->buffer, bytes.bytes, bytes.len);
+    }
+    return peg_stream_step(ps, 0);
+}
+
+JANET_CORE_FN(cfun_peg_finish,
+              "(peg/finish stream)",
+              "Match the peg against the pending input of a peg stream, treating it as the end of "
+              "the input. Returns the array of captures, or :fail.") {
+    janet_fixarity(argc, 1);
+    JanetPegStream *ps = peg_getstream(argv, 0);
+    return peg_stream_step(ps, 1);
+}
+
+JANET_CORE_FN(cfun_peg_pending,
+              "(peg/pending stream)",
+              "Get the input of a peg stream that has not been consumed by a match, as a new buffer.") {
+    janet_fixarity(argc, 1);
+    JanetPegStream *ps = peg_getstream(argv, 0);
+    JanetBuffer *ret = janet_buffer(ps->buffer->count - ps->start);
+    janet_buffer_push_bytes(ret, ps->buffer->data + ps->start, ps->buffer->count - ps->start);
+    return janet_wrap_buffer(ret);
+}
+
+static JanetMethod peg_stream_methods[] = {
+    {"feed", cfun_peg_feed},
+    {"finish", cfun_peg_finish},
+    {"pending", cfun_peg_pending},
+    {NULL, NULL}
+};
+
+static int peg_stream_get(void *p, Janet key, Janet *out) {
+    (void) p;
+    if (!janet_checktype(key, JANET_KEYWORD))
+        return 0;
+    return janet_getmethod(janet_unwrap_keyword(key), peg_stream_methods, out);
+}
+
+static Janet peg_stream_next(void *p, Janet key) {
+    (void) p;
+    return janet_nextmethod(peg_stream_methods, key);
+}
+
 /* Load the peg module */
 void janet_lib_peg(JanetTable *env) {
     JanetRegExt cfuns[] = {
         JANET_CORE_REG("peg/compile", cfun_peg_compile),
         JANET_CORE_REG("peg/match", cfun_peg_match),
         JANET_CORE_REG("peg/find", cfun_peg_find),
+        JANET_CORE_REG("peg/profile", cfun_peg_profile),
         JANET_CORE_REG("peg/find-all", cfun_peg_find_all),
         JANET_CORE_REG("peg/replace", cfun_peg_replace),
         JANET_CORE_REG("peg/replace-all", cfun_peg_replace_all),
+        JANET_CORE_REG("peg/stream", cfun_peg_stream),
+        JANET_CORE_REG("peg/feed", cfun_peg_feed),
+        JANET_CORE_REG("peg/finish", cfun_peg_finish),
+        JANET_CORE_REG("peg/pending", cfun_peg_pending),
         JANET_REG_END
     };
     janet_core_cfuns_ext(env, NULL, cfuns);
     janet_register_abstract_type(&janet_peg_type);
+    janet_register_abstract_type(&peg_stream_type);
 }
 
 #endif /* ifdef JANET_PEG */
@@ -37,20 +37,244 @@
 /* Temporary buffer size */
 #define BUFSIZE 64
 
-static void number_to_string_b(JanetBuffer *buffer, double x) {
+/*
+ * Shortest round trip printing of doubles, with the Grisu2 algorithm
+ * (Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately
+ * with Integers"). The output always reads back as the same double, and is
+ * the shortest such output for nearly all inputs.
+ */
+
+typedef struct {
+    uint64_t f;
+    int e;
+} DiyFp;
+
+/* Normalized 64 bit approximations of 10^k for k = -348, -340, ..., 340 */
+static const uint64_t grisu_powers_f[] = {
+    0xfa8fd5a0081c0288, 0xbaaee17fa23ebf76, 0x8b16fb203055ac76, 0xcf42894a5dce35ea,
+    0x9a6bb0aa55653b2d, 0xe61acf033d1a45df, 0xab70fe17c79ac6ca, 0xff77b1fcbebcdc4f,
+    0xbe5691ef416bd60c, 0x8dd01fad907ffc3c, 0xd3515c2831559a83, 0x9d71ac8fada6c9b5,
+    0xea9c227723ee8bcb, 0xaecc49914078536d, 0x823c12795db6ce57, 0xc21094364dfb5637,
+    0x9096ea6f3848984f, 0xd77485cb25823ac7, 0xa086cfcd97bf97f4, 0xef340a98172aace5,
+    0xb23867fb2a35b28e, 0x84c8d4dfd2c63f3b, 0xc5dd44271ad3cdba, 0x936b9fcebb25c996,
+    0xdbac6c247d62a584, 0xa3ab66580d5fdaf6, 0xf3e2f893dec3f126, 0xb5b5ada8aaff80b8,
+    0x87625f056c7c4a8b, 0xc9bcff6034c13053, 0x964e858c91ba2655, 0xdff9772470297ebd,
+    0xa6dfbd9fb8e5b88f, 0xf8a95fcf88747d94, 0xb94470938fa89bcf, 0x8a08f0f8bf0f156b,
+    0xcdb02555653131b6, 0x993fe2c6d07b7fac, 0xe45c10c42a2b3b06, 0xaa242499697392d3,
+    0xfd87b5f28300ca0e, 0xbce5086492111aeb, 0x8cbccc096f5088cc, 0xd1b71758e219652c,
+    0x9c40000000000000, 0xe8d4a51000000000, 0xad78ebc5ac620000, 0x813f3978f8940984,
+    0xc097ce7bc90715b3, 0x8f7e32ce7bea5c70, 0xd5d238a4abe98068, 0x9f4f2726179a2245,
+    0xed63a231d4c4fb27, 0xb0de65388cc8ada8, 0x83c7088e1aab65db, 0xc45d1df942711d9a,
+    0x924d692ca61be758, 0xda01ee641a708dea, 0xa26da3999aef774a, 0xf209787bb47d6b85,
+    0xb454e4a179dd1877, 0x865b86925b9bc5c2, 0xc83553c5c8965d3d, 0x952ab45cfa97a0b3,
+    0xde469fbd99a05fe3, 0xa59bc234db398c25, 0xf6c69a72a3989f5c, 0xb7dcbf5354e9bece,
+    0x88fcf317f22241e2, 0xcc20ce9bd35c78a5, 0x98165af37b2153df, 0xe2a0b5dc971f303a,
+    0xa8d9d1535ce3b396, 0xfb9b7cd9a4a7443c, 0xbb764c4ca7a44410, 0x8bab8eefb6409c1a,
+    0xd01fef10a657842c, 0x9b10a4e5e9913129, 0xe7109bfba19c0c9d, 0xac2820d9623bf429,
+    0x80444b5e7aa7cf85, 0xbf21e44003acdd2d, 0x8e679c2f5e44ff8f, 0xd433179d9c8cb841,
+    0x9e19db92b4e31ba9, 0xeb96bf6ebadf77d9, 0xaf87023b9bf0ee6b,
+};
+
+static const int16_t grisu_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static DiyFp diyfp_mul(DiyFp x, DiyFp y) {
+    const uint64_t M32 = 0xFFFFFFFF;
+    uint64_t a = x.f >> 32, b = x.f & M32;
+    uint64_t c = y.f >> 32, d = y.f & M32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+    tmp += 1U << 31; /* Round */
+    DiyFp r;
+    r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+static DiyFp diyfp_normalize(DiyFp x) {
+    while (!(x.f & ((uint64_t) 1 << 63))) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+static void grisu_round(char *buffer, int len, uint64_t delta, uint64_t rest,
+                        uint64_t ten_kappa, uint64_t wp_w) {
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+            (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buffer[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int count_digits32(uint32_t n) {
+    int count = 1;
+    while (n >= 10) {
+        n /= 10;
+        count++;
+    }
+    return count;
+}
+
+static const uint64_t grisu_pow10[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static int grisu_digits(DiyFp w, DiyFp mp, uint64_t delta, char *buffer, int *K) {
+    DiyFp one;
+    one.f = (uint64_t) 1 << -mp.e;
+    one.e = mp.e;
+    uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = count_digits32(p1);
+    int len = 0;
+    while (kappa > 0) {
+        uint32_t div = (uint32_t) grisu_pow10[kappa - 1];
+        uint32_t d = p1 / div;
+        p1 %= div;
+        if (d || len) buffer[len++] = (char)('0' + d);
+        kappa--;
+        uint64_t tmp = ((uint64_t) p1 << -one.e) + p2;
+        if (tmp <= delta) {
+            *K += kappa;
+            grisu_round(buffer, len, delta, tmp, grisu_pow10[kappa] << -one.e, wp_w);
+            return len;
+        }
+    }
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> -one.e);
+        if (d || len) buffer[len++] = (char)('0' + d);
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *K += kappa;
+            int index = -kappa;
+            grisu_round(buffer, len, delta, p2, one.f, wp_w * (index < 20 ? grisu_pow10[index] : 0));
+            return len;
+        }
+    }
+}
+
+/* Write the shortest digits of a finite, positive double to buffer (at least 18
+ * bytes). Returns the number of digits, and the value is digits * 10^K. */
+static int grisu2(double value, char *buffer, int *K) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int biased_e = (int)((bits >> 52) & 0x7FF);
+    uint64_t significand = bits & (((uint64_t) 1 << 52) - 1);
+    DiyFp v;
+    if (biased_e) {
+        v.f = significand | ((uint64_t) 1 << 52);
+        v.e = biased_e - 1075;
+    } else {
+        v.f = significand;
+        v.e = -1074;
+    }
+    /* Boundaries half way to the neighboring doubles */
+    DiyFp plus, minus;
+    plus.f = (v.f << 1) + 1;
+    plus.e = v.e - 1;
+    plus = diyfp_normalize(plus);
+    if (v.f == ((uint64_t) 1 << 52) && biased_e > 1) {
+        /* The gap below a power of two is half the size */
+        minus.f = (v.f << 2) - 1;
+        minus.e = v.e - 2;
+    } else {
+        minus.f = (v.f << 1) - 1;
+        minus.e = v.e - 1;
+    }
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+    /* Scale by a cached power of 10 into the range the digit generation expects */
+    double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+    int k = (int) dk;
+    if (dk - k > 0.0) k++;
+    unsigned index = (unsigned)((k >> 3) + 1);
+    *K = -(-348 + (int)(index << 3));
+    DiyFp c_mk;
+    c_mk.f = grisu_powers_f[index];
+    c_mk.e = grisu_powers_e[index];
+    DiyFp w = diyfp_mul(diyfp_normalize(v), c_mk);
+    DiyFp wp = diyfp_mul(plus, c_mk);
+    DiyFp wm = diyfp_mul(minus, c_mk);
+    wm.f++;
+    wp.f--;
+    return grisu_digits(w, wp, wp.f - wm.f, buffer, K);
+}
+
+/* Push the shortest representation of a double that reads back as the same value.
+ * Uses fixed notation for decimal exponents in [-4, 17), like %.17g. */
+void janet_buffer_push_shortest(JanetBuffer *buffer, double x) {
+    if (x == 0.0 || !isfinite(x)) {
+        janet_buffer_ensure(buffer, buffer->count + BUFSIZE, 2);
+        buffer->count += snprintf((char *) buffer->data + buffer->count, BUFSIZE, "%g", x);
+        return;
+    }
+    char digits[32];
+    int K;
+    int neg = x < 0;
+    int len = grisu2(neg ? -x : x, digits, &K);
+    int exp10 = len + K - 1;
     janet_buffer_ensure(buffer, buffer->count + BUFSIZE, 2);
-    const char *fmt = (x == floor(x) &&
-                       x <= JANET_INTMAX_DOUBLE &&
-                       x >= JANET_INTMIN_DOUBLE) ? "%.0f" : "%g";
-    int count;
+    uint8_t *out = buffer->data + buffer->count;
+    uint8_t *p = out;
+    if (neg) *p++ = '-';
+    if (exp10 < -4 || exp10 >= 17) {
+        *p++ = (uint8_t) digits[0];
+        if (len > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, len - 1);
+            p += len - 1;
+        }
+        p += sprintf((char *) p, "e%c%02d", exp10 < 0 ? '-' : '+', exp10 < 0 ? -exp10 : exp10);
+    } else if (exp10 < 0) {
+        *p++ = '0';
+        *p++ = '.';
+        for (int i = -1; i > exp10; i--) *p++ = '0';
+        memcpy(p, digits, len);
+        p += len;
+    } else if (exp10 + 1 >= len) {
+        memcpy(p, digits, len);
+        p += len;
+        for (int i = len; i <= exp10; i++) *p++ = '0';
+    } else {
+        memcpy(p, digits, exp10 + 1);
+        p += exp10 + 1;
+        *p++ = '.';
+        memcpy(p, digits + exp10 + 1, len - exp10 - 1);
+        p += len - exp10 - 1;
+    }
+    buffer->count += (int32_t)(p - out);
+}
+
+static void number_to_string_b(JanetBuffer *buffer, double x) {
     if (x == 0.0) {
         /* Prevent printing of '-0' */
-        count = 1;
-        buffer->data[buffer->count] = '0';
+        janet_buffer_push_u8(buffer, '0');
+    } else if (x == floor(x) &&
+               x <= JANET_INTMAX_DOUBLE &&
+               x >= JANET_INTMIN_DOUBLE) {
+        janet_buffer_ensure(buffer, buffer->count + BUFSIZE, 2);
+        buffer->count += snprintf((char *) buffer->data + buffer->count, BUFSIZE, "%.0f", x);
     } else {
-        count = snprintf((char *) buffer->data + buffer->count, BUFSIZE, fmt, x);
+        janet_buffer_push_shortest(buffer, x);
     }
-    buffer->count += count;
 }
 
 /* expects non positive x */
@@ -362,9 +586,7 @@ static int print_jdn_one(struct pretty *S, Janet x, int depth) {
             janet_description_b(S->buffer, x);
             break;
         case JANET_NUMBER:
-            janet_buffer_ensure(S->buffer, S->buffer->count + BUFSIZE, 2);
-            int count = snprintf((char *) S->buffer->data + S->buffer->count, BUFSIZE, "%.17g", janet_unwrap_number(x));
-            S->buffer->count += count;
+            janet_buffer_push_shortest(S->buffer, janet_unwrap_number(x));
             break;
         case JANET_SYMBOL:
         case JANET_KEYWORD:
@@ -932,6 +1154,115 @@ JanetBuffer *janet_formatb(JanetBuffer *buffer, const char *format, ...) {
     return buffer;
 }
 
+/* Format one directive into the buffer, using argv[arg] */
+static void format_item(
+    JanetBuffer *b,
+    char conv,
+    const char *form,
+    const char *precision,
+    Janet *argv,
+    int32_t arg,
+    int32_t startlen) {
+    char item[MAX_ITEM];
+    int nb = 0; /* number of bytes in added item */
+    switch (conv) {
+        case 'c': {
+            nb = snprintf(item, MAX_ITEM, form, (int)
+                          janet_getinteger(argv, arg));
+            break;
+        }
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'x':
+        case 'X': {
+            int32_t n = janet_getinteger(argv, arg);
+            if (form[2] == '\0' && conv != 'o' && conv != 'x' && conv != 'X') {
+                /* Plain %d needs no snprintf */
+                integer_to_string_b(b, n);
+            } else {
+                nb = snprintf(item, MAX_ITEM, form, n);
+            }
+            break;
+        }
+        case 'a':
+        case 'A':
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'g':
+        case 'G': {
+            double d = janet_getnumber(argv, arg);
+            nb = snprintf(item, MAX_ITEM, form, d);
+            break;
+        }
+        case 's': {
+            const uint8_t *s = janet_getstring(argv, arg);
+            int32_t l = janet_string_length(s);
+            if (form[2] == '\0')
+                janet_buffer_push_bytes(b, s, l);
+            else {
+                if (l != (int32_t) strlen((const char *) s))
+                    janet_panic("string contains zeros");
+                if (!strchr(form, '.') && l >= 100) {
+                    janet_panic("no precision and string is too long to be formatted");
+                } else {
+                    nb = snprintf(item, MAX_ITEM, form, s);
+                }
+            }
+            break;
+        }
+        case 'V': {
+            janet_to_string_b(b, argv[arg]);
+            break;
+        }
+        case 'v': {
+            janet_description_b(b, argv[arg]);
+            break;
+        }
+        case 't':
+            janet_buffer_push_cstring(b, typestr(argv[arg]));
+            break;
+        case 'M':
+        case 'm':
+        case 'N':
+        case 'n':
+        case 'Q':
+        case 'q':
+        case 'P':
+        case 'p': { /* janet pretty , precision = depth */
+            int depth = atoi(precision);
+            if (depth < 1) depth = JANET_RECURSION_GUARD;
+            char d = conv;
+            int has_color = (d == 'P') || (d == 'Q') || (d == 'M') || (d == 'N');
+            int has_oneline = (d == 'Q') || (d == 'q') || (d == 'N') || (d == 'n');
+            int has_notrunc = (d == 'M') || (d == 'm') || (d == 'N') || (d == 'n');
+            int flags = 0;
+            flags |= has_color ? JANET_PRETTY_COLOR : 0;
+            flags |= has_oneline ? JANET_PRETTY_ONELINE : 0;
+            flags |= has_notrunc ? JANET_PRETTY_NOTRUNC : 0;
+            janet_pretty_(b, depth, flags, argv[arg], startlen);
+            break;
+        }
+        case 'j': {
+            int depth = atoi(precision);
+            if (depth < 1)
+                depth = JANET_RECURSION_GUARD;
+            janet_jdn_(b, depth, argv[arg], startlen);
+            break;
+        }
+        default: {
+            /* also treat cases 'nLlh' */
+            janet_panicf("invalid conversion '%s' to 'format'",
+                         form);
+        }
+    }
+    if (nb >= MAX_ITEM)
+        janet_panic("format buffer overflow");
+    if (nb > 0)
+        janet_buffer_push_bytes(b, (uint8_t *) item, nb);
+}
+
 /* Shared implementation between string/format and
  * buffer/format */
 void janet_buffer_format(
@@ -950,106 +1281,196 @@ void janet_buffer_format(
         else if (*++strfrmt == '%')
             janet_buffer_push_u8(b, (uint8_t) * strfrmt++); /* %% */
         else { /* format item */
-            char form[MAX_FORMAT], item[MAX_ITEM];
+            char form[MAX_FORMAT];
             char width[3], precision[3];
-            int nb = 0; /* number of bytes in added item */
             if (++arg >= argc)
                 janet_panic("not enough values for format");
             strfrmt = scanformat(strfrmt, form, width, precision);
-            switch (*strfrmt++) {
-                case 'c': {
-                    nb = snprintf(item, MAX_ITEM, form, (int)
-                                  janet_getinteger(argv, arg));
-                    break;
-                }
-                case 'd':
-                case 'i':
-                case 'o':
-                case 'x':
-                case 'X': {
-                    int32_t n = janet_getinteger(argv, arg);
-                    nb = snprintf(item, MAX_ITEM, form, n);
-                    break;
-                }
-                case 'a':
-                case 'A':
-                case 'e':
-                case 'E':
-                case 'f':
-                case 'g':
-                case 'G': {
-                    double d = janet_getnumber(argv, arg);
-                    nb = snprintf(item, MAX_ITEM, form, d);
-                    break;
-                }
-                case 's': {
-                    const uint8_t *s = janet_getstring(argv, arg);
-                    int32_t l = janet_string_length(s);
-                    if (form[2] == '\0')
-                        janet_buffer_push_bytes(b, s, l);
-                    else {
-                        if (l != (int32_t) strlen((const char *) s))
-                            janet_panic("string contains zeros");
-                        if (!strchr(form, '.') && l >= 100) {
-                            janet_panic("no precision and string is too long to be formatted");
-                        } else {
-                            nb = snprintf(item, MAX_ITEM, form, s);
-                        }
-                    }
-                    break;
-                }
-                case 'V': {
-                    janet_to_string_b(b, argv[arg]);
-                    break;
-                }
-                case 'v': {
-                    janet_description_b(b, argv[arg]);
-                    break;
-                }
-                case 't':
-                    janet_buffer_push_cstring(b, typestr(argv[arg]));
-                    break;
-                case 'M':
-                case 'm':
-                case 'N':
-                case 'n':
-                case 'Q':
-                case 'q':
-                case 'P':
-                case 'p': { /* janet pretty , precision = depth */
-                    int depth = atoi(precision);
-                    if (depth < 1) depth = JANET_RECURSION_GUARD;
-                    char d = strfrmt[-1];
-                    int has_color = (d == 'P') || (d == 'Q') || (d == 'M') || (d == 'N');
-                    int has_oneline = (d == 'Q') || (d == 'q') || (d == 'N') || (d == 'n');
-                    int has_notrunc = (d == 'M') || (d == 'm') || (d == 'N') || (d == 'n');
-                    int flags = 0;
-                    flags |= has_color ? JANET_PRETTY_COLOR : 0;
-                    flags |= has_oneline ? JANET_PRETTY_ONELINE : 0;
-                    flags |= has_notrunc ? JANET_PRETTY_NOTRUNC : 0;
-                    janet_pretty_(b, depth, flags, argv[arg], startlen);
-                    break;
-                }
-                case 'j': {
-                    int depth = atoi(precision);
-                    if (depth < 1)
-                        depth = JANET_RECURSION_GUARD;
-                    janet_jdn_(b, depth, argv[arg], startlen);
-                    break;
-                }
-                default: {
-                    /* also treat cases 'nLlh' */
-                    janet_panicf("invalid conversion '%s' to 'format'",
-                                 form);
-                }
+            format_item(b, *strfrmt++, form, precision, argv, arg, startlen);
+        }
+    }
+}
+
+/*
+ * Compiled format strings. The directives of a format string are scanned once
+ * and kept, so formatting with the same string again skips scanformat.
+ */
+
+typedef struct {
+    int32_t lit_start; /* Literal text before the directive, as a slice of the source */
+    int32_t lit_len;
+    char conv; /* 0 if there is only literal text */
+    char form[MAX_FORMAT];
+    char precision[3];
+} JanetFormatItem;
+
+typedef struct {
+    JanetString source;
+    int32_t count;
+    int32_t nargs;
+    JanetFormatItem *items;
+} JanetFormat;
+
+static int format_gc(void *p, size_t s) {
+    (void) s;
+    janet_free(((JanetFormat *) p)->items);
+    return 0;
+}
+
+static int format_gcmark(void *p, size_t s) {
+    (void) s;
+    JanetFormat *f = (JanetFormat *) p;
+    if (f->source) janet_mark(janet_wrap_string(f->source));
+    return 0;
+}
+
+static void format_marshal(void *p, JanetMarshalContext *ctx) {
+    JanetFormat *f = (JanetFormat *) p;
+    janet_marshal_abstract(ctx, p);
+    janet_marshal_janet(ctx, janet_wrap_string(f->source));
+}
+
+static void format_build(JanetFormat *f) {
+    const char *strfrmt = (const char *) f->source;
+    const char *begin = strfrmt;
+    const char *strfrmt_end = strfrmt + janet_string_length(f->source);
+    int32_t cap = 4;
+    f->items = janet_malloc(cap * sizeof(JanetFormatItem));
+    if (NULL == f->items) {
+        JANET_OUT_OF_MEMORY;
+    }
+    const char *lit = strfrmt;
+    while (strfrmt < strfrmt_end) {
+        if (*strfrmt != '%') {
+            strfrmt++;
+            continue;
+        }
+        if (f->count == cap) {
+            cap *= 2;
+            JanetFormatItem *items = janet_realloc(f->items, cap * sizeof(JanetFormatItem));
+            if (NULL == items) {
+                JANET_OUT_OF_MEMORY;
             }
-            if (nb >= MAX_ITEM)
-                janet_panic("format buffer overflow");
-            if (nb > 0)
-                janet_buffer_push_bytes(b, (uint8_t *) item, nb);
+            f->items = items;
+        }
+        JanetFormatItem *item = f->items + f->count++;
+        item->lit_start = (int32_t)(lit - begin);
+        if (*++strfrmt == '%') {
+            /* %% - keep the first % as literal text */
+            item->lit_len = (int32_t)(strfrmt - lit);
+            item->conv = 0;
+            lit = ++strfrmt;
+            continue;
         }
+        item->lit_len = (int32_t)(strfrmt - 1 - lit);
+        char width[3];
+        strfrmt = scanformat(strfrmt, item->form, width, item->precision);
+        item->conv = *strfrmt++;
+        if (!item->conv || !strchr("cdioxXaAeEfgGsVvtMmNnQqPpj", item->conv)) {
+            janet_panicf("invalid conversion '%s' to 'format'", item->form);
+        }
+        f->nargs++;
+        lit = strfrmt;
+    }
+    if (lit < strfrmt_end) {
+        if (f->count == cap) {
+            JanetFormatItem *items = janet_realloc(f->items, (cap + 1) * sizeof(JanetFormatItem));
+            if (NULL == items) {
+                JANET_OUT_OF_MEMORY;
+            }
+            f->items = items;
+        }
+        JanetFormatItem *item = f->items + f->count++;
+        item->lit_start = (int32_t)(lit - begin);
+        item->lit_len = (int32_t)(strfrmt_end - lit);
+        item->conv = 0;
+    }
+}
+
+static void *format_unmarshal(JanetMarshalContext *ctx) {
+    JanetFormat *f = janet_unmarshal_abstract(ctx, sizeof(JanetFormat));
+    f->source = NULL;
+    f->items = NULL;
+    f->count = 0;
+    f->nargs = 0;
+    Janet source = janet_unmarshal_janet(ctx);
+    if (!janet_checktype(source, JANET_STRING)) janet_panic("expected format string");
+    f->source = janet_unwrap_string(source);
+    format_build(f);
+    return f;
+}
+
+static Janet format_call(void *p, int32_t argc, Janet *argv);
+
+const JanetAbstractType janet_format_type = {
+    "core/format",
+    format_gc,
+    format_gcmark,
+    NULL,
+    NULL,
+    format_marshal,
+    format_unmarshal,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    format_call,
+    JANET_ATEND_CALL
+};
+
+void *janet_format_compile(JanetString source) {
+    if ((int32_t) strlen((const char *) source) != janet_string_length(source))
+        janet_panic("format string contains zeros");
+    JanetFormat *f = janet_abstract(&janet_format_type, sizeof(JanetFormat));
+    f->source = source;
+    f->items = NULL;
+    f->count = 0;
+    f->nargs = 0;
+    format_build(f);
+    return f;
+}
+
+static void janet_buffer_format_compiled(
+    JanetBuffer *b,
+    JanetFormat *f,
+    int32_t argstart,
+    int32_t argc,
+    Janet *argv) {
+    if (argc - argstart - 1 < f->nargs)
+        janet_panic("not enough values for format");
+    int32_t arg = argstart;
+    int32_t startlen = b->count;
+    for (int32_t i = 0; i < f->count; i++) {
+        JanetFormatItem *item = f->items + i;
+        if (item->lit_len) janet_buffer_push_bytes(b, f->source + item->lit_start, item->lit_len);
+        if (item->conv) format_item(b, item->conv, item->form, item->precision, argv, ++arg, startlen);
+    }
+}
+
+void janet_buffer_format_value(
+    JanetBuffer *b,
+    int32_t argstart,
+    int32_t argc,
+    Janet *argv) {
+    Janet fmt = argv[argstart];
+    if (janet_checktype(fmt, JANET_ABSTRACT) &&
+            janet_abstract_type(janet_unwrap_abstract(fmt)) == &janet_format_type) {
+        janet_buffer_format_compiled(b, janet_unwrap_abstract(fmt), argstart, argc, argv);
+    } else {
+        janet_buffer_format(b, (const char *) janet_getstring(argv, argstart), argstart, argc, argv);
     }
 }
 
+static Janet format_call(void *p, int32_t argc, Janet *argv) {
+    JanetBuffer *buffer = janet_buffer(0);
+    /* Formatting expects the format in the slot before the arguments */
+    Janet *args = janet_smalloc(sizeof(Janet) * ((size_t) argc + 1));
+    args[0] = janet_wrap_abstract(p);
+    if (argc) memcpy(args + 1, argv, sizeof(Janet) * (size_t) argc);
+    janet_buffer_format_compiled(buffer, (JanetFormat *) p, 0, argc + 1, args);
+    janet_sfree(args);
+    return janet_stringv(buffer->data, buffer->count);
+}
+
 #undef HEX
 #undef BUFSIZE
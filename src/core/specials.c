@@ -432,6 +432,11 @@ static int defleaf(
         /* Add env entry to env */
         janet_table_put(c->env, janet_wrap_symbol(sym), janet_wrap_table(entry));
     }
+    if (s.flags & JANET_SLOT_CONSTANT) {
+        /* A def of a constant is the constant, and needs no register */
+        janetc_nameslot(c, sym, janetc_cslot(s.constant));
+        return 1;
+    }
     return namelocal(c, sym, 0, s);
 }
 
@@ -446,6 +451,170 @@ static JanetSlot janetc_def(JanetFopts opts, int32_t argn, const Janet *argv) {
     return ret;
 }
 
+/* Fewest arms worth compiling to a jump table */
+#define JANET_JUMP_TABLE_MIN 4
+
+/* Check if a condition matches the pattern (= sym constant), where constant
+ * is a keyword, string, or number. `case` emits these with the function =
+ * itself as the head. */
+static int janetc_check_case_arm(JanetCompiler *c, Janet x, const uint8_t **sym, Janet *key) {
+    if (!janet_checktype(x, JANET_TUPLE)) return 0;
+    const Janet *tup = janet_unwrap_tuple(x);
+    if (3 != janet_tuple_length(tup)) return 0;
+    if (janet_tuple_flag(tup) & JANET_TUPLE_FLAG_BRACKETCTOR) return 0;
+    if (!janet_checktype(tup[1], JANET_SYMBOL)) return 0;
+    if (NULL != *sym && *sym != janet_unwrap_symbol(tup[1])) return 0;
+    switch (janet_type(tup[2])) {
+        default:
+            return 0;
+        case JANET_NUMBER:
+            /* NaN never equals itself, so a NaN arm can not go in the table */
+            if (janet_unwrap_number(tup[2]) != janet_unwrap_number(tup[2])) return 0;
+            break;
+        case JANET_KEYWORD:
+        case JANET_STRING:
+            break;
+    }
+    Janet head = tup[0];
+    if (janet_checktype(head, JANET_SYMBOL)) {
+        if (janet_cstrcmp(janet_unwrap_symbol(head), "=")) return 0;
+        JanetSlot s = janetc_resolve(c, janet_unwrap_symbol(head));
+        if (!(s.flags & JANET_SLOT_CONSTANT)) return 0;
+        head = s.constant;
+    }
+    if (!janet_checktype(head, JANET_FUNCTION)) return 0;
+    if ((janet_unwrap_function(head)->def->flags & JANET_FUNCDEF_FLAG_TAG) != JANET_FUN_EQ) return 0;
+    *sym = janet_unwrap_symbol(tup[1]);
+    *key = tup[2];
+    return 1;
+}
+
+/* Get the arguments of an if form nested in the false branch of another */
+static const Janet *janetc_nested_if(Janet x, int32_t *argn) {
+    if (!janet_checktype(x, JANET_TUPLE)) return NULL;
+    const Janet *tup = janet_unwrap_tuple(x);
+    int32_t len = janet_tuple_length(tup);
+    if (len != 3 && len != 4) return NULL;
+    if (janet_tuple_flag(tup) & JANET_TUPLE_FLAG_BRACKETCTOR) return NULL;
+    if (!janet_checktype(tup[0], JANET_SYMBOL) || janet_cstrcmp(janet_unwrap_symbol(tup[0]), "if")) return NULL;
+    *argn = len - 1;
+    return tup + 1;
+}
+
+/*
+ * A chain of ifs that compare the same symbol to constants, like the
+ * expansion of case, dispatches with a single lookup. The jump table
+ * maps each constant to the index of its jump, and other values take
+ * the first jump to the default.
+ *
+ * jump-table sym {constant 1 ...}
+ * jump :default
+ * jump :arm1
+ * ...
+ * :arm1
+ * ...
+ * jump :done (only if not tail)
+ * ...
+ * :default
+ * ...
+ * :done
+ *
+ * Returns 0 without emitting anything if the chain is too short.
+ */
+static int janetc_case_table(JanetFopts opts, const Janet *argv, int32_t argn, JanetSlot *out) {
+    JanetCompiler *c = opts.compiler;
+    const int tail = opts.flags & JANET_FOPTS_TAIL;
+    const int drop = opts.flags & JANET_FOPTS_DROP;
+    const uint8_t *sym = NULL;
+    const Janet *form = argv;
+    int32_t formlen = argn;
+    Janet key;
+    int32_t arms = 0;
+
+    /* Find the arms, stopping at the first condition that does not match */
+    while (arms < JANET_JUMP_TABLE_MAX && janetc_check_case_arm(c, form[0], &sym, &key)) {
+        arms++;
+        const Janet *next = formlen > 2 ? janetc_nested_if(form[2], &formlen) : NULL;
+        if (NULL == next) break;
+        form = next;
+    }
+    if (arms < JANET_JUMP_TABLE_MIN) return 0;
+
+    JanetScope casescope, tempscope;
+    janetc_scope(&casescope, c, 0, "case");
+    JanetSlot dispatch = janetc_value(janetc_fopts_default(c), janet_wrap_symbol(sym));
+    if (dispatch.flags & JANET_SLOT_CONSTANT) {
+        /* Leave constant dispatch values to if, which folds them */
+        janetc_popscope(c);
+        return 0;
+    }
+
+    /* Number the distinct constants. Only the first arm with a constant can
+     * be taken, as with the chain of ifs. */
+    JanetTable *table = janet_table(arms);
+    form = argv;
+    for (int32_t i = 0; i < arms; i++) {
+        Janet k = janet_unwrap_tuple(form[0])[2];
+        if (janet_checktype(janet_table_get(table, k), JANET_NIL)) {
+            janet_table_put(table, k, janet_wrap_integer(table->count + 1));
+        }
+        if (i + 1 < arms) form = janetc_nested_if(form[2], &formlen);
+    }
+    const JanetKV *lookup = janet_table_to_struct(table);
+    int32_t count = janet_struct_length(lookup);
+
+    JanetSlot target = (drop || tail)
+                       ? janetc_cslot(janet_wrap_nil())
+                       : janetc_gettarget(opts);
+    janetc_emit_sc(c, JOP_JUMP_TABLE, dispatch, janet_wrap_struct(lookup));
+    int32_t labelt = janet_v_count(c->buffer);
+    for (int32_t i = 0; i <= count; i++) janetc_emit(c, JOP_JUMP);
+
+    /* Compile the arms */
+    int32_t *labelsd = NULL;
+    form = argv;
+    formlen = argn;
+    for (int32_t i = 0; i < arms; i++) {
+        Janet k = janet_unwrap_tuple(form[0])[2];
+        int32_t index = janet_unwrap_integer(janet_struct_get(lookup, k));
+        if (c->buffer[labelt + index] != JOP_JUMP) {
+            /* An earlier arm has the same constant */
+            janetc_throwaway(opts, form[1]);
+        } else {
+            int32_t label = janet_v_count(c->buffer);
+            c->buffer[labelt + index] |= (label - labelt - index) << 8;
+            janetc_scope(&tempscope, c, 0, "case-arm");
+            JanetSlot body = janetc_value(opts, form[1]);
+            if (!drop && !tail) janetc_copy(c, target, body);
+            janetc_popscope(c);
+            if (!tail) {
+                janet_v_push(labelsd, janet_v_count(c->buffer));
+                janetc_emit(c, JOP_JUMP);
+            }
+        }
+        if (i + 1 < arms) form = janetc_nested_if(form[2], &formlen);
+    }
+
+    /* Compile the default, which is the false branch of the last if */
+    int32_t labeldefault = janet_v_count(c->buffer);
+    c->buffer[labelt] |= (labeldefault - labelt) << 8;
+    janetc_scope(&tempscope, c, 0, "case-default");
+    JanetSlot fallback = janetc_value(opts, formlen > 2 ? form[2] : janet_wrap_nil());
+    if (!drop && !tail) janetc_copy(c, target, fallback);
+    janetc_popscope(c);
+    janetc_popscope(c);
+
+    int32_t labeld = janet_v_count(c->buffer);
+    for (int32_t i = 0; i < janet_v_count(labelsd); i++) {
+        c->buffer[labelsd[i]] |= (labeld - labelsd[i]) << 8;
+    }
+    janet_v_free(labelsd);
+
+    if (tail) target.flags |= JANET_SLOT_RETURNED;
+    *out = target;
+    return 1;
+}
+
 /*
  * :condition
  * ...
@@ -476,6 +645,9 @@ static JanetSlot janetc_if(JanetFopts opts, int32_t argn, const Janet *argv) {
     truebody = argv[1];
     falsebody = argn > 2 ? argv[2] : janet_wrap_nil();
 
+    /* Dispatch on constants with a jump table */
+    if (janetc_case_table(opts, argv, argn, &target)) return target;
+
     /* Get options */
     condopts = janetc_fopts_default(c);
     bodyopts = opts;
@@ -736,8 +908,8 @@ static JanetSlot janetc_while(JanetFopts opts, int32_t argn, const Janet *argv)
         janetc_freeslot(c, janetc_value(subopts, argv[i]));
     }
 
-    /* Check if closure created in while scope. If so,
-     * recompile in a function scope. */
+    /* Check if a closure captured a var created in the while scope. If so,
+     * recompile in a function scope so each iteration gets its own var. */
     if (tempscope.flags & JANET_SCOPE_CLOSURE) {
         subopts = janetc_fopts_default(c);
         tempscope.flags |= JANET_SCOPE_UNUSED;
@@ -773,7 +945,6 @@ static JanetSlot janetc_while(JanetFopts opts, int32_t argn, const Janet *argv)
         janetc_emit(c, JOP_CLOSURE | (cloreg << 8) | (defindex << 16));
         janetc_emit(c, JOP_CALL | (cloreg << 8) | (cloreg << 16));
         janetc_regalloc_freetemp(&c->scope->ra, cloreg, JANETC_REGTEMP_0);
-        c->scope->flags |= JANET_SCOPE_CLOSURE;
         return janetc_cslot(janet_wrap_nil());
     }
 
@@ -819,7 +990,6 @@ static JanetSlot janetc_fn(JanetFopts opts, int32_t argn, const Janet *argv) {
     int seenopt = 0;
 
     /* Begin function */
-    c->scope->flags |= JANET_SCOPE_CLOSURE;
     janetc_scope(&fnscope, c, JANET_SCOPE_FUNCTION, "function");
 
     if (argn == 0) {
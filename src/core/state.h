@@ -46,13 +46,100 @@ typedef struct {
     void *data;
 } JanetQueue;
 
+/* Growable list of gc objects, used for the remembered set */
 typedef struct {
+    JanetGCObject **items;
+    size_t count;
+    size_t capacity;
+} JanetGCList;
+
+/* Number of size classes used for pooled allocation of small gc objects */
+#define JANET_GC_POOL_COUNT 7
+
+/* Number of capacity buckets for pooled fiber stacks, and stacks kept per bucket */
+#define JANET_FIBER_POOL_BUCKETS 8
+#define JANET_FIBER_POOL_MAX 64
+
+/* Free cells and bump allocation region for one size class */
+typedef struct {
+    JanetGCObject *free;
+    char *cursor;
+    char *end;
+} JanetGCPool;
+
+/* Number of inline cache entries, must be a power of 2 */
+#define JANET_ICACHE_SIZE 1024
+
+/* Where a key was last found by the lookup instruction at pc - the index of the slot
+ * holding it, in the table or struct level prototypes up from the one looked in. */
+typedef struct {
+    const uint32_t *pc;
+    int32_t level;
+    int32_t index;
+} JanetInlineCache;
+
+/* Deepest stack recorded by the sampling profiler. Outer frames past this are dropped. */
+#define JANET_PROFILE_MAX_DEPTH 32
+
+/* A stack frame recorded by the sampling profiler. The cfunction is only set if def is NULL. */
+typedef struct {
+    JanetFuncDef *def;
+    JanetCFunction cfun;
+    int32_t pc;
+} JanetProfileFrame;
+
+/* A sampled stack, innermost frame first */
+typedef struct {
+    int32_t depth;
+    int32_t truncated;
+    JanetProfileFrame frames[JANET_PROFILE_MAX_DEPTH];
+} JanetProfileSample;
+
+typedef struct JanetTimeout JanetTimeout;
+struct JanetTimeout {
     JanetTimestamp when;
     JanetFiber *fiber;
     JanetFiber *curr_fiber;
     uint32_t sched_id;
     int is_error;
-} JanetTimeout;
+    /* Timing wheel slot list */
+    JanetTimeout *next;
+    JanetTimeout **pprev;
+    int32_t slot;
+};
+
+/* Hierarchical timing wheel for event loop timeouts, see ev.c */
+#define JANET_TW_BITS 6
+#define JANET_TW_SLOTS (1 << JANET_TW_BITS)
+#define JANET_TW_LEVELS 4
+typedef struct {
+    JanetTimestamp now; /* Next tick to process */
+    uint64_t occupied[JANET_TW_LEVELS];
+    JanetTimeout *slots[JANET_TW_LEVELS * JANET_TW_SLOTS];
+    JanetTimeout *expired;
+    JanetTimeout *expired_tail;
+    JanetTimeout *free_list;
+    size_t deadlines;
+} JanetTimerWheel;
+
+/* Value of auto_suspend for a time slice request, see ev/time-slice */
+#define JANET_SUSPEND_SLICE 2
+
+/* Run queues of the event loop, one per fiber priority, highest first */
+#define JANET_EV_PRIORITIES 3
+
+/* Event loop statistics, see ev/stats. The run histogram counts loop iterations
+ * by the time spent running fibers between polls, in power of two buckets of
+ * microseconds. */
+#define JANET_EV_RUN_BUCKETS 24
+typedef struct {
+    uint64_t iterations;
+    uint64_t resumes;
+    uint64_t slow_resumes;
+    uint64_t preemptions;
+    uint64_t run_hist[JANET_EV_RUN_BUCKETS];
+    double run_time_max;
+} JanetEVStats;
 
 /* Registry table for C functions - containts metadata that can
  * be looked up by cfunction pointer. All strings here are pointing to
@@ -84,6 +171,35 @@ struct JanetVM {
      * When this occurs, this flag will be reset to 0. */
     int auto_suspend;
 
+    /* Time slicing for the event loop. A time slice thread sets auto_suspend to
+     * JANET_SUSPEND_SLICE, which only suspends while the vm is at slice_depth, the
+     * resume depth of the fiber the event loop is running. Fibers are therefore never
+     * preempted inside janet_call or inside a fiber resumed from C. */
+    int32_t resume_depth;
+    volatile int32_t slice_depth;
+    int slice_preempted;
+
+    /* Set by the profiler thread to request a stack sample the next time the vm
+     * checks auto_suspend. Taking the sample resets it, and does not suspend the vm.
+     * Samples are kept in a ring buffer, oldest replaced first. */
+    int profile_request;
+    void *profiler;
+    JanetProfileSample *profile_samples;
+    size_t profile_capacity;
+    size_t profile_count;
+    size_t profile_next;
+
+    /* Structured trace events of the kinds in trace_mask. The vm is the only writer of
+     * the ring, and a single reader, possibly on another thread, drains it with
+     * janet_trace_drain. Events are dropped rather than replaced when the ring is full,
+     * so the vm never writes to a slot that is being read. */
+    uint32_t trace_mask;
+    JanetTraceEvent *trace_events;
+    size_t trace_capacity;
+    volatile int64_t trace_head;
+    volatile int64_t trace_tail;
+    size_t trace_dropped;
+
     /* The current running fiber on the current thread.
      * Set and unset by janet_run. */
     JanetFiber *fiber;
@@ -112,13 +228,77 @@ struct JanetVM {
     uint32_t cache_deleted;
     uint8_t gensym_counter[8];
 
+    /* Inline caches for lookups in the vm, indexed by a hash of the instruction address */
+    JanetInlineCache *icache;
+
+#ifdef JANET_OPCODE_STATS
+    /* Dispatch counts per opcode, and per pair of opcodes indexed by
+     * first * JOP_INSTRUCTION_COUNT + second. Both live in one allocation. */
+    uint64_t *opcode_counts;
+    uint64_t *opcode_pairs;
+    uint32_t opcode_last;
+#endif
+
     /* Garbage collection */
     void *blocks;
+    void *old_blocks; /* First block of the old generation. Everything before it in blocks is young. */
     size_t gc_interval;
     size_t next_collection;
     size_t block_count;
+    size_t old_block_count; /* Number of blocks alive after the last collection */
+    size_t major_block_limit; /* Do a full collection when the old generation grows past this */
     int gc_suspend;
 
+    /* Old objects that may reference young objects. The remembered set is filled
+     * by the write barrier and cleared after every collection. The rescan set holds
+     * old fibers and abstract types with gcmark, which are mutated without a barrier
+     * and so are always scanned during minor collections. */
+    JanetGCList gc_remembered;
+    JanetGCList gc_rescan;
+
+    /* Buffers borrowed with janet_buffer_borrow_scope, innermost last */
+    JanetGCList buffer_borrows;
+
+    /* Size class pools for small gc objects. Chunks are kept in a linked list and only
+     * released when the VM is deinitialized. */
+    JanetGCPool gc_pools[JANET_GC_POOL_COUNT];
+    void *gc_pool_chunks;
+
+    /* Stacks of collected fibers, kept for reuse by new fibers. Bucket i holds up to
+     * JANET_FIBER_POOL_MAX stacks with a capacity of at least 32 << i slots. */
+    void *fiber_pool[JANET_FIBER_POOL_BUCKETS];
+    int32_t fiber_pool_count[JANET_FIBER_POOL_BUCKETS];
+
+    /* Incremental collection. A step budget of 0 disables incremental collection. The
+     * cursor is the next block to clear, or the last block swept, depending on the phase. */
+    int gc_phase;
+    size_t gc_step_budget;
+    JanetGCList gc_gray;
+    JanetGCObject *gc_cursor;
+
+    /* GC statistics, and memory freed by the sweep in progress */
+    JanetGCStats gc_stats;
+    size_t gc_freed_blocks;
+    size_t gc_freed_bytes;
+    JanetGCHook gc_hook;
+    void *gc_hook_data;
+
+    /* Blocks allocated while an arena fiber runs. The fiber that owns the arena is the
+     * outermost running fiber with JANET_FIBER_ARENA. The tail is the oldest block. */
+    JanetFiber *gc_arena_fiber;
+    JanetGCObject *gc_arena;
+    JanetGCObject *gc_arena_tail;
+    size_t gc_arena_count;
+
+    /* Allocation site sampling. One in every gc_sample_rate allocations is recorded,
+     * up to JANET_GC_SAMPLE_MAX samples, after which the oldest samples are replaced. */
+    size_t gc_sample_rate;
+    size_t gc_sample_countdown;
+    JanetGCSample *gc_samples;
+    size_t gc_sample_count;
+    size_t gc_sample_capacity;
+    size_t gc_sample_next;
+
     /* GC roots */
     Janet *roots;
     size_t root_count;
@@ -137,18 +317,31 @@ struct JanetVM {
     JanetTraversalNode *traversal_top;
     JanetTraversalNode *traversal_base;
 
+    /* Empty bucket returned when a key is missing from a small struct, which has no empty buckets */
+    JanetKV missing_kv;
+
     /* Event loop and scheduler globals */
 #ifdef JANET_EV
     size_t tq_count;
-    size_t tq_capacity;
-    JanetQueue spawn;
-    JanetTimeout *tq;
+    JanetQueue spawn[JANET_EV_PRIORITIES];
+    int32_t spawn_streak[JANET_EV_PRIORITIES]; /* Tasks taken from a queue since the one below it was served */
+    volatile int32_t slice_epoch; /* Bumped on every resume, watched by the time slice thread */
+    void *slicer;
+    JanetTimerWheel tw;
     JanetRNG ev_rng;
     JanetListenerState **listeners;
     size_t listener_count;
     size_t listener_cap;
     size_t extra_listeners;
     JanetTable threaded_abstracts; /* All abstract types that can be shared between threads (used in this thread) */
+    JanetEVStats ev_stats;
+    size_t threaded_pending; /* Threaded calls whose callback has not run yet */
+    double ev_slow_threshold;
+    Janet ev_slow_hook; /* Called when one fiber resume takes at least ev_slow_threshold seconds */
+#ifndef JANET_WINDOWS
+    void *volatile inbox; /* Events posted by other threads, drained after a self-pipe wakeup */
+    volatile int32_t inbox_signaled; /* Set while a wakeup is in the self-pipe */
+#endif
 #ifdef JANET_WINDOWS
     void **iocp;
 #elif defined(JANET_EV_EPOLL)
@@ -156,6 +349,9 @@ struct JanetVM {
     int epoll;
     int timerfd;
     int timer_enabled;
+#elif defined(JANET_EV_URING)
+    JanetHandle selfpipe[2];
+    struct JanetUring *uring;
 #elif defined(JANET_EV_KQUEUE)
     JanetHandle selfpipe[2];
     int kq;
@@ -167,6 +363,12 @@ struct JanetVM {
 #endif
 #endif
 
+    /* Networking globals */
+#ifdef JANET_NET
+    JanetTable *dns_cache; /* Results of recent name lookups, kept for dns_ttl seconds */
+    double dns_ttl;
+#endif
+
 };
 
 extern JANET_THREAD_LOCAL JanetVM janet_vm;
@@ -26,10 +26,15 @@
 #include "gc.h"
 #include "util.h"
 #include "state.h"
+#include "vector.h"
 #endif
 
 #include <string.h>
 
+#ifdef JANET_SSE2
+#include <emmintrin.h>
+#endif
+
 /* Begin building a string */
 uint8_t *janet_string_begin(int32_t length) {
     JanetStringHead *head = janet_gcalloc(JANET_MEMORY_STRING, sizeof(JanetStringHead) + (size_t) length + 1);
@@ -89,57 +94,65 @@ const uint8_t *janet_cstring(const char *str) {
     return janet_string((const uint8_t *)str, (int32_t)strlen(str));
 }
 
-/* Knuth Morris Pratt Algorithm */
+/* Substring search. Candidate positions are found by matching the first
+ * and last bytes of the pattern, 16 positions at a time with SSE2 or with
+ * memchr otherwise, and then checked with memcmp. Inputs that produce many
+ * false candidates, such as long runs of one byte, switch to Knuth Morris
+ * Pratt so a search stays linear in the length of the text. */
 
-struct kmp_state {
+struct search_state {
     int32_t i;
     int32_t j;
     int32_t textlen;
     int32_t patlen;
     int32_t *lookup;
+    int64_t work;
     const uint8_t *text;
     const uint8_t *pat;
 };
 
-static void kmp_init(
-    struct kmp_state *s,
+#ifdef JANET_SSE2
+#ifdef __GNUC__
+#define search_bit(mask) ((int32_t) __builtin_ctz(mask))
+#else
+static int32_t search_bit(uint32_t mask) {
+    int32_t bit = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        bit++;
+    }
+    return bit;
+}
+#endif
+#endif
+
+static void search_init(
+    struct search_state *s,
     const uint8_t *text, int32_t textlen,
     const uint8_t *pat, int32_t patlen) {
     if (patlen == 0) {
         janet_panic("expected non-empty pattern");
     }
-    int32_t *lookup = janet_calloc(patlen, sizeof(int32_t));
-    if (!lookup) {
-        JANET_OUT_OF_MEMORY;
-    }
-    s->lookup = lookup;
+    s->lookup = NULL;
+    s->work = 0;
     s->i = 0;
     s->j = 0;
     s->text = text;
     s->pat = pat;
     s->textlen = textlen;
     s->patlen = patlen;
-    /* Init state machine */
-    {
-        int32_t i, j;
-        for (i = 1, j = 0; i < patlen; i++) {
-            while (j && pat[j] != pat[i]) j = lookup[j - 1];
-            if (pat[j] == pat[i]) j++;
-            lookup[i] = j;
-        }
-    }
 }
 
-static void kmp_deinit(struct kmp_state *state) {
+static void search_deinit(struct search_state *state) {
     janet_free(state->lookup);
 }
 
-static void kmp_seti(struct kmp_state *state, int32_t i) {
+static void search_seti(struct search_state *state, int32_t i) {
     state->i = i;
     state->j = 0;
 }
 
-static int32_t kmp_next(struct kmp_state *state) {
+static int32_t kmp_next(struct search_state *state) {
     int32_t i = state->i;
     int32_t j = state->j;
     int32_t textlen = state->textlen;
@@ -168,6 +181,298 @@ static int32_t kmp_next(struct kmp_state *state) {
     return -1;
 }
 
+/* Build the Knuth Morris Pratt table and continue the search from i */
+static int32_t kmp_fallback(struct search_state *s, int32_t i) {
+    const uint8_t *pat = s->pat;
+    int32_t patlen = s->patlen;
+    int32_t *lookup = janet_calloc(patlen, sizeof(int32_t));
+    if (!lookup) {
+        JANET_OUT_OF_MEMORY;
+    }
+    for (int32_t k = 1, j = 0; k < patlen; k++) {
+        while (j && pat[j] != pat[k]) j = lookup[j - 1];
+        if (pat[j] == pat[k]) j++;
+        lookup[k] = j;
+    }
+    s->lookup = lookup;
+    search_seti(s, i);
+    return kmp_next(s);
+}
+
+/* Check a candidate whose first and last bytes match. Gives up on
+ * candidates once memcmp has done much more work than the scan. */
+#define SEARCH_CANDIDATE(p) do { \
+    if (s->work > 2 * (int64_t)(p) + 4096) return kmp_fallback(s, (p)); \
+    s->work += m; \
+    if (!memcmp(text + (p) + 1, pat + 1, (size_t)(m - 2))) { \
+        s->i = (p) + 1; \
+        return (p); \
+    } \
+} while (0)
+
+static int32_t search_next(struct search_state *s) {
+    if (s->lookup) return kmp_next(s);
+    const uint8_t *text = s->text;
+    const uint8_t *pat = s->pat;
+    int32_t m = s->patlen;
+    int32_t n = s->textlen;
+    int32_t i = s->i;
+    if (m > n || i > n - m) {
+        s->i = n;
+        return -1;
+    }
+    if (m == 1) {
+        const uint8_t *found = memchr(text + i, pat[0], (size_t)(n - i));
+        if (NULL == found) {
+            s->i = n;
+            return -1;
+        }
+        s->i = (int32_t)(found - text) + 1;
+        return s->i - 1;
+    }
+    int32_t last = n - m;
+#ifdef JANET_SSE2
+    __m128i first_byte = _mm_set1_epi8((char) pat[0]);
+    __m128i last_byte = _mm_set1_epi8((char) pat[m - 1]);
+    for (; i + 15 <= last; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(text + i + m - 1));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(
+                            _mm_and_si128(_mm_cmpeq_epi8(a, first_byte), _mm_cmpeq_epi8(b, last_byte)));
+        while (mask) {
+            int32_t p = i + search_bit(mask);
+            SEARCH_CANDIDATE(p);
+            mask &= mask - 1;
+        }
+    }
+#endif
+    while (i <= last) {
+        const uint8_t *found = memchr(text + i, pat[0], (size_t)(last - i + 1));
+        if (NULL == found) break;
+        int32_t p = (int32_t)(found - text);
+        if (text[p + m - 1] == pat[m - 1]) SEARCH_CANDIDATE(p);
+        i = p + 1;
+    }
+    s->i = n;
+    return -1;
+}
+
+#undef SEARCH_CANDIDATE
+
+/* Multi-pattern search with an Aho-Corasick automaton. Bytes that appear in
+ * no needle share one class, so the transition table has one column per
+ * distinct needle byte rather than 256. out[state] is the first state on the
+ * fail chain of state that ends a needle, and link[state] is the next one
+ * after that, so all needles ending at a position can be listed. */
+
+typedef struct {
+    int32_t *table;
+    int32_t *out;
+    int32_t *link;
+    int32_t *needle;
+    int32_t nstates;
+    int32_t nclasses;
+    int32_t maxlen;
+    const Janet *needles;
+    uint8_t classes[256];
+} JanetSearcher;
+
+static int searcher_gc(void *p, size_t size) {
+    (void) size;
+    JanetSearcher *s = (JanetSearcher *) p;
+    janet_free(s->table);
+    janet_free(s->out);
+    janet_free(s->link);
+    janet_free(s->needle);
+    return 0;
+}
+
+static int searcher_gcmark(void *p, size_t size) {
+    (void) size;
+    JanetSearcher *s = (JanetSearcher *) p;
+    if (s->needles) janet_mark(janet_wrap_tuple(s->needles));
+    return 0;
+}
+
+static void searcher_build(JanetSearcher *s) {
+    const Janet *needles = s->needles;
+    int32_t count = janet_tuple_length(needles);
+    memset(s->classes, 0, sizeof(s->classes));
+    size_t total = 1;
+    s->maxlen = 0;
+    for (int32_t i = 0; i < count; i++) {
+        const uint8_t *str = janet_unwrap_string(needles[i]);
+        int32_t len = janet_string_length(str);
+        for (int32_t j = 0; j < len; j++) s->classes[str[j]] = 1;
+        if (len > s->maxlen) s->maxlen = len;
+        total += (size_t) len;
+    }
+    int32_t nclasses = 1;
+    for (int b = 0; b < 256; b++) {
+        if (s->classes[b]) s->classes[b] = (uint8_t) nclasses++;
+    }
+    if (total * (size_t) nclasses > INT32_MAX) janet_panic("needles too large");
+    int32_t *table = janet_calloc(total * (size_t) nclasses, sizeof(int32_t));
+    int32_t *out = janet_malloc(total * sizeof(int32_t));
+    int32_t *link = janet_malloc(total * sizeof(int32_t));
+    int32_t *needle = janet_malloc(total * sizeof(int32_t));
+    int32_t *fail = janet_malloc(total * sizeof(int32_t));
+    int32_t *queue = janet_malloc(total * sizeof(int32_t));
+    if (!table || !out || !link || !needle || !fail || !queue) {
+        JANET_OUT_OF_MEMORY;
+    }
+    s->table = table;
+    s->out = out;
+    s->link = link;
+    s->needle = needle;
+    s->nclasses = nclasses;
+
+    /* Build the trie. No trie edge points back to the root, so 0 marks a
+     * missing edge. The first of several equal needles wins. */
+    int32_t nstates = 1;
+    needle[0] = -1;
+    for (int32_t i = 0; i < count; i++) {
+        const uint8_t *str = janet_unwrap_string(needles[i]);
+        int32_t len = janet_string_length(str);
+        int32_t state = 0;
+        for (int32_t j = 0; j < len; j++) {
+            int32_t *edge = table + (size_t) state * nclasses + s->classes[str[j]];
+            if (!*edge) {
+                needle[nstates] = -1;
+                *edge = nstates++;
+            }
+            state = *edge;
+        }
+        if (needle[state] < 0) needle[state] = i;
+    }
+    s->nstates = nstates;
+
+    /* Breadth first, fill in fail links and complete the transition table,
+     * so a search takes exactly one transition per byte. */
+    int32_t head = 0, tail = 0;
+    fail[0] = 0;
+    out[0] = -1;
+    link[0] = -1;
+    for (int32_t c = 0; c < nclasses; c++) {
+        int32_t child = table[c];
+        if (child) {
+            fail[child] = 0;
+            queue[tail++] = child;
+        }
+    }
+    while (head < tail) {
+        int32_t state = queue[head++];
+        int32_t f = fail[state];
+        link[state] = out[f];
+        out[state] = needle[state] >= 0 ? state : link[state];
+        int32_t *row = table + (size_t) state * nclasses;
+        const int32_t *frow = table + (size_t) f * nclasses;
+        for (int32_t c = 0; c < nclasses; c++) {
+            if (row[c]) {
+                fail[row[c]] = frow[c];
+                queue[tail++] = row[c];
+            } else {
+                row[c] = frow[c];
+            }
+        }
+    }
+    janet_free(fail);
+    janet_free(queue);
+}
+
+static void searcher_marshal(void *p, JanetMarshalContext *ctx) {
+    JanetSearcher *s = (JanetSearcher *) p;
+    janet_marshal_abstract(ctx, p);
+    janet_marshal_janet(ctx, janet_wrap_tuple(s->needles));
+}
+
+static void searcher_clear(JanetSearcher *s) {
+    s->table = NULL;
+    s->out = NULL;
+    s->link = NULL;
+    s->needle = NULL;
+    s->needles = NULL;
+}
+
+static void *searcher_unmarshal(JanetMarshalContext *ctx) {
+    JanetSearcher *s = janet_unmarshal_abstract(ctx, sizeof(JanetSearcher));
+    searcher_clear(s);
+    Janet needles = janet_unmarshal_janet(ctx);
+    if (!janet_checktype(needles, JANET_TUPLE)) janet_panic("expected tuple of needles");
+    const Janet *tup = janet_unwrap_tuple(needles);
+    for (int32_t i = 0; i < janet_tuple_length(tup); i++) {
+        if (!janet_checktype(tup[i], JANET_STRING) || !janet_string_length(janet_unwrap_string(tup[i])))
+            janet_panic("expected non-empty string needle");
+    }
+    s->needles = tup;
+    searcher_build(s);
+    return s;
+}
+
+static const JanetAbstractType janet_searcher_type = {
+    "core/searcher",
+    searcher_gc,
+    searcher_gcmark,
+    NULL,
+    NULL,
+    searcher_marshal,
+    searcher_unmarshal,
+    JANET_ATEND_UNMARSHAL
+};
+
+/* Find the leftmost match at or after start, preferring the longest needle
+ * at that position. Returns the position, and the needle in *which. */
+static int32_t searcher_first(const JanetSearcher *s, const uint8_t *text, int32_t len,
+                              int32_t start, int32_t *which) {
+    int32_t state = 0;
+    int32_t best = -1;
+    int32_t bestlen = 0;
+    for (int32_t i = start; i < len; i++) {
+        /* Once past best + maxlen, later matches can only start after best */
+        if (best >= 0 && i >= best + s->maxlen) break;
+        state = s->table[(size_t) state * s->nclasses + s->classes[text[i]]];
+        for (int32_t m = s->out[state]; m >= 0; m = s->link[m]) {
+            int32_t n = s->needle[m];
+            int32_t nlen = janet_string_length(janet_unwrap_string(s->needles[n]));
+            int32_t pos = i - nlen + 1;
+            if (best < 0 || pos < best || (pos == best && nlen > bestlen)) {
+                best = pos;
+                bestlen = nlen;
+                *which = n;
+            }
+        }
+    }
+    return best;
+}
+
+static int searcher_cmp(const void *a, const void *b) {
+    int32_t x = *(const int32_t *) a;
+    int32_t y = *(const int32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Find every match at or after start, including overlapping ones. Returns
+ * a scratch vector of positions in ascending order. */
+static int32_t *searcher_all(const JanetSearcher *s, const uint8_t *text, int32_t len,
+                             int32_t start) {
+    int32_t *positions = NULL;
+    int32_t state = 0;
+    int sorted = 1;
+    for (int32_t i = start; i < len; i++) {
+        state = s->table[(size_t) state * s->nclasses + s->classes[text[i]]];
+        for (int32_t m = s->out[state]; m >= 0; m = s->link[m]) {
+            int32_t nlen = janet_string_length(janet_unwrap_string(s->needles[s->needle[m]]));
+            int32_t pos = i - nlen + 1;
+            if (janet_v_count(positions) && pos < janet_v_last(positions)) sorted = 0;
+            janet_v_push(positions, pos);
+        }
+    }
+    if (!sorted) {
+        qsort(positions, (size_t) janet_v_count(positions), sizeof(int32_t), searcher_cmp);
+    }
+    return positions;
+}
+
 /* CFuns */
 
 JANET_CORE_FN(cfun_string_slice,
@@ -293,7 +598,7 @@ JANET_CORE_FN(cfun_string_reverse,
     return janet_wrap_string(janet_string_end(buf));
 }
 
-static void findsetup(int32_t argc, Janet *argv, struct kmp_state *s, int32_t extra) {
+static void findsetup(int32_t argc, Janet *argv, struct search_state *s, int32_t extra) {
     janet_arity(argc, 2, 3 + extra);
     JanetByteView pat = janet_getbytes(argv, 0);
     JanetByteView text = janet_getbytes(argv, 1);
@@ -302,20 +607,75 @@ static void findsetup(int32_t argc, Janet *argv, struct kmp_state *s, int32_t ex
         start = janet_getinteger(argv, 2);
         if (start < 0) janet_panic("expected non-negative start index");
     }
-    kmp_init(s, text.bytes, text.len, pat.bytes, pat.len);
+    search_init(s, text.bytes, text.len, pat.bytes, pat.len);
     s->i = start;
 }
 
+static JanetSearcher *searcher_setup(int32_t argc, Janet *argv, JanetByteView *text, int32_t *start) {
+    janet_arity(argc, 2, 3);
+    JanetSearcher *s = janet_getabstract(argv, 0, &janet_searcher_type);
+    *text = janet_getbytes(argv, 1);
+    *start = 0;
+    if (argc >= 3) {
+        *start = janet_getinteger(argv, 2);
+        if (*start < 0) janet_panic("expected non-negative start index");
+    }
+    return s;
+}
+
+JANET_CORE_FN(cfun_string_searcher,
+              "(string/searcher & needles)",
+              "Compile byte sequences into a searcher that finds any of them in a single "
+              "pass over a string. A searcher can be used in place of patt in "
+              "`string/find` and `string/find-all`, and with `string/search`.") {
+    Janet *needles = janet_tuple_begin(argc);
+    for (int32_t i = 0; i < argc; i++) {
+        JanetByteView needle = janet_getbytes(argv, i);
+        if (needle.len == 0) janet_panic("expected non-empty needle");
+        needles[i] = janet_checktype(argv[i], JANET_STRING)
+                     ? argv[i]
+                     : janet_stringv(needle.bytes, needle.len);
+    }
+    JanetSearcher *s = janet_abstract(&janet_searcher_type, sizeof(JanetSearcher));
+    searcher_clear(s);
+    s->needles = janet_tuple_end(needles);
+    searcher_build(s);
+    return janet_wrap_abstract(s);
+}
+
+JANET_CORE_FN(cfun_string_search,
+              "(string/search searcher str &opt start-index)",
+              "Find the first match of any needle of searcher in str. Returns a tuple "
+              "of the index of the match and the needle that matched, or nil if no needle "
+              "is found. If several needles match at the same index, the longest is returned.") {
+    JanetByteView text;
+    int32_t start, which = -1;
+    JanetSearcher *s = searcher_setup(argc, argv, &text, &start);
+    int32_t result = searcher_first(s, text.bytes, text.len, start, &which);
+    if (result < 0) return janet_wrap_nil();
+    Janet tup[2] = {janet_wrap_integer(result), s->needles[which]};
+    return janet_wrap_tuple(janet_tuple_n(tup, 2));
+}
+
 JANET_CORE_FN(cfun_string_find,
               "(string/find patt str &opt start-index)",
               "Searches for the first instance of pattern patt in string "
               "str. Returns the index of the first character in patt if found, "
-              "otherwise returns nil.") {
+              "otherwise returns nil. patt may also be a searcher from `string/searcher`, "
+              "which finds the first instance of any of its needles.") {
     int32_t result;
-    struct kmp_state state;
+    struct search_state state;
+    janet_arity(argc, 2, 3);
+    if (janet_checkabstract(argv[0], &janet_searcher_type)) {
+        JanetByteView text;
+        int32_t start, which;
+        JanetSearcher *s = searcher_setup(argc, argv, &text, &start);
+        result = searcher_first(s, text.bytes, text.len, start, &which);
+        return result < 0 ? janet_wrap_nil() : janet_wrap_integer(result);
+    }
     findsetup(argc, argv, &state, 0);
-    result = kmp_next(&state);
-    kmp_deinit(&state);
+    result = search_next(&state);
+    search_deinit(&state);
     return result < 0
            ? janet_wrap_nil()
            : janet_wrap_integer(result);
@@ -350,20 +710,36 @@ JANET_CORE_FN(cfun_string_findall,
               "Searches for all instances of pattern patt in string "
               "str. Returns an array of all indices of found patterns. Overlapping "
               "instances of the pattern are counted individually, meaning a byte in str "
-              "may contribute to multiple found patterns.") {
+              "may contribute to multiple found patterns. patt may also be a searcher from "
+              "`string/searcher`, in which case an index appears once for each needle that "
+              "matches there.") {
     int32_t result;
-    struct kmp_state state;
+    struct search_state state;
+    janet_arity(argc, 2, 3);
+    if (janet_checkabstract(argv[0], &janet_searcher_type)) {
+        JanetByteView text;
+        int32_t start;
+        JanetSearcher *s = searcher_setup(argc, argv, &text, &start);
+        int32_t *positions = searcher_all(s, text.bytes, text.len, start);
+        JanetArray *array = janet_array(janet_v_count(positions));
+        for (int32_t i = 0; i < janet_v_count(positions); i++) {
+            array->data[i] = janet_wrap_integer(positions[i]);
+        }
+        array->count = janet_v_count(positions);
+        janet_v_free(positions);
+        return janet_wrap_array(array);
+    }
     findsetup(argc, argv, &state, 0);
     JanetArray *array = janet_array(0);
-    while ((result = kmp_next(&state)) >= 0) {
+    while ((result = search_next(&state)) >= 0) {
         janet_array_push(array, janet_wrap_integer(result));
     }
-    kmp_deinit(&state);
+    search_deinit(&state);
     return janet_wrap_array(array);
 }
 
 struct replace_state {
-    struct kmp_state kmp;
+    struct search_state search;
     const uint8_t *subst;
     int32_t substlen;
 };
@@ -378,8 +754,8 @@ static void replacesetup(int32_t argc, Janet *argv, struct replace_state *s) {
         start = janet_getinteger(argv, 3);
         if (start < 0) janet_panic("expected non-negative start index");
     }
-    kmp_init(&s->kmp, text.bytes, text.len, pat.bytes, pat.len);
-    s->kmp.i = start;
+    search_init(&s->search, text.bytes, text.len, pat.bytes, pat.len);
+    s->search.i = start;
     s->subst = subst.bytes;
     s->substlen = subst.len;
 }
@@ -392,18 +768,18 @@ JANET_CORE_FN(cfun_string_replace,
     struct replace_state s;
     uint8_t *buf;
     replacesetup(argc, argv, &s);
-    result = kmp_next(&s.kmp);
+    result = search_next(&s.search);
     if (result < 0) {
-        kmp_deinit(&s.kmp);
-        return janet_stringv(s.kmp.text, s.kmp.textlen);
+        search_deinit(&s.search);
+        return janet_stringv(s.search.text, s.search.textlen);
     }
-    buf = janet_string_begin(s.kmp.textlen - s.kmp.patlen + s.substlen);
-    safe_memcpy(buf, s.kmp.text, result);
+    buf = janet_string_begin(s.search.textlen - s.search.patlen + s.substlen);
+    safe_memcpy(buf, s.search.text, result);
     safe_memcpy(buf + result, s.subst, s.substlen);
     safe_memcpy(buf + result + s.substlen,
-                s.kmp.text + result + s.kmp.patlen,
-                s.kmp.textlen - result - s.kmp.patlen);
-    kmp_deinit(&s.kmp);
+                s.search.text + result + s.search.patlen,
+                s.search.textlen - result - s.search.patlen);
+    search_deinit(&s.search);
     return janet_wrap_string(janet_string_end(buf));
 }
 
@@ -417,17 +793,17 @@ JANET_CORE_FN(cfun_string_replaceall,
     JanetBuffer b;
     int32_t lastindex = 0;
     replacesetup(argc, argv, &s);
-    janet_buffer_init(&b, s.kmp.textlen);
-    while ((result = kmp_next(&s.kmp)) >= 0) {
-        janet_buffer_push_bytes(&b, s.kmp.text + lastindex, result - lastindex);
+    janet_buffer_init(&b, s.search.textlen);
+    while ((result = search_next(&s.search)) >= 0) {
+        janet_buffer_push_bytes(&b, s.search.text + lastindex, result - lastindex);
         janet_buffer_push_bytes(&b, s.subst, s.substlen);
-        lastindex = result + s.kmp.patlen;
-        kmp_seti(&s.kmp, lastindex);
+        lastindex = result + s.search.patlen;
+        search_seti(&s.search, lastindex);
     }
-    janet_buffer_push_bytes(&b, s.kmp.text + lastindex, s.kmp.textlen - lastindex);
+    janet_buffer_push_bytes(&b, s.search.text + lastindex, s.search.textlen - lastindex);
     const uint8_t *ret = janet_string(b.data, b.count);
     janet_buffer_deinit(&b);
-    kmp_deinit(&s.kmp);
+    search_deinit(&s.search);
     return janet_wrap_string(ret);
 }
 
@@ -440,22 +816,22 @@ JANET_CORE_FN(cfun_string_split,
               "of limit results (if provided).") {
     int32_t result;
     JanetArray *array;
-    struct kmp_state state;
+    struct search_state state;
     int32_t limit = -1, lastindex = 0;
     if (argc == 4) {
         limit = janet_getinteger(argv, 3);
     }
     findsetup(argc, argv, &state, 1);
     array = janet_array(0);
-    while ((result = kmp_next(&state)) >= 0 && --limit) {
+    while ((result = search_next(&state)) >= 0 && --limit) {
         const uint8_t *slice = janet_string(state.text + lastindex, result - lastindex);
         janet_array_push(array, janet_wrap_string(slice));
         lastindex = result + state.patlen;
-        kmp_seti(&state, lastindex);
+        search_seti(&state, lastindex);
     }
     const uint8_t *slice = janet_string(state.text + lastindex, state.textlen - lastindex);
     janet_array_push(array, janet_wrap_string(slice));
-    kmp_deinit(&state);
+    search_deinit(&state);
     return janet_wrap_array(array);
 }
 
@@ -531,14 +907,23 @@ JANET_CORE_FN(cfun_string_join,
 JANET_CORE_FN(cfun_string_format,
               "(string/format format & values)",
               "Similar to snprintf, but specialized for operating with Janet values. Returns "
-              "a new string.") {
+              "a new string. The format can be a string or a format compiled by format/compile.") {
     janet_arity(argc, 1, -1);
     JanetBuffer *buffer = janet_buffer(0);
-    const char *strfrmt = (const char *) janet_getstring(argv, 0);
-    janet_buffer_format(buffer, strfrmt, 0, argc, argv);
+    janet_buffer_format_value(buffer, 0, argc, argv);
     return janet_stringv(buffer->data, buffer->count);
 }
 
+JANET_CORE_FN(cfun_format_compile,
+              "(format/compile format)",
+              "Scan the directives of a format string once and return a compiled format. It can be "
+              "used in place of the string with string/format, buffer/format, printf and related "
+              "functions, which then skip scanning it on every call. A compiled format can also "
+              "be called like a function, which is the same as calling string/format with it.") {
+    janet_fixarity(argc, 1);
+    return janet_wrap_abstract(janet_format_compile(janet_getstring(argv, 0)));
+}
+
 static int trim_help_checkset(JanetByteView set, uint8_t x) {
     for (int32_t j = 0; j < set.len; j++)
         if (set.bytes[j] == x)
@@ -618,6 +1003,8 @@ void janet_lib_string(JanetTable *env) {
         JANET_CORE_REG("string/reverse", cfun_string_reverse),
         JANET_CORE_REG("string/find", cfun_string_find),
         JANET_CORE_REG("string/find-all", cfun_string_findall),
+        JANET_CORE_REG("string/searcher", cfun_string_searcher),
+        JANET_CORE_REG("string/search", cfun_string_search),
         JANET_CORE_REG("string/has-prefix?", cfun_string_hasprefix),
         JANET_CORE_REG("string/has-suffix?", cfun_string_hassuffix),
         JANET_CORE_REG("string/replace", cfun_string_replace),
@@ -626,10 +1013,13 @@ void janet_lib_string(JanetTable *env) {
         JANET_CORE_REG("string/check-set", cfun_string_checkset),
         JANET_CORE_REG("string/join", cfun_string_join),
         JANET_CORE_REG("string/format", cfun_string_format),
+        JANET_CORE_REG("format/compile", cfun_format_compile),
         JANET_CORE_REG("string/trim", cfun_string_trim),
         JANET_CORE_REG("string/triml", cfun_string_triml),
         JANET_CORE_REG("string/trimr", cfun_string_trimr),
         JANET_REG_END
     };
     janet_core_cfuns_ext(env, NULL, string_cfuns);
+    janet_register_abstract_type(&janet_searcher_type);
+    janet_register_abstract_type(&janet_format_type);
 }
@@ -25,14 +25,33 @@
 #include <janet.h>
 #include "gc.h"
 #include "util.h"
+#include "state.h"
 #include <math.h>
 #endif
 
+/* Structs with at most this many entries are not hashed. Their entries fill all of
+ * the buckets, sorted by key hash and then by key, so structs with the same keys share
+ * one layout. This halves the memory of small structs, and lets inline caches in the
+ * vm use the same bucket index for every struct with the same keys. */
+#define JANET_STRUCT_LINEAR_MAX 8
+#define janet_struct_linear(cap) ((cap) <= JANET_STRUCT_LINEAR_MAX)
+#ifdef JANET_NANBOX_64
+#define janet_struct_samekey(a, b) ((a).u64 == (b).u64)
+#else
+#define janet_struct_samekey(a, b) (janet_type(a) == janet_type(b) && \
+        janet_unwrap_pointer(a) == janet_unwrap_pointer(b))
+#endif
+
 /* Begin creation of a struct */
 JanetKV *janet_struct_begin(int32_t count) {
-    /* Calculate capacity as power of 2 after 2 * count. */
-    int32_t capacity = janet_tablen(2 * count);
-    if (capacity < 0) capacity = janet_tablen(count + 1);
+    int32_t capacity;
+    if (count <= JANET_STRUCT_LINEAR_MAX) {
+        capacity = count > 0 ? count : 1;
+    } else {
+        /* Calculate capacity as power of 2 after 2 * count. */
+        capacity = janet_tablen(2 * count);
+        if (capacity < 0) capacity = janet_tablen(count + 1);
+    }
 
     size_t size = sizeof(JanetStructHead) + (size_t) capacity * sizeof(JanetKV);
     JanetStructHead *head = janet_gcalloc(JANET_MEMORY_STRUCT, size);
@@ -47,11 +66,25 @@ JanetKV *janet_struct_begin(int32_t count) {
 }
 
 /* Find an item in a struct without looking for prototypes. Should be similar to janet_dict_find, but
- * specialized to structs (slightly more compact). */
+ * specialized to structs (slightly more compact). If the key is missing from a struct with no
+ * empty buckets, returns a shared empty bucket that is not part of the struct. */
 const JanetKV *janet_struct_find(const JanetKV *st, Janet key) {
     int32_t cap = janet_struct_capacity(st);
-    int32_t index = janet_maphash(cap, janet_hash(key));
     int32_t i;
+    if (janet_struct_linear(cap)) {
+        if (janet_checktypes(key, JANET_TFLAG_KEYWORD | JANET_TFLAG_SYMBOL)) {
+            /* Keywords and symbols are interned, so comparing pointers is enough */
+            for (i = 0; i < cap; i++)
+                if (janet_struct_samekey(st[i].key, key))
+                    return st + i;
+            return janet_checktype(st->key, JANET_NIL) ? st : &janet_vm.missing_kv;
+        }
+        for (i = 0; i < cap; i++)
+            if (janet_checktype(st[i].key, JANET_NIL) || janet_equals(st[i].key, key))
+                return st + i;
+        return &janet_vm.missing_kv;
+    }
+    int32_t index = janet_maphash(cap, janet_hash(key));
     for (i = index; i < cap; i++)
         if (janet_checktype(st[i].key, JANET_NIL) || janet_equals(st[i].key, key))
             return st + i;
@@ -79,6 +112,23 @@ void janet_struct_put_ext(JanetKV *st, Janet key, Janet value, int replace) {
     if (janet_checktype(key, JANET_NUMBER) && isnan(janet_unwrap_number(key))) return;
     /* Avoid extra items */
     if (janet_struct_hash(st) == janet_struct_length(st)) return;
+    if (janet_struct_linear(cap)) {
+        /* Entries are sorted once the struct is finished */
+        for (i = 0; i < cap; i++) {
+            JanetKV *kv = st + i;
+            if (janet_checktype(kv->key, JANET_NIL)) {
+                kv->key = key;
+                kv->value = value;
+                janet_struct_hash(st)++;
+                return;
+            }
+            if (janet_equals(kv->key, key)) {
+                if (replace) kv->value = value;
+                return;
+            }
+        }
+        return;
+    }
     for (dist = 0, j = 0; j < 4; j += 2)
         for (i = bounds[j]; i < bounds[j + 1]; i++, dist++) {
             int status;
@@ -137,6 +187,15 @@ void janet_struct_put(JanetKV *st, Janet key, Janet value) {
     janet_struct_put_ext(st, key, value, 1);
 }
 
+/* Order of the entries of a linear struct, the same as the order of colliding
+ * entries in a hashed struct. */
+static int janet_struct_order(const JanetKV *a, const JanetKV *b) {
+    int32_t ahash = janet_hash(a->key);
+    int32_t bhash = janet_hash(b->key);
+    if (ahash != bhash) return ahash < bhash ? -1 : 1;
+    return janet_compare(a->key, b->key);
+}
+
 /* Finish building a struct */
 const JanetKV *janet_struct_end(JanetKV *st) {
     if (janet_struct_hash(st) != janet_struct_length(st)) {
@@ -153,6 +212,18 @@ const JanetKV *janet_struct_end(JanetKV *st) {
         janet_struct_proto(newst) = janet_struct_proto(st);
         st = newst;
     }
+    if (janet_struct_linear(janet_struct_capacity(st))) {
+        /* Insertion sort, as there are only a few entries */
+        for (int32_t i = 1; i < janet_struct_length(st); i++) {
+            JanetKV kv = st[i];
+            int32_t j = i;
+            while (j > 0 && janet_struct_order(st + j - 1, &kv) > 0) {
+                st[j] = st[j - 1];
+                j--;
+            }
+            st[j] = kv;
+        }
+    }
     janet_struct_hash(st) = janet_kv_calchash(st, janet_struct_capacity(st));
     if (janet_struct_proto(st)) {
         janet_struct_hash(st) += 2654435761u * janet_struct_hash(janet_struct_proto(st));
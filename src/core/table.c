@@ -25,21 +25,158 @@
 #include <janet.h>
 #include "gc.h"
 #include "util.h"
+#include "state.h"
 #include <math.h>
 #endif
 
+#ifdef JANET_TABLE_SSE2
+#include <emmintrin.h>
+#endif
+
 #define JANET_TABLE_FLAG_STACK 0x10000
 
-static void *janet_memalloc_empty_local(int32_t count) {
-    int32_t i;
-    void *mem = janet_smalloc((size_t) count * sizeof(JanetKV));
-    JanetKV *mmem = (JanetKV *)mem;
-    for (i = 0; i < count; i++) {
-        JanetKV *kv = mmem + i;
-        kv->key = janet_wrap_nil();
-        kv->value = janet_wrap_nil();
+/* Each bucket has a metadata byte, stored after the buckets. Full buckets
+ * hold 7 bits of the key's hash, so a lookup only compares keys whose
+ * metadata matches. Probing reads the metadata of JANET_TABLE_GROUP
+ * buckets at a time. The buckets themselves keep the usual layout, with
+ * tombstones as a nil key and false value, for janet_dictionary_get and
+ * other code that reads table data directly. */
+#define JANET_TABLE_EMPTY 0x80
+#define JANET_TABLE_DELETED 0xFE
+
+#define janet_table_tags(t) ((uint8_t *)((t)->data + (t)->capacity))
+#define janet_table_tag(hash) ((uint8_t)((uint32_t)(hash) >> 25))
+
+#ifdef JANET_TABLE_SSE2
+typedef uint32_t JanetTableMask;
+static JanetTableMask janet_table_match(const uint8_t *group, uint8_t tag) {
+    __m128i g = _mm_loadu_si128((const __m128i *) group);
+    return (JanetTableMask) _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char) tag)));
+}
+#define janet_table_match_empty(group) janet_table_match((group), JANET_TABLE_EMPTY)
+#define janet_table_match_deleted(group) janet_table_match((group), JANET_TABLE_DELETED)
+#define JANET_TABLE_MASK_WIDTH 1
+#ifdef __GNUC__
+#define janet_table_bit(mask) ((int32_t) __builtin_ctz(mask))
+#endif
+#else
+/* Compare 8 metadata bytes at once in a 64 bit word. A tag match can have
+ * false positives, which are filtered out by comparing keys. */
+typedef uint64_t JanetTableMask;
+#define JANET_TABLE_LSBS 0x0101010101010101ULL
+#define JANET_TABLE_MSBS 0x8080808080808080ULL
+#define JANET_TABLE_MASK_WIDTH 8
+static JanetTableMask janet_table_load(const uint8_t *group) {
+    uint64_t word = 0;
+    for (int i = 0; i < 8; i++) word |= (uint64_t) group[i] << (8 * i);
+    return word;
+}
+static JanetTableMask janet_table_match(const uint8_t *group, uint8_t tag) {
+    uint64_t x = janet_table_load(group) ^ (JANET_TABLE_LSBS * tag);
+    return (x - JANET_TABLE_LSBS) & ~x & JANET_TABLE_MSBS;
+}
+static JanetTableMask janet_table_match_empty(const uint8_t *group) {
+    uint64_t x = janet_table_load(group);
+    return x & ~(x << 6) & JANET_TABLE_MSBS;
+}
+static JanetTableMask janet_table_match_deleted(const uint8_t *group) {
+    uint64_t x = janet_table_load(group);
+    return x & (x << 6) & JANET_TABLE_MSBS;
+}
+#ifdef __GNUC__
+#define janet_table_bit(mask) ((int32_t) __builtin_ctzll(mask) >> 3)
+#endif
+#endif
+
+/* Fallback for when ctz is not available */
+#ifndef janet_table_bit
+static int32_t janet_table_bit(JanetTableMask mask) {
+    int32_t bit = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        bit++;
+    }
+    return bit / JANET_TABLE_MASK_WIDTH;
+}
+#endif
+
+#ifdef __GNUC__
+#define janet_table_prefetch(kv) __builtin_prefetch(kv)
+#else
+#define janet_table_prefetch(kv)
+#endif
+
+/* Set the metadata of a bucket and its copies past the end */
+static void janet_table_settag(JanetTable *t, int32_t index, uint8_t tag) {
+    uint8_t *tags = janet_table_tags(t);
+    tags[index] = tag;
+    for (int32_t i = index + t->capacity; i < t->capacity + JANET_TABLE_GROUP - 1; i += t->capacity) {
+        tags[i] = tag;
     }
-    return mem;
+}
+
+/* Allocate empty buckets and metadata */
+static JanetKV *janet_table_alloc(int32_t capacity, int islocal) {
+    size_t size = janet_table_datasize(capacity);
+    JanetKV *data;
+    if (islocal) {
+        data = (JanetKV *) janet_smalloc(size);
+    } else {
+        data = (JanetKV *) janet_malloc(size);
+        if (NULL == data) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_vm.next_collection += size;
+    }
+    janet_memempty(data, capacity);
+    memset(data + capacity, JANET_TABLE_EMPTY, size - (size_t) capacity * sizeof(JanetKV));
+    return data;
+}
+
+/* Find the bucket containing key, or the bucket where it should be inserted. */
+static JanetKV *janet_table_lookup(JanetTable *t, Janet key, int32_t hash) {
+    if (!t->capacity) return NULL;
+    uint32_t mask = (uint32_t) t->capacity - 1;
+    uint32_t pos = janet_maphash(t->capacity, hash);
+    uint8_t tag = janet_table_tag(hash);
+    const uint8_t *tags = janet_table_tags(t);
+    JanetKV *first_bucket = NULL;
+    /* Most keys are in their first bucket, so start loading it with the metadata */
+    janet_table_prefetch(t->data + pos);
+    for (uint32_t probed = 0; probed <= mask; probed += JANET_TABLE_GROUP) {
+        const uint8_t *group = tags + pos;
+        for (JanetTableMask m = janet_table_match(group, tag); m; m &= m - 1) {
+            JanetKV *kv = t->data + ((pos + janet_table_bit(m)) & mask);
+            if (janet_equals(kv->key, key)) return kv;
+        }
+        JanetTableMask empty = janet_table_match_empty(group);
+        if (NULL == first_bucket) {
+            /* Only tombstones before the first empty bucket are on the probe sequence */
+            JanetTableMask deleted = janet_table_match_deleted(group);
+            if (empty) deleted &= (empty & (~empty + 1)) - 1;
+            if (deleted) first_bucket = t->data + ((pos + janet_table_bit(deleted)) & mask);
+        }
+        if (empty) {
+            return first_bucket ? first_bucket : t->data + ((pos + janet_table_bit(empty)) & mask);
+        }
+        pos = (pos + JANET_TABLE_GROUP) & mask;
+    }
+    return first_bucket;
+}
+
+/* Write a key that is not in the table. Used when rehashing. */
+static void janet_table_insert_new(JanetTable *t, const JanetKV *kv) {
+    uint32_t mask = (uint32_t) t->capacity - 1;
+    int32_t hash = janet_hash(kv->key);
+    uint32_t pos = janet_maphash(t->capacity, hash);
+    const uint8_t *tags = janet_table_tags(t);
+    JanetTableMask empty;
+    while (!(empty = janet_table_match_empty(tags + pos))) {
+        pos = (pos + JANET_TABLE_GROUP) & mask;
+    }
+    int32_t index = (int32_t)((pos + janet_table_bit(empty)) & mask);
+    t->data[index] = *kv;
+    janet_table_settag(t, index, janet_table_tag(hash));
 }
 
 static JanetTable *janet_table_init_impl(JanetTable *table, int32_t capacity, int stackalloc) {
@@ -47,14 +184,7 @@ static JanetTable *janet_table_init_impl(JanetTable *table, int32_t capacity, in
     capacity = janet_tablen(capacity);
     if (stackalloc) table->gc.flags = JANET_TABLE_FLAG_STACK;
     if (capacity) {
-        if (stackalloc) {
-            data = janet_memalloc_empty_local(capacity);
-        } else {
-            data = (JanetKV *) janet_memalloc_empty(capacity);
-            if (NULL == data) {
-                JANET_OUT_OF_MEMORY;
-            }
-        }
+        data = janet_table_alloc(capacity, stackalloc);
         table->data = data;
         table->capacity = capacity;
     } else {
@@ -74,6 +204,7 @@ JanetTable *janet_table_init(JanetTable *table, int32_t capacity) {
 
 /* Initialize a table without using scratch memory */
 JanetTable *janet_table_init_raw(JanetTable *table, int32_t capacity) {
+    table->gc.flags = 0;
     return janet_table_init_impl(table, capacity, 0);
 }
 
@@ -95,22 +226,14 @@ JanetTable *janet_table(int32_t capacity) {
 /* Find the bucket that contains the given key. Will also return
  * bucket where key should go if not in the table. */
 JanetKV *janet_table_find(JanetTable *t, Janet key) {
-    return (JanetKV *) janet_dict_find(t->data, t->capacity, key);
+    return janet_table_lookup(t, key, janet_hash(key));
 }
 
 /* Resize the dictionary table. */
 static void janet_table_rehash(JanetTable *t, int32_t size) {
     JanetKV *olddata = t->data;
-    JanetKV *newdata;
     int islocal = t->gc.flags & JANET_TABLE_FLAG_STACK;
-    if (islocal) {
-        newdata = (JanetKV *) janet_memalloc_empty_local(size);
-    } else {
-        newdata = (JanetKV *) janet_memalloc_empty(size);
-        if (NULL == newdata) {
-            JANET_OUT_OF_MEMORY;
-        }
-    }
+    JanetKV *newdata = janet_table_alloc(size, islocal);
     int32_t i, oldcapacity;
     oldcapacity = t->capacity;
     t->data = newdata;
@@ -119,8 +242,7 @@ static void janet_table_rehash(JanetTable *t, int32_t size) {
     for (i = 0; i < oldcapacity; i++) {
         JanetKV *kv = olddata + i;
         if (!janet_checktype(kv->key, JANET_NIL)) {
-            JanetKV *newkv = janet_table_find(t, kv->key);
-            *newkv = *kv;
+            janet_table_insert_new(t, kv);
         }
     }
     if (islocal) {
@@ -171,12 +293,27 @@ Janet janet_table_remove(JanetTable *t, Janet key) {
         t->deleted++;
         bucket->key = janet_wrap_nil();
         bucket->value = janet_wrap_false();
+        janet_table_settag(t, (int32_t)(bucket - t->data), JANET_TABLE_DELETED);
         return ret;
     } else {
         return janet_wrap_nil();
     }
 }
 
+/* Add a key that is not in the table, given the bucket found for it */
+static void janet_table_insert(JanetTable *t, JanetKV *bucket, Janet key, Janet value, int32_t hash) {
+    if (NULL == bucket || 2 * (t->count + t->deleted + 1) > t->capacity) {
+        janet_table_rehash(t, janet_tablen(2 * t->count + 2));
+        bucket = janet_table_lookup(t, key, hash);
+    }
+    if (janet_checktype(bucket->value, JANET_BOOLEAN))
+        --t->deleted;
+    bucket->key = key;
+    bucket->value = value;
+    janet_table_settag(t, (int32_t)(bucket - t->data), janet_table_tag(hash));
+    ++t->count;
+}
+
 /* Put a value into the object */
 void janet_table_put(JanetTable *t, Janet key, Janet value) {
     if (janet_checktype(key, JANET_NIL)) return;
@@ -184,19 +321,14 @@ void janet_table_put(JanetTable *t, Janet key, Janet value) {
     if (janet_checktype(value, JANET_NIL)) {
         janet_table_remove(t, key);
     } else {
-        JanetKV *bucket = janet_table_find(t, key);
+        int32_t hash = janet_hash(key);
+        JanetKV *bucket = janet_table_lookup(t, key, hash);
+        janet_gc_barrier_value(t, value);
         if (NULL != bucket && !janet_checktype(bucket->key, JANET_NIL)) {
             bucket->value = value;
         } else {
-            if (NULL == bucket || 2 * (t->count + t->deleted + 1) > t->capacity) {
-                janet_table_rehash(t, janet_tablen(2 * t->count + 2));
-            }
-            bucket = janet_table_find(t, key);
-            if (janet_checktype(bucket->value, JANET_BOOLEAN))
-                --t->deleted;
-            bucket->key = key;
-            bucket->value = value;
-            ++t->count;
+            janet_gc_barrier_value(t, key);
+            janet_table_insert(t, bucket, key, value, hash);
         }
     }
 }
@@ -204,18 +336,13 @@ void janet_table_put(JanetTable *t, Janet key, Janet value) {
 /* Used internally so don't check arguments
  * Put into a table, but if the key already exists do nothing. */
 static void janet_table_put_no_overwrite(JanetTable *t, Janet key, Janet value) {
-    JanetKV *bucket = janet_table_find(t, key);
+    int32_t hash = janet_hash(key);
+    JanetKV *bucket = janet_table_lookup(t, key, hash);
     if (NULL != bucket && !janet_checktype(bucket->key, JANET_NIL))
         return;
-    if (NULL == bucket || 2 * (t->count + t->deleted + 1) > t->capacity) {
-        janet_table_rehash(t, janet_tablen(2 * t->count + 2));
-    }
-    bucket = janet_table_find(t, key);
-    if (janet_checktype(bucket->value, JANET_BOOLEAN))
-        --t->deleted;
-    bucket->key = key;
-    bucket->value = value;
-    ++t->count;
+    janet_gc_barrier_value(t, key);
+    janet_gc_barrier_value(t, value);
+    janet_table_insert(t, bucket, key, value, hash);
 }
 
 /* Clear a table */
@@ -223,6 +350,9 @@ void janet_table_clear(JanetTable *t) {
     int32_t capacity = t->capacity;
     JanetKV *data = t->data;
     janet_memempty(data, capacity);
+    if (capacity) {
+        memset(data + capacity, JANET_TABLE_EMPTY, janet_table_datasize(capacity) - (size_t) capacity * sizeof(JanetKV));
+    }
     t->count = 0;
     t->deleted = 0;
 }
@@ -234,11 +364,11 @@ JanetTable *janet_table_clone(JanetTable *table) {
     newTable->capacity = table->capacity;
     newTable->deleted = table->deleted;
     newTable->proto = table->proto;
-    newTable->data = janet_malloc(newTable->capacity * sizeof(JanetKV));
+    newTable->data = janet_malloc(janet_table_datasize(newTable->capacity));
     if (NULL == newTable->data) {
         JANET_OUT_OF_MEMORY;
     }
-    memcpy(newTable->data, table->data, (size_t) table->capacity * sizeof(JanetKV));
+    memcpy(newTable->data, table->data, janet_table_datasize(table->capacity));
     return newTable;
 }
 
@@ -293,6 +423,16 @@ JanetTable *janet_table_proto_flatten(JanetTable *t) {
 
 /* C Functions */
 
+/* Unwrap a table argument without the whole table write barrier of janet_gettable.
+ * The functions below only store new references with janet_table_put or an explicit
+ * janet_gc_barrier_value. */
+static JanetTable *gettable(const Janet *argv, int32_t n) {
+    if (!janet_checktype(argv[n], JANET_TABLE)) {
+        janet_panic_type(argv[n], n, JANET_TFLAG_TABLE);
+    }
+    return janet_unwrap_table(argv[n]);
+}
+
 JANET_CORE_FN(cfun_table_new,
               "(table/new capacity)",
               "Creates a new empty table with pre-allocated memory "
@@ -309,7 +449,7 @@ JANET_CORE_FN(cfun_table_getproto,
               "Get the prototype table of a table. Returns nil if a table "
               "has no prototype, otherwise returns the prototype.") {
     janet_fixarity(argc, 1);
-    JanetTable *t = janet_gettable(argv, 0);
+    JanetTable *t = gettable(argv, 0);
     return t->proto
            ? janet_wrap_table(t->proto)
            : janet_wrap_nil();
@@ -319,11 +459,12 @@ JANET_CORE_FN(cfun_table_setproto,
               "(table/setproto tab proto)",
               "Set the prototype of a table. Returns the original table tab.") {
     janet_fixarity(argc, 2);
-    JanetTable *table = janet_gettable(argv, 0);
+    JanetTable *table = gettable(argv, 0);
     JanetTable *proto = NULL;
     if (!janet_checktype(argv[1], JANET_NIL)) {
-        proto = janet_gettable(argv, 1);
+        proto = gettable(argv, 1);
     }
+    janet_gc_barrier_value(table, argv[1]);
     table->proto = proto;
     return argv[0];
 }
@@ -333,7 +474,7 @@ JANET_CORE_FN(cfun_table_tostruct,
               "Convert a table to a struct. Returns a new struct. This function "
               "does not take into account prototype tables.") {
     janet_fixarity(argc, 1);
-    JanetTable *t = janet_gettable(argv, 0);
+    JanetTable *t = gettable(argv, 0);
     return janet_wrap_struct(janet_table_to_struct(t));
 }
 
@@ -343,7 +484,7 @@ JANET_CORE_FN(cfun_table_rawget,
               "If a table tab does not contain t directly, the function will return "
               "nil without checking the prototype. Returns the value in the table.") {
     janet_fixarity(argc, 2);
-    JanetTable *table = janet_gettable(argv, 0);
+    JanetTable *table = gettable(argv, 0);
     return janet_table_rawget(table, argv[1]);
 }
 
@@ -352,7 +493,7 @@ JANET_CORE_FN(cfun_table_clone,
               "Create a copy of a table. Updates to the new table will not change the old table, "
               "and vice versa.") {
     janet_fixarity(argc, 1);
-    JanetTable *table = janet_gettable(argv, 0);
+    JanetTable *table = gettable(argv, 0);
     return janet_wrap_table(janet_table_clone(table));
 }
 
@@ -360,7 +501,7 @@ JANET_CORE_FN(cfun_table_clear,
               "(table/clear tab)",
               "Remove all key-value pairs in a table and return the modified table `tab`.") {
     janet_fixarity(argc, 1);
-    JanetTable *table = janet_gettable(argv, 0);
+    JanetTable *table = gettable(argv, 0);
     janet_table_clear(table);
     return janet_wrap_table(table);
 }
@@ -369,7 +510,7 @@ JANET_CORE_FN(cfun_table_proto_flatten,
               "(table/proto-flatten tab)",
               "Create a new table that is the result of merging all prototypes into a new table.") {
     janet_fixarity(argc, 1);
-    JanetTable *table = janet_gettable(argv, 0);
+    JanetTable *table = gettable(argv, 0);
     return janet_wrap_table(janet_table_proto_flatten(table));
 }
 
@@ -0,0 +1,861 @@
+/*
+* Copyright (c) 2021 Calvin Rose & contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to
+* deal in the Software without restriction, including without limitation the
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+* sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#ifndef JANET_AMALG
+#include "features.h"
+#include <janet.h>
+#include "util.h"
+#endif
+
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef JANET_TYPED_ARRAY
+
+/* Typed arrays. A typed array is a view of unboxed numbers stored in a
+ * buffer. Several views can share one buffer, and any buffer can be
+ * viewed as a typed array, so reading a file into a buffer or writing a
+ * typed array's buffer to a stream never copies the numbers. Because the
+ * buffer can be resized behind a view's back, the data pointer is
+ * recomputed and bounds checked on every access rather than cached. */
+
+#define TA_TYPES(X) \
+    X(u8, uint8_t, JANET_TARRAY_U8) \
+    X(s8, int8_t, JANET_TARRAY_S8) \
+    X(u16, uint16_t, JANET_TARRAY_U16) \
+    X(s16, int16_t, JANET_TARRAY_S16) \
+    X(u32, uint32_t, JANET_TARRAY_U32) \
+    X(s32, int32_t, JANET_TARRAY_S32) \
+    X(f32, float, JANET_TARRAY_F32) \
+    X(f64, double, JANET_TARRAY_F64)
+
+#define TA_NAME(name, T, tag) #name,
+static const char *const ta_type_names[] = {
+    TA_TYPES(TA_NAME)
+};
+#undef TA_NAME
+
+#define TA_SIZE(name, T, tag) sizeof(T),
+static const size_t ta_type_sizes[] = {
+    TA_TYPES(TA_SIZE)
+};
+#undef TA_SIZE
+
+#define TA_TYPE_COUNT ((int)(sizeof(ta_type_sizes) / sizeof(ta_type_sizes[0])))
+
+/* Convert a double to an integer element. Out of range values wrap like C
+ * integer conversions, and NaN becomes 0. */
+static int64_t ta_to_int(double x) {
+    if (x != x) return 0;
+    if (x >= 9223372036854775807.0) return INT64_MAX;
+    if (x <= -9223372036854775808.0) return INT64_MIN;
+    return (int64_t) x;
+}
+
+void *janet_tarray_data(JanetTArray *ta) {
+    size_t size = ta_type_sizes[ta->type];
+    size_t end = (size_t) ta->offset + (size_t) ta->length * size;
+    if (end > (size_t) ta->buffer->count)
+        janet_panic("typed array is out of range of its buffer");
+    if (ta->length == 0) return ta->buffer->data;
+    uint8_t *data = ta->buffer->data + ta->offset;
+    if ((uintptr_t) data % size)
+        janet_panic("typed array data is misaligned");
+    return data;
+}
+
+#define TA_GET(name, T, tag) case tag: return (double)((const T *) data)[i];
+static double ta_get(JanetTArrayType type, const void *data, int32_t i) {
+    switch (type) {
+        TA_TYPES(TA_GET)
+    }
+    return 0.0;
+}
+#undef TA_GET
+
+static void ta_set(JanetTArrayType type, void *data, int32_t i, double x) {
+    switch (type) {
+        case JANET_TARRAY_U8:
+            ((uint8_t *) data)[i] = (uint8_t) ta_to_int(x);
+            break;
+        case JANET_TARRAY_S8:
+            ((int8_t *) data)[i] = (int8_t) ta_to_int(x);
+            break;
+        case JANET_TARRAY_U16:
+            ((uint16_t *) data)[i] = (uint16_t) ta_to_int(x);
+            break;
+        case JANET_TARRAY_S16:
+            ((int16_t *) data)[i] = (int16_t) ta_to_int(x);
+            break;
+        case JANET_TARRAY_U32:
+            ((uint32_t *) data)[i] = (uint32_t) ta_to_int(x);
+            break;
+        case JANET_TARRAY_S32:
+            ((int32_t *) data)[i] = (int32_t) ta_to_int(x);
+            break;
+        case JANET_TARRAY_F32:
+            ((float *) data)[i] = (float) x;
+            break;
+        case JANET_TARRAY_F64:
+            ((double *) data)[i] = x;
+            break;
+    }
+}
+
+/* Abstract type */
+
+static Janet ta_length_method(int32_t argc, Janet *argv);
+
+static const JanetMethod ta_methods[] = {
+    {"length", ta_length_method},
+    {NULL, NULL}
+};
+
+static int ta_gcmark(void *p, size_t size) {
+    (void) size;
+    JanetTArray *ta = (JanetTArray *) p;
+    if (ta->buffer) janet_mark(janet_wrap_buffer(ta->buffer));
+    return 0;
+}
+
+static int ta_getter(void *p, Janet key, Janet *out) {
+    JanetTArray *ta = (JanetTArray *) p;
+    if (janet_checktype(key, JANET_KEYWORD)) {
+        return janet_getmethod(janet_unwrap_keyword(key), ta_methods, out);
+    }
+    if (!janet_checkint(key)) return 0;
+    int32_t i = janet_unwrap_integer(key);
+    if (i < 0 || i >= ta->length) return 0;
+    *out = janet_wrap_number(ta_get(ta->type, janet_tarray_data(ta), i));
+    return 1;
+}
+
+static void ta_putter(void *p, Janet key, Janet value) {
+    JanetTArray *ta = (JanetTArray *) p;
+    if (!janet_checkint(key)) janet_panicf("expected integer key, got %v", key);
+    if (!janet_checktype(value, JANET_NUMBER))
+        janet_panicf("expected number value, got %v", value);
+    int32_t i = janet_unwrap_integer(key);
+    if (i < 0 || i >= ta->length)
+        janet_panicf("index %d out of range [0,%d)", i, ta->length);
+    ta_set(ta->type, janet_tarray_data(ta), i, janet_unwrap_number(value));
+}
+
+/* Views marshal their buffer as a value, so views that share a buffer
+ * still share it after unmarshalling. */
+static void ta_marshal(void *p, JanetMarshalContext *ctx) {
+    JanetTArray *ta = (JanetTArray *) p;
+    janet_marshal_abstract(ctx, p);
+    janet_marshal_byte(ctx, (uint8_t) ta->type);
+    janet_marshal_int(ctx, ta->offset);
+    janet_marshal_int(ctx, ta->length);
+    janet_marshal_janet(ctx, janet_wrap_buffer(ta->buffer));
+}
+
+static void *ta_unmarshal(JanetMarshalContext *ctx) {
+    JanetTArray *ta = janet_unmarshal_abstract(ctx, sizeof(JanetTArray));
+    ta->buffer = NULL;
+    ta->offset = 0;
+    ta->length = 0;
+    ta->type = JANET_TARRAY_U8;
+    uint8_t type = janet_unmarshal_byte(ctx);
+    int32_t offset = janet_unmarshal_int(ctx);
+    int32_t length = janet_unmarshal_int(ctx);
+    Janet buffer = janet_unmarshal_janet(ctx);
+    if (type >= TA_TYPE_COUNT || offset < 0 || length < 0 ||
+            !janet_checktype(buffer, JANET_BUFFER))
+        janet_panic("invalid typed array");
+    ta->buffer = janet_unwrap_buffer(buffer);
+    ta->type = (JanetTArrayType) type;
+    ta->offset = offset;
+    ta->length = length;
+    janet_tarray_data(ta);
+    return ta;
+}
+
+#define TA_PRINT_MAX 16
+
+static void ta_tostring(void *p, JanetBuffer *buffer) {
+    JanetTArray *ta = (JanetTArray *) p;
+    janet_buffer_push_cstring(buffer, ta_type_names[ta->type]);
+    janet_buffer_push_cstring(buffer, " [");
+    const void *data = janet_tarray_data(ta);
+    int32_t n = ta->length < TA_PRINT_MAX ? ta->length : TA_PRINT_MAX;
+    for (int32_t i = 0; i < n; i++) {
+        if (i) janet_buffer_push_u8(buffer, ' ');
+        janet_description_b(buffer, janet_wrap_number(ta_get(ta->type, data, i)));
+    }
+    if (n < ta->length) janet_buffer_push_cstring(buffer, " ...");
+    janet_buffer_push_u8(buffer, ']');
+}
+
+static Janet ta_next(void *p, Janet key) {
+    JanetTArray *ta = (JanetTArray *) p;
+    if (janet_checktype(key, JANET_NIL)) {
+        return ta->length ? janet_wrap_integer(0) : janet_wrap_nil();
+    }
+    if (!janet_checkint(key)) janet_panic("expected integer key");
+    int32_t i = janet_unwrap_integer(key) + 1;
+    return (i > 0 && i < ta->length) ? janet_wrap_integer(i) : janet_wrap_nil();
+}
+
+const JanetAbstractType janet_tarray_type = {
+    "core/tarray",
+    NULL,
+    ta_gcmark,
+    ta_getter,
+    ta_putter,
+    ta_marshal,
+    ta_unmarshal,
+    ta_tostring,
+    NULL,
+    NULL,
+    ta_next,
+    JANET_ATEND_NEXT
+};
+
+/* C API */
+
+JanetTArray *janet_tarray_view(JanetTArrayType type, JanetBuffer *buffer,
+                               int32_t offset, int32_t length) {
+    JanetTArray *ta = janet_abstract(&janet_tarray_type, sizeof(JanetTArray));
+    ta->buffer = buffer;
+    ta->type = type;
+    ta->offset = offset;
+    ta->length = length;
+    janet_tarray_data(ta);
+    return ta;
+}
+
+JanetTArray *janet_tarray(JanetTArrayType type, int32_t length) {
+    size_t nbytes = (size_t) length * ta_type_sizes[type];
+    if (length < 0 || nbytes > INT32_MAX) janet_panic("typed array too large");
+    JanetBuffer *buffer = janet_buffer((int32_t) nbytes);
+    if (nbytes) memset(buffer->data, 0, nbytes);
+    buffer->count = (int32_t) nbytes;
+    return janet_tarray_view(type, buffer, 0, length);
+}
+
+JanetTArray *janet_gettarray(const Janet *argv, int32_t n) {
+    return (JanetTArray *) janet_getabstract(argv, n, &janet_tarray_type);
+}
+
+static JanetTArrayType ta_gettype(const Janet *argv, int32_t n) {
+    const uint8_t *kw = janet_getkeyword(argv, n);
+    for (int i = 0; i < TA_TYPE_COUNT; i++) {
+        if (!janet_cstrcmp(kw, ta_type_names[i])) return (JanetTArrayType) i;
+    }
+    janet_panicf("bad slot #%d, unknown typed array type %v", n, argv[n]);
+}
+
+/* Check that an optional destination argument can hold the result of an
+ * operation on src, or create one. */
+static JanetTArray *ta_getdest(int32_t argc, const Janet *argv, int32_t n, JanetTArray *src) {
+    if (argc <= n || janet_checktype(argv[n], JANET_NIL)) {
+        return janet_tarray(src->type, src->length);
+    }
+    JanetTArray *dest = janet_gettarray(argv, n);
+    if (dest->type != src->type || dest->length != src->length)
+        janet_panicf("bad slot #%d, expected typed array of type %s and length %d",
+                     n, ta_type_names[src->type], src->length);
+    return dest;
+}
+
+static JanetTArray *ta_getpeer(const Janet *argv, int32_t n, JanetTArray *src) {
+    JanetTArray *peer = janet_gettarray(argv, n);
+    if (peer->type != src->type || peer->length != src->length)
+        janet_panicf("bad slot #%d, expected typed array of type %s and length %d",
+                     n, ta_type_names[src->type], src->length);
+    return peer;
+}
+
+static Janet ta_length_method(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetTArray *ta = janet_gettarray(argv, 0);
+    return janet_wrap_integer(ta->length);
+}
+
+/* Kernels. Loops are kept simple enough for the compiler to vectorize.
+ * Integer arithmetic is done on unsigned 32 bit values so overflow wraps
+ * instead of being undefined, and reductions keep several independent
+ * accumulators so floating point sums are not serialized on one add. */
+
+typedef enum {
+    TA_ADD,
+    TA_SUB,
+    TA_MUL,
+    TA_DIV
+} TABinop;
+
+#define TA_INT_LOOP(T, EXPR) do { \
+    T *d = (T *) dst; \
+    const T *x = (const T *) xs; \
+    if (ys) { \
+        const T *y = (const T *) ys; \
+        for (int32_t i = 0; i < n; i++) \
+            d[i] = (T)((uint32_t) x[i] EXPR (uint32_t) y[i]); \
+    } else { \
+        uint32_t s = (uint32_t) ta_to_int(scalar); \
+        for (int32_t i = 0; i < n; i++) \
+            d[i] = (T)((uint32_t) x[i] EXPR s); \
+    } \
+} while (0)
+
+#define TA_FLOAT_LOOP(T, EXPR) do { \
+    T *d = (T *) dst; \
+    const T *x = (const T *) xs; \
+    if (ys) { \
+        const T *y = (const T *) ys; \
+        for (int32_t i = 0; i < n; i++) \
+            d[i] = x[i] EXPR y[i]; \
+    } else { \
+        T s = (T) scalar; \
+        for (int32_t i = 0; i < n; i++) \
+            d[i] = x[i] EXPR s; \
+    } \
+} while (0)
+
+#define TA_ARITH_CASES(EXPR) \
+    case JANET_TARRAY_U8: TA_INT_LOOP(uint8_t, EXPR); break; \
+    case JANET_TARRAY_S8: TA_INT_LOOP(int8_t, EXPR); break; \
+    case JANET_TARRAY_U16: TA_INT_LOOP(uint16_t, EXPR); break; \
+    case JANET_TARRAY_S16: TA_INT_LOOP(int16_t, EXPR); break; \
+    case JANET_TARRAY_U32: TA_INT_LOOP(uint32_t, EXPR); break; \
+    case JANET_TARRAY_S32: TA_INT_LOOP(int32_t, EXPR); break; \
+    case JANET_TARRAY_F32: TA_FLOAT_LOOP(float, EXPR); break; \
+    case JANET_TARRAY_F64: TA_FLOAT_LOOP(double, EXPR); break;
+
+/* Integer division has no vector form and has to check for zero, so it
+ * goes element by element through 64 bit values. */
+static void ta_int_div(JanetTArrayType type, void *dst, const void *xs,
+                       const void *ys, double scalar, int32_t n) {
+    int64_t s = ta_to_int(scalar);
+    if (!ys && s == 0) janet_panic("division by zero");
+    for (int32_t i = 0; i < n; i++) {
+        int64_t y = ys ? (int64_t) ta_get(type, ys, i) : s;
+        if (y == 0) janet_panic("division by zero");
+        ta_set(type, dst, i, (double)((int64_t) ta_get(type, xs, i) / y));
+    }
+}
+
+static void ta_binop(TABinop op, JanetTArrayType type, void *dst, const void *xs,
+                     const void *ys, double scalar, int32_t n) {
+    switch (op) {
+        case TA_ADD:
+            switch (type) {
+                    TA_ARITH_CASES(+)
+            }
+            break;
+        case TA_SUB:
+            switch (type) {
+                    TA_ARITH_CASES(-)
+            }
+            break;
+        case TA_MUL:
+            switch (type) {
+                    TA_ARITH_CASES(*)
+            }
+            break;
+        case TA_DIV:
+            if (type == JANET_TARRAY_F32) {
+                TA_FLOAT_LOOP(float, /);
+            } else if (type == JANET_TARRAY_F64) {
+                TA_FLOAT_LOOP(double, /);
+            } else {
+                ta_int_div(type, dst, xs, ys, scalar, n);
+            }
+            break;
+    }
+}
+
+#define TA_SUM_LOOP(T, ACC) do { \
+    const T *x = (const T *) xs; \
+    ACC s0 = 0, s1 = 0, s2 = 0, s3 = 0; \
+    int32_t i = 0; \
+    for (; i + 4 <= n; i += 4) { \
+        s0 += (ACC) x[i]; \
+        s1 += (ACC) x[i + 1]; \
+        s2 += (ACC) x[i + 2]; \
+        s3 += (ACC) x[i + 3]; \
+    } \
+    for (; i < n; i++) s0 += (ACC) x[i]; \
+    return (double)((s0 + s1) + (s2 + s3)); \
+} while (0)
+
+static double ta_sum(JanetTArrayType type, const void *xs, int32_t n) {
+    switch (type) {
+        case JANET_TARRAY_U8:
+            TA_SUM_LOOP(uint8_t, int64_t);
+        case JANET_TARRAY_S8:
+            TA_SUM_LOOP(int8_t, int64_t);
+        case JANET_TARRAY_U16:
+            TA_SUM_LOOP(uint16_t, int64_t);
+        case JANET_TARRAY_S16:
+            TA_SUM_LOOP(int16_t, int64_t);
+        case JANET_TARRAY_U32:
+            TA_SUM_LOOP(uint32_t, int64_t);
+        case JANET_TARRAY_S32:
+            TA_SUM_LOOP(int32_t, int64_t);
+        case JANET_TARRAY_F32:
+            TA_SUM_LOOP(float, double);
+        case JANET_TARRAY_F64:
+            TA_SUM_LOOP(double, double);
+    }
+    return 0.0;
+}
+
+#define TA_DOT_LOOP(T, ACC, OUT) do { \
+    const T *x = (const T *) xs; \
+    const T *y = (const T *) ys; \
+    ACC s0 = 0, s1 = 0, s2 = 0, s3 = 0; \
+    int32_t i = 0; \
+    for (; i + 4 <= n; i += 4) { \
+        s0 += (ACC) x[i] * (ACC) y[i]; \
+        s1 += (ACC) x[i + 1] * (ACC) y[i + 1]; \
+        s2 += (ACC) x[i + 2] * (ACC) y[i + 2]; \
+        s3 += (ACC) x[i + 3] * (ACC) y[i + 3]; \
+    } \
+    for (; i < n; i++) s0 += (ACC) x[i] * (ACC) y[i]; \
+    return (double)(OUT)((s0 + s1) + (s2 + s3)); \
+} while (0)
+
+/* Integer products are summed as unsigned 64 bit values so overflow wraps,
+ * then reinterpreted as signed for signed types. */
+static double ta_dot(JanetTArrayType type, const void *xs, const void *ys, int32_t n) {
+    switch (type) {
+        case JANET_TARRAY_U8:
+            TA_DOT_LOOP(uint8_t, uint64_t, uint64_t);
+        case JANET_TARRAY_S8:
+            TA_DOT_LOOP(int8_t, uint64_t, int64_t);
+        case JANET_TARRAY_U16:
+            TA_DOT_LOOP(uint16_t, uint64_t, uint64_t);
+        case JANET_TARRAY_S16:
+            TA_DOT_LOOP(int16_t, uint64_t, int64_t);
+        case JANET_TARRAY_U32:
+            TA_DOT_LOOP(uint32_t, uint64_t, uint64_t);
+        case JANET_TARRAY_S32:
+            TA_DOT_LOOP(int32_t, uint64_t, int64_t);
+        case JANET_TARRAY_F32:
+            TA_DOT_LOOP(float, double, double);
+        case JANET_TARRAY_F64:
+            TA_DOT_LOOP(double, double, double);
+    }
+    return 0.0;
+}
+
+#define TA_EXTREME_LOOP(T, CMP) do { \
+    const T *x = (const T *) xs; \
+    T m = x[0]; \
+    for (int32_t i = 1; i < n; i++) m = (x[i] CMP m) ? x[i] : m; \
+    return (double) m; \
+} while (0)
+
+#define TA_EXTREME_CASES(CMP) \
+    case JANET_TARRAY_U8: TA_EXTREME_LOOP(uint8_t, CMP); \
+    case JANET_TARRAY_S8: TA_EXTREME_LOOP(int8_t, CMP); \
+    case JANET_TARRAY_U16: TA_EXTREME_LOOP(uint16_t, CMP); \
+    case JANET_TARRAY_S16: TA_EXTREME_LOOP(int16_t, CMP); \
+    case JANET_TARRAY_U32: TA_EXTREME_LOOP(uint32_t, CMP); \
+    case JANET_TARRAY_S32: TA_EXTREME_LOOP(int32_t, CMP); \
+    case JANET_TARRAY_F32: TA_EXTREME_LOOP(float, CMP); \
+    case JANET_TARRAY_F64: TA_EXTREME_LOOP(double, CMP);
+
+static double ta_min(JanetTArrayType type, const void *xs, int32_t n) {
+    switch (type) {
+            TA_EXTREME_CASES(<)
+    }
+    return 0.0;
+}
+
+static double ta_max(JanetTArrayType type, const void *xs, int32_t n) {
+    switch (type) {
+            TA_EXTREME_CASES(>)
+    }
+    return 0.0;
+}
+
+/* Sorting. NaN sorts after every other float. */
+
+#define TA_CMP(name, T, tag) \
+static int ta_cmp_##name(const void *a, const void *b) { \
+    T x = *(const T *) a; \
+    T y = *(const T *) b; \
+    if (x < y) return -1; \
+    if (x > y) return 1; \
+    if (x == y) return 0; \
+    return (x != x) - (y != y); \
+}
+TA_TYPES(TA_CMP)
+#undef TA_CMP
+
+#define TA_CMP_ENTRY(name, T, tag) ta_cmp_##name,
+static int (*const ta_comparators[])(const void *, const void *) = {
+    TA_TYPES(TA_CMP_ENTRY)
+};
+#undef TA_CMP_ENTRY
+
+/* Math functions that tarray/map runs natively instead of calling once per
+ * element. They are matched by their registered name, so rebinding the
+ * symbol does not change the behavior. */
+
+static double ta_abs(double x) {
+    return fabs(x);
+}
+
+typedef struct {
+    const char *name;
+    double (*fn)(double);
+} TAMathOp;
+
+static const TAMathOp ta_math_ops[] = {
+    {"math/abs", ta_abs},
+    {"math/acos", acos},
+    {"math/acosh", acosh},
+    {"math/asin", asin},
+    {"math/asinh", asinh},
+    {"math/atan", atan},
+    {"math/atanh", atanh},
+    {"math/cbrt", cbrt},
+    {"math/ceil", ceil},
+    {"math/cos", cos},
+    {"math/cosh", cosh},
+    {"math/erf", erf},
+    {"math/erfc", erfc},
+    {"math/exp", exp},
+    {"math/exp2", exp2},
+    {"math/expm1", expm1},
+    {"math/floor", floor},
+    {"math/gamma", tgamma},
+    {"math/log", log},
+    {"math/log-gamma", lgamma},
+    {"math/log10", log10},
+    {"math/log1p", log1p},
+    {"math/log2", log2},
+    {"math/round", round},
+    {"math/sin", sin},
+    {"math/sinh", sinh},
+    {"math/sqrt", sqrt},
+    {"math/tan", tan},
+    {"math/tanh", tanh},
+    {"math/trunc", trunc},
+    {NULL, NULL}
+};
+
+static double (*ta_native_math(Janet f))(double) {
+    if (!janet_checktype(f, JANET_CFUNCTION)) return NULL;
+    JanetCFunRegistry *reg = janet_registry_get(janet_unwrap_cfunction(f));
+    if (NULL == reg || NULL == reg->name || NULL != reg->name_prefix) return NULL;
+    for (const TAMathOp *op = ta_math_ops; op->name; op++) {
+        if (!strcmp(op->name, reg->name)) return op->fn;
+    }
+    return NULL;
+}
+
+static void ta_map_native(JanetTArrayType type, void *dst, const void *xs,
+                          int32_t n, double (*fn)(double)) {
+    if (type == JANET_TARRAY_F64) {
+        double *d = (double *) dst;
+        const double *x = (const double *) xs;
+        for (int32_t i = 0; i < n; i++) d[i] = fn(x[i]);
+    } else if (type == JANET_TARRAY_F32) {
+        float *d = (float *) dst;
+        const float *x = (const float *) xs;
+        for (int32_t i = 0; i < n; i++) d[i] = (float) fn((double) x[i]);
+    } else {
+        for (int32_t i = 0; i < n; i++) ta_set(type, dst, i, fn(ta_get(type, xs, i)));
+    }
+}
+
+/* C Functions */
+
+JANET_CORE_FN(cfun_tarray_new,
+              "(tarray/new type size)",
+              "Create a new typed array of size elements, all 0. type is one of :u8, :s8, "
+              ":u16, :s16, :u32, :s32, :f32, or :f64.") {
+    janet_fixarity(argc, 2);
+    JanetTArrayType type = ta_gettype(argv, 0);
+    int32_t size = janet_getnat(argv, 1);
+    return janet_wrap_abstract(janet_tarray(type, size));
+}
+
+JANET_CORE_FN(cfun_tarray_from,
+              "(tarray/from type xs)",
+              "Create a new typed array from an array or tuple of numbers. Numbers are "
+              "converted to the element type, and integer types wrap values that are out "
+              "of range.") {
+    janet_fixarity(argc, 2);
+    JanetTArrayType type = ta_gettype(argv, 0);
+    JanetView view = janet_getindexed(argv, 1);
+    JanetTArray *ta = janet_tarray(type, view.len);
+    void *data = janet_tarray_data(ta);
+    for (int32_t i = 0; i < view.len; i++) {
+        if (!janet_checktype(view.items[i], JANET_NUMBER))
+            janet_panicf("expected number, got %v", view.items[i]);
+        ta_set(type, data, i, janet_unwrap_number(view.items[i]));
+    }
+    return janet_wrap_abstract(ta);
+}
+
+JANET_CORE_FN(cfun_tarray_view,
+              "(tarray/view type buffer &opt offset length)",
+              "Create a typed array that views the bytes of buffer starting at byte offset, "
+              "without copying them. offset defaults to 0 and must be a multiple of the "
+              "element size. length is the number of elements, and defaults to as many as "
+              "fit in the rest of the buffer. Writes through the view change the buffer, and "
+              "the view raises an error if the buffer is later shrunk out from under it.") {
+    janet_arity(argc, 2, 4);
+    JanetTArrayType type = ta_gettype(argv, 0);
+    JanetBuffer *buffer = janet_getbuffer(argv, 1);
+    int32_t size = (int32_t) ta_type_sizes[type];
+    int32_t offset = janet_optnat(argv, argc, 2, 0);
+    if (offset % size)
+        janet_panicf("offset %d is not a multiple of the element size %d", offset, size);
+    if (offset > buffer->count)
+        janet_panicf("offset %d out of range of buffer", offset);
+    int32_t length = janet_optnat(argv, argc, 3, (buffer->count - offset) / size);
+    if ((int64_t) offset + (int64_t) length * size > buffer->count)
+        janet_panicf("length %d out of range of buffer", length);
+    return janet_wrap_abstract(janet_tarray_view(type, buffer, offset, length));
+}
+
+JANET_CORE_FN(cfun_tarray_buffer,
+              "(tarray/buffer ta)",
+              "Get the buffer that holds the elements of a typed array. The buffer is shared, "
+              "not copied, and may be larger than the typed array if it is a view.") {
+    janet_fixarity(argc, 1);
+    JanetTArray *ta = janet_gettarray(argv, 0);
+    return janet_wrap_buffer(ta->buffer);
+}
+
+JANET_CORE_FN(cfun_tarray_type,
+              "(tarray/type ta)",
+              "Get the element type of a typed array as a keyword.") {
+    janet_fixarity(argc, 1);
+    JanetTArray *ta = janet_gettarray(argv, 0);
+    return janet_ckeywordv(ta_type_names[ta->type]);
+}
+
+JANET_CORE_FN(cfun_tarray_slice,
+              "(tarray/slice ta &opt start end)",
+              "Create a typed array that views elements start to end of ta. The slice shares "
+              "storage with ta, so writes to one are seen by the other. start and end behave "
+              "as in `slice`.") {
+    JanetTArray *ta = janet_gettarray(argv, 0);
+    JanetRange range = janet_getslice(argc, argv);
+    int32_t offset = ta->offset + range.start * (int32_t) ta_type_sizes[ta->type];
+    return janet_wrap_abstract(janet_tarray_view(ta->type, ta->buffer, offset,
+                               range.end - range.start));
+}
+
+JANET_CORE_FN(cfun_tarray_copy,
+              "(tarray/copy ta)",
+              "Create a new typed array with its own buffer and the same elements as ta.") {
+    janet_fixarity(argc, 1);
+    JanetTArray *ta = janet_gettarray(argv, 0);
+    JanetTArray *copy = janet_tarray(ta->type, ta->length);
+    size_t nbytes = (size_t) ta->length * ta_type_sizes[ta->type];
+    if (nbytes) memcpy(janet_tarray_data(copy), janet_tarray_data(ta), nbytes);
+    return janet_wrap_abstract(copy);
+}
+
+JANET_CORE_FN(cfun_tarray_to_array,
+              "(tarray/to-array ta)",
+              "Create a new array with the elements of a typed array.") {
+    janet_fixarity(argc, 1);
+    JanetTArray *ta = janet_gettarray(argv, 0);
+    const void *data = janet_tarray_data(ta);
+    JanetArray *array = janet_array(ta->length);
+    for (int32_t i = 0; i < ta->length; i++) {
+        array->data[i] = janet_wrap_number(ta_get(ta->type, data, i));
+    }
+    array->count = ta->length;
+    return janet_wrap_array(array);
+}
+
+JANET_CORE_FN(cfun_tarray_fill,
+              "(tarray/fill ta x)",
+              "Set every element of ta to the number x. Returns ta.") {
+    janet_fixarity(argc, 2);
+    JanetTArray *ta = janet_gettarray(argv, 0);
+    double x = janet_getnumber(argv, 1);
+    void *data = janet_tarray_data(ta);
+    if (ta->length) ta_set(ta->type, data, 0, x);
+    size_t size = ta_type_sizes[ta->type];
+    for (int32_t i = 1; i < ta->length; i++) {
+        memcpy((uint8_t *) data + i * size, data, size);
+    }
+    return argv[0];
+}
+
+static Janet ta_binop_cfun(TABinop op, int32_t argc, Janet *argv) {
+    janet_arity(argc, 2, 3);
+    JanetTArray *a = janet_gettarray(argv, 0);
+    JanetTArray *b = NULL;
+    double scalar = 0.0;
+    if (janet_checktype(argv[1], JANET_NUMBER)) {
+        scalar = janet_unwrap_number(argv[1]);
+    } else {
+        b = ta_getpeer(argv, 1, a);
+    }
+    JanetTArray *dest = ta_getdest(argc, argv, 2, a);
+    ta_binop(op, a->type, janet_tarray_data(dest), janet_tarray_data(a),
+             b ? janet_tarray_data(b) : NULL, scalar, a->length);
+    return janet_wrap_abstract(dest);
+}
+
+JANET_CORE_FN(cfun_tarray_add,
+              "(tarray/add a b &opt into)",
+              "Add a and b elementwise. a is a typed array, and b is a number or a typed array "
+              "of the same type and length. Results are written to into, which may be a or b, "
+              "or to a new typed array. Integer types wrap on overflow. Returns the result.") {
+    return ta_binop_cfun(TA_ADD, argc, argv);
+}
+
+JANET_CORE_FN(cfun_tarray_sub,
+              "(tarray/sub a b &opt into)",
+              "Subtract b from a elementwise. Arguments are as in `tarray/add`.") {
+    return ta_binop_cfun(TA_SUB, argc, argv);
+}
+
+JANET_CORE_FN(cfun_tarray_mul,
+              "(tarray/mul a b &opt into)",
+              "Multiply a and b elementwise. Arguments are as in `tarray/add`.") {
+    return ta_binop_cfun(TA_MUL, argc, argv);
+}
+
+JANET_CORE_FN(cfun_tarray_div,
+              "(tarray/div a b &opt into)",
+              "Divide a by b elementwise. Arguments are as in `tarray/add`. Integer division "
+              "truncates and raises an error on division by zero.") {
+    return ta_binop_cfun(TA_DIV, argc, argv);
+}
+
+JANET_CORE_FN(cfun_tarray_sum,
+              "(tarray/sum ta)",
+              "Sum the elements of a typed array. Floating point elements are added in an "
+              "unspecified order.") {
+    janet_fixarity(argc, 1);
+    JanetTArray *ta = janet_gettarray(argv, 0);
+    return janet_wrap_number(ta_sum(ta->type, janet_tarray_data(ta), ta->length));
+}
+
+JANET_CORE_FN(cfun_tarray_dot,
+              "(tarray/dot a b)",
+              "Get the dot product of two typed arrays of the same type and length.") {
+    janet_fixarity(argc, 2);
+    JanetTArray *a = janet_gettarray(argv, 0);
+    JanetTArray *b = ta_getpeer(argv, 1, a);
+    return janet_wrap_number(ta_dot(a->type, janet_tarray_data(a), janet_tarray_data(b), a->length));
+}
+
+JANET_CORE_FN(cfun_tarray_min,
+              "(tarray/min ta)",
+              "Get the smallest element of a typed array, or nil if it is empty.") {
+    janet_fixarity(argc, 1);
+    JanetTArray *ta = janet_gettarray(argv, 0);
+    const void *data = janet_tarray_data(ta);
+    if (!ta->length) return janet_wrap_nil();
+    return janet_wrap_number(ta_min(ta->type, data, ta->length));
+}
+
+JANET_CORE_FN(cfun_tarray_max,
+              "(tarray/max ta)",
+              "Get the largest element of a typed array, or nil if it is empty.") {
+    janet_fixarity(argc, 1);
+    JanetTArray *ta = janet_gettarray(argv, 0);
+    const void *data = janet_tarray_data(ta);
+    if (!ta->length) return janet_wrap_nil();
+    return janet_wrap_number(ta_max(ta->type, data, ta->length));
+}
+
+JANET_CORE_FN(cfun_tarray_map,
+              "(tarray/map ta f &opt into)",
+              "Call f on each element of ta and write the results to into, which may be ta, "
+              "or to a new typed array of the same type. Unary functions from the math module "
+              "such as math/sqrt are applied natively without a call per element. "
+              "Returns the result.") {
+    janet_arity(argc, 2, 3);
+    JanetTArray *ta = janet_gettarray(argv, 0);
+    Janet f = argv[1];
+    double (*native)(double) = ta_native_math(f);
+    if (!native && !janet_checktypes(f, JANET_TFLAG_FUNCTION | JANET_TFLAG_CFUNCTION))
+        janet_panic_type(f, 1, JANET_TFLAG_FUNCTION | JANET_TFLAG_CFUNCTION);
+    JanetTArray *dest = ta_getdest(argc, argv, 2, ta);
+    if (native) {
+        ta_map_native(ta->type, janet_tarray_data(dest), janet_tarray_data(ta), ta->length, native);
+        return janet_wrap_abstract(dest);
+    }
+    for (int32_t i = 0; i < ta->length; i++) {
+        Janet x = janet_wrap_number(ta_get(ta->type, janet_tarray_data(ta), i));
+        Janet y = janet_checktype(f, JANET_CFUNCTION)
+                  ? janet_unwrap_cfunction(f)(1, &x)
+                  : janet_call(janet_unwrap_function(f), 1, &x);
+        if (!janet_checktype(y, JANET_NUMBER))
+            janet_panicf("expected number from mapping function, got %v", y);
+        ta_set(dest->type, janet_tarray_data(dest), i, janet_unwrap_number(y));
+    }
+    return janet_wrap_abstract(dest);
+}
+
+JANET_CORE_FN(cfun_tarray_sort,
+              "(tarray/sort ta)",
+              "Sort the elements of a typed array in place in ascending order. NaN sorts last. "
+              "Returns ta.") {
+    janet_fixarity(argc, 1);
+    JanetTArray *ta = janet_gettarray(argv, 0);
+    void *data = janet_tarray_data(ta);
+    if (ta->length > 1) {
+        qsort(data, (size_t) ta->length, ta_type_sizes[ta->type], ta_comparators[ta->type]);
+    }
+    return argv[0];
+}
+
+/* Load the typed array module */
+void janet_lib_typed_array(JanetTable *env) {
+    JanetRegExt tarray_cfuns[] = {
+        JANET_CORE_REG("tarray/new", cfun_tarray_new),
+        JANET_CORE_REG("tarray/from", cfun_tarray_from),
+        JANET_CORE_REG("tarray/view", cfun_tarray_view),
+        JANET_CORE_REG("tarray/buffer", cfun_tarray_buffer),
+        JANET_CORE_REG("tarray/type", cfun_tarray_type),
+        JANET_CORE_REG("tarray/slice", cfun_tarray_slice),
+        JANET_CORE_REG("tarray/copy", cfun_tarray_copy),
+        JANET_CORE_REG("tarray/to-array", cfun_tarray_to_array),
+        JANET_CORE_REG("tarray/fill", cfun_tarray_fill),
+        JANET_CORE_REG("tarray/add", cfun_tarray_add),
+        JANET_CORE_REG("tarray/sub", cfun_tarray_sub),
+        JANET_CORE_REG("tarray/mul", cfun_tarray_mul),
+        JANET_CORE_REG("tarray/div", cfun_tarray_div),
+        JANET_CORE_REG("tarray/sum", cfun_tarray_sum),
+        JANET_CORE_REG("tarray/dot", cfun_tarray_dot),
+        JANET_CORE_REG("tarray/min", cfun_tarray_min),
+        JANET_CORE_REG("tarray/max", cfun_tarray_max),
+        JANET_CORE_REG("tarray/map", cfun_tarray_map),
+        JANET_CORE_REG("tarray/sort", cfun_tarray_sort),
+        JANET_REG_END
+    };
+    janet_core_cfuns_ext(env, NULL, tarray_cfuns);
+    janet_register_abstract_type(&janet_tarray_type);
+}
+
+#endif
@@ -50,6 +50,10 @@
 #endif
 
 #define JANET_MARSHAL_DECREF 0x40000
+#define JANET_MARSHAL_LAZY 0x80000
+/* Hand buffer memory to the unmarshalling thread. Only used by threaded channels made with
+ * the :m flag, and needed on both sides together with JANET_MARSHAL_UNSAFE. */
+#define JANET_MARSHAL_MOVE 0x200000
 
 #define janet_assert(c, m) do { \
     if (!(c)) JANET_EXIT((m)); \
@@ -67,11 +71,49 @@ int32_t janet_string_calchash(const uint8_t *str, int32_t len);
 int32_t janet_tablen(int32_t n);
 void safe_memcpy(void *dest, const void *src, size_t len);
 void janet_buffer_push_types(JanetBuffer *buffer, int types);
+void janet_buffer_borrow(JanetBuffer *buffer);
+void janet_buffer_unborrow(JanetBuffer *buffer);
+int janet_buffer_borrowed(JanetBuffer *buffer);
+void janet_buffer_borrow_values(const Janet *values, int32_t n, int borrow);
+size_t janet_buffer_borrow_scope(Janet x);
+void janet_buffer_unborrow_scope(size_t mark);
 const JanetKV *janet_dict_find(const JanetKV *buckets, int32_t cap, Janet key);
 void janet_memempty(JanetKV *mem, int32_t count);
 void *janet_memalloc_empty(int32_t count);
+
+/* SSE2 is always available on x86-64 */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define JANET_SSE2
+#endif
+
+/* Tables keep one byte of metadata per bucket after their buckets, plus a copy
+ * of the first JANET_TABLE_GROUP - 1 bytes so a group can be read from any bucket. */
+#ifdef JANET_SSE2
+#define JANET_TABLE_SSE2
+#define JANET_TABLE_GROUP 16
+#else
+#define JANET_TABLE_GROUP 8
+#endif
+#define janet_table_datasize(cap) ((cap) \
+    ? (size_t)(cap) * (sizeof(JanetKV) + 1) + JANET_TABLE_GROUP - 1 \
+    : 0)
 JanetTable *janet_get_core_table(const char *name);
 void janet_def_addflags(JanetFuncDef *def);
+void janet_bytecode_peephole(JanetFuncDef *def);
+void janet_bytecode_compact(JanetFuncDef *def);
+void janet_bytecode_fuse(JanetFuncDef *def);
+void janet_bytecode_specialize(JanetFuncDef *def);
+int32_t janet_bytecode_specializations(const JanetFuncDef *def);
+uint32_t janet_bytecode_generic(uint32_t instr);
+int janet_bytecode_slots(uint32_t instr, int32_t *uses, int32_t *def);
+
+/* Most values a jump table instruction can dispatch on */
+#define JANET_JUMP_TABLE_MAX 256
+
+/* Decode the body of a funcdef unmarshalled with JANET_MARSHAL_LAZY */
+void janet_funcdef_force(JanetFuncDef *def);
+
+int janet_math_returns_number(JanetCFunction cfun);
 const void *janet_strbinsearch(
     const void *tab,
     size_t tabcount,
@@ -83,8 +125,19 @@ void janet_buffer_format(
     int32_t argstart,
     int32_t argc,
     Janet *argv);
+void janet_buffer_format_value(
+    JanetBuffer *b,
+    int32_t argstart,
+    int32_t argc,
+    Janet *argv);
+extern const JanetAbstractType janet_format_type;
+void *janet_format_compile(JanetString source);
+void janet_buffer_push_shortest(JanetBuffer *buffer, double x);
 Janet janet_next_impl(Janet ds, Janet key, int is_interpreter);
 JanetBinding janet_binding_from_entry(Janet entry);
+#ifdef JANET_INT_TYPES
+int janet_int64_binop(char op, Janet lhs, Janet rhs, Janet *out);
+#endif
 
 /* Registry functions */
 void janet_registry_put(
@@ -95,6 +148,35 @@ void janet_registry_put(
     int32_t source_line);
 JanetCFunRegistry *janet_registry_get(JanetCFunction key);
 
+#if defined(JANET_ASSEMBLER) || defined(JANET_OPCODE_STATS)
+const char *janet_opcode_name(uint32_t opcode);
+#endif
+
+/* Record a profiler sample of the running fiber's stack */
+void janet_profile_sample(JanetFiber *fiber);
+
+/* Record a structured trace event if events of its kind are enabled. Probes are
+ * nops that perf, bpftrace and dtrace can attach to, and only exist with JANET_USDT. */
+void janet_trace_emit(uint32_t type, uint32_t arg, const void *subject);
+#define janet_trace(KIND, TYPE, ARG, SUBJECT) do { \
+    if (janet_vm.trace_mask & (KIND)) janet_trace_emit((TYPE), (ARG), (SUBJECT)); \
+} while (0)
+#ifdef JANET_USDT
+#include <sys/sdt.h>
+#define janet_probe1(NAME, A) DTRACE_PROBE1(janet, NAME, A)
+#define janet_probe2(NAME, A, B) DTRACE_PROBE2(janet, NAME, A, B)
+#else
+#define janet_probe1(NAME, A)
+#define janet_probe2(NAME, A, B)
+#endif
+
+/* Machine code for hot funcdefs */
+#ifdef JANET_JIT
+uint32_t *janet_jit_run(JanetFuncDef *def, Janet *stack, uint32_t *pc);
+void janet_jit_free(JanetFuncDef *def);
+void janet_jit_invalidate(JanetFuncDef *def);
+#endif
+
 /* Inside the janet core, defining globals is different
  * at bootstrap time and normal runtime */
 #ifdef JANET_BOOTSTRAP
@@ -131,6 +213,7 @@ void janet_lib_tuple(JanetTable *env);
 void janet_lib_buffer(JanetTable *env);
 void janet_lib_table(JanetTable *env);
 void janet_lib_struct(JanetTable *env);
+void janet_lib_hmap(JanetTable *env);
 void janet_lib_fiber(JanetTable *env);
 void janet_lib_os(JanetTable *env);
 void janet_lib_string(JanetTable *env);
@@ -144,6 +227,9 @@ void janet_lib_debug(JanetTable *env);
 #ifdef JANET_PEG
 void janet_lib_peg(JanetTable *env);
 #endif
+#ifdef JANET_JSON
+void janet_lib_json(JanetTable *env);
+#endif
 #ifdef JANET_TYPED_ARRAY
 void janet_lib_typed_array(JanetTable *env);
 #endif
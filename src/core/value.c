@@ -146,9 +146,13 @@ Janet janet_next_impl(Janet ds, Janet key, int is_interpreter) {
                 start = st;
             }
             const JanetKV *end = start + cap;
-            const JanetKV *kv = janet_checktype(key, JANET_NIL)
-                                ? start
-                                : janet_dict_find(start, cap, key) + 1;
+            const JanetKV *kv = start;
+            if (!janet_checktype(key, JANET_NIL)) {
+                kv = janet_dict_find(start, cap, key);
+                /* Small structs have no empty buckets, so a missing key is not found at all */
+                if (kv == &janet_vm.missing_kv) break;
+                kv++;
+            }
             while (kv < end) {
                 if (!janet_checktype(kv->key, JANET_NIL)) return kv->key;
                 kv++;
@@ -323,10 +327,11 @@ int32_t janet_hash(Janet x) {
             } as;
             as.d = janet_unwrap_number(x);
             as.d += 0.0; /* normalize negative 0 */
-            uint32_t lo = (uint32_t)(as.u & 0xFFFFFFFF);
-            uint32_t hi = (uint32_t)(as.u >> 32);
-            uint32_t hilo = (hi ^ lo) * 2654435769u;
-            hash = (int32_t)((hilo << 16) | (hilo >> 16));
+            /* The low bits of integral doubles are all zero, so fold in the
+             * high bits and keep the top half of the product, which depends
+             * on every bit of the input. */
+            uint64_t mixed = (as.u ^ (as.u >> 32)) * 0x9E3779B97F4A7C15ULL;
+            hash = (int32_t)(mixed >> 32);
             break;
         }
         case JANET_ABSTRACT: {
@@ -690,6 +695,7 @@ void janet_putindex(Janet ds, int32_t index, Janet value) {
                 janet_array_ensure(array, index + 1, 2);
                 array->count = index + 1;
             }
+            janet_gc_barrier_value(array, value);
             array->data[index] = value;
             break;
         }
@@ -732,6 +738,7 @@ void janet_put(Janet ds, Janet key, Janet value) {
             if (index >= array->count) {
                 janet_array_setcount(array, index + 1);
             }
+            janet_gc_barrier_value(array, value);
             array->data[index] = value;
             break;
         }
@@ -57,19 +57,41 @@
 #define JANET_USE_COMPUTED_GOTOS
 #endif
 
+/* With JANET_OPCODE_STATS, count how many times each instruction and each pair of
+ * consecutive instructions is dispatched. Pairs are not counted across entries into
+ * the interpreter loop. */
+#ifdef JANET_OPCODE_STATS
+#define vm_count_opcode(op) do { \
+    uint32_t _op = (op); \
+    if (_op < JOP_INSTRUCTION_COUNT) { \
+        janet_vm.opcode_counts[_op]++; \
+        if (janet_vm.opcode_last < JOP_INSTRUCTION_COUNT) \
+            janet_vm.opcode_pairs[janet_vm.opcode_last * JOP_INSTRUCTION_COUNT + _op]++; \
+    } \
+    janet_vm.opcode_last = _op; \
+} while (0)
+#define vm_count_first_opcode(op) do { \
+    janet_vm.opcode_last = JOP_INSTRUCTION_COUNT; \
+    vm_count_opcode(op); \
+} while (0)
+#else
+#define vm_count_opcode(op)
+#define vm_count_first_opcode(op)
+#endif
+
 #ifdef JANET_USE_COMPUTED_GOTOS
-#define VM_START() { goto *op_lookup[first_opcode];
+#define VM_START() { vm_count_first_opcode(first_opcode); goto *op_lookup[first_opcode];
 #define VM_END() }
 #define VM_OP(op) label_##op :
 #define VM_DEFAULT() label_unknown_op:
-#define vm_next() goto *op_lookup[*pc & 0xFF]
+#define vm_next() vm_count_opcode(*pc & 0xFF); goto *op_lookup[*pc & 0xFF]
 #define opcode (*pc & 0xFF)
 #else
-#define VM_START() uint8_t opcode = first_opcode; for (;;) {switch(opcode) {
+#define VM_START() uint8_t opcode = first_opcode; vm_count_first_opcode(opcode); for (;;) {switch(opcode) {
 #define VM_END() }}
 #define VM_OP(op) case op :
 #define VM_DEFAULT() default:
-#define vm_next() opcode = *pc & 0xFF; continue
+#define vm_next() opcode = *pc & 0xFF; vm_count_opcode(opcode); continue
 #endif
 
 /* Commit and restore VM state before possible longjmp */
@@ -91,7 +113,9 @@
 
 /* Next instruction variations */
 #define maybe_collect() do {\
-    if (janet_vm.next_collection >= janet_vm.gc_interval) janet_collect(); } while (0)
+    if (janet_vm.next_collection >= janet_vm.gc_interval || (janet_vm.gc_phase && \
+            janet_vm.next_collection >= janet_vm.gc_step_budget * JANET_GC_STEP_RATIO)) \
+        janet_collect_minor(); } while (0)
 #define vm_checkgc_next() maybe_collect(); vm_next()
 #define vm_pcnext() pc++; vm_next()
 #define vm_checkgc_pcnext() maybe_collect(); vm_pcnext()
@@ -115,14 +139,43 @@
 #define vm_maybe_auto_suspend(COND)
 #else
 #define vm_maybe_auto_suspend(COND) do { \
-    if ((COND) && janet_vm.auto_suspend) { \
-        janet_vm.auto_suspend = 0; \
-        fiber->flags |= (JANET_FIBER_RESUME_NO_USEVAL | JANET_FIBER_RESUME_NO_SKIP); \
-        vm_return(JANET_SIGNAL_INTERRUPT, janet_wrap_nil()); \
+    if ((COND) && (janet_vm.auto_suspend | janet_vm.profile_request)) { \
+        if (janet_vm.profile_request) { \
+            vm_commit(); \
+            janet_profile_sample(fiber); \
+        } \
+        if (janet_vm.auto_suspend && (janet_vm.auto_suspend != JANET_SUSPEND_SLICE || \
+                                      janet_vm.resume_depth == janet_vm.slice_depth)) { \
+            janet_vm.slice_preempted = janet_vm.auto_suspend == JANET_SUSPEND_SLICE; \
+            janet_vm.auto_suspend = 0; \
+            fiber->flags |= (JANET_FIBER_RESUME_NO_USEVAL | JANET_FIBER_RESUME_NO_SKIP); \
+            vm_return(JANET_SIGNAL_INTERRUPT, janet_wrap_nil()); \
+        } \
     } \
 } while (0)
 #endif
 
+/* Hand hot bytecode to the JIT once a funcdef has run enough backward jumps and calls */
+#ifdef JANET_JIT
+#ifndef JANET_JIT_THRESHOLD
+#define JANET_JIT_THRESHOLD 1000
+#endif
+#define vm_maybe_jit(COND) do { \
+    if ((COND) && (func->def->jit || ++func->def->hotness >= JANET_JIT_THRESHOLD)) { \
+        pc = janet_jit_run(func->def, stack, pc); \
+    } \
+} while (0)
+#else
+#define vm_maybe_jit(COND)
+#endif
+
+/* Boxed 64 bit integers skip the method lookup in arithmetic opcodes */
+#ifdef JANET_INT_TYPES
+#define vm_int64_binop(c, x, y, out) janet_int64_binop((c), (x), (y), (out))
+#else
+#define vm_int64_binop(c, x, y, out) 0
+#endif
+
 /* Templates for certain patterns in opcodes */
 #define vm_binop_immediate(op)\
     {\
@@ -130,7 +183,8 @@
         if (!janet_checktype(op1, JANET_NUMBER)) {\
             vm_commit();\
             Janet _argv[2] = { op1, janet_wrap_number(CS) };\
-            stack[A] = janet_mcall(#op, 2, _argv);\
+            if (!vm_int64_binop(#op[0], op1, _argv[1], stack + A))\
+                stack[A] = janet_mcall(#op, 2, _argv);\
             vm_checkgc_pcnext();\
         } else {\
             double x1 = janet_unwrap_number(op1);\
@@ -144,7 +198,8 @@
         if (!janet_checktype(op1, JANET_NUMBER)) {\
             vm_commit();\
             Janet _argv[2] = { op1, janet_wrap_number(CS) };\
-            stack[A] = janet_mcall(#op, 2, _argv);\
+            if (!vm_int64_binop(#op[0], op1, _argv[1], stack + A))\
+                stack[A] = janet_mcall(#op, 2, _argv);\
             vm_checkgc_pcnext();\
         } else {\
             type1 x1 = (type1) janet_unwrap_integer(op1);\
@@ -165,7 +220,8 @@
             vm_pcnext();\
         } else {\
             vm_commit();\
-            stack[A] = janet_binop_call(#op, "r" #op, op1, op2);\
+            if (!vm_int64_binop(#op[0], op1, op2, stack + A))\
+                stack[A] = janet_binop_call(#op, "r" #op, op1, op2);\
             vm_checkgc_pcnext();\
         }\
     }
@@ -181,7 +237,8 @@
             vm_pcnext();\
         } else {\
             vm_commit();\
-            stack[A] = janet_binop_call(#op, "r" #op, op1, op2);\
+            if (!vm_int64_binop(#op[0], op1, op2, stack + A))\
+                stack[A] = janet_binop_call(#op, "r" #op, op1, op2);\
             vm_checkgc_pcnext();\
         }\
     }
@@ -217,6 +274,62 @@
         }\
     }
 
+/* Superinstructions do the work of their own opcode, and of the jump that the compiler
+ * emitted right after it, in one dispatch. The second instruction is still in the bytecode,
+ * so jumps to it keep working. If it has a breakpoint set, only the first half runs, and the
+ * second instruction is dispatched normally. */
+#define vm_jump_if_not_next(cond) \
+    {\
+        uint32_t _next = pc[1];\
+        stack[A] = janet_wrap_boolean(cond);\
+        if ((_next & 0xFF) != JOP_JUMP_IF_NOT) {\
+            vm_pcnext();\
+        } else if (janet_unwrap_boolean(stack[A])) {\
+            pc += 2;\
+            vm_next();\
+        } else {\
+            int32_t _offset = ((int32_t) _next) >> 16;\
+            pc += 1 + _offset;\
+            vm_maybe_auto_suspend(_offset < 0);\
+            vm_maybe_jit(_offset < 0);\
+            vm_next();\
+        }\
+    }
+#define vm_compop_jump(op) \
+    {\
+        Janet op1 = stack[B];\
+        Janet op2 = stack[C];\
+        if (janet_checktype(op1, JANET_NUMBER) && janet_checktype(op2, JANET_NUMBER)) {\
+            vm_jump_if_not_next(janet_unwrap_number(op1) op janet_unwrap_number(op2));\
+        } else {\
+            vm_commit();\
+            stack[A] = janet_wrap_boolean(janet_compare(op1, op2) op 0);\
+            vm_checkgc_pcnext();\
+        }\
+    }
+#define vm_compop_imm_jump(op) \
+    {\
+        Janet op1 = stack[B];\
+        if (janet_checktype(op1, JANET_NUMBER)) {\
+            vm_jump_if_not_next(janet_unwrap_number(op1) op (double) CS);\
+        } else {\
+            vm_commit();\
+            stack[A] = janet_wrap_boolean(janet_compare(op1, janet_wrap_integer(CS)) op 0);\
+            vm_checkgc_pcnext();\
+        }\
+    }
+
+/* Arithmetic and comparisons on slots the compiler has proven to hold numbers */
+#define vm_binop_number(op)\
+    stack[A] = janet_wrap_number(janet_unwrap_number(stack[B]) op janet_unwrap_number(stack[C]));\
+    vm_pcnext();
+#define vm_binop_immediate_number(op)\
+    stack[A] = janet_wrap_number(janet_unwrap_number(stack[B]) op CS);\
+    vm_pcnext();
+#define vm_compop_number(op)\
+    stack[A] = janet_wrap_boolean(janet_unwrap_number(stack[B]) op janet_unwrap_number(stack[C]));\
+    vm_pcnext();
+
 /* Trace a function call */
 static void vm_do_trace(JanetFunction *func, int32_t argc, const Janet *argv) {
     if (func->def->name) {
@@ -230,6 +343,24 @@ static void vm_do_trace(JanetFunction *func, int32_t argc, const Janet *argv) {
     janet_printf(")\n");
 }
 
+/* Record entering and leaving functions for structured tracing and probes */
+#define vm_trace_enter(DEF) do { \
+    janet_probe2(function__entry, (DEF)->name, (DEF)); \
+    janet_trace(JANET_TRACE_CALLS, JANET_TRACE_ENTER, 0, (DEF)); \
+} while (0)
+#define vm_trace_exit(DEF) do { \
+    janet_trace(JANET_TRACE_CALLS, JANET_TRACE_EXIT, 0, (DEF)); \
+    janet_probe2(function__return, (DEF)->name, (DEF)); \
+} while (0)
+#define vm_trace_center(CFUN) do { \
+    janet_probe1(cfunction__entry, (void *)(CFUN)); \
+    janet_trace(JANET_TRACE_CALLS, JANET_TRACE_ENTER, 1, (const void *)(CFUN)); \
+} while (0)
+#define vm_trace_cexit(CFUN) do { \
+    janet_trace(JANET_TRACE_CALLS, JANET_TRACE_EXIT, 1, (const void *)(CFUN)); \
+    janet_probe1(cfunction__return, (void *)(CFUN)); \
+} while (0)
+
 /* Invoke a method once we have looked it up */
 static Janet janet_method_invoke(Janet method, int32_t argc, Janet *argv) {
     switch (janet_type(method)) {
@@ -269,9 +400,83 @@ static Janet janet_method_invoke(Janet method, int32_t argc, Janet *argv) {
 
 /* Call a non function type from a JOP_CALL or JOP_TAILCALL instruction.
  * Assumes that the arguments are on the fiber stack. */
-static Janet call_nonfn(JanetFiber *fiber, Janet callee) {
+/* Inline caches. Lookups of keyword and symbol keys in tables and structs remember
+ * which slot the key was found in, keyed by the address of the instruction. An entry
+ * is only a hint: it is used if the slot still holds the key, and the tables (or structs)
+ * closer in the prototype chain do not, so nothing needs to be invalidated when tables
+ * change or bytecode is freed. */
+
+#define JANET_ICACHE_KEYS (JANET_TFLAG_KEYWORD | JANET_TFLAG_SYMBOL)
+
+#define janet_icache_entry(pc) (janet_vm.icache + (((uintptr_t)(pc) >> 2) & (JANET_ICACHE_SIZE - 1)))
+#define janet_icache_match(kv, key) (janet_type((kv)->key) == janet_type(key) && \
+        janet_unwrap_string((kv)->key) == janet_unwrap_string(key))
+
+static Janet janet_icache_fill(JanetInlineCache *ic, const uint32_t *pc, int32_t level,
+                               const JanetKV *data, const JanetKV *kv) {
+    ic->pc = pc;
+    ic->level = level;
+    ic->index = (int32_t)(kv - data);
+    return kv->value;
+}
+
+static Janet janet_icache_table_get(JanetTable *t, Janet key, const uint32_t *pc) {
+    JanetInlineCache *ic = janet_icache_entry(pc);
+    int32_t level = 0;
+    if (ic->pc == pc) {
+        for (; level < ic->level && NULL != t; level++, t = t->proto) {
+            JanetKV *kv = janet_table_find(t, key);
+            if (NULL != kv && !janet_checktype(kv->key, JANET_NIL))
+                return janet_icache_fill(ic, pc, level, t->data, kv);
+        }
+        if (NULL != t && ic->index < t->capacity && janet_icache_match(t->data + ic->index, key))
+            return t->data[ic->index].value;
+    }
+    for (; level < JANET_MAX_PROTO_DEPTH && NULL != t; level++, t = t->proto) {
+        JanetKV *kv = janet_table_find(t, key);
+        if (NULL != kv && !janet_checktype(kv->key, JANET_NIL))
+            return janet_icache_fill(ic, pc, level, t->data, kv);
+    }
+    return janet_wrap_nil();
+}
+
+static Janet janet_icache_struct_get(const JanetKV *st, Janet key, const uint32_t *pc) {
+    JanetInlineCache *ic = janet_icache_entry(pc);
+    int32_t level = 0;
+    if (ic->pc == pc) {
+        for (; level < ic->level && NULL != st; level++, st = janet_struct_proto(st)) {
+            const JanetKV *kv = janet_struct_find(st, key);
+            if (NULL != kv && !janet_checktype(kv->key, JANET_NIL))
+                return janet_icache_fill(ic, pc, level, st, kv);
+        }
+        if (NULL != st && ic->index < janet_struct_capacity(st) && janet_icache_match(st + ic->index, key))
+            return st[ic->index].value;
+    }
+    for (; level < JANET_MAX_PROTO_DEPTH && NULL != st; level++, st = janet_struct_proto(st)) {
+        const JanetKV *kv = janet_struct_find(st, key);
+        if (NULL != kv && !janet_checktype(kv->key, JANET_NIL))
+            return janet_icache_fill(ic, pc, level, st, kv);
+    }
+    return janet_wrap_nil();
+}
+
+/* Same as janet_get, but uses the inline cache for the instruction at pc */
+static Janet janet_icache_get(Janet ds, Janet key, const uint32_t *pc) {
+    if (janet_checktypes(key, JANET_ICACHE_KEYS)) {
+        if (janet_checktype(ds, JANET_TABLE))
+            return janet_icache_table_get(janet_unwrap_table(ds), key, pc);
+        if (janet_checktype(ds, JANET_STRUCT))
+            return janet_icache_struct_get(janet_unwrap_struct(ds), key, pc);
+    }
+    return janet_get(ds, key);
+}
+
+static Janet call_nonfn(JanetFiber *fiber, Janet callee, const uint32_t *pc) {
     int32_t argc = fiber->stacktop - fiber->stackstart;
     fiber->stacktop = fiber->stackstart;
+    if (argc == 1 && janet_checktypes(callee, JANET_TFLAG_DICTIONARY)) {
+        return janet_icache_get(callee, fiber->data[fiber->stacktop], pc);
+    }
     return janet_method_invoke(callee, argc, fiber->data + fiber->stacktop);
 }
 
@@ -281,10 +486,10 @@ static Janet method_to_fun(Janet method, Janet obj) {
 }
 
 /* Get a callable from a keyword method name and ensure that it is valid. */
-static Janet resolve_method(Janet name, JanetFiber *fiber) {
+static Janet resolve_method(Janet name, JanetFiber *fiber, const uint32_t *pc) {
     int32_t argc = fiber->stacktop - fiber->stackstart;
     if (argc < 1) janet_panicf("method call (%v) takes at least 1 argument, got 0", name);
-    Janet callee = method_to_fun(name, fiber->data[fiber->stackstart]);
+    Janet callee = janet_icache_get(fiber->data[fiber->stackstart], name, pc);
     if (janet_checktype(callee, JANET_NIL))
         janet_panicf("unknown method %v invoked on %v", name, fiber->data[fiber->stackstart]);
     return callee;
@@ -399,29 +604,29 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         &&label_JOP_NOT_EQUALS,
         &&label_JOP_NOT_EQUALS_IMMEDIATE,
         &&label_JOP_CANCEL,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
+        &&label_JOP_LESS_THAN_JUMP_IF_NOT,
+        &&label_JOP_LESS_THAN_EQUAL_JUMP_IF_NOT,
+        &&label_JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT,
+        &&label_JOP_GREATER_THAN_JUMP_IF_NOT,
+        &&label_JOP_GREATER_THAN_EQUAL_JUMP_IF_NOT,
+        &&label_JOP_GREATER_THAN_IMMEDIATE_JUMP_IF_NOT,
+        &&label_JOP_EQUALS_JUMP_IF_NOT,
+        &&label_JOP_EQUALS_IMMEDIATE_JUMP_IF_NOT,
+        &&label_JOP_NOT_EQUALS_JUMP_IF_NOT,
+        &&label_JOP_NOT_EQUALS_IMMEDIATE_JUMP_IF_NOT,
+        &&label_JOP_ADD_IMMEDIATE_JUMP,
+        &&label_JOP_ADD_NUMBER,
+        &&label_JOP_SUBTRACT_NUMBER,
+        &&label_JOP_MULTIPLY_NUMBER,
+        &&label_JOP_DIVIDE_NUMBER,
+        &&label_JOP_ADD_IMMEDIATE_NUMBER,
+        &&label_JOP_MULTIPLY_IMMEDIATE_NUMBER,
+        &&label_JOP_DIVIDE_IMMEDIATE_NUMBER,
+        &&label_JOP_LESS_THAN_NUMBER,
+        &&label_JOP_LESS_THAN_EQUAL_NUMBER,
+        &&label_JOP_GREATER_THAN_NUMBER,
+        &&label_JOP_GREATER_THAN_EQUAL_NUMBER,
+        &&label_JOP_JUMP_TABLE,
         &&label_unknown_op,
         &&label_unknown_op,
         &&label_unknown_op,
@@ -644,6 +849,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     VM_OP(JOP_RETURN) {
         Janet retval = stack[D];
         int entrance_frame = janet_stack_frame(stack)->flags & JANET_STACKFRAME_ENTRANCE;
+        vm_trace_exit(func->def);
         janet_fiber_popframe(fiber);
         if (entrance_frame) vm_return_no_restore(JANET_SIGNAL_OK, retval);
         vm_restore();
@@ -654,6 +860,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     VM_OP(JOP_RETURN_NIL) {
         Janet retval = janet_wrap_nil();
         int entrance_frame = janet_stack_frame(stack)->flags & JANET_STACKFRAME_ENTRANCE;
+        vm_trace_exit(func->def);
         janet_fiber_popframe(fiber);
         if (entrance_frame) vm_return_no_restore(JANET_SIGNAL_OK, retval);
         vm_restore();
@@ -693,7 +900,8 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
             vm_pcnext();
         } else {
             vm_commit();
-            stack[A] = janet_binop_call("mod", "rmod", op1, op2);
+            if (!vm_int64_binop('m', op1, op2, stack + A))
+                stack[A] = janet_binop_call("mod", "rmod", op1, op2);
             vm_checkgc_pcnext();
         }
     }
@@ -708,7 +916,8 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
             vm_pcnext();
         } else {
             vm_commit();
-            stack[A] = janet_binop_call("%", "r%", op1, op2);
+            if (!vm_int64_binop('%', op1, op2, stack + A))
+                stack[A] = janet_binop_call("%", "r%", op1, op2);
             vm_checkgc_pcnext();
         }
     }
@@ -758,12 +967,14 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     VM_OP(JOP_JUMP)
     pc += DS;
     vm_maybe_auto_suspend(DS < 0);
+    vm_maybe_jit(DS < 0);
     vm_next();
 
     VM_OP(JOP_JUMP_IF)
     if (janet_truthy(stack[A])) {
         pc += ES;
         vm_maybe_auto_suspend(ES < 0);
+        vm_maybe_jit(ES < 0);
     } else {
         pc++;
     }
@@ -775,6 +986,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     } else {
         pc += ES;
         vm_maybe_auto_suspend(ES < 0);
+        vm_maybe_jit(ES < 0);
     }
     vm_next();
 
@@ -782,6 +994,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     if (janet_checktype(stack[A], JANET_NIL)) {
         pc += ES;
         vm_maybe_auto_suspend(ES < 0);
+        vm_maybe_jit(ES < 0);
     } else {
         pc++;
     }
@@ -793,9 +1006,18 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     } else {
         pc += ES;
         vm_maybe_auto_suspend(ES < 0);
+        vm_maybe_jit(ES < 0);
     }
     vm_next();
 
+    /* The constant maps values to the index of a jump after this instruction.
+     * Values that are not in the table take the first jump. */
+    VM_OP(JOP_JUMP_TABLE) {
+        Janet index = janet_struct_get(janet_unwrap_struct(func->def->constants[E]), stack[A]);
+        pc += 1 + (janet_checktype(index, JANET_NUMBER) ? (int32_t) janet_unwrap_number(index) : 0);
+        vm_next();
+    }
+
     VM_OP(JOP_LESS_THAN)
     vm_compop( <);
 
@@ -834,6 +1056,82 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     stack[A] = janet_wrap_integer(janet_compare(stack[B], stack[C]));
     vm_pcnext();
 
+    VM_OP(JOP_LESS_THAN_JUMP_IF_NOT)
+    vm_compop_jump( <);
+
+    VM_OP(JOP_LESS_THAN_EQUAL_JUMP_IF_NOT)
+    vm_compop_jump( <=);
+
+    VM_OP(JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT)
+    vm_compop_imm_jump( <);
+
+    VM_OP(JOP_GREATER_THAN_JUMP_IF_NOT)
+    vm_compop_jump( >);
+
+    VM_OP(JOP_GREATER_THAN_EQUAL_JUMP_IF_NOT)
+    vm_compop_jump( >=);
+
+    VM_OP(JOP_GREATER_THAN_IMMEDIATE_JUMP_IF_NOT)
+    vm_compop_imm_jump( >);
+
+    VM_OP(JOP_EQUALS_JUMP_IF_NOT)
+    vm_jump_if_not_next(janet_equals(stack[B], stack[C]));
+
+    VM_OP(JOP_EQUALS_IMMEDIATE_JUMP_IF_NOT)
+    vm_jump_if_not_next(janet_unwrap_number(stack[B]) == (double) CS);
+
+    VM_OP(JOP_NOT_EQUALS_JUMP_IF_NOT)
+    vm_jump_if_not_next(!janet_equals(stack[B], stack[C]));
+
+    VM_OP(JOP_NOT_EQUALS_IMMEDIATE_JUMP_IF_NOT)
+    vm_jump_if_not_next(janet_unwrap_number(stack[B]) != (double) CS);
+
+    VM_OP(JOP_ADD_IMMEDIATE_JUMP)
+    if (!janet_checktype(stack[B], JANET_NUMBER) || (pc[1] & 0xFF) != JOP_JUMP) {
+        vm_binop_immediate(+);
+    }
+    {
+        int32_t offset = ((int32_t) pc[1]) >> 8;
+        stack[A] = janet_wrap_number(janet_unwrap_number(stack[B]) + CS);
+        pc += 1 + offset;
+        vm_maybe_auto_suspend(offset < 0);
+        vm_maybe_jit(offset < 0);
+        vm_next();
+    }
+
+    VM_OP(JOP_ADD_NUMBER)
+    vm_binop_number(+);
+
+    VM_OP(JOP_SUBTRACT_NUMBER)
+    vm_binop_number(-);
+
+    VM_OP(JOP_MULTIPLY_NUMBER)
+    vm_binop_number(*);
+
+    VM_OP(JOP_DIVIDE_NUMBER)
+    vm_binop_number( /);
+
+    VM_OP(JOP_ADD_IMMEDIATE_NUMBER)
+    vm_binop_immediate_number(+);
+
+    VM_OP(JOP_MULTIPLY_IMMEDIATE_NUMBER)
+    vm_binop_immediate_number(*);
+
+    VM_OP(JOP_DIVIDE_IMMEDIATE_NUMBER)
+    vm_binop_immediate_number( /);
+
+    VM_OP(JOP_LESS_THAN_NUMBER)
+    vm_compop_number( <);
+
+    VM_OP(JOP_LESS_THAN_EQUAL_NUMBER)
+    vm_compop_number( <=);
+
+    VM_OP(JOP_GREATER_THAN_NUMBER)
+    vm_compop_number( >);
+
+    VM_OP(JOP_GREATER_THAN_EQUAL_NUMBER)
+    vm_compop_number( >=);
+
     VM_OP(JOP_NEXT)
     vm_commit();
     {
@@ -899,6 +1197,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         if (env->offset > 0) {
             env->as.fiber->data[env->offset + vindex] = stack[A];
         } else {
+            janet_gc_barrier_value(env, stack[A]);
             env->as.values[vindex] = stack[A];
         }
         vm_pcnext();
@@ -909,6 +1208,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         JanetFunction *fn;
         int32_t elen;
         int32_t defindex = (int32_t)E;
+        vm_commit();
         vm_assert(defindex < func->def->defs_length, "invalid funcdef");
         fd = func->def->defs[defindex];
         elen = fd->environments_length;
@@ -929,6 +1229,24 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
                         frame->env = env;
                     }
                     fn->envs[i] = frame->env;
+                } else if (inherit == -2) {
+                    /* Copy captured values into a detached environment */
+                    int32_t clen = fd->captures_length;
+                    size_t s = sizeof(Janet) * (size_t) clen;
+                    JanetFuncEnv *env = janet_gcalloc(JANET_MEMORY_FUNCENV, sizeof(JanetFuncEnv));
+                    Janet *vmem = NULL;
+                    if (clen) {
+                        vmem = janet_malloc(s);
+                        if (NULL == vmem) {
+                            JANET_OUT_OF_MEMORY;
+                        }
+                        janet_vm.next_collection += (uint32_t) s;
+                        for (int32_t j = 0; j < clen; j++) vmem[j] = stack[fd->captures[j]];
+                    }
+                    env->offset = 0;
+                    env->length = clen;
+                    env->as.values = vmem;
+                    fn->envs[i] = env;
                 } else {
                     fn->envs[i] = func->envs[inherit];
                 }
@@ -973,7 +1291,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         }
         if (janet_checktype(callee, JANET_KEYWORD)) {
             vm_commit();
-            callee = resolve_method(callee, fiber);
+            callee = resolve_method(callee, fiber, pc);
         }
         if (janet_checktype(callee, JANET_FUNCTION)) {
             func = janet_unwrap_function(callee);
@@ -986,21 +1304,25 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
                 janet_panicf("%v called with %d argument%s, expected %d",
                              callee, n, n == 1 ? "" : "s", func->def->arity);
             }
+            vm_trace_enter(func->def);
             stack = fiber->data + fiber->frame;
             pc = func->def->bytecode;
+            vm_maybe_jit(1);
             vm_checkgc_next();
         } else if (janet_checktype(callee, JANET_CFUNCTION)) {
             vm_commit();
             int32_t argc = fiber->stacktop - fiber->stackstart;
             janet_fiber_cframe(fiber, janet_unwrap_cfunction(callee));
+            vm_trace_center(janet_unwrap_cfunction(callee));
             Janet ret = janet_unwrap_cfunction(callee)(argc, fiber->data + fiber->frame);
+            vm_trace_cexit(janet_unwrap_cfunction(callee));
             janet_fiber_popframe(fiber);
             stack = fiber->data + fiber->frame;
             stack[A] = ret;
             vm_checkgc_pcnext();
         } else {
             vm_commit();
-            stack[A] = call_nonfn(fiber, callee);
+            stack[A] = call_nonfn(fiber, callee, pc);
             vm_pcnext();
         }
     }
@@ -1013,9 +1335,10 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         }
         if (janet_checktype(callee, JANET_KEYWORD)) {
             vm_commit();
-            callee = resolve_method(callee, fiber);
+            callee = resolve_method(callee, fiber, pc);
         }
         if (janet_checktype(callee, JANET_FUNCTION)) {
+            JanetFuncDef *caller = func->def;
             func = janet_unwrap_function(callee);
             if (func->gc.flags & JANET_FUNCFLAG_TRACE) {
                 vm_do_trace(func, fiber->stacktop - fiber->stackstart, fiber->data + fiber->stackstart);
@@ -1026,8 +1349,11 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
                 janet_panicf("%v called with %d argument%s, expected %d",
                              callee, n, n == 1 ? "" : "s", func->def->arity);
             }
+            vm_trace_exit(caller);
+            vm_trace_enter(func->def);
             stack = fiber->data + fiber->frame;
             pc = func->def->bytecode;
+            vm_maybe_jit(1);
             vm_checkgc_next();
         } else {
             Janet retreg;
@@ -1036,11 +1362,14 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
             if (janet_checktype(callee, JANET_CFUNCTION)) {
                 int32_t argc = fiber->stacktop - fiber->stackstart;
                 janet_fiber_cframe(fiber, janet_unwrap_cfunction(callee));
+                vm_trace_center(janet_unwrap_cfunction(callee));
                 retreg = janet_unwrap_cfunction(callee)(argc, fiber->data + fiber->frame);
+                vm_trace_cexit(janet_unwrap_cfunction(callee));
                 janet_fiber_popframe(fiber);
             } else {
-                retreg = call_nonfn(fiber, callee);
+                retreg = call_nonfn(fiber, callee, pc);
             }
+            vm_trace_exit(func->def);
             janet_fiber_popframe(fiber);
             if (entrance_frame) {
                 vm_return_no_restore(JANET_SIGNAL_OK, retreg);
@@ -1127,12 +1456,16 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
 
     VM_OP(JOP_IN)
     vm_commit();
-    stack[A] = janet_in(stack[B], stack[C]);
+    if (janet_checktypes(stack[B], JANET_TFLAG_DICTIONARY)) {
+        stack[A] = janet_icache_get(stack[B], stack[C], pc);
+    } else {
+        stack[A] = janet_in(stack[B], stack[C]);
+    }
     vm_pcnext();
 
     VM_OP(JOP_GET)
     vm_commit();
-    stack[A] = janet_get(stack[B], stack[C]);
+    stack[A] = janet_icache_get(stack[B], stack[C], pc);
     vm_pcnext();
 
     VM_OP(JOP_GET_INDEX)
@@ -1148,6 +1481,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     VM_OP(JOP_MAKE_ARRAY) {
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
+        vm_commit();
         stack[D] = janet_wrap_array(janet_array_n(mem, count));
         fiber->stacktop = fiber->stackstart;
         vm_checkgc_pcnext();
@@ -1158,6 +1492,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     VM_OP(JOP_MAKE_BRACKET_TUPLE) {
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
+        vm_commit();
         const Janet *tup = janet_tuple_n(mem, count);
         if (opcode == JOP_MAKE_BRACKET_TUPLE)
             janet_tuple_flag(tup) |= JANET_TUPLE_FLAG_BRACKETCTOR;
@@ -1169,8 +1504,8 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     VM_OP(JOP_MAKE_TABLE) {
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
+        vm_commit();
         if (count & 1) {
-            vm_commit();
             janet_panicf("expected even number of arguments to table constructor, got %d", count);
         }
         JanetTable *table = janet_table(count / 2);
@@ -1184,8 +1519,8 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     VM_OP(JOP_MAKE_STRUCT) {
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
+        vm_commit();
         if (count & 1) {
-            vm_commit();
             janet_panicf("expected even number of arguments to struct constructor, got %d", count);
         }
         JanetKV *st = janet_struct_begin(count / 2);
@@ -1199,6 +1534,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     VM_OP(JOP_MAKE_STRING) {
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
+        vm_commit();
         JanetBuffer buffer;
         janet_buffer_init(&buffer, 10 * count);
         for (int32_t i = 0; i < count; i++)
@@ -1212,6 +1548,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     VM_OP(JOP_MAKE_BUFFER) {
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
+        vm_commit();
         JanetBuffer *buffer = janet_buffer(10 * count);
         for (int32_t i = 0; i < count; i++)
             janet_to_string_b(buffer, mem[i]);
@@ -1238,7 +1575,8 @@ JanetSignal janet_step(JanetFiber *fiber, Janet in, Janet *out) {
     }
 
     /* Get PC for setting breakpoints */
-    uint32_t *pc = janet_stack_frame(fiber->data + fiber->frame)->pc;
+    JanetStackFrame *frame = janet_stack_frame(fiber->data + fiber->frame);
+    uint32_t *pc = frame->pc;
 
     /* Check current opcode (sans debug flag). This tells us where the next or next two candidate
      * instructions will be. Usually it's the next instruction in memory,
@@ -1275,12 +1613,21 @@ JanetSignal janet_step(JanetFiber *fiber, Janet in, Janet *out) {
         *nextb |= 0x80;
     }
 
+    /* Machine code does not see the temporary breakpoints */
+#ifdef JANET_JIT
+    JanetFuncDef *def = frame->func ? frame->func->def : NULL;
+    if (def) janet_jit_invalidate(def);
+#endif
+
     /* Go */
     JanetSignal signal = janet_continue(fiber, in, out);
 
     /* Restore */
     if (nexta) *nexta = olda;
     if (nextb) *nextb = oldb;
+#ifdef JANET_JIT
+    if (def) janet_jit_invalidate(def);
+#endif
 
     return signal;
 }
@@ -1310,9 +1657,11 @@ Janet janet_call(JanetFunction *fun, int32_t argc, const Janet *argv) {
         janet_panicf("arity mismatch in %v, expected at most %d, got %d", funv, max, argc);
     }
     janet_fiber_frame(janet_vm.fiber)->flags |= JANET_STACKFRAME_ENTRANCE;
+    vm_trace_enter(fun->def);
 
     /* Set up */
     int32_t oldn = janet_vm.stackn++;
+    int32_t old_depth = janet_vm.resume_depth++;
     int handle = janet_gclock();
 
     /* Run vm */
@@ -1321,6 +1670,7 @@ Janet janet_call(JanetFunction *fun, int32_t argc, const Janet *argv) {
 
     /* Teardown */
     janet_vm.stackn = oldn;
+    janet_vm.resume_depth = old_depth;
     janet_gcunlock(handle);
 
     if (signal != JANET_SIGNAL_OK) {
@@ -1370,6 +1720,7 @@ void janet_try_init(JanetTryState *state) {
     state->vm_fiber = janet_vm.fiber;
     state->vm_jmp_buf = janet_vm.signal_buf;
     state->vm_return_reg = janet_vm.return_reg;
+    state->buffer_borrows = janet_vm.buffer_borrows.count;
     janet_vm.return_reg = &(state->payload);
     janet_vm.signal_buf = &(state->buf);
 }
@@ -1380,6 +1731,7 @@ void janet_restore(JanetTryState *state) {
     janet_vm.fiber = state->vm_fiber;
     janet_vm.signal_buf = state->vm_jmp_buf;
     janet_vm.return_reg = state->vm_return_reg;
+    janet_buffer_unborrow_scope(state->buffer_borrows);
 }
 
 static JanetSignal janet_continue_no_check(JanetFiber *fiber, Janet in, Janet *out) {
@@ -1390,6 +1742,10 @@ static JanetSignal janet_continue_no_check(JanetFiber *fiber, Janet in, Janet *o
     janet_fiber_did_resume(fiber);
 #endif
 
+    janet_gc_arena_enter(fiber);
+    janet_probe1(fiber__resume, fiber);
+    janet_trace(JANET_TRACE_FIBERS, JANET_TRACE_RESUME, 0, fiber);
+
     /* Clear last value */
     fiber->last_value = janet_wrap_nil();
 
@@ -1399,12 +1755,17 @@ static JanetSignal janet_continue_no_check(JanetFiber *fiber, Janet in, Janet *o
         JanetFiber *child = fiber->child;
         uint32_t instr = (janet_stack_frame(fiber->data + fiber->frame)->pc)[0];
         janet_vm.stackn++;
-        JanetSignal sig = janet_continue(child, in, &in);
+        /* Resuming the child is part of this resume, so it does not count as deeper */
+        JanetSignal sig = janet_check_can_resume(child, &in, 0);
+        if (!sig) sig = janet_continue_no_check(child, in, &in);
         janet_vm.stackn--;
         if (janet_vm.root_fiber == fiber) janet_vm.root_fiber = NULL;
         if (sig != JANET_SIGNAL_OK && !(child->flags & (1 << sig))) {
             *out = in;
             janet_fiber_set_status(fiber, sig);
+            janet_trace(JANET_TRACE_FIBERS, JANET_TRACE_STOP, sig, fiber);
+            janet_probe2(fiber__stop, fiber, sig);
+            janet_gc_arena_exit(fiber, sig, in);
             return sig;
         }
         /* Check if we need any special handling for certain opcodes */
@@ -1429,6 +1790,12 @@ static JanetSignal janet_continue_no_check(JanetFiber *fiber, Janet in, Janet *o
         fiber->child = NULL;
     }
 
+    /* The function of a new fiber is entered here rather than by a call */
+    if (old_status == JANET_STATUS_NEW) {
+        JanetFunction *func = janet_stack_frame(fiber->data + fiber->frame)->func;
+        if (func) vm_trace_enter(func->def);
+    }
+
     /* Handle new fibers being resumed with a non-nil value */
     if (old_status == JANET_STATUS_NEW && !janet_checktype(in, JANET_NIL)) {
         Janet *stack = fiber->data + fiber->frame;
@@ -1456,9 +1823,13 @@ static JanetSignal janet_continue_no_check(JanetFiber *fiber, Janet in, Janet *o
     /* Restore */
     if (janet_vm.root_fiber == fiber) janet_vm.root_fiber = NULL;
     janet_fiber_set_status(fiber, sig);
+    if (sig == JANET_SIGNAL_OK) janet_fiber_release_stack(fiber);
     janet_restore(&tstate);
     fiber->last_value = tstate.payload;
     *out = tstate.payload;
+    janet_trace(JANET_TRACE_FIBERS, JANET_TRACE_STOP, sig, fiber);
+    janet_probe2(fiber__stop, fiber, sig);
+    janet_gc_arena_exit(fiber, sig, tstate.payload);
 
     return sig;
 }
@@ -1468,7 +1839,10 @@ JanetSignal janet_continue(JanetFiber *fiber, Janet in, Janet *out) {
     /* Check conditions */
     JanetSignal tmp_signal = janet_check_can_resume(fiber, out, 0);
     if (tmp_signal) return tmp_signal;
-    return janet_continue_no_check(fiber, in, out);
+    int32_t depth = janet_vm.resume_depth++;
+    JanetSignal sig = janet_continue_no_check(fiber, in, out);
+    janet_vm.resume_depth = depth;
+    return sig;
 }
 
 /* Enter the main vm loop but immediately raise a signal */
@@ -1482,7 +1856,10 @@ JanetSignal janet_continue_signal(JanetFiber *fiber, Janet in, Janet *out, Janet
         child->gc.flags |= sig << JANET_FIBER_STATUS_OFFSET;
         child->flags |= JANET_FIBER_RESUME_SIGNAL;
     }
-    return janet_continue_no_check(fiber, in, out);
+    int32_t depth = janet_vm.resume_depth++;
+    JanetSignal result = janet_continue_no_check(fiber, in, out);
+    janet_vm.resume_depth = depth;
+    return result;
 }
 
 JanetSignal janet_pcall(
@@ -1524,9 +1901,46 @@ int janet_init(void) {
 
     /* Garbage collection */
     janet_vm.blocks = NULL;
+    janet_vm.old_blocks = NULL;
     janet_vm.next_collection = 0;
     janet_vm.gc_interval = 0x400000;
     janet_vm.block_count = 0;
+    janet_vm.old_block_count = 0;
+    janet_vm.major_block_limit = 0;
+    janet_vm.gc_remembered.items = NULL;
+    janet_vm.gc_remembered.count = 0;
+    janet_vm.gc_remembered.capacity = 0;
+    janet_vm.gc_rescan.items = NULL;
+    janet_vm.gc_rescan.count = 0;
+    janet_vm.gc_rescan.capacity = 0;
+    janet_vm.buffer_borrows.items = NULL;
+    janet_vm.buffer_borrows.count = 0;
+    janet_vm.buffer_borrows.capacity = 0;
+    memset(janet_vm.gc_pools, 0, sizeof(janet_vm.gc_pools));
+    janet_vm.gc_pool_chunks = NULL;
+    memset(janet_vm.fiber_pool, 0, sizeof(janet_vm.fiber_pool));
+    memset(janet_vm.fiber_pool_count, 0, sizeof(janet_vm.fiber_pool_count));
+    janet_vm.gc_phase = JANET_GC_IDLE;
+    janet_vm.gc_step_budget = 0;
+    janet_vm.gc_gray.items = NULL;
+    janet_vm.gc_gray.count = 0;
+    janet_vm.gc_gray.capacity = 0;
+    janet_vm.gc_cursor = NULL;
+    memset(&janet_vm.gc_stats, 0, sizeof(janet_vm.gc_stats));
+    janet_vm.gc_freed_blocks = 0;
+    janet_vm.gc_freed_bytes = 0;
+    janet_vm.gc_hook = NULL;
+    janet_vm.gc_hook_data = NULL;
+    janet_vm.gc_arena_fiber = NULL;
+    janet_vm.gc_arena = NULL;
+    janet_vm.gc_arena_tail = NULL;
+    janet_vm.gc_arena_count = 0;
+    janet_vm.gc_sample_rate = 0;
+    janet_vm.gc_sample_countdown = 0;
+    janet_vm.gc_samples = NULL;
+    janet_vm.gc_sample_count = 0;
+    janet_vm.gc_sample_capacity = 0;
+    janet_vm.gc_sample_next = 0;
 
     janet_symcache_init();
 
@@ -1555,12 +1969,49 @@ int janet_init(void) {
     janet_vm.traversal = NULL;
     janet_vm.traversal_base = NULL;
     janet_vm.traversal_top = NULL;
+    janet_vm.missing_kv.key = janet_wrap_nil();
+    janet_vm.missing_kv.value = janet_wrap_nil();
+
+    /* Inline caches */
+    janet_vm.icache = janet_calloc(JANET_ICACHE_SIZE, sizeof(JanetInlineCache));
+    if (NULL == janet_vm.icache) {
+        JANET_OUT_OF_MEMORY;
+    }
 
     /* Core env */
     janet_vm.core_env = NULL;
 
     /* Auto suspension */
     janet_vm.auto_suspend = 0;
+    janet_vm.resume_depth = 0;
+    janet_vm.slice_depth = -1;
+    janet_vm.slice_preempted = 0;
+
+#ifdef JANET_OPCODE_STATS
+    /* Opcode statistics */
+    janet_vm.opcode_counts = janet_calloc(JOP_INSTRUCTION_COUNT * (JOP_INSTRUCTION_COUNT + 1), sizeof(uint64_t));
+    if (NULL == janet_vm.opcode_counts) {
+        JANET_OUT_OF_MEMORY;
+    }
+    janet_vm.opcode_pairs = janet_vm.opcode_counts + JOP_INSTRUCTION_COUNT;
+    janet_vm.opcode_last = JOP_INSTRUCTION_COUNT;
+#endif
+
+    /* Sampling profiler */
+    janet_vm.profile_request = 0;
+    janet_vm.profiler = NULL;
+    janet_vm.profile_samples = NULL;
+    janet_vm.profile_capacity = 0;
+    janet_vm.profile_count = 0;
+    janet_vm.profile_next = 0;
+
+    /* Structured tracing */
+    janet_vm.trace_mask = 0;
+    janet_vm.trace_events = NULL;
+    janet_vm.trace_capacity = 0;
+    janet_vm.trace_head = 0;
+    janet_vm.trace_tail = 0;
+    janet_vm.trace_dropped = 0;
 
     /* Dynamic bindings */
     janet_vm.top_dyns = NULL;
@@ -1584,6 +2035,10 @@ int janet_init(void) {
 
 /* Clear all memory associated with the VM */
 void janet_deinit(void) {
+#if !defined(JANET_SINGLE_THREADED) && !defined(JANET_NO_INTERPRETER_INTERRUPT)
+    janet_profile_stop();
+#endif
+    janet_vm.trace_mask = 0;
     janet_clear_memory();
     janet_symcache_deinit();
     janet_free(janet_vm.roots);
@@ -1595,6 +2050,20 @@ void janet_deinit(void) {
     janet_vm.top_dyns = NULL;
     janet_vm.user = NULL;
     janet_free(janet_vm.traversal_base);
+    janet_free(janet_vm.icache);
+    janet_vm.icache = NULL;
+#ifdef JANET_OPCODE_STATS
+    janet_free(janet_vm.opcode_counts);
+    janet_vm.opcode_counts = NULL;
+    janet_vm.opcode_pairs = NULL;
+#endif
+    janet_free(janet_vm.profile_samples);
+    janet_vm.profile_samples = NULL;
+    janet_vm.profile_capacity = 0;
+    janet_vm.profile_count = 0;
+    janet_free(janet_vm.trace_events);
+    janet_vm.trace_events = NULL;
+    janet_vm.trace_capacity = 0;
     janet_vm.fiber = NULL;
     janet_vm.root_fiber = NULL;
     janet_free(janet_vm.registry);
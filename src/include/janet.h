@@ -173,6 +173,11 @@ extern "C" {
 #define JANET_PEG
 #endif
 
+/* Enable or disable the json module */
+#ifndef JANET_NO_JSON
+#define JANET_JSON
+#endif
+
 /* Enable or disable event loop */
 #if !defined(JANET_NO_EV) && !defined(__EMSCRIPTEN__)
 #define JANET_EV
@@ -188,8 +193,23 @@ extern "C" {
 #define JANET_INT_TYPES
 #endif
 
+/* Enable or disable typed arrays of unboxed numbers */
+#ifndef JANET_NO_TYPED_ARRAY
+#define JANET_TYPED_ARRAY
+#endif
+
+/* Enable or disable pooled allocation of small gc objects and fiber stacks */
+#ifndef JANET_NO_GC_POOL
+#define JANET_GC_POOL
+#endif
+
+/* Use io_uring instead of epoll on Linux (opt in, needs Linux 5.11 or later) */
+#if defined(JANET_EV_URING) && !defined(JANET_LINUX)
+#undef JANET_EV_URING
+#endif
+
 /* Enable or disable epoll on Linux */
-#if defined(JANET_LINUX) && !defined(JANET_EV_NO_EPOLL)
+#if defined(JANET_LINUX) && !defined(JANET_EV_NO_EPOLL) && !defined(JANET_EV_URING)
 #define JANET_EV_EPOLL
 #endif
 
@@ -257,6 +277,13 @@ extern "C" {
 #endif
 #endif
 
+/* Enable or disable the JIT. Machine code is only generated for
+ * nanboxed values on x86-64 System V platforms. */
+#if !defined(JANET_NO_JIT) && defined(JANET_NANBOX_64) && defined(__x86_64__) && \
+    !defined(JANET_WINDOWS) && !defined(JANET_OPCODE_STATS)
+#define JANET_JIT
+#endif
+
 /* Runtime config constants */
 #ifdef JANET_NO_NANBOX
 #define JANET_NANBOX_BIT 0
@@ -548,6 +575,8 @@ typedef void *JanetAbstract;
 #define JANET_STREAM_WRITABLE 0x400
 #define JANET_STREAM_ACCEPTABLE 0x800
 #define JANET_STREAM_UDPSERVER 0x1000
+#define JANET_STREAM_COALESCE 0x2000
+#define JANET_STREAM_FILE 0x4000
 
 typedef enum {
     JANET_ASYNC_EVENT_INIT,
@@ -587,6 +616,9 @@ struct JanetStream {
      * this constraint may be lifted later but allowing such would require more internal book keeping
      * for some implementations. You can read and write at the same time on the same stream, though. */
     int _mask;
+#ifdef JANET_EV_URING
+    void *_uring; /* Outstanding io_uring poll for this stream */
+#endif
 };
 
 /* Interface for state machine based event loop */
@@ -891,6 +923,7 @@ struct JanetFiber {
     JanetListenerState *waiting;
     uint32_t sched_id; /* Increment everytime fiber is scheduled by event loop */
     void *supervisor_channel; /* Channel to push self to when complete */
+    void *timeout; /* Pending event loop timeout, cancelled when the fiber is rescheduled */
 #endif
 };
 
@@ -991,6 +1024,9 @@ struct JanetAbstractHead {
 #define JANET_FUNCDEF_FLAG_HASSOURCEMAP 0x800000
 #define JANET_FUNCDEF_FLAG_STRUCTARG 0x1000000
 #define JANET_FUNCDEF_FLAG_HASCLOBITSET 0x2000000
+#define JANET_FUNCDEF_FLAG_NUMBER_MATH 0x4000000
+#define JANET_FUNCDEF_FLAG_NUMBER_COMPARE 0x8000000
+#define JANET_FUNCDEF_FLAG_HASCAPTURES 0x10000000
 #define JANET_FUNCDEF_FLAG_TAG 0xFFFF
 
 /* Source mapping structure for a bytecode instruction */
@@ -1007,6 +1043,7 @@ struct JanetFuncDef {
     JanetFuncDef **defs;
     uint32_t *bytecode;
     uint32_t *closure_bitset; /* Bit set indicating which slots can be referenced by closures. */
+    int32_t *captures; /* Slots of the parent copied into a new environment when a closure is created. */
 
     /* Various debug information */
     JanetSourceMapping *sourcemap;
@@ -1022,6 +1059,14 @@ struct JanetFuncDef {
     int32_t bytecode_length;
     int32_t environments_length;
     int32_t defs_length;
+    int32_t captures_length;
+
+    /* Machine code, when the JIT is enabled */
+    void *jit;
+
+    /* Body that has not been unmarshalled yet, for funcdefs loaded lazily */
+    void *lazy;
+    int32_t hotness;
 };
 
 /* A function environment */
@@ -1097,6 +1142,7 @@ struct JanetAbstractType {
     int32_t (*hash)(void *p, size_t len);
     Janet(*next)(void *p, Janet key);
     Janet(*call)(void *p, int32_t argc, Janet *argv);
+    JanetByteView(*bytes)(void *p, size_t len);
 };
 
 /* Some macros to let us add extra types to JanetAbstract types without
@@ -1114,7 +1160,8 @@ struct JanetAbstractType {
 #define JANET_ATEND_COMPARE     NULL,JANET_ATEND_HASH
 #define JANET_ATEND_HASH        NULL,JANET_ATEND_NEXT
 #define JANET_ATEND_NEXT        NULL,JANET_ATEND_CALL
-#define JANET_ATEND_CALL
+#define JANET_ATEND_CALL        NULL,JANET_ATEND_BYTES
+#define JANET_ATEND_BYTES
 
 struct JanetReg {
     const char *name;
@@ -1175,6 +1222,7 @@ typedef struct {
     JanetFiber *vm_fiber;
     jmp_buf *vm_jmp_buf;
     Janet *vm_return_reg;
+    size_t buffer_borrows;
     /* new state */
     jmp_buf buf;
     Janet payload;
@@ -1302,6 +1350,29 @@ enum JanetOpCode {
     JOP_NOT_EQUALS,
     JOP_NOT_EQUALS_IMMEDIATE,
     JOP_CANCEL,
+    JOP_LESS_THAN_JUMP_IF_NOT,
+    JOP_LESS_THAN_EQUAL_JUMP_IF_NOT,
+    JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT,
+    JOP_GREATER_THAN_JUMP_IF_NOT,
+    JOP_GREATER_THAN_EQUAL_JUMP_IF_NOT,
+    JOP_GREATER_THAN_IMMEDIATE_JUMP_IF_NOT,
+    JOP_EQUALS_JUMP_IF_NOT,
+    JOP_EQUALS_IMMEDIATE_JUMP_IF_NOT,
+    JOP_NOT_EQUALS_JUMP_IF_NOT,
+    JOP_NOT_EQUALS_IMMEDIATE_JUMP_IF_NOT,
+    JOP_ADD_IMMEDIATE_JUMP,
+    JOP_ADD_NUMBER,
+    JOP_SUBTRACT_NUMBER,
+    JOP_MULTIPLY_NUMBER,
+    JOP_DIVIDE_NUMBER,
+    JOP_ADD_IMMEDIATE_NUMBER,
+    JOP_MULTIPLY_IMMEDIATE_NUMBER,
+    JOP_DIVIDE_IMMEDIATE_NUMBER,
+    JOP_LESS_THAN_NUMBER,
+    JOP_LESS_THAN_EQUAL_NUMBER,
+    JOP_GREATER_THAN_NUMBER,
+    JOP_GREATER_THAN_EQUAL_NUMBER,
+    JOP_JUMP_TABLE,
     JOP_INSTRUCTION_COUNT
 };
 
@@ -1352,6 +1423,8 @@ JANET_API Janet janet_cfun_stream_close(int32_t argc, Janet *argv);
 JANET_API Janet janet_cfun_stream_read(int32_t argc, Janet *argv);
 JANET_API Janet janet_cfun_stream_chunk(int32_t argc, Janet *argv);
 JANET_API Janet janet_cfun_stream_write(int32_t argc, Janet *argv);
+JANET_API Janet janet_cfun_stream_pread(int32_t argc, Janet *argv);
+JANET_API Janet janet_cfun_stream_pwrite(int32_t argc, Janet *argv);
 JANET_API void janet_stream_flags(JanetStream *stream, uint32_t flags);
 
 /* Queue a fiber to run on the event loop */
@@ -1379,6 +1452,13 @@ JANET_API void *janet_abstract_threaded(const JanetAbstractType *atype, size_t s
 JANET_API int32_t janet_abstract_incref(void *abst);
 JANET_API int32_t janet_abstract_decref(void *abst);
 
+/* Snapshot an environment, by default the core environment, into a template.
+ * janet_vm_template_load builds a copy of the environment in a new VM, after janet_init,
+ * in place of janet_core_env. The template is a threaded abstract; code that passes it
+ * between threads outside of a VM should hold a reference with janet_abstract_incref. */
+JANET_API void *janet_vm_template(JanetTable *env);
+JANET_API JanetTable *janet_vm_template_load(void *tpl);
+
 /* Expose some OS sync primitives to make portable abstract types easier to implement */
 JANET_API void janet_os_mutex_init(JanetOSMutex *mutex);
 JANET_API void janet_os_mutex_deinit(JanetOSMutex *mutex);
@@ -1451,9 +1531,11 @@ JANET_API void janet_ev_recvfrom(JanetStream *stream, JanetBuffer *buf, int32_t
 /* Write async to a stream */
 JANET_API void janet_ev_write_buffer(JanetStream *stream, JanetBuffer *buf);
 JANET_API void janet_ev_write_string(JanetStream *stream, JanetString str);
+JANET_API void janet_ev_write_parts(JanetStream *stream, Janet parts);
 #ifdef JANET_NET
 JANET_API void janet_ev_send_buffer(JanetStream *stream, JanetBuffer *buf, int flags);
 JANET_API void janet_ev_send_string(JanetStream *stream, JanetString str, int flags);
+JANET_API void janet_ev_send_parts(JanetStream *stream, Janet parts, int flags);
 JANET_API void janet_ev_sendto_buffer(JanetStream *stream, JanetBuffer *buf, void *dest, int flags);
 JANET_API void janet_ev_sendto_string(JanetStream *stream, JanetString str, void *dest, int flags);
 #endif
@@ -1465,6 +1547,7 @@ extern JANET_API const JanetAbstractType janet_parser_type;
 JANET_API void janet_parser_init(JanetParser *parser);
 JANET_API void janet_parser_deinit(JanetParser *parser);
 JANET_API void janet_parser_consume(JanetParser *parser, uint8_t c);
+JANET_API size_t janet_parser_consume_bytes(JanetParser *parser, const uint8_t *bytes, size_t len);
 JANET_API enum JanetParserStatus janet_parser_status(JanetParser *parser);
 JANET_API Janet janet_parser_produce(JanetParser *parser);
 JANET_API Janet janet_parser_produce_wrapped(JanetParser *parser);
@@ -1631,6 +1714,9 @@ JANET_API Janet janet_struct_get_ex(JanetStruct st, Janet key, JanetStruct *whic
 JANET_API JanetTable *janet_struct_to_table(JanetStruct st);
 JANET_API const JanetKV *janet_struct_find(JanetStruct st, Janet key);
 
+/* Persistent hash maps */
+extern JANET_API const JanetAbstractType janet_hmap_type;
+
 /* Table functions */
 JANET_API JanetTable *janet_table(int32_t capacity);
 JANET_API JanetTable *janet_table_init(JanetTable *table, int32_t capacity);
@@ -1676,8 +1762,11 @@ typedef void (*JanetModule)(JanetTable *);
 typedef JanetBuildConfig(*JanetModconf)(void);
 JANET_API JanetModule janet_native(const char *name, JanetString *error);
 
-/* Marshaling */
+/* Marshaling. Output marshalled with JANET_MARSHAL_UNSAFE can hold raw pointers that are
+ * trusted as is when unmarshalled with the same flag, so never unmarshal untrusted bytes
+ * with it. */
 #define JANET_MARSHAL_UNSAFE 0x20000
+#define JANET_MARSHAL_COMPACT 0x100000
 
 JANET_API void janet_marshal(
     JanetBuffer *buf,
@@ -1694,9 +1783,48 @@ JANET_API JanetTable *janet_env_lookup(JanetTable *env);
 JANET_API void janet_env_lookup_into(JanetTable *renv, JanetTable *env, const char *prefix, int recurse);
 
 /* GC */
+
+/* Garbage collection statistics. Times are in seconds. Each step of an
+ * incremental collection counts as a separate pause for the maximum times. */
+typedef struct {
+    size_t collections;
+    size_t major_collections;
+    double mark_time;
+    double mark_time_max;
+    double sweep_time;
+    double sweep_time_max;
+    size_t block_count;
+    size_t next_collection;
+    size_t last_freed_blocks;
+    size_t last_freed_bytes;
+} JanetGCStats;
+
+/* Number and approximate size of the objects of one type on the heap */
+#define JANET_GC_TYPE_COUNT 14
+typedef struct {
+    const char *name;
+    size_t count;
+    size_t bytes;
+} JanetGCTypeStats;
+
+/* Called after every collection, or at the end of an incremental collection */
+typedef void (*JanetGCHook)(const JanetGCStats *stats, int major, void *data);
+
+/* A sampled allocation. def and pc are the function and bytecode offset of the
+ * innermost janet function running when the block was allocated, or NULL and 0
+ * if there was none. type is the memory type of the block. */
+typedef struct {
+    JanetFuncDef *def;
+    int32_t pc;
+    int32_t type;
+    size_t size;
+} JanetGCSample;
+
 JANET_API void janet_mark(Janet x);
 JANET_API void janet_sweep(void);
 JANET_API void janet_collect(void);
+JANET_API void janet_collect_minor(void);
+JANET_API void janet_gcbarrier(void *mem);
 JANET_API void janet_clear_memory(void);
 JANET_API void janet_gcroot(Janet root);
 JANET_API int janet_gcunroot(Janet root);
@@ -1704,6 +1832,13 @@ JANET_API int janet_gcunrootall(Janet root);
 JANET_API int janet_gclock(void);
 JANET_API void janet_gcunlock(int handle);
 JANET_API void janet_gcpressure(size_t s);
+JANET_API void janet_gcstats(JanetGCStats *stats);
+JANET_API void janet_gcstats_types(JanetGCTypeStats *types);
+JANET_API void janet_gcsethook(JanetGCHook hook, void *data);
+JANET_API void janet_heap_snapshot(JanetBuffer *buffer);
+JANET_API void janet_gcsample(size_t rate);
+JANET_API size_t janet_gcsamples(const JanetGCSample **samples);
+JANET_API void janet_gcsamples_clear(void);
 
 /* Functions */
 JANET_API JanetFuncDef *janet_funcdef_alloc(void);
@@ -1747,6 +1882,43 @@ JANET_API int janet_streq(Janet x, const char *cstring);
 JANET_API int janet_symeq(Janet x, const char *cstring);
 JANET_API int32_t janet_sorted_keys(const JanetKV *dict, int32_t cap, int32_t *index_buffer);
 
+/* Kinds of structured trace events, as a mask for janet_trace_start */
+#define JANET_TRACE_CALLS 0x1
+#define JANET_TRACE_FIBERS 0x2
+#define JANET_TRACE_GC 0x4
+#define JANET_TRACE_EV 0x8
+#define JANET_TRACE_ALL 0xF
+
+typedef enum {
+    JANET_TRACE_ENTER,
+    JANET_TRACE_EXIT,
+    JANET_TRACE_RESUME,
+    JANET_TRACE_STOP,
+    JANET_TRACE_GC_BEGIN,
+    JANET_TRACE_GC_END,
+    JANET_TRACE_LISTENER
+} JanetTraceType;
+
+/* Values of arg for JANET_TRACE_GC_BEGIN and JANET_TRACE_GC_END */
+typedef enum {
+    JANET_TRACE_GC_MAJOR,
+    JANET_TRACE_GC_MINOR,
+    JANET_TRACE_GC_STEP,
+    JANET_TRACE_GC_ARENA
+} JanetTraceGCKind;
+
+/* A structured trace event. For JANET_TRACE_ENTER and JANET_TRACE_EXIT, subject is a
+ * JanetFuncDef, or a JanetCFunction if arg is 1. For fiber events it is the JanetFiber,
+ * and arg is the signal the fiber stopped with. For JANET_TRACE_LISTENER it is the
+ * JanetStream, and arg is the JanetAsyncEvent. Time is in nanoseconds from a
+ * monotonic clock. */
+typedef struct {
+    uint64_t time;
+    uint32_t type;
+    uint32_t arg;
+    const void *subject;
+} JanetTraceEvent;
+
 /* VM functions */
 JANET_API int janet_init(void);
 JANET_API void janet_deinit(void);
@@ -1756,6 +1928,15 @@ JANET_API void janet_vm_free(JanetVM *vm);
 JANET_API void janet_vm_save(JanetVM *into);
 JANET_API void janet_vm_load(JanetVM *from);
 JANET_API void janet_interpreter_interrupt(JanetVM *vm);
+#if !defined(JANET_SINGLE_THREADED) && !defined(JANET_NO_INTERPRETER_INTERRUPT)
+JANET_API void janet_profile_start(int32_t hz, size_t capacity);
+JANET_API void janet_profile_stop(void);
+#endif
+JANET_API void janet_profile_folded(JanetBuffer *buffer);
+JANET_API void janet_profile_clear(void);
+JANET_API void janet_trace_start(uint32_t mask, size_t capacity);
+JANET_API void janet_trace_stop(void);
+JANET_API size_t janet_trace_drain(JanetVM *vm, JanetTraceEvent *out, size_t max);
 JANET_API JanetSignal janet_continue(JanetFiber *fiber, Janet in, Janet *out);
 JANET_API JanetSignal janet_continue_signal(JanetFiber *fiber, Janet in, Janet *out, JanetSignal sig);
 JANET_API JanetSignal janet_pcall(JanetFunction *fun, int32_t argn, const Janet *argv, Janet *out, JanetFiber **f);
@@ -1963,6 +2144,7 @@ JANET_API Janet janet_dyn(const char *name);
 JANET_API void janet_setdyn(const char *name, Janet value);
 
 extern JANET_API const JanetAbstractType janet_file_type;
+extern JANET_API const JanetAbstractType janet_mmap_type;
 
 #define JANET_FILE_WRITE 1
 #define JANET_FILE_READ 2
@@ -2045,7 +2227,11 @@ typedef enum {
     RULE_LINE,         /* [tag] */
     RULE_COLUMN,       /* [tag] */
     RULE_UNREF,        /* [rule, tag] */
-    RULE_CAPTURE_NUM   /* [rule, tag] */
+    RULE_CAPTURE_NUM,  /* [rule, tag] */
+    RULE_SPAN,         /* [lo, hi, bitmap (8 words)] */
+    RULE_DISPATCH,     /* [len, words, rules..., candidates (257 * words)] */
+    RULE_MEMO,         /* [rule] */
+    RULE_PROFILE       /* [rule, constant] */
 } JanetPegOpcod;
 
 typedef struct {
@@ -2079,6 +2265,36 @@ JANET_API int janet_scan_uint64(const uint8_t *str, int32_t len, uint64_t *out);
 
 #endif
 
+#ifdef JANET_TYPED_ARRAY
+
+extern JANET_API const JanetAbstractType janet_tarray_type;
+
+typedef enum {
+    JANET_TARRAY_U8,
+    JANET_TARRAY_S8,
+    JANET_TARRAY_U16,
+    JANET_TARRAY_S16,
+    JANET_TARRAY_U32,
+    JANET_TARRAY_S32,
+    JANET_TARRAY_F32,
+    JANET_TARRAY_F64
+} JanetTArrayType;
+
+/* A view of length elements starting offset bytes into buffer */
+typedef struct {
+    JanetBuffer *buffer;
+    int32_t offset;
+    int32_t length;
+    JanetTArrayType type;
+} JanetTArray;
+
+JANET_API JanetTArray *janet_tarray(JanetTArrayType type, int32_t length);
+JANET_API JanetTArray *janet_tarray_view(JanetTArrayType type, JanetBuffer *buffer, int32_t offset, int32_t length);
+JANET_API void *janet_tarray_data(JanetTArray *ta);
+JANET_API JanetTArray *janet_gettarray(const Janet *argv, int32_t n);
+
+#endif
+
 #ifdef JANET_THREADS
 
 extern JANET_API const JanetAbstractType janet_thread_type;